@@ -0,0 +1,55 @@
+#pragma once
+
+// Minimal utility for the benchmarks in this directory.
+// Every benchmark is a simple executable (registered via meson's
+// benchmark function) that prints its results to stdout.
+
+#include <chrono>
+#include <cstdio>
+#include <atomic>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Prevents the compiler from optimizing away the computation
+// of the given value.
+template<typename T>
+void consume(const T& val) {
+	static std::atomic<const void*> sink;
+	sink.store(&val, std::memory_order_relaxed);
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+// Runs the given function 'iterations' times (after a short warmup)
+// and returns the average time of one run in nanoseconds.
+template<typename F>
+double measure(unsigned iterations, F&& func) {
+	for(auto i = 0u; i < iterations / 10 + 1; ++i) {
+		func();
+	}
+
+	auto start = Clock::now();
+	for(auto i = 0u; i < iterations; ++i) {
+		func();
+	}
+
+	auto diff = Clock::now() - start;
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count();
+	return double(ns) / iterations;
+}
+
+// Measures the given function once, returns the time in milliseconds.
+template<typename F>
+double measureOnce(F&& func) {
+	auto start = Clock::now();
+	func();
+	auto diff = Clock::now() - start;
+	return std::chrono::duration<double, std::milli>(diff).count();
+}
+
+inline void print(const char* name, double ns) {
+	std::printf("%-40s %12.1f ns\n", name, ns);
+}
+
+} // namespace bench
@@ -0,0 +1,114 @@
+// Benchmarks the instance bvh (tkn/scene/bvh.hpp) with 100k instances:
+// building, refitting, frustum culling and ray queries.
+
+#include <tkn/scene/bvh.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include "bench.hpp"
+
+#include <random>
+#include <cstdio>
+
+using namespace tkn;
+
+int main() {
+	constexpr auto count = 100 * 1000u;
+
+	// instances scattered in a city-like layout: mostly on the
+	// ground plane, some of them larger
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> pos(-500.f, 500.f);
+	std::uniform_real_distribution<float> height(0.f, 20.f);
+	std::exponential_distribution<float> size(1.f);
+
+	std::vector<Aabb> bounds(count);
+	for(auto& box : bounds) {
+		auto s = 0.5f + size(rng);
+		box.min = {pos(rng), height(rng), pos(rng)};
+		box.max = box.min + Vec3f{s, 2 * s, s};
+	}
+
+	auto& pool = ThreadPool::instance();
+	Bvh bvh;
+
+	auto build = bench::measureOnce([&]{ bvh.build(bounds, &pool); });
+	std::printf("%u instances, %u threads\n", count, pool.numWorkers() + 1);
+	std::printf("  %-36s %10zu\n", "nodes", bvh.nodes().size());
+	std::printf("  %-36s %10.2f\n", "sah cost", bvh.sahCost());
+	std::printf("  %-36s %10.2f ms\n", "build", build);
+
+	// moving all instances a bit
+	auto refit = bench::measureOnce([&]{
+		for(auto& box : bounds) {
+			box.min.y += 0.1f;
+			box.max.y += 0.1f;
+		}
+		bvh.refit(bounds);
+	});
+	std::printf("  %-36s %10.2f ms\n", "refit (including moving)", refit);
+
+	// A camera standing in the scene, looking along +z with a 90 degree
+	// field of view and a far plane at 300.
+	auto near = 0.1f;
+	auto far = 300.f;
+	Frustum frustum = {{
+		{-near, near, near}, {near, near, near},
+		{near, -near, near}, {-near, -near, near},
+		{-far, far, far}, {far, far, far},
+		{far, -far, far}, {-far, -far, far},
+	}};
+	for(auto& p : frustum) {
+		p += Vec3f{0.f, 10.f, 0.f};
+	}
+
+	auto planes = frustumPlanes(frustum);
+	std::vector<u32> visible;
+	visible.reserve(count);
+	auto cull = bench::measure(100, [&]{
+		visible.clear();
+		bvh.cull(planes, visible);
+		bench::consume(visible.data());
+	});
+
+	std::printf("  %-36s %10zu\n", "visible", visible.size());
+	std::printf("  %-36s %10.2f ms\n", "cull", cull / 1e6);
+
+	// naive reference: testing every instance
+	auto naive = bench::measure(20, [&]{
+		visible.clear();
+		for(auto i = 0u; i < count; ++i) {
+			auto& box = bounds[i];
+			auto in = true;
+			for(auto& p : planes) {
+				auto v = Vec3f{
+					p[0] >= 0.f ? box.max.x : box.min.x,
+					p[1] >= 0.f ? box.max.y : box.min.y,
+					p[2] >= 0.f ? box.max.z : box.min.z};
+				in &= (p[0] * v.x + p[1] * v.y + p[2] * v.z + p[3] >= 0.f);
+			}
+
+			if(in) {
+				visible.push_back(i);
+			}
+		}
+		bench::consume(visible.data());
+	});
+	std::printf("  %-36s %10.2f ms\n", "cull (all instances, no bvh)", naive / 1e6);
+
+	// picking rays from the camera position
+	std::uniform_real_distribution<float> dir(-1.f, 1.f);
+	std::vector<Vec3f> dirs(1000);
+	for(auto& d : dirs) {
+		d = nytl::normalized(Vec3f{dir(rng), 0.2f * dir(rng), 1.f});
+	}
+
+	std::vector<Bvh::RayHit> hits;
+	auto ray = bench::measure(10, [&]{
+		for(auto& d : dirs) {
+			hits.clear();
+			bvh.raycast({0.f, 10.f, 0.f}, d, far, hits);
+			bench::consume(hits.data());
+		}
+	});
+	std::printf("  %-36s %10.2f us\n", "raycast", ray / (1e3 * dirs.size()));
+}
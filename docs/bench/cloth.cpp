@@ -0,0 +1,256 @@
+// Mass-spring cloth stepping: the original array-of-structures
+// implementation of src/cloth/software.cpp (without OpenMP) vs
+// tkn::Cloth on a single thread and on the global thread pool.
+// Reports nanoseconds per node and step for growing grid sizes.
+// Then compares the verlet and xpbd solvers for increasingly stiff
+// springs: verlet at the largest stable time step, xpbd at 60 steps
+// per second with multiple iterations or substeps. Reports simulated
+// seconds per wall second and the mean stretch of the structural springs
+// (as indicator for the visual stiffness).
+
+#include <tkn/cloth.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace tkn;
+
+// The old implementation: one node struct per node, column-major
+// indexing, springs evaluated via lambda.
+struct AosCloth {
+	struct Node {
+		Vec3f pos;
+		Vec3f vel;
+		Vec3f lpos;
+		Vec3f npos;
+	};
+
+	unsigned size;
+	ClothParams params;
+	std::vector<Node> nodes;
+
+	AosCloth(unsigned xsize) : size(xsize), nodes(size * size) {
+		auto start = -0.5f * (size - 1);
+		for(auto y = 0u; y < size; ++y) {
+			for(auto x = 0u; x < size; ++x) {
+				auto pos = Vec3f{start + x, 0.f, start + y};
+				nodes[id(x, y)] = {pos, {}, pos, pos};
+			}
+		}
+	}
+
+	std::size_t id(unsigned x, unsigned y) const { return x * size + y; }
+
+	Vec3f springForce(const Node& a, const Node& b, float ks, float kd, float l) {
+		auto pd = b.pos - a.pos;
+		auto vd = b.vel - a.vel;
+		auto pl = nytl::length(pd);
+		pd *= 1.f / pl;
+		return (ks * (pl - l) + kd * dot(vd, pd)) * pd;
+	}
+
+	void step(float dt) {
+		for(auto x = 0u; x < size; ++x) {
+			for(auto y = 0u; y < size; ++y) {
+				if((x == 0 || x == size - 1) && (y == 0 || y == size - 1)) {
+					continue;
+				}
+
+				auto f = params.mass * params.gravity;
+				auto& n = nodes[id(x, y)];
+				auto ks = params.ks[0];
+				auto kd = params.kd[0];
+				auto l = 1.f;
+				auto addf = [&](int offx, int offy) {
+					if(int(x) + offx >= int(size) || int(y) + offy >= int(size) ||
+							int(x) + offx < 0 || int(y) + offy < 0) {
+						return;
+					}
+					f += springForce(n, nodes[id(x + offx, y + offy)], ks, kd, l);
+				};
+
+				addf(-1, 0);
+				addf(1, 0);
+				addf(0, -1);
+				addf(0, 1);
+
+				l = 2.f;
+				ks = params.ks[1];
+				kd = params.kd[1];
+				addf(-2, 0);
+				addf(2, 0);
+				addf(0, -2);
+				addf(0, 2);
+
+				l = std::sqrt(2.f);
+				ks = params.ks[2];
+				kd = params.kd[2];
+				addf(-1, -1);
+				addf(1, 1);
+				addf(-1, 1);
+				addf(1, -1);
+
+				f *= 1 / params.mass;
+				n.npos = 2 * n.pos - n.lpos + dt * dt * f;
+			}
+		}
+
+		for(auto& n : nodes) {
+			n.lpos = n.pos;
+			n.pos = n.npos;
+			n.vel = (1.f / dt) * (n.pos - n.lpos);
+		}
+	}
+};
+
+// Whether the cloth has exploded.
+bool exploded(const Cloth& cloth) {
+	for(auto i = 0u; i < cloth.nodeCount(); ++i) {
+		auto p = cloth.position(i);
+		if(!(std::abs(p.x) + std::abs(p.y) + std::abs(p.z) < 1000.f)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Mean relative stretch of the structural springs.
+float stretch(const Cloth& cloth) {
+	auto sum = 0.0;
+	auto x = cloth.x(), y = cloth.y(), z = cloth.z();
+	auto add = [&](std::size_t a, std::size_t b) {
+		auto dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a];
+		sum += std::sqrt(dx * dx + dy * dy + dz * dz) - cloth.params.spacing;
+	};
+
+	for(auto j = 0u; j < cloth.height(); ++j) {
+		for(auto i = 0u; i + 1 < cloth.width(); ++i) {
+			add(cloth.id(i, j), cloth.id(i + 1, j));
+			add(cloth.id(j, i), cloth.id(j, i + 1));
+		}
+	}
+
+	auto count = 2.0 * cloth.height() * (cloth.width() - 1);
+	return float(sum / (count * cloth.params.spacing));
+}
+
+struct SolverResult {
+	float dt;
+	double throughput; // simulated seconds per wall second
+	float stretch;
+};
+
+// Simulates 'duration' seconds and returns the result. The stretch is
+// averaged over the last second since the cloth still swings.
+// Returns a zero throughput when the simulation exploded.
+SolverResult simulate(const ClothParams& params, float dt, float duration,
+		ThreadPool& pool) {
+	constexpr auto size = 64u;
+	Cloth cloth(size, size, params);
+	auto steps = unsigned(std::ceil(duration / dt));
+	auto avgSteps = unsigned(std::ceil(1.f / dt));
+
+	auto avgStretch = 0.0;
+	auto ms = bench::measureOnce([&]{
+		// stop early when exploded, the springs might become degenerate
+		for(auto i = 0u; i < steps && !exploded(cloth); ++i) {
+			cloth.step(dt, &pool);
+			if(i + avgSteps >= steps) {
+				avgStretch += stretch(cloth);
+			}
+		}
+	});
+
+	if(exploded(cloth)) {
+		return {dt, 0.0, 0.f};
+	}
+
+	return {dt, 1000.0 * steps * dt / ms, float(avgStretch / avgSteps)};
+}
+
+void compareSolvers(ThreadPool& pool) {
+	constexpr auto duration = 5.f;
+	constexpr auto frame = 1 / 60.f;
+	std::printf("solvers, 64x64 nodes, %g simulated seconds\n", duration);
+	std::printf("  %-8s %-24s %10s %14s %10s\n", "ks", "solver", "dt",
+		"sim s / wall s", "stretch");
+
+	auto print = [](float ks, const std::string& name, const SolverResult& res) {
+		std::printf("  %-8g %-24s %10.5f %14.2f %9.3f%%\n", ks, name.c_str(),
+			res.dt, res.throughput, 100 * res.stretch);
+	};
+
+	for(auto ks : {500.f, 5000.f, 50000.f}) {
+		ClothParams params;
+		params.ks = {ks, ks, ks};
+		params.kd = {1.f, 1.f, 1.f};
+
+		// largest stable verlet step, halving from frame rate
+		SolverResult verlet {};
+		for(auto dt = frame; dt > 1e-5f && verlet.throughput == 0.0; dt *= 0.5f) {
+			verlet = simulate(params, dt, duration, pool);
+		}
+
+		print(ks, "verlet", verlet);
+
+		// xpbd at frame rate with multiple iterations vs multiple
+		// steps (substeps) per frame with a single iteration.
+		// The substeps converge much better for stiff springs
+		params.solver = ClothSolver::xpbd;
+		for(auto iterations : {10u, 40u}) {
+			params.iterations = iterations;
+			auto name = "xpbd, " + std::to_string(iterations) + " it";
+			print(ks, name, simulate(params, frame, duration, pool));
+		}
+
+		params.iterations = 1u;
+		for(auto substeps : {10u, 40u}) {
+			auto name = "xpbd, " + std::to_string(substeps) + " substeps";
+			print(ks, name, simulate(params, frame / substeps, duration, pool));
+		}
+	}
+}
+
+int main() {
+	constexpr auto dt = 0.01f;
+
+	auto& pool = ThreadPool::instance();
+	ThreadPool single(0u);
+	std::printf("ns per node and step, %u threads\n", pool.numWorkers() + 1);
+	std::printf("  %-6s %12s %12s %12s\n", "size", "aos", "soa", "soa (pool)");
+
+	for(auto size : {256u, 512u, 1024u, 2048u}) {
+		auto nodes = double(size) * size;
+		auto iters = unsigned(std::max(2.0, 2e7 / nodes));
+
+		AosCloth aos(size);
+		auto aosNs = bench::measure(iters, [&]{
+			aos.step(dt);
+			bench::consume(aos.nodes[size / 2].pos);
+		});
+
+		Cloth soa(size, size);
+		auto soaNs = bench::measure(iters, [&]{
+			soa.step(dt, &single);
+			bench::consume(soa.x()[size / 2]);
+		});
+
+		soa.reset();
+		auto poolNs = bench::measure(iters, [&]{
+			soa.step(dt, &pool);
+			bench::consume(soa.x()[size / 2]);
+		});
+
+		std::printf("  %-6u %12.3f %12.3f %12.3f\n", size, aosNs / nodes,
+			soaNs / nodes, poolNs / nodes);
+	}
+
+	compareSolvers(pool);
+}
@@ -0,0 +1,96 @@
+// Benchmarks receiving large, fragmented packages with tkn::MessageManager.
+// Compares passing non-owned buffers to processPackage (fragment payloads
+// are copied into pooled buffers) with moving pooled receive buffers
+// into it (fragments are handled in place, nothing is copied).
+
+#include <tkn/connection.hpp>
+#include <tkn/recvBuf.hpp>
+#include <dlg/dlg.hpp>
+#include "bench.hpp"
+
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+using namespace tkn;
+
+int main() {
+	for(auto msgSize : {10 * 1024u, 25 * 1024u, 50 * 1024u}) {
+		MessageManager sender;
+		MessageManager receiver;
+
+		// message: u32 size, followed by that many bytes.
+		std::vector<std::byte> msg(sizeof(uint32_t) + msgSize);
+		std::memcpy(msg.data(), &msgSize, sizeof(msgSize));
+		for(auto i = 0u; i < msgSize; ++i) {
+			msg[sizeof(uint32_t) + i] = std::byte(i & 0xFF);
+		}
+
+		// The handler consumes the message chunk by chunk, as a real
+		// handler would e.g. deserialize a snapshot.
+		auto sum = 0u;
+		receiver.messageHandler([&](uint32_t, RecvBuf& buf) {
+			auto size = read<uint32_t>(buf);
+			if(size > tkn::size(buf)) {
+				return false;
+			}
+
+			while(size > 0) {
+				auto chunk = readChunk(buf, size);
+				for(auto b : chunk) {
+					sum += unsigned(b);
+				}
+				size -= chunk.size();
+			}
+
+			return true;
+		});
+
+		// The sent fragments for one message, as they would be received
+		std::vector<std::vector<std::byte>> fragments;
+		auto sendNext = [&]{
+			fragments.clear();
+			sender.queueMsg(msg);
+			for(auto& buf : sender.packages()) {
+				auto data = static_cast<const std::byte*>(buf.data());
+				fragments.emplace_back(data, data + buf.size());
+			}
+		};
+
+		sendNext();
+		std::printf("message size %u: %u fragments\n", msgSize,
+			unsigned(fragments.size()));
+
+		auto iterations = 2000u;
+		auto copyTime = 0.0;
+		auto inPlaceTime = 0.0;
+		for(auto i = 0u; i < iterations; ++i) {
+			sendNext();
+			copyTime += bench::measureOnce([&]{
+				for(auto& frag : fragments) {
+					receiver.processPackage(asio::buffer(frag.data(), frag.size()));
+				}
+			});
+
+			// simulates receiving into pooled buffers
+			sendNext();
+			std::vector<std::vector<std::byte>> received;
+			for(auto& frag : fragments) {
+				auto buf = receiver.recvBuffer();
+				std::memcpy(buf.data(), frag.data(), frag.size());
+				buf.resize(frag.size());
+				received.push_back(std::move(buf));
+			}
+
+			inPlaceTime += bench::measureOnce([&]{
+				for(auto& buf : received) {
+					receiver.processPackage(std::move(buf));
+				}
+			});
+		}
+
+		bench::consume(sum);
+		bench::print("  copied fragments", 1000 * 1000 * copyTime / iterations);
+		bench::print("  pooled, in-place fragments", 1000 * 1000 * inPlaceTime / iterations);
+	}
+}
@@ -0,0 +1,311 @@
+// FEM soft body: the original explicit euler step of src/fem/main.cpp
+// (atan2 based svd and dense 6x6 rotation per element, 10 steps of
+// 2ms per frame) vs tkn::FemBody's implicit step (sparse assembly and
+// pcg, one step per frame) on a single thread and on the global thread
+// pool. Both simulate a beam fixed on its left side, starting at rest,
+// for grids of 10k to 1M triangles. Also compares the closed form polar
+// decomposition with the svd.
+
+#include <tkn/fem.hpp>
+#include <tkn/threadPool.hpp>
+#include "bench.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace tkn;
+
+// The old implementation, without nytl matrices but the same
+// operations.
+namespace old {
+
+using Mat2 = std::array<float, 4>; // row major
+using Mat6 = std::array<float, 36>;
+using Vec6 = std::array<float, 6>;
+
+Mat2 mul(const Mat2& a, const Mat2& b) {
+	return {
+		a[0] * b[0] + a[1] * b[2], a[0] * b[1] + a[1] * b[3],
+		a[2] * b[0] + a[3] * b[2], a[2] * b[1] + a[3] * b[3],
+	};
+}
+
+Mat2 transpose(const Mat2& m) {
+	return {m[0], m[2], m[1], m[3]};
+}
+
+Vec6 mul(const Mat6& m, const Vec6& v) {
+	Vec6 ret {};
+	for(auto i = 0u; i < 6u; ++i) {
+		for(auto j = 0u; j < 6u; ++j) {
+			ret[i] += m[i * 6 + j] * v[j];
+		}
+	}
+	return ret;
+}
+
+float sign(float x) {
+	return (x > 0) ? 1.f : (x < 0) ? -1.f : 0.f;
+}
+
+struct SVD {
+	Mat2 u, sig, v;
+};
+
+SVD svd(const Mat2& m) {
+	SVD ret;
+	auto tm = transpose(m);
+
+	auto m1 = mul(m, tm);
+	auto phi = 0.5f * std::atan2(m1[1] + m1[2], m1[0] - m1[3]);
+	auto cphi = std::cos(phi);
+	auto sphi = std::sin(phi);
+	ret.u = {cphi, -sphi, sphi, cphi};
+
+	auto sum = m1[0] + m1[3];
+	auto dif = m1[0] - m1[3];
+	dif = std::sqrt(dif * dif + 4 * m1[1] * m1[2]);
+	ret.sig = {std::sqrt(0.5f * (sum + dif)), 0, 0, std::sqrt(0.5f * (sum - dif))};
+
+	auto m2 = mul(tm, m);
+	auto theta = 0.5f * std::atan2(m2[1] + m2[2], m2[0] - m2[3]);
+	auto ctheta = std::cos(theta);
+	auto stheta = std::sin(theta);
+	auto w = Mat2{ctheta, -stheta, stheta, ctheta};
+
+	auto s = mul(mul(transpose(ret.u), m), w);
+	ret.v = mul(w, Mat2{sign(s[0]), 0, 0, sign(s[3])});
+	return ret;
+}
+
+struct Body {
+	struct Point {
+		Vec2f pos;
+		Vec2f u {};
+		Vec2f udot {};
+	};
+
+	struct Elem {
+		unsigned a, b, c;
+		Mat6 K;
+		float invm;
+		std::array<float, 6> n; // shape function derivatives
+	};
+
+	std::vector<Point> points;
+	std::vector<Elem> elems;
+	std::vector<bool> fixed;
+};
+
+// Same mesh and material as the given body.
+Body fromFem(const FemBody& fem, unsigned width) {
+	Body body;
+	for(auto& pos : fem.restPositions()) {
+		body.points.push_back({pos});
+	}
+
+	body.fixed.resize(body.points.size());
+	for(auto i = 0u; i < body.points.size(); i += width) {
+		body.fixed[i] = true;
+	}
+
+	FemParams params;
+	for(auto& tri : fem.triangles()) {
+		auto& elem = body.elems.emplace_back();
+		elem.a = tri[0];
+		elem.b = tri[1];
+		elem.c = tri[2];
+
+		auto a = body.points[tri[0]].pos;
+		auto b = body.points[tri[1]].pos;
+		auto c = body.points[tri[2]].pos;
+		auto vt2 = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		elem.n = {
+			(b.y - c.y) / vt2, (c.x - b.x) / vt2,
+			(c.y - a.y) / vt2, (a.x - c.x) / vt2,
+			(a.y - b.y) / vt2, (b.x - a.x) / vt2,
+		};
+		elem.invm = 1 / (0.25f * params.density * 0.5f * vt2);
+
+		auto E = params.youngsModulus;
+		auto nu = params.poissonRatio;
+		auto fac = E / ((1 + nu) * (1 - 2 * nu));
+		std::array<float, 9> D = {
+			fac * (1 - nu), fac * nu, 0,
+			fac * nu, fac * (1 - nu), 0,
+			0, 0, fac * 0.5f * (1 - 2 * nu),
+		};
+
+		std::array<float, 18> B {};
+		for(auto i = 0u; i < 3u; ++i) {
+			B[0 * 6 + 2 * i] = elem.n[2 * i];
+			B[1 * 6 + 2 * i + 1] = elem.n[2 * i + 1];
+			B[2 * 6 + 2 * i] = elem.n[2 * i + 1];
+			B[2 * 6 + 2 * i + 1] = elem.n[2 * i];
+		}
+
+		for(auto r = 0u; r < 6u; ++r) {
+			for(auto col = 0u; col < 6u; ++col) {
+				auto sum = 0.f;
+				for(auto k = 0u; k < 3u; ++k) {
+					for(auto l = 0u; l < 3u; ++l) {
+						sum += B[k * 6 + r] * D[k * 3 + l] * B[l * 6 + col];
+					}
+				}
+				elem.K[r * 6 + col] = 0.5f * vt2 * sum;
+			}
+		}
+	}
+
+	return body;
+}
+
+void step(Body& fe, float dt) {
+	for(auto& point : fe.points) {
+		point.u += dt * point.udot;
+	}
+
+	for(auto& tri : fe.elems) {
+		auto& a = fe.points[tri.a];
+		auto& b = fe.points[tri.b];
+		auto& c = fe.points[tri.c];
+
+		auto& n = tri.n;
+		auto f = Mat2{
+			1 + n[0] * a.u.x + n[2] * b.u.x + n[4] * c.u.x,
+			n[1] * a.u.x + n[3] * b.u.x + n[5] * c.u.x,
+			n[0] * a.u.y + n[2] * b.u.y + n[4] * c.u.y,
+			1 + n[1] * a.u.y + n[3] * b.u.y + n[5] * c.u.y,
+		};
+
+		auto [u, sig, v] = svd(f);
+		auto rot = mul(u, transpose(v));
+		Mat6 r {};
+		for(auto i = 0u; i < 3u; ++i) {
+			r[(2 * i) * 6 + 2 * i] = rot[0];
+			r[(2 * i) * 6 + 2 * i + 1] = rot[1];
+			r[(2 * i + 1) * 6 + 2 * i] = rot[2];
+			r[(2 * i + 1) * 6 + 2 * i + 1] = rot[3];
+		}
+
+		Mat6 rt;
+		for(auto i = 0u; i < 6u; ++i) {
+			for(auto j = 0u; j < 6u; ++j) {
+				rt[i * 6 + j] = r[j * 6 + i];
+			}
+		}
+
+		Vec6 x = {a.pos.x, a.pos.y, b.pos.x, b.pos.y, c.pos.x, c.pos.y};
+		Vec6 xu = {
+			x[0] + a.u.x, x[1] + a.u.y,
+			x[2] + b.u.x, x[3] + b.u.y,
+			x[4] + c.u.x, x[5] + c.u.y,
+		};
+
+		auto rx = mul(rt, xu);
+		for(auto i = 0u; i < 6u; ++i) {
+			rx[i] -= x[i];
+		}
+
+		auto force = mul(r, mul(tri.K, rx));
+		Vec6 udot = {a.udot.x, a.udot.y, b.udot.x, b.udot.y, c.udot.x, c.udot.y};
+		for(auto i = 0u; i < 6u; ++i) {
+			force[i] = -force[i] - 0.01f * udot[i];
+		}
+
+		auto fac = dt * tri.invm;
+		a.udot += fac * Vec2f{force[0], force[1]};
+		b.udot += fac * Vec2f{force[2], force[3]};
+		c.udot += fac * Vec2f{force[4], force[5]};
+	}
+
+	for(auto i = 0u; i < fe.points.size(); ++i) {
+		auto& p = fe.points[i];
+		p.udot.y -= dt * 9.81f;
+		if(fe.fixed[i]) {
+			p.u = p.udot = {};
+		}
+	}
+}
+
+} // namespace old
+
+int main() {
+	constexpr auto frame = 1 / 60.f;
+	constexpr auto spacing = 0.25f;
+
+	auto& pool = ThreadPool::instance();
+	ThreadPool single(0u);
+
+	std::printf("ms per simulated frame (%.4f s), %u threads\n", frame,
+		pool.numWorkers() + 1);
+	std::printf("  %-10s %14s %14s %14s %8s\n", "triangles", "old explicit",
+		"implicit", "impl. (pool)", "pcg it");
+
+	for(auto side : {72u, 225u, 708u}) {
+		auto width = 2 * side;
+		auto height = side / 2;
+		auto fem = FemBody::grid(width, height, spacing);
+		for(auto y = 0u; y < height; ++y) {
+			fem.fix(y * width);
+		}
+
+		auto tris = fem.triangles().size();
+		auto frames = unsigned(std::clamp<std::size_t>(100000 / tris, 2u, 20u));
+
+		auto body = old::fromFem(fem, width);
+		auto oldMs = bench::measureOnce([&]{
+			for(auto f = 0u; f < frames; ++f) {
+				for(auto i = 0u; i < 10u; ++i) {
+					old::step(body, 0.002f);
+				}
+			}
+		}) / frames;
+
+		auto copy = fem;
+		auto implMs = bench::measureOnce([&]{
+			for(auto f = 0u; f < frames; ++f) {
+				copy.step(frame, &single);
+			}
+		}) / frames;
+
+		auto iterations = 0u;
+		auto poolMs = bench::measureOnce([&]{
+			for(auto f = 0u; f < frames; ++f) {
+				fem.step(frame, &pool);
+				iterations += fem.lastSolve().iterations;
+			}
+		}) / frames;
+
+		std::printf("  %-10zu %14.2f %14.2f %14.2f %8.1f\n", tris, oldMs,
+			implMs, poolMs, float(iterations) / frames);
+	}
+
+	// rotation extraction only
+	constexpr auto count = 1000 * 1000u;
+	std::vector<std::array<float, 4>> mats(count);
+	for(auto i = 0u; i < count; ++i) {
+		auto a = 0.001f * i;
+		mats[i] = {std::cos(a) + 0.1f, -std::sin(a), std::sin(a), std::cos(a) + 0.2f};
+	}
+
+	auto svdMs = bench::measureOnce([&]{
+		for(auto& m : mats) {
+			auto [u, sig, v] = old::svd(m);
+			bench::consume(old::mul(u, old::transpose(v)));
+		}
+	});
+
+	auto polarMs = bench::measureOnce([&]{
+		for(auto& m : mats) {
+			bench::consume(polarRotation(nytl::Mat2f{m[0], m[1], m[2], m[3]}));
+		}
+	});
+
+	std::printf("rotation of %u matrices\n", count);
+	std::printf("  %-24s %10.2f ms\n", "svd (atan2)", svdMs);
+	std::printf("  %-24s %10.2f ms\n", "polar (closed form)", polarMs);
+}
@@ -0,0 +1,98 @@
+// Benchmarks decoding gltf accessors in bulk via tkn::decode against
+// reading them element by element via tkn::range (AccessorIterator),
+// for the formats Scene::loadPrimitive has to handle.
+
+#include <tkn/gltf.hpp>
+#include <dlg/dlg.hpp>
+#include "bench.hpp"
+
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+using namespace tkn;
+
+struct Layout {
+	const char* name;
+	int componentType;
+	int type;
+	unsigned stride; // 0 for tightly packed
+	bool normalized;
+};
+
+// Adds an accessor with 'count' elements of the given layout to the
+// model, filled with arbitrary data.
+const gltf::Accessor& addAccessor(gltf::Model& model, const Layout& layout,
+		std::size_t count) {
+	auto elemSize = gltf::GetComponentSizeInBytes(layout.componentType) *
+		gltf::GetTypeSizeInBytes(layout.type);
+	auto stride = layout.stride ? layout.stride : elemSize;
+
+	auto& buf = model.buffers.emplace_back();
+	buf.data.resize(count * stride);
+	for(auto i = 0u; i < buf.data.size(); ++i) {
+		buf.data[i] = (i * 31) & 0x3F; // keeps floats finite
+	}
+
+	auto& bv = model.bufferViews.emplace_back();
+	bv.buffer = model.buffers.size() - 1;
+	bv.byteOffset = 0u;
+	bv.byteLength = buf.data.size();
+	bv.byteStride = layout.stride;
+
+	auto& acc = model.accessors.emplace_back();
+	acc.bufferView = model.bufferViews.size() - 1;
+	acc.byteOffset = 0u;
+	acc.componentType = layout.componentType;
+	acc.type = layout.type;
+	acc.normalized = layout.normalized;
+	acc.count = count;
+	return acc;
+}
+
+template<std::size_t N, typename T>
+void run(const Layout& layout, std::size_t count) {
+	gltf::Model model;
+	model.accessors.reserve(1);
+	auto& acc = addAccessor(model, layout, count);
+
+	std::vector<AccessorValue<N, T>> dst(count);
+	auto iterations = 20u;
+
+	auto rangeTime = bench::measure(iterations, [&]{
+		auto it = dst.begin();
+		for(auto val : range<N, T>(model, acc)) {
+			*(it++) = val;
+		}
+		bench::consume(dst.back());
+	});
+
+	auto decodeTime = bench::measure(iterations, [&]{
+		decode<N, T>(model, acc, nytl::Span<AccessorValue<N, T>>(dst));
+		bench::consume(dst.back());
+	});
+
+	std::printf("%s, %zu elements\n", layout.name, count);
+	bench::print("  range (per element)", rangeTime / count);
+	bench::print("  decode (per element)", decodeTime / count);
+	std::printf("  speedup: %.1fx\n", rangeTime / decodeTime);
+}
+
+int main() {
+	auto count = std::size_t(1024 * 1024);
+
+	run<3, float>({"positions, vec3 f32", TINYGLTF_COMPONENT_TYPE_FLOAT,
+		TINYGLTF_TYPE_VEC3, 0u, false}, count);
+	run<3, float>({"normals, vec3 f32 interleaved (32 byte stride)",
+		TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, 32u, false}, count);
+	run<2, float>({"uvs, vec2 f32", TINYGLTF_COMPONENT_TYPE_FLOAT,
+		TINYGLTF_TYPE_VEC2, 0u, false}, count);
+	run<2, float>({"uvs, normalized vec2 u16",
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_TYPE_VEC2, 0u, true}, count);
+	run<4, float>({"colors, normalized vec4 u8",
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, TINYGLTF_TYPE_VEC4, 0u, true}, count);
+	run<1, std::uint32_t>({"indices, u16", TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+		TINYGLTF_TYPE_SCALAR, 0u, false}, 3 * count);
+	run<1, std::uint32_t>({"indices, u32", TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+		TINYGLTF_TYPE_SCALAR, 0u, false}, 3 * count);
+}
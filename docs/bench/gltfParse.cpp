@@ -0,0 +1,249 @@
+// Compares the streaming gltf parser (tkn/gltfParse.hpp) against
+// tinygltf (that first builds a complete json document and reads all
+// buffers into memory) on a large generated scene and the gltf models
+// in assets/gltf. Reports the parse time and the peak heap usage
+// during parsing. The memory mapped buffers of the streaming parser
+// are not heap memory, they are reported separately.
+
+#include <tkn/gltfParse.hpp>
+#include "bench.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+
+namespace fs = std::filesystem;
+using namespace tkn;
+
+// Heap tracking. Every allocation stores its size in front of the
+// returned memory so that the current and peak heap usage is known.
+namespace {
+
+constexpr auto header = alignof(std::max_align_t);
+std::atomic<std::size_t> heapCurrent {0u};
+std::atomic<std::size_t> heapPeak {0u};
+
+} // anon namespace
+
+void* operator new(std::size_t size) {
+	auto ptr = static_cast<unsigned char*>(std::malloc(size + header));
+	if(!ptr) {
+		throw std::bad_alloc();
+	}
+
+	std::memcpy(ptr, &size, sizeof(size));
+	auto cur = heapCurrent.fetch_add(size) + size;
+	auto peak = heapPeak.load();
+	while(cur > peak && !heapPeak.compare_exchange_weak(peak, cur));
+	return ptr + header;
+}
+
+void operator delete(void* ptr) noexcept {
+	if(!ptr) {
+		return;
+	}
+
+	auto base = static_cast<unsigned char*>(ptr) - header;
+	std::size_t size;
+	std::memcpy(&size, base, sizeof(size));
+	heapCurrent.fetch_sub(size);
+	std::free(base);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	::operator delete(ptr);
+}
+
+struct Result {
+	double ms;
+	std::size_t peak; // peak heap usage while loading
+	std::size_t mapped; // size of the referenced mapped buffers
+};
+
+template<typename F>
+Result measure(F&& load) {
+	// best of three
+	Result ret {1e30, 0u, 0u};
+	for(auto i = 0u; i < 3u; ++i) {
+		auto base = heapCurrent.load();
+		heapPeak = base;
+
+		gltf::Model model;
+		auto ms = bench::measureOnce([&]{ model = load(); });
+		bench::consume(model);
+
+		ret.ms = std::min(ret.ms, ms);
+		ret.peak = heapPeak - base;
+		ret.mapped = 0u;
+		for(auto& buf : model.buffers) {
+			ret.mapped += buf.mappedSize;
+		}
+	}
+
+	return ret;
+}
+
+void print(const char* name, const Result& res) {
+	std::printf("  %-12s %10.2f ms, peak heap %8.2f MiB, mapped %8.2f MiB\n",
+		name, res.ms, res.peak / (1024.f * 1024.f), res.mapped / (1024.f * 1024.f));
+}
+
+void run(const std::string& path) {
+	auto binary = path.size() > 4 && path.substr(path.size() - 4) == ".glb";
+	auto tiny = measure([&]{
+		gltf::TinyGLTF loader;
+		gltf::Model model;
+		std::string err, warn;
+		auto res = binary ?
+			loader.LoadBinaryFromFile(&model, &err, &warn, path) :
+			loader.LoadASCIIFromFile(&model, &err, &warn, path);
+		if(!res) {
+			std::printf("tinygltf failed: %s\n", err.c_str());
+		}
+		return model;
+	});
+
+	auto stream = measure([&]{ return parseGltf(path); });
+
+	std::printf("%s\n", fs::path(path).filename().c_str());
+	print("tinygltf", tiny);
+	print("parseGltf", stream);
+	std::printf("  speedup: %.1fx\n", tiny.ms / stream.ms);
+}
+
+// Generates a large scene: many nodes, meshes, accessors and materials
+// and a large (sparse, all zero) binary buffer.
+std::string generate(const fs::path& dir, bool glb) {
+	constexpr auto meshCount = 2000u;
+	constexpr auto vertexCount = 512u;
+	constexpr auto indexCount = 3 * 1024u;
+	constexpr auto nodeCount = 20000u;
+	constexpr auto materialCount = 500u;
+	constexpr auto meshSize = vertexCount * 32u + indexCount * 4u;
+	constexpr auto binSize = std::size_t(meshCount) * meshSize;
+
+	std::string json;
+	json += R"({"asset": {"version": "2.0", "generator": "tkn bench"},)";
+	json += "\n\"scene\": 0, \"scenes\": [{\"nodes\": [";
+	for(auto i = 0u; i < nodeCount; i += 8) {
+		json += (i == 0 ? "" : ", ") + std::to_string(i);
+	}
+
+	json += "]}],\n\"nodes\": [\n";
+	for(auto i = 0u; i < nodeCount; ++i) {
+		char buf[512];
+		std::snprintf(buf, sizeof(buf), R"(  {"name": "node %u", "mesh": %u, )"
+			R"("translation": [%.6f, %.6f, %.6f], "rotation": [0.0, %.7f, 0.0, %.7f], )"
+			R"("scale": [1.5, 1.5, 1.5]%s})", i, i % meshCount,
+			0.37f * i, -1.5f * (i % 13), 12.25f / (i + 1), std::sin(0.01f * i),
+			std::cos(0.01f * i), (i % 8 == 0 && i + 1 < nodeCount) ?
+				(", \"children\": [" + std::to_string(i + 1) + "]").c_str() : "");
+		json += buf;
+		json += (i + 1 == nodeCount ? "\n" : ",\n");
+	}
+
+	json += "],\n\"meshes\": [\n";
+	for(auto i = 0u; i < meshCount; ++i) {
+		char buf[256];
+		auto a = 4 * i;
+		std::snprintf(buf, sizeof(buf), R"(  {"primitives": [{"attributes": )"
+			R"({"POSITION": %u, "NORMAL": %u, "TEXCOORD_0": %u}, "indices": %u, )"
+			R"("material": %u}]})", a, a + 1, a + 2, a + 3, i % materialCount);
+		json += buf;
+		json += (i + 1 == meshCount ? "\n" : ",\n");
+	}
+
+	json += "],\n\"accessors\": [\n";
+	for(auto i = 0u; i < meshCount; ++i) {
+		char buf[1024];
+		auto b = 4 * i;
+		std::snprintf(buf, sizeof(buf),
+			R"(  {"bufferView": %u, "componentType": 5126, "count": %u, "type": "VEC3", )"
+				R"("min": [-%.6f, -1.0, -%.6f], "max": [%.6f, 1.0, %.6f]},)" "\n"
+			R"(  {"bufferView": %u, "componentType": 5126, "count": %u, "type": "VEC3"},)" "\n"
+			R"(  {"bufferView": %u, "componentType": 5126, "count": %u, "type": "VEC2"},)" "\n"
+			R"(  {"bufferView": %u, "componentType": 5125, "count": %u, "type": "SCALAR"})",
+			b, vertexCount, 1.f + i * 0.001f, 2.f + i * 0.003f, 1.f + i * 0.001f,
+			2.f + i * 0.003f, b + 1, vertexCount, b + 2, vertexCount, b + 3, indexCount);
+		json += buf;
+		json += (i + 1 == meshCount ? "\n" : ",\n");
+	}
+
+	json += "],\n\"bufferViews\": [\n";
+	for(auto i = 0u; i < meshCount; ++i) {
+		auto off = std::size_t(i) * meshSize;
+		std::size_t sizes[] = {vertexCount * 12u, vertexCount * 12u,
+			vertexCount * 8u, indexCount * 4u};
+		for(auto j = 0u; j < 4u; ++j) {
+			json += "  {\"buffer\": 0, \"byteOffset\": " + std::to_string(off) +
+				", \"byteLength\": " + std::to_string(sizes[j]) + "}";
+			json += (i + 1 == meshCount && j == 3) ? "\n" : ",\n";
+			off += sizes[j];
+		}
+	}
+
+	json += "],\n\"materials\": [\n";
+	for(auto i = 0u; i < materialCount; ++i) {
+		char buf[512];
+		std::snprintf(buf, sizeof(buf), R"(  {"name": "material %u", )"
+			R"("pbrMetallicRoughness": {"baseColorFactor": [%.4f, %.4f, %.4f, 1.0], )"
+			R"("metallicFactor": %.3f, "roughnessFactor": %.3f}, )"
+			R"("doubleSided": %s, "extras": {"id": %u}})", i, (i % 7) / 7.f,
+			(i % 5) / 5.f, (i % 3) / 3.f, (i % 10) / 10.f, (i % 4) / 4.f,
+			(i % 2) ? "true" : "false", i);
+		json += buf;
+		json += (i + 1 == materialCount ? "\n" : ",\n");
+	}
+
+	json += "],\n\"buffers\": [{\"byteLength\": " + std::to_string(binSize);
+	json += glb ? "}]\n}" : ", \"uri\": \"large.bin\"}]\n}";
+
+	if(!glb) {
+		auto path = dir / "large.gltf";
+		std::ofstream(path, std::ios::binary).write(json.data(), json.size());
+		std::ofstream(dir / "large.bin", std::ios::binary);
+		fs::resize_file(dir / "large.bin", binSize);
+		return path.string();
+	}
+
+	while(json.size() % 4 != 0) {
+		json.push_back(' ');
+	}
+
+	auto path = dir / "large.glb";
+	std::uint32_t head[] = {0x46546C67u, 2u,
+		std::uint32_t(12 + 8 + json.size() + 8 + binSize),
+		std::uint32_t(json.size()), 0x4E4F534Au};
+	std::uint32_t binHead[] = {std::uint32_t(binSize), 0x004E4942u};
+
+	{
+		std::ofstream out(path, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(head), sizeof(head));
+		out.write(json.data(), json.size());
+		out.write(reinterpret_cast<const char*>(binHead), sizeof(binHead));
+	}
+
+	fs::resize_file(path, 12 + 8 + json.size() + 8 + binSize);
+	return path.string();
+}
+
+int main() {
+	auto dir = fs::path("bench_gltfparse");
+	fs::create_directories(dir);
+	run(generate(dir, false));
+	run(generate(dir, true));
+	fs::remove_all(dir);
+
+	for(auto name : {"test.gltf", "test2.gltf", "test-blend.gltf", "cube.glb"}) {
+		auto path = std::string(TKN_BASE_DIR "/assets/gltf/") + name;
+		if(fs::exists(path)) {
+			run(path);
+		}
+	}
+}
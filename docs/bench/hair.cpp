@@ -0,0 +1,125 @@
+// Throughput of tkn::Hair in simulated strand nodes per millisecond:
+// - a straight-forward follow the leader implementation, strand after
+//   strand with an array of nodes per strand
+// - tkn::Hair (batches of 8 strands in SoA layout, vectorized across
+//   the strands) on a single thread and on the global pool,
+//   with follow the leader and pbd (4 iterations)
+
+#include <tkn/hair.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include "bench.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace tkn;
+
+namespace {
+
+constexpr auto dt = 1 / 60.f;
+
+std::vector<HairStrand> strands(unsigned count) {
+	std::vector<HairStrand> ret;
+	for(auto i = 0u; i < count; ++i) {
+		auto a = 6.2831853f * i / count;
+		auto dir = Vec3f{std::cos(a), 0.3f, std::sin(a)};
+		dir = (1 / nytl::length(dir)) * dir;
+		ret.push_back({0.1f * dir, dir, 0.3f});
+	}
+	return ret;
+}
+
+// Same model as HairSolver::followTheLeader, without sphere.
+struct Reference {
+	struct Node {
+		Vec3f pos;
+		Vec3f vel;
+	};
+
+	unsigned nodeCount;
+	std::vector<std::vector<Node>> strands;
+	std::vector<float> segLengths;
+	HairParams params;
+
+	Reference(nytl::Span<const HairStrand> xstrands, unsigned xnodeCount) :
+			nodeCount(xnodeCount) {
+		for(auto& s : xstrands) {
+			auto seg = s.length / (nodeCount - 1);
+			auto& nodes = strands.emplace_back(nodeCount);
+			for(auto i = 0u; i < nodeCount; ++i) {
+				nodes[i] = {s.root + (i * seg) * s.direction, {0.f, 0.f, 0.f}};
+			}
+			segLengths.push_back(seg);
+		}
+	}
+
+	void step() {
+		auto damping = std::max(1.f - params.damping * dt, 0.f);
+		for(auto s = 0u; s < strands.size(); ++s) {
+			auto& nodes = strands[s];
+			auto seg = segLengths[s];
+			Vec3f lastX {}, lastP {};
+			auto parent = nodes[0].pos;
+			for(auto i = 1u; i < nodeCount; ++i) {
+				auto x = nodes[i].pos;
+				auto v = damping * nodes[i].vel + dt * params.gravity;
+				auto p = x + dt * v;
+				auto d = p - parent;
+				auto q = parent + (seg / nytl::length(d)) * d;
+				if(i > 1) {
+					nodes[i - 1].vel = (1 / dt) * (lastP - lastX) +
+						(params.ftlDamping / dt) * (p - q);
+					nodes[i - 1].pos = lastP;
+				}
+
+				lastX = x;
+				lastP = q;
+				parent = q;
+			}
+
+			nodes.back().vel = (1 / dt) * (lastP - lastX);
+			nodes.back().pos = lastP;
+		}
+	}
+};
+
+} // anon namespace
+
+int main() {
+	auto& pool = ThreadPool::instance();
+	ThreadPool single(0u);
+
+	std::printf("strand nodes per ms, %u threads\n", pool.numWorkers() + 1);
+	std::printf("  %-8s %-6s %12s %12s %12s %12s %12s\n", "strands", "nodes",
+		"reference", "ftl", "ftl (pool)", "pbd", "pbd (pool)");
+
+	for(auto count : {1024u, 16384u, 65536u}) {
+		for(auto nodes : {16u, 32u}) {
+			auto s = strands(count);
+			auto iterations = std::max(2u, 1024u * 1024u / (count * nodes));
+			auto perMs = [&](double ns) {
+				return double(count) * nodes / (ns * 1e-6);
+			};
+
+			Reference ref(s, nodes);
+			auto refNs = bench::measure(iterations, [&]{ ref.step(); });
+
+			HairParams params;
+			Hair ftl(s, nodes, params);
+			auto ftlNs = bench::measure(iterations, [&]{ ftl.step(dt, &single); });
+			auto ftlPoolNs = bench::measure(iterations, [&]{ ftl.step(dt, &pool); });
+
+			params.solver = HairSolver::pbd;
+			Hair pbd(s, nodes, params);
+			auto pbdNs = bench::measure(iterations, [&]{ pbd.step(dt, &single); });
+			auto pbdPoolNs = bench::measure(iterations, [&]{ pbd.step(dt, &pool); });
+
+			bench::consume(ref.strands.back().back().pos);
+			std::printf("  %-8u %-6u %12.0f %12.0f %12.0f %12.0f %12.0f\n",
+				count, nodes, perMs(refNs), perMs(ftlNs), perMs(ftlPoolNs),
+				perMs(pbdNs), perMs(pbdPoolNs));
+		}
+	}
+}
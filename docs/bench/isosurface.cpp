@@ -0,0 +1,222 @@
+// Isosurface extraction for the barth sextic of src/volume on grids of
+// 64^3 to 512^3 samples:
+// - sampling the field per sample (as src/volume did) vs per row with sse
+// - the original marching cubes of src/volume (per cell, triangles
+//   deduplicated via an unordered_map on positions) vs tkn::marchingCubes
+//   (edge indexed vertex sharing, slabs) on a single thread and on
+//   the global pool, and tkn::dualMarchingCubes
+
+#include <tkn/isosurface.hpp>
+#include <tkn/threadPool.hpp>
+#include "../../src/tkn/isosurfaceTables.hpp"
+#include "bench.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+using namespace tkn;
+
+namespace {
+
+constexpr auto golden = 1.6180339887f;
+
+float barth(float x, float y, float z) {
+	const float r = golden;
+	auto t = (x * x + y * y + z * z - 1.f);
+	return 4 * (r * r * x * x - y * y) *
+		(r * r * y * y - z * z) *
+		(r * r * z * z - x * x) -
+		(1 + 2 * r) * t * t;
+}
+
+void barthRow(nytl::Span<const float> xs, float y, float z,
+		nytl::Span<float> values) {
+	const auto r2 = golden * golden;
+	const auto c = 1 + 2 * golden;
+	auto y2 = y * y;
+	auto z2 = z * z;
+	auto b = 4 * (r2 * y2 - z2);
+	auto i = 0u;
+
+#ifdef __SSE2__
+	auto vr2 = _mm_set1_ps(r2);
+	auto vc = _mm_set1_ps(c);
+	auto vb = _mm_set1_ps(b);
+	auto vy2 = _mm_set1_ps(y2);
+	auto vz2 = _mm_set1_ps(r2 * z2);
+	auto vt = _mm_set1_ps(y2 + z2 - 1.f);
+	for(; i + 4 <= xs.size(); i += 4) {
+		auto x = _mm_loadu_ps(&xs[i]);
+		auto x2 = _mm_mul_ps(x, x);
+		auto a = _mm_sub_ps(_mm_mul_ps(vr2, x2), vy2);
+		auto d = _mm_sub_ps(vz2, x2);
+		auto t = _mm_add_ps(x2, vt);
+		auto v = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(vb, a), d),
+			_mm_mul_ps(vc, _mm_mul_ps(t, t)));
+		_mm_storeu_ps(&values[i], v);
+	}
+#endif
+
+	for(; i < xs.size(); ++i) {
+		auto x2 = xs[i] * xs[i];
+		auto t = x2 + (y2 + z2 - 1.f);
+		values[i] = b * (r2 * x2 - y2) * (r2 * z2 - x2) - c * t * t;
+	}
+}
+
+// The old implementation
+namespace old {
+
+struct Hash {
+	std::size_t operator()(const Vec3f& v) const {
+		std::size_t seed = 0;
+		for(auto val : v) {
+			auto hash = std::hash<float>{}(val);
+			hash += 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			seed ^= hash;
+		}
+		return seed;
+	}
+};
+
+struct Cell {
+	std::array<Vec3f, 8> pos;
+	std::array<float, 8> val;
+};
+
+void sampleGrid(SdfGrid& grid) {
+	auto [nx, ny, nz] = std::array{grid.size.x, grid.size.y, grid.size.z};
+	grid.values.resize(std::size_t(nx) * ny * nz);
+	for(auto iz = 0u; iz < nz; ++iz) {
+		for(auto iy = 0u; iy < ny; ++iy) {
+			for(auto ix = 0u; ix < nx; ++ix) {
+				auto p = grid.position(ix, iy, iz);
+				grid.values[grid.id(ix, iy, iz)] = barth(p.x, p.y, p.z);
+			}
+		}
+	}
+}
+
+Vec3f interpolate(const Cell& c, unsigned i1, unsigned i2, float iso) {
+	auto a = c.pos[i1];
+	auto b = c.pos[i2];
+	auto va = c.val[i1];
+	auto vb = c.val[i2];
+	if(va > vb) {
+		std::swap(va, vb);
+		std::swap(a, b);
+	}
+
+	auto f = std::clamp((iso - va) / (vb - va), 0.f, 1.f);
+	return a + f * (b - a);
+}
+
+IsoMesh marchingCubes(const SdfGrid& grid, float iso) {
+	IsoMesh ret;
+	std::vector<Vec3f> positions;
+	auto [nx, ny, nz] = std::array{grid.size.x, grid.size.y, grid.size.z};
+	for(auto z = 0u; z + 1 < nz; ++z) {
+		for(auto y = 0u; y + 1 < ny; ++y) {
+			for(auto x = 0u; x + 1 < nx; ++x) {
+				Cell cell;
+				auto config = 0u;
+				for(auto i = 0u; i < 8; ++i) {
+					Vec3ui off {((i + 1) / 2) % 2, i / 4, (i / 2) % 2};
+					cell.pos[i] = grid.position(x + off.x, y + off.y, z + off.z);
+					cell.val[i] = grid.value(x + off.x, y + off.y, z + off.z);
+					if(cell.val[i] < iso) {
+						config |= (1u << i);
+					}
+				}
+
+				auto edges = mc::edgeTable[config];
+				if(edges == 0) {
+					continue;
+				}
+
+				std::array<Vec3f, 12> verts;
+				for(auto i = 0u; i < 12; ++i) {
+					if(edges & (1 << i)) {
+						auto& points = mc::edgePoints[i];
+						verts[i] = interpolate(cell, points.a, points.b, iso);
+					}
+				}
+
+				auto& tris = mc::triTable[config];
+				for(auto i = 0u; tris[i] != -1; i += 3) {
+					positions.push_back(verts[tris[i + 0]]);
+					positions.push_back(verts[tris[i + 2]]);
+					positions.push_back(verts[tris[i + 1]]);
+				}
+			}
+		}
+	}
+
+	std::unordered_map<Vec3f, u32, Hash> seen;
+	for(auto& pos : positions) {
+		auto [it, inserted] = seen.emplace(pos, u32(ret.positions.size()));
+		if(inserted) {
+			ret.positions.push_back(pos);
+		}
+		ret.indices.push_back(it->second);
+	}
+
+	return ret;
+}
+
+} // namespace old
+} // anon namespace
+
+int main() {
+	auto& pool = ThreadPool::instance();
+	ThreadPool single(0u);
+
+	std::printf("barth sextic, ms, %u threads\n", pool.numWorkers() + 1);
+	std::printf("  %-5s %10s %10s %10s %10s %10s %10s %10s %12s\n", "size",
+		"sample", "row+sse", "old mc", "mc", "mc (pool)", "dmc (pool)",
+		"old verts", "verts (mc)");
+
+	for(auto n : {64u, 128u, 256u, 512u}) {
+		SdfGrid grid;
+		grid.size = {n, n, n};
+		grid.start = {-1.5f, -1.5f, -1.5f};
+		grid.spacing = {3.f / n, 3.f / n, 3.f / n};
+
+		auto sampleMs = bench::measureOnce([&]{ old::sampleGrid(grid); });
+		auto rowMs = bench::measureOnce([&]{ sample(grid, barthRow, &single); });
+
+		// the old version is too slow and needs too much memory
+		// for the largest grid
+		auto oldMs = 0.0;
+		std::size_t oldVerts = 0u;
+		if(n <= 256) {
+			oldMs = bench::measureOnce([&]{
+				oldVerts = old::marchingCubes(grid, 0.f).positions.size();
+			});
+		}
+
+		IsoMesh mesh;
+		auto mcMs = bench::measureOnce([&]{
+			mesh = marchingCubes(grid, 0.f, &single);
+		});
+
+		auto poolMs = bench::measureOnce([&]{
+			mesh = marchingCubes(grid, 0.f, &pool);
+		});
+
+		auto dmcMs = bench::measureOnce([&]{
+			bench::consume(dualMarchingCubes(grid, 0.f, &pool));
+		});
+
+		std::printf("  %-5u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10zu %12zu\n",
+			n, sampleMs, rowMs, oldMs, mcMs, poolMs, dmcMs, oldVerts,
+			mesh.positions.size());
+	}
+}
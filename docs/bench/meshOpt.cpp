@@ -0,0 +1,87 @@
+// Reports the vertex cache efficiency (ACMR/ATVR, see tkn/scene/meshOpt.hpp)
+// of the shape generators before and after optimizeMesh and measures the
+// time the individual optimization stages take.
+
+#include <tkn/scene/meshOpt.hpp>
+#include <dlg/dlg.hpp>
+#include "bench.hpp"
+
+#include <algorithm>
+#include <random>
+#include <array>
+#include <cstdio>
+
+using namespace tkn;
+
+// Shuffles the triangle order, simulates meshes exported without
+// any optimization.
+Shape shuffled(Shape shape) {
+	std::vector<std::array<u32, 3>> tris;
+	for(auto i = 0u; i < shape.indices.size(); i += 3) {
+		tris.push_back({shape.indices[i], shape.indices[i + 1],
+			shape.indices[i + 2]});
+	}
+
+	std::mt19937 rng(42);
+	std::shuffle(tris.begin(), tris.end(), rng);
+	shape.indices.clear();
+	for(auto& tri : tris) {
+		shape.indices.insert(shape.indices.end(), tri.begin(), tri.end());
+	}
+
+	return shape;
+}
+
+void run(const char* name, const Shape& shape) {
+	auto copy = shape;
+	MeshOptStats stats;
+	auto total = bench::measureOnce([&]{ stats = optimizeMesh(copy); });
+
+	std::printf("%s, %zu triangles\n", name, shape.indices.size() / 3);
+	std::printf("  vertices: %u -> %u\n", stats.verticesBefore, stats.verticesAfter);
+	std::printf("  ACMR (16 entry FIFO): %.3f -> %.3f\n",
+		stats.before.acmr, stats.after.acmr);
+	std::printf("  ATVR (16 entry FIFO): %.3f -> %.3f\n",
+		stats.before.atvr, stats.after.atvr);
+	for(auto size : {8u, 32u}) {
+		auto before = analyzeVertexCache(shape.indices, shape.positions.size(), size);
+		auto after = analyzeVertexCache(copy.indices, copy.positions.size(), size);
+		std::printf("  ACMR (%u entry FIFO): %.3f -> %.3f\n", size,
+			before.acmr, after.acmr);
+	}
+
+	// stages
+	std::vector<u32> remap(shape.positions.size());
+	std::vector<VertexStream> streams = {shape.positions, shape.normals};
+	auto dedup = bench::measureOnce([&]{
+		auto unique = generateVertexRemap(remap, shape.indices, streams);
+		bench::consume(unique);
+	});
+
+	auto indices = shape.indices;
+	auto cache = bench::measureOnce([&]{
+		optimizeVertexCache(indices, indices, shape.positions.size());
+	});
+
+	auto overdraw = bench::measureOnce([&]{
+		optimizeOverdraw(indices, shape.positions);
+	});
+
+	auto fetch = bench::measureOnce([&]{
+		auto used = optimizeVertexFetch(remap, indices);
+		bench::consume(used);
+	});
+
+	std::printf("  %-36s %10.2f ms\n", "dedup", dedup);
+	std::printf("  %-36s %10.2f ms\n", "vertex cache", cache);
+	std::printf("  %-36s %10.2f ms\n", "overdraw", overdraw);
+	std::printf("  %-36s %10.2f ms\n", "vertex fetch", fetch);
+	std::printf("  %-36s %10.2f ms\n", "total (optimizeMesh)", total);
+}
+
+int main() {
+	run("uv sphere", generateUV(Sphere{}, 512, 512));
+	run("uv sphere, shuffled", shuffled(generateUV(Sphere{}, 512, 512)));
+	run("ico sphere", generateIco(7));
+	run("ico sphere, shuffled", shuffled(generateIco(7)));
+}
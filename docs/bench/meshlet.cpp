@@ -0,0 +1,61 @@
+// Benchmarks building meshlets (tkn/scene/meshlet.hpp) for meshes with
+// about a million triangles, single meshes and a scene of many
+// primitives built in parallel like the scene cache does it.
+
+#include <tkn/scene/meshlet.hpp>
+#include <tkn/scene/meshOpt.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include "bench.hpp"
+
+#include <cstdio>
+
+using namespace tkn;
+
+void run(const char* name, Shape shape) {
+	optimizeMesh(shape);
+
+	MeshletData data;
+	auto time = bench::measureOnce([&]{
+		data = buildMeshlets(shape.indices, shape.positions);
+	});
+
+	auto tris = shape.indices.size() / 3;
+	auto& ms = data.meshlets;
+	std::printf("%s, %zu triangles\n", name, tris);
+	std::printf("  %zu meshlets, %.1f vertices, %.1f triangles on average\n",
+		ms.size(), float(data.vertices.size()) / ms.size(),
+		float(tris) / ms.size());
+	std::printf("  %-36s %10.2f ms\n", "buildMeshlets", time);
+	std::printf("  %-36s %10.2f Mtris/s\n", "throughput", tris / (1000.f * time));
+}
+
+int main() {
+	run("uv sphere", generateUV(Sphere{}, 708, 708));
+	run("ico sphere", generateIco(8));
+
+	// many primitives, in parallel
+	auto shape = generateUV(Sphere{}, 128, 128);
+	optimizeMesh(shape);
+	std::vector<MeshletData> results(64);
+
+	auto serial = bench::measureOnce([&]{
+		for(auto& res : results) {
+			res = buildMeshlets(shape.indices, shape.positions);
+		}
+	});
+
+	auto& pool = ThreadPool::instance();
+	auto parallel = bench::measureOnce([&]{
+		parallelFor(pool, results.size(), 1u, [&](auto begin, auto end) {
+			for(auto i = begin; i < end; ++i) {
+				results[i] = buildMeshlets(shape.indices, shape.positions);
+			}
+		});
+	});
+
+	std::printf("64 primitives, %zu triangles total, %u threads\n",
+		64 * shape.indices.size() / 3, pool.numWorkers() + 1);
+	std::printf("  %-36s %10.2f ms\n", "serial", serial);
+	std::printf("  %-36s %10.2f ms\n", "parallel", parallel);
+}
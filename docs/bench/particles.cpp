@@ -0,0 +1,128 @@
+// Particle interactions: all pairs attraction within a radius via
+// tkn::SpatialHash vs brute force, at a constant density of ~20
+// neighbors per particle for 10k to 1M particles. Also compares the
+// ring trail history (tkn::Trails) with shifting the full history via
+// memmove every step, as src/pursuers did.
+
+#include <tkn/particles.hpp>
+#include <tkn/threadPool.hpp>
+#include "bench.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace tkn;
+
+namespace {
+
+std::vector<Vec2f> randomPoints(unsigned count, float extent) {
+	std::mt19937 rgen(42u);
+	std::uniform_real_distribution<float> distr(0.f, extent);
+	std::vector<Vec2f> ret(count);
+	for(auto& p : ret) {
+		p = {distr(rgen), distr(rgen)};
+	}
+	return ret;
+}
+
+void bruteForce(nytl::Span<const Vec2f> points, nytl::Span<Vec2f> vels,
+		float dt, const AttractionParams& params) {
+	auto r2 = params.radius * params.radius;
+	for(auto i = 0u; i < points.size(); ++i) {
+		auto sum = Vec2f{0.f, 0.f};
+		for(auto j = 0u; j < points.size(); ++j) {
+			auto dx = points[j].x - points[i].x;
+			auto dy = points[j].y - points[i].y;
+			auto d2 = dx * dx + dy * dy;
+			if(d2 >= r2 || d2 == 0.f) {
+				continue;
+			}
+
+			auto fac = 1 / std::sqrt(d2) - 1 / params.radius;
+			sum.x += fac * dx;
+			sum.y += fac * dy;
+		}
+
+		vels[i].x += dt * params.strength * sum.x;
+		vels[i].y += dt * params.strength * sum.y;
+	}
+}
+
+} // anon namespace
+
+int main() {
+	constexpr auto neighbors = 20.f;
+	constexpr auto dt = 0.01f;
+
+	auto& pool = ThreadPool::instance();
+	ThreadPool single(0u);
+
+	AttractionParams params;
+	params.radius = 1.f;
+
+	std::printf("attraction, ms per step, %u threads\n", pool.numWorkers() + 1);
+	std::printf("  %-10s %10s %12s %12s %12s\n", "particles", "build",
+		"hash", "hash (pool)", "brute force");
+
+	for(auto count : {10 * 1000u, 100 * 1000u, 1000 * 1000u}) {
+		auto density = neighbors / (3.141f * params.radius * params.radius);
+		auto points = randomPoints(count, std::sqrt(count / density));
+		std::vector<Vec2f> vels(count);
+		SpatialHash hash;
+
+		auto runs = unsigned(std::max(1000 * 1000u / count, 2u));
+		auto buildMs = bench::measure(runs, [&]{
+			hash.build(points, params.radius);
+		}) * 1e-6;
+
+		auto hashMs = bench::measure(runs, [&]{
+			applyAttraction(points, vels, dt, params, hash, &single);
+		}) * 1e-6;
+
+		auto poolMs = bench::measure(runs, [&]{
+			applyAttraction(points, vels, dt, params, hash, &pool);
+		}) * 1e-6;
+
+		// quadratic, only feasible for the smallest set
+		if(count <= 10 * 1000u) {
+			auto bruteMs = bench::measureOnce([&]{
+				bruteForce(points, vels, dt, params);
+			});
+			std::printf("  %-10u %10.2f %12.2f %12.2f %12.2f\n", count, buildMs,
+				hashMs, poolMs, bruteMs);
+		} else {
+			std::printf("  %-10u %10.2f %12.2f %12.2f %12s\n", count, buildMs,
+				hashMs, poolMs, "-");
+		}
+
+		bench::consume(vels);
+	}
+
+	constexpr auto length = 128u;
+	std::printf("trail history of %u positions, us per step\n", length);
+	std::printf("  %-10s %10s %10s\n", "particles", "memmove", "ring");
+	for(auto count : {2000u, 100 * 1000u}) {
+		auto points = randomPoints(count, 1.f);
+
+		std::vector<Vec2f> history(count * length);
+		auto shiftUs = bench::measure(20u, [&]{
+			auto size = (history.size() - 1) * sizeof(history[0]);
+			std::memmove(history.data() + 1, history.data(), size);
+			for(auto i = 0u; i < count; ++i) {
+				history[i * length] = points[i];
+			}
+			bench::consume(history);
+		}) * 1e-3;
+
+		Trails trails(points, length);
+		auto ringUs = bench::measure(20u, [&]{
+			trails.push(points);
+			bench::consume(trails);
+		}) * 1e-3;
+
+		std::printf("  %-10u %10.2f %10.2f\n", count, shiftUs, ringUs);
+	}
+}
@@ -0,0 +1,99 @@
+// Measures the throughput of the compact vertex format encoders
+// (see tkn/scene/quantize.hpp) and reports the memory saved and the
+// precision lost for a couple of shapes.
+
+#include <tkn/scene/quantize.hpp>
+#include <tkn/scene/shape.hpp>
+#include <nytl/vecOps.hpp>
+#include "bench.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace tkn;
+
+Scene::Primitive primitive(const Shape& shape, bool texCoords) {
+	Scene::Primitive p;
+	p.positions = shape.positions;
+	p.normals = shape.normals;
+	p.indices = shape.indices;
+
+	p.min = p.max = p.positions[0];
+	for(auto& pos : p.positions) {
+		p.min = nytl::vec::cw::min(p.min, pos);
+		p.max = nytl::vec::cw::max(p.max, pos);
+	}
+
+	if(texCoords) {
+		// some planar mapping, values in [0, 4]
+		for(auto& pos : p.positions) {
+			auto rel = (pos - p.min);
+			p.texCoords0.push_back({4 * rel.x, 4 * rel.y});
+		}
+	}
+
+	return p;
+}
+
+void stats(const char* name, const Scene::Primitive& p) {
+	auto s = quantizationStats(p);
+	std::printf("%s: %llu vertices, %.1f KiB -> %.1f KiB\n", name,
+		(unsigned long long) s.vertices, s.floatBytes / 1024.f,
+		s.compactBytes / 1024.f);
+	std::printf("  max error: position %g (relative %g), normal %g deg, "
+		"texCoord %g\n", s.positionError, s.relPositionError,
+		s.normalError, s.texCoordError);
+}
+
+int main() {
+	auto sphere = primitive(generateUV(Sphere{}, 512, 512), true);
+	auto ico = primitive(generateIco(6), false);
+	auto box = primitive(generate(Cube{{}, {10.f, 0.1f, 3.f}}), true);
+
+	stats("uv sphere", sphere);
+	stats("ico sphere", ico);
+	stats("flat box", box);
+	std::printf("\n");
+
+	// throughput, compared to just copying the float data
+	auto& p = sphere;
+	auto count = p.positions.size();
+	std::vector<CompactPosition> positions(count);
+	std::vector<CompactNormal> normals(count);
+	std::vector<CompactTexCoord> tcs(count);
+	std::vector<Vec3f> copy(count);
+
+	auto iterations = 20u;
+	auto perVertex = [&](double ns) { return ns / count; };
+
+	bench::print("copy Vec3f, per vertex", perVertex(bench::measure(iterations, [&]{
+		std::memcpy(copy.data(), p.positions.data(), count * sizeof(Vec3f));
+		bench::consume(copy.back());
+	})));
+	bench::print("quantizePositions, per vertex", perVertex(bench::measure(iterations, [&]{
+		quantizePositions(p.positions, p.min, p.max, positions);
+		bench::consume(positions.back());
+	})));
+	bench::print("encodeNormals, per vertex", perVertex(bench::measure(iterations, [&]{
+		encodeNormals(p.normals, normals);
+		bench::consume(normals.back());
+	})));
+	bench::print("encodeTexCoords, per vertex", perVertex(bench::measure(iterations, [&]{
+		encodeTexCoords(p.texCoords0, tcs);
+		bench::consume(tcs.back());
+	})));
+
+	// scalar versions, for comparison
+	bench::print("encodeNormal (scalar), per vertex", perVertex(bench::measure(iterations, [&]{
+		for(auto i = 0u; i < count; ++i) {
+			normals[i] = encodeNormal(p.normals[i]);
+		}
+		bench::consume(normals.back());
+	})));
+	bench::print("quantizeHalf (scalar), per vertex", perVertex(bench::measure(iterations, [&]{
+		for(auto i = 0u; i < count; ++i) {
+			tcs[i] = {quantizeHalf(p.texCoords0[i].x), quantizeHalf(p.texCoords0[i].y)};
+		}
+		bench::consume(tcs.back());
+	})));
+}
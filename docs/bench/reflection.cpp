@@ -0,0 +1,137 @@
+// Pipeline layout inference with and without the reflection cache of
+// the ShaderCache. Loads all glsl shaders of tkn and the deferred
+// renderer and measures
+// - the reflection of all modules via spirv_reflect vs the lookup
+//   in the in-memory cache and in a cache just loaded from disk
+//   (i.e. warm startup),
+// - inferComputeState for all compute shaders from SPIR-V vs from
+//   the cached reflection (this includes creating the layouts).
+// Runs in a temporary working directory. Needs a vulkan device.
+
+#include <tkn/shader.hpp>
+#include <tkn/pipeline.hpp>
+#include <tkn/headless.hpp>
+#include <vpp/device.hpp>
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace tkn;
+
+std::vector<std::string> findShaders() {
+	std::vector<std::string> ret;
+	auto base = fs::path(TKN_BASE_DIR "/src/");
+	for(auto dir : {"tkn/shaders", "deferred"}) {
+		for(auto& entry : fs::directory_iterator(base / dir)) {
+			auto ext = entry.path().extension();
+			if(ext == ".vert" || ext == ".frag" || ext == ".comp") {
+				ret.push_back(fs::relative(entry.path(), base).string());
+			}
+		}
+	}
+
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+void print(const char* name, double ns, std::size_t count) {
+	std::printf("  %-28s %10.2f us (%8.2f us per module)\n", name,
+		ns / 1000.0, ns / (1000.0 * count));
+}
+
+int main() {
+	auto headless = Headless();
+	auto& dev = *headless.device;
+
+	auto dir = fs::absolute("bench_reflection");
+	auto oldPath = fs::current_path();
+	fs::create_directories(dir);
+	fs::current_path(dir);
+
+	std::vector<ShaderCache::LoadRequest> requests;
+	auto shaders = findShaders();
+	for(auto& shader : shaders) {
+		requests.push_back({shader});
+	}
+
+	// copy the SPIR-V, it references the caches
+	std::vector<std::vector<u32>> modules;
+	std::vector<std::size_t> compute;
+
+	{
+		ShaderCache cache(dev);
+		auto views = cache.loadMany(requests);
+		for(auto i = 0u; i < views.size(); ++i) {
+			if(views[i].spv.empty()) {
+				continue;
+			}
+
+			if(fs::path(shaders[i]).extension() == ".comp") {
+				compute.push_back(modules.size());
+			}
+
+			modules.emplace_back(views[i].spv.begin(), views[i].spv.end());
+			cache.reflection(views[i].spv);
+		}
+	}
+
+	std::printf("%zu modules, %zu compute shaders\n", modules.size(), compute.size());
+
+	auto reflectAll = [&](auto&& func) {
+		return [&, func]{
+			for(auto& spv : modules) {
+				bench::consume(func(spv));
+			}
+		};
+	};
+
+	auto ns = bench::measure(20, reflectAll([](auto& spv) {
+		return reflect(spv).bindings.size();
+	}));
+	print("reflect", ns, modules.size());
+
+	// warm startup: reflections loaded from disk (loading itself not
+	// included, it happens on construction). Best of five
+	auto best = 1e30;
+	for(auto i = 0u; i < 5u; ++i) {
+		ShaderCache cache(dev);
+		auto ms = bench::measureOnce(reflectAll([&](auto& spv) {
+			return cache.reflection(spv).bindings.size();
+		}));
+		best = std::min(best, ms);
+	}
+	print("cached, loaded from disk", 1000 * 1000 * best, modules.size());
+
+	ShaderCache cache(dev);
+	ns = bench::measure(100, reflectAll([&](auto& spv) {
+		return cache.reflection(spv).bindings.size();
+	}));
+	print("cached, in memory", ns, modules.size());
+
+	// layout inference
+	auto& dsAlloc = dev.descriptorAllocator();
+	ns = bench::measure(20, [&]{
+		for(auto id : compute) {
+			auto state = inferComputeState(dev, modules[id], &dsAlloc);
+			bench::consume(state);
+		}
+	});
+	print("inferComputeState", ns, compute.size());
+
+	ns = bench::measure(20, [&]{
+		for(auto id : compute) {
+			auto& refl = cache.reflection(modules[id]);
+			auto state = inferComputeState(dev, refl, &dsAlloc);
+			bench::consume(state);
+		}
+	});
+	print("inferComputeState, cached", ns, compute.size());
+
+	fs::current_path(oldPath);
+	fs::remove_all(dir);
+}
@@ -0,0 +1,56 @@
+// Benchmarks loading the processed scene data of the gltf models in
+// assets/gltf the uncached way (parsing, decoding and processing the
+// gltf model and decoding all its images) against loading it from
+// the binary scene cache (tkn/scene/cache.hpp).
+// The uncached numbers include writing the cache.
+
+#include <tkn/scene/cache.hpp>
+#include <dlg/dlg.hpp>
+#include "bench.hpp"
+
+#include <filesystem>
+#include <cstdio>
+
+namespace fs = std::filesystem;
+
+void run(const char* name) {
+	auto path = std::string(TKN_BASE_DIR "/assets/gltf/") + name;
+	auto cacheDir = std::string("bench_scenecache/");
+
+	fs::remove_all(cacheDir);
+	std::optional<tkn::SceneData> data;
+	auto cold = bench::measureOnce([&]{
+		data = tkn::loadSceneCached(path, cacheDir);
+	});
+
+	if(!data) {
+		std::printf("%s: failed to load\n", name);
+		return;
+	}
+
+	auto nprims = data->primitives.size();
+	auto nimages = data->images.size();
+	data = {};
+
+	auto warm = bench::measureOnce([&]{
+		data = tkn::loadSceneCached(path, cacheDir);
+	});
+
+	dlg_assert(data && data->primitives.size() == nprims);
+	std::printf("%s (%zu primitives, %zu images)\n", name, nprims, nimages);
+	std::printf("  %-38s %12.2f ms\n", "uncached (+ writing cache)", cold);
+	std::printf("  %-38s %12.2f ms\n", "cached", warm);
+	std::printf("  speedup: %.1fx\n", cold / warm);
+	fs::remove_all(cacheDir);
+}
+
+int main() {
+	run("test.gltf");
+	run("test2.gltf");
+	run("test3.gltf");
+	run("test-blend.gltf");
+	run("tstation.gltf");
+	run("cube.glb");
+	run("skull");
+	run("ssky");
+}
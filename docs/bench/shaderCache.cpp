@@ -0,0 +1,133 @@
+// Cold-cache startup of the ShaderCache: compiles all glsl shaders of
+// tkn and the deferred renderer (in two permutations each, every
+// request issued twice like by pipelines sharing a shader) once
+// sequentially via ShaderCache::load and once via ShaderCache::loadMany.
+// Also measures the warm start (all modules in the disk cache) with
+// and without the persistent include/hash index.
+// Runs in a temporary working directory, so the disk cache is empty.
+// Needs a vulkan device to create the shader modules.
+
+#include <tkn/shader.hpp>
+#include <tkn/headless.hpp>
+#include <tkn/threadPool.hpp>
+#include <vpp/device.hpp>
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace tkn;
+
+std::vector<std::string> findShaders() {
+	std::vector<std::string> ret;
+	auto base = fs::path(TKN_BASE_DIR "/src/");
+	for(auto dir : {"tkn/shaders", "deferred"}) {
+		for(auto& entry : fs::directory_iterator(base / dir)) {
+			auto ext = entry.path().extension();
+			if(ext == ".vert" || ext == ".frag" || ext == ".comp") {
+				ret.push_back(fs::relative(entry.path(), base).string());
+			}
+		}
+	}
+
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+unsigned countLoaded(nytl::Span<const ShaderCache::CompiledShaderView> views) {
+	auto ret = 0u;
+	for(auto& view : views) {
+		ret += bool(view.mod);
+	}
+
+	return ret;
+}
+
+int main() {
+	auto headless = Headless();
+	auto& dev = *headless.device;
+
+	auto shaders = findShaders();
+	std::vector<ShaderCache::LoadRequest> requests;
+	for(auto& shader : shaders) {
+		for(auto preamble : {"", "#define TKN_BENCH_VARIANT"}) {
+			requests.push_back({shader, preamble});
+			requests.push_back({shader, preamble});
+		}
+	}
+
+	auto& pool = ThreadPool::instance();
+	std::printf("%zu shaders, %zu requests, %u workers\n", shaders.size(),
+		requests.size(), pool.numWorkers());
+
+	auto dir = fs::absolute("bench_shadercache");
+	auto oldPath = fs::current_path();
+	fs::create_directories(dir);
+	fs::current_path(dir);
+
+	// sequential
+	{
+		fs::remove_all(ShaderCache::cacheDir);
+		ShaderCache cache(dev);
+		std::vector<ShaderCache::CompiledShaderView> views;
+		auto ms = bench::measureOnce([&]{
+			for(auto& req : requests) {
+				views.push_back(cache.load(req.path, std::string(req.preamble)));
+			}
+		});
+
+		std::printf("  %-24s %10.2f ms (%u loaded)\n", "load, sequential", ms,
+			countLoaded(views));
+	}
+
+	// batched
+	{
+		fs::remove_all(ShaderCache::cacheDir);
+		ShaderCache cache(dev);
+		std::vector<ShaderCache::CompiledShaderView> views;
+		auto ms = bench::measureOnce([&]{
+			views = cache.loadMany(requests, &pool);
+		});
+
+		std::printf("  %-24s %10.2f ms (%u loaded)\n", "loadMany", ms,
+			countLoaded(views));
+
+		// warm: everything in memory
+		ms = bench::measureOnce([&]{
+			views = cache.loadMany(requests, &pool);
+		});
+		std::printf("  %-24s %10.2f ms\n", "loadMany, in memory", ms);
+	}
+
+	// warm start: compiled modules are in the disk cache. Once with
+	// the include/hash index and once without it, i.e. all sources
+	// have to be read and parsed again. Best of five runs.
+	auto index = fs::path(ShaderCache::cacheDir) / "index";
+	fs::copy_file(index, "index.bak");
+	for(auto useIndex : {false, true}) {
+		auto best = 1e30;
+		for(auto i = 0u; i < 5u; ++i) {
+			fs::remove(index);
+			if(useIndex) {
+				fs::copy_file("index.bak", index);
+			}
+
+			ShaderCache cache(dev);
+			std::vector<ShaderCache::CompiledShaderView> views;
+			auto ms = bench::measureOnce([&]{
+				views = cache.loadMany(requests, &pool);
+			});
+			best = std::min(best, ms);
+		}
+
+		std::printf("  %-24s %10.2f ms\n", useIndex ?
+			"loadMany, disk cache" : "loadMany, disk, no index", best);
+	}
+
+	fs::current_path(oldPath);
+	fs::remove_all(dir);
+}
@@ -0,0 +1,77 @@
+// Measures normal and tangent generation (see tkn/scene/shape.hpp)
+// on large meshes, compared to the serial scatter implementation
+// areaSmoothNormals used before.
+
+#include <tkn/scene/shape.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include "bench.hpp"
+
+#include <cstdio>
+
+using namespace tkn;
+
+std::vector<Vec3f> serialNormals(const Shape& shape) {
+	std::vector<Vec3f> normals(shape.positions.size(), {0.f, 0.f, 0.f});
+	auto& ids = shape.indices;
+	for(auto i = 0u; i < ids.size(); i += 3) {
+		auto& p0 = shape.positions[ids[i]];
+		auto n = nytl::cross(shape.positions[ids[i + 1]] - p0,
+			shape.positions[ids[i + 2]] - p0);
+		normals[ids[i + 0]] += n;
+		normals[ids[i + 1]] += n;
+		normals[ids[i + 2]] += n;
+	}
+
+	for(auto& n : normals) {
+		n = nytl::normalized(n);
+	}
+
+	return normals;
+}
+
+void run(const char* name, const Shape& shape) {
+	std::printf("%s: %zu vertices, %zu triangles\n", name,
+		shape.positions.size(), shape.indices.size() / 3);
+
+	// simple spherical mapping for the tangents
+	std::vector<Vec2f> uvs;
+	for(auto& p : shape.positions) {
+		auto n = nytl::normalized(p);
+		uvs.push_back({std::atan2(n.z, n.x), std::asin(n.y)});
+	}
+
+	ThreadPool single(1u);
+	auto& pool = ThreadPool::instance();
+
+	auto serial = bench::measureOnce([&]{
+		bench::consume(serialNormals(shape));
+	});
+	auto normals1 = bench::measureOnce([&]{
+		bench::consume(areaSmoothNormals(shape.positions, shape.indices, &single));
+	});
+	auto normalsN = bench::measureOnce([&]{
+		bench::consume(areaSmoothNormals(shape.positions, shape.indices, &pool));
+	});
+	auto tangents1 = bench::measureOnce([&]{
+		bench::consume(generateTangents(shape.positions, shape.normals, uvs,
+			shape.indices, &single));
+	});
+	auto tangentsN = bench::measureOnce([&]{
+		bench::consume(generateTangents(shape.positions, shape.normals, uvs,
+			shape.indices, &pool));
+	});
+
+	std::printf("  %-36s %10.2f ms\n", "normals, serial scatter", serial);
+	std::printf("  %-36s %10.2f ms\n", "areaSmoothNormals, 1 worker", normals1);
+	std::printf("  %-36s %10.2f ms (%u workers)\n", "areaSmoothNormals",
+		normalsN, pool.numWorkers());
+	std::printf("  %-36s %10.2f ms\n", "generateTangents, 1 worker", tangents1);
+	std::printf("  %-36s %10.2f ms (%u workers)\n", "generateTangents",
+		tangentsN, pool.numWorkers());
+}
+
+int main() {
+	run("uv sphere", generateUV(Sphere{}, 1024, 1024));
+	run("ico sphere", generateIco(8));
+}
@@ -0,0 +1,114 @@
+// Dense SdfGrid vs SparseSdfGrid (8^3 bricks, band of 2 cells) for the
+// distance field of a torus at 256^3 and 1024^3 samples: memory,
+// sampling, marching cubes and access to the stored values.
+// The dense grid at 1024^3 would need 4 GiB and is only listed.
+
+#include <tkn/sparseGrid.hpp>
+#include <tkn/threadPool.hpp>
+#include "bench.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace tkn;
+
+namespace {
+
+void torus(nytl::Span<const float> xs, float y, float z,
+		nytl::Span<float> values) {
+	for(auto i = 0u; i < xs.size(); ++i) {
+		auto q = std::sqrt(xs[i] * xs[i] + z * z) - 0.8f;
+		values[i] = 0.3f - std::sqrt(q * q + y * y);
+	}
+}
+
+double mib(std::size_t bytes) {
+	return bytes / (1024.0 * 1024.0);
+}
+
+} // anon namespace
+
+int main() {
+	auto& pool = ThreadPool::instance();
+	std::printf("torus distance field, %u threads\n", pool.numWorkers() + 1);
+
+	for(auto n : {256u, 1024u}) {
+		auto s = 3.f / n;
+		auto band = 2 * s;
+		std::printf("%u^3, band %.4f\n", n, band);
+
+		auto denseBytes = std::size_t(n) * n * n * sizeof(float);
+		if(n <= 256) {
+			SdfGrid dense;
+			dense.size = {n, n, n};
+			dense.start = {-1.5f, -1.5f, -1.5f};
+			dense.spacing = {s, s, s};
+
+			auto sampleMs = bench::measureOnce([&]{ sample(dense, torus); });
+			IsoMesh mesh;
+			auto mcMs = bench::measureOnce([&]{
+				mesh = marchingCubes(dense, 0.f);
+			});
+
+			std::printf("  %-8s %10.1f MiB, sample %8.1f ms, mc %8.1f ms, "
+				"%zu vertices\n", "dense", mib(denseBytes), sampleMs, mcMs,
+				mesh.positions.size());
+		} else {
+			std::printf("  %-8s %10.1f MiB\n", "dense", mib(denseBytes));
+		}
+
+		SparseSdfGrid sparse({n, n, n}, {-1.5f, -1.5f, -1.5f}, {s, s, s});
+		auto sampleMs = bench::measureOnce([&]{ sparse.sample(torus, band); });
+		IsoMesh mesh;
+		auto mcMs = bench::measureOnce([&]{
+			mesh = marchingCubes(sparse, 0.f);
+		});
+
+		std::printf("  %-8s %10.1f MiB, sample %8.1f ms, mc %8.1f ms, "
+			"%zu vertices, %zu bricks\n", "sparse", mib(sparse.memoryUsage()),
+			sampleMs, mcMs, mesh.positions.size(), sparse.bricks().size());
+
+		// access: all stored samples in order, random samples near
+		// the surface (mesh vertices) with and without accessor,
+		// coherent (x varies fastest) samples through the accessor
+		auto sum = 0.f;
+		auto seqMs = bench::measureOnce([&]{
+			sparse.forEachSample([&](u32, u32, u32, float v) { sum += v; });
+		});
+
+		std::vector<Vec3ui> random;
+		std::mt19937 rng(42);
+		std::uniform_int_distribution<std::size_t> dist(0, mesh.positions.size() - 1);
+		for(auto i = 0u; i < 1000000u; ++i) {
+			auto p = mesh.positions[dist(rng)];
+			random.push_back(Vec3ui{
+				u32((p.x + 1.5f) / s),
+				u32((p.y + 1.5f) / s),
+				u32((p.z + 1.5f) / s)});
+		}
+
+		auto randomMs = bench::measureOnce([&]{
+			for(auto& p : random) {
+				sum += sparse.value(p.x, p.y, p.z);
+			}
+		});
+
+		auto coherentMs = bench::measureOnce([&]{
+			SparseSdfGrid::Accessor acc(sparse);
+			for(auto& p : random) {
+				for(auto x = 0u; x < 8u && p.x + x < n; ++x) {
+					sum += acc.value(p.x + x, p.y, p.z);
+				}
+			}
+		});
+
+		bench::consume(sum);
+		auto stored = sparse.bricks().size() * SparseSdfGrid::brickSamples;
+		std::printf("  sequential %.2f ns/sample, random %.2f ns/sample, "
+			"accessor rows of 8 %.2f ns/sample\n",
+			1e6 * seqMs / stored, 1e6 * randomMs / random.size(),
+			1e6 * coherentMs / (8 * random.size()));
+	}
+}
@@ -0,0 +1,104 @@
+// Reports the SPIR-V size of all glsl shaders of tkn and the deferred
+// renderer, compiled without post-processing and with the optional
+// optimization and stripping stages (see tkn::SpirvOptions), as well
+// as the compile time.
+// NOTE: the optimizer only runs when glslang was built with
+// SPIRV-Tools, otherwise only stripping has an effect.
+
+#include <tkn/shader.hpp>
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace tkn;
+
+std::vector<fs::path> findShaders() {
+	std::vector<fs::path> ret;
+	auto base = fs::path(TKN_BASE_DIR "/src/");
+	for(auto dir : {"tkn/shaders", "deferred"}) {
+		for(auto& entry : fs::directory_iterator(base / dir)) {
+			auto ext = entry.path().extension();
+			if(ext == ".vert" || ext == ".frag" || ext == ".comp") {
+				ret.push_back(entry.path());
+			}
+		}
+	}
+
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+int main() {
+	const char* includeDirs[] = {
+		TKN_BASE_DIR "/src/",
+		TKN_BASE_DIR "/src/shaders/include/",
+	};
+
+	struct Config {
+		const char* name;
+		SpirvOptions options;
+	};
+
+	const Config configs[] = {
+		{"default", {}},
+		{"strip", {false, false, true}},
+		{"perf+strip", {true, false, true}},
+		{"size+strip", {true, true, true}},
+	};
+
+	constexpr auto configCount = sizeof(configs) / sizeof(configs[0]);
+	std::size_t total[configCount] {};
+	double ms[configCount] {};
+
+	std::printf("%-40s", "shader (bytes)");
+	for(auto& config : configs) {
+		std::printf(" %12s", config.name);
+	}
+	std::printf("\n");
+
+	auto base = fs::path(TKN_BASE_DIR "/src/");
+	for(auto& shader : findShaders()) {
+		std::size_t sizes[configCount] {};
+		for(auto i = 0u; i < configCount; ++i) {
+			std::vector<u32> spv;
+			ms[i] += bench::measureOnce([&]{
+				spv = compileShader(shader, {}, includeDirs, configs[i].options);
+			});
+			sizes[i] = spv.size() * sizeof(u32);
+		}
+
+		auto name = fs::relative(shader, base).string();
+		if(sizes[0] == 0u) {
+			std::printf("%-40s failed\n", name.c_str());
+			continue;
+		}
+
+		std::printf("%-40s", name.c_str());
+		for(auto i = 0u; i < configCount; ++i) {
+			total[i] += sizes[i];
+			std::printf(" %12zu", sizes[i]);
+		}
+		std::printf("\n");
+	}
+
+	std::printf("%-40s", "total");
+	for(auto i = 0u; i < configCount; ++i) {
+		std::printf(" %12zu", total[i]);
+	}
+
+	std::printf("\n%-40s", "relative");
+	for(auto i = 0u; i < configCount; ++i) {
+		std::printf(" %11.1f%%", 100.0 * total[i] / total[0]);
+	}
+
+	std::printf("\n%-40s", "compile time (ms)");
+	for(auto i = 0u; i < configCount; ++i) {
+		std::printf(" %12.1f", ms[i]);
+	}
+	std::printf("\n");
+}
@@ -0,0 +1,231 @@
+#include <tkn/scene/bvh.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include "bugged.hpp"
+
+using namespace tkn;
+
+std::vector<Aabb> randomBoxes(unsigned count, unsigned seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> pos(-50.f, 50.f);
+	std::uniform_real_distribution<float> size(0.01f, 2.f);
+
+	std::vector<Aabb> ret(count);
+	for(auto& box : ret) {
+		box.min = {pos(rng), pos(rng), pos(rng)};
+		box.max = box.min + Vec3f{size(rng), size(rng), size(rng)};
+	}
+
+	return ret;
+}
+
+bool outside(const FrustumPlanes& planes, const Aabb& box) {
+	for(auto& p : planes) {
+		auto v = Vec3f{
+			p[0] >= 0.f ? box.max.x : box.min.x,
+			p[1] >= 0.f ? box.max.y : box.min.y,
+			p[2] >= 0.f ? box.max.z : box.min.z};
+		if(p[0] * v.x + p[1] * v.y + p[2] * v.z + p[3] < 0.f) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::vector<u32> bruteCull(const FrustumPlanes& planes,
+		const std::vector<Aabb>& boxes) {
+	std::vector<u32> ret;
+	for(auto i = 0u; i < boxes.size(); ++i) {
+		if(!outside(planes, boxes[i])) {
+			ret.push_back(i);
+		}
+	}
+
+	return ret;
+}
+
+// Some frustum pointing along -z, near plane at z = -1, far at z = -60
+Frustum someFrustum() {
+	auto n = 0.5f;
+	auto f = 30.f;
+	return {{
+		{-n, n, -1.f}, {n, n, -1.f}, {n, -n, -1.f}, {-n, -n, -1.f},
+		{-f, f, -60.f}, {f, f, -60.f}, {f, -f, -60.f}, {-f, -f, -60.f},
+	}};
+}
+
+TEST(structure) {
+	auto boxes = randomBoxes(5000, 1);
+	Bvh bvh;
+	bvh.build(boxes);
+
+	auto& nodes = bvh.nodes();
+	EXPECT(nodes.empty(), false);
+
+	// every item is referenced by exactly one leaf, children come after
+	// their parent and are contained in it
+	std::vector<unsigned> refs(boxes.size());
+	for(auto i = 0u; i < nodes.size(); ++i) {
+		auto& node = nodes[i];
+		if(node.count == 0u) {
+			EXPECT(node.first > i, true);
+			EXPECT(node.first + 1 < nodes.size(), true);
+			for(auto c = node.first; c < node.first + 2; ++c) {
+				for(auto a = 0u; a < 3; ++a) {
+					EXPECT(nodes[c].min[a] >= node.min[a], true);
+					EXPECT(nodes[c].max[a] <= node.max[a], true);
+				}
+			}
+			continue;
+		}
+
+		EXPECT(node.count <= Bvh::maxLeafSize, true);
+		for(auto j = 0u; j < node.count; ++j) {
+			auto item = bvh.items()[node.first + j];
+			++refs[item];
+			for(auto a = 0u; a < 3; ++a) {
+				EXPECT(boxes[item].min[a] >= node.min[a], true);
+				EXPECT(boxes[item].max[a] <= node.max[a], true);
+			}
+		}
+	}
+
+	auto once = std::all_of(refs.begin(), refs.end(),
+		[](auto c) { return c == 1u; });
+	EXPECT(once, true);
+
+	// much better than testing all boxes
+	EXPECT(bvh.sahCost() < 100.f, true);
+}
+
+// Centroid extents in the denormal range must not be binned, the
+// bin scale would be infinite.
+TEST(denormal) {
+	for(auto spreadY : {true, false}) {
+		std::vector<Aabb> boxes(3000);
+		for(auto i = 0u; i < boxes.size(); ++i) {
+			auto d = float(i) * std::numeric_limits<float>::denorm_min();
+			auto y = spreadY ? float(i) : d;
+			boxes[i].min = {d, y, d};
+			boxes[i].max = {d, y, d};
+		}
+
+		Bvh bvh;
+		bvh.build(boxes);
+
+		std::vector<unsigned> refs(boxes.size());
+		for(auto& node : bvh.nodes()) {
+			EXPECT(node.count <= Bvh::maxLeafSize, true);
+			for(auto j = 0u; j < node.count; ++j) {
+				++refs[bvh.items()[node.first + j]];
+			}
+		}
+
+		auto once = std::all_of(refs.begin(), refs.end(),
+			[](auto c) { return c == 1u; });
+		EXPECT(once, true);
+	}
+}
+
+TEST(cull) {
+	auto boxes = randomBoxes(20000, 2);
+	Bvh bvh;
+	bvh.build(boxes);
+
+	auto planes = frustumPlanes(someFrustum());
+	std::vector<u32> visible;
+	bvh.cull(planes, visible);
+	std::sort(visible.begin(), visible.end());
+
+	auto expected = bruteCull(planes, boxes);
+	EXPECT(expected.empty(), false);
+	EXPECT(expected.size() < boxes.size(), true);
+	EXPECT(visible == expected, true);
+
+	// refit after moving all boxes
+	for(auto& box : boxes) {
+		auto off = Vec3f{0.1f * box.min.y, -3.f, 0.5f};
+		box.min += off;
+		box.max += off;
+	}
+
+	bvh.refit(boxes);
+	visible.clear();
+	bvh.cull(planes, visible);
+	std::sort(visible.begin(), visible.end());
+	EXPECT(visible == bruteCull(planes, boxes), true);
+
+	// view projection matrix variant: with the identity matrix the
+	// frustum is the ndc box [-1, 1]^2 x [0, 1]
+	auto ndc = frustumPlanes(nytl::identity<4, float>());
+	EXPECT(outside(ndc, {{-0.1f, -0.1f, 0.1f}, {0.1f, 0.1f, 0.2f}}), false);
+	EXPECT(outside(ndc, {{-0.1f, -0.1f, -0.5f}, {0.1f, 0.1f, -0.2f}}), true);
+	EXPECT(outside(ndc, {{1.1f, -0.1f, 0.5f}, {1.2f, 0.1f, 0.6f}}), true);
+}
+
+TEST(raycast) {
+	auto boxes = randomBoxes(20000, 3);
+	Bvh bvh;
+	bvh.build(boxes);
+
+	std::mt19937 rng(4);
+	std::uniform_real_distribution<float> dist(-1.f, 1.f);
+	for(auto r = 0u; r < 32; ++r) {
+		auto origin = Vec3f{0.f, 0.f, 0.f};
+		auto dir = nytl::normalized(Vec3f{dist(rng), dist(rng), dist(rng)});
+
+		std::vector<Bvh::RayHit> hits;
+		bvh.raycast(origin, dir, 100.f, hits);
+
+		// brute force slab test
+		std::vector<u32> expected;
+		for(auto i = 0u; i < boxes.size(); ++i) {
+			auto tmin = 0.f;
+			auto tmax = 100.f;
+			for(auto a = 0u; a < 3; ++a) {
+				auto t1 = (boxes[i].min[a] - origin[a]) / dir[a];
+				auto t2 = (boxes[i].max[a] - origin[a]) / dir[a];
+				tmin = std::max(tmin, std::min(t1, t2));
+				tmax = std::min(tmax, std::max(t1, t2));
+			}
+
+			if(tmin <= tmax) {
+				expected.push_back(i);
+			}
+		}
+
+		auto sorted = std::is_sorted(hits.begin(), hits.end(),
+			[](auto& a, auto& b) { return a.t < b.t; });
+		EXPECT(sorted, true);
+
+		std::vector<u32> items;
+		for(auto& hit : hits) {
+			items.push_back(hit.item);
+		}
+
+		std::sort(items.begin(), items.end());
+		EXPECT(items == expected, true);
+	}
+}
+
+TEST(transform) {
+	// rotation by 90 degrees around z, then translation
+	nytl::Mat4f mat = nytl::identity<4, float>();
+	mat[0][0] = 0.f;
+	mat[0][1] = -1.f;
+	mat[1][0] = 1.f;
+	mat[1][1] = 0.f;
+	mat[0][3] = 10.f;
+
+	auto box = transform(Aabb{{0.f, 0.f, 0.f}, {1.f, 2.f, 3.f}}, mat);
+	EXPECT(box.min.x, 8.f);
+	EXPECT(box.max.x, 10.f);
+	EXPECT(box.min.y, 0.f);
+	EXPECT(box.max.y, 1.f);
+	EXPECT(box.min.z, 0.f);
+	EXPECT(box.max.z, 3.f);
+}
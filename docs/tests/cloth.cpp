@@ -0,0 +1,292 @@
+#include <tkn/cloth.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <cmath>
+#include <vector>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+namespace {
+
+// Straight-forward implementation of the same model, as in
+// src/cloth/software.cpp before it used tkn::Cloth.
+struct Reference {
+	struct Node {
+		Vec3f pos;
+		Vec3f vel;
+		Vec3f lpos;
+		Vec3f npos;
+	};
+
+	unsigned w, h;
+	Cloth::Params params;
+	std::vector<Node> nodes;
+
+	Reference(unsigned xw, unsigned xh) : w(xw), h(xh), nodes(w * h) {
+		auto sx = -0.5f * (w - 1);
+		auto sz = -0.5f * (h - 1);
+		for(auto y = 0u; y < h; ++y) {
+			for(auto x = 0u; x < w; ++x) {
+				auto pos = Vec3f{sx + x, 0.f, sz + y};
+				nodes[y * w + x] = {pos, {}, pos, pos};
+			}
+		}
+	}
+
+	void step(float dt) {
+		for(auto y = 0u; y < h; ++y) {
+			for(auto x = 0u; x < w; ++x) {
+				auto& n = nodes[y * w + x];
+				if((x == 0 || x == w - 1) && (y == 0 || y == h - 1)) {
+					n.npos = n.pos;
+					continue;
+				}
+
+				auto f = params.mass * params.gravity;
+				auto add = [&](int dx, int dy, unsigned type, float l) {
+					auto nx = int(x) + dx;
+					auto ny = int(y) + dy;
+					if(nx < 0 || ny < 0 || nx >= int(w) || ny >= int(h)) {
+						return;
+					}
+
+					auto& o = nodes[ny * w + nx];
+					auto pd = o.pos - n.pos;
+					auto pl = nytl::length(pd);
+					pd *= 1.f / pl;
+					f += (params.ks[type] * (pl - l) +
+						params.kd[type] * dot(o.vel - n.vel, pd)) * pd;
+				};
+
+				add(-1, 0, 0, 1.f);
+				add(1, 0, 0, 1.f);
+				add(0, -1, 0, 1.f);
+				add(0, 1, 0, 1.f);
+				add(-2, 0, 1, 2.f);
+				add(2, 0, 1, 2.f);
+				add(0, -2, 1, 2.f);
+				add(0, 2, 1, 2.f);
+				add(-1, -1, 2, std::sqrt(2.f));
+				add(1, 1, 2, std::sqrt(2.f));
+				add(-1, 1, 2, std::sqrt(2.f));
+				add(1, -1, 2, std::sqrt(2.f));
+
+				f *= 1 / params.mass;
+				n.npos = 2 * n.pos - n.lpos + dt * dt * f;
+			}
+		}
+
+		for(auto& n : nodes) {
+			n.lpos = n.pos;
+			n.pos = n.npos;
+			n.vel = (1.f / dt) * (n.pos - n.lpos);
+		}
+	}
+};
+
+} // anon namespace
+
+TEST(reference) {
+	// not a multiple of the vector width, covers all border cases
+	constexpr auto w = 23u;
+	constexpr auto h = 13u;
+	constexpr auto dt = 0.01f;
+
+	ThreadPool pool(2u);
+	Cloth cloth(w, h);
+	Reference ref(w, h);
+	for(auto i = 0u; i < 100u; ++i) {
+		cloth.step(dt, &pool);
+		ref.step(dt);
+	}
+
+	auto maxDiff = 0.f;
+	for(auto i = 0u; i < w * h; ++i) {
+		auto diff = nytl::length(cloth.position(i) - ref.nodes[i].pos);
+		maxDiff = std::max(maxDiff, diff);
+	}
+
+	EXPECT(maxDiff < 1e-3f, true);
+
+	// it actually moved
+	auto center = cloth.id(w / 2, h / 2);
+	EXPECT(cloth.position(center).y < -0.1f, true);
+	EXPECT(cloth.velocity(center).y < 0.f, true);
+
+	// fixed corners
+	EXPECT(cloth.position(cloth.id(0, 0)) == ref.nodes[0].pos, true);
+	EXPECT(cloth.position(cloth.id(w - 1, h - 1)) ==
+		ref.nodes[w * h - 1].pos, true);
+}
+
+// Tile borders read the same neighbors as the reference.
+TEST(tiles) {
+	// multiple tiles in both dimensions
+	constexpr auto w = Cloth::tileWidth + 37u;
+	constexpr auto h = 3 * Cloth::tileHeight + 5u;
+
+	ThreadPool pool(4u);
+	Cloth cloth(w, h);
+	Reference ref(w, h);
+	for(auto i = 0u; i < 20u; ++i) {
+		cloth.step(0.01f, &pool);
+		ref.step(0.01f);
+	}
+
+	auto maxDiff = 0.f;
+	for(auto i = 0u; i < w * h; ++i) {
+		auto diff = nytl::length(cloth.position(i) - ref.nodes[i].pos);
+		maxDiff = std::max(maxDiff, diff);
+	}
+
+	EXPECT(maxDiff < 1e-3f, true);
+
+	std::vector<Vec3f> positions(cloth.nodeCount());
+	cloth.writePositions(positions, 0.5f);
+	auto id = cloth.id(3, 7);
+	EXPECT(positions[id] == 0.5f * cloth.position(id), true);
+}
+
+TEST(reset) {
+	Cloth cloth(8, 8);
+	auto start = cloth.position(cloth.id(4, 5));
+	for(auto i = 0u; i < 10u; ++i) {
+		cloth.step(0.01f);
+	}
+
+	EXPECT(cloth.position(cloth.id(4, 5)) == start, false);
+	cloth.reset();
+	EXPECT(cloth.position(cloth.id(4, 5)) == start, true);
+	EXPECT(cloth.velocity(cloth.id(4, 5)) == Vec3f{}, true);
+}
+
+namespace {
+
+// Maximum relative deviation of the structural springs from their
+// rest length.
+float maxStretch(const Cloth& cloth) {
+	auto ret = 0.f;
+	auto check = [&](std::size_t a, std::size_t b) {
+		auto len = nytl::length(cloth.position(b) - cloth.position(a));
+		auto rest = cloth.params.spacing;
+		ret = std::max(ret, std::abs(len - rest) / rest);
+	};
+
+	for(auto y = 0u; y < cloth.height(); ++y) {
+		for(auto x = 0u; x < cloth.width(); ++x) {
+			if(x + 1 < cloth.width()) {
+				check(cloth.id(x, y), cloth.id(x + 1, y));
+			}
+			if(y + 1 < cloth.height()) {
+				check(cloth.id(x, y), cloth.id(x, y + 1));
+			}
+		}
+	}
+
+	return ret;
+}
+
+bool finite(const Cloth& cloth) {
+	for(auto i = 0u; i < cloth.nodeCount(); ++i) {
+		if(!test::finite(cloth.position(i))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // anon namespace
+
+// Stiff springs at frame-rate time steps.
+TEST(xpbdStable) {
+	constexpr auto dt = 1 / 60.f;
+	ClothParams params;
+	params.solver = ClothSolver::xpbd;
+	params.ks = {5000.f, 5000.f, 5000.f};
+	params.kd = {1.f, 1.f, 1.f};
+
+	ThreadPool pool(2u);
+	Cloth cloth(33, 21, params);
+	for(auto i = 0u; i < 600u; ++i) {
+		cloth.step(dt, &pool);
+	}
+
+	EXPECT(finite(cloth), true);
+	EXPECT(maxStretch(cloth) < 0.1f, true);
+
+	// hangs between the corners
+	auto center = cloth.id(16, 10);
+	EXPECT(cloth.position(center).y < -0.1f, true);
+	EXPECT(cloth.position(center).y > -10.f, true);
+	EXPECT((cloth.position(cloth.id(32, 20)) == Vec3f{16.f, 0.f, 10.f}), true);
+
+	// softer springs stretch more
+	auto soft = params;
+	soft.ks = {50.f, 50.f, 50.f};
+	soft.kd = {0.03f, 0.03f, 0.03f};
+	Cloth softCloth(33, 21, soft);
+	for(auto i = 0u; i < 600u; ++i) {
+		softCloth.step(dt, &pool);
+	}
+
+	EXPECT(finite(softCloth), true);
+	EXPECT(softCloth.position(center).y < cloth.position(center).y, true);
+}
+
+// The colored gauss-seidel iterations don't depend on the number of
+// threads, as long as the coloring is valid.
+TEST(threads) {
+	constexpr auto w = 1024u + 13u;
+	constexpr auto h = 19u;
+
+	ThreadPool single(1u);
+	ThreadPool multi(4u);
+
+	ClothParams params;
+	params.solver = ClothSolver::xpbd;
+	params.iterations = 4u;
+	params.fixCorners = {true, false, true, false};
+
+	Cloth a(w, h, params);
+	Cloth b(w, h, params);
+	for(auto i = 0u; i < 10u; ++i) {
+		a.step(1 / 60.f, &single);
+		b.step(1 / 60.f, &multi);
+	}
+
+	auto equal = true;
+	for(auto i = 0u; i < w * h; ++i) {
+		equal &= (a.position(i) == b.position(i));
+		equal &= (a.velocity(i) == b.velocity(i));
+	}
+
+	EXPECT(equal, true);
+	EXPECT(finite(a), true);
+	EXPECT(a.position(a.id(w - 1, 0)).y < 0.f, true);
+}
+
+// Switching the solver between steps keeps the state consistent.
+TEST(switchSolver) {
+	ClothParams params;
+	Cloth cloth(16, 16, params);
+	for(auto i = 0u; i < 50u; ++i) {
+		cloth.step(0.01f);
+	}
+
+	cloth.params.solver = ClothSolver::xpbd;
+	for(auto i = 0u; i < 50u; ++i) {
+		cloth.step(0.01f);
+	}
+
+	cloth.params.solver = ClothSolver::verlet;
+	for(auto i = 0u; i < 50u; ++i) {
+		cloth.step(0.01f);
+	}
+
+	EXPECT(finite(cloth), true);
+	EXPECT(maxStretch(cloth) < 0.5f, true);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// Helpers shared by multiple tests.
+
+#include <tkn/isosurface.hpp>
+#include <tkn/scene/shape.hpp>
+#include <tkn/scene/meshOpt.hpp>
+#include <nytl/vec.hpp>
+#include <cmath>
+
+namespace tkn::test {
+
+template<std::size_t D, typename T>
+bool finite(const nytl::Vec<D, T>& vec) {
+	for(auto& val : vec) {
+		if(!std::isfinite(val)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// uv sphere with the given number of stacks and sectors,
+// deduplicated and optimized.
+inline Shape optimizedSphere(unsigned segments) {
+	auto shape = generateUV(Sphere{}, segments, segments);
+	optimizeMesh(shape);
+	return shape;
+}
+
+// Exact signed distance functions, positive inside.
+inline float sphereSdf(float x, float y, float z) {
+	return 1.f - std::sqrt(x * x + y * y + z * z);
+}
+
+inline float torusSdf(float x, float y, float z) {
+	auto q = std::sqrt(x * x + z * z) - 0.8f;
+	return 0.3f - std::sqrt(q * q + y * y);
+}
+
+inline SdfRowFunc rows(float (*func)(float, float, float)) {
+	return [func](nytl::Span<const float> xs, float y, float z,
+			nytl::Span<float> values) {
+		for(auto i = 0u; i < xs.size(); ++i) {
+			values[i] = func(xs[i], y, z);
+		}
+	};
+}
+
+// n^3 samples covering [-1.5, 1.5]^3
+inline SdfGrid denseGrid(unsigned n, const SdfRowFunc& func) {
+	SdfGrid ret;
+	ret.size = {n, n, n};
+	ret.start = {-1.5f, -1.5f, -1.5f};
+	auto s = 3.f / (n - 1);
+	ret.spacing = {s, s, s};
+	sample(ret, func);
+	return ret;
+}
+
+} // namespace tkn::test
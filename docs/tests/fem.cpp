@@ -0,0 +1,257 @@
+#include <tkn/fem.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <cmath>
+#include <vector>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+namespace {
+
+nytl::Mat2f rotation(float angle) {
+	auto c = std::cos(angle);
+	auto s = std::sin(angle);
+	return nytl::Mat2f{c, -s, s, c};
+}
+
+nytl::Mat2f mul(const nytl::Mat2f& a, const nytl::Mat2f& b) {
+	nytl::Mat2f ret;
+	for(auto i = 0u; i < 2u; ++i) {
+		for(auto j = 0u; j < 2u; ++j) {
+			ret[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j];
+		}
+	}
+	return ret;
+}
+
+bool near(const nytl::Mat2f& a, const nytl::Mat2f& b, float eps = 1e-5f) {
+	for(auto i = 0u; i < 2u; ++i) {
+		for(auto j = 0u; j < 2u; ++j) {
+			if(std::abs(a[i][j] - b[i][j]) > eps) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// 1D laplacian plus identity, symmetric positive definite
+CsrMatrix laplacian(unsigned n) {
+	CsrMatrix ret;
+	ret.rows = n;
+	ret.rowStart.push_back(0u);
+	for(auto i = 0u; i < n; ++i) {
+		if(i > 0) {
+			ret.cols.push_back(i - 1);
+			ret.values.push_back(-1.f);
+		}
+
+		ret.cols.push_back(i);
+		ret.values.push_back(3.f);
+
+		if(i + 1 < n) {
+			ret.cols.push_back(i + 1);
+			ret.values.push_back(-1.f);
+		}
+
+		ret.rowStart.push_back(u32(ret.cols.size()));
+	}
+
+	return ret;
+}
+
+} // anon namespace
+
+TEST(polar) {
+	// F = R * S with S symmetric positive definite
+	auto R = rotation(0.7f);
+	auto S = nytl::Mat2f{1.5f, 0.3f, 0.3f, 0.8f};
+	EXPECT(near(polarRotation(mul(R, S)), R), true);
+
+	// pure rotations, also by more than 90 degrees
+	EXPECT(near(polarRotation(rotation(2.5f)), rotation(2.5f)), true);
+	EXPECT(near(polarRotation(rotation(-1.2f)), rotation(-1.2f)), true);
+
+	// uniform scaling has no rotation
+	EXPECT(near(polarRotation(nytl::Mat2f{3.f, 0.f, 0.f, 3.f}), rotation(0.f)), true);
+
+	// degenerate
+	EXPECT(near(polarRotation(nytl::Mat2f{}), rotation(0.f)), true);
+
+	// inverted: still a proper rotation
+	auto inv = polarRotation(nytl::Mat2f{-1.f, 0.2f, 0.1f, 1.f});
+	auto det = inv[0][0] * inv[1][1] - inv[0][1] * inv[1][0];
+	EXPECT(std::abs(det - 1.f) < 1e-5f, true);
+}
+
+TEST(pcg) {
+	constexpr auto n = 3000u;
+	auto A = laplacian(n);
+
+	std::vector<float> expected(n);
+	for(auto i = 0u; i < n; ++i) {
+		expected[i] = std::sin(0.01f * i);
+	}
+
+	std::vector<float> b(n);
+	multiply(A, expected, b);
+
+	ThreadPool single(1u);
+	ThreadPool multi(4u);
+
+	std::vector<float> x1(n, 0.f);
+	auto res = solvePcg(A, b, x1, 500u, 1e-6f, &single);
+	EXPECT(res.residual <= 1e-6f, true);
+	EXPECT(res.iterations > 0u, true);
+
+	auto maxDiff = 0.f;
+	for(auto i = 0u; i < n; ++i) {
+		maxDiff = std::max(maxDiff, std::abs(x1[i] - expected[i]));
+	}
+	EXPECT(maxDiff < 1e-4f, true);
+
+	// independent of the number of threads
+	std::vector<float> x2(n, 0.f);
+	auto res2 = solvePcg(A, b, x2, 500u, 1e-6f, &multi);
+	EXPECT(res2.iterations, res.iterations);
+	EXPECT(x1 == x2, true);
+
+	// converged initial guess
+	auto res3 = solvePcg(A, b, expected, 500u, 1e-3f, &single);
+	EXPECT(res3.iterations, 0u);
+}
+
+// Rigid motion must not create elastic forces (this is what the
+// corotational formulation is for).
+TEST(rigidRotation) {
+	FemParams params;
+	params.gravity = {};
+	params.damping = 0.f;
+	auto body = FemBody::grid(8, 4, 0.25f, params);
+	EXPECT(body.colorCount() >= 6u, true);
+
+	auto R = rotation(1.3f);
+	auto rest = body.restPositions();
+	std::vector<Vec2f> rotated(rest.size());
+	for(auto i = 0u; i < rest.size(); ++i) {
+		auto p = rest[i];
+		rotated[i] = {R[0][0] * p.x + R[0][1] * p.y, R[1][0] * p.x + R[1][1] * p.y};
+	}
+
+	// set the displacement via velocity in a single step
+	auto dt = 0.01f;
+	body.params.youngsModulus = 0.f;
+	body.updateMaterial();
+	for(auto i = 0u; i < rest.size(); ++i) {
+		body.velocities()[i] = (1 / dt) * (rotated[i] - rest[i]);
+	}
+	body.step(dt);
+	for(auto& v : body.velocities()) {
+		v = {};
+	}
+
+	body.params.youngsModulus = 500.f;
+	body.updateMaterial();
+	for(auto i = 0u; i < 10u; ++i) {
+		body.step(1 / 60.f);
+	}
+
+	auto maxDiff = 0.f;
+	for(auto i = 0u; i < rest.size(); ++i) {
+		maxDiff = std::max(maxDiff, nytl::length(body.position(i) - rotated[i]));
+	}
+
+	EXPECT(maxDiff < 1e-3f, true);
+}
+
+// Beam fixed on one side, bending under gravity with large steps.
+TEST(beam) {
+	constexpr auto w = 32u;
+	constexpr auto h = 4u;
+
+	FemParams params;
+	params.youngsModulus = 50000.f;
+	params.damping = 1.f;
+
+	auto body = FemBody::grid(w, h, 0.25f, params);
+	for(auto y = 0u; y < h; ++y) {
+		body.fix(y * w);
+	}
+
+	ThreadPool pool(2u);
+	for(auto i = 0u; i < 600u; ++i) {
+		body.step(1 / 60.f, &pool);
+	}
+
+	EXPECT(body.lastSolve().residual <= body.params.tolerance, true);
+
+	// fixed nodes didn't move
+	EXPECT(body.displacements()[0] == Vec2f{}, true);
+	EXPECT(body.displacements()[(h - 1) * w] == Vec2f{}, true);
+
+	// the tip bends down but the beam doesn't collapse, came to rest
+	auto tip = body.position(w - 1);
+	EXPECT(finite(tip), true);
+	EXPECT(tip.y < -0.5f, true);
+	EXPECT(tip.y > -3.f, true);
+	EXPECT(nytl::length(body.velocities()[w - 1]) < 0.05f, true);
+
+	// total mass
+	auto mass = 0.f;
+	for(auto i = 0u; i < w * h; ++i) {
+		mass += body.mass(i);
+	}
+	EXPECT(std::abs(mass - (w - 1) * (h - 1) * 0.25f * 0.25f) < 1e-4f, true);
+}
+
+// The colored parallel assembly gives the same result for any number
+// of threads.
+TEST(threads) {
+	ThreadPool single(1u);
+	ThreadPool multi(4u);
+
+	auto a = FemBody::grid(120, 60, 0.1f);
+	auto b = FemBody::grid(120, 60, 0.1f);
+	a.fix(0);
+	b.fix(0);
+
+	for(auto i = 0u; i < 5u; ++i) {
+		a.step(1 / 60.f, &single);
+		b.step(1 / 60.f, &multi);
+	}
+
+	auto equal = true;
+	for(auto i = 0u; i < 120u * 60u; ++i) {
+		equal &= (a.position(i) == b.position(i));
+	}
+
+	EXPECT(equal, true);
+	EXPECT(a.lastSolve().iterations, b.lastSolve().iterations);
+}
+
+// A node shared by more than 64 elements, each of them needs its
+// own color.
+TEST(fan) {
+	auto n = 100u;
+	std::vector<Vec2f> positions {{0.f, 0.f}};
+	std::vector<FemBody::Triangle> triangles;
+	for(auto i = 0u; i < n; ++i) {
+		auto a = 6.2831853f * i / n;
+		positions.push_back({std::cos(a), std::sin(a)});
+		triangles.push_back({0u, 1 + i, 1 + (i + 1) % n});
+	}
+
+	FemBody body(positions, triangles);
+	EXPECT(body.colorCount(), n);
+
+	body.fix(0);
+	body.step(1 / 60.f);
+	auto allFinite = true;
+	for(auto i = 0u; i <= n; ++i) {
+		allFinite &= finite(body.position(i));
+	}
+	EXPECT(allFinite, true);
+}
@@ -0,0 +1,188 @@
+// Tests the reassembly of fragmented packages in tkn::MessageManager.
+
+#include <tkn/connection.hpp>
+#include <tkn/recvBuf.hpp>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "bugged.hpp"
+
+using namespace tkn;
+using Package = std::vector<std::byte>;
+
+namespace {
+
+// Receives messages consisting of a u32 size and that many bytes with
+// value (i & 0xFF) and records their sizes.
+struct Receiver {
+	MessageManager manager;
+	std::vector<uint32_t> received;
+
+	Receiver() {
+		manager.messageHandler([this](uint32_t, RecvBuf& buf) {
+			auto size = read<uint32_t>(buf);
+			if(size > tkn::size(buf)) {
+				return false;
+			}
+
+			for(auto i = 0u; i < size; ++i) {
+				if(read<std::byte>(buf) != std::byte(i & 0xFF)) {
+					return false;
+				}
+			}
+
+			received.push_back(size);
+			return true;
+		});
+	}
+
+	PackageStatus process(const Package& pkg) {
+		// alternate between the owning and non-owning overload
+		if(pkg.size() % 2) {
+			return manager.processPackage(asio::buffer(pkg.data(), pkg.size()));
+		}
+
+		auto buf = manager.recvBuffer();
+		std::memcpy(buf.data(), pkg.data(), pkg.size());
+		buf.resize(pkg.size());
+		return manager.processPackage(std::move(buf));
+	}
+};
+
+// Returns the packages of the next message with the given size.
+std::vector<Package> send(MessageManager& sender, uint32_t size) {
+	std::vector<std::byte> msg(sizeof(uint32_t) + size);
+	std::memcpy(msg.data(), &size, sizeof(size));
+	for(auto i = 0u; i < size; ++i) {
+		msg[sizeof(uint32_t) + i] = std::byte(i & 0xFF);
+	}
+
+	sender.queueMsg(msg);
+	std::vector<Package> ret;
+	for(auto& buf : sender.packages()) {
+		auto data = static_cast<const std::byte*>(buf.data());
+		ret.emplace_back(data, data + buf.size());
+	}
+
+	return ret;
+}
+
+} // anon namespace
+
+TEST(outOfOrder) {
+	MessageManager sender;
+	Receiver receiver;
+
+	auto pkgs = send(sender, 10000u);
+	EXPECT(pkgs.size() > 4u, true);
+
+	// last, first, then the rest reversed
+	std::rotate(pkgs.rbegin(), pkgs.rbegin() + 1, pkgs.rend());
+	std::reverse(pkgs.begin() + 2, pkgs.end());
+	for(auto i = 0u; i + 1 < pkgs.size(); ++i) {
+		EXPECT(receiver.process(pkgs[i]), PackageStatus::fragment);
+	}
+
+	EXPECT(receiver.process(pkgs.back()), PackageStatus::message);
+	EXPECT(receiver.received.size(), 1u);
+	EXPECT(receiver.received[0], 10000u);
+}
+
+TEST(duplicates) {
+	MessageManager sender;
+	Receiver receiver;
+
+	auto pkgs = send(sender, 5000u);
+	for(auto i = 0u; i + 1 < pkgs.size(); ++i) {
+		EXPECT(receiver.process(pkgs[i]), PackageStatus::fragment);
+		EXPECT(receiver.process(pkgs[i]), PackageStatus::fragment);
+	}
+
+	EXPECT(receiver.process(pkgs.back()), PackageStatus::message);
+	EXPECT(receiver.received.size(), 1u);
+
+	// the package was already handled, receiving it again must
+	// not dispatch the message again
+	for(auto& pkg : pkgs) {
+		EXPECT(receiver.process(pkg) != PackageStatus::message, true);
+	}
+
+	EXPECT(receiver.received.size(), 1u);
+}
+
+TEST(lost) {
+	MessageManager sender;
+	Receiver receiver;
+
+	auto pkgs = send(sender, 5000u);
+	auto lost = pkgs.size() / 2;
+	for(auto i = 0u; i < pkgs.size(); ++i) {
+		if(i != lost) {
+			EXPECT(receiver.process(pkgs[i]), PackageStatus::fragment);
+		}
+	}
+
+	EXPECT(receiver.received.size(), 0u);
+	EXPECT(receiver.manager.discardFragments(std::chrono::seconds(1)), 0u);
+	EXPECT(receiver.manager.discardFragments({}), 1u);
+
+	// arrives too late, the other fragments were discarded
+	EXPECT(receiver.process(pkgs[lost]), PackageStatus::fragment);
+	EXPECT(receiver.received.size(), 0u);
+
+	// the next package is not affected
+	pkgs = send(sender, 5000u);
+	for(auto i = 0u; i + 1 < pkgs.size(); ++i) {
+		EXPECT(receiver.process(pkgs[i]), PackageStatus::fragment);
+	}
+
+	EXPECT(receiver.process(pkgs.back()), PackageStatus::message);
+	EXPECT(receiver.received.size(), 1u);
+}
+
+TEST(timeout) {
+	MessageManager sender;
+	Receiver receiver;
+	receiver.manager.fragmentTimeout(std::chrono::milliseconds(10));
+
+	auto pkgs = send(sender, 5000u);
+	for(auto i = 0u; i + 1 < pkgs.size(); ++i) {
+		EXPECT(receiver.process(pkgs[i]), PackageStatus::fragment);
+	}
+
+	// the incomplete package expires when the next fragment arrives
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT(receiver.process(pkgs.back()), PackageStatus::fragment);
+	EXPECT(receiver.received.size(), 0u);
+}
+
+TEST(limit) {
+	MessageManager sender;
+	Receiver receiver;
+
+	// only the first fragments of too many packages arrive
+	std::vector<std::vector<Package>> msgs;
+	for(auto i = 0u; i < MessageManager::maxFragmentedPackages + 1; ++i) {
+		msgs.push_back(send(sender, 5000u));
+		EXPECT(receiver.process(msgs.back()[0]), PackageStatus::fragment);
+	}
+
+	// the first one was discarded
+	auto& first = msgs.front();
+	for(auto i = 1u; i < first.size(); ++i) {
+		EXPECT(receiver.process(first[i]), PackageStatus::fragment);
+	}
+
+	EXPECT(receiver.received.size(), 0u);
+
+	// completing the fragmented package of the first one discarded
+	// the second one but the last one is still there
+	auto& last = msgs.back();
+	for(auto i = 1u; i + 1 < last.size(); ++i) {
+		EXPECT(receiver.process(last[i]), PackageStatus::fragment);
+	}
+
+	EXPECT(receiver.process(last.back()), PackageStatus::message);
+	EXPECT(receiver.received.size(), 1u);
+}
@@ -0,0 +1,161 @@
+#include <tkn/fswatch.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "bugged.hpp"
+
+using namespace std::chrono_literals;
+namespace fs = std::filesystem;
+
+namespace {
+
+const auto dir = fs::path("tkn_test_fswatch");
+
+fs::path file(const char* name) {
+	fs::create_directories(dir);
+	auto path = dir / name;
+	std::ofstream(path) << "initial";
+	return path;
+}
+
+void write(const fs::path& path, const char* content) {
+	std::ofstream(path, std::ios::app) << content;
+}
+
+// Calls update until a batch was dispatched or the timeout was reached.
+// The timeouts are generous, the tests should not depend on scheduling.
+bool waitBatch(tkn::FileWatcher& watcher, std::chrono::milliseconds timeout = 10s) {
+	auto start = std::chrono::steady_clock::now();
+	auto count = watcher.batchCount();
+	while(std::chrono::steady_clock::now() - start < timeout) {
+		watcher.update();
+		if(watcher.batchCount() != count) {
+			return true;
+		}
+
+		std::this_thread::sleep_for(5ms);
+	}
+
+	return false;
+}
+
+} // anon namespace
+
+TEST(basic) {
+	auto a = file("a.glsl");
+	auto b = file("b.glsl");
+
+	tkn::FileWatcher watcher(20ms);
+	auto ida = watcher.watch(a.string());
+	auto idb = watcher.watch(b.string());
+	EXPECT(ida != 0u, true);
+	EXPECT(idb != 0u, true);
+
+	watcher.update();
+	EXPECT(watcher.batchCount(), 0u);
+	EXPECT(watcher.check(ida), false);
+
+	write(a, "change");
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(watcher.check(idb), false);
+	EXPECT(watcher.check(ida), true);
+	EXPECT(watcher.check(ida), false);
+
+	watcher.unregsiter(ida);
+	watcher.unregsiter(idb);
+	fs::remove_all(dir);
+}
+
+// A burst of changes to multiple files must result in one batch
+// containing every changed watch once.
+TEST(coalesce) {
+	auto a = file("a.glsl");
+	auto b = file("b.glsl");
+	auto c = file("c.glsl");
+
+	// The burst takes ~50ms, the debounce must be long enough that it
+	// is not split even when the thread is descheduled for a while.
+	tkn::FileWatcher watcher(1s);
+	auto ida = watcher.watch(a.string());
+	auto idb = watcher.watch(b.string());
+	auto idc = watcher.watch(c.string());
+	auto ida2 = watcher.watch(a.string());
+
+	std::vector<std::vector<std::uint64_t>> batches;
+	auto cb = watcher.onChange([&](nytl::Span<const std::uint64_t> ids) {
+		batches.emplace_back(ids.begin(), ids.end());
+	});
+
+	for(auto i = 0u; i < 5u; ++i) {
+		write(a, "a");
+		write(b, "b");
+		std::this_thread::sleep_for(10ms);
+		watcher.update();
+	}
+
+	EXPECT(batches.size(), 0u);
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(batches.size(), 1u);
+
+	auto& batch = batches[0];
+	std::sort(batch.begin(), batch.end());
+	auto expected = std::vector<std::uint64_t>{ida, idb, ida2};
+	std::sort(expected.begin(), expected.end());
+	EXPECT(batch == expected, true);
+	EXPECT(watcher.check(idc), false);
+
+	// nothing more is dispatched
+	EXPECT(waitBatch(watcher, 1500ms), false);
+
+	watcher.removeCallback(cb);
+	write(c, "c");
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(batches.size(), 1u);
+	EXPECT(watcher.check(idc), true);
+
+	fs::remove_all(dir);
+}
+
+// Editors often write a new file and move it over the old one.
+TEST(replace) {
+	auto a = file("a.glsl");
+	tkn::FileWatcher watcher(20ms);
+	auto id = watcher.watch(a.string());
+
+	auto tmp = file("a.glsl.tmp");
+	fs::rename(tmp, a);
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(watcher.check(id), true);
+
+	// the watch must still work for the new file
+	write(a, "change");
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(watcher.check(id), true);
+
+	fs::remove_all(dir);
+}
+
+// The file is removed and only recreated after the batch was dispatched.
+// The watch must be re-added without any further event.
+TEST(recreate) {
+	auto a = file("a.glsl");
+	tkn::FileWatcher watcher(20ms);
+	auto id = watcher.watch(a.string());
+
+	fs::remove(a);
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(watcher.check(id), true);
+
+	file("a.glsl");
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(watcher.check(id), true);
+
+	write(a, "change");
+	EXPECT(waitBatch(watcher), true);
+	EXPECT(watcher.check(id), true);
+
+	fs::remove_all(dir);
+}
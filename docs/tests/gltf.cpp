@@ -0,0 +1,149 @@
+#include <tkn/gltf.hpp>
+#include <nytl/approx.hpp>
+#include <cstring>
+#include "bugged.hpp"
+
+using nytl::approx;
+
+// Adds a buffer, buffer view and accessor with the given data to the model.
+template<typename T>
+tkn::gltf::Accessor addAccessor(tkn::gltf::Model& model,
+		const std::vector<T>& data, int componentType, int type,
+		unsigned stride = 0u, unsigned offset = 0u, bool normalized = false) {
+	auto& buf = model.buffers.emplace_back();
+	buf.data.resize(data.size() * sizeof(T));
+	std::memcpy(buf.data.data(), data.data(), buf.data.size());
+
+	auto& bv = model.bufferViews.emplace_back();
+	bv.buffer = model.buffers.size() - 1;
+	bv.byteOffset = 0u;
+	bv.byteLength = buf.data.size();
+	bv.byteStride = stride;
+
+	auto elemSize = tinygltf::GetComponentSizeInBytes(componentType) *
+		tinygltf::GetTypeSizeInBytes(type);
+	auto& acc = model.accessors.emplace_back();
+	acc.bufferView = model.bufferViews.size() - 1;
+	acc.byteOffset = offset;
+	acc.componentType = componentType;
+	acc.type = type;
+	acc.normalized = normalized;
+	acc.count = (buf.data.size() - offset) / (stride ? stride : elemSize);
+	return acc;
+}
+
+// Decoding must give the same results as iterating over the accessor
+template<std::size_t N, typename T>
+void checkRange(const tkn::gltf::Model& model, const tkn::gltf::Accessor& acc) {
+	auto decoded = tkn::decode<N, T>(model, acc);
+	EXPECT(decoded.size(), acc.count);
+
+	auto i = 0u;
+	for(auto val : tkn::range<N, T>(model, acc)) {
+		EXPECT(decoded[i] == val, true);
+		++i;
+	}
+}
+
+TEST(indices) {
+	tkn::gltf::Model model;
+
+	// long enough to cover the vectorized and scalar tail paths
+	std::vector<std::uint8_t> i8(37);
+	std::vector<std::uint16_t> i16(37);
+	std::vector<std::uint32_t> i32(37);
+	for(auto i = 0u; i < i8.size(); ++i) {
+		i8[i] = (i * 7) % 256;
+		i16[i] = 65535 - i * 1000;
+		i32[i] = 100000 + i;
+	}
+
+	checkRange<1, std::uint32_t>(model, addAccessor(model, i8,
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, TINYGLTF_TYPE_SCALAR));
+	checkRange<1, std::uint32_t>(model, addAccessor(model, i16,
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_TYPE_SCALAR));
+	checkRange<1, std::uint32_t>(model, addAccessor(model, i32,
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, TINYGLTF_TYPE_SCALAR));
+}
+
+TEST(floats) {
+	tkn::gltf::Model model;
+
+	std::vector<float> data(3 * 21);
+	for(auto i = 0u; i < data.size(); ++i) {
+		data[i] = 0.25f * i - 3.f;
+	}
+
+	// tight, vec2 -> vec3 (fill), vec3 -> vec2 (skip)
+	auto tight = addAccessor(model, data, TINYGLTF_COMPONENT_TYPE_FLOAT,
+		TINYGLTF_TYPE_VEC3);
+	checkRange<3, float>(model, tight);
+	checkRange<2, float>(model, tight);
+	checkRange<4, float>(model, tight);
+
+	// interleaved, using the second vec2 of every 12 byte element
+	auto inter = addAccessor(model, data, TINYGLTF_COMPONENT_TYPE_FLOAT,
+		TINYGLTF_TYPE_VEC2, 12u, 4u);
+	checkRange<2, float>(model, inter);
+	checkRange<3, float>(model, inter);
+
+	auto decoded = tkn::decode<3, float>(model, inter);
+	EXPECT(decoded[1].x, data[4]);
+	EXPECT(decoded[1].y, data[5]);
+	EXPECT(decoded[1].z, 0.f);
+}
+
+TEST(normalized) {
+	tkn::gltf::Model model;
+
+	std::vector<std::uint16_t> u16(2 * 13);
+	std::vector<std::uint8_t> u8(4 * 13);
+	for(auto i = 0u; i < u16.size(); ++i) {
+		u16[i] = i * 2500;
+	}
+	for(auto i = 0u; i < u8.size(); ++i) {
+		u8[i] = i * 5;
+	}
+
+	auto a16 = addAccessor(model, u16, TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT,
+		TINYGLTF_TYPE_VEC2, 0u, 0u, true);
+	auto uvs = tkn::decode<2, float>(model, a16);
+	for(auto i = 0u; i < uvs.size(); ++i) {
+		EXPECT(uvs[i].x, approx(u16[2 * i] / 65535.f));
+		EXPECT(uvs[i].y, approx(u16[2 * i + 1] / 65535.f));
+	}
+
+	auto a8 = addAccessor(model, u8, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE,
+		TINYGLTF_TYPE_VEC4, 0u, 0u, true);
+	auto colors = tkn::decode<4, float>(model, a8);
+	EXPECT(colors.back().w, approx(u8.back() / 255.f));
+	EXPECT(colors[3].x, approx(u8[12] / 255.f));
+
+	std::vector<std::int8_t> i8 = {-128, -127, 0, 127};
+	auto as8 = addAccessor(model, i8, TINYGLTF_COMPONENT_TYPE_BYTE,
+		TINYGLTF_TYPE_SCALAR, 0u, 0u, true);
+	auto snorm = tkn::decode<1, float>(model, as8);
+	EXPECT(snorm[0], -1.f);
+	EXPECT(snorm[1], -1.f);
+	EXPECT(snorm[2], 0.f);
+	EXPECT(snorm[3], 1.f);
+}
+
+TEST(invalid) {
+	tkn::gltf::Model model;
+	std::vector<float> data(6);
+	auto acc = addAccessor(model, data, TINYGLTF_COMPONENT_TYPE_FLOAT,
+		TINYGLTF_TYPE_VEC3);
+
+	auto copy = acc;
+	copy.count = 3;
+	ERROR(tkn::accessorData(model, copy), std::runtime_error);
+
+	copy = acc;
+	copy.bufferView = 5;
+	ERROR(tkn::accessorData(model, copy), std::runtime_error);
+
+	copy = acc;
+	copy.sparse.isSparse = true;
+	ERROR(tkn::accessorData(model, copy), std::runtime_error);
+}
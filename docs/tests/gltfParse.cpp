@@ -0,0 +1,309 @@
+#include <tkn/gltfParse.hpp>
+#include <tkn/scene/scene.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "bugged.hpp"
+
+using namespace tkn;
+namespace fs = std::filesystem;
+
+// Covers most of the gltf properties, unknown properties, extensions,
+// extras, escapes and numbers in different forms.
+const char* modelJson = R"json({
+	"asset": {"version": "2.0", "generator": "tkn \"test\"\té😀\/"},
+	"scene": 0,
+	"scenes": [{"nodes": [0], "name": "scene"}],
+	"nodes": [
+		{
+			"mesh": 0, "children": [1], "name": "root",
+			"translation": [1, 2.5, -3e-2], "rotation": [0, 0, 0, 1],
+			"extras": {"a": 1, "b": [1.5, "x", null], "c": {}, "d": true}
+		}, {
+			"matrix": [1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0.1, 0.2, 0.3, 1],
+			"scale": [2, 2, 2], "camera": 0
+		}
+	],
+	"meshes": [{
+		"name": "triangle",
+		"primitives": [{
+			"attributes": {"POSITION": 0, "NORMAL": 1},
+			"indices": 2, "material": 0,
+			"extensions": {"KHR_foo": {"x": 1}, "KHR_empty": {}}
+		}]
+	}],
+	"accessors": [
+		{"bufferView": 0, "componentType": 5126, "count": 3, "type": "VEC3",
+			"min": [0, 0, 0], "max": [1.0, 1E0, 0]},
+		{"bufferView": 0, "byteOffset": 36, "componentType": 5126,
+			"count": 3, "type": "VEC3"},
+		{"bufferView": 1, "componentType": 5123, "count": 3, "type": "SCALAR"}
+	],
+	"bufferViews": [
+		{"buffer": 0, "byteLength": 72},
+		{"buffer": 0, "byteOffset": 72, "byteLength": 6}
+	],
+	"buffers": [
+		BUFFER0,
+		{"byteLength": 4, "uri": "data:application/octet-stream;base64,AQIDBA=="}
+	],
+	"materials": [{
+		"name": "material",
+		"pbrMetallicRoughness": {
+			"baseColorFactor": [1, 0.5, 0.25, 1],
+			"metallicFactor": 0.5,
+			"baseColorTexture": {"index": 0, "texCoord": 1,
+				"extensions": {"KHR_texture_transform": {"scale": [2, 2]}}}
+		},
+		"normalTexture": {"index": 0, "scale": 0.8},
+		"doubleSided": true, "alphaMode": "MASK", "alphaCutoff": 0.3,
+		"emissiveFactor": [0, 0, 0]
+	}],
+	"textures": [{"sampler": 0, "source": 0}],
+	"images": [{"uri": "albedo.png"}],
+	"samplers": [{"magFilter": 9729, "wrapS": 33071}],
+	"cameras": [{"type": "perspective",
+		"perspective": {"yfov": 0.8, "znear": 0.01, "aspectRatio": 1.5}}],
+	"animations": [{
+		"channels": [{"sampler": 0, "target": {"node": 0, "path": "translation"}}],
+		"samplers": [{"input": 2, "output": 0, "interpolation": "STEP"}]
+	}],
+	"skins": [{"joints": [0, 1], "inverseBindMatrices": 0}],
+	"extensionsUsed": ["KHR_foo"],
+	"unknown": {"nested": [1, {"deep": [[], {}]}], "s": "\\\""},
+	"extras": {"number": 123456, "exp": 1.5e300, "neg": -0.000125}
+})json";
+
+std::vector<unsigned char> bufferContent() {
+	float positions[] = {0, 0, 0, 1, 0, 0, 0, 1, 0};
+	float normals[] = {0, 0, 1, 0, 0, 1, 0, 0, 1};
+	std::uint16_t indices[] = {0, 1, 2};
+
+	std::vector<unsigned char> ret(78);
+	std::memcpy(ret.data(), positions, 36);
+	std::memcpy(ret.data() + 36, normals, 36);
+	std::memcpy(ret.data() + 72, indices, 6);
+	return ret;
+}
+
+std::string json(const char* buffer0) {
+	std::string ret = modelJson;
+	auto pos = ret.find("BUFFER0");
+	ret.replace(pos, 7, buffer0);
+	return ret;
+}
+
+std::vector<unsigned char> glb(std::string_view json,
+		const std::vector<unsigned char>& bin) {
+	auto pad = [](std::size_t size) { return (size + 3u) & ~std::size_t(3u); };
+	auto jsonSize = pad(json.size());
+	auto binSize = pad(bin.size());
+
+	std::vector<unsigned char> ret(12 + 8 + jsonSize + 8 + binSize, 0u);
+	auto write = [&](std::size_t off, std::uint32_t val) {
+		std::memcpy(ret.data() + off, &val, 4u);
+	};
+
+	write(0, 0x46546C67u);
+	write(4, 2u);
+	write(8, ret.size());
+	write(12, jsonSize);
+	write(16, 0x4E4F534Au);
+	std::memset(ret.data() + 20, ' ', jsonSize);
+	std::memcpy(ret.data() + 20, json.data(), json.size());
+
+	auto off = 20 + jsonSize;
+	write(off, binSize);
+	write(off + 4, 0x004E4942u);
+	std::memcpy(ret.data() + off + 8, bin.data(), bin.size());
+	return ret;
+}
+
+fs::path writeFile(const std::string& name, const void* data, std::size_t size) {
+	auto dir = fs::temp_directory_path() / "tkn-gltfParse";
+	fs::create_directories(dir);
+	auto path = dir / name;
+	std::ofstream(path, std::ios::binary).write(
+		static_cast<const char*>(data), size);
+	return path;
+}
+
+std::string_view bytes(const gltf::Buffer& buf) {
+	auto data = bufferData(buf);
+	return {reinterpret_cast<const char*>(data.data()), data.size()};
+}
+
+// The parsed model must be the same as the one loaded by tinygltf.
+void compare(const gltf::Model& a, const gltf::Model& b) {
+	EXPECT(a.asset == b.asset, true);
+	EXPECT(a.defaultScene, b.defaultScene);
+	EXPECT(a.scenes == b.scenes, true);
+	EXPECT(a.nodes == b.nodes, true);
+	EXPECT(a.meshes == b.meshes, true);
+	EXPECT(a.accessors == b.accessors, true);
+	EXPECT(a.bufferViews == b.bufferViews, true);
+	EXPECT(a.materials == b.materials, true);
+	EXPECT(a.textures == b.textures, true);
+	EXPECT(a.images == b.images, true);
+	EXPECT(a.samplers == b.samplers, true);
+	EXPECT(a.cameras == b.cameras, true);
+	EXPECT(a.animations == b.animations, true);
+	EXPECT(a.skins == b.skins, true);
+	EXPECT(a.lights == b.lights, true);
+	EXPECT(a.extensions == b.extensions, true);
+	EXPECT(a.extensionsUsed == b.extensionsUsed, true);
+	EXPECT(a.extensionsRequired == b.extensionsRequired, true);
+	EXPECT(a.extras == b.extras, true);
+
+	// compares the contents, no matter whether mapped or owned
+	EXPECT(a.buffers == b.buffers, true);
+}
+
+TEST(json) {
+	auto bin = bufferContent();
+	writeFile("test.bin", bin.data(), bin.size());
+	auto str = json(R"({"byteLength": 78, "uri": "test.bin", "name": "bin"})");
+	auto path = writeFile("test.gltf", str.data(), str.size());
+
+	auto model = parseGltf(path.string());
+
+	gltf::TinyGLTF loader;
+	gltf::Model ref;
+	std::string err, warn;
+	EXPECT(loader.LoadASCIIFromFile(&ref, &err, &warn, path.string()), true);
+	EXPECT(err, "");
+	compare(model, ref);
+
+	// the external buffer is mapped, the data uri decoded
+	EXPECT(model.buffers[0].data.empty(), true);
+	EXPECT(model.buffers[0].mappedSize, 78u);
+	EXPECT(model.buffers[1].data.size(), 4u);
+	EXPECT(bytes(model.buffers[1]) == "\1\2\3\4", true);
+
+	// some explicit checks
+	EXPECT(model.asset.generator, "tkn \"test\"\té\U0001F600/");
+	EXPECT(model.nodes[1].scale.empty(), true);
+	EXPECT(model.nodes[0].extras.Get("a").Get<int>(), 1);
+	EXPECT(model.nodes[0].extras.Get("b").ArrayLen(), 2u);
+	EXPECT(model.nodes[0].extras.Has("c"), false);
+	EXPECT(model.bufferViews[0].target, TINYGLTF_TARGET_ARRAY_BUFFER);
+	EXPECT(model.bufferViews[1].target, TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+	EXPECT(model.materials[0].values["baseColorTexture"].TextureTexCoord(), 1);
+	EXPECT(model.extras.Get("neg").Get<double>(), -0.000125);
+
+	// decoding works on the mapped data
+	auto positions = decode<3, float>(model, model.accessors[0]);
+	EXPECT(positions[1][0], 1.f);
+	EXPECT(positions[2][1], 1.f);
+	auto indices = decode<1, std::uint32_t>(model, model.accessors[2]);
+	EXPECT(indices[2], 2u);
+
+	// the model can outlive the loader, mappings are kept alive by copies
+	gltf::Model copy = model;
+	model = {};
+	auto normals = decode<3, float>(copy, copy.accessors[1]);
+	EXPECT(normals[0][2], 1.f);
+}
+
+TEST(glb) {
+	auto bin = bufferContent();
+	auto str = json(R"({"byteLength": 78})");
+	auto data = glb(str, bin);
+	auto path = writeFile("test.glb", data.data(), data.size());
+
+	auto model = parseGltf(path.string());
+
+	gltf::TinyGLTF loader;
+	gltf::Model ref;
+	std::string err, warn;
+	EXPECT(loader.LoadBinaryFromFile(&ref, &err, &warn, path.string()), true);
+	compare(model, ref);
+
+	// the binary chunk is referenced, not copied
+	EXPECT(model.buffers[0].data.empty(), true);
+	EXPECT(bytes(model.buffers[0]) == bytes(ref.buffers[0]), true);
+
+	// from memory
+	auto bytes = nytl::Span<const std::byte>(
+		reinterpret_cast<const std::byte*>(data.data()), data.size());
+	auto mem = parseGltf(bytes);
+	compare(mem, ref);
+	EXPECT(reinterpret_cast<const unsigned char*>(bufferData(mem.buffers[0]).data()),
+		data.data() + 20 + ((str.size() + 3) & ~std::size_t(3u)) + 8);
+}
+
+TEST(numbers) {
+	const char* numbers[] = {
+		"0.1", "1e-7", "3.14159265358979", "-0.000001", "0.30000000000000004",
+		"2.2250738585072014e-308", "1.7976931348623157e308", "4.9e-324",
+		"9007199254740993.0", "123456789012345678901234.5", "1E22", "1e23",
+		"0.0000000000000000000000000001", "-7.5E+3", "100.25e-2",
+	};
+
+	std::string str = R"({"asset": {"version": "2.0"}, "extras": {"v": [)";
+	for(auto i = 0u; i < std::size(numbers); ++i) {
+		str += (i == 0u ? "" : ", ");
+		str += numbers[i];
+	}
+	str += "]}}";
+
+	auto model = parseGltf({reinterpret_cast<const std::byte*>(str.data()), str.size()});
+	auto& v = model.extras.Get("v");
+	EXPECT(v.ArrayLen(), std::size(numbers));
+	for(auto i = 0u; i < std::size(numbers); ++i) {
+		// must be correctly rounded
+		EXPECT(v.Get(i).Get<double>(), std::strtod(numbers[i], nullptr));
+	}
+}
+
+TEST(errors) {
+	auto parse = [](std::string_view str) {
+		parseGltf({reinterpret_cast<const std::byte*>(str.data()), str.size()});
+	};
+
+	ERROR(parse(R"({"nodes": [}")"), std::runtime_error);
+	ERROR(parse(R"({"nodes": [{"mesh": 0,}]})"), std::runtime_error);
+	ERROR(parse(R"({"asset": {"version": "2.0"}} x)"), std::runtime_error);
+	ERROR(parse(R"({"extras": "unterminated})"), std::runtime_error);
+	ERROR(parse(R"({"extras": "\x"})"), std::runtime_error);
+	ERROR(parse(R"({"extras": 1.})"), std::runtime_error);
+	ERROR(parse(R"({"extras": tru})"), std::runtime_error);
+	ERROR(parse(R"({"accessors": [{"componentType": 5126, "count": 1}]})"),
+		std::runtime_error);
+	ERROR(parse(R"({"accessors": [{"componentType": 1, "count": 1, "type": "VEC3"}]})"),
+		std::runtime_error);
+	ERROR(parse(R"({"bufferViews": [{"buffer": 0, "byteLength": 4, "byteStride": 6}]})"),
+		std::runtime_error);
+	ERROR(parse(R"({"buffers": [{"byteLength": 4}]})"), std::runtime_error);
+	ERROR(parse(R"({"buffers": [{"byteLength": 4, "uri": "doesnotexist.bin"}]})"),
+		std::runtime_error);
+	ERROR(parse(R"({"cameras": [{"type": "fisheye"}]})"), std::runtime_error);
+	ERROR(parse("glTF\2\0\0\0"), std::runtime_error);
+	ERROR(parseGltf("doesnotexist.gltf"), std::runtime_error);
+
+	// empty model is fine, unknown properties are skipped
+	parse(R"({"asset": {"version": "2.0"}, "foo": [null, true, {"a": -1}]})");
+}
+
+// Images are not decoded while parsing. Scenes can't load images
+// embedded as data uri (or buffer view) and must reject the model
+// instead of treating the uri as path.
+TEST(dataUriImage) {
+	auto load = [](std::string_view str) {
+		return tkn::loadGltf(nytl::Span<const std::byte>(
+			reinterpret_cast<const std::byte*>(str.data()), str.size()));
+	};
+
+	auto str = std::string_view(R"({"asset": {"version": "2.0"},
+		"scenes": [{"nodes": []}],
+		"images": [{"uri": "data:image/png;base64,iVBORw0KGgo="}]})");
+	auto model = parseGltf({reinterpret_cast<const std::byte*>(str.data()), str.size()});
+	EXPECT(model.images.size(), 1u);
+	EXPECT(gltf::IsDataURI(model.images[0].uri), true);
+	EXPECT(load(str).has_value(), false);
+
+	EXPECT(load(R"({"asset": {"version": "2.0"}, "scenes": [{"nodes": []}],
+		"images": [{"uri": "image.png"}]})").has_value(), true);
+}
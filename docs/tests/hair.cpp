@@ -0,0 +1,191 @@
+#include <tkn/hair.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <cmath>
+#include <vector>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+namespace {
+
+constexpr auto dt = 1 / 60.f;
+
+// Strands on a ring around the y axis, pointing outwards.
+std::vector<HairStrand> ring(unsigned count, float length = 0.3f) {
+	std::vector<HairStrand> ret;
+	for(auto i = 0u; i < count; ++i) {
+		auto a = 6.2831853f * i / count;
+		auto dir = Vec3f{std::cos(a), 0.f, std::sin(a)};
+		ret.push_back({0.1f * dir, dir, length + 0.01f * (i % 5)});
+	}
+	return ret;
+}
+
+// Largest relative deviation of a segment from its rest length.
+float stretch(const Hair& hair) {
+	auto ret = 0.f;
+	for(auto s = 0u; s < hair.strandCount(); ++s) {
+		auto l = hair.segmentLength(s);
+		for(auto i = 1u; i < hair.nodeCount(); ++i) {
+			auto d = nytl::length(hair.position(s, i) - hair.position(s, i - 1));
+			ret = std::max(ret, std::abs(d - l) / l);
+		}
+	}
+	return ret;
+}
+
+bool finite(const Hair& hair) {
+	auto ret = true;
+	for(auto s = 0u; s < hair.strandCount(); ++s) {
+		for(auto i = 0u; i < hair.nodeCount(); ++i) {
+			ret &= test::finite(hair.position(s, i));
+		}
+	}
+	return ret;
+}
+
+} // anon namespace
+
+TEST(init) {
+	auto strands = ring(13);
+	Hair hair(strands, 16);
+	EXPECT(hair.strandCount(), 13u);
+	EXPECT(hair.nodeCount(), 16u);
+	EXPECT(stretch(hair) < 1e-5f, true);
+	EXPECT(hair.position(3, 0), strands[3].root);
+
+	auto tip = strands[12].root + strands[12].length * strands[12].direction;
+	EXPECT(nytl::length(hair.position(12, 15) - tip) < 1e-5f, true);
+
+	std::vector<Vec3f> positions(13 * 16);
+	hair.writePositions(positions);
+	EXPECT(positions[12 * 16 + 15], hair.position(12, 15));
+}
+
+// Follow the leader keeps the lengths exactly, the strands
+// end up hanging down.
+TEST(followTheLeader) {
+	auto strands = ring(20);
+	Hair hair(strands, 16);
+	for(auto i = 0u; i < 600u; ++i) {
+		hair.step(dt);
+	}
+
+	EXPECT(finite(hair), true);
+	EXPECT(stretch(hair) < 1e-4f, true);
+
+	auto hanging = true;
+	for(auto s = 0u; s < hair.strandCount(); ++s) {
+		auto d = hair.position(s, 15) - hair.position(s, 0);
+		hanging &= (d.y < -0.9f * strands[s].length);
+		hanging &= (nytl::length(hair.velocity(s, 15)) < 0.05f);
+	}
+	EXPECT(hanging, true);
+}
+
+// Gauss-Seidel iterations, stretches a bit under gravity. Converges
+// to the rest lengths with more iterations.
+TEST(pbd) {
+	auto strands = ring(20);
+	auto simulate = [&](unsigned iterations) {
+		HairParams params;
+		params.solver = HairSolver::pbd;
+		params.iterations = iterations;
+		Hair hair(strands, 16, params);
+		for(auto i = 0u; i < 600u; ++i) {
+			hair.step(dt);
+		}
+		return hair;
+	};
+
+	auto hair = simulate(20u);
+	EXPECT(finite(hair), true);
+	EXPECT(stretch(hair) < 0.1f, true);
+	EXPECT(stretch(simulate(80u)) < 0.5f * stretch(hair), true);
+
+	auto hanging = true;
+	for(auto s = 0u; s < hair.strandCount(); ++s) {
+		auto d = hair.position(s, 15) - hair.position(s, 0);
+		hanging &= (d.y < -0.8f * strands[s].length);
+	}
+	EXPECT(hanging, true);
+}
+
+TEST(roots) {
+	auto strands = ring(5);
+	Hair hair(strands, 8);
+	std::vector<Vec3f> roots;
+	for(auto& s : strands) {
+		roots.push_back(s.root + Vec3f{0.f, 1.f, 0.f});
+	}
+
+	hair.moveRoots(roots);
+	hair.step(dt);
+	EXPECT(hair.position(4, 0), roots[4]);
+	EXPECT(stretch(hair) < 1e-4f, true);
+
+	// the strands are pulled up with the roots
+	auto above = true;
+	for(auto s = 0u; s < hair.strandCount(); ++s) {
+		for(auto i = 0u; i < hair.nodeCount(); ++i) {
+			above &= (hair.position(s, i).y > 0.5f);
+			above &= (hair.velocity(s, i).y > 0.f);
+		}
+	}
+	EXPECT(above, true);
+}
+
+TEST(sphere) {
+	for(auto solver : {HairSolver::followTheLeader, HairSolver::pbd}) {
+		// strands on top of a sphere, falling down on it
+		HairParams params;
+		params.solver = solver;
+		params.sphereRadius = 0.5f;
+		std::vector<HairStrand> strands;
+		for(auto i = 0u; i < 9u; ++i) {
+			auto a = 6.2831853f * i / 9;
+			auto dir = Vec3f{std::cos(a), 0.f, std::sin(a)};
+			strands.push_back({{0.f, 0.5f, 0.f}, dir, 0.6f});
+		}
+
+		Hair hair(strands, 12, params);
+		for(auto i = 0u; i < 300u; ++i) {
+			hair.step(dt);
+		}
+
+		auto outside = true;
+		for(auto s = 0u; s < hair.strandCount(); ++s) {
+			for(auto i = 0u; i < hair.nodeCount(); ++i) {
+				outside &= nytl::length(hair.position(s, i)) > 0.5f - 1e-4f;
+			}
+		}
+		EXPECT(outside, true);
+	}
+}
+
+// Strands don't interact: the result doesn't depend on the other
+// strands in the batch (or their position in the simd lanes).
+TEST(independent) {
+	ThreadPool pool(4u);
+	auto strands = ring(300);
+	for(auto solver : {HairSolver::followTheLeader, HairSolver::pbd}) {
+		HairParams params;
+		params.solver = solver;
+		Hair a(strands, 16, params);
+		Hair c({&strands[137], 1u}, 16, params);
+		for(auto i = 0u; i < 100u; ++i) {
+			a.step(dt, &pool);
+			c.step(dt, &pool);
+		}
+
+		auto alone = true;
+		for(auto i = 0u; i < c.nodeCount(); ++i) {
+			alone &= (c.position(0, i) == a.position(137, i));
+			alone &= (c.velocity(0, i) == a.velocity(137, i));
+		}
+		EXPECT(alone, true);
+	}
+}
@@ -0,0 +1,145 @@
+#include <tkn/isosurface.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <cmath>
+#include <map>
+#include <utility>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+namespace {
+
+constexpr auto pi = 3.14159265f;
+
+// Checks that the mesh is closed and consistently oriented: every
+// directed edge is used exactly once and its reverse as well.
+// Returns the euler characteristic.
+std::pair<bool, int> topology(const IsoMesh& mesh) {
+	std::map<std::pair<u32, u32>, unsigned> edges;
+	auto ok = (mesh.indices.size() % 3 == 0);
+	for(auto i = 0u; i + 2 < mesh.indices.size(); i += 3) {
+		for(auto j = 0u; j < 3u; ++j) {
+			auto a = mesh.indices[i + j];
+			auto b = mesh.indices[i + (j + 1) % 3];
+			ok &= (a != b);
+			ok &= (a < mesh.positions.size());
+			++edges[{a, b}];
+		}
+	}
+
+	for(auto& [edge, count] : edges) {
+		auto rev = edges.find({edge.second, edge.first});
+		ok &= (count == 1 && rev != edges.end() && rev->second == 1);
+	}
+
+	int v = mesh.positions.size();
+	int e = edges.size() / 2;
+	int f = mesh.indices.size() / 3;
+	return {ok, v - e + f};
+}
+
+// Via the divergence theorem, positive for outward facing triangles.
+float volume(const IsoMesh& mesh) {
+	auto ret = 0.f;
+	for(auto i = 0u; i + 2 < mesh.indices.size(); i += 3) {
+		auto a = mesh.positions[mesh.indices[i + 0]];
+		auto b = mesh.positions[mesh.indices[i + 1]];
+		auto c = mesh.positions[mesh.indices[i + 2]];
+		ret += nytl::dot(a, nytl::cross(b, c)) / 6.f;
+	}
+	return ret;
+}
+
+} // anon namespace
+
+TEST(sample) {
+	auto g = denseGrid(5, rows(sphereSdf));
+	EXPECT(g.values.size(), 125u);
+	EXPECT(g.value(2, 2, 2), 1.f);
+	EXPECT(std::abs(g.value(0, 2, 2) + 0.5f) < 1e-6f, true);
+}
+
+TEST(marchingCubes) {
+	auto g = denseGrid(48, rows(sphereSdf));
+	auto mesh = marchingCubes(g, 0.f);
+	EXPECT(mesh.positions.size(), mesh.normals.size());
+	EXPECT(mesh.positions.empty(), false);
+
+	auto [closed, euler] = topology(mesh);
+	EXPECT(closed, true);
+	EXPECT(euler, 2);
+
+	auto vol = volume(mesh);
+	EXPECT(std::abs(vol - 4 / 3.f * pi) < 0.02f * 4 / 3.f * pi, true);
+
+	// on the surface, normals facing outwards
+	auto onSurface = true;
+	for(auto i = 0u; i < mesh.positions.size(); ++i) {
+		auto p = mesh.positions[i];
+		onSurface &= std::abs(nytl::length(p) - 1.f) < 0.01f;
+		onSurface &= nytl::dot(mesh.normals[i], (1 / nytl::length(p)) * p) > 0.99f;
+	}
+	EXPECT(onSurface, true);
+
+	// genus one
+	auto t = marchingCubes(denseGrid(64, rows(torusSdf)), 0.f);
+	auto [tclosed, teuler] = topology(t);
+	EXPECT(tclosed, true);
+	EXPECT(teuler, 0);
+}
+
+TEST(dualMarchingCubes) {
+	auto g = denseGrid(48, rows(sphereSdf));
+	auto mesh = dualMarchingCubes(g, 0.f);
+	EXPECT(mesh.positions.size(), mesh.normals.size());
+
+	auto [closed, euler] = topology(mesh);
+	EXPECT(closed, true);
+	EXPECT(euler, 2);
+
+	auto vol = volume(mesh);
+	EXPECT(std::abs(vol - 4 / 3.f * pi) < 0.02f * 4 / 3.f * pi, true);
+
+	// the dual vertices are the mean of surface points of the cell
+	auto nearSurface = true;
+	for(auto& p : mesh.positions) {
+		nearSurface &= std::abs(nytl::length(p) - 1.f) < g.spacing.x;
+	}
+	EXPECT(nearSurface, true);
+
+	auto t = dualMarchingCubes(denseGrid(64, rows(torusSdf)), 0.f);
+	auto [tclosed, teuler] = topology(t);
+	EXPECT(tclosed, true);
+	EXPECT(teuler, 0);
+}
+
+// The slabs are merged so that the result does not depend on the
+// number of threads.
+TEST(threads) {
+	ThreadPool single(0u);
+	ThreadPool multi(4u);
+
+	auto g = denseGrid(37, rows(torusSdf));
+	auto a = marchingCubes(g, 0.f, &single);
+	auto b = marchingCubes(g, 0.f, &multi);
+	EXPECT(a.indices == b.indices, true);
+	EXPECT(a.positions == b.positions, true);
+
+	auto c = dualMarchingCubes(g, 0.f, &single);
+	auto d = dualMarchingCubes(g, 0.f, &multi);
+	EXPECT(c.indices == d.indices, true);
+	EXPECT(c.positions == d.positions, true);
+}
+
+TEST(empty) {
+	SdfGrid g;
+	EXPECT(marchingCubes(g, 0.f).indices.empty(), true);
+
+	// no surface
+	auto full = denseGrid(8, rows([](float, float, float) { return 1.f; }));
+	EXPECT(marchingCubes(full, 0.f).positions.empty(), true);
+	EXPECT(dualMarchingCubes(full, 0.f).positions.empty(), true);
+}
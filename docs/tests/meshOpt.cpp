@@ -0,0 +1,131 @@
+#include <tkn/scene/meshOpt.hpp>
+#include <algorithm>
+#include <array>
+#include <random>
+#include "bugged.hpp"
+
+using namespace tkn;
+
+// Returns the triangles of the given mesh as sorted list of
+// (rotation-normalized) position triples, to check that optimization
+// doesn't change the geometry.
+std::vector<std::array<Vec3f, 3>> triangles(const Shape& shape) {
+	std::vector<std::array<Vec3f, 3>> ret;
+	auto less = [](const Vec3f& a, const Vec3f& b) {
+		return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+	};
+
+	for(auto i = 0u; i < shape.indices.size(); i += 3) {
+		std::array<Vec3f, 3> tri = {
+			shape.positions[shape.indices[i + 0]],
+			shape.positions[shape.indices[i + 1]],
+			shape.positions[shape.indices[i + 2]],
+		};
+
+		// keep winding order, just rotate the smallest vertex to the front
+		auto min = std::min_element(tri.begin(), tri.end(), less);
+		std::rotate(tri.begin(), min, tri.end());
+		ret.push_back(tri);
+	}
+
+	std::sort(ret.begin(), ret.end(), [&](auto& a, auto& b) {
+		return std::lexicographical_compare(a.begin(), a.end(),
+			b.begin(), b.end(), less);
+	});
+	return ret;
+}
+
+// Grid of (n + 1)^2 vertices, triangles in random order.
+Shape shuffledGrid(unsigned n) {
+	Shape shape;
+	for(auto y = 0u; y <= n; ++y) {
+		for(auto x = 0u; x <= n; ++x) {
+			shape.positions.push_back({float(x), float(y), 0.f});
+			shape.normals.push_back({0.f, 0.f, 1.f});
+		}
+	}
+
+	std::vector<std::array<u32, 3>> tris;
+	for(auto y = 0u; y < n; ++y) {
+		for(auto x = 0u; x < n; ++x) {
+			auto i = y * (n + 1) + x;
+			tris.push_back({i, i + 1, i + n + 2});
+			tris.push_back({i, i + n + 2, i + n + 1});
+		}
+	}
+
+	std::mt19937 rng(42);
+	std::shuffle(tris.begin(), tris.end(), rng);
+	for(auto& tri : tris) {
+		shape.indices.insert(shape.indices.end(), tri.begin(), tri.end());
+	}
+
+	return shape;
+}
+
+TEST(dedup) {
+	// cube has 24 vertices (per-face normals), duplicating all of
+	// them must result in the same 24 vertices again
+	auto cube = generate(Cube{});
+	auto dup = cube;
+	auto n = u32(cube.positions.size());
+	for(auto i = 0u; i < n; ++i) {
+		dup.positions.push_back(cube.positions[i]);
+		dup.normals.push_back(cube.normals[i]);
+	}
+	for(auto i = 0u; i < cube.indices.size(); ++i) {
+		dup.indices.push_back(cube.indices[i] + n);
+	}
+
+	std::vector<VertexStream> streams = {dup.positions, dup.normals};
+	std::vector<u32> remap(dup.positions.size());
+	auto unique = generateVertexRemap(remap, dup.indices, streams);
+	EXPECT(unique, n);
+	for(auto i = 0u; i < n; ++i) {
+		EXPECT(remap[i], remap[i + n]);
+	}
+
+	// unreferenced vertices are dropped
+	dup.indices.resize(cube.indices.size());
+	unique = generateVertexRemap(remap, dup.indices, streams);
+	EXPECT(unique, n);
+	EXPECT(remap[n], unusedVertex);
+}
+
+TEST(vertexCache) {
+	auto grid = shuffledGrid(64);
+	auto before = analyzeVertexCache(grid.indices, grid.positions.size());
+
+	auto indices = grid.indices;
+	optimizeVertexCache(indices, indices, grid.positions.size());
+	auto after = analyzeVertexCache(indices, grid.positions.size());
+
+	// random order is close to the worst case (3), a good ordering
+	// of a regular grid should get near the optimum (0.5)
+	EXPECT(before.acmr > 2.f, true);
+	EXPECT(after.acmr < 0.8f, true);
+	EXPECT(after.misses <= before.misses, true);
+
+	// same triangles
+	auto copy = grid;
+	copy.indices = indices;
+	EXPECT(triangles(copy) == triangles(grid), true);
+}
+
+TEST(optimizeMesh) {
+	auto sphere = generateUV(Sphere{}, 32, 32);
+	auto ref = triangles(sphere);
+
+	auto stats = optimizeMesh(sphere);
+	EXPECT(stats.verticesAfter <= stats.verticesBefore, true);
+	EXPECT(stats.verticesAfter, sphere.positions.size());
+	EXPECT(stats.after.acmr <= stats.before.acmr, true);
+	EXPECT(triangles(sphere) == ref, true);
+
+	// vertex fetch order: vertices are first referenced in order
+	auto next = 0u;
+	for(auto idx : sphere.indices) {
+		EXPECT(idx <= next, true);
+		next = std::max(next, idx + 1);
+	}
+}
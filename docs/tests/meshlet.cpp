@@ -0,0 +1,79 @@
+#include <tkn/scene/meshlet.hpp>
+#include <nytl/vecOps.hpp>
+#include <random>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+TEST(limits) {
+	auto shape = optimizedSphere(48);
+	auto data = buildMeshlets(shape.indices, shape.positions);
+	EXPECT(data.meshlets.empty(), false);
+
+	// all triangles are there, in the original order
+	auto tri = 0u;
+	for(auto& m : data.meshlets) {
+		EXPECT(m.vertexCount <= maxMeshletVertices, true);
+		EXPECT(m.triangleCount <= maxMeshletTriangles, true);
+		EXPECT(m.triangleCount > 0u, true);
+
+		for(auto t = 0u; t < 3 * m.triangleCount; ++t) {
+			auto local = data.triangles[m.triangleOffset + t];
+			EXPECT(local < m.vertexCount, true);
+			auto v = data.vertices[m.vertexOffset + local];
+			EXPECT(v, shape.indices[3 * tri + t]);
+		}
+
+		tri += m.triangleCount;
+
+		// bounding sphere contains all vertices
+		for(auto i = 0u; i < m.vertexCount; ++i) {
+			auto& pos = shape.positions[data.vertices[m.vertexOffset + i]];
+			EXPECT(nytl::length(pos - m.center) <= m.radius + 1e-5f, true);
+		}
+	}
+
+	EXPECT(3 * tri, shape.indices.size());
+
+	// deterministic
+	auto data2 = buildMeshlets(shape.indices, shape.positions);
+	EXPECT(data2.vertices == data.vertices, true);
+	EXPECT(data2.triangles == data.triangles, true);
+}
+
+TEST(cone) {
+	auto shape = optimizedSphere(48);
+	auto data = buildMeshlets(shape.indices, shape.positions);
+
+	// backface culling must be conservative
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> dist(-5.f, 5.f);
+	auto culled = 0u;
+	for(auto i = 0u; i < 64; ++i) {
+		auto view = Vec3f{dist(rng), dist(rng), dist(rng)};
+		for(auto& m : data.meshlets) {
+			if(!backfacing(m, view)) {
+				continue;
+			}
+
+			++culled;
+			for(auto t = 0u; t < m.triangleCount; ++t) {
+				auto id = [&](auto j) {
+					auto local = data.triangles[m.triangleOffset + 3 * t + j];
+					return data.vertices[m.vertexOffset + local];
+				};
+
+				auto& a = shape.positions[id(0)];
+				auto& b = shape.positions[id(1)];
+				auto& c = shape.positions[id(2)];
+				auto n = nytl::cross(b - a, c - a);
+				EXPECT(nytl::dot(n, view - a) <= 0.f, true);
+			}
+		}
+	}
+
+	// the far side of the sphere is backfacing
+	EXPECT(culled > 0u, true);
+}
@@ -0,0 +1,148 @@
+#include <tkn/particles.hpp>
+#include <tkn/threadPool.hpp>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "bugged.hpp"
+
+using namespace tkn;
+
+namespace {
+
+std::vector<Vec2f> randomPoints(unsigned count, float extent) {
+	std::mt19937 rgen(42u);
+	std::uniform_real_distribution<float> distr(-extent, extent);
+	std::vector<Vec2f> ret(count);
+	for(auto& p : ret) {
+		p = {distr(rgen), distr(rgen)};
+	}
+	return ret;
+}
+
+float dist2(Vec2f a, Vec2f b) {
+	auto dx = a.x - b.x;
+	auto dy = a.y - b.y;
+	return dx * dx + dy * dy;
+}
+
+} // anon namespace
+
+TEST(neighbors) {
+	auto points = randomPoints(2000, 3.f);
+	auto radius = 0.2f;
+
+	SpatialHash hash;
+	hash.build(points, radius);
+	EXPECT(hash.bucketCount(), 2048u);
+
+	// every point appears once
+	auto order = std::vector<u32>(hash.order().begin(), hash.order().end());
+	std::sort(order.begin(), order.end());
+	auto complete = true;
+	for(auto i = 0u; i < order.size(); ++i) {
+		complete &= (order[i] == i);
+	}
+	EXPECT(complete, true);
+
+	// finds exactly the same neighbors as brute force
+	auto equal = true;
+	for(auto i = 0u; i < points.size(); ++i) {
+		std::vector<u32> expected;
+		for(auto j = 0u; j < points.size(); ++j) {
+			if(dist2(points[i], points[j]) < radius * radius) {
+				expected.push_back(j);
+			}
+		}
+
+		std::vector<u32> found;
+		hash.forEachNear(points[i], [&](u32 s) {
+			auto j = hash.order()[s];
+			if(dist2(points[i], points[j]) < radius * radius) {
+				found.push_back(j);
+			}
+		});
+
+		std::sort(found.begin(), found.end());
+		equal &= (found == expected);
+	}
+
+	EXPECT(equal, true);
+
+	// empty
+	hash.build({}, 1.f);
+	auto called = false;
+	hash.forEachNear({0.f, 0.f}, [&](u32) { called = true; });
+	EXPECT(called, false);
+}
+
+TEST(attraction) {
+	auto points = randomPoints(3000, 2.f);
+	AttractionParams params;
+	params.radius = 0.15f;
+	params.strength = 2.f;
+	auto dt = 0.01f;
+
+	// brute force reference
+	std::vector<Vec2f> expected(points.size());
+	for(auto i = 0u; i < points.size(); ++i) {
+		for(auto j = 0u; j < points.size(); ++j) {
+			auto d2 = dist2(points[i], points[j]);
+			if(d2 == 0.f || d2 >= params.radius * params.radius) {
+				continue;
+			}
+
+			auto d = std::sqrt(d2);
+			auto fac = dt * params.strength * (1 - d / params.radius) / d;
+			expected[i].x += fac * (points[j].x - points[i].x);
+			expected[i].y += fac * (points[j].y - points[i].y);
+		}
+	}
+
+	ThreadPool pool(4u);
+	SpatialHash hash;
+
+	std::vector<Vec2f> vel(points.size());
+	applyAttraction(points, vel, dt, params, hash, &pool);
+
+	auto maxDiff = 0.f;
+	for(auto i = 0u; i < points.size(); ++i) {
+		maxDiff = std::max(maxDiff, std::sqrt(dist2(vel[i], expected[i])));
+	}
+	EXPECT(maxDiff < 1e-4f, true);
+}
+
+TEST(trails) {
+	std::vector<Vec2f> pos = {{0.f, 0.f}, {10.f, 0.f}};
+	Trails trails(pos, 4u);
+	EXPECT(trails.data().size(), 10u);
+	EXPECT((trails.at(1, 3) == Vec2f{10.f, 0.f}), true);
+
+	for(auto i = 1u; i <= 6u; ++i) {
+		pos[0].x = float(i);
+		pos[1].x = 10.f + i;
+		trails.push(pos);
+
+		// order from new to old, the segments cover the full history
+		auto ordered = true;
+		auto age = 0u;
+		for(auto [first, count] : trails.segments()) {
+			for(auto s = first; s < first + count; ++s) {
+				auto p = trails.data()[(trails.length() + 1) + s];
+				ordered &= (p == trails.at(1, age));
+				++age;
+			}
+
+			// the mirror slot is shared
+			if(count && first > 0) {
+				--age;
+			}
+		}
+
+		EXPECT(ordered, true);
+		EXPECT(age, 4u);
+	}
+
+	EXPECT(trails.at(0, 0).x, 6.f);
+	EXPECT(trails.at(0, 3).x, 3.f);
+	EXPECT(trails.at(1, 1).x, 15.f);
+}
@@ -0,0 +1,187 @@
+#include <tkn/scene/quantize.hpp>
+#include <tkn/scene/shape.hpp>
+#include <nytl/vecOps.hpp>
+#include <nytl/matOps.hpp>
+#include <random>
+#include <cmath>
+#include "bugged.hpp"
+
+using namespace tkn;
+
+std::vector<Vec3f> randomNormals(unsigned count) {
+	std::mt19937 rng(7);
+	std::normal_distribution<float> dist;
+	std::vector<Vec3f> ret;
+	while(ret.size() < count) {
+		auto n = Vec3f{dist(rng), dist(rng), dist(rng)};
+		if(nytl::length(n) > 1e-4f) {
+			ret.push_back(nytl::normalized(n));
+		}
+	}
+
+	// axis aligned ones, the edge cases of the encoding
+	for(auto i = 0u; i < 3; ++i) {
+		auto n = Vec3f{0.f, 0.f, 0.f};
+		n[i] = 1.f;
+		ret.push_back(n);
+		n[i] = -1.f;
+		ret.push_back(n);
+	}
+
+	return ret;
+}
+
+TEST(positions) {
+	auto shape = generateUV(Sphere{{1.f, -2.f, 3.f}, {2.f, 0.5f, 1.f}}, 32, 32);
+	auto min = Vec3f{-1.f, -2.5f, 2.f};
+	auto max = Vec3f{3.f, -1.5f, 4.f};
+
+	// odd count to test the tail of the batched version
+	shape.positions.push_back(min);
+	shape.positions.push_back(max);
+	shape.positions.push_back(0.5f * (min + max));
+
+	std::vector<CompactPosition> qs(shape.positions.size());
+	quantizePositions(shape.positions, min, max, qs);
+
+	auto dequant = dequantizeMatrix(min, max);
+	for(auto i = 0u; i < qs.size(); ++i) {
+		auto& q = qs[i];
+		auto& p = shape.positions[i];
+		EXPECT(q.pad, 0u);
+
+		// half a quantization step on each axis
+		auto d = dequantize(q, min, max);
+		for(auto a = 0u; a < 3; ++a) {
+			auto step = (max[a] - min[a]) / 65535.f;
+			EXPECT(std::abs(d[a] - p[a]) <= 0.5001f * step, true);
+		}
+
+		// matches what the vertex shader computes
+		auto n = Vec3f{q.x / 65535.f, q.y / 65535.f, q.z / 65535.f};
+		auto m = dequant * nytl::Vec4f{n.x, n.y, n.z, 1.f};
+		EXPECT(std::abs(m[0] - d[0]) < 1e-5f, true);
+		EXPECT(std::abs(m[1] - d[1]) < 1e-5f, true);
+		EXPECT(std::abs(m[2] - d[2]) < 1e-5f, true);
+		EXPECT(m[3], 1.f);
+
+		auto single = std::vector<CompactPosition>(1);
+		quantizePositions({&p, 1}, min, max, single);
+		EXPECT(single[0].x, q.x);
+		EXPECT(single[0].y, q.y);
+		EXPECT(single[0].z, q.z);
+	}
+
+	auto n = qs.size();
+	EXPECT(qs[n - 3].x, 0u);
+	EXPECT(qs[n - 3].z, 0u);
+	EXPECT(qs[n - 2].x, 65535u);
+	EXPECT(qs[n - 2].y, 65535u);
+
+	// degenerate bounds, e.g. a plane
+	std::vector<Vec3f> plane = {{0.f, 1.f, 0.f}, {1.f, 1.f, 2.f}};
+	std::vector<CompactPosition> pqs(2);
+	quantizePositions(plane, {0.f, 1.f, 0.f}, {1.f, 1.f, 2.f}, pqs);
+	EXPECT(pqs[0].y, 0u);
+	EXPECT(pqs[1].y, 0u);
+	auto d = dequantize(pqs[1], {0.f, 1.f, 0.f}, {1.f, 1.f, 2.f});
+	EXPECT(d[1], 1.f);
+}
+
+TEST(normals) {
+	auto normals = randomNormals(1001);
+	std::vector<CompactNormal> encoded(normals.size());
+	encodeNormals(normals, encoded);
+
+	auto maxAngle = 0.f;
+	for(auto i = 0u; i < normals.size(); ++i) {
+		// batched and single versions must be exactly the same
+		auto single = encodeNormal(normals[i]);
+		EXPECT(single.x, encoded[i].x);
+		EXPECT(single.y, encoded[i].y);
+
+		auto d = decode(encoded[i]);
+		EXPECT(std::abs(nytl::length(d) - 1.f) < 1e-5f, true);
+		auto sin = nytl::length(nytl::cross(d, normals[i]));
+		maxAngle = std::max(maxAngle, std::atan2(sin, nytl::dot(d, normals[i])));
+	}
+
+	// 16 bit octahedral encoding has an error of about 0.005 degrees
+	auto deg = maxAngle * 180.f / 3.14159265f;
+	EXPECT(deg < 0.01f, true);
+
+	// axis aligned normals are exact
+	for(auto i = normals.size() - 6; i < normals.size(); ++i) {
+		EXPECT(decode(encoded[i]) == normals[i], true);
+	}
+}
+
+TEST(half) {
+	// representable values are exact
+	for(auto v : {0.f, 1.f, -1.f, 0.5f, 0.25f, 2.f, 1024.f, 65504.f,
+			-0.125f, 1.f / 1024.f, 3.140625f}) {
+		auto tc = CompactTexCoord{quantizeHalf(v), quantizeHalf(-v)};
+		auto d = decode(tc);
+		EXPECT(d.x, v);
+		EXPECT(d.y, -v);
+	}
+
+	EXPECT(quantizeHalf(1e6f), 0x7c00u);
+	EXPECT(quantizeHalf(-1e6f), 0xfc00u);
+	EXPECT(quantizeHalf(std::numeric_limits<float>::infinity()), 0x7c00u);
+	EXPECT(quantizeHalf(std::nanf("")) & 0x7fffu, 0x7e00u);
+	EXPECT(quantizeHalf(1e-10f) & 0x7fffu, 0u);
+
+	// rounds to nearest: half the step above 1 is 2^-11
+	EXPECT(quantizeHalf(1.f + 0.6f / 1024.f), quantizeHalf(1.f + 1.f / 1024.f));
+	EXPECT(quantizeHalf(1.f + 0.4f / 1024.f), quantizeHalf(1.f));
+
+	// batched version, including the tail
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> dist(-4.f, 4.f);
+	std::vector<Vec2f> tcs(37);
+	for(auto& tc : tcs) {
+		tc = {dist(rng), dist(rng)};
+	}
+
+	tcs.push_back({1e6f, -1e-10f});
+	tcs.push_back({std::nanf(""), -1e6f});
+
+	std::vector<CompactTexCoord> encoded(tcs.size());
+	encodeTexCoords(tcs, encoded);
+	for(auto i = 0u; i < tcs.size(); ++i) {
+		EXPECT(encoded[i].u, quantizeHalf(tcs[i].x));
+		EXPECT(encoded[i].v, quantizeHalf(tcs[i].y));
+		if(i < 37) {
+			// relative error: 11 bit mantissa
+			auto d = decode(encoded[i]);
+			EXPECT(std::abs(d.x - tcs[i].x) <= std::abs(tcs[i].x) / 2048.f, true);
+			EXPECT(std::abs(d.y - tcs[i].y) <= std::abs(tcs[i].y) / 2048.f, true);
+		}
+	}
+}
+
+TEST(stats) {
+	auto shape = generateUV(Sphere{}, 64, 64);
+
+	Scene::Primitive p;
+	p.positions = shape.positions;
+	p.normals = shape.normals;
+	p.texCoords0.resize(p.positions.size(), {0.5f, 0.25f});
+	p.min = {-1.f, -1.f, -1.f};
+	p.max = {1.f, 1.f, 1.f};
+
+	auto stats = quantizationStats(p);
+	EXPECT(stats.vertices, p.positions.size());
+	EXPECT(stats.floatBytes, 32 * p.positions.size());
+	EXPECT(stats.compactBytes, 16 * p.positions.size());
+	EXPECT(stats.positionError < 2.f / 65535.f, true);
+	EXPECT(stats.relPositionError < 1.f / 65535.f, true);
+	EXPECT(stats.normalError < 0.01f, true);
+	EXPECT(stats.texCoordError, 0.f);
+
+	auto sum = stats;
+	sum += stats;
+	EXPECT(sum.vertices, 2 * stats.vertices);
+	EXPECT(sum.positionError, stats.positionError);
+}
@@ -0,0 +1,56 @@
+#include <tkn/recvBuf.hpp>
+#include <vector>
+#include <cstdint>
+#include "bugged.hpp"
+
+TEST(contiguous) {
+	std::vector<std::byte> data(12);
+	std::uint32_t vals[3] = {1u, 42u, 0xFFFFFFFFu};
+	std::memcpy(data.data(), vals, sizeof(vals));
+
+	auto buf = tkn::recvBuf(tkn::RecvChunk(data));
+	EXPECT(tkn::size(buf), 12u);
+	EXPECT(tkn::read<std::uint32_t>(buf), 1u);
+	EXPECT(tkn::read<std::uint32_t>(buf), 42u);
+	EXPECT(tkn::read<std::uint32_t>(buf), 0xFFFFFFFFu);
+	EXPECT(tkn::empty(buf), true);
+	ERROR(tkn::read<std::uint8_t>(buf), tkn::OutOfRangeRecvBuf);
+}
+
+TEST(scattered) {
+	// 0, 1, ..., 19 distributed over chunks of different size
+	std::vector<std::byte> a, b, c;
+	for(auto i = 0u; i < 20u; ++i) {
+		auto& dst = (i < 3) ? a : (i < 13) ? b : c;
+		dst.push_back(std::byte(i));
+	}
+
+	std::vector<tkn::RecvChunk> chunks = {a, {}, b, c};
+	auto buf = tkn::recvBuf(nytl::Span<const tkn::RecvChunk>(chunks));
+	EXPECT(tkn::size(buf), 20u);
+
+	// spans the first two (non-empty) chunks
+	auto v = tkn::read<std::uint32_t>(buf);
+	auto bytes = reinterpret_cast<const std::uint8_t*>(&v);
+	EXPECT(unsigned(bytes[0]), 0u);
+	EXPECT(unsigned(bytes[3]), 3u);
+
+	// sub buffer crossing into the last chunk
+	auto sub = tkn::sub(buf, 12u);
+	EXPECT(tkn::size(sub), 12u);
+	EXPECT(tkn::size(buf), 4u);
+
+	auto chunk = tkn::readChunk(sub);
+	EXPECT(chunk.size(), 9u);
+	EXPECT(unsigned(chunk[0]), 4u);
+
+	chunk = tkn::readChunk(sub);
+	EXPECT(chunk.size(), 3u);
+	EXPECT(unsigned(chunk[0]), 13u);
+	EXPECT(tkn::empty(sub), true);
+	EXPECT(tkn::readChunk(sub).size(), 0u);
+
+	tkn::skip(buf, 3u);
+	EXPECT(unsigned(tkn::read<std::uint8_t>(buf)), 19u);
+	ERROR(tkn::skip(buf, 1u), tkn::OutOfRangeRecvBuf);
+}
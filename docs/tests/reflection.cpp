@@ -0,0 +1,282 @@
+#include <tkn/shader.hpp>
+#include <initializer_list>
+#include <vector>
+#include <cstring>
+#include "bugged.hpp"
+
+using namespace tkn;
+
+namespace {
+
+// Minimal SPIR-V assembler, just enough for the test module.
+struct Module {
+	std::vector<u32> words {0x07230203, 0x00010000, 0u, 0u, 0u};
+
+	void op(u32 opcode, std::initializer_list<u32> args) {
+		words.push_back(u32((args.size() + 1) << 16u) | opcode);
+		words.insert(words.end(), args);
+	}
+
+	// Packs the given string (including the null terminator) into words
+	std::vector<u32> str(const char* s) {
+		std::vector<u32> ret((std::strlen(s) + 4) / 4, 0u);
+		std::memcpy(ret.data(), s, std::strlen(s));
+		return ret;
+	}
+};
+
+// Equivalent of
+// layout(local_size_x = 1) in;
+// layout(set = 0, binding = 1) buffer SSBO { uint a; } ssbo;
+// layout(set = 1, binding = 0) uniform UBO { uint b; } ubo;
+// layout(set = 0, binding = 0) uniform UBO2 { uint c; } ubo2;
+// layout(push_constant) uniform PC { uint x; uint y; } pc;
+// layout(constant_id = 3) const uint count = 7;
+// layout(constant_id = 1) const bool enable = true;
+// layout(constant_id = 2) const float scale = 1.5;
+// void main() { uint v = pc.x; }
+std::vector<u32> testModule() {
+	enum : u32 {
+		idVoid = 1, idFn, idUint, idFloat, idBool,
+		idSSBOType, idUBOType, idPCType,
+		idPtrSSBO, idPtrUBO, idPtrPC, idPtrPCUint,
+		idSSBO, idUBO, idUBO2, idPC,
+		idSpecCount, idSpecEnable, idSpecScale, idZero,
+		idMain, idLabel, idAccess, idLoad,
+		idBound,
+	};
+
+	Module m;
+	m.op(17, {1}); // OpCapability Shader
+	m.op(14, {0, 1}); // OpMemoryModel Logical GLSL450
+
+	auto name = m.str("main");
+	m.words.push_back(u32((3 + name.size()) << 16u) | 15u); // OpEntryPoint
+	m.words.push_back(5u); // GLCompute
+	m.words.push_back(idMain);
+	m.words.insert(m.words.end(), name.begin(), name.end());
+	m.op(16, {idMain, 17, 1, 1, 1}); // OpExecutionMode LocalSize
+
+	// decorations
+	m.op(71, {idSSBOType, 3}); // BufferBlock
+	m.op(72, {idSSBOType, 0, 35, 0}); // Offset
+	m.op(71, {idUBOType, 2}); // Block
+	m.op(72, {idUBOType, 0, 35, 0});
+	m.op(71, {idPCType, 2});
+	m.op(72, {idPCType, 0, 35, 0});
+	m.op(72, {idPCType, 1, 35, 4});
+	m.op(71, {idSSBO, 34, 0}); // DescriptorSet
+	m.op(71, {idSSBO, 33, 1}); // Binding
+	m.op(71, {idUBO, 34, 1});
+	m.op(71, {idUBO, 33, 0});
+	m.op(71, {idUBO2, 34, 0});
+	m.op(71, {idUBO2, 33, 0});
+	m.op(71, {idSpecCount, 1, 3}); // SpecId
+	m.op(71, {idSpecEnable, 1, 1});
+	m.op(71, {idSpecScale, 1, 2});
+
+	// types
+	m.op(19, {idVoid});
+	m.op(33, {idFn, idVoid});
+	m.op(21, {idUint, 32, 0});
+	m.op(22, {idFloat, 32});
+	m.op(20, {idBool});
+	m.op(30, {idSSBOType, idUint});
+	m.op(30, {idUBOType, idUint});
+	m.op(30, {idPCType, idUint, idUint});
+	m.op(32, {idPtrSSBO, 2, idSSBOType}); // Uniform
+	m.op(32, {idPtrUBO, 2, idUBOType});
+	m.op(32, {idPtrPC, 9, idPCType}); // PushConstant
+	m.op(32, {idPtrPCUint, 9, idUint});
+
+	// constants, variables
+	m.op(50, {idUint, idSpecCount, 7});
+	m.op(48, {idBool, idSpecEnable});
+	u32 scale;
+	auto fscale = 1.5f;
+	std::memcpy(&scale, &fscale, 4);
+	m.op(50, {idFloat, idSpecScale, scale});
+	m.op(43, {idUint, idZero, 0}); // OpConstant
+	m.op(59, {idPtrSSBO, idSSBO, 2}); // OpVariable
+	m.op(59, {idPtrUBO, idUBO, 2});
+	m.op(59, {idPtrUBO, idUBO2, 2});
+	m.op(59, {idPtrPC, idPC, 9});
+
+	// main
+	m.op(54, {idVoid, idMain, 0, idFn}); // OpFunction
+	m.op(248, {idLabel});
+	m.op(65, {idPtrPCUint, idAccess, idPC, idZero}); // OpAccessChain
+	m.op(61, {idUint, idLoad, idAccess}); // OpLoad
+	m.op(253, {}); // OpReturn
+	m.op(56, {}); // OpFunctionEnd
+
+	m.words[3] = idBound;
+	return m.words;
+}
+
+} // anon namespace
+
+TEST(bindings) {
+	auto refl = reflect(testModule());
+	EXPECT(refl.bindings.size(), 3u);
+
+	auto& b0 = refl.bindings[0];
+	EXPECT(b0.set, 0u);
+	EXPECT(b0.binding, 0u);
+	EXPECT(b0.count, 1u);
+	EXPECT(b0.type == vk::DescriptorType::uniformBuffer, true);
+
+	auto& b1 = refl.bindings[1];
+	EXPECT(b1.set, 0u);
+	EXPECT(b1.binding, 1u);
+	EXPECT(b1.type == vk::DescriptorType::storageBuffer, true);
+
+	auto& b2 = refl.bindings[2];
+	EXPECT(b2.set, 1u);
+	EXPECT(b2.binding, 0u);
+	EXPECT(b2.type == vk::DescriptorType::uniformBuffer, true);
+}
+
+TEST(pushConstants) {
+	auto refl = reflect(testModule());
+	EXPECT(refl.pushConstantOffset, 0u);
+	// spirv_reflect pads block sizes to 16 bytes
+	EXPECT(refl.pushConstantSize, 16u);
+}
+
+TEST(specConstants) {
+	auto refl = reflect(testModule());
+	EXPECT(refl.specConstants.size(), 3u);
+
+	auto& enable = refl.specConstants[0];
+	EXPECT(enable.id, 1u);
+	EXPECT(enable.size, 4u);
+	EXPECT(enable.defaultValue, 1u);
+
+	auto& scale = refl.specConstants[1];
+	EXPECT(scale.id, 2u);
+	EXPECT(scale.size, 4u);
+	float fscale;
+	auto bits = u32(scale.defaultValue);
+	std::memcpy(&fscale, &bits, 4);
+	EXPECT(fscale, 1.5f);
+
+	auto& count = refl.specConstants[2];
+	EXPECT(count.id, 3u);
+	EXPECT(count.size, 4u);
+	EXPECT(count.defaultValue, 7u);
+}
+
+TEST(freeze) {
+	auto spv = testModule();
+	auto size = spv.size();
+	SpecConstantValue values[] = {{3u, 12u}, {1u, 0u}, {9u, 5u}};
+	EXPECT(freezeSpecConstants(spv, values), true);
+
+	// SpecId decorations were removed, the rest kept
+	EXPECT(spv.size(), size - 2 * 4u);
+	auto refl = reflect(spv);
+	EXPECT(refl.specConstants.size(), 1u);
+	EXPECT(refl.specConstants[0].id, 2u);
+	EXPECT(refl.bindings.size(), 3u);
+
+	auto constant = false;
+	auto constantFalse = false;
+	for(auto i = 5u; i < spv.size(); i += spv[i] >> 16u) {
+		auto opcode = spv[i] & 0xFFFFu;
+		constant |= (opcode == 43u && spv[i + 3] == 12u); // OpConstant
+		constantFalse |= (opcode == 42u); // OpConstantFalse
+		EXPECT(opcode != 48u, true); // OpSpecConstantTrue
+	}
+
+	EXPECT(constant, true);
+	EXPECT(constantFalse, true);
+
+	// nothing to freeze
+	auto copy = spv;
+	EXPECT(freezeSpecConstants(spv, values), true);
+	EXPECT(spv == copy, true);
+
+	// last instruction (OpFunctionEnd) extends beyond the module
+	spv.back() = (2u << 16u) | 56u;
+	copy = spv;
+	EXPECT(freezeSpecConstants(spv, values), false);
+	EXPECT(spv == copy, true);
+}
+
+TEST(strip) {
+	auto ref = testModule();
+
+	// insert debug instructions before the first decoration
+	auto spv = ref;
+	auto i = 5u;
+	while((spv[i] & 0xFFFFu) != 71u) {
+		i += spv[i] >> 16u;
+	}
+
+	std::vector<u32> debug {
+		(3u << 16u) | 3u, 2u, 450u, // OpSource GLSL 450
+		(4u << 16u) | 5u, 0u, 0u, 0u, // OpName %main "main"
+		(3u << 16u) | 317u, 0u, 0u, // OpNoLine, with unused operands
+	};
+	debug[4] = 21u; // idMain
+	std::memcpy(&debug[5], "main", 4u);
+	spv.insert(spv.begin() + i, debug.begin(), debug.end());
+
+	EXPECT(stripSpirvDebugInfo(spv), true);
+	EXPECT(spv == ref, true);
+	EXPECT(stripSpirvDebugInfo(spv), true);
+	EXPECT(spv == ref, true);
+	EXPECT(reflect(spv).bindings.size(), 3u);
+
+	spv.back() = (2u << 16u) | 56u;
+	auto copy = spv;
+	EXPECT(stripSpirvDebugInfo(spv), false);
+	EXPECT(spv == copy, true);
+}
+
+TEST(invalid) {
+	auto spv = testModule();
+	spv[0] = 0xDEADBEEFu; // magic number
+
+	auto thrown = false;
+	try {
+		reflect(spv);
+	} catch(const std::runtime_error&) {
+		thrown = true;
+	}
+
+	EXPECT(thrown, true);
+}
+
+// Instructions with a valid word count but too few operands.
+TEST(missingOperands) {
+	auto ref = testModule();
+	auto i = 5u;
+	while((ref[i] & 0xFFFFu) != 54u) { // OpFunction
+		i += ref[i] >> 16u;
+	}
+
+	std::vector<std::vector<u32>> insts {
+		{(2u << 16u) | 21u, 100u}, // OpTypeInt, no width
+		{(2u << 16u) | 22u, 100u}, // OpTypeFloat, no width
+		{(1u << 16u) | 20u}, // OpTypeBool, no result
+		{(2u << 16u) | 48u, 5u}, // OpSpecConstantTrue, no result
+		{(3u << 16u) | 50u, 3u, 100u}, // OpSpecConstant, no value
+		{(2u << 16u) | 71u, 100u}, // OpDecorate, no decoration
+	};
+
+	for(auto& inst : insts) {
+		auto spv = ref;
+		spv.insert(spv.begin() + i, inst.begin(), inst.end());
+
+		auto thrown = false;
+		try {
+			reflect(spv);
+		} catch(const std::runtime_error&) {
+			thrown = true;
+		}
+
+		EXPECT(thrown, true);
+	}
+}
@@ -0,0 +1,155 @@
+#include <tkn/scene/shape.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <cmath>
+#include "bugged.hpp"
+
+using namespace tkn;
+
+constexpr auto stacks = 32u;
+constexpr auto sectors = 48u;
+
+// Serial scatter version, how areaSmoothNormals used to work.
+std::vector<Vec3f> referenceNormals(const Shape& shape) {
+	std::vector<Vec3f> normals(shape.positions.size(), {0.f, 0.f, 0.f});
+	auto& ids = shape.indices;
+	for(auto i = 0u; i < ids.size(); i += 3) {
+		auto& p0 = shape.positions[ids[i]];
+		auto n = nytl::cross(shape.positions[ids[i + 1]] - p0,
+			shape.positions[ids[i + 2]] - p0);
+		normals[ids[i + 0]] += n;
+		normals[ids[i + 1]] += n;
+		normals[ids[i + 2]] += n;
+	}
+
+	for(auto& n : normals) {
+		n = nytl::normalized(n);
+	}
+
+	return normals;
+}
+
+// Texture coordinates for generateUV, u along the sectors.
+std::vector<Vec2f> sphereUVs(bool mirrored) {
+	std::vector<Vec2f> uvs;
+	for(auto i = 0u; i <= stacks; ++i) {
+		for(auto j = 0u; j <= sectors; ++j) {
+			auto u = float(j) / sectors;
+			uvs.push_back({mirrored ? 1.f - u : u, float(i) / stacks});
+		}
+	}
+
+	return uvs;
+}
+
+TEST(normals) {
+	for(auto& shape : {generateIco(4), generateUV(Sphere{}, stacks, sectors)}) {
+		auto normals = areaSmoothNormals(shape.positions, shape.indices);
+		auto ref = referenceNormals(shape);
+		EXPECT(normals.size(), shape.positions.size());
+
+		std::vector<bool> used(shape.positions.size());
+		for(auto i : shape.indices) {
+			used[i] = true;
+		}
+
+		for(auto i = 0u; i < normals.size(); ++i) {
+			if(!used[i]) {
+				EXPECT(nytl::length(normals[i]), 0.f);
+				continue;
+			}
+
+			EXPECT(std::abs(nytl::length(normals[i]) - 1.f) < 1e-5f, true);
+			EXPECT(nytl::dot(normals[i], ref[i]) > 0.99999f, true);
+
+			// unit sphere around the origin
+			EXPECT(nytl::dot(normals[i], shape.positions[i]) > 0.99f, true);
+		}
+	}
+}
+
+TEST(deterministic) {
+	// The result must not depend on the number of threads.
+	// Large enough to be split into multiple slices.
+	ThreadPool single(1u);
+	ThreadPool multi(4u);
+	for(auto& shape : {generateIco(6), generateUV(Sphere{}, 256, 256)}) {
+		auto a = areaSmoothNormals(shape.positions, shape.indices, &single);
+		auto b = areaSmoothNormals(shape.positions, shape.indices, &multi);
+		EXPECT(a == b, true);
+
+		auto ref = referenceNormals(shape);
+		for(auto i = 0u; i < a.size(); ++i) {
+			if(nytl::length(a[i]) > 0.f) { // unreferenced otherwise
+				EXPECT(nytl::dot(a[i], ref[i]) > 0.99999f, true);
+			}
+		}
+
+		auto uvs = std::vector<Vec2f>(shape.positions.size());
+		for(auto i = 0u; i < uvs.size(); ++i) {
+			uvs[i] = {shape.positions[i].x, shape.positions[i].y};
+		}
+
+		auto ta = generateTangents(shape.positions, a, uvs, shape.indices, &single);
+		auto tb = generateTangents(shape.positions, a, uvs, shape.indices, &multi);
+		EXPECT(ta == tb, true);
+	}
+}
+
+TEST(tangents) {
+	auto shape = generateUV(Sphere{}, stacks, sectors);
+	for(auto mirrored : {false, true}) {
+		auto uvs = sphereUVs(mirrored);
+		auto tangents = generateTangents(shape.positions, shape.normals, uvs,
+			shape.indices);
+		EXPECT(tangents.size(), shape.positions.size());
+
+		std::vector<bool> used(shape.positions.size());
+		for(auto i : shape.indices) {
+			used[i] = true;
+		}
+
+		for(auto i = 0u; i < tangents.size(); ++i) {
+			if(!used[i]) {
+				continue;
+			}
+
+			auto t = Vec3f{tangents[i][0], tangents[i][1], tangents[i][2]};
+			auto& n = shape.normals[i];
+			EXPECT(std::abs(nytl::length(t) - 1.f) < 1e-4f, true);
+			EXPECT(std::abs(nytl::dot(t, n)) < 1e-4f, true);
+			// v increases downwards, i.e. texture space is mirrored
+			// compared to the right handed (tangent, bitangent, normal)
+			EXPECT(tangents[i][3], mirrored ? 1.f : -1.f);
+
+			// away from the poles, the tangent points along the
+			// direction of increasing u. Only roughly on the uv seam
+			// since those vertices have triangles only on one side.
+			auto stack = i / (sectors + 1);
+			if(stack > 1 && stack + 1 < stacks) {
+				auto& p = shape.positions[i];
+				auto dpdu = nytl::normalized(Vec3f{p.z, 0.f, -p.x});
+				auto expected = mirrored ? -dpdu : dpdu;
+				EXPECT(nytl::dot(t, expected) > 0.995f, true);
+
+				// bitangent follows v
+				auto b = tangents[i][3] * nytl::cross(n, t);
+				EXPECT(b.y < 0.f, true);
+			}
+		}
+	}
+}
+
+TEST(degenerate) {
+	// all uvs the same: no texture space, still some valid tangent
+	auto shape = generate(Cube{});
+	auto uvs = std::vector<Vec2f>(shape.positions.size(), {0.5f, 0.5f});
+	auto tangents = generateTangents(shape.positions, shape.normals, uvs,
+		shape.indices);
+	for(auto i = 0u; i < tangents.size(); ++i) {
+		auto t = Vec3f{tangents[i][0], tangents[i][1], tangents[i][2]};
+		EXPECT(std::abs(nytl::length(t) - 1.f) < 1e-5f, true);
+		EXPECT(std::abs(nytl::dot(t, shape.normals[i])) < 1e-5f, true);
+		EXPECT(tangents[i][3], 1.f);
+	}
+}
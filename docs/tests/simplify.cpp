@@ -0,0 +1,252 @@
+#include <tkn/scene/simplify.hpp>
+#include <nytl/vecOps.hpp>
+#include <array>
+#include <map>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+float segmentDistanceSq(Vec3f p, Vec3f a, Vec3f b) {
+	auto ab = b - a;
+	auto t = nytl::dot(p - a, ab) / std::max(nytl::dot(ab, ab), 1e-20f);
+	auto d = p - (a + std::clamp(t, 0.f, 1.f) * ab);
+	return nytl::dot(d, d);
+}
+
+// Distance of p to the triangle: to its plane when the projection is
+// inside, to the nearest edge otherwise.
+float triangleDistanceSq(Vec3f p, Vec3f a, Vec3f b, Vec3f c) {
+	auto n = nytl::cross(b - a, c - a);
+	auto len2 = nytl::dot(n, n);
+	if(len2 > 0.f) {
+		auto inside = nytl::dot(nytl::cross(b - a, p - a), n) >= 0.f &&
+			nytl::dot(nytl::cross(c - b, p - b), n) >= 0.f &&
+			nytl::dot(nytl::cross(a - c, p - c), n) >= 0.f;
+		if(inside) {
+			auto d = nytl::dot(p - a, n);
+			return d * d / len2;
+		}
+	}
+
+	return std::min({segmentDistanceSq(p, a, b), segmentDistanceSq(p, b, c),
+		segmentDistanceSq(p, c, a)});
+}
+
+// Brute force: the maximum distance of the points to the triangles.
+// Triangles are culled via their bounding spheres, otherwise this
+// gets slow.
+float maxDistance(nytl::Span<const Vec3f> points, nytl::Span<const u32> indices,
+		nytl::Span<const Vec3f> positions) {
+	struct Bounds {
+		Vec3f center;
+		float radius;
+	};
+
+	std::vector<Bounds> bounds;
+	for(auto i = 0u; i < indices.size(); i += 3) {
+		auto& a = positions[indices[i + 0]];
+		auto& b = positions[indices[i + 1]];
+		auto& c = positions[indices[i + 2]];
+		auto center = (1 / 3.f) * (a + b + c);
+		auto radius = std::max({nytl::length(a - center),
+			nytl::length(b - center), nytl::length(c - center)});
+		bounds.push_back({center, radius});
+	}
+
+	std::vector<u32> vertices(indices.begin(), indices.end());
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+	auto ret = 0.f;
+	for(auto& p : points) {
+		// the distance to any vertex is an upper bound
+		auto best = std::numeric_limits<float>::infinity();
+		for(auto i : vertices) {
+			auto d = p - positions[i];
+			best = std::min(best, nytl::dot(d, d));
+		}
+
+		auto bestLength = std::sqrt(best);
+		for(auto t = 0u; t < bounds.size(); ++t) {
+			auto d = p - bounds[t].center;
+			auto r = bounds[t].radius + bestLength;
+			if(nytl::dot(d, d) >= r * r) {
+				continue;
+			}
+
+			auto* tri = &indices[3 * t];
+			auto dist = triangleDistanceSq(p, positions[tri[0]],
+				positions[tri[1]], positions[tri[2]]);
+			if(dist < best) {
+				best = dist;
+				bestLength = std::sqrt(best);
+			}
+		}
+
+		ret = std::max(ret, best);
+	}
+
+	return std::sqrt(ret);
+}
+
+// Sphere with a uv seam: the vertices of the first and last sector
+// have the same position (generateUV computes them separately, so
+// they may differ slightly) but would have different uvs.
+// Not optimized since that would merge them (Shape has no uvs).
+Shape seamSphere() {
+	auto shape = generateUV(Sphere{}, 64, 64);
+	for(auto i = 0u; i <= 64u; ++i) {
+		shape.positions[i * 65 + 64] = shape.positions[i * 65];
+		shape.normals[i * 65 + 64] = shape.normals[i * 65];
+	}
+
+	return shape;
+}
+
+TEST(simplify) {
+	auto shape = seamSphere();
+	auto tris = u32(shape.indices.size() / 3);
+
+	SimplifyParams params;
+	params.maxError = 0.05f;
+	auto res = simplify(shape.indices, shape.positions, shape.normals, {},
+		tris / 4, params);
+
+	EXPECT(res.indices.size() % 3, 0u);
+	EXPECT(res.indices.size() / 3 <= tris / 4, true);
+	EXPECT(res.indices.empty(), false);
+
+	// the error bounds the distance of every original vertex to the result
+	EXPECT(res.error > 0.f, true);
+	auto dist = maxDistance(shape.positions, res.indices, shape.positions);
+	EXPECT(dist <= res.error * 1.001f, true);
+
+	// only removes vertices, never adds them. No degenerate triangles
+	for(auto i = 0u; i < res.indices.size(); i += 3) {
+		auto a = res.indices[i + 0];
+		auto b = res.indices[i + 1];
+		auto c = res.indices[i + 2];
+		EXPECT(a < shape.positions.size(), true);
+		EXPECT(b < shape.positions.size(), true);
+		EXPECT(c < shape.positions.size(), true);
+		EXPECT(a != b && b != c && c != a, true);
+	}
+
+	// Vertices that share a position with exactly one other vertex
+	// (the uv seam) are collapsed together with it: the seam stays
+	// closed, both sides use the same positions.
+	std::vector<bool> used(shape.positions.size());
+	for(auto i : shape.indices) {
+		used[i] = true;
+	}
+
+	std::vector<bool> usedAfter(shape.positions.size());
+	for(auto i : res.indices) {
+		usedAfter[i] = true;
+	}
+
+	using Pos = std::array<float, 3>;
+	std::map<Pos, unsigned> count, countAfter;
+	for(auto i = 0u; i < shape.positions.size(); ++i) {
+		auto& p = shape.positions[i];
+		count[{p[0], p[1], p[2]}] += used[i];
+		countAfter[{p[0], p[1], p[2]}] += usedAfter[i];
+	}
+
+	auto seam = 0u;
+	auto removed = 0u;
+	for(auto& [pos, c] : count) {
+		if(c == 2u) {
+			++seam;
+			removed += (countAfter[pos] == 0u);
+			EXPECT(countAfter[pos] == 0u || countAfter[pos] == 2u, true);
+		}
+	}
+
+	EXPECT(seam > 0u, true);
+	EXPECT(removed > 0u, true);
+	EXPECT(res.lockedVertices, 0u);
+}
+
+TEST(flat) {
+	// Every triangle has its own vertices, so (almost) every position is
+	// shared by more than two vertices, those can't be removed.
+	auto shape = optimizedSphere(64);
+	std::vector<Vec3f> positions;
+	std::vector<u32> indices;
+	std::map<std::array<float, 3>, unsigned> count;
+	for(auto i : shape.indices) {
+		auto& p = shape.positions[i];
+		indices.push_back(positions.size());
+		positions.push_back(p);
+		++count[{p[0], p[1], p[2]}];
+	}
+
+	auto locked = 0u;
+	for(auto& [pos, c] : count) {
+		locked += (c > 2u) ? c : 0u;
+	}
+
+	auto res = simplify(indices, positions, {}, {}, 0u);
+	EXPECT(res.lockedVertices, locked);
+	EXPECT(res.lockedVertices > positions.size() / 2, true);
+	EXPECT(res.indices.size() > indices.size() / 2, true);
+}
+
+TEST(limit) {
+	// with a tiny error limit (almost) nothing can be collapsed
+	// on a curved surface
+	auto shape = optimizedSphere(64);
+	SimplifyParams params;
+	params.maxError = 1e-6f;
+	auto res = simplify(shape.indices, shape.positions, {}, {}, 0u, params);
+	EXPECT(res.error < 1e-3f, true);
+	EXPECT(res.indices.size() > shape.indices.size() / 2, true);
+}
+
+TEST(lods) {
+	auto shape = optimizedSphere(64);
+	auto lods = buildLods(shape.indices, shape.positions, shape.normals, {});
+	EXPECT(lods.levels.size() > 1u, true);
+
+	auto prevTris = u32(shape.indices.size() / 3);
+	auto prevError = 0.f;
+	for(auto& level : lods.levels) {
+		EXPECT(level.indexCount % 3, 0u);
+		EXPECT(level.indexOffset + level.indexCount <= lods.indices.size(), true);
+		EXPECT(level.indexCount / 3 < prevTris, true);
+		EXPECT(level.error >= prevError, true);
+		prevTris = level.indexCount / 3;
+		prevError = level.error;
+	}
+
+	for(auto i : lods.indices) {
+		EXPECT(i < shape.positions.size(), true);
+	}
+
+	// The error of every level bounds the distance of the original
+	// vertices to it, selectLod must not select levels that are too coarse.
+	for(auto& level : lods.levels) {
+		auto indices = nytl::Span<const u32>(lods.indices).subspan(
+			level.indexOffset, level.indexCount);
+		auto dist = maxDistance(shape.positions, indices, shape.positions);
+		EXPECT(dist <= level.error * 1.001f, true);
+	}
+
+	// coarser levels with increasing distance
+	auto prev = 0u;
+	for(auto dist : {0.1f, 1.f, 10.f, 100.f, 1000.f, 1e5f}) {
+		auto lod = selectLod(lods, dist, 1000.f);
+		EXPECT(lod >= prev, true);
+		EXPECT(lod <= lods.levels.size(), true);
+		prev = lod;
+	}
+
+	EXPECT(selectLod(lods, 0.f, 1000.f), 0u);
+	EXPECT(selectLod(lods, 1e5f, 1000.f), unsigned(lods.levels.size()));
+}
@@ -0,0 +1,163 @@
+#include <tkn/sparseGrid.hpp>
+#include <tkn/threadPool.hpp>
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include "bugged.hpp"
+#include "common.hpp"
+
+using namespace tkn;
+using namespace tkn::test;
+
+namespace {
+
+// n^3 samples covering [-1.5, 1.5]^3
+SparseSdfGrid sparse(unsigned n, const SdfRowFunc& func, float band,
+		ThreadPool* pool = nullptr) {
+	auto s = 3.f / (n - 1);
+	SparseSdfGrid ret({n, n, n}, {-1.5f, -1.5f, -1.5f}, {s, s, s});
+	ret.sample(func, band, 1.f, pool);
+	return ret;
+}
+
+// Triangles with sorted positions, to compare meshes with
+// different vertex orders.
+using Triangle = std::tuple<Vec3f, Vec3f, Vec3f>;
+bool less(const Vec3f& a, const Vec3f& b) {
+	return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+}
+
+std::vector<Triangle> triangles(const IsoMesh& mesh) {
+	std::vector<Triangle> ret;
+	for(auto i = 0u; i + 2 < mesh.indices.size(); i += 3) {
+		// rotate the smallest position to the front, keeps the winding
+		Vec3f p[3];
+		for(auto j = 0u; j < 3u; ++j) {
+			p[j] = mesh.positions[mesh.indices[i + j]];
+		}
+
+		auto first = 0u;
+		for(auto j = 1u; j < 3u; ++j) {
+			first = less(p[j], p[first]) ? j : first;
+		}
+
+		ret.push_back({p[first], p[(first + 1) % 3], p[(first + 2) % 3]});
+	}
+
+	std::sort(ret.begin(), ret.end(), [](auto& a, auto& b) {
+		if(std::get<0>(a) != std::get<0>(b)) {
+			return less(std::get<0>(a), std::get<0>(b));
+		} else if(std::get<1>(a) != std::get<1>(b)) {
+			return less(std::get<1>(a), std::get<1>(b));
+		}
+		return less(std::get<2>(a), std::get<2>(b));
+	});
+	return ret;
+}
+
+} // anon namespace
+
+TEST(access) {
+	auto n = 100u;
+	auto d = denseGrid(n, rows(sphereSdf));
+	auto s = sparse(n, rows(sphereSdf), 0.1f);
+
+	// only a part of the volume is allocated
+	EXPECT(s.bricks().empty(), false);
+	auto samples = s.bricks().size() * SparseSdfGrid::brickSamples;
+	EXPECT(samples < d.values.size() / 2, true);
+
+	// all samples within the band are stored exactly, everything
+	// else has the background value with the correct sign
+	auto correct = true;
+	SparseSdfGrid::Accessor acc(s);
+	for(auto z = 0u; z < n; ++z) {
+		for(auto y = 0u; y < n; ++y) {
+			for(auto x = 0u; x < n; ++x) {
+				auto expected = d.value(x, y, z);
+				auto value = s.value(x, y, z);
+				correct &= (value == acc.value(x, y, z));
+				if(std::abs(expected) <= s.background()) {
+					correct &= (value == expected);
+				} else if(value != expected) {
+					correct &= (std::abs(value) == s.background());
+					correct &= ((value < 0.f) == (expected < 0.f));
+				}
+			}
+		}
+	}
+	EXPECT(correct, true);
+
+	auto count = 0u;
+	auto same = true;
+	s.forEachSample([&](u32 x, u32 y, u32 z, float value) {
+		same &= (value == d.value(x, y, z));
+		++count;
+	});
+	EXPECT(same, true);
+	EXPECT(count > 0u, true);
+	EXPECT(count <= samples, true);
+}
+
+// The band is widened to a cell diagonal, enough for extraction.
+TEST(marchingCubes) {
+	for(auto func : {rows(sphereSdf), rows(torusSdf)}) {
+		auto n = 61u;
+		auto d = marchingCubes(denseGrid(n, func), 0.f);
+		auto grid = sparse(n, func, 0.001f);
+		auto s = marchingCubes(grid, 0.f);
+
+		EXPECT(s.positions.size(), d.positions.size());
+		EXPECT(s.indices.size(), d.indices.size());
+		EXPECT(s.normals.size(), s.positions.size());
+		EXPECT(triangles(s) == triangles(d), true);
+	}
+}
+
+// Iso values close to the background can cross edges in tiles, those
+// cells are skipped. Must still give a valid mesh.
+TEST(isoNearBackground) {
+	auto grid = sparse(61, rows(torusSdf), 0.001f);
+	for(auto f : {-0.99f, -0.5f, 0.5f, 0.99f}) {
+		auto iso = f * grid.background();
+		auto mesh = marchingCubes(grid, iso);
+		EXPECT(mesh.indices.empty(), false);
+		EXPECT(mesh.indices.size() % 3, 0u);
+		EXPECT(mesh.normals.size(), mesh.positions.size());
+
+		auto valid = true;
+		for(auto i : mesh.indices) {
+			valid &= (i < mesh.positions.size());
+		}
+		EXPECT(valid, true);
+	}
+}
+
+TEST(threads) {
+	ThreadPool single(0u);
+	ThreadPool multi(4u);
+
+	auto a = sparse(70, rows(torusSdf), 0.05f, &single);
+	auto b = sparse(70, rows(torusSdf), 0.05f, &multi);
+	EXPECT(a.bricks().size(), b.bricks().size());
+
+	auto ma = marchingCubes(a, 0.f, &single);
+	auto mb = marchingCubes(b, 0.f, &multi);
+	EXPECT(ma.indices == mb.indices, true);
+	EXPECT(ma.positions == mb.positions, true);
+	EXPECT(ma.normals == mb.normals, true);
+}
+
+TEST(empty) {
+	auto far = [](nytl::Span<const float> xs, float, float,
+			nytl::Span<float> values) {
+		for(auto i = 0u; i < xs.size(); ++i) {
+			values[i] = -10.f;
+		}
+	};
+
+	auto s = sparse(40, far, 0.1f);
+	EXPECT(s.bricks().empty(), true);
+	EXPECT(s.value(3, 5, 7), -s.background());
+	EXPECT(marchingCubes(s, 0.f).positions.empty(), true);
+}
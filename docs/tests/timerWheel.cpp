@@ -0,0 +1,72 @@
+#include <tkn/timerWheel.hpp>
+#include <vector>
+#include "bugged.hpp"
+
+using namespace std::chrono_literals;
+using Clock = tkn::TimerWheel::Clock;
+
+TEST(basic) {
+	auto start = Clock::time_point{};
+	tkn::TimerWheel wheel(1ms, start);
+
+	std::vector<int> fired;
+	wheel.add(start + 5ms, [&]{ fired.push_back(5); });
+	wheel.add(start + 1ms, [&]{ fired.push_back(1); });
+	auto id = wheel.add(start + 3ms, [&]{ fired.push_back(3); });
+	EXPECT(wheel.size(), 3u);
+	EXPECT(*wheel.nextExpiry() == start + 1ms, true);
+
+	EXPECT(wheel.cancel(id), true);
+	EXPECT(wheel.cancel(id), false);
+
+	EXPECT(wheel.advance(start + 4ms), 1u);
+	EXPECT(fired.size(), 1u);
+	EXPECT(fired[0], 1);
+
+	EXPECT(wheel.advance(start + 5ms), 1u);
+	EXPECT(fired.back(), 5);
+	EXPECT(wheel.empty(), true);
+	EXPECT(wheel.nextExpiry().has_value(), false);
+}
+
+TEST(cascade) {
+	auto start = Clock::time_point{};
+	tkn::TimerWheel wheel(1ms, start);
+
+	// spans all levels, including timers beyond the highest one
+	std::vector<unsigned> delays = {63, 64, 65, 200, 4095, 4096, 4097,
+		100000, 262144, 20000000};
+	std::vector<unsigned> fired;
+	for(auto d : delays) {
+		wheel.add(start + d * 1ms, [&, d]{
+			// must fire exactly at its tick
+			EXPECT((wheel.time() - start) / 1ms, d);
+			fired.push_back(d);
+		});
+	}
+
+	wheel.advance(start + 20000000ms);
+	EXPECT(fired == delays, true);
+}
+
+TEST(reentrant) {
+	auto start = Clock::time_point{};
+	tkn::TimerWheel wheel(1ms, start);
+
+	auto count = 0u;
+	tkn::TimerWheel::TimerID other {};
+	wheel.add(start + 2ms, [&]{
+		++count;
+		wheel.cancel(other);
+		wheel.add(1ms, [&]{ ++count; });
+	});
+	other = wheel.add(start + 3ms, [&]{ count += 100; });
+
+	EXPECT(wheel.advance(start + 2ms), 1u);
+	EXPECT(count, 1u);
+
+	// timers added for the past fire on the next tick
+	wheel.add(start, [&]{ ++count; });
+	EXPECT(wheel.advance(start + 3ms), 2u);
+	EXPECT(count, 3u);
+}
@@ -55,6 +55,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -769,6 +770,13 @@ struct Buffer {
       uri;  // considered as required here but not in the spec (need to clarify)
   Value extras;
 
+  // for tkn: buffers loaded with tkn::parseGltf reference memory mapped
+  // data instead of owning a copy in 'data'. The memory is kept alive
+  // by Model::mappedSource. Use tkn::bufferData to access the contents
+  // of a buffer independent from where it is stored.
+  const unsigned char *mappedData = nullptr;
+  size_t mappedSize = 0;
+
   bool operator==(const Buffer &) const;
 };
 
@@ -830,6 +838,9 @@ class Model {
   Asset asset;
 
   Value extras;
+
+  // for tkn: keeps the memory referenced by Buffer::mappedData alive.
+  std::shared_ptr<const void> mappedSource;
 };
 
 enum SectionCheck {
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+#include <array>
+
+namespace tkn {
+
+class ThreadPool;
+
+// How Cloth advances the simulation.
+enum class ClothSolver {
+	// Explicit verlet integration of the spring forces. Cheap steps but
+	// stiff springs (and large damping constants) need tiny time steps.
+	verlet,
+	// Extended position based dynamics: every spring is a distance
+	// constraint with compliance 1 / ks (and damping derived from kd),
+	// solved with graph-colored Gauss-Seidel iterations. Stays stable
+	// for large (e.g. frame-rate) time steps, converges to the stiffness
+	// of the springs with enough iterations.
+	xpbd,
+};
+
+// See Cloth.
+struct ClothParams {
+	// Spring constants of structural, bend and shear springs.
+	std::array<float, 3> ks {50.f, 50.f, 50.f};
+	// Damping constants of structural, bend and shear springs.
+	std::array<float, 3> kd {0.03f, 0.03f, 0.03f};
+	float mass {0.05f}; // of every node, in kg
+	Vec3f gravity {0.f, -10.f, 0.f};
+	float spacing {1.f}; // rest length of structural springs
+	// Whether the corners (in order -x-y, +x-y, -x+y, +x+y) are fixed.
+	std::array<bool, 4> fixCorners {true, true, true, true};
+	ClothSolver solver {ClothSolver::verlet};
+	unsigned iterations {10u}; // constraint iterations per step, xpbd only
+};
+
+// Mass-spring cloth on a regular grid of nodes, integrated with verlet
+// integration. Every node is connected to its direct neighbors
+// (structural springs), the nodes two steps away (bend springs) and
+// its diagonal neighbors (shear springs).
+// Does not depend on rendering, the positions can be written to a
+// vertex buffer via writePositions.
+// The node state is stored as structure of arrays, the node at (x, y)
+// has index y * width + x. The force evaluation is vectorized (when
+// SSE is available) and distributed over a thread pool in tiles small
+// enough that the rows they read stay in cache.
+// With the verlet solver, a fixed time step should be used: changing
+// it between steps introduces an error and too large steps (relative to
+// the spring and especially the damping constants) make the simulation
+// explode. See ClothSolver::xpbd for larger steps.
+class Cloth {
+public:
+	using Params = ClothParams;
+
+	// Size of the tiles the grid is processed in, in nodes.
+	static constexpr auto tileWidth = 512u;
+	static constexpr auto tileHeight = 16u;
+
+	Params params;
+
+public:
+	Cloth() = default;
+
+	// Creates a flat cloth of width * height nodes in the xz plane,
+	// centered around the origin. Both dimensions must be at least 2.
+	Cloth(unsigned width, unsigned height, const ClothParams& = {});
+
+	// Resets the cloth into its initial flat state.
+	void reset();
+
+	// Advances the simulation by dt. Uses the given pool (or
+	// ThreadPool::instance() if nullptr) for large grids, the calling
+	// thread takes part.
+	void step(float dt, ThreadPool* pool = nullptr);
+
+	// Writes scale * position of all nodes into dst, in node order.
+	void writePositions(nytl::Span<Vec3f> dst, float scale = 1.f) const;
+
+	std::size_t id(unsigned x, unsigned y) const { return y * width_ + x; }
+	Vec3f position(std::size_t id) const;
+	Vec3f velocity(std::size_t id) const;
+
+	unsigned width() const { return width_; }
+	unsigned height() const { return height_; }
+	std::size_t nodeCount() const { return std::size_t(width_) * height_; }
+
+	// Components of the current positions.
+	nytl::Span<const float> x() const { return pos_[0]; }
+	nytl::Span<const float> y() const { return pos_[1]; }
+	nytl::Span<const float> z() const { return pos_[2]; }
+
+protected:
+	using Components = std::array<std::vector<float>, 3>;
+
+	void stepVerlet(float dt, ThreadPool& pool);
+	void stepXpbd(float dt, ThreadPool& pool);
+
+	void stepTile(unsigned x0, unsigned x1, unsigned y0, unsigned y1, float dt);
+	void stepNode(unsigned x, unsigned y, float dt);
+	void stepNodes4(unsigned x, unsigned y, float dt);
+
+protected:
+	unsigned width_ {};
+	unsigned height_ {};
+
+	// Current and last positions. A step writes the new positions into
+	// the last positions (only read for the node itself) and then
+	// swaps them. Velocities are double buffered since they are read
+	// for the neighbors.
+	Components pos_;
+	Components lastPos_;
+	Components vel_;
+	Components nextVel_;
+
+	// xpbd only, see stepXpbd.
+	std::vector<float> invMass_;
+	std::array<std::vector<float>, 6> lambda_;
+};
+
+} // namespace tkn
@@ -12,6 +12,7 @@
 #include <vector>
 #include <memory>
 #include <bitset>
+#include <array>
 #include <chrono>
 #include <functional>
 
@@ -180,6 +181,19 @@ public:
 	/// Used to avoid fragmentation or higher package lost rates.
 	static constexpr auto maxPackageSize = 1200;
 
+	/// The maximum number of fragments a received package may have.
+	/// Packages with more fragments are treated as invalid.
+	static constexpr auto maxFragmentCount = 1024;
+
+	/// The maximum number of incomplete fragmented packages that are kept.
+	/// When a fragment of another package arrives, the package whose
+	/// first fragment arrived first is discarded.
+	static constexpr auto maxFragmentedPackages = 32;
+
+	/// The maximum number of unused package buffers kept in the pool,
+	/// see recvBuffer. Further buffers are freed.
+	static constexpr auto maxPooledPackageBuffers = 256;
+
 	/// The function responsible for handling received messages.
 	/// See the messageHandler function for more information.
 	/// \param seq The sequence number this message belongs to
@@ -238,6 +252,12 @@ public:
 
 
 	// --- Receiving ---
+	/// Returns a buffer of maxPackageSize bytes from the internal pool
+	/// into which the next package can be received. After receiving, it
+	/// should be resized to the received size and moved into
+	/// processPackage(std::vector<std::byte>).
+	std::vector<std::byte> recvBuffer();
+
 	/// Processes the given received package.
 	/// Returns the status of the message.
 	/// If it returns PackageStatus::message this package caused
@@ -249,8 +269,19 @@ public:
 	/// parsed by the messgae handler.
 	/// If it returns PackageStatus::fragment the package was a valid fragment that
 	/// did not complete a package.
+	/// Since the given buffer is not owned, fragments have to be copied
+	/// into a pooled buffer. Prefer the overload below when receiving
+	/// fragmented packages.
 	PackageStatus processPackage(asio::const_buffer buffer);
 
+	/// Like processPackage(asio::const_buffer) but takes ownership of the
+	/// buffer the package was received into (ideally retrieved via recvBuffer).
+	/// Fragments are retained until their package is complete and then passed
+	/// to the message handler in place, as RecvBuf scattered over the
+	/// fragment buffers, i.e. their payloads are never copied.
+	/// The buffer is moved back into the pool afterwards.
+	PackageStatus processPackage(std::vector<std::byte> buffer);
+
 	/// Sets the callback for messages to be processed.
 	/// This will only be called from within processPackage.
 	/// The handler will receive a MessageBuffer that points to the
@@ -269,9 +300,16 @@ public:
 	MessageHandler messageHandler(MessageHandler newHandler);
 
 	/// Frees all stored fragments that are older than the given time.
+	/// Their buffers are moved back into the pool.
 	/// Returns the number of discarded fragmented packages.
+	/// Is called with fragmentTimeout for every received fragment.
 	unsigned int discardFragments(Clock::duration age);
 
+	/// Sets the time after which incomplete fragmented packages are
+	/// discarded, measured since their first fragment arrived.
+	void fragmentTimeout(Clock::duration timeout) { fragmentTimeout_ = timeout; }
+	Clock::duration fragmentTimeout() const { return fragmentTimeout_; }
+
 	/// Frees all currently unused memory.
 	void shrink();
 
@@ -290,6 +328,12 @@ protected:
 	/// critical_
 	void updateCriticalMessages();
 
+	/// Shared implementation of the processPackage overloads.
+	/// If owned is not null, it holds the buffer of data and may be
+	/// moved from. Otherwise data is only valid during this call.
+	PackageStatus processPackage(nytl::Span<const std::byte> data,
+		std::vector<std::byte>* owned);
+
 protected:
 	std::vector<Message> critical_; // stores all critical messages, sorted
 	std::vector<std::vector<std::byte>> nonCritical_; // stores all non-critical pending messages
@@ -302,22 +346,45 @@ protected:
 	/// a buffer is needed. Separated since msg buffers are usually way smaller
 	/// than pkg buffers. They may still contain data, must be cleared when popped
 	std::vector<std::vector<std::byte>> unusedMsgBuffers_;
-	std::vector<std::vector<std::byte>> unusedPkgBuffers_; // used for fragmented pkgs
+	std::vector<std::vector<std::byte>> unusedPkgBuffers_; // received pkgs, see recvBuffer
+
+	/// A received fragment of a fragmented package.
+	/// Keeps the whole received package buffer alive so that its
+	/// payload can be handled in place once all fragments are there.
+	struct Fragment {
+		std::vector<std::byte> buffer; // the received package, empty if not received yet
+		// The raw package data (stripped headers and magic) in buffer.
+		// Offsets instead of a span since fragments may be copied.
+		std::size_t payloadBegin {};
+		std::size_t payloadEnd {};
+	};
 
 	/// A fragmented package that is currently being assembled.
 	/// Contains the packages sequence number as well as all fragments.
-	/// If a vector in fragments is empty the associated fragment has not yet
+	/// If a fragment has an empty buffer it has not yet
 	/// been received and must be waited on.
 	/// Fragmented pacakges are discarded after some time if not all fragments
 	/// have arrived.
 	struct FragmentedPackage {
 		Clock::time_point firstSeen; // first encounter of any fragment
-		MessageHeader header;
-		std::vector<bool> received; // which fragments where received
-		std::vector<std::byte> data; // the raw package data (stripped headers and magic)
+		uint32_t seq; // sequence number of the package
+		MessageHeader header; // only valid if the first fragment was received
+		unsigned count {}; // number of fragments, 0 while the last one is unknown
+		unsigned received {}; // number of received fragments
+		std::vector<Fragment> fragments;
 	};
 
-	std::vector<FragmentedPackage> fragmented_; // sorted
+	std::vector<FragmentedPackage> fragmented_; // sorted by seq
+	std::vector<nytl::Span<const std::byte>> chunks_; // RecvBuf chunks for fragments
+	Clock::duration fragmentTimeout_ {std::chrono::seconds(1)};
+
+	/// Moves the buffers of the given fragmented package back into
+	/// unusedPkgBuffers_.
+	void releaseFragments(FragmentedPackage& pkg);
+
+	/// Moves the given buffer back into unusedPkgBuffers_, unless
+	/// it already holds maxPooledPackageBuffers.
+	void poolPkgBuffer(std::vector<std::byte>&& buffer);
 };
 
 } // namespace tkn
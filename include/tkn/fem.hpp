@@ -0,0 +1,148 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/mat.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+#include <array>
+
+namespace tkn {
+
+class ThreadPool;
+
+// Sparse matrix in compressed sparse row format.
+struct CsrMatrix {
+	unsigned rows {};
+	std::vector<u32> rowStart; // offsets into cols and values, rows + 1 entries
+	std::vector<u32> cols; // sorted per row
+	std::vector<float> values;
+};
+
+// Computes y = A * x. The rows are distributed over the given pool
+// (or ThreadPool::instance() if nullptr).
+void multiply(const CsrMatrix& A, nytl::Span<const float> x,
+	nytl::Span<float> y, ThreadPool* pool = nullptr);
+
+struct PcgResult {
+	unsigned iterations {};
+	float residual {}; // relative to the norm of b
+};
+
+// Solves A * x = b for a symmetric positive definite A using conjugate
+// gradients with a jacobi (diagonal) preconditioner. The given x is
+// used as initial guess. Stops after maxIterations or as soon as the
+// residual is at most tolerance * |b|. The result does not depend on
+// the number of threads in the pool.
+PcgResult solvePcg(const CsrMatrix& A, nytl::Span<const float> b,
+	nytl::Span<float> x, unsigned maxIterations, float tolerance,
+	ThreadPool* pool = nullptr);
+
+// Returns the rotational part R of the polar decomposition F = R * S
+// (S symmetric) of the given matrix, in closed form. Always returns
+// a proper rotation (for inverted F the one closest to it), identity
+// for degenerate F.
+nytl::Mat2f polarRotation(const nytl::Mat2f& F);
+
+// See FemBody.
+struct FemParams {
+	float youngsModulus {500.f}; // stiffness
+	float poissonRatio {0.3f}; // in [0, 0.5)
+	float density {1.f}; // mass per area
+	float damping {0.1f}; // mass proportional, in 1/s
+	Vec2f gravity {0.f, -9.81f};
+
+	// Limits for the linear solver in each step.
+	unsigned maxIterations {200u};
+	float tolerance {1e-3f};
+};
+
+// Two dimensional soft body, simulated with linear triangle finite
+// elements and corotational linear elasticity: the element stiffness
+// is applied in the rotated frame of every element (the rotation being
+// extracted from the deformation gradient via polar decomposition)
+// so large rotations don't produce ghost forces.
+// Integrated with (linearized) backward euler: every step assembles
+// the sparse system (M + dt * C + dt^2 * K) dv = dt * (f - dt * K v)
+// and solves it with preconditioned conjugate gradients. Stable for
+// large time steps. The assembly runs in parallel, the elements are
+// colored so that elements of one color don't share any nodes.
+// Does not depend on rendering.
+class FemBody {
+public:
+	using Triangle = std::array<u32, 3>;
+	FemParams params;
+
+public:
+	// Creates a body of width * height nodes with the given distance,
+	// every quad split into two triangles. Node (x, y) has index
+	// y * width + x.
+	static FemBody grid(unsigned width, unsigned height, float spacing,
+		const FemParams& = {});
+
+	FemBody() = default;
+
+	// The triangles are given as node indices into the rest positions,
+	// in counter-clockwise order.
+	FemBody(std::vector<Vec2f> restPositions, std::vector<Triangle> triangles,
+		const FemParams& = {});
+
+	// Advances the simulation by dt. Uses the given pool (or
+	// ThreadPool::instance() if nullptr), the calling thread takes part.
+	void step(float dt, ThreadPool* pool = nullptr);
+
+	// Recomputes the element stiffness and the node masses. Must be
+	// called when the material parameters were changed.
+	void updateMaterial();
+
+	// Fixed nodes keep their current position.
+	void fix(u32 node, bool fixed = true);
+	bool fixed(u32 node) const { return fixed_[node]; }
+
+	Vec2f position(u32 node) const { return rest_[node] + u_[node]; }
+	nytl::Span<const Vec2f> restPositions() const { return rest_; }
+	nytl::Span<const Vec2f> displacements() const { return u_; }
+	nytl::Span<const Vec2f> velocities() const { return v_; }
+	nytl::Span<Vec2f> velocities() { return v_; }
+	nytl::Span<const Triangle> triangles() const { return triangles_; }
+	float mass(u32 node) const { return mass_[node]; }
+
+	// Number of colors of the element coloring.
+	unsigned colorCount() const { return unsigned(colorStart_.size() - 1); }
+
+	// Result of the linear solver in the last step.
+	const PcgResult& lastSolve() const { return lastSolve_; }
+
+protected:
+	struct Element {
+		Triangle nodes;
+		float area;
+		std::array<float, 4> dmInv; // inverse rest edge matrix, row major
+		std::array<float, 36> K; // rest stiffness, row major 6x6
+		// Offset of the matrix block (2 * nodes[i], 2 * nodes[j]) in
+		// the values of the system matrix, index i * 3 + j.
+		std::array<u32, 9> blocks;
+	};
+
+	void initSystem();
+	void colorElements();
+
+protected:
+	std::vector<Vec2f> rest_;
+	std::vector<Vec2f> u_; // displacement
+	std::vector<Vec2f> v_; // velocity
+	std::vector<float> mass_; // lumped
+	std::vector<bool> fixed_;
+	std::vector<Triangle> triangles_;
+
+	std::vector<Element> elements_; // sorted by color
+	std::vector<u32> colorStart_ {0u}; // offsets into elements, colors + 1 entries
+
+	CsrMatrix system_;
+	std::vector<u32> diag_; // offset of the diagonal block of every node
+	std::vector<float> rhs_;
+	std::vector<float> dv_;
+	PcgResult lastSolve_ {};
+};
+
+} // namespace tkn
@@ -3,6 +3,8 @@
 #include <nytl/stringParam.hpp>
 #include <memory>
 #include <cstdio>
+#include <string_view>
+#include <system_error>
 
 namespace tkn {
 
@@ -40,4 +42,12 @@ private:
 	std::FILE* file_ {};
 };
 
+/// Writes the data to a temporary file next to 'path' and then renames
+/// it to 'path', so that a reader (also in another process) never sees
+/// a partially written file. The temporary file name is unique per
+/// process and call, concurrent writers never write into the same file
+/// (the last rename wins). The temporary file is removed on failure.
+bool replaceFile(nytl::StringParam path, std::string_view data,
+	std::error_code& ec);
+
 } // namespace tkn
@@ -3,33 +3,80 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_set>
+#include <nytl/span.hpp>
 #include <nytl/stringParam.hpp>
 
 namespace tkn {
 
-// TODO: callback-based interface.
-// TODO: simple std::fs implementation for windows. Later on (or when
-// neeeded for performance) this could be replaced by a intoify winapi
-// equivalent.
 // TODO: when on linux, we could add the inotify fd to the swa display
-// event loop and just do nothing in update.
+// event loop instead of using a separate thread.
+// TODO: the std::filesystem fallback (used on windows) simply polls the
+// last write times. Could be replaced by a winapi inotify equivalent.
 
 // Simple FileWatcher, able to notify on file change.
-// Implementations may not be threadsafe.
+// Changes are detected on a separate thread. Bursts of changes (e.g.
+// editors writing multiple files or writing a file in multiple steps)
+// are coalesced: only when no further change was detected during the
+// debounce duration, all changes are made available as one batch.
+// Batches are dispatched in 'update', the only place where callbacks
+// are called and 'check' changes its result.
+// The public interface is not threadsafe.
 class FileWatcher {
 public:
-	FileWatcher();
+	// Called with the ids of all watches whose file changed in a batch.
+	using Callback = std::function<void(nytl::Span<const std::uint64_t> ids)>;
+	static constexpr auto defaultDebounce = std::chrono::milliseconds(50);
+
+public:
+	explicit FileWatcher(std::chrono::milliseconds debounce = defaultDebounce);
 	~FileWatcher();
 
 	std::uint64_t watch(nytl::StringParam path);
 	void unregsiter(std::uint64_t);
 
+	// Dispatches batches of changes, should be called regularly (e.g.
+	// every frame). Cheap when nothing changed.
 	void update();
+
+	// Returns whether the file of the given watch changed (in a batch
+	// dispatched by update) since the last call.
 	bool check(std::uint64_t);
 
+	// Registers a callback for all batches dispatched by update.
+	// Returns an id that can be used to remove the callback.
+	std::uint64_t onChange(Callback);
+	void removeCallback(std::uint64_t);
+
+	// The number of batches dispatched so far. Can be used to skip
+	// checking watches when nothing changed.
+	std::uint64_t batchCount() const { return batchCount_; }
+
 protected:
+	// Called from the watcher thread with all changed watches
+	// after the debounce duration.
+	void pushBatch(std::vector<std::uint64_t> ids);
+
+protected:
+	// Platform-specific, owns the watcher thread
 	struct Impl;
 	std::unique_ptr<Impl> impl_;
+	std::chrono::milliseconds debounce_;
+
+	// Batches pushed by the watcher thread but not yet dispatched.
+	std::mutex mutex_;
+	std::vector<std::uint64_t> pending_;
+	std::atomic<bool> hasPending_ {};
+
+	std::unordered_set<std::uint64_t> changed_;
+	std::vector<std::pair<std::uint64_t, Callback>> callbacks_;
+	std::uint64_t lastCallbackID_ {};
+	std::uint64_t batchCount_ {};
 };
 
 } // namespace tkn
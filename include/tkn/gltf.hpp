@@ -2,37 +2,53 @@
 
 #include <tinygltf.hpp>
 #include <cstdint>
+#include <cstddef>
+#include <vector>
 #include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <dlg/dlg.hpp>
 
 // intended for general gltf helpers
-// gltf accessor iterator
+// gltf accessor iterator, bulk accessor decoding
 
 namespace tkn {
 
 namespace gltf = tinygltf;
 
+// Returns the contents of the given buffer. Buffers loaded with
+// parseGltf (see tkn/gltfParse.hpp) don't own their data but reference
+// memory mapped files.
+inline nytl::Span<const std::byte> bufferData(const gltf::Buffer& buf) {
+	if(buf.mappedData) {
+		return {reinterpret_cast<const std::byte*>(buf.mappedData), buf.mappedSize};
+	}
+
+	return {reinterpret_cast<const std::byte*>(buf.data.data()), buf.data.size()};
+}
+
 /// Throws std::runtime_error if componentType is not a valid gltf component type
 /// Does not check for bounds of address
 inline double read(const gltf::Buffer& buf, unsigned address,
 		unsigned componentType) {
 	double v;
 	auto t = componentType;
+	auto data = bufferData(buf).data() + address;
 	if(t == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
-		v = *reinterpret_cast<const std::uint8_t*>(&buf.data[address]);
+		v = *reinterpret_cast<const std::uint8_t*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
-		v = *reinterpret_cast<const std::uint32_t*>(&buf.data[address]);
+		v = *reinterpret_cast<const std::uint32_t*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
-		v = *reinterpret_cast<const std::uint16_t*>(&buf.data[address]);
+		v = *reinterpret_cast<const std::uint16_t*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_SHORT) {
-		v = *reinterpret_cast<const std::int16_t*>(&buf.data[address]);
+		v = *reinterpret_cast<const std::int16_t*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_BYTE) {
-		v = *reinterpret_cast<const std::int8_t*>(&buf.data[address]);
+		v = *reinterpret_cast<const std::int8_t*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_INT) {
-		v = *reinterpret_cast<const std::int32_t*>(&buf.data[address]);
+		v = *reinterpret_cast<const std::int32_t*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_FLOAT) {
-		v = *reinterpret_cast<const float*>(&buf.data[address]);
+		v = *reinterpret_cast<const float*>(data);
 	} else if(t == TINYGLTF_COMPONENT_TYPE_DOUBLE) {
-		v = *reinterpret_cast<const double*>(&buf.data[address]);
+		v = *reinterpret_cast<const double*>(data);
 	} else {
 		throw std::runtime_error("Invalid gltf component type");
 	}
@@ -49,7 +65,7 @@ auto read(const gltf::Buffer& buf, unsigned address, unsigned type,
 	// NOTE: not really bytes though
 	unsigned components = gltf::GetTypeSizeInBytes(type);
 	unsigned valSize = gltf::GetComponentSizeInBytes(componentType);
-	for(auto i = 0u; i < components; ++i) {
+	for(auto i = 0u; i < N; ++i) {
 		if(i < components) {
 			vals[i] = read(buf, address, componentType);
 			address += valSize;
@@ -61,10 +77,13 @@ auto read(const gltf::Buffer& buf, unsigned address, unsigned type,
 	return vals;
 }
 
+template<std::size_t N, typename T>
+using AccessorValue = std::conditional_t<N == 1, T, nytl::Vec<N, T>>;
+
 template<std::size_t N, typename T>
 struct AccessorIterator {
 	static_assert(N > 0);
-	using Value = std::conditional_t<N == 1, T, nytl::Vec<N, T>>;
+	using Value = AccessorValue<N, T>;
 
 	const gltf::Buffer* buffer {};
 	std::size_t address {};
@@ -117,6 +136,7 @@ struct AccessorIterator {
 
 	AccessorIterator& operator--() {
 		address -= stride;
+		return *this;
 	}
 
 	AccessorIterator operator--(int) {
@@ -178,5 +198,53 @@ bool operator!=(const AccessorIterator<N, T>& a, const AccessorIterator<N, T>& b
 	return a.buffer != b.buffer || a.address != b.address || a.stride != b.stride;
 }
 
+// Resolved and validated layout of the data of an accessor.
+// Computed once per accessor so that bulk decoding doesn't have to
+// look up or check anything per element.
+struct AccessorData {
+	const std::byte* data {}; // first element
+	std::size_t stride {}; // in bytes
+	std::size_t count {}; // number of elements
+	unsigned components {}; // per element
+	unsigned componentType {};
+	bool normalized {};
+};
+
+// Throws std::runtime_error if the accessor is sparse, has an invalid
+// type or if its data lies outside of its buffer view or buffer.
+AccessorData accessorData(const gltf::Model&, const gltf::Accessor&);
+
+// Decodes all elements of the given accessor into dst, which must have
+// space for 'data.count * dstComponents' values.
+// Like with AccessorIterator, missing components are filled with 0
+// and additional components are skipped. When decoding into floats,
+// normalized integer accessors are converted to [0, 1] or [-1, 1].
+// The component type and layout are only resolved once, the conversion
+// itself is a specialized (and vectorized where possible) loop or just a
+// memcpy. Prefer this over AccessorIterator when reading whole accessors.
+void decode(const AccessorData& data, float* dst, unsigned dstComponents);
+void decode(const AccessorData& data, std::uint32_t* dst, unsigned dstComponents);
+
+template<std::size_t N, typename T>
+void decode(const gltf::Model& model, const gltf::Accessor& accessor,
+		nytl::Span<AccessorValue<N, T>> dst) {
+	static_assert(sizeof(AccessorValue<N, T>) == N * sizeof(T));
+	auto data = accessorData(model, accessor);
+	dlg_assert(dst.size() == data.count);
+	decode(data, reinterpret_cast<T*>(dst.data()), N);
+}
+
+// Returns the decoded values of the given accessor, converted in the
+// same way as the values returned by range<N, T>.
+template<std::size_t N, typename T>
+std::vector<AccessorValue<N, T>> decode(const gltf::Model& model,
+		const gltf::Accessor& accessor) {
+	static_assert(sizeof(AccessorValue<N, T>) == N * sizeof(T));
+	auto data = accessorData(model, accessor);
+	std::vector<AccessorValue<N, T>> ret(data.count);
+	decode(data, reinterpret_cast<T*>(ret.data()), N);
+	return ret;
+}
+
 } // namespace tkn
 
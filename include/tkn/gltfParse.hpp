@@ -0,0 +1,32 @@
+#pragma once
+
+#include <tkn/gltf.hpp>
+#include <nytl/span.hpp>
+#include <nytl/stringParam.hpp>
+#include <memory>
+#include <string_view>
+
+// Streaming gltf loader. In comparison to tinygltf, this does not build
+// a json document first and then copy it into the model but parses the
+// json in a single pass directly into the gltf::Model.
+// External buffers and the binary chunk of glb files are not copied
+// into gltf::Buffer::data but memory mapped, see gltf::Buffer::mappedData
+// and tkn::bufferData.
+
+namespace tkn {
+
+// Parses the .gltf or binary .glb file at the given path.
+// Images are not loaded, only their uri or buffer view is stored.
+// Relative uris are resolved relative to the directory of the file.
+// Throws std::runtime_error when the file can't be read, is not valid json
+// or not a valid gltf model.
+gltf::Model parseGltf(nytl::StringParam path);
+
+// Parses a gltf model from memory. 'data' may either be gltf json or a
+// binary glb. The model will reference the given data (the binary chunk
+// of a glb), 'keepAlive' is stored in the model to keep it valid.
+// Relative uris are resolved relative to baseDir.
+gltf::Model parseGltf(nytl::Span<const std::byte> data,
+	std::string_view baseDir = {}, std::shared_ptr<const void> keepAlive = {});
+
+} // namespace tkn
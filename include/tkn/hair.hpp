@@ -0,0 +1,116 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+#include <array>
+
+namespace tkn {
+
+class ThreadPool;
+
+// How Hair keeps the segment lengths of the strands.
+enum class HairSolver {
+	// Dynamic follow the leader (Müller et al. 2012): after integrating,
+	// every node is moved towards its parent until the segment has its
+	// rest length, going from the root to the tip. Exactly inextensible
+	// in a single pass; the velocity correction (ftlDamping) hides the
+	// resulting artificial damping towards the root.
+	followTheLeader,
+	// Position based dynamics: Gauss-Seidel iterations over distance
+	// constraints of neighboring nodes (and, for bending, of nodes two
+	// segments apart). Slightly stretchy with few iterations.
+	pbd,
+};
+
+// See Hair.
+struct HairParams {
+	HairSolver solver {HairSolver::followTheLeader};
+	Vec3f gravity {0.f, -9.81f, 0.f};
+	float damping {0.5f}; // fraction of the velocity lost per second
+	float ftlDamping {0.9f}; // velocity correction, followTheLeader only
+	unsigned iterations {4u}; // constraint iterations per step, pbd only
+	float bendStiffness {0.2f}; // in [0, 1], pbd only
+
+	// Sphere the nodes are kept out of (e.g. a head). Disabled if the
+	// radius is 0.
+	Vec3f sphereCenter {0.f, 0.f, 0.f};
+	float sphereRadius {0.f};
+};
+
+// A strand of Hair, initially straight.
+struct HairStrand {
+	Vec3f root;
+	Vec3f direction; // normalized, from the root to the tip
+	float length;
+};
+
+// Simulates many hair strands with the same number of nodes each.
+// Node 0 of every strand (its root) is moved only via moveRoots,
+// the others are integrated with gravity and kept at the rest length
+// of the segments by the chosen solver.
+// Does not depend on rendering, the positions can be written to a
+// vertex buffer via writePositions.
+// Strands are processed in batches of batchSize strands that are
+// simulated together: the node state is stored per component, node
+// and batch with the strands of the batch next to each other, so
+// that all operations on a node are vectorized across the strands
+// (when SSE is available). The batches are distributed over a thread
+// pool. Strands don't interact, the result does not depend on the
+// number of threads or the other strands in a batch.
+class Hair {
+public:
+	using Params = HairParams;
+	static constexpr auto batchSize = 8u; // strands per batch
+
+	Params params;
+
+public:
+	Hair() = default;
+
+	// nodeCount must be at least 2.
+	Hair(nytl::Span<const HairStrand> strands, unsigned nodeCount,
+		const HairParams& = {});
+
+	// Advances the simulation by dt. Uses the given pool (or
+	// ThreadPool::instance() if nullptr), the calling thread takes part.
+	void step(float dt, ThreadPool* pool = nullptr);
+
+	// Sets the root positions of all strands, takes effect in the
+	// next step.
+	void moveRoots(nytl::Span<const Vec3f> roots);
+
+	// Writes the positions of all nodes into dst: strand after strand,
+	// from the root to the tip.
+	void writePositions(nytl::Span<Vec3f> dst) const;
+
+	Vec3f position(unsigned strand, unsigned node) const;
+	Vec3f velocity(unsigned strand, unsigned node) const;
+
+	unsigned strandCount() const { return strandCount_; }
+	unsigned nodeCount() const { return nodeCount_; }
+	float segmentLength(unsigned strand) const { return segLength_[strand]; }
+
+protected:
+	using Components = std::array<std::vector<float>, 3>;
+
+	// Index of the first float of the given node of a batch.
+	std::size_t id(unsigned batch, unsigned node) const {
+		return (std::size_t(batch) * nodeCount_ + node) * batchSize;
+	}
+
+	void stepBatch(unsigned batch, float dt);
+
+protected:
+	unsigned strandCount_ {};
+	unsigned nodeCount_ {};
+	unsigned batchCount_ {};
+
+	Components pos_;
+	Components vel_;
+	Components roots_; // per strand, padded to full batches
+	std::vector<float> segLength_; // per strand, padded to full batches
+};
+
+} // namespace tkn
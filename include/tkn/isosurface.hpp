@@ -0,0 +1,67 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <functional>
+#include <vector>
+
+namespace tkn {
+
+class ThreadPool;
+
+// Samples of a scalar field on a regular grid.
+struct SdfGrid {
+	Vec3ui size {}; // number of samples per dimension
+	Vec3f start {}; // position of sample (0, 0, 0)
+	Vec3f spacing {}; // distance between two samples
+	std::vector<float> values; // x varies fastest, then y, then z
+
+	std::size_t id(u32 x, u32 y, u32 z) const {
+		return (std::size_t(z) * size.y + y) * size.x + x;
+	}
+
+	float value(u32 x, u32 y, u32 z) const { return values[id(x, y, z)]; }
+	Vec3f position(u32 x, u32 y, u32 z) const {
+		return {
+			start.x + x * spacing.x,
+			start.y + y * spacing.y,
+			start.z + z * spacing.z,
+		};
+	}
+};
+
+// Evaluates the field for a row of samples: values[i] = f(xs[i], y, z).
+// Gets the samples of a grid row at once so it can be vectorized.
+using SdfRowFunc = std::function<void(nytl::Span<const float> xs,
+	float y, float z, nytl::Span<float> values)>;
+
+// Resizes the values of the grid to its size and evaluates the given
+// function for all samples. The rows are distributed over the given pool
+// (or ThreadPool::instance() if nullptr).
+void sample(SdfGrid& grid, const SdfRowFunc& func, ThreadPool* pool = nullptr);
+
+struct IsoMesh {
+	std::vector<Vec3f> positions;
+	std::vector<Vec3f> normals; // from the gradient of the grid
+	std::vector<u32> indices; // counter-clockwise triangles
+};
+
+// Extracts the surface where the field equals iso from the grid, values
+// smaller than iso are outside. Vertices are shared between all
+// triangles using them. The grid is split into slabs along z that
+// are extracted in parallel on the given pool (or ThreadPool::instance()
+// if nullptr) and merged afterwards; the result does not depend on the
+// number of threads.
+IsoMesh marchingCubes(const SdfGrid& grid, float iso, ThreadPool* pool = nullptr);
+
+// Like marchingCubes but creates one vertex per surface patch in a cell
+// (at the mean of the patch's edge intersections) and connects the
+// vertices of the four cells around every intersected grid edge with
+// a quad. Avoids the thin triangles of marching cubes, with about the
+// same number of vertices. The surface is open at the boundary of the
+// grid.
+IsoMesh dualMarchingCubes(const SdfGrid& grid, float iso,
+	ThreadPool* pool = nullptr);
+
+} // namespace tkn
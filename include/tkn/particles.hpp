@@ -0,0 +1,163 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+#include <array>
+#include <cmath>
+
+namespace tkn {
+
+class ThreadPool;
+
+// Uniform grid for finding the points near a position in 2D.
+// The grid is unbounded, the cells are hashed into a table with
+// (at least) as many buckets as there are points, distant cells
+// may share a bucket. Built with a counting
+// sort: the points of one bucket are stored contiguously, in the
+// order of the original points.
+class SpatialHash {
+public:
+	// Rebuilds the hash for the given points. Neighbors are searched
+	// in the 3x3 cells around a position, i.e. for finding all points
+	// within a radius, cellSize must be at least the radius.
+	void build(nytl::Span<const Vec2f> points, float cellSize);
+
+	// Calls func(u32 sortedID) for all points in the 3x3 cells around
+	// the given position. This is a superset of the points within
+	// cellSize of pos (due to hash collisions, there may also be points
+	// from far-away cells), the caller has to check the distance.
+	// Points of one bucket are visited in their original order.
+	template<typename F>
+	void forEachNear(Vec2f pos, F&& func) const;
+
+	// Returns the original index of the point with the given sortedID.
+	nytl::Span<const u32> order() const { return order_; }
+
+	// The points, sorted by bucket.
+	nytl::Span<const Vec2f> sortedPoints() const { return sorted_; }
+
+	float cellSize() const { return cellSize_; }
+	u32 bucketCount() const { return mask_ + 1; }
+	u32 bucket(Vec2f pos) const {
+		return bucket(int(std::floor(pos.x * invCellSize_)),
+			int(std::floor(pos.y * invCellSize_)));
+	}
+
+protected:
+	// Row major cell index, wrapped into the table. Neighboring cells
+	// (up to rowStride_ cells wide) map to neighboring buckets, keeping
+	// the iteration cache friendly.
+	u32 bucket(int x, int y) const {
+		return (u32(x) + u32(y) * rowStride_) & mask_;
+	}
+
+protected:
+	float cellSize_ {};
+	float invCellSize_ {};
+	u32 mask_ {};
+	u32 rowStride_ {};
+	std::vector<u32> bucketStart_; // bucketCount + 1 entries
+	std::vector<u32> order_;
+	std::vector<Vec2f> sorted_;
+	std::vector<u32> buckets_; // bucket of every point, only for building
+};
+
+template<typename F>
+void SpatialHash::forEachNear(Vec2f pos, F&& func) const {
+	if(sorted_.empty()) {
+		return;
+	}
+
+	auto cx = int(std::floor(pos.x * invCellSize_));
+	auto cy = int(std::floor(pos.y * invCellSize_));
+
+	// multiple cells may map to the same bucket, visit it only once
+	std::array<u32, 9> visited;
+	auto count = 0u;
+	for(auto y = cy - 1; y <= cy + 1; ++y) {
+		for(auto x = cx - 1; x <= cx + 1; ++x) {
+			auto b = bucket(x, y);
+			auto seen = false;
+			for(auto i = 0u; i < count; ++i) {
+				seen |= (visited[i] == b);
+			}
+
+			if(seen) {
+				continue;
+			}
+
+			visited[count++] = b;
+			for(auto s = bucketStart_[b]; s < bucketStart_[b + 1]; ++s) {
+				func(s);
+			}
+		}
+	}
+}
+
+struct AttractionParams {
+	float radius {0.1f};
+	// Acceleration towards a neighbor at distance 0, falls off linearly
+	// to zero at radius. Negative values repel.
+	float strength {1.f};
+};
+
+// Accelerates every point towards all other points within the radius.
+// Builds the given hash with cellSize = radius and distributes the
+// points over the given pool (or ThreadPool::instance() if nullptr).
+// Runs in O(N) for a bounded density, the result does not depend on
+// the number of threads. Coincident points don't influence each other.
+void applyAttraction(nytl::Span<const Vec2f> positions,
+	nytl::Span<Vec2f> velocities, float dt, const AttractionParams& params,
+	SpatialHash& hash, ThreadPool* pool = nullptr);
+
+// History of the last positions of a number of particles. Instead of
+// shifting all positions every time a new one is added, the slots are
+// used as ring: push only writes one position per particle.
+// The positions of a particle are stored contiguously, with one
+// additional slot at the end that mirrors slot 0. This way the history
+// of a particle can be drawn as two line strips without gap, see segments.
+class Trails {
+public:
+	Trails() = default;
+
+	// Initializes all slots with the given positions.
+	Trails(nytl::Span<const Vec2f> positions, unsigned length);
+
+	// Adds the given positions as newest entries, overwriting the oldest.
+	void push(nytl::Span<const Vec2f> positions);
+
+	// The position of the given particle, age steps ago.
+	Vec2f at(unsigned particle, unsigned age) const {
+		return data_[particle * (length_ + 1) + slot(age)];
+	}
+
+	// Slot of the entries with the given age, in [0, length).
+	unsigned slot(unsigned age) const { return (head_ + age) % length_; }
+
+	// Slot of the newest entries.
+	unsigned head() const { return head_; }
+	unsigned length() const { return length_; }
+	unsigned count() const { return count_; }
+
+	// The two slot ranges {first, count} that contain the history of
+	// a particle ordered from new to old. If the second range is not
+	// empty, the first one ends with the mirror slot, i.e. with the same
+	// position the second one starts with.
+	std::array<std::array<unsigned, 2>, 2> segments() const {
+		auto wraps = unsigned(head_ > 0);
+		return {{{head_, length_ - head_ + wraps}, {0u, head_}}};
+	}
+
+	// All count * (length + 1) positions, particle by particle.
+	nytl::Span<const Vec2f> data() const { return data_; }
+
+protected:
+	unsigned count_ {};
+	unsigned length_ {};
+	unsigned head_ {};
+	std::vector<Vec2f> data_;
+};
+
+} // namespace tkn
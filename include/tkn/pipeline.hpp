@@ -115,7 +115,10 @@ private:
 
 	std::vector<Stage> stages_;
 	std::vector<Watch> fileWatches_;
-	tkn::FileWatcher* fileWatcher_;
+	tkn::FileWatcher* fileWatcher_ {};
+	// FileWatcher::batchCount when the watches were last checked.
+	// Only when new batches were dispatched something might have changed.
+	std::uint64_t checkedBatch_ {};
 	std::future<CreateInfo> future_;
 
 	std::string name_;
@@ -235,12 +238,22 @@ protected:
 
 using SamplerProvider = tkn::Callable<const vk::Sampler*(unsigned set, unsigned binding) const>;
 
+// Creates the descriptor set layouts, descriptor sets and pipeline
+// layout for the given shader stages. The overloads taking SPIR-V
+// reflect it first, use ShaderCache::reflection to reuse reflections.
 PipeLayoutDescriptors inferComputeState(const vpp::Device& dev, nytl::Span<const u32> spv,
 	vpp::DescriptorAllocator* dsAlloc = nullptr,
 	const SamplerProvider* samplers = {});
+PipeLayoutDescriptors inferComputeState(const vpp::Device& dev,
+	const ShaderReflection& refl, vpp::DescriptorAllocator* dsAlloc = nullptr,
+	const SamplerProvider* samplers = {});
 PipeLayoutDescriptors inferGraphicsState(const vpp::Device& dev, nytl::Span<const u32> vert,
 	nytl::Span<const u32> frag, vpp::DescriptorAllocator* dsAlloc = nullptr,
 	const SamplerProvider* samplers = {});
+PipeLayoutDescriptors inferGraphicsState(const vpp::Device& dev,
+	const ShaderReflection& vert, const ShaderReflection& frag,
+	vpp::DescriptorAllocator* dsAlloc = nullptr,
+	const SamplerProvider* samplers = {});
 void nameHandle(const PipeLayoutDescriptors&, std::string_view name);
 
 void cmdBindGraphics(vk::CommandBuffer cb, const PipeLayoutDescriptors& state);
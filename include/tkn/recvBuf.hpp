@@ -1,16 +1,33 @@
 #pragma once
 
+#include <nytl/span.hpp>
 #include <cstddef>
+#include <cstring>
 #include <stdexcept>
+#include <algorithm>
+#include <type_traits>
 
-namespace kyo {
+namespace tkn {
+
+// A single contiguous chunk of received (non-owned) data.
+using RecvChunk = nytl::Span<const std::byte>;
 
 // Represents an iterator over the raw non-owned data of a received message buffer.
-// - current: The current position in the buffer.
-// - end: The end of the buffer, points after the last valid byte
+// The data may be scattered over multiple chunks (e.g. the payloads of
+// the fragments of a fragmented package) so that it never has to be
+// reassembled into one contiguous buffer.
+// - current: The current position in the current chunk.
+// - end: The end of the current chunk, points after its last valid byte.
+// - next: The chunk following the current one. Only valid if
+//   there is data left after the current chunk.
+// - left: Total number of bytes left in the buffer, including
+//   the range [current, end).
+// Use the functions below to access it, they keep the members in sync.
 struct RecvBuf {
-	const std::byte* current;
-	const std::byte* end;
+	const std::byte* current {};
+	const std::byte* end {};
+	const RecvChunk* next {};
+	std::size_t left {};
 };
 
 // This exception should be thrown if a processed message buffer is invalid in
@@ -27,19 +44,134 @@ struct OutOfRangeRecvBuf : public InvalidRecvBuf {
 	using InvalidRecvBuf::InvalidRecvBuf;
 };
 
-// Interprets the data of the message buffer at the current position at the
+// Creates a RecvBuf for a single contiguous chunk.
+inline RecvBuf recvBuf(RecvChunk data) {
+	return {data.data(), data.data() + data.size(), nullptr, data.size()};
+}
+
+// Creates a RecvBuf for a list of chunks. The given span of chunks
+// must stay valid as long as the returned buffer is used.
+inline RecvBuf recvBuf(nytl::Span<const RecvChunk> chunks) {
+	if(chunks.empty()) {
+		return {};
+	}
+
+	std::size_t size = 0u;
+	for(auto& chunk : chunks) {
+		size += chunk.size();
+	}
+
+	auto& first = chunks[0];
+	return {first.data(), first.data() + first.size(), chunks.data() + 1, size};
+}
+
+// Returns the number of bytes left in the given buffer.
+inline std::size_t size(const RecvBuf& buf) {
+	return buf.left;
+}
+
+inline bool empty(const RecvBuf& buf) {
+	return buf.left == 0u;
+}
+
+namespace detail {
+
+// Makes sure that buf.current points to readable data if there is
+// data left, i.e. moves to the next chunk if the current one is exhausted.
+inline void nextChunk(RecvBuf& buf) {
+	while(buf.current == buf.end && buf.left > 0) {
+		auto& chunk = *buf.next;
+		auto size = std::min<std::size_t>(chunk.size(), buf.left);
+		buf.current = chunk.data();
+		buf.end = chunk.data() + size;
+		++buf.next;
+	}
+}
+
+inline void checkRange(const RecvBuf& buf, std::size_t size) {
+	if(size > buf.left) {
+		throw OutOfRangeRecvBuf{"read(RecvBuf): would exceed size"};
+	}
+}
+
+} // namespace detail
+
+// Advances the buffer by the given number of bytes.
+// Throws an exception if there is not enough data left.
+inline void skip(RecvBuf& buf, std::size_t size) {
+	detail::checkRange(buf, size);
+	while(size > 0) {
+		detail::nextChunk(buf);
+		auto count = std::min<std::size_t>(size, buf.end - buf.current);
+		buf.current += count;
+		buf.left -= count;
+		size -= count;
+	}
+}
+
+// Copies the given number of bytes from the buffer into dst and
+// advances the buffer. Throws an exception if there is not enough data left.
+inline void read(RecvBuf& buf, std::byte* dst, std::size_t size) {
+	detail::checkRange(buf, size);
+	while(size > 0) {
+		detail::nextChunk(buf);
+		auto count = std::min<std::size_t>(size, buf.end - buf.current);
+		std::memcpy(dst, buf.current, count);
+		buf.current += count;
+		buf.left -= count;
+		dst += count;
+		size -= count;
+	}
+}
+
+// Returns the next contiguous chunk of the buffer with at most
+// maxSize bytes without copying anything and advances the buffer
+// behind it. Returns an empty span if there is no data left.
+// Can be used to e.g. consume a large message that spans multiple
+// fragments chunk by chunk.
+inline RecvChunk readChunk(RecvBuf& buf, std::size_t maxSize = std::size_t(-1)) {
+	detail::nextChunk(buf);
+	auto count = std::min<std::size_t>(maxSize, buf.end - buf.current);
+	auto ret = RecvChunk{buf.current, count};
+	buf.current += count;
+	buf.left -= count;
+	return ret;
+}
+
+// Returns a buffer for the next size bytes of the given buffer and
+// advances the given buffer behind them.
+// Throws an exception if there is not enough data left.
+inline RecvBuf sub(RecvBuf& buf, std::size_t size) {
+	detail::checkRange(buf, size);
+	detail::nextChunk(buf);
+	auto ret = buf;
+	ret.left = size;
+	ret.end = ret.current + std::min<std::size_t>(size, buf.end - buf.current);
+	skip(buf, size);
+	return ret;
+}
+
+// Reads the data of the message buffer at the current position as the
 // given type. Automatically advances the current pointer after this call.
 // Throws an exception if there is not enough data left in the msg buffer.
-// The buffer at current will simply be reinterpret_casted to const T&.
+// The value is copied, i.e. the data in the buffer does not have to
+// be aligned for T and may span multiple chunks.
 template<typename T>
-const auto& read(RecvBuf& buf) {
-	if(buf.current + sizeof(T) > buf.end) {
-		throw OutOfRangeRecvBuf{"next(RecvBuf): would exceed size"};
+T read(RecvBuf& buf) {
+	static_assert(std::is_trivially_copyable_v<T>);
+	detail::checkRange(buf, sizeof(T));
+	detail::nextChunk(buf);
+
+	T ret;
+	if(std::size_t(buf.end - buf.current) >= sizeof(T)) {
+		std::memcpy(&ret, buf.current, sizeof(T));
+		buf.current += sizeof(T);
+		buf.left -= sizeof(T);
+	} else {
+		read(buf, reinterpret_cast<std::byte*>(&ret), sizeof(T));
 	}
 
-	auto pos = buf.current;
-	buf.current += sizeof(T);
-	return reinterpret_cast<const T&>(*pos);
+	return ret;
 }
 
-} // namespace kyo
+} // namespace tkn
@@ -189,7 +189,9 @@ public:
 	 * into the ring buffer.
 	 */
 	unsigned enqueue(T * elements, unsigned count) {
-		int rd_idx = read_index_.load(std::memory_order::memory_order_relaxed);
+		// acquire: the consumer must be done moving out of the slots
+		// we are about to overwrite. Relevant for non-trivial T.
+		int rd_idx = read_index_.load(std::memory_order::memory_order_acquire);
 		int wr_idx = write_index_.load(std::memory_order::memory_order_relaxed);
 
 		if (full_internal(rd_idx, wr_idx)) {
@@ -259,7 +261,7 @@ public:
 			Move(elements + first_part, data_.get(), second_part);
 		}
 
-		read_index_.store(increment_index(rd_idx, to_read), std::memory_order::memory_order_relaxed);
+		read_index_.store(increment_index(rd_idx, to_read), std::memory_order::memory_order_release);
 
 		return to_read;
 	}
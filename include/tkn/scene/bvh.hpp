@@ -0,0 +1,98 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <tkn/transform.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/mat.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+#include <array>
+
+namespace tkn {
+
+class ThreadPool;
+
+struct Aabb {
+	Vec3f min;
+	Vec3f max;
+};
+
+// Returns the bounds of the given box transformed by the given affine
+// matrix (i.e. the last row must be (0, 0, 0, 1)).
+Aabb transform(const Aabb&, const nytl::Mat4f&);
+
+// Planes of a frustum. The xyz components are the (normalized) normal,
+// pointing inside, and w the offset, i.e. a point p is on the inner side
+// of the plane if dot(xyz, p) + w >= 0.
+using FrustumPlanes = std::array<nytl::Vec4f, 6>;
+
+// Computes the planes of the given frustum, e.g. ndcFrustum() transformed
+// into world space with the inverse view projection matrix.
+FrustumPlanes frustumPlanes(const Frustum&);
+
+// Computes the world space frustum planes for the given view projection
+// matrix (as used by the renderers, depth in [0, 1]).
+FrustumPlanes frustumPlanes(const nytl::Mat4f& viewProj);
+
+// Bounding volume hierarchy over axis-aligned boxes, e.g. the world
+// space bounds of scene instances. Items are identified by their
+// index in the bounds span given to build.
+// Built with the surface area heuristic, using binning. Large nodes are
+// binned in parallel and the subtrees below them built in parallel.
+class Bvh {
+public:
+	// Inner nodes (count == 0) have their two children at 'first'
+	// and 'first + 1', leaves reference 'count' items starting at
+	// 'first' in items(). Children always have a higher index
+	// than their parent.
+	struct Node {
+		Vec3f min;
+		u32 first;
+		Vec3f max;
+		u32 count;
+	};
+
+	struct RayHit {
+		u32 item;
+		float t; // where the ray enters the bounds of the item
+	};
+
+	static constexpr auto maxLeafSize = 4u;
+	static constexpr auto binCount = 16u;
+
+public:
+	// Builds the hierarchy from scratch. Uses ThreadPool::instance()
+	// if no pool is given.
+	void build(nytl::Span<const Aabb> bounds, ThreadPool* = nullptr);
+
+	// Updates the bounds of all nodes without changing the hierarchy,
+	// cheaper than a rebuild when items just moved a bit. Must be called
+	// with the same number of items as the last build.
+	void refit(nytl::Span<const Aabb> bounds);
+
+	// Appends the ids of all items whose bounds intersect the
+	// given frustum to 'visible', in no particular order.
+	// Conservative, i.e. may return items slightly outside.
+	void cull(const FrustumPlanes&, std::vector<u32>& visible) const;
+
+	// Appends all items whose bounds are hit by the given ray before
+	// 'maxT' to 'hits' and sorts them by distance. The caller can test
+	// them in order until a hit is closer than the next entry.
+	void raycast(Vec3f origin, Vec3f dir, float maxT,
+		std::vector<RayHit>& hits) const;
+
+	// Expected cost of a ray query according to the surface area
+	// heuristic, relative to testing a single box.
+	float sahCost() const;
+
+	const auto& nodes() const { return nodes_; }
+	const auto& items() const { return items_; }
+	bool empty() const { return nodes_.empty(); }
+
+protected:
+	std::vector<Node> nodes_;
+	std::vector<u32> items_;
+	std::vector<Aabb> bounds_; // of the items, for the leaf tests
+};
+
+} // namespace tkn
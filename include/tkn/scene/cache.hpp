@@ -0,0 +1,58 @@
+#pragma once
+
+#include <tkn/scene/scene.hpp>
+#include <tkn/types.hpp>
+#include <nytl/stringParam.hpp>
+#include <nytl/span.hpp>
+#include <optional>
+#include <string>
+#include <vector>
+
+// On-disk cache for processed gltf scenes.
+// A cache file stores everything in a SceneData, i.e. the processed
+// primitives (decoded attributes, generated normals, bounds), materials,
+// samplers, instances and the decoded image data. The file is memory
+// mapped when loaded: primitive arrays are copied out of it, images
+// are uploaded directly from the mapping. So loading a cached scene
+// doesn't have to parse any json or decode any buffer or image.
+// Since the cache is only written once, the meshes are also optimized
+// for rendering (see tkn/scene/meshOpt.hpp), split into meshlets
+// (tkn/scene/meshlet.hpp) and simplified into levels of detail
+// (tkn/scene/simplify.hpp) before writing it.
+//
+// A cache stores the paths, sizes, modification times and content
+// hashes of all files it was created from (the gltf file, its buffers
+// and images) and is only used when all of them still match. Sources
+// are only hashed again when their modification time changed. The file format is versioned and
+// machine-specific (native endianess and struct layouts).
+
+namespace tkn {
+
+// TODO: replace this with some platform-specific cache dir,
+// see ShaderCache::cacheDir.
+constexpr auto sceneCacheDir = "scenecache/";
+constexpr auto sceneCacheVersion = 6u;
+
+// Loads the processed default scene of the gltf model at the given
+// path (resolved as by loadGltf). Uses the cache in 'cacheDir' if it
+// exists and is up-to-date, otherwise loads and processes the model
+// and writes the cache (decoding all images for it).
+// An empty cacheDir disables the cache. Returns std::nullopt if the
+// model can't be loaded.
+std::optional<SceneData> loadSceneCached(nytl::StringParam path,
+	nytl::StringParam cacheDir = sceneCacheDir);
+
+// Reads the given cache file. Returns std::nullopt if it doesn't exist,
+// is invalid, has another version or if any of its sources changed.
+std::optional<SceneData> readSceneCache(nytl::StringParam file);
+
+// Writes the given scene data into a cache file. All images must
+// have their data set. 'sources' must contain all files the data
+// depends on. Returns false on failure.
+bool writeSceneCache(nytl::StringParam file, const SceneData&,
+	nytl::Span<const std::string> sources);
+
+// Fast, non-cryptographic 64-bit content hash.
+u64 contentHash(nytl::Span<const std::byte> data, u64 seed = 0u);
+
+} // namespace tkn
@@ -130,8 +130,10 @@ protected:
 };
 
 // Inits the shadow map renderer for a standard tkn::Scene geometry pipeline.
+// 'compactVertices' must match Scene::compactVertices.
 void initShadowData(ShadowData&, const vpp::Device&, vk::Format depthFormat,
-	vk::DescriptorSetLayout sceneDsLayout, bool multiview, bool depthClamp);
+	vk::DescriptorSetLayout sceneDsLayout, bool multiview, bool depthClamp,
+	bool compactVertices = false);
 
 // More detailed shadowmap api that allows using custom shaders, mainly
 // for custom geometry inputs. Otherwise they must behave as the
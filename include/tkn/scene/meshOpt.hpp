@@ -0,0 +1,113 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <tkn/scene/scene.hpp>
+#include <tkn/scene/shape.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <dlg/dlg.hpp>
+#include <vector>
+#include <cstddef>
+
+// Mesh processing for indexed triangle lists, meant to be run once at
+// load time or when baking the scene cache:
+// - vertex deduplication (generateVertexRemap)
+// - post-transform vertex cache optimization, using the algorithm from
+//   Tom Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006)
+// - overdraw aware ordering of triangle clusters (optimizeOverdraw),
+//   a simplified version of Sander, Nehab, Barczak, "Fast Triangle
+//   Reordering for Vertex Locality and Reduced Overdraw" (2007)
+// - vertex fetch reordering (optimizeVertexFetch)
+// optimizeMesh runs all of them in this order.
+
+namespace tkn {
+
+// Remap value of vertices that aren't referenced by any index.
+constexpr auto unusedVertex = u32(0xFFFFFFFFu);
+
+// Statistics of a simulated FIFO post-transform vertex cache.
+struct VertexCacheStats {
+	unsigned misses {};
+	float acmr {}; // average cache miss ratio, misses per triangle. [0.5, 3]
+	float atvr {}; // average transformed vertex ratio, misses per vertex. >= 1
+};
+
+VertexCacheStats analyzeVertexCache(nytl::Span<const u32> indices,
+	unsigned vertexCount, unsigned cacheSize = 16u);
+
+// One vertex attribute array, as raw memory.
+struct VertexStream {
+	const std::byte* data;
+	std::size_t size; // size of one element in bytes
+	std::size_t stride; // offset between elements in bytes
+
+	VertexStream() = default;
+	VertexStream(const std::byte* d, std::size_t s, std::size_t str) :
+		data(d), size(s), stride(str) {}
+
+	template<typename T>
+	VertexStream(const std::vector<T>& vec) :
+		data(reinterpret_cast<const std::byte*>(vec.data())),
+		size(sizeof(T)), stride(sizeof(T)) {}
+};
+
+// Generates a remap table that maps all vertices with identical data
+// in all streams to the same new vertex. New vertex ids are assigned in
+// order of first use in the index buffer, unreferenced vertices are
+// mapped to 'unusedVertex'. The size of 'remap' is the vertex count,
+// all streams must have at least that many elements.
+// Returns the number of unique vertices.
+u32 generateVertexRemap(nytl::Span<u32> remap, nytl::Span<const u32> indices,
+	nytl::Span<const VertexStream> streams);
+
+// Applies a remap table to indices (in place).
+void remapIndices(nytl::Span<u32> indices, nytl::Span<const u32> remap);
+
+// Applies a remap table to a vertex attribute array.
+template<typename T>
+void remapVertices(std::vector<T>& vertices, nytl::Span<const u32> remap,
+		u32 newCount) {
+	dlg_assert(vertices.size() == remap.size());
+	std::vector<T> ret(newCount);
+	for(auto i = 0u; i < vertices.size(); ++i) {
+		if(remap[i] != unusedVertex) {
+			dlg_assert(remap[i] < newCount);
+			ret[remap[i]] = std::move(vertices[i]);
+		}
+	}
+
+	vertices = std::move(ret);
+}
+
+// Reorders the triangles to improve post-transform vertex cache hits.
+// Works for all cache sizes and replacement policies.
+// 'dst' and 'indices' may be the same span.
+void optimizeVertexCache(nytl::Span<u32> dst, nytl::Span<const u32> indices,
+	unsigned vertexCount);
+
+// Expects an index buffer already optimized for the vertex cache.
+// Splits it into clusters at points where the simulated cache would
+// be flushed anyways (so the cache efficiency stays the same) and sorts
+// the clusters so that the ones facing outwards are drawn first.
+void optimizeOverdraw(nytl::Span<u32> indices,
+	nytl::Span<const Vec3f> positions, unsigned cacheSize = 16u);
+
+// Generates a remap table assigning vertex ids in order of first use
+// in the index buffer, improving memory locality of vertex fetches.
+// Returns the number of used vertices.
+u32 optimizeVertexFetch(nytl::Span<u32> remap, nytl::Span<const u32> indices);
+
+struct MeshOptStats {
+	unsigned verticesBefore {};
+	unsigned verticesAfter {};
+	VertexCacheStats before {};
+	VertexCacheStats after {};
+};
+
+// Runs the full optimization pipeline on the given mesh. The triangles
+// and the vertex attributes are reordered, duplicate and unused vertices
+// removed. The rendered result stays the same (except overdraw order).
+MeshOptStats optimizeMesh(Scene::Primitive&, bool overdraw = true);
+MeshOptStats optimizeMesh(Shape&, bool overdraw = true);
+
+} // namespace tkn
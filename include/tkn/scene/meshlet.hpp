@@ -0,0 +1,58 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+
+namespace tkn {
+
+// Limits chosen to fit the common mesh shader output limits
+// (e.g. nvidia recommends 64 vertices and 126 primitives). 124
+// keeps the triangle array of a meshlet a multiple of 4 bytes.
+constexpr auto maxMeshletVertices = 64u;
+constexpr auto maxMeshletTriangles = 124u;
+
+// Small cluster of triangles of a primitive, allows culling on a finer
+// level than whole primitives. All bounds are in model space.
+struct Meshlet {
+	u32 vertexOffset; // first entry in MeshletData::vertices
+	u32 triangleOffset; // first entry in MeshletData::triangles
+	u32 vertexCount;
+	u32 triangleCount;
+
+	// bounding sphere
+	Vec3f center;
+	float radius;
+
+	// Normal cone, see backfacing.
+	// The cutoff is 1 if the meshlet can never be backface culled.
+	Vec3f coneAxis;
+	float coneCutoff;
+};
+
+struct MeshletData {
+	std::vector<Meshlet> meshlets;
+	std::vector<u32> vertices; // meshlet vertex -> primitive vertex
+	std::vector<u8> triangles; // 3 meshlet vertex ids per triangle
+};
+
+// Splits the given triangles into meshlets. The triangles are
+// processed in order, so the indices should already be optimized
+// for vertex locality (see optimizeVertexCache in meshOpt.hpp).
+// Deterministic, the triangle order is preserved.
+MeshletData buildMeshlets(nytl::Span<const u32> indices,
+	nytl::Span<const Vec3f> positions);
+
+// Computes bounding sphere and normal cone for the given meshlet.
+// Called by buildMeshlets.
+void computeBounds(Meshlet&, const MeshletData&,
+	nytl::Span<const Vec3f> positions);
+
+// Returns whether all (counter-clockwise) triangles of the meshlet are
+// backfacing when viewed from the given position (in model space).
+// Conservative: may return false when they are but never returns
+// true when any triangle is frontfacing.
+bool backfacing(const Meshlet&, Vec3f viewPos);
+
+} // namespace tkn
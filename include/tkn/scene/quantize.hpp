@@ -0,0 +1,75 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <tkn/scene/scene.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/mat.hpp>
+#include <nytl/span.hpp>
+
+// Compact vertex format for Scene, 20 instead of 40 bytes per vertex
+// (with two texture coordinate sets):
+// - positions as unorm16 in the bounds of their primitive. The
+//   dequantization (scale and offset) is done by the model matrix,
+//   see dequantizeMatrix.
+// - normals octahedral encoded as 2x snorm16, see decodeNormal in
+//   scene.glsl (it's the same encoding as used for the gbuffer).
+// - texture coordinates as half floats.
+// The formats match the vertex input formats returned by
+// Scene::vertexInfo(true).
+
+namespace tkn {
+
+struct CompactPosition {
+	u16 x, y, z;
+	u16 pad; // for alignment, always zero
+};
+
+struct CompactNormal {
+	i16 x, y;
+};
+
+struct CompactTexCoord {
+	u16 u, v; // f16 bits
+};
+
+// Quantizes the given positions into the bounds [min, max].
+// 'dst' must have the same size as 'src'.
+void quantizePositions(nytl::Span<const Vec3f> src, Vec3f min, Vec3f max,
+	nytl::Span<CompactPosition> dst);
+
+// Expects the normals to be normalized.
+void encodeNormals(nytl::Span<const Vec3f> src, nytl::Span<CompactNormal> dst);
+void encodeTexCoords(nytl::Span<const Vec2f> src,
+	nytl::Span<CompactTexCoord> dst);
+
+// Single value variants, matching the batch versions above exactly.
+CompactNormal encodeNormal(Vec3f);
+u16 quantizeHalf(float); // rounds to nearest
+
+Vec3f dequantize(CompactPosition, Vec3f min, Vec3f max);
+Vec3f decode(CompactNormal);
+Vec2f decode(CompactTexCoord);
+
+// Returns the matrix mapping the normalized quantized positions
+// ([0, 1]^3, as read by the vertex input) into [min, max].
+nytl::Mat4f dequantizeMatrix(Vec3f min, Vec3f max);
+
+struct QuantizationStats {
+	u64 vertices {};
+	u64 floatBytes {}; // vertex data size with the float format
+	u64 compactBytes {}; // vertex data size with the compact format
+
+	// Maximum errors, over all vertices.
+	float positionError {}; // model space distance
+	float relPositionError {}; // relative to the primitive extent
+	float normalError {}; // angle, in degrees
+	float texCoordError {}; // absolute
+
+	QuantizationStats& operator+=(const QuantizationStats&);
+};
+
+// Quantizes the primitives vertex data and computes the errors
+// by decoding it again.
+QuantizationStats quantizationStats(const Scene::Primitive&);
+
+} // namespace tkn
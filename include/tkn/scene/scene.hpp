@@ -1,6 +1,9 @@
 #pragma once
 
 #include <tkn/scene/material.hpp>
+#include <tkn/scene/bvh.hpp>
+#include <tkn/scene/meshlet.hpp>
+#include <tkn/scene/simplify.hpp>
 #include <tkn/texture.hpp>
 #include <tkn/defer.hpp>
 #include <tkn/bits.hpp>
@@ -13,6 +16,9 @@
 #include <vpp/sharedBuffer.hpp>
 #include <tinygltf.hpp>
 #include <vector>
+#include <memory>
+#include <string>
+#include <optional>
 
 // TODO: fix updateDs returning in upload
 // TODO: use descriptor indexing when possible.
@@ -26,8 +32,9 @@
 //   use the updateDevice() version.
 // PERF: sorting primitives by how they are layed out in the vertex
 //   buffers (when there are no other creteria)? could improve cache locality
-// PERF: support basic AABB culling, always use indirect commands
-//   could do it on the gpu, even more efficiently with khr_draw_indirect_count
+// PERF: culling (see Scene::culling) is done on the cpu and culled
+//   instances are only skipped via instanceCount = 0. Could do it
+//   on the gpu, even more efficiently with khr_draw_indirect_count
 
 namespace tkn {
 namespace gltf = tinygltf;
@@ -39,6 +46,11 @@ struct SceneRenderInfo {
 	// whether the respective vulkan features are enabled
 	bool drawIndirectFirstInstance {};
 	bool multiDrawIndirect {};
+
+	// Whether to store the vertex data in the compact format,
+	// see tkn/scene/quantize.hpp. The pipelines rendering the scene
+	// must use vertexInfo(true) and decode the normals.
+	bool compactVertices {};
 };
 
 struct SceneImage {
@@ -66,10 +78,15 @@ struct Sampler {
 	SamplerInfo info;
 
 	Sampler() = default;
-	Sampler(const vpp::Device&, const gltf::Sampler&,
+	Sampler(const vpp::Device&, const SamplerInfo&,
 		float maxAnisotropy, float mipLodBias);
+	Sampler(const vpp::Device& dev, const gltf::Sampler& sampler,
+			float maxAnisotropy, float mipLodBias) :
+		Sampler(dev, SamplerInfo(sampler), maxAnisotropy, mipLodBias) {}
 };
 
+struct SceneData;
+
 /// Manages all geometry and material buffers as well as the instances
 /// that use them.
 class Scene {
@@ -102,6 +119,10 @@ public:
 		// tmp accum
 		unsigned tc0Count {};
 		unsigned tc1Count {};
+
+		// Keeps the source of image data alive until init,
+		// e.g. a mapped scene cache. See SceneData::source.
+		std::shared_ptr<const void> source;
 	};
 
 	/// Raw geometry data for a primitive.
@@ -120,6 +141,11 @@ public:
 		std::vector<nytl::Vec3f> normals;
 		std::vector<nytl::Vec2f> texCoords0;
 		std::vector<nytl::Vec2f> texCoords1;
+
+		// Optional, only generated when baking the scene cache.
+		// See tkn/scene/meshlet.hpp and tkn/scene/simplify.hpp.
+		MeshletData meshlets;
+		LodData lods;
 	};
 
 	/// Connects a Primitive to a Material and defined its transform.
@@ -132,10 +158,22 @@ public:
 		u32 modelID; // just for picking, not related to Primitive
 	};
 
-	static const vk::PipelineVertexInputStateCreateInfo& vertexInfo();
+	// The vertex input state for the vertex buffers bound in render.
+	// With 'compact', the normals have to be decoded via decodeNormal
+	// (scene.glsl), the position dequantization is part of the model matrix.
+	static const vk::PipelineVertexInputStateCreateInfo& vertexInfo(
+		bool compact = false);
 
 public:
 	Scene() = default;
+
+	// Creates the scene from the given processed data. All instances
+	// will be transformed by the given matrix.
+	void create(InitData&, WorkBatcher&, SceneData&&, nytl::Mat4f matrix,
+		const SceneRenderInfo&, float samplerLodBias = 0.f);
+
+	// Processes the given gltf scene (see loadSceneData) and creates
+	// the scene from it.
 	void create(InitData&, WorkBatcher&, nytl::StringParam path,
 		const gltf::Model&, const gltf::Scene&, nytl::Mat4f matrix,
 		const SceneRenderInfo&, float samplerLodBias = 0.f);
@@ -150,6 +188,7 @@ public:
 	// optionally returns semaphore that should be waited upon before
 	// doing any rendering involding the scene. In that case a
 	// re-record is needed additionally.
+	// 'proj' is the world space view projection matrix of the camera.
 	vk::Semaphore updateDevice(nytl::Mat4f proj);
 	void render(vk::CommandBuffer, vk::PipelineLayout, bool blend) const;
 
@@ -178,22 +217,39 @@ public:
 
 	void updatedInstance(u32 ini) { updateInis_.push_back(ini); }
 
+	// When enabled, instances outside the view frustum passed to
+	// updateDevice are not drawn. Must only be enabled when the scene
+	// is only rendered from that view (e.g. not for shadow maps).
+	void culling(bool enable) { cull_ = enable; }
+	bool culling() const { return cull_; }
+
+	// Hierarchy over the world space bounds of all instances, item ids
+	// are instance ids. Kept up-to-date by init and updateDevice.
+	const Bvh& bvh() const { return bvh_; }
+	Aabb bounds(const Instance&) const; // world space
+
+	// Returns the id of the first instance hit by the given world space
+	// ray and the ray parameter of the hit. Only considers instances
+	// contained in bvh(). Tests the triangles on the cpu.
+	std::optional<std::pair<u32, float>> pick(nytl::Vec3f origin,
+		nytl::Vec3f dir) const;
+
+	bool compactVertices() const { return compact_; }
+
 	nytl::Vec3f min() const { return min_; }
 	nytl::Vec3f max() const { return max_; }
 	const vpp::Device& device() const { return defaultSampler_.device(); }
 
 protected:
-	void loadNode(InitData&, WorkBatcher&, const gltf::Model&,
-		const gltf::Node&, const SceneRenderInfo&, nytl::Mat4f matrix);
-	void loadMaterial(InitData&, WorkBatcher&, const gltf::Model&,
-		const gltf::Material&, const SceneRenderInfo&);
-	void loadPrimitive(InitData&, WorkBatcher&, const gltf::Model&,
-		const gltf::Primitive&, nytl::Mat4f matrix);
 	void writeInstance(const Instance& ini, nytl::Span<std::byte>& ids,
-		nytl::Span<std::byte>& cmds);
+		nytl::Span<std::byte>& cmds, bool visible = true);
+	void writeModel(nytl::Span<std::byte>& models, const Instance& ini) const;
 	vk::Semaphore upload();
+	void updateBvh(bool rebuild);
+	void cull(const nytl::Mat4f& viewProj);
 
 	bool multiDrawIndirect_ {};
+	bool compact_ {}; // whether vertices use the compact format
 	vpp::Sampler defaultSampler_;
 	std::vector<Sampler> samplers_;
 	std::vector<SceneImage> images_;
@@ -214,6 +270,12 @@ protected:
 	nytl::Vec3f min_;
 	nytl::Vec3f max_;
 
+	Bvh bvh_;
+	std::vector<Aabb> instanceBounds_;
+	std::vector<u8> visible_; // per instance, only valid when cull_
+	bool cull_ {};
+	bool culled_ {}; // whether commands were written with culling
+
 	vpp::TrDsLayout dsLayout_;
 	vpp::TrDs ds_;
 	vpp::TrDs blendDs_;
@@ -252,6 +314,45 @@ protected:
 	} upload_;
 };
 
+// Fully processed, cpu-side description of a scene, i.e. everything
+// Scene::create needs. Created from a gltf scene (see loadSceneData) or
+// loaded from a scene cache (see tkn/scene/cache.hpp).
+struct SceneData {
+	struct Image {
+		// The file to load the image from when 'data' is empty.
+		std::string path;
+		bool srgb {};
+		bool needed {};
+
+		// Already decoded image data (first layer and level).
+		// Either references 'owned' or data kept alive by SceneData::source.
+		nytl::Vec3ui size {};
+		vk::Format format {};
+		nytl::Span<const std::byte> data;
+		std::unique_ptr<std::byte[]> owned;
+	};
+
+	std::vector<SamplerInfo> samplers;
+	std::vector<Material> materials; // last one is the default material
+	std::vector<Image> images;
+	std::vector<Scene::Primitive> primitives;
+	std::vector<Scene::Instance> instances; // relative to the scene root
+
+	// Keeps the data referenced by the images alive.
+	std::shared_ptr<const void> source;
+};
+
+// Processes all materials, primitives and nodes of the given gltf scene.
+// Images are not loaded, only their paths resolved relative to the given
+// base path. Primitives that can't be loaded are omitted.
+SceneData loadSceneData(const gltf::Model&, const gltf::Scene&,
+	nytl::StringParam path);
+
+// Resolves the given string as path or filename of a gltf/gltb file
+// (or a directory containing a scene.gltf/gltb file). Returns the base
+// path and the file name.
+std::optional<std::pair<std::string, std::string>> resolveGltf(nytl::StringParam);
+
 // Tries to parse the given string as path or filename of a gltf/gltb file
 // and parse it. On success, also returns the base path as second parameter
 std::tuple<std::optional<gltf::Model>, std::string> loadGltf(nytl::StringParam);
@@ -7,6 +7,8 @@
 
 namespace tkn {
 
+class ThreadPool;
+
 struct Cube {
 	Vec3f pos {0.f, 0.f, 0.f}; // center
 	Vec3f size {1.f, 1.f, 1.f}; // total size
@@ -32,9 +34,23 @@ Shape generateQuad(nytl::Vec3f center, nytl::Vec3f x, nytl::Vec3f y);
 // TODO: allows position and radius as well
 Shape generateIco(unsigned subdiv);
 
-// generate smooth normals weighted by triangle area
+// Generates smooth normals weighted by triangle area.
+// Works in parallel on the given pool (ThreadPool::instance() by default),
+// the result does not depend on the number of threads.
 std::vector<Vec3f> areaSmoothNormals(nytl::Span<const Vec3f> positions,
-	nytl::Span<const u32> indices);
+	nytl::Span<const u32> indices, ThreadPool* = nullptr);
+
+// Generates per-vertex tangents for normal mapping like MikkTSpace:
+// the per-triangle texture space directions are projected into the
+// tangent plane of the vertex normal and weighted by the triangle angle
+// at the vertex. w is the handedness, i.e. the bitangent is
+// w * cross(normal, tangent.xyz) (as expected by glTF).
+// Other than MikkTSpace, vertices are not split. Meshes usually already
+// have separate vertices on uv seams and mirrored uv islands.
+// Parallel, like areaSmoothNormals.
+std::vector<Vec4f> generateTangents(nytl::Span<const Vec3f> positions,
+	nytl::Span<const Vec3f> normals, nytl::Span<const Vec2f> texCoords,
+	nytl::Span<const u32> indices, ThreadPool* = nullptr);
 
 // TODO: add (dual-)cube marching. See tkn/volume
 
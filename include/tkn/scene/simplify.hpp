@@ -0,0 +1,106 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+
+// Mesh simplification via quadric error metrics (Garland, Heckbert:
+// "Surface Simplification Using Quadric Error Metrics", 1997).
+// Uses half-edge collapses, i.e. vertices are only ever removed and
+// never moved or created. All levels of detail can therefore share
+// the vertex data of the original mesh, only the indices differ.
+//
+// - Vertices on uv seams or normal creases (two vertices with the same
+//   position) are only collapsed along the seam, together with the
+//   vertex on the other side, so seams stay intact.
+// - Vertices shared by more than two vertices (e.g. flat shading, where
+//   every triangle has its own vertices) are never removed, see
+//   SimplifyResult::lockedVertices. Weld such meshes first.
+// - Vertices on open borders are only collapsed along the border.
+// - The cost of a collapse is the area weighted mean squared distance
+//   to the planes of the original triangles around the removed vertex.
+//   Collapses are ordered by this cost plus the attribute (normal, uv)
+//   difference, scaled by the weights in SimplifyParams, so that
+//   shading discontinuities are removed last.
+// - Since the cost is a mean (its root an RMS distance), it can be
+//   considerably smaller than the actual deviation. The reported errors
+//   are therefore measured on the result: the maximum distance of the
+//   removed vertices to the triangles near the vertex they were
+//   collapsed into (an upper bound of their distance to the result).
+//   They are model space distances, suited for screen space error
+//   estimation.
+
+namespace tkn {
+
+struct SimplifyParams {
+	// Maximum cost (root of the mean squared plane distance) of a
+	// single collapse, relative to the extent (bounding box diagonal)
+	// of the mesh. The resulting error may be larger.
+	float maxError {0.01f};
+
+	// Weights of attribute differences, relative to the mesh extent.
+	// A normal difference (length of the vector difference) of 1 is
+	// ordered like a position error of normalWeight * extent.
+	float normalWeight {0.1f};
+	float uvWeight {0.1f};
+};
+
+struct SimplifyResult {
+	std::vector<u32> indices;
+	float error {}; // model space distance, see above
+	u32 lockedVertices {}; // vertices that were never considered for removal
+	// For every vertex the vertex it was (transitively) collapsed into.
+	// Vertices that were not removed map to themselves.
+	std::vector<u32> remap;
+};
+
+// Simplifies the given triangle list until it has at most
+// 'targetTriangles' triangles or no collapse with an error below the
+// maximum error is possible anymore.
+// 'normals' and 'uvs' may be empty, otherwise must have the same size
+// as 'positions'.
+SimplifyResult simplify(nytl::Span<const u32> indices,
+	nytl::Span<const Vec3f> positions, nytl::Span<const Vec3f> normals,
+	nytl::Span<const Vec2f> uvs, u32 targetTriangles,
+	const SimplifyParams& = {});
+
+struct LodLevel {
+	u32 indexOffset; // into LodData::indices
+	u32 indexCount;
+	float error; // model space distance to the original mesh, see above
+};
+
+// Levels of detail for a mesh. The original mesh is level 0 (with
+// error 0) and not stored here, levels[i] is level i + 1.
+struct LodData {
+	std::vector<LodLevel> levels;
+	std::vector<u32> indices;
+};
+
+struct LodParams {
+	float ratio {0.5f}; // target triangle ratio between two levels
+	u32 minTriangles {64u}; // no levels with fewer triangles are generated
+	u32 maxLevels {8u};
+	// Used for every level. Its maxError limits the cost of collapses
+	// per level, the errors of the coarser levels can get larger.
+	SimplifyParams simplify {0.02f};
+};
+
+// Builds a chain of levels of detail. Each level is simplified from the
+// previous one, its error is measured against the original mesh (and
+// never smaller than the error of the previous level).
+// The index order of every level is optimized for the vertex cache.
+LodData buildLods(nytl::Span<const u32> indices,
+	nytl::Span<const Vec3f> positions, nytl::Span<const Vec3f> normals,
+	nytl::Span<const Vec2f> uvs, const LodParams& = {});
+
+// Returns the coarsest level whose error, projected onto the screen,
+// is at most 'pixelError' pixels. 'distance' is the view distance and
+// 'scale' the scale of the instance, 'projScale' is
+// viewportHeight / (2 * tan(fovy / 2)).
+// Returns 0 for the original mesh, i for lods.levels[i - 1].
+unsigned selectLod(const LodData& lods, float distance, float projScale,
+	float pixelError = 1.f, float scale = 1.f);
+
+} // namespace tkn
@@ -13,12 +13,19 @@
 #include <unordered_map>
 #include <array>
 #include <shared_mutex>
+#include <mutex>
+#include <future>
 #include <cstring>
+#include <chrono>
+#include <memory>
 #include <filesystem>
 namespace fs = std::filesystem;
 
 namespace tkn {
 
+class ThreadPool;
+class StreamMemoryMap;
+
 // Renamed to compileShader. This one is just badly named.
 [[deprecated("Use ShaderCache or alternatives below instead")]]
 std::optional<vpp::ShaderModule> loadShader(const vpp::Device& dev,
@@ -36,21 +43,88 @@ std::optional<vpp::ShaderModule> compileShader(const vpp::Device& dev,
 	std::string_view glslPath, nytl::StringParam args = {},
 	fs::path spvOutput = "live.spv", std::vector<u32>* outSpv = nullptr);
 
+// Known value of a specialization constant, see freezeSpecConstants.
+struct SpecConstantValue {
+	u32 id; // constant_id
+	u64 value; // bit pattern, the lower 4 bytes are used for 32-bit types
+};
+
+// Post-processing of the SPIR-V generated by glslang.
+struct SpirvOptions {
+	// Runs the SPIR-V optimizer (dead code elimination, constant
+	// folding, inlining, ...). Only has an effect when tkn was
+	// built with SPIRV-Tools.
+	bool optimize {false};
+	// When optimizing: optimize for size instead of performance.
+	bool optimizeSize {false};
+	// Strips all debug information (names, source, line info), e.g.
+	// for release builds. Makes debugging via renderdoc harder.
+	bool stripDebugInfo {false};
+	// Specialization constants with known values, frozen into regular
+	// constants (see freezeSpecConstants). When optimizing, the
+	// optimizer runs after that and can fold them, e.g. remove the
+	// branches depending on them.
+	std::vector<SpecConstantValue> specConstants {};
+};
+
+// Compiles the given glsl file to SPIR-V using glslang.
+// Returns an empty vector on failure.
 std::vector<u32> compileShader(const fs::path& glslPath,
 	nytl::StringParam preamble,
-	nytl::Span<const char*> includeDirs);
+	nytl::Span<const char*> includeDirs,
+	const SpirvOptions& options = {});
+
+// Sets the default values of the specialization constants with the
+// given ids and turns them into regular constants, like the
+// set-spec-const-default-value and freeze-spec-const passes of
+// spirv-opt. Removes their SpecId decorations, pipelines must not
+// specialize them anymore. Ids not in the module are ignored, for
+// duplicate ids the last value is used. Returns false (leaving spv
+// unchanged) if the module can't be parsed.
+bool freezeSpecConstants(std::vector<u32>& spv,
+	nytl::Span<const SpecConstantValue> values);
+
+// Removes the debug instructions (source, names, line info) from the
+// given module, like spirv-opt --strip-debug. Strings are kept when the
+// module uses non-semantic instructions (e.g. debugPrintfEXT).
+// Returns false (leaving spv unchanged) if the module can't be parsed.
+bool stripSpirvDebugInfo(std::vector<u32>& spv);
+
+// The interface of a SPIR-V module needed to create pipeline layouts.
+struct ShaderReflection {
+	struct Binding {
+		u32 set;
+		u32 binding;
+		u32 count; // number of descriptors, for arrays
+		vk::DescriptorType type;
+	};
+
+	struct SpecConstant {
+		u32 id; // constant_id
+		u32 size; // in bytes
+		u64 defaultValue; // bit pattern, the lower size bytes are used
+	};
+
+	// Sorted by set, then by binding.
+	std::vector<Binding> bindings;
+	// Push constant block of the entry point, size 0 if there is none.
+	u32 pushConstantOffset {};
+	u32 pushConstantSize {};
+	// Sorted by id.
+	std::vector<SpecConstant> specConstants;
+};
+
+// Reflects the descriptor bindings, push constants and specialization
+// constants of the given SPIR-V module. Throws std::runtime_error when
+// the module can't be parsed.
+ShaderReflection reflect(nytl::Span<const u32> spv);
 
-// TODO: test and re-audit synchronization. Might have issues, mainly
-//   when one module is compiled by multiple threads at the same time.
 // TODO(low): Re-check hash *after* compilation and retry if it has changed?
 //   Currently, if a file changes between hash building and compilation,
 //   we will store the compiled mod under an hash not matching the
 //   source we compiled. Or maybe while building the hash, already load
 //   all needed files?
 //   But, is that a even usecase we really want to support?
-// PERF(low): maybe also cache included files (& hash) per file in the disk cache,
-//   to avoid actually reading shader files as often as possible?
-//   we currently have to parse them at every startup.
 
 // Loads and compiles glsl shaders.
 // Has an internal in-memory cache for compiled shader modules as well
@@ -58,6 +132,14 @@ std::vector<u32> compileShader(const fs::path& glslPath,
 // modules when out of date. Works purely with hashes so can cache
 // multiple versions of the same path (multiple revisions or compiled
 // with different preambles i.e. defines).
+// The hash and direct includes of every parsed source file are stored
+// in an index in the cache dir, together with the files last write
+// time and size. On startup, files are only read and parsed again
+// when they changed since they were indexed.
+// Compiled SPIR-V is stored in a single archive file in the cache dir
+// that is memory mapped on startup. Modules from the archive directly
+// reference the mapping. New modules are appended to the archive,
+// see compactArchive.
 class ShaderCache {
 public:
 	// TODO: replace this with some platform-specific shader cache dir
@@ -88,19 +170,34 @@ public:
 		}
 	};
 
+	// We can return views of CompiledShader instances since they are
+	// immutable once created
+	struct CompiledShaderView {
+		vk::ShaderModule mod {};
+		nytl::Span<const u32> spv;
+	};
+
 	// Immutable
 	struct CompiledShader {
 		// The last loaded version of this Shader
 		vpp::ShaderModule mod;
 		// Compiled/Loaded SPIR-V bytecode.
+		// Empty when loaded from the archive, see mappedSpv.
 		std::vector<u32> spv;
+		// When loaded from the archive: the SPIR-V inside the mapping.
+		nytl::Span<const u32> mappedSpv {};
+
+		CompiledShaderView view() const {
+			return {mod, mappedSpv.empty() ?
+				nytl::Span<const u32>(spv) : mappedSpv};
+		}
 	};
 
-	// We can return views of CompiledShader instances since they are
-	// immutable once created
-	struct CompiledShaderView {
-		vk::ShaderModule mod {};
-		nytl::Span<const u32> spv;
+	// A single shader requested via loadMany.
+	struct LoadRequest {
+		std::string_view path;
+		std::string_view preamble {};
+		nytl::Span<const SpecConstantValue> specConstants {};
 	};
 
 	struct FileInfo {
@@ -115,6 +212,16 @@ public:
 		FsTimePoint lastParsed {FsTimePoint::min()};
 	};
 
+	// Entry of the persistent index, see indexPath.
+	struct IndexEntry {
+		// Last write time and size of the file when it was parsed.
+		FsTimePoint lastWritten;
+		std::uintmax_t size;
+		// See FileInfo
+		Hash hash;
+		std::vector<fs::path> includes;
+	};
+
 public:
 	// TODO: synchronization.
 	// Should probably be private and have its own mutex.
@@ -124,8 +231,16 @@ public:
 		TKN_BASE_DIR "/src/shaders/include/",
 	};
 
+	// Options for newly compiled modules. Part of the module hash, so
+	// modules compiled with different options are cached separately.
+	// The specConstants of a load are frozen in addition to these.
+	// Same synchronization issues as with includePaths.
+	SpirvOptions spirvOptions {};
+
 public:
-	ShaderCache(const vpp::Device& dev) : dev_(dev) {}
+	// Loads the index from the cache dir.
+	ShaderCache(const vpp::Device& dev);
+	~ShaderCache(); // writes the index, see saveIndex
 
 	// Tries to find an already compiled/cached version of the given
 	// shader, compiled with the given args. Will search the in-memory
@@ -140,8 +255,31 @@ public:
 	// Adds default include paths (src/shaders/{., include})
 	// Returns nullopt on failure. glslPath should be given relative to "src/",
 	// so e.g. be just "particles/particles.comp"
+	// The given specialization constants are frozen into the module
+	// (see SpirvOptions::specConstants), they are part of its hash.
+	// When the same module (same sources, preamble and frozen constants)
+	// is already being compiled by another thread, waits for that
+	// compilation instead of compiling it again.
 	CompiledShaderView load(std::string_view shaderPath,
-		nytl::StringParam preamble = {});
+		nytl::StringParam preamble = {},
+		nytl::Span<const SpecConstantValue> specConstants = {});
+
+	// Loads multiple shaders at once. Hashes all requests first,
+	// deduplicates identical modules (also with compilations already
+	// running on other threads) and then loads/compiles the remaining
+	// ones in parallel on the given pool (ThreadPool::instance() if
+	// nullptr), the calling thread takes part.
+	// Returns the loaded modules in the order of the requests, failed
+	// ones are empty, like for load.
+	std::vector<CompiledShaderView> loadMany(
+		nytl::Span<const LoadRequest> requests, ThreadPool* pool = nullptr);
+
+	// Returns the reflection of the given SPIR-V module, see reflect.
+	// Cached by the SHA-1 of the SPIR-V in memory and on disk (see
+	// reflectionPath), so that pipeline layouts of already known modules
+	// can be created without parsing them. The returned reference stays
+	// valid as long as the cache. Threadsafe.
+	const ShaderReflection& reflection(nytl::Span<const u32> spv);
 
 	// Inserts a manually loaded and compiled module into this cache.
 	vk::ShaderModule insertSpv(const std::string& fullPathStr,
@@ -157,18 +295,109 @@ public:
 	const vpp::Device& device() const { return dev_; }
 	void clear(); // NOTE: not threadsafe, deletes all compiled shaders
 
+	// Writes the index, the cached reflections and the last usage times
+	// of modules loaded from the archive to disk. Called automatically
+	// from clear and on destruction, loading never saves (it may run on
+	// worker threads). Returns false on error.
+	bool save();
+
+	// Rewrites the archive, only keeping the modules used during the
+	// given duration, at most maxSize bytes of SPIR-V (most recently
+	// used first, 0 for no limit). The remaining modules are packed and
+	// indexed at the front of the archive again. Also removes the .spv
+	// files of the old per-module disk cache.
+	// Must not be called while a ShaderCache instance has the archive
+	// open. Constructing a ShaderCache calls this automatically
+	// (with the defaults) when most of the archive was appended since
+	// the last compaction. Returns false on error.
+	static bool compactArchive(
+		std::chrono::seconds maxUnused = std::chrono::hours(24 * 30),
+		std::uint64_t maxSize = 0u);
+
 private:
 	bool buildCurrentHash(fs::path shaderPath, Hash& outHash);
 
+	// Returns the module with the given hash only if it is already loaded.
+	CompiledShaderView findLoaded(const std::string& fullPathStr,
+		const Hash& hash);
+
+	// Hashes the given resolved glsl shader with the preamble, the
+	// options and the frozen specialization constants.
+	bool buildModuleHash(const fs::path& fullPath, std::string_view preamble,
+		nytl::Span<const SpecConstantValue> specConstants, Hash& outHash);
+
+	// Loads a precompiled spirv shader.
+	CompiledShaderView loadSpv(const fs::path& fullPath);
+
+	// Finds the module with the given hash (see 'find') or compiles it.
+	// Makes sure a module is only compiled by one thread at a time,
+	// see inFlight_.
+	CompiledShaderView loadHashed(const fs::path& fullPath,
+		std::string_view preamble,
+		nytl::Span<const SpecConstantValue> specConstants, const Hash& hash);
+	CompiledShaderView compile(const fs::path& fullPath,
+		std::string_view preamble,
+		nytl::Span<const SpecConstantValue> specConstants, const Hash& hash);
+
 	static bool reparse(std::string_view sourceString,
 		std::vector<std::string>& outIncluded,
 		Hash& outHash);
-	static fs::path cachePathForShader(const Hash& hash);
+	static fs::path indexPath();
+	static fs::path archivePath();
+	static fs::path archiveLockPath();
+	static fs::path reflectionPath();
+	void loadIndex();
+	void loadReflections();
+	void openArchive();
+	void appendArchive(const Hash& hash, nytl::Span<const u32> spv);
+	bool saveIndex();
+	bool saveArchiveUsage();
+	bool saveReflections();
 
 private:
 	const vpp::Device& dev_;
 	std::unordered_map<std::string, FileInfo> known_;
 	std::shared_mutex mutex_;
+
+	// Persistent index, maps absolute paths of all source files
+	// ever parsed. Also synchronized via mutex_.
+	std::unordered_map<std::string, IndexEntry> index_;
+	bool indexChanged_ {};
+
+	// Module in the mapped archive.
+	struct ArchiveEntry {
+		nytl::Span<const u32> spv;
+		std::uint64_t entryOffset; // of its entry in the archive file
+		bool used {}; // whether it was used since the last save
+	};
+
+	// Contains all modules that were present in the archive on
+	// construction. Modules appended later on are only in known_.
+	// Also synchronized via mutex_.
+	std::unique_ptr<StreamMemoryMap> archiveMap_;
+	std::unordered_map<Hash, ArchiveEntry, HashHasher> archive_;
+	std::mutex archiveWriteMutex_;
+
+	// Cached reflections, by SHA-1 of the SPIR-V. Persistent, entries
+	// not used for some time are dropped when loading them.
+	struct ReflectionEntry {
+		ShaderReflection reflection;
+		i64 lastUsed; // seconds since epoch
+	};
+
+	std::unordered_map<Hash, ReflectionEntry, HashHasher> reflections_;
+	bool reflectionsChanged_ {};
+	std::shared_mutex reflectionMutex_;
+
+	// Modules currently being compiled by some thread. Other threads
+	// wanting the same module wait for the future instead.
+	// When locking both mutexes, inFlightMutex_ must be locked first.
+	std::unordered_map<Hash, std::shared_future<CompiledShaderView>,
+		HashHasher> inFlight_;
+	std::mutex inFlightMutex_;
+
+	// Serializes save, locked before any other mutex.
+	std::mutex saveMutex_;
 };
 
 // TODO: evaluate whether this can be merged with ThreadState
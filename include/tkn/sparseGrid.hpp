@@ -0,0 +1,147 @@
+#pragma once
+
+#include <tkn/types.hpp>
+#include <tkn/isosurface.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <array>
+#include <vector>
+
+namespace tkn {
+
+class ThreadPool;
+
+// Narrow band samples of a distance field on a regular grid.
+// Stores only the bricks of 8^3 samples near the surface, in a two
+// level tree: a dense root array of nodes (16^3 bricks each) that
+// reference the allocated bricks. Everything else is a tile: a single
+// value (+-background) for a whole brick or node. Needs about
+// (2 * band / spacing) * (surface area / spacing^2) samples, instead of
+// the whole volume for an SdfGrid.
+class SparseSdfGrid {
+public:
+	static constexpr u32 brickSize = 8; // samples per dimension
+	static constexpr u32 brickSamples = brickSize * brickSize * brickSize;
+	static constexpr u32 nodeSize = 16; // bricks per dimension
+	static constexpr u32 noBrick = 0xFFFFFFFFu;
+
+	struct Brick {
+		Vec3ui origin; // first sample
+		std::array<float, brickSamples> values; // x varies fastest
+
+		float value(u32 lx, u32 ly, u32 lz) const {
+			return values[(lz * brickSize + ly) * brickSize + lx];
+		}
+	};
+
+	// Caches the last accessed brick, for fast random access with
+	// some locality.
+	class Accessor {
+	public:
+		Accessor(const SparseSdfGrid& grid) : grid_(&grid) {}
+		float value(u32 x, u32 y, u32 z);
+
+	protected:
+		const SparseSdfGrid* grid_;
+		Vec3ui cached_ {noBrick, noBrick, noBrick}; // brick coordinates
+		const Brick* brick_ {};
+		float tile_ {};
+	};
+
+public:
+	SparseSdfGrid() = default;
+	SparseSdfGrid(Vec3ui size, Vec3f start, Vec3f spacing);
+
+	// Evaluates the given function for the samples within band of the
+	// surface. The function must not change faster than lipschitz
+	// times the distance (1 for an exact distance field, more for an
+	// approximation), positive inside. Whether a brick (or node) is in
+	// the band is decided from the value at its center. The band is
+	// widened to one cell diagonal if needed, so that all cells the
+	// surface passes through are allocated. The work is distributed
+	// over the given pool (or ThreadPool::instance() if nullptr); the
+	// order of the bricks does not depend on it.
+	void sample(const SdfRowFunc& func, float band, float lipschitz = 1.f,
+		ThreadPool* pool = nullptr);
+
+	// Random access. Returns the tile value outside of the band.
+	float value(u32 x, u32 y, u32 z) const;
+	Vec3f position(u32 x, u32 y, u32 z) const {
+		return {
+			start_.x + x * spacing_.x,
+			start_.y + y * spacing_.y,
+			start_.z + z * spacing_.z,
+		};
+	}
+
+	// Index of the brick with the given brick coordinates (sample / 8)
+	// or noBrick if it's a tile.
+	u32 brickID(u32 bx, u32 by, u32 bz) const;
+	float tile(u32 bx, u32 by, u32 bz) const;
+
+	// Sequential access. All allocated bricks, ordered by node and
+	// then by z, y, x within the node.
+	nytl::Span<const Brick> bricks() const { return bricks_; }
+
+	// Calls func(x, y, z, value) for all samples of all bricks, in
+	// the order of the bricks.
+	template<typename F>
+	void forEachSample(F&& func) const;
+
+	Vec3ui size() const { return size_; }
+	Vec3f start() const { return start_; }
+	Vec3f spacing() const { return spacing_; }
+	float background() const { return background_; }
+
+	// Allocated bytes, bricks and nodes.
+	std::size_t memoryUsage() const;
+
+protected:
+	struct Node {
+		std::array<u32, nodeSize * nodeSize * nodeSize> bricks;
+		std::array<float, nodeSize * nodeSize * nodeSize> tiles;
+	};
+
+	static constexpr u32 noNode = 0xFFFFFFFFu;
+
+	Vec3ui size_ {};
+	Vec3f start_ {};
+	Vec3f spacing_ {};
+	float background_ {};
+
+	Vec3ui rootSize_ {}; // nodes per dimension
+	std::vector<u32> root_; // node index or noNode
+	std::vector<float> rootTiles_;
+	std::vector<Node> nodes_;
+	std::vector<Brick> bricks_;
+};
+
+// Like marchingCubes for an SdfGrid but only visits the allocated
+// bricks. Vertices are shared between bricks. All cells the surface
+// passes through are allocated for iso = 0, other values need a band
+// that is wider by |iso|. Cells with crossed edges in tiles (only
+// possible for |iso| > background - lipschitz * cell diagonal) are
+// skipped, leaving holes in the mesh.
+IsoMesh marchingCubes(const SparseSdfGrid& grid, float iso,
+	ThreadPool* pool = nullptr);
+
+template<typename F>
+void SparseSdfGrid::forEachSample(F&& func) const {
+	for(auto& brick : bricks_) {
+		auto id = 0u;
+		for(auto z = 0u; z < brickSize; ++z) {
+			for(auto y = 0u; y < brickSize; ++y) {
+				for(auto x = 0u; x < brickSize; ++x, ++id) {
+					auto gx = brick.origin.x + x;
+					auto gy = brick.origin.y + y;
+					auto gz = brick.origin.z + z;
+					if(gx < size_.x && gy < size_.y && gz < size_.z) {
+						func(gx, gy, gz, brick.values[id]);
+					}
+				}
+			}
+		}
+	}
+}
+
+} // namespace tkn
@@ -10,6 +10,8 @@
 #include <vector>
 #include <future>
 #include <type_traits>
+#include <memory>
+#include <cstddef>
 
 namespace tkn {
 
@@ -121,5 +123,32 @@ protected:
 	std::atomic<unsigned> lastPushed_ {0u}; // The queue we last pushed to.
 };
 
+namespace detail {
+
+void parallelFor(ThreadPool&, std::size_t count, std::size_t grain,
+	void* func, void (*call)(void*, std::size_t, std::size_t));
+
+} // namespace detail
+
+// Calls func(begin, end) for consecutive ranges of at most 'grain'
+// elements covering [0, count). The ranges are distributed dynamically
+// over the workers of the given pool and the calling thread and
+// this function blocks until all of them were processed.
+// Since the calling thread works on ranges itself, this can also be
+// called from inside a pool task.
+// If a call throws, the remaining ranges are still processed and
+// the first exception is rethrown at the end.
+template<typename F>
+void parallelFor(ThreadPool& pool, std::size_t count, std::size_t grain,
+		F&& func) {
+	using Func = std::remove_reference_t<F>;
+	auto call = [](void* f, std::size_t begin, std::size_t end) {
+		(*static_cast<Func*>(f))(begin, end);
+	};
+
+	auto ptr = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+	detail::parallelFor(pool, count, grain, ptr, call);
+}
+
 } // namespace tkn
 
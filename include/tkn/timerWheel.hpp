@@ -0,0 +1,93 @@
+#pragma once
+
+#include <tkn/function.hpp>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <optional>
+#include <cstdint>
+
+namespace tkn {
+
+// Hierarchical timer wheel, allows O(1) insertion and cancellation of
+// timers and amortized O(1) expiration.
+// Time is quantized into ticks, timers never fire before their expiration
+// time but may fire up to one tick later.
+// Each level has 'slotCount' slots, a timer that expires in less than
+// slotCount^(l + 1) ticks is stored in level l. Timers in higher levels
+// are cascaded down to the lower levels when the wheel reaches their slot.
+// Not threadsafe, usually owned by the thread running an event loop.
+// The loop can use nextExpiry to determine how long to wait.
+class TimerWheel {
+public:
+	using Clock = std::chrono::steady_clock;
+	using TimerID = std::uint64_t;
+
+	static constexpr auto slotBits = 6u;
+	static constexpr auto slotCount = 1u << slotBits;
+	static constexpr auto levelCount = 4u;
+
+public:
+	explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(1),
+		Clock::time_point start = Clock::now());
+
+	// Adds a timer that will call the given function once the wheel
+	// is advanced to (or beyond) the given time point.
+	// The returned id can be used to cancel the timer. It won't
+	// ever be returned again for another timer.
+	TimerID add(Clock::time_point expiry, Function<void()> func);
+	TimerID add(Clock::duration timeout, Function<void()> func) {
+		return add(time() + timeout, std::move(func));
+	}
+
+	// Cancels the timer with the given id. Returns false if the timer has
+	// already fired or was already cancelled.
+	bool cancel(TimerID id);
+
+	// Advances the wheel to the given time point, calling the functions
+	// of all timers that expired. The functions may add or cancel timers.
+	// Returns the number of fired timers.
+	unsigned advance(Clock::time_point now);
+
+	// Returns the time point at which the next timer may fire or
+	// std::nullopt if there are no timers. Might return a time point
+	// earlier than the real expiration of the next timer (when it is
+	// stored in a higher level), i.e. the caller should just call
+	// advance at that point and then ask again.
+	std::optional<Clock::time_point> nextExpiry() const;
+
+	// Returns the current time of the wheel, i.e. the time point up to
+	// which it was advanced, rounded to ticks.
+	Clock::time_point time() const { return start_ + tick_ * now_; }
+	std::size_t size() const { return count_; }
+	bool empty() const { return count_ == 0u; }
+
+protected:
+	static constexpr auto invalid = std::uint32_t(0xFFFFFFFFu);
+
+	struct Timer {
+		std::uint64_t expiry {}; // in ticks
+		Function<void()> func;
+		std::uint32_t prev {invalid};
+		std::uint32_t next {invalid};
+		std::uint32_t slot {invalid}; // global slot id, invalid if free
+		std::uint32_t generation {};
+	};
+
+	void insert(std::uint32_t id);
+	void unlink(std::uint32_t id);
+	void cascade(unsigned level);
+	std::uint64_t nextTick() const; // -1 if there are no timers
+
+protected:
+	Clock::time_point start_;
+	Clock::duration tick_;
+	std::uint64_t now_ {}; // in ticks since start_
+	std::size_t count_ {};
+
+	std::vector<Timer> timers_;
+	std::vector<std::uint32_t> free_;
+	std::array<std::uint32_t, slotCount * levelCount> slots_; // list heads
+};
+
+} // namespace tkn
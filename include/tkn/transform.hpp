@@ -541,8 +541,8 @@ nytl::Mat4f cubeProjectionVP(nytl::Vec3f pos, unsigned face,
 	float near = -0.01f, float far = -30.f);
 
 // order:
-// front/near (topleft, topright, bottomleft, bottomright)
-// back/far (topleft, topright, bottomleft, bottomright)
+// front/near (topleft, topright, bottomright, bottomleft)
+// back/far (topleft, topright, bottomright, bottomleft)
 using Frustum = std::array<nytl::Vec3f, 8>;
 Frustum ndcFrustum(); // frustum in ndc space, i.e. [-1, 1]^3
 
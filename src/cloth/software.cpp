@@ -3,6 +3,7 @@
 #include <tkn/render.hpp>
 #include <tkn/ccam.hpp>
 #include <tkn/types.hpp>
+#include <tkn/cloth.hpp>
 #include <argagg.hpp>
 
 #include <vpp/trackedDescriptor.hpp>
@@ -21,12 +22,14 @@
 #include <shaders/tkn.color.frag.h>
 
 // Simple cloth example, simulation done using verlet integration on
-// the cpu. Currently using OpenMP (pragma should just be ignored
-// when OpenMP isn't supported/found).
+// the cpu, see tkn::Cloth. Steps are distributed over the global
+// thread pool.
 // Uses a fixed time step, when simulation is too slow will simply
 // slow down the simulation. Verlet integration will simply explode
 // when the time step is too large. Might have to adjust time step
-// when increasing spring or damping factors (especially latter)
+// when increasing spring or damping factors (especially latter).
+// The xpbd solver can be selected instead, it stays stable for
+// large (e.g. frame-rate) steps and stiff springs.
 
 // TODO: when stepdt is changed the next iteration will give wrong
 // results, due to verlet integration. Solution sketch: when stepdt
@@ -38,14 +41,6 @@ using nytl::Vec3f;
 class ClothApp : public tkn::SinglePassApp {
 public:
 	using Base = tkn::SinglePassApp;
-	struct Node {
-		nytl::Vec3f pos;
-		nytl::Vec3f vel;
-
-		// integratin
-		nytl::Vec3f lpos {};
-		nytl::Vec3f npos {};
-	};
 
 	static constexpr float near = 0.05f;
 	static constexpr float far = 25.f;
@@ -61,7 +56,7 @@ public:
 		auto& dev = vkDevice();
 
 		// init nodes
-		resetCloth();
+		cloth_ = {gridSize_, gridSize_, cloth_.params};
 
 		// pipeline
 		auto bindings = std::array {
@@ -104,7 +99,7 @@ public:
 		std::vector<u32> inds;
 		for(auto y = 0u; y < gridSize_; ++y) {
 			for(auto x = 0u; x < gridSize_; ++x) {
-				inds.push_back(id(x, y));
+				inds.push_back(cloth_.id(x, y));
 			}
 
 			inds.push_back(0xFFFFFFFFu);
@@ -112,7 +107,7 @@ public:
 
 		for(auto x = 0u; x < gridSize_; ++x) {
 			for(auto y = 0u; y < gridSize_; ++y) {
-				inds.push_back(id(x, y));
+				inds.push_back(cloth_.id(x, y));
 			}
 
 			inds.push_back(0xFFFFFFFFu);
@@ -183,51 +178,45 @@ public:
 			});
 		};
 
-		createValueTextfield(panel, "ks0", params_.ks[0]);
-		createValueTextfield(panel, "ks1", params_.ks[1]);
-		createValueTextfield(panel, "ks2", params_.ks[2]);
+		createValueTextfield(panel, "ks0", cloth_.params.ks[0]);
+		createValueTextfield(panel, "ks1", cloth_.params.ks[1]);
+		createValueTextfield(panel, "ks2", cloth_.params.ks[2]);
+
+		createValueTextfield(panel, "kd0", cloth_.params.kd[0]);
+		createValueTextfield(panel, "kd1", cloth_.params.kd[1]);
+		createValueTextfield(panel, "kd2", cloth_.params.kd[2]);
 
-		createValueTextfield(panel, "kd0", params_.kd[0]);
-		createValueTextfield(panel, "kd1", params_.kd[1]);
-		createValueTextfield(panel, "kd2", params_.kd[2]);
+		createValueTextfield(panel, "dt", stepdt_);
+		createValueTextfield(panel, "dtfac", facdt_);
+		createValueTextfield(panel, "mass", cloth_.params.mass);
+
+		auto& xpbd = panel.create<Checkbox>("xpbd").checkbox();
+		xpbd.set(cloth_.params.solver == tkn::ClothSolver::xpbd);
+		xpbd.onToggle = [&](auto& cb) {
+			cloth_.params.solver = cb.checked() ?
+				tkn::ClothSolver::xpbd : tkn::ClothSolver::verlet;
+		};
 
-		createValueTextfield(panel, "dt", params_.stepdt);
-		createValueTextfield(panel, "dtfac", params_.facdt);
-		createValueTextfield(panel, "mass", params_.mass);
+		createNumTextfield(panel, "iterations", cloth_.params.iterations,
+			[&](auto v){ cloth_.params.iterations = unsigned(v); });
 
 		for(auto i = 0u; i < 4; ++i) {
 			auto name = "corner " + std::to_string(i);
 			auto& cb = panel.create<Checkbox>(name).checkbox();
-			cb.set(params_.fixCorners[i]);
+			cb.set(cloth_.params.fixCorners[i]);
 			cb.onToggle = [=](auto&) {
-				params_.fixCorners[i] ^= true;
+				cloth_.params.fixCorners[i] ^= true;
 			};
 		}
 
 		auto& b = panel.create<Button>("Reset");
 		b.onClick = [&]{
-			resetCloth();
+			cloth_.reset();
 		};
 
 		return true;
 	}
 
-	void resetCloth() {
-		nodes_.resize(gridSize_ * gridSize_);
-		auto start = -int(gridSize_) / 2.f;
-		for(auto y = 0u; y < gridSize_; ++y) {
-			for(auto x = 0u; x < gridSize_; ++x) {
-				auto pos =  nytl::Vec3f{start + x, 0, start + y};
-				nodes_[id(x, y)] = {pos, {0.f, 0.f, 0.f}, pos, pos};
-			}
-		}
-	}
-
-	std::size_t id(unsigned x, unsigned y) {
-		dlg_assert(x < gridSize_ && y < gridSize_);
-		return x * gridSize_ + y;
-	}
-
 	void render(vk::CommandBuffer cb) override {
 		vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics, gfx_.pipe);
 		tkn::cmdBindGraphicsDescriptors(cb, gfx_.pipeLayout, 0, {gfx_.ds});
@@ -246,101 +235,22 @@ public:
 		camera_.mouseMove(swaDisplay(), {ev.dx, ev.dy}, windowSize());
 	}
 
-	// actually returns spring force plus dampening force
-	Vec3f springForce(const Node& a, const Node& b, float ks, float kd, float l) {
-		auto pd = b.pos - a.pos;
-		auto vd = b.vel - a.vel;
-
-		auto pl = nytl::length(pd);
-		dlg_assert(pl > 0.0);
-		pd *= 1.f / pl; // normalize
-		return (ks * (pl - l) + kd * dot(vd, pd)) * pd;
-	}
-
-	void step(float dt) {
-		#pragma omp parallel for
-		for(auto x = 0u; x < gridSize_; ++x) {
-			for(auto y = 0u; y < gridSize_; ++y) {
-				if(x == 0 && y == 0 && params_.fixCorners[0]) {
-					continue;
-				} else if(x == gridSize_ - 1 && y == 0 && params_.fixCorners[1]) {
-					continue;
-				} else if(x == 0 && y == gridSize_ - 1 && params_.fixCorners[2]) {
-					continue;
-				} else if(x == gridSize_ - 1 && y == gridSize_ - 1 && params_.fixCorners[3]) {
-					continue;
-				}
-
-				// start with external: gravity
-				nytl::Vec3f f {0.f, -10.f * params_.mass, 0.f};
-				auto& n = nodes_[id(x,y)];
-				auto kd = params_.kd[0];
-				auto ks = params_.ks[0];
-				auto l = 1.f;
-				auto addf = [&](int offx, int offy) {
-					if(int(x) + offx >= int(gridSize_) ||
-							int(y) + offy >= int(gridSize_) ||
-							int(y) + offy < 0 ||
-							int(x) + offx < 0) {
-						return;
-					}
-					f += springForce(n, nodes_[id(x + offx, y + offy)],
-						ks, kd, l);
-				};
-
-				addf(-1, 0);
-				addf(1, 0);
-				addf(0, -1);
-				addf(0, 1);
-
-				l = 2.f;
-				kd = params_.kd[1];
-				ks = params_.ks[1];
-
-				addf(-2, 0);
-				addf(2, 0);
-				addf(0, -2);
-				addf(0, 2);
-
-				l = std::sqrt(2.f);
-				kd = params_.kd[2];
-				ks = params_.ks[2];
-
-				addf(-1, -1);
-				addf(1, 1);
-				addf(-1, 1);
-				addf(1, -1);
-
-				// integrate
-				f *= 1 / params_.mass;
-				n.npos = 2 * n.pos - n.lpos + dt * dt * f;
-			}
-		}
-
-		// update
-		for(auto& n : nodes_) {
-			n.lpos = n.pos;
-			n.pos = n.npos;
-			n.vel = (1.f / dt) * (n.pos - n.lpos);
-		}
-	}
-
 	void update(double dt) override {
 		Base::update(dt);
 		camera_.update(swaDisplay(), dt);
 
 		// simulate
 		// fixed time step
-		accumdt_ += params_.facdt * dt;
+		accumdt_ += facdt_ * dt;
 		auto total = 0u;
-		while(accumdt_ > params_.stepdt) {
+		while(accumdt_ > stepdt_) {
 			if(++total > 3u) {
 				dlg_warn("Updating too slow");
 				accumdt_ = 0.f;
 				break;
 			}
-			accumdt_ -= params_.stepdt;
-			step(params_.stepdt);
+			accumdt_ -= stepdt_;
+			cloth_.step(stepdt_);
 		}
 
 		// always redraw
@@ -361,16 +271,11 @@ public:
 		// always update position buffer
 		auto map = nodesBuf_.memoryMap();
 		auto span = map.span();
+		auto positions = nytl::Span<Vec3f>(
+			reinterpret_cast<Vec3f*>(span.data()), cloth_.nodeCount());
 
 		auto size = 2.f;
-		auto scale = size / gridSize_;
-		for(auto y = 0u; y < gridSize_; ++y) {
-			for(auto x = 0u; x < gridSize_; ++x) {
-				auto& n = nodes_[id(x, y)];
-				tkn::write(span, nytl::Vec3f(scale * n.pos));
-			}
-		}
-
+		cloth_.writePositions(positions, size / gridSize_);
 		map.flush();
 	}
 
@@ -416,21 +321,14 @@ protected:
 
 	tkn::ControlledCamera camera_;
 	unsigned gridSize_ {40};
-	std::vector<Node> nodes_;
+	tkn::Cloth cloth_;
 	vpp::SubBuffer nodesBuf_;
 	vpp::SubBuffer indexBuf_;
 	unsigned indexCount_ {};
 
 	float accumdt_ {};
-
-	struct {
-		std::array<float, 3> ks {50.f, 50.f, 50.f}; // spring dconstants
-		std::array<float, 3> kd {0.03f, 0.03f, 0.03f}; // damping constants
-		std::array<bool, 4> fixCorners {true, true, true, true};
-		float stepdt {0.01}; // in s
-		float facdt {1.f};
-		float mass {0.05}; // in kg
-	} params_;
+	float stepdt_ {0.01}; // in s
+	float facdt_ {1.f};
 };
 
 int main(int argc, const char** argv) {
@@ -17,6 +17,11 @@ layout(location = 4) out float outLinDepth;
 layout(location = 5) flat out uint outMatID;
 layout(location = 6) flat out uint outModelID;
 
+// Whether the scene uses the compact vertex format, see
+// tkn/scene/quantize.hpp. The normals are octahedral encoded then,
+// the positions are dequantized by the model matrix.
+layout(constant_id = 0) const bool compactVertices = false;
+
 layout(set = 0, binding = 0, row_major) uniform Scene {
 	mat4 proj; // view and pojection
 	mat4 _invProj;
@@ -47,7 +52,8 @@ void main() {
 	outMatID = uint(models[id].normal[0][3]);
 	outModelID = uint(models[id].normal[1][3]);
 
-	outNormal = mat3(models[id].normal) * inNormal;
+	vec3 normal = compactVertices ? decodeNormal(inNormal.xy) : inNormal;
+	outNormal = mat3(models[id].normal) * normal;
 	outTexCoord0 = inTexCoord0;
 	outTexCoord1 = inTexCoord1;
 
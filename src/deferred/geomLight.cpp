@@ -171,14 +171,28 @@ void GeomLightPass::create(InitData& data, const PassCreateInfo& info,
 		info.dsLayouts.scene.vkHandle()}}, {}};
 	vpp::nameHandle(geomPipeLayout_, "GeomLightPass:geomPipeLayout");
 
+	// compactVertices specialization constant, see gbuf.vert
+	vk::SpecializationMapEntry specEntry;
+	specEntry.constantID = 0u;
+	specEntry.offset = 0u;
+	specEntry.size = sizeof(vk::Bool32);
+
+	vk::Bool32 compactVertices = info.compactVertices;
+
+	vk::SpecializationInfo spec;
+	spec.dataSize = sizeof(compactVertices);
+	spec.pData = &compactVertices;
+	spec.mapEntryCount = 1u;
+	spec.pMapEntries = &specEntry;
+
 	vpp::ShaderModule vertShader(dev, deferred_gbuf_vert_data);
 	vpp::ShaderModule fragShader(dev, deferred_gbuf_frag_data);
 	vpp::GraphicsPipelineInfo gpi {rp_, geomPipeLayout_, {{{
-		{vertShader, vk::ShaderStageBits::vertex},
+		{vertShader, vk::ShaderStageBits::vertex, &spec},
 		{fragShader, vk::ShaderStageBits::fragment},
 	}}}, 0};
 
-	gpi.vertex = tkn::Scene::vertexInfo();
+	gpi.vertex = tkn::Scene::vertexInfo(info.compactVertices);
 
 	// we don't blend in the gbuffers; simply overwrite
 	auto blendAttachments = {
@@ -212,11 +226,11 @@ void GeomLightPass::create(InitData& data, const PassCreateInfo& info,
 	// blending pipeline for transparent pass
 	vpp::ShaderModule blendFragShader(dev, deferred_blend_frag_data);
 	vpp::GraphicsPipelineInfo bgpi {rp_, geomPipeLayout_, {{{
-		{vertShader, vk::ShaderStageBits::vertex},
+		{vertShader, vk::ShaderStageBits::vertex, &spec},
 		{blendFragShader, vk::ShaderStageBits::fragment},
 	}}}, 1};
 
-	bgpi.vertex = tkn::Scene::vertexInfo();
+	bgpi.vertex = tkn::Scene::vertexInfo(info.compactVertices);
 	bgpi.assembly.topology = vk::PrimitiveTopology::triangleList;
 	bgpi.depthStencil.depthTestEnable = true;
 	bgpi.depthStencil.depthWriteEnable = false;
@@ -28,6 +28,7 @@
 #include <tkn/scene/shape.hpp>
 #include <tkn/scene/light.hpp>
 #include <tkn/scene/scene.hpp>
+#include <tkn/scene/cache.hpp>
 #include <tkn/scene/environment.hpp>
 #include <argagg.hpp>
 
@@ -84,6 +85,7 @@ public:
 		float scale {1.f};
 		float maxAniso {1.f};
 		std::string model;
+		bool compactVertices {};
 	};
 
 	bool init(const nytl::Span<const char*> args) override;
@@ -397,25 +399,21 @@ bool ViewApp::init(const nytl::Span<const char*> pargs) {
 		// primitiveDsLayout_,
 		dummyTex_.vkImageView(),
 		samplerAnisotropy,
-		false, multiDrawIndirect_
+		false, multiDrawIndirect_,
+		args.compactVertices,
 	};
 
-	auto [omodel, path] = tkn::loadGltf(args.model);
-	if(!omodel) {
+	auto sceneData = tkn::loadSceneCached(args.model);
+	if(!sceneData) {
 		std::exit(-1);
 	}
 
-	auto model = std::move(*omodel);
-	dlg_info("Found {} scenes", model.scenes.size());
-	auto scene = model.defaultScene >= 0 ? model.defaultScene : 0;
-	auto& sc = model.scenes[scene];
-
 	tkn::Scene::InitData initScene;
-	scene_.create(initScene, wb, path, *omodel, sc, mat, ri);
+	scene_.create(initScene, wb, std::move(*sceneData), mat, ri);
 	scene_.rescale(4 * args.scale);
 
 	tkn::initShadowData(shadowData_, dev, depthFormat_,
-		scene_.dsLayout(), multiview_, depthClamp_);
+		scene_.dsLayout(), multiview_, depthClamp_, scene_.compactVertices());
 	auto dirtPath = TKN_BASE_DIR "/assets/lens/LensDirt_60.JPG";
 	auto initDirt = createTexture(wb, tkn::loadImage(dirtPath));
 
@@ -784,7 +782,8 @@ void ViewApp::initPasses(tkn::WorkBatcher& wb) {
 			linearSampler_,
 			nearestSampler_,
 		},
-		fullVertShader_
+		fullVertShader_,
+		scene_.compactVertices(),
 	};
 
 	// NOTE: conservative simplification at the moment; can be optimzied
@@ -1345,6 +1344,10 @@ argagg::parser ViewApp::argParser() const {
 		"maxAniso", {"--maxaniso", "--ani"},
 		"Maximum of anisotropy for samplers", 1
 	});
+	defs.push_back({
+		"compactVertices", {"--compact-vertices"},
+		"Store the scene vertices in the quantized compact format", 0
+	});
 	return parser;
 }
 
@@ -1363,6 +1366,9 @@ bool ViewApp::handleArgs(const argagg::parser_results& result, App::Args& bout)
 	if(result.has_option("maxAniso")) {
 		out.maxAniso = result["maxAniso"].as<float>();
 	}
+	if(result.has_option("compactVertices")) {
+		out.compactVertices = true;
+	}
 
 	return true;
 }
@@ -1514,7 +1520,8 @@ void ViewApp::screenshot() {
 				linearSampler_,
 				nearestSampler_,
 			},
-			fullVertShader_
+			fullVertShader_,
+			scene_.compactVertices(),
 		};
 
 		SyncScope empty {};
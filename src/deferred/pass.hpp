@@ -39,5 +39,6 @@ struct PassCreateInfo {
 	} samplers;
 
 	vk::ShaderModule fullscreenVertShader;
+	bool compactVertices {}; // see tkn::Scene::compactVertices
 };
 
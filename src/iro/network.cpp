@@ -1,16 +1,13 @@
 #include "network.hpp"
 #include <dlg/dlg.hpp>
 #include <tkn/bits.hpp>
-#include <mutex>
-#include <condition_variable>
+#include <asio/post.hpp>
+#include <array>
 #include <random>
 
 // TODO:
 // - invalid packet (currently using tkn::read, only asserts size)
 //   probably best solved by exceptions in read function, caught here
-// - make packet receiving (header processing, check whether re-send
-//   is needed and re-send, if so) async. That can happen in separate
-//   thread. Just sync via mutex.
 // - when a player knows it's behind (i.e. step < recv) it could execute
 //   multiple steps at once, trying to catch up.
 //   I guess update() could return a enum status:
@@ -143,10 +140,6 @@ Socket::Socket() {
 
 	player_ = socket().local_endpoint() < socket().remote_endpoint();
 
-	// Not sure really why this is needed though to make socket().available()
-	// work...
-	socket().non_blocking(true);
-
 	// The buffers have to be of size 2 * delay, they are basically
 	// ring buffers.
 	// The worst case (in terms of used buffer slots) is this:
@@ -167,9 +160,27 @@ Socket::Socket() {
 	// and we know that recv_ cannot be more than delay steps behind
 	// step_.
 	sent_.resize(2 * delay);
+	resendable_.resize(2 * delay);
 
 	Header hdr {packetMagic, step_, recv_};
 	write(sending_, hdr); // add dummy for next (first) step
+
+	// start the network thread
+	ioService_.restart();
+	work_.emplace(ioService_.get_executor());
+	timer_.emplace(ioService_);
+	recvBuf_.resize(64 * 1024); // max udp packet size
+	receive();
+
+	thread_ = std::thread([this]{ ioService_.run(); });
+}
+
+Socket::~Socket() {
+	work_.reset();
+	ioService_.stop();
+	if(thread_.joinable()) {
+		thread_.join();
+	}
 }
 
 void Socket::recvSocket(udp::endpoint& ep, std::uint32_t& num, unsigned& state) {
@@ -231,140 +242,255 @@ void Socket::recvBroadcast(udp::endpoint& ep, std::uint32_t& num, unsigned& stat
 	}
 }
 
-bool Socket::update(MsgHandler handler) {
-	while(true) {
-		std::error_code ec {};
-		auto a = socket().available(ec);
-		if(ec) {
-			dlg_warn("socket.available: {}", ec.message());
-			break;
+// network thread
+void Socket::receive() {
+	auto buf = asio::buffer(recvBuf_.data(), recvBuf_.size());
+	socket().async_receive(buf, [this](const std::error_code& ec, std::size_t size) {
+		if(ec == asio::error::operation_aborted) {
+			return;
 		}
 
-		if(!a) {
-			break;
+		if(ec) {
+			dlg_warn("socket.receive: {}", ec.message());
+		} else {
+			handlePacket(size);
 		}
 
-		std::vector<std::byte> buf(a);
-		auto size = socket().receive(asio::buffer(buf.data(), buf.size()));
-		// dlg_trace("received {} bytes", size);
-		buf.resize(size);
+		receive();
+	});
+}
 
-		if(size < sizeof(Header)) {
-			dlg_info("Received packet is too small: {}", size);
-			continue;
-		}
+void Socket::handlePacket(std::size_t size) {
+	if(size < sizeof(Header)) {
+		dlg_info("Received packet is too small: {}", size);
+		return;
+	}
 
-		auto r = RecvBuf(buf);
-		auto h = tkn::read<Header>(r);
+	auto r = RecvBuf(recvBuf_.data(), size);
+	auto h = tkn::read<Header>(r);
 
-		// check magic
-		if(h.magic != packetMagic) {
-			// just discard the packet
-			dlg_info("Invalid packet magic number: {}", h.magic);
-			continue;
-		}
+	// check magic
+	if(h.magic != packetMagic) {
+		// just discard the packet
+		dlg_info("Invalid packet magic number: {}", h.magic);
+		return;
+	}
 
-		// check step number
-		// This can happen when we received old packets
-		auto off = stepOffset(step_, h.step);
-		// dlg_trace("  step: {} (off {})", h.step, off);
-		if(std::abs(off) > int(delay)) {
-			// just discard
-			dlg_info("Invalid step in packet: {} (step_ = {})",
-				h.step, step_);
-			continue;
-		}
+	// check step number
+	// This can happen when we received old packets
+	auto off = stepOffset(netStep_, h.step);
+	// dlg_trace("  step: {} (off {})", h.step, off);
+	if(std::abs(off) > int(delay)) {
+		// just discard
+		dlg_info("Invalid step in packet: {} (netStep_ = {})",
+			h.step, netStep_);
+		return;
+	}
+
+	// TODO: We randomly drop valid packets for testing atm.
+	static std::mt19937 rgen;
+	// rgen.seed(std::time(nullptr));
+	std::uniform_real_distribution<float> distr(0.f, 1.f);
+	auto lossChance = 0.0;
+	if(distr(rgen) < lossChance) {
+		dlg_info("dropping step {}", h.step);
+		return;
+	}
+
+	// update the ack_ bitset
+	// We have to bring the h.ack bitset to our netStep_ base using off
+	if(off > 0) {
+		h.ack = h.ack << off;
+	} else if(off < 0) {
+		h.ack = h.ack >> -off;
+	}
+
+	// check that ack_ does not contain acks for packets we didn't send.
+	if((~((1u << delay) - 1) & h.ack) != 0u) {
+		dlg_info("Invalid ack bits in packet: {}", printAckBits(h.ack));
+		return;
+	}
 
-		// check if already received
-		if(isAckSet(recv_, off)) {
-			dlg_info("Received redundant packet {}", h.step);
-			// TODO: use potantially new information in h.ack?
+	// Use the ack information even from redundant packets.
+	// Stop the re-send timers of all newly acknowledged packets
+	// and immediately re-send the first hole, the probability is
+	// high it just got lost.
+	auto newAcks = h.ack & ~ack_;
+	ack_ |= h.ack;
+	auto hole = false;
+	for(auto i = i32(delay) - 1; i >= 0; --i) {
+		auto& sent = resendable_[u32(netStep_ - delay + i) % (2 * delay)];
+		if(!sent.packet) {
 			continue;
 		}
 
-		// TODO: We randomly drop valid packets for testing atm.
-		static std::mt19937 rgen;
-		// rgen.seed(std::time(nullptr));
-		std::uniform_real_distribution<float> distr(0.f, 1.f);
-		auto lossChance = 0.0;
-		if(distr(rgen) < lossChance) {
-			dlg_info("dropping step {}", h.step);
-			continue;
+		if(newAcks & (1u << i)) {
+			timers_.cancel(sent.timer);
+			sent = {};
+			hole = true;
+		} else if(ack_ & (1u << i)) {
+			hole = true;
+		} else if(hole && !sent.resent) {
+			dlg_trace("resending packet (hole) {}", netStep_ - delay + i);
+			sent.resent = true;
+			sendPacket(*sent.packet);
+			break;
 		}
+	}
 
-		// update recv_ bitset, setting the bit for the packet we
-		// just received
-		setAckRef(recv_, off);
+	// check if already received
+	if(isAckSet(netRecv_, off)) {
+		dlg_info("Received redundant packet {}", h.step);
+		return;
+	}
 
-		// update the ack_ bitset
-		// We have to bring the h.ack bitset to our step_ base using off
-		if(off > 0) {
-			h.ack = h.ack << off;
-		} else if(off < 0) {
-			h.ack = h.ack >> -off;
-		}
+	// hand it to the game thread. If the queue is full, we just don't
+	// acknowledge the packet, it will be re-sent.
+	SendBuf packet {{recvBuf_.data(), recvBuf_.data() + size}};
+	if(recvQueue_.enqueue(packet) == 0u) {
+		dlg_warn("Receive queue full, dropping packet {}", h.step);
+		return;
+	}
+
+	// update recv bitset, setting the bit for the packet we
+	// just received
+	setAckRef(netRecv_, off);
+}
 
-		// check that ack_ does not contain acks for packets we didn't send.
-		dlg_assert((~((1u << delay) - 1) & h.ack) == 0u);
+void Socket::send(std::shared_ptr<const SendBuf> packet) {
+	auto r = RecvBuf(packet->data);
+	auto h = tkn::read<Header>(r);
+	dlg_assertm(h.step == netStep_, "{} {}", h.step, netStep_);
 
-		ack_ |= h.ack;
-		recvd_[h.step % (2 * delay)] = {std::move(buf)};
+	sendPacket(*packet);
+
+	// the packet that previously used this slot is too old to be re-sent
+	auto& sent = resendable_[h.step % (2 * delay)];
+	if(sent.packet) {
+		timers_.cancel(sent.timer);
 	}
 
-	// TODO: encode potential new ack information in the message headers
-	// when we have to re-send.
-	// Just modify them inplace, always additive
-
-	// check whether we have to re-send a packet
-	// we resend packets in the following situations:
-	if(ack_ == 0 && initCount_ >= delay) {
-		// ack_ is just empty. In that case the other side is as far
-		// behind as possible.
-		using namespace std::chrono;
-		if(waiting_ && duration_cast<milliseconds>(Clock::now() - *waiting_).count() > 5) { // TODO!
-			auto d = sent_[(step_ - delay) % (2 * delay)].data;
-			dlg_trace("resending packet (empty) {}", step_ - delay);
-			socket().send(asio::buffer(d.data(), d.size()));
-		}
+	auto step = h.step;
+	sent.packet = std::move(packet);
+	sent.resent = false;
+	sent.timer = timers_.add(Clock::now() + resendTimeout, [this, step]{
+		resend(step);
+	});
+	updateTimer();
+
+	++netStep_;
+	netRecv_ = netRecv_ >> 1u;
+	ack_ = ack_ >> 1u;
+}
+
+void Socket::sendPacket(const SendBuf& packet) {
+	// Always send our latest ack information (relative to the packets step)
+	// instead of the one from when the packet was first sent.
+	auto r = RecvBuf(packet.data);
+	auto h = tkn::read<Header>(r);
+	auto off = stepOffset(netStep_, h.step);
+	auto ack = netRecv_;
+	if(off > 0) {
+		ack = ack >> off;
+	} else if(off < 0) {
+		ack = ack << -off;
+	}
+
+	Header hdr {packetMagic, h.step, ack & ((1u << (2 * delay)) - 1)};
+	std::array<asio::const_buffer, 2> bufs = {
+		asio::buffer(&hdr, sizeof(hdr)),
+		asio::buffer(r.data(), r.size()),
+	};
+
+	std::error_code ec;
+	socket().send(bufs, 0, ec);
+	if(ec) {
+		dlg_warn("socket.send: {}", ec.message());
+	}
+}
+
+void Socket::resend(u32 step) {
+	auto& sent = resendable_[step % (2 * delay)];
+	if(!sent.packet) {
+		return;
+	}
+
+	// Packets older than the ack bits reach are not resent anymore.
+	// The other side must have received them for us to get here.
+	auto off = stepOffset(netStep_, step);
+	if(off >= -i32(delay) && !isAckSet(ack_, off)) {
+		dlg_trace("resending packet (timeout) {}", step);
+		sendPacket(*sent.packet);
+		sent.timer = timers_.add(Clock::now() + resendTimeout, [this, step]{
+			resend(step);
+		});
+	} else if(off < -i32(delay) && -off <= i32(2 * delay)) {
+		// we don't know whether the other side received it, the ack
+		// bits don't reach back this far. Re-send it one last time.
+		dlg_trace("resending packet (old) {}", step);
+		sendPacket(*sent.packet);
+		sent = {};
 	} else {
-		// there is a hole in the ack bits we got from the other side.
-		// That packet might just be late, but the probability is
-		// high is just got lost.
-		// We only re-send it for the first hole.
-		auto start = std::max(i32(delay) - i32(initCount_), 0);
-		auto count = initCount_;
-		for(auto i = start; i < i32(start + count); ++i) {
-			auto set = ack_ & (1u << i);
-			if(!set) {
-				dlg_trace("resending packet (hole) {}", step_ - delay + i);
-				auto d = sent_[(step_ - delay + i) % (2 * delay)].data;
-				socket().send(asio::buffer(d.data(), d.size()));
-				break;
-			}
-		}
+		sent = {};
+	}
+}
+
+void Socket::updateTimer() {
+	auto next = timers_.nextExpiry();
+	if(!next || (timerExpiry_ && *timerExpiry_ <= *next)) {
+		return;
 	}
-	// In any case, if the other side is missing the packet it needs
-	// to proceed (offset: -delay) we always re-send that.
 
+	timerExpiry_ = *next;
+	timer_->expires_at(*next);
+	timer_->async_wait([this](const std::error_code& ec) {
+		if(ec == asio::error::operation_aborted) {
+			return;
+		}
 
-	// check whether we can do the next step
-	if(initCount_ >= delay && !isAckSet(recv_, -i32(delay))) {
-		if(!waiting_) {
-			waiting_ = Clock::now();
+		timerExpiry_ = {};
+		timers_.advance(Clock::now());
+		updateTimer();
+	});
+}
+
+// game thread
+bool Socket::update(MsgHandler handler) {
+	// receive all packets the network thread has validated for us
+	SendBuf packet;
+	while(recvQueue_.dequeue(&packet, 1) == 1u) {
+		auto r = RecvBuf(packet.data);
+		auto h = tkn::read<Header>(r);
+
+		// The network thread validated the packet relative to
+		// its step, which might be behind ours.
+		auto off = stepOffset(step_, h.step);
+		if(std::abs(off) > int(delay) || isAckSet(recv_, off)) {
+			dlg_debug("Discarding old packet {} (step_ = {})", h.step, step_);
+			continue;
 		}
 
-		dlg_info("no update: {} vs {}", step_, printAckBits(recv_));
-		return false;
+		// update recv_ bitset, setting the bit for the packet we
+		// just received
+		setAckRef(recv_, off);
+		recvd_[h.step % (2 * delay)] = std::move(packet);
 	}
 
-	waiting_ = {};
+	// check whether we can do the next step
+	// Re-sending our packets happens on the network thread.
+	if(initCount_ >= delay && !isAckSet(recv_, -i32(delay))) {
+		dlg_debug("no update: {} vs {}", step_, printAckBits(recv_));
+		return false;
+	}
 
 	// we can do the next step, yeay!
 	// send the accumulated messages
-	auto& d = sending_.data;
-	// dlg_trace("sending {} bytes", d.size());
-	socket().send(asio::buffer(d.data(), d.size()));
-	sent_[step_ % (2 * delay)] = std::move(sending_);
+	// dlg_trace("sending {} bytes", sending_.data.size());
+	auto sent = std::make_shared<const SendBuf>(std::move(sending_));
+	sent_[step_ % (2 * delay)] = sent;
+	asio::post(ioService_, [this, sent = std::move(sent)]() mutable {
+		this->send(std::move(sent));
+	});
 
 	// process
 	if(initCount_ >= i32(delay)) {
@@ -379,7 +505,7 @@ bool Socket::update(MsgHandler handler) {
 	}
 
 	if(initCount_ >= i32(delay)) {
-		auto own = RecvBuf(sent_[u32(step_ - delay) % (2 * delay)].data);
+		auto own = RecvBuf(sent_[u32(step_ - delay) % (2 * delay)]->data);
 		dlg_assert(!own.empty());
 		auto hdr = tkn::read<Header>(own);
 		dlg_assertm(hdr.step + delay == step_, "{} {}", hdr.step, step_);
@@ -392,8 +518,8 @@ bool Socket::update(MsgHandler handler) {
 	if(initCount_ < 2 * delay) ++initCount_;
 
 	recv_ = recv_ >> 1u;
-	ack_ = ack_ >> 1u;
 
+	sending_ = {};
 	Header hdr {packetMagic, step_, recv_};
 	write(sending_, hdr);
 
@@ -1,16 +1,22 @@
 #pragma once
 
 #include <tkn/types.hpp>
+#include <tkn/timerWheel.hpp>
+#include <tkn/ringbuffer.hpp>
 #include <nytl/span.hpp>
 
 #include <asio/ip/udp.hpp>
 #include <asio/ip/host_name.hpp>
 #include <asio/io_service.hpp>
+#include <asio/steady_timer.hpp>
+#include <asio/executor_work_guard.hpp>
 #include <asio/buffer.hpp>
 
 #include <optional>
 #include <functional>
 #include <chrono>
+#include <thread>
+#include <memory>
 
 using asio::ip::udp;
 using namespace tkn::types;
@@ -50,36 +56,56 @@ auto& write(SendBuf& buf, T&& obj) {
 
 using RecvBuf = nytl::Span<const std::byte>;
 
-// everything network related
+// everything network related.
+// Receiving, acknowledging and re-sending packets happens on a dedicated
+// network thread that runs an asio event loop. It is woken up by incoming
+// packets and by the re-send timers (managed in a tkn::TimerWheel), i.e.
+// network latency does not depend on the frame rate.
+// Validated packets are handed to the game thread via a lock-free queue,
+// update just polls them.
 class Socket {
 public:
 	using MsgHandler = std::function<void(std::uint32_t player, RecvBuf&)>;
 	using Clock = std::chrono::steady_clock;
 
+	// The time after which a sent packet that wasn't acknowledged by
+	// the other side is sent again. Note that the other side acknowledges
+	// our packets with the packets it sends, i.e. once per step.
+	static constexpr auto resendTimeout = std::chrono::milliseconds(20);
+
 public:
 	Socket();
+	~Socket();
 
-	// sends pending messages and calls the message handler with the
-	// messages to be processed. Returns whether allowed to make
-	// the next step.
+	// Calls the message handler with the messages to be processed
+	// and queues the messages for this step to be sent.
+	// Returns whether allowed to make the next step.
 	bool update(MsgHandler handler);
 
 	// write new messages into that buffer
 	// until next nextStep call
 	SendBuf& add() { return sending_; }
 
-	udp::socket& socket() { return *socket_; }
 	auto step() const { return step_; }
 	auto player() const { return player_; }
 
 private:
+	udp::socket& socket() { return *socket_; }
 	void recvBroadcast(udp::endpoint& ep, std::uint32_t& num, unsigned& state);
 	void recvSocket(udp::endpoint& ep, std::uint32_t& num, unsigned& state);
 
+	// network thread
+	void receive();
+	void handlePacket(std::size_t size);
+	void send(std::shared_ptr<const SendBuf> packet);
+	void sendPacket(const SendBuf& packet);
+	void resend(u32 step);
+	void updateTimer();
+
 private:
+	// - game thread -
 	u32 step_ {0}; // current step (sent in next packets)
 	u32 recv_ {0}; // bitset of received packets
-	u32 ack_ {0}; // bitset of messages packets by other side (remoteAck)
 	// acknowledge bitsets:
 	// if bit i is set (ack & (1 << i)), this means that message
 	// (step - delay + i) was received/acknowledged.
@@ -90,21 +116,48 @@ private:
 	// messages sent.
 	u32 initCount_ {0};
 
-	asio::io_service ioService_;
-	std::optional<udp::socket> socket_;
-	std::optional<udp::socket> broadcast_;
-
 	// receieved messages to be processed in future
 	std::vector<SendBuf> recvd_;
 
 	// sent messages to be processed in future.
-	// also used in case we have to re-send messages
-	std::vector<SendBuf> sent_;
+	// Shared with the network thread that might have to re-send them.
+	std::vector<std::shared_ptr<const SendBuf>> sent_;
 
 	SendBuf sending_; // to be sent, will be built in the current step
 	unsigned player_; // own player id
 
-	std::optional<Clock::time_point> waiting_;
+	// Validated, received packets. Produced by the network thread,
+	// consumed by the game thread.
+	tkn::RingBuffer<SendBuf> recvQueue_ {4 * delay};
+
+	// - network thread -
+	asio::io_service ioService_;
+	std::optional<udp::socket> socket_;
+	std::optional<udp::socket> broadcast_;
+	std::thread thread_;
+
+	using WorkGuard = asio::executor_work_guard<asio::io_service::executor_type>;
+	std::optional<WorkGuard> work_;
+
+	// Single asio timer, always waiting for the next expiration
+	// in the timer wheel.
+	std::optional<asio::steady_timer> timer_;
+	std::optional<Clock::time_point> timerExpiry_;
+	tkn::TimerWheel timers_;
+
+	std::vector<std::byte> recvBuf_; // for the next received packet
+	u32 netStep_ {0}; // step of the next packet to be sent
+	u32 netRecv_ {0}; // like recv_, relative to netStep_
+	u32 ack_ {0}; // bitset of packets acknowledged by other side, relative to netStep_
+
+	// Sent packets that might have to be re-sent, ring buffer.
+	struct Sent {
+		std::shared_ptr<const SendBuf> packet;
+		tkn::TimerWheel::TimerID timer {};
+		bool resent {}; // whether it was already re-sent because of a hole
+	};
+
+	std::vector<Sent> resendable_;
 };
 
 enum class MessageType : std::uint32_t {
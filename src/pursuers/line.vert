@@ -3,11 +3,19 @@
 layout(location = 0) in vec2 in_pos;
 layout(location = 0) out float out_alpha;
 
-const float pointCount = 128.f;
+// slot of the newest position and number of slots, the trail is a ring.
+// See tkn::Trails
+layout(push_constant) uniform Trail {
+	layout(offset = 16) uint head;
+	uint pointCount;
+} trail;
 
 void main() {
-	out_alpha = 1.f - (gl_VertexIndex / pointCount);
+	// also correct for the last slot, mirroring slot 0
+	int count = int(trail.pointCount);
+	int age = (gl_VertexIndex - int(trail.head) + count) % count;
+
+	out_alpha = 1.f - (age / float(count));
 	out_alpha = 0.4 * pow(out_alpha, 4);
 	gl_Position = vec4(in_pos, 0.0, 1.0);
 }
-
@@ -5,6 +5,7 @@
 //   has on the others over time)
 
 #include <tkn/singlePassApp.hpp>
+#include <tkn/particles.hpp>
 #include <vpp/sharedBuffer.hpp>
 #include <vpp/vk.hpp>
 #include <vpp/pipeline.hpp>
@@ -19,7 +20,7 @@
 #include <shaders/pursuers.line.vert.h>
 #include <shaders/pursuers.line.frag.h>
 
-constexpr auto pointCount = 128; // needs to be updated in line.vert
+constexpr auto pointCount = 128;
 constexpr auto particleCount = 2000;
 
 struct Parameters {
@@ -31,6 +32,13 @@ struct Parameters {
 		float invDist;
 		float maxInvDist;
 	} attraction;
+
+	// attraction to all particles within the radius, disabled
+	// for strength 0. Negative strength for repulsion.
+	struct {
+		float radius;
+		float strength;
+	} local;
 };
 
 Parameters p1 = {
@@ -41,6 +49,10 @@ Parameters p1 = {
 		2.f,
 		100.f
 	},
+	{
+		0.05f,
+		0.f,
+	},
 };
 
 Parameters p2 = {
@@ -51,6 +63,10 @@ Parameters p2 = {
 		1.f,
 		50.f
 	},
+	{
+		0.05f,
+		0.f,
+	},
 };
 
 class PursuerSystem {
@@ -59,8 +75,7 @@ public:
 
 public:
 	PursuerSystem(vpp::Device& dev) {
-		auto pcount = pointCount * particleCount;
-		auto size = pcount * sizeof(nytl::Vec2f);
+		auto size = (pointCount + 1) * particleCount * sizeof(nytl::Vec2f);
 		buf_ = {dev.bufferAllocator(), size,
 			vk::BufferUsageBits::vertexBuffer, dev.hostMemoryTypes()};
 
@@ -69,33 +84,27 @@ public:
 		rgen.seed(std::time(nullptr));
 		std::uniform_real_distribution<float> posDistr(-1.f, 1.f);
 
-		particles_.reserve(particleCount);
-		points_.resize(pcount);
+		pos_.reserve(particleCount);
+		colors_.reserve(particleCount);
+		vel_.resize(particleCount);
 		for(auto i = 0u; i < particleCount; ++i) {
-			auto pos = nytl::Vec2f {posDistr(rgen), posDistr(rgen)};
+			pos_.push_back({posDistr(rgen), posDistr(rgen)});
 			float b = 0.2 + 0.3 * i / float(particleCount);
-			auto col = nytl::Vec4f {0.2f, 0.9f - b, b, 1.f};
-			particles_.push_back({pos, {}, col});
-			for(auto j = 0u; j < pointCount; ++j) {
-				points_[i * pointCount + j] = pos;
-			}
+			colors_.push_back({0.2f, 0.9f - b, b, 1.f});
 		}
 
+		trails_ = {pos_, pointCount};
 	}
 
 	void update(double dt) {
-		// shift all position by one
-		auto size = (points_.size() - 1) * (sizeof(points_[0]));
-		std::memmove(points_.data() + 1, points_.data(), size);
-
-		auto follow = &particles_.back();
-		auto i = 0u;
-		for(auto& p : particles_) {
-			p.pos += dt * p.vel;
-			points_[i] = p.pos;
-			p.vel *= std::pow(params.friction, dt * 100.f);
-
-			auto d = follow->pos - p.pos;
+		auto follow = particleCount - 1;
+		for(auto i = 0u; i < particleCount; ++i) {
+			auto& pos = pos_[i];
+			auto& vel = vel_[i];
+			pos += dt * vel;
+			vel *= std::pow(params.friction, dt * 100.f);
+
+			auto d = pos_[follow] - pos;
 			auto dd = dot(d, d);
 
 			if(dd != 0.f) {
@@ -107,47 +116,71 @@ public:
 					normalize(d);
 				}
 
-				p.vel += dt * fac * d;
+				vel += dt * fac * d;
 
 				// == ideas ==
 				// add invSqrtDist attraction
 				// fac += std::min(0.2f / std::sqrt(dd), 30.f);
 			}
 
-			follow = &p;
-			i += pointCount;
+			follow = i;
+		}
+
+		if(params.local.strength != 0.f && params.local.radius > 0.f) {
+			tkn::AttractionParams local;
+			local.radius = params.local.radius;
+			local.strength = params.local.strength;
+			tkn::applyAttraction(pos_, vel_, dt, local, hash_);
 		}
+
+		trails_.push(pos_);
+		changed_ = true;
 	}
 
 	void updateDevice() {
+		if(!changed_) {
+			return;
+		}
+
+		changed_ = false;
 		auto map = buf_.memoryMap();
-		auto size = points_.size() * sizeof(points_[0]);
-		std::memcpy(map.ptr(), points_.data(), size);
+		auto data = trails_.data();
+		std::memcpy(map.ptr(), data.data(), data.size() * sizeof(data[0]));
 	}
 
 	void render(vk::CommandBuffer cb, vk::PipelineLayout layout) {
+		// The trails are a ring, the vertex shader needs the newest
+		// slot and the number of slots to compute the age of a point.
+		std::array<std::uint32_t, 2> trail {trails_.head(), trails_.length()};
+		vk::cmdPushConstants(cb, layout, vk::ShaderStageBits::vertex,
+			sizeof(nytl::Vec4f), sizeof(trail), trail.data());
+
 		// could be done more efficiently if we ignore color i guess
-		auto offset = 0u;
-		for(auto& p : particles_) {
-			auto c = p.color;
+		auto segments = trails_.segments();
+		auto offset = buf_.offset();
+		for(auto& c : colors_) {
 			vk::cmdPushConstants(cb, layout,
 				vk::ShaderStageBits::fragment, 0u, sizeof(c), &c);
 			vk::cmdBindVertexBuffers(cb, 0, 1, buf_.buffer(), offset);
-			vk::cmdDraw(cb, pointCount, 1, 0, 0);
-			offset += pointCount * sizeof(nytl::Vec2f);
+			for(auto [first, count] : segments) {
+				if(count > 1) {
+					vk::cmdDraw(cb, count, 1, first, 0);
+				}
+			}
+
+			offset += (pointCount + 1) * sizeof(nytl::Vec2f);
 		}
 	}
 
 protected:
-	std::vector<nytl::Vec2f> points_;
+	std::vector<nytl::Vec2f> pos_;
+	std::vector<nytl::Vec2f> vel_;
+	std::vector<nytl::Vec4f> colors_;
 
-	struct Particle {
-		nytl::Vec2f pos {};
-		nytl::Vec2f vel {};
-		nytl::Vec4f color {};
-	};
+	tkn::Trails trails_;
+	tkn::SpatialHash hash_;
+	bool changed_ {true};
 
-	std::vector<Particle> particles_;
 	vpp::SubBuffer buf_;
 };
 
@@ -163,9 +196,13 @@ public:
 		rvgInit();
 
 		// pipe
-		auto range = vk::PushConstantRange {vk::ShaderStageBits::fragment,
-			0u, sizeof(nytl::Vec4f)};
-		particlePipeLayout_ = {dev, {}, {{range}}};
+		auto ranges = std::array {
+			vk::PushConstantRange {vk::ShaderStageBits::fragment,
+				0u, sizeof(nytl::Vec4f)},
+			vk::PushConstantRange {vk::ShaderStageBits::vertex,
+				sizeof(nytl::Vec4f), 2 * sizeof(std::uint32_t)},
+		};
+		particlePipeLayout_ = {dev, {}, ranges};
 
 		auto lineVert = vpp::ShaderModule(dev, pursuers_line_vert_data);
 		auto lineFrag = vpp::ShaderModule(dev, pursuers_line_frag_data);
@@ -237,6 +274,10 @@ public:
 			params.normalize = c.checked();
 		};
 
+		auto& local = panel_->create<Folder>("local attraction");
+		createValueTextfield(local, "radius", params.local.radius);
+		createValueTextfield(local, "strength", params.local.strength);
+
 		return true;
 	}
 
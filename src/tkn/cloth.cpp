@@ -0,0 +1,612 @@
+#include <tkn/cloth.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace tkn {
+namespace {
+
+// Springs of a node, in the order they are evaluated.
+// Both, the scalar and the vectorized implementation, evaluate them
+// with exactly the same operations so their results are identical.
+struct Spring {
+	int dx;
+	int dy;
+	unsigned type; // 0: structural, 1: bend, 2: shear
+};
+
+constexpr Spring springs[] = {
+	{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0},
+	{-2, 0, 1}, {2, 0, 1}, {0, -2, 1}, {0, 2, 1},
+	{-1, -1, 2}, {1, 1, 2}, {-1, 1, 2}, {1, -1, 2},
+};
+
+// Nodes at most this far from the border might have missing springs.
+constexpr auto border = 2u;
+
+std::array<float, 3> restLengths(float spacing) {
+	return {spacing, 2 * spacing, float(std::sqrt(2.f)) * spacing};
+}
+
+} // anon namespace
+
+Cloth::Cloth(unsigned width, unsigned height, const Params& xparams) :
+		params(xparams), width_(width), height_(height) {
+	dlg_assert(width >= 2 && height >= 2);
+	for(auto* comps : {&pos_, &lastPos_, &vel_, &nextVel_}) {
+		for(auto& comp : *comps) {
+			comp.resize(nodeCount());
+		}
+	}
+
+	reset();
+}
+
+void Cloth::reset() {
+	auto sx = -0.5f * (width_ - 1) * params.spacing;
+	auto sz = -0.5f * (height_ - 1) * params.spacing;
+	for(auto y = 0u; y < height_; ++y) {
+		for(auto x = 0u; x < width_; ++x) {
+			auto i = id(x, y);
+			pos_[0][i] = sx + x * params.spacing;
+			pos_[1][i] = 0.f;
+			pos_[2][i] = sz + y * params.spacing;
+		}
+	}
+
+	lastPos_ = pos_;
+	for(auto& comp : vel_) {
+		std::fill(comp.begin(), comp.end(), 0.f);
+	}
+}
+
+void Cloth::step(float dt, ThreadPool* pool) {
+	dlg_assert(dt > 0.f);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	switch(params.solver) {
+		case ClothSolver::verlet: stepVerlet(dt, *pool); break;
+		case ClothSolver::xpbd: stepXpbd(dt, *pool); break;
+	}
+}
+
+void Cloth::stepVerlet(float dt, ThreadPool& pool) {
+	auto tilesX = (width_ + tileWidth - 1) / tileWidth;
+	auto tilesY = (height_ + tileHeight - 1) / tileHeight;
+	parallelFor(pool, tilesX * tilesY, 1, [&](auto begin, auto end) {
+		for(auto t = begin; t < end; ++t) {
+			auto tx = unsigned(t % tilesX);
+			auto ty = unsigned(t / tilesX);
+			stepTile(tx * tileWidth, std::min((tx + 1) * tileWidth, width_),
+				ty * tileHeight, std::min((ty + 1) * tileHeight, height_), dt);
+		}
+	});
+
+	// fixed corners simply keep their position
+	std::array<std::size_t, 4> corners = {
+		id(0, 0), id(width_ - 1, 0),
+		id(0, height_ - 1), id(width_ - 1, height_ - 1),
+	};
+
+	for(auto c = 0u; c < 4u; ++c) {
+		if(!params.fixCorners[c]) {
+			continue;
+		}
+
+		for(auto i = 0u; i < 3u; ++i) {
+			lastPos_[i][corners[c]] = pos_[i][corners[c]];
+			nextVel_[i][corners[c]] = 0.f;
+		}
+	}
+
+	std::swap(pos_, lastPos_);
+	std::swap(vel_, nextVel_);
+}
+
+void Cloth::stepTile(unsigned x0, unsigned x1, unsigned y0, unsigned y1,
+		float dt) {
+	for(auto y = y0; y < y1; ++y) {
+		auto x = x0;
+		if(y >= border && y + border < height_) {
+			// all springs exist for nodes in [border, width - border)
+			for(; x < std::min(x1, border); ++x) {
+				stepNode(x, y, dt);
+			}
+
+			auto end = std::min(x1, width_ - border);
+			for(; x + 4 <= end; x += 4) {
+				stepNodes4(x, y, dt);
+			}
+		}
+
+		for(; x < x1; ++x) {
+			stepNode(x, y, dt);
+		}
+	}
+}
+
+void Cloth::stepNode(unsigned x, unsigned y, float dt) {
+	auto i = id(x, y);
+	auto px = pos_[0][i], py = pos_[1][i], pz = pos_[2][i];
+	auto vx = vel_[0][i], vy = vel_[1][i], vz = vel_[2][i];
+	auto fx = 0.f, fy = 0.f, fz = 0.f;
+
+	auto lengths = restLengths(params.spacing);
+	for(auto& spring : springs) {
+		auto nx = int(x) + spring.dx;
+		auto ny = int(y) + spring.dy;
+		if(nx < 0 || ny < 0 || nx >= int(width_) || ny >= int(height_)) {
+			continue;
+		}
+
+		auto j = id(nx, ny);
+		auto dx = pos_[0][j] - px;
+		auto dy = pos_[1][j] - py;
+		auto dz = pos_[2][j] - pz;
+		auto len = std::sqrt(dx * dx + dy * dy + dz * dz);
+		dlg_assert(len > 0.f);
+
+		auto inv = 1.f / len;
+		dx *= inv;
+		dy *= inv;
+		dz *= inv;
+
+		auto dvx = vel_[0][j] - vx;
+		auto dvy = vel_[1][j] - vy;
+		auto dvz = vel_[2][j] - vz;
+		auto s = params.ks[spring.type] * (len - lengths[spring.type]) +
+			params.kd[spring.type] * (dvx * dx + dvy * dy + dvz * dz);
+		fx += s * dx;
+		fy += s * dy;
+		fz += s * dz;
+	}
+
+	auto invMass = 1.f / params.mass;
+	auto dt2 = dt * dt;
+	auto invDt = 1.f / dt;
+	auto integrate = [&](unsigned c, float p, float f) {
+		auto a = f * invMass + params.gravity[c];
+		auto next = (2.f * p - lastPos_[c][i]) + dt2 * a;
+		lastPos_[c][i] = next;
+		nextVel_[c][i] = (next - p) * invDt;
+	};
+
+	integrate(0, px, fx);
+	integrate(1, py, fy);
+	integrate(2, pz, fz);
+}
+
+#ifdef __SSE2__
+
+// Same as stepNode for the 4 nodes starting at (x, y). All their
+// springs must exist.
+void Cloth::stepNodes4(unsigned x, unsigned y, float dt) {
+	auto i = id(x, y);
+	struct Vec3x4 {
+		__m128 x, y, z;
+	};
+
+	auto load = [&](const Components& comps, std::size_t j) {
+		return Vec3x4 {
+			_mm_loadu_ps(comps[0].data() + j),
+			_mm_loadu_ps(comps[1].data() + j),
+			_mm_loadu_ps(comps[2].data() + j),
+		};
+	};
+
+	auto [px, py, pz] = load(pos_, i);
+	auto [vx, vy, vz] = load(vel_, i);
+	auto fx = _mm_setzero_ps();
+	auto fy = _mm_setzero_ps();
+	auto fz = _mm_setzero_ps();
+
+	auto lengths = restLengths(params.spacing);
+	const auto one = _mm_set1_ps(1.f);
+	for(auto& spring : springs) {
+		auto j = std::size_t(std::ptrdiff_t(i) +
+			std::ptrdiff_t(spring.dy) * width_ + spring.dx);
+
+		auto [nx, ny, nz] = load(pos_, j);
+		auto dx = _mm_sub_ps(nx, px);
+		auto dy = _mm_sub_ps(ny, py);
+		auto dz = _mm_sub_ps(nz, pz);
+		auto len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+
+		auto inv = _mm_div_ps(one, len);
+		dx = _mm_mul_ps(dx, inv);
+		dy = _mm_mul_ps(dy, inv);
+		dz = _mm_mul_ps(dz, inv);
+
+		auto [nvx, nvy, nvz] = load(vel_, j);
+		auto dvx = _mm_sub_ps(nvx, vx);
+		auto dvy = _mm_sub_ps(nvy, vy);
+		auto dvz = _mm_sub_ps(nvz, vz);
+		auto dot = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(dvx, dx), _mm_mul_ps(dvy, dy)), _mm_mul_ps(dvz, dz));
+
+		auto ks = _mm_set1_ps(params.ks[spring.type]);
+		auto kd = _mm_set1_ps(params.kd[spring.type]);
+		auto l = _mm_set1_ps(lengths[spring.type]);
+		auto s = _mm_add_ps(_mm_mul_ps(ks, _mm_sub_ps(len, l)),
+			_mm_mul_ps(kd, dot));
+
+		fx = _mm_add_ps(fx, _mm_mul_ps(s, dx));
+		fy = _mm_add_ps(fy, _mm_mul_ps(s, dy));
+		fz = _mm_add_ps(fz, _mm_mul_ps(s, dz));
+	}
+
+	const auto invMass = _mm_set1_ps(1.f / params.mass);
+	const auto dt2 = _mm_set1_ps(dt * dt);
+	const auto invDt = _mm_set1_ps(1.f / dt);
+	const auto two = _mm_set1_ps(2.f);
+	auto integrate = [&](unsigned c, __m128 p, __m128 f) {
+		auto a = _mm_add_ps(_mm_mul_ps(f, invMass), _mm_set1_ps(params.gravity[c]));
+		auto last = _mm_loadu_ps(lastPos_[c].data() + i);
+		auto next = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(two, p), last),
+			_mm_mul_ps(dt2, a));
+		_mm_storeu_ps(lastPos_[c].data() + i, next);
+		_mm_storeu_ps(nextVel_[c].data() + i, _mm_mul_ps(_mm_sub_ps(next, p), invDt));
+	};
+
+	integrate(0, px, fx);
+	integrate(1, py, fy);
+	integrate(2, pz, fz);
+}
+
+#else // __SSE2__
+
+void Cloth::stepNodes4(unsigned x, unsigned y, float dt) {
+	for(auto i = 0u; i < 4u; ++i) {
+		stepNode(x + i, y, dt);
+	}
+}
+
+#endif // __SSE2__
+
+// xpbd
+namespace {
+
+// Directions of the distance constraints, each spring of the verlet
+// solver is one of them (seen from both its nodes). The constraints
+// of a direction are split into two colors (by x for horizontal ones,
+// by y otherwise) so that the constraints of one color don't share
+// any nodes and can be solved in parallel.
+struct EdgeDir {
+	int dx;
+	unsigned dy;
+	unsigned type; // see Spring
+};
+
+constexpr EdgeDir edgeDirs[] = {
+	{1, 0, 0}, {0, 1, 0}, {2, 0, 1}, {0, 2, 1}, {1, 1, 2}, {-1, 1, 2},
+};
+
+// Guards against the division by zero for nodes at the same position.
+constexpr auto minLength = 1e-6f;
+
+// Rough number of nodes processed per parallelFor range.
+constexpr auto xpbdGrain = 16 * 1024u;
+
+// The constraints of one direction in one step.
+struct Constraints {
+	std::array<float*, 3> pos;
+	std::array<const float*, 3> last;
+	const float* w; // inverse masses
+	float* lambda;
+	float restLength;
+	float alpha; // compliance / dt^2
+	float gamma; // compliance * kd / dt
+};
+
+// Solves the constraint between the nodes a and b, with the
+// accumulated lambda at index l.
+void solve(const Constraints& c, std::size_t a, std::size_t b,
+		std::size_t l) {
+	std::array<float, 3> n;
+	auto len2 = 0.f;
+	for(auto k = 0u; k < 3u; ++k) {
+		n[k] = c.pos[k][b] - c.pos[k][a];
+		len2 += n[k] * n[k];
+	}
+
+	auto len = std::max(std::sqrt(len2), minLength);
+	auto inv = 1.f / len;
+	auto dv = 0.f; // relative movement along the constraint, for damping
+	for(auto k = 0u; k < 3u; ++k) {
+		n[k] *= inv;
+		auto va = c.pos[k][a] - c.last[k][a];
+		auto vb = c.pos[k][b] - c.last[k][b];
+		dv += n[k] * (vb - va);
+	}
+
+	auto wa = c.w[a];
+	auto wb = c.w[b];
+	auto num = -((len - c.restLength) + c.alpha * c.lambda[l] + c.gamma * dv);
+	auto den = (1.f + c.gamma) * (wa + wb) + c.alpha;
+	auto dl = num / den;
+	c.lambda[l] += dl;
+	for(auto k = 0u; k < 3u; ++k) {
+		c.pos[k][a] -= wa * dl * n[k];
+		c.pos[k][b] += wb * dl * n[k];
+	}
+}
+
+#ifdef __SSE2__
+
+// Four constraints, in lanes.
+struct Edges4 {
+	__m128 a[3];
+	__m128 b[3];
+	__m128 lastA[3];
+	__m128 lastB[3];
+	__m128 wa;
+	__m128 wb;
+	__m128 lambda;
+};
+
+// Same as solve for the four constraints in the given lanes.
+inline void solve4(const Constraints& c, Edges4& e) {
+	__m128 n[3];
+	auto len2 = _mm_setzero_ps();
+	for(auto k = 0u; k < 3u; ++k) {
+		n[k] = _mm_sub_ps(e.b[k], e.a[k]);
+		len2 = _mm_add_ps(len2, _mm_mul_ps(n[k], n[k]));
+	}
+
+	auto len = _mm_max_ps(_mm_sqrt_ps(len2), _mm_set1_ps(minLength));
+	auto inv = _mm_div_ps(_mm_set1_ps(1.f), len);
+	auto dv = _mm_setzero_ps();
+	for(auto k = 0u; k < 3u; ++k) {
+		n[k] = _mm_mul_ps(n[k], inv);
+		auto va = _mm_sub_ps(e.a[k], e.lastA[k]);
+		auto vb = _mm_sub_ps(e.b[k], e.lastB[k]);
+		dv = _mm_add_ps(dv, _mm_mul_ps(n[k], _mm_sub_ps(vb, va)));
+	}
+
+	auto alpha = _mm_set1_ps(c.alpha);
+	auto gamma = _mm_set1_ps(c.gamma);
+	auto err = _mm_add_ps(_mm_add_ps(
+		_mm_sub_ps(len, _mm_set1_ps(c.restLength)),
+		_mm_mul_ps(alpha, e.lambda)), _mm_mul_ps(gamma, dv));
+	auto num = _mm_sub_ps(_mm_setzero_ps(), err);
+	auto den = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps(1.f), gamma),
+		_mm_add_ps(e.wa, e.wb)), alpha);
+	auto dl = _mm_div_ps(num, den);
+	e.lambda = _mm_add_ps(e.lambda, dl);
+
+	auto da = _mm_mul_ps(e.wa, dl);
+	auto db = _mm_mul_ps(e.wb, dl);
+	for(auto k = 0u; k < 3u; ++k) {
+		e.a[k] = _mm_sub_ps(e.a[k], _mm_mul_ps(da, n[k]));
+		e.b[k] = _mm_add_ps(e.b[k], _mm_mul_ps(db, n[k]));
+	}
+}
+
+#endif // __SSE2__
+
+// Solves the count constraints between the nodes a + i and b + i,
+// with lambdas at l + i. The nodes must not overlap.
+void solveRun(const Constraints& c, std::size_t a, std::size_t b,
+		std::size_t l, unsigned count) {
+	auto i = 0u;
+
+#ifdef __SSE2__
+	for(; i + 4 <= count; i += 4) {
+		Edges4 e;
+		for(auto k = 0u; k < 3u; ++k) {
+			e.a[k] = _mm_loadu_ps(c.pos[k] + a + i);
+			e.b[k] = _mm_loadu_ps(c.pos[k] + b + i);
+			e.lastA[k] = _mm_loadu_ps(c.last[k] + a + i);
+			e.lastB[k] = _mm_loadu_ps(c.last[k] + b + i);
+		}
+
+		e.wa = _mm_loadu_ps(c.w + a + i);
+		e.wb = _mm_loadu_ps(c.w + b + i);
+		e.lambda = _mm_loadu_ps(c.lambda + l + i);
+
+		solve4(c, e);
+
+		for(auto k = 0u; k < 3u; ++k) {
+			_mm_storeu_ps(c.pos[k] + a + i, e.a[k]);
+			_mm_storeu_ps(c.pos[k] + b + i, e.b[k]);
+		}
+
+		_mm_storeu_ps(c.lambda + l + i, e.lambda);
+	}
+#endif // __SSE2__
+
+	for(; i < count; ++i) {
+		solve(c, a + i, b + i, l + i);
+	}
+}
+
+// Solves the horizontal constraints between x and x + d (d being 1 or
+// 2) of the row starting at node r that have the given color,
+// i.e. (x % 2d) / d == color. Lambdas are stored at r + x.
+void solveRow(const Constraints& c, std::size_t r, unsigned width,
+		unsigned d, unsigned color) {
+	auto x = color * d;
+
+#ifdef __SSE2__
+	// The constraints of one color are interleaved with the other
+	// one: a block of 8 values contains 4 constraints.
+	auto split = [d](const float* src, __m128& a, __m128& b) {
+		auto lo = _mm_loadu_ps(src);
+		auto hi = _mm_loadu_ps(src + 4);
+		if(d == 1) {
+			a = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+			b = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+		} else {
+			a = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(1, 0, 1, 0));
+			b = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 2, 3, 2));
+		}
+	};
+
+	auto merge = [d](float* dst, __m128 a, __m128 b) {
+		if(d == 1) {
+			_mm_storeu_ps(dst, _mm_unpacklo_ps(a, b));
+			_mm_storeu_ps(dst + 4, _mm_unpackhi_ps(a, b));
+		} else {
+			_mm_storeu_ps(dst, _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 1, 0)));
+			_mm_storeu_ps(dst + 4, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 3, 2)));
+		}
+	};
+
+	for(; x + 8 <= width; x += 8) {
+		auto i = r + x;
+		Edges4 e;
+		for(auto k = 0u; k < 3u; ++k) {
+			split(c.pos[k] + i, e.a[k], e.b[k]);
+			split(c.last[k] + i, e.lastA[k], e.lastB[k]);
+		}
+
+		__m128 otherLambda;
+		split(c.w + i, e.wa, e.wb);
+		split(c.lambda + i, e.lambda, otherLambda);
+
+		solve4(c, e);
+
+		for(auto k = 0u; k < 3u; ++k) {
+			merge(c.pos[k] + i, e.a[k], e.b[k]);
+		}
+
+		merge(c.lambda + i, e.lambda, otherLambda);
+	}
+#endif // __SSE2__
+
+	for(; x + d < width; ++x) {
+		if((x % (2 * d)) / d == color) {
+			solve(c, r + x, r + x + d, r + x);
+		}
+	}
+}
+
+} // anon namespace
+
+// Every step predicts the positions from the velocities and gravity,
+// then iteratively projects them onto the constraints and finally
+// derives the velocities from the movement. Since all constraints of
+// one color are independent, the result does not depend on the number
+// of threads.
+void Cloth::stepXpbd(float dt, ThreadPool& pool) {
+	auto count = nodeCount();
+	invMass_.assign(count, 1.f / params.mass);
+	std::array<std::size_t, 4> corners = {
+		id(0, 0), id(width_ - 1, 0),
+		id(0, height_ - 1), id(width_ - 1, height_ - 1),
+	};
+
+	for(auto c = 0u; c < 4u; ++c) {
+		if(params.fixCorners[c]) {
+			invMass_[corners[c]] = 0.f;
+		}
+	}
+
+	for(auto& lambda : lambda_) {
+		lambda.assign(count, 0.f);
+	}
+
+	auto rowGrain = std::max(1u, xpbdGrain / width_);
+	auto forRows = [&](auto&& func) {
+		parallelFor(pool, height_, rowGrain, [&](auto begin, auto end) {
+			for(auto y = unsigned(begin); y < end; ++y) {
+				func(y);
+			}
+		});
+	};
+
+	// predict
+	forRows([&](unsigned y) {
+		for(auto i = id(0, y); i < id(0, y + 1); ++i) {
+			auto free = invMass_[i] > 0.f;
+			for(auto k = 0u; k < 3u; ++k) {
+				auto v = vel_[k][i] + dt * params.gravity[k];
+				lastPos_[k][i] = pos_[k][i];
+				pos_[k][i] += free ? dt * v : 0.f;
+			}
+		}
+	});
+
+	// constraints
+	auto lengths = restLengths(params.spacing);
+	for(auto it = 0u; it < params.iterations; ++it) {
+		for(auto d = 0u; d < 6u; ++d) {
+			auto& dir = edgeDirs[d];
+			auto ks = params.ks[dir.type];
+			if(ks <= 0.f) {
+				continue;
+			}
+
+			Constraints c;
+			for(auto k = 0u; k < 3u; ++k) {
+				c.pos[k] = pos_[k].data();
+				c.last[k] = lastPos_[k].data();
+			}
+
+			c.w = invMass_.data();
+			c.lambda = lambda_[d].data();
+			c.restLength = lengths[dir.type];
+			c.alpha = 1.f / (ks * dt * dt);
+			c.gamma = params.kd[dir.type] / (ks * dt);
+
+			for(auto color = 0u; color < 2u; ++color) {
+				forRows([&](unsigned y) {
+					if(dir.dy == 0u) {
+						solveRow(c, id(0, y), width_, unsigned(dir.dx), color);
+						return;
+					}
+
+					if(y + dir.dy >= height_ || (y % (2 * dir.dy)) / dir.dy != color) {
+						return;
+					}
+
+					auto ny = y + dir.dy;
+					if(dir.dx == 0) {
+						solveRun(c, id(0, y), id(0, ny), id(0, y), width_);
+					} else if(dir.dx > 0) {
+						solveRun(c, id(0, y), id(1, ny), id(0, y), width_ - 1);
+					} else {
+						solveRun(c, id(1, y), id(0, ny), id(0, y), width_ - 1);
+					}
+				});
+			}
+		}
+	}
+
+	// velocities
+	auto invDt = 1.f / dt;
+	forRows([&](unsigned y) {
+		for(auto i = id(0, y); i < id(0, y + 1); ++i) {
+			for(auto k = 0u; k < 3u; ++k) {
+				vel_[k][i] = (pos_[k][i] - lastPos_[k][i]) * invDt;
+			}
+		}
+	});
+}
+
+void Cloth::writePositions(nytl::Span<Vec3f> dst, float scale) const {
+	dlg_assert(dst.size() >= nodeCount());
+	for(auto i = 0u; i < nodeCount(); ++i) {
+		dst[i] = {scale * pos_[0][i], scale * pos_[1][i], scale * pos_[2][i]};
+	}
+}
+
+Vec3f Cloth::position(std::size_t id) const {
+	dlg_assert(id < nodeCount());
+	return {pos_[0][id], pos_[1][id], pos_[2][id]};
+}
+
+Vec3f Cloth::velocity(std::size_t id) const {
+	dlg_assert(id < nodeCount());
+	return {vel_[0][id], vel_[1][id], vel_[2][id]};
+}
+
+} // namespace tkn
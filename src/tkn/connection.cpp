@@ -5,6 +5,7 @@
 #include <tkn/recvBuf.hpp>
 #include <dlg/dlg.hpp>
 #include <limits>
+#include <cstring>
 #include <cmath>
 #include <algorithm>
 #include <iostream>
@@ -117,7 +118,7 @@ MessageHeaderStatus ConnectionManager::processHeader(const MessageHeader& msg)
 		// ackBits are alwasy relative to the last seen package so we have to shift it
 		// shift to the left since the most significant bit is the oldest one whose
 		// bit is no longer needed
-		localAckBits_ <<= absSeqDiff;
+		localAckBits_ = (absSeqDiff < 32) ? localAckBits_ << absSeqDiff : 0u;
 		remoteSeq_ = msg.seq;
 
 		// make sure to set the localAck bit for the old latest ack (if possible)
@@ -129,11 +130,12 @@ MessageHeaderStatus ConnectionManager::processHeader(const MessageHeader& msg)
 		remoteAck_ = msg.ack;
 
 		// make sure to set the remoteAck bit for the old latest ack (if possible)
-		if(remoteAckDiff < remoteAckBits_.size())
-			remoteAckBits_ |= (1 << (remoteAckDiff - 1));
+		if(remoteAckDiff > 0 && remoteAckDiff <= remoteAckBits_.size())
+			remoteAckBits_.set(remoteAckDiff - 1);
 	} else { // i.e. old message
 		// update localAckBits if in range
-		localAckBits_ |= 1 << (absSeqDiff - 1);
+		if(absSeqDiff < 32)
+			localAckBits_ |= (1u << (absSeqDiff - 1));
 
 		// TODO: update remoteAckBits_ here as well?
 		// we might get new information from this old package
@@ -254,7 +256,8 @@ const std::vector<asio::const_buffer>& MessageManager::packages()
 
 	// function that writes the given data into the message buffer
 	// makes sure that there is enough space in the current fragment
-	auto write = [&](const auto* data, auto size) {
+	auto write = [&](const auto* src, auto size) {
+		auto data = reinterpret_cast<const std::byte*>(src);
 		auto remaining = size;
 		while(remaining != 0) {
 			// create new fragment if we reached its end
@@ -284,6 +287,7 @@ const std::vector<asio::const_buffer>& MessageManager::packages()
 
 			std::memcpy(ptr, data, size);
 			remaining -= size;
+			data += size;
 			ptr += size;
 		}
 	};
@@ -404,31 +408,57 @@ void MessageManager::updateCriticalMessages()
 	critical_.erase(critical_.begin(), it);
 }
 
+std::vector<std::byte> MessageManager::recvBuffer()
+{
+	std::vector<std::byte> ret;
+	if(!unusedPkgBuffers_.empty()) {
+		ret = std::move(unusedPkgBuffers_.back());
+		unusedPkgBuffers_.pop_back();
+	}
+
+	ret.resize(maxPackageSize);
+	return ret;
+}
+
 PackageStatus MessageManager::processPackage(asio::const_buffer buffer)
 {
-	dlg_tags("MessageManager", "processPackage");
+	auto data = asio::buffer_cast<const std::byte*>(buffer);
+	auto size = asio::buffer_size(buffer);
+	return processPackage({data, size}, nullptr);
+}
 
-	// utility
-	// the max raw package data size of the first fragment
-	constexpr auto firstDataSize = maxPackageSize - sizeof(MessageHeader) - 4;
+PackageStatus MessageManager::processPackage(std::vector<std::byte> buffer)
+{
+	auto ret = processPackage(buffer, &buffer);
 
-	// the max raw package data size of a non-first fragment
-	constexpr auto fragDataSize = maxPackageSize - sizeof(FragmentHeader) - 4;
+	// if the buffer wasn't retained as fragment, we can reuse it
+	if(buffer.capacity() > 0) {
+		poolPkgBuffer(std::move(buffer));
+	}
+
+	return ret;
+}
+
+PackageStatus MessageManager::processPackage(nytl::Span<const std::byte> package,
+		std::vector<std::byte>* owned)
+{
+	dlg_tags("MessageManager", "processPackage");
 
 	// check that it at least has the size of the smaller header and end magic
 	// for all first checks we only outputs info messages for invalid packages
 	// since they might simply come from something else and are not really
 	// an issue
-	auto size = asio::buffer_size(buffer);
+	auto size = package.size();
 	if(size < sizeof(FragmentHeader) + 4) {
 		dlg_info("invalid pkg: size {} too small", size);
 		return PackageStatus::invalid;
 	}
 
 	// check magic numbers
-	auto data = asio::buffer_cast<const std::byte*>(buffer);
-	auto beginMagic = *reinterpret_cast<const uint32_t*>(data);
-	auto endMagic = *reinterpret_cast<const uint32_t*>(data + size - 4);
+	auto data = package.data();
+	uint32_t beginMagic, endMagic;
+	std::memcpy(&beginMagic, data, sizeof(beginMagic));
+	std::memcpy(&endMagic, data + size - 4, sizeof(endMagic));
 
 	if(endMagic != magic::end && endMagic != magic::another) {
 		dlg_info("invalid pkg: invalid end magic value {}", endMagic);
@@ -438,115 +468,210 @@ PackageStatus MessageManager::processPackage(asio::const_buffer buffer)
 	// fragment handling variables
 	uint32_t seqid = 0u; // the sequence id the fragment belongs to (if it is an fragment)
 	uint32_t fragpart = 0u; // the part the fragment has
-	const MessageHeader* header = nullptr; // potential message header
+	MessageHeader header {}; // potential message header
 	const std::byte* dataBegin = nullptr; // raw data begin
 	const std::byte* dataEnd = (data + size) - 4; // raw data end
 
 	// check message header or fragment header
 	if(beginMagic == magic::message) {
-		header = reinterpret_cast<const MessageHeader*>(data);
+		if(size < sizeof(MessageHeader) + 4) {
+			dlg_info("invalid pkg: size {} too small for message header", size);
+			return PackageStatus::invalid;
+		}
+
+		std::memcpy(&header, data, sizeof(header));
 		if(endMagic == magic::end) {
 			// we received a single, non-fragmented message, yeay
 			// handle its header an pass it to handlePackageData
+			// directly, in place.
 			auto lastAck = remoteSeq_;
-			auto processed = processHeader(*header);
+			auto processed = processHeader(header);
 			if(processed != MessageHeaderStatus::valid) {
 				dlg_info("invalid pkg: processing sc message header failed: {}", name(processed));
 				return PackageStatus::invalid;
 			}
 
-			RecvBuf msgbuf {};
-			msgbuf.current = data + sizeof(MessageHeader);
-			msgbuf.end = data + size - 4; // exclude last magic
-
-			return handlePackageData(lastAck, header->seq, msgbuf) ?
+			auto msgBegin = data + sizeof(MessageHeader);
+			auto msgbuf = recvBuf(RecvChunk{msgBegin, std::size_t(dataEnd - msgBegin)});
+			return handlePackageData(lastAck, header.seq, msgbuf) ?
 				PackageStatus::message :
 				PackageStatus::invalidMessage;
 		}
 
 		// if it was only the first part of the fragmented message we wait with processing
 		// the header until all fragments part arrive (if they do)
-		seqid = header->seq;
+		seqid = header.seq;
 		fragpart = 0u; // first fragment
 		dataBegin = data + sizeof(MessageHeader);
 	} else if(beginMagic == magic::fragment) {
-		auto& header = *reinterpret_cast<const FragmentHeader*>(data);
-		seqid = header.seq;
-		fragpart = header.fragment;
+		FragmentHeader fheader;
+		std::memcpy(&fheader, data, sizeof(fheader));
+		seqid = fheader.seq;
+		fragpart = fheader.fragment;
 		dataBegin = data + sizeof(FragmentHeader);
+
+		if(fragpart == 0u) {
+			dlg_info("invalid pkg: fragment header with fragment number 0");
+			return PackageStatus::invalid;
+		}
 	} else {
 		dlg_info("invalid pkg: Invalid start magic value {}", beginMagic);
 		return PackageStatus::invalid;
 	}
 
+	if(fragpart >= maxFragmentCount) {
+		dlg_info("invalid pkg: fragment number {} too high", fragpart);
+		return PackageStatus::invalid;
+	}
+
+	// incomplete packages whose fragments got lost would otherwise
+	// stay forever
+	discardFragments(fragmentTimeout_);
+
 	// here we know that the package is part of a fragmented pkg
-	// find the upper bound, i.e. the place it would have in the sorted fragmented_ vector
+	// find the place it has in the sorted fragmented_ vector
 	// or otherwise the place it should be inserted to
-	FragmentedPackage dummy {};
-	dummy.header.seq = seqid;
-	auto fpkg = std::upper_bound(fragmented_.begin(), fragmented_.end(), dummy,
-		[](const auto& a, const auto& b) { return a.header.seq < b.header.seq; });
+	auto findPkg = [&]{
+		return std::lower_bound(fragmented_.begin(), fragmented_.end(), seqid,
+			[](const auto& pkg, uint32_t seq) { return pkg.seq < seq; });
+	};
+
+	auto fpkg = findPkg();
 
 	// check if fragmented already contains the given package, otherwise create it
-	// try to use an unused pkg buffer instead of allocating a new one
-	if(fpkg == fragmented_.end() || fpkg->header.seq != seqid) {
+	if(fpkg == fragmented_.end() || fpkg->seq != seqid) {
+		if(fragmented_.size() >= maxFragmentedPackages) {
+			auto oldest = std::min_element(fragmented_.begin(), fragmented_.end(),
+				[](auto& a, auto& b) { return a.firstSeen < b.firstSeen; });
+			dlg_debug("Discarding fragmented package {}, too many pending",
+				oldest->seq);
+			releaseFragments(*oldest);
+			fragmented_.erase(oldest);
+			fpkg = findPkg();
+		}
+
 		fpkg = fragmented_.emplace(fpkg);
 		fpkg->firstSeen = Clock::now();
-		if(!unusedPkgBuffers_.empty()) {
-			fpkg->data = std::move(unusedPkgBuffers_.back());
-			fpkg->data.clear();
-			unusedPkgBuffers_.pop_back();
+		fpkg->seq = seqid;
+	}
+
+	// the last fragment determines the number of fragments
+	if(endMagic == magic::end) {
+		if(fpkg->count != 0 && fpkg->count != fragpart + 1) {
+			dlg_info("invalid pkg: conflicting fragment count {} vs {}",
+				fpkg->count, fragpart + 1);
+			return PackageStatus::invalid;
+		}
+
+		// parts stored before that lie beyond the end make the
+		// whole package inconsistent
+		for(auto i = fragpart + 1; i < fpkg->fragments.size(); ++i) {
+			if(!fpkg->fragments[i].buffer.empty()) {
+				dlg_info("invalid pkg: fragment {} stored beyond end {}", i, fragpart);
+				releaseFragments(*fpkg);
+				fragmented_.erase(fpkg);
+				return PackageStatus::invalid;
+			}
 		}
+
+		fpkg->count = fragpart + 1;
+		fpkg->fragments.resize(fpkg->count);
+	} else if(fpkg->count != 0 && fragpart >= fpkg->count) {
+		dlg_info("invalid pkg: fragment {} beyond fragment count {}",
+			fragpart, fpkg->count);
+		return PackageStatus::invalid;
 	}
 
-	// set its header (if it is valid i.e. this package had one)
-	if(header) fpkg->header = *header;
+	if(fpkg->fragments.size() <= fragpart) {
+		fpkg->fragments.resize(fragpart + 1);
+	}
 
-	// the required size of fpkg->received
-	auto neededSize = fragpart;
-	if(endMagic == magic::another)
-		++neededSize;
+	auto& frag = fpkg->fragments[fragpart];
+	if(!frag.buffer.empty()) {
+		dlg_debug("fragment {} of {} already received", fragpart, seqid);
+		return PackageStatus::fragment;
+	}
 
-	// resize, store in received
-	if(fpkg->received.size() < neededSize)
-		fpkg->received.resize(neededSize, false);
-	fpkg->received[fragpart] = true;
+	// retain the package buffer. If we don't own it we have to copy
+	// it into a buffer from our pool.
+	auto offBegin = dataBegin - data;
+	auto offEnd = dataEnd - data;
+	if(owned) {
+		frag.buffer = std::move(*owned);
+		*owned = {};
+	} else {
+		if(!unusedPkgBuffers_.empty()) {
+			frag.buffer = std::move(unusedPkgBuffers_.back());
+			unusedPkgBuffers_.pop_back();
+		}
 
-	// make sure fpkg->data is large enough so that we can copy
-	// our data into it
-	auto prev = fragpart ? firstDataSize + (fragpart - 1) * fragDataSize : 0u;
-	auto bufferBegin = prev;
-	auto bufferEnd = static_cast<unsigned int>(dataEnd - dataBegin) + prev;
+		frag.buffer.assign(data, data + size);
+	}
 
-	if(fpkg->data.size() < bufferEnd)
-		fpkg->data.resize(neededSize);
+	frag.payloadBegin = offBegin;
+	frag.payloadEnd = offEnd;
+	if(fragpart == 0u) {
+		fpkg->header = header;
+	}
 
-	// TODO: do we have to make sure the fragment was not already received?
-	// copy the raw data into the buffer
-	std::memcpy(&fpkg->data[bufferBegin], dataBegin, dataEnd - dataBegin);
+	++fpkg->received;
+	if(fpkg->count == 0 || fpkg->received < fpkg->count) {
+		return PackageStatus::fragment;
+	}
 
-	// if the fragmented package is complete now, handle it
-	if(std::all_of(fpkg->received.begin(), fpkg->received.end(), [](auto b) { return b; })) {
-		// try to handle its header
-		auto lastAck = remoteSeq_;
-		auto processed = processHeader(fpkg->header);
-		if(processed != MessageHeaderStatus::valid) {
-			dlg_info("invalid pkg: processing frag message header failed: {}", name(processed));
-			return PackageStatus::invalid;
+	// the fragmented package is complete now, handle it.
+	// try to handle its header
+	// never hand out a package with missing parts
+	auto ret = PackageStatus::invalid;
+	auto complete = fpkg->fragments.size() == fpkg->count &&
+		std::all_of(fpkg->fragments.begin(), fpkg->fragments.end(),
+			[](const auto& frag) { return !frag.buffer.empty(); });
+	if(!complete) {
+		dlg_info("invalid pkg: fragmented package {} has missing parts", fpkg->seq);
+		releaseFragments(*fpkg);
+		fragmented_.erase(fpkg);
+		return ret;
+	}
+
+	auto lastAck = remoteSeq_;
+	auto processed = processHeader(fpkg->header);
+	if(processed != MessageHeaderStatus::valid) {
+		dlg_info("invalid pkg: processing frag message header failed: {}", name(processed));
+	} else {
+		// pass the fragment payloads in place
+		chunks_.clear();
+		for(auto& frag : fpkg->fragments) {
+			chunks_.push_back({frag.buffer.data() + frag.payloadBegin,
+				frag.payloadEnd - frag.payloadBegin});
 		}
 
-		RecvBuf buf {};
-		buf.current = fpkg->data.data();
-		buf.end = buf.current + fpkg->data.size();
-		auto ret = handlePackageData(lastAck, fpkg->header.seq, buf) ?
+		ret = handlePackageData(lastAck, fpkg->header.seq,
+			recvBuf(nytl::Span<const RecvChunk>(chunks_))) ?
 			PackageStatus::message :
 			PackageStatus::invalidMessage;
-		unusedPkgBuffers_.push_back(std::move(fpkg->data));
-		fragmented_.erase(fpkg);
-		return ret;
 	}
 
-	return PackageStatus::fragment;
+	releaseFragments(*fpkg);
+	fragmented_.erase(fpkg);
+	return ret;
+}
+
+void MessageManager::releaseFragments(FragmentedPackage& pkg)
+{
+	for(auto& frag : pkg.fragments) {
+		if(!frag.buffer.empty()) {
+			poolPkgBuffer(std::move(frag.buffer));
+		}
+	}
+
+	pkg.fragments.clear();
+}
+
+void MessageManager::poolPkgBuffer(std::vector<std::byte>&& buffer)
+{
+	if(unusedPkgBuffers_.size() < maxPooledPackageBuffers) {
+		unusedPkgBuffers_.push_back(std::move(buffer));
+	}
 }
 
 bool MessageManager::handlePackageData(uint32_t lastAck, uint32_t seqNumber, RecvBuf buffer)
@@ -573,7 +698,7 @@ bool MessageManager::handlePackageData(uint32_t lastAck, uint32_t seqNumber, Rec
 
 		// we read until the entire (!) package data is processed (without any paddings)
 		// or until something goes wrong
-		while(buffer.current < buffer.end) {
+		while(!empty(buffer)) {
 
 			// TODO: some group seq number validity check
 			// e.g. check the jump is not too high
@@ -590,7 +715,7 @@ bool MessageManager::handlePackageData(uint32_t lastAck, uint32_t seqNumber, Rec
 			groupSize = read<uint32_t>(buffer);
 
 			// check if given group size would exceed the overall package data size
-			if(groupSize == 0 || buffer.current + groupSize > buffer.end) {
+			if(groupSize == 0 || groupSize > size(buffer)) {
 				dlg_warn("invalid pkg: group size {} is too large", groupSize);
 				return false;
 			}
@@ -599,15 +724,16 @@ bool MessageManager::handlePackageData(uint32_t lastAck, uint32_t seqNumber, Rec
 			// now the knowledge of the groups size in bytes comes in really handy
 			if(lastAck - groupSeq < maxSeqDiff) {
 				dlg_debug("skipping already received group {}", groupSeq);
-				buffer.current += groupSize;
+				skip(buffer, groupSize);
 				continue;
 			}
 
 			// handle all messages in the group
-			auto groupBuffer = RecvBuf {buffer.current, buffer.current + groupSize};
-			while(groupBuffer.current < groupBuffer.end) {
+			// this already advances buffer behind the group
+			auto groupBuffer = sub(buffer, groupSize);
+			while(!empty(groupBuffer)) {
 				try {
-					auto before = groupBuffer.current;
+					auto before = size(groupBuffer);
 					auto ret = false;
 					ret = messageHandler_(groupSeq, groupBuffer);
 
@@ -617,27 +743,17 @@ bool MessageManager::handlePackageData(uint32_t lastAck, uint32_t seqNumber, Rec
 					}
 
 					// avoid infinite loop, message handler MUST advance buffer
-					if(before == groupBuffer.current) {
+					if(before == size(groupBuffer)) {
 						dlg_error("invalid messages handler did not advance buffer");
 						return false;
 					}
-				} catch(const RecvBufInvalid& err) {
+				} catch(const InvalidRecvBuf& err) {
 					dlg_warn("invalid pkg: messageHandler threw: {}", err.what());
 					return false;
 				}
 			}
-
-			// check that the groupBuffer was only advanced in its bounds
-			if(groupBuffer.current > groupBuffer.end) {
-				dlg_error("message group buffer advanced too far");
-				return false;
-			}
-
-			// apply the advance of the message group to the data buffer
-			buffer.current = groupBuffer.current;
-
 		}
-	} catch(const RecvBufOutOfRange& err) {
+	} catch(const OutOfRangeRecvBuf& err) {
 		// this extra catch is only for our own code above, the
 		// message handler has its own try/catch
 		// if we land here some assumption about the anatomy of
@@ -646,12 +762,6 @@ bool MessageManager::handlePackageData(uint32_t lastAck, uint32_t seqNumber, Rec
 		return false;
 	}
 
-	// check that buffer was only advanced in bounds
-	if(buffer.current > buffer.end) {
-		dlg_error("pkg buffer advanced too far");
-		return false;
-	}
-
 	return true;
 }
 
@@ -677,12 +787,21 @@ unsigned int MessageManager::discardFragments(Clock::duration age)
 {
 	auto prev = fragmented_.size();
 	auto now = Clock::now();
-	std::remove_if(fragmented_.begin(), fragmented_.end(), [&](const auto& pkg) {
-		return (now - pkg.firstSeen) >= age;
+	auto it = std::remove_if(fragmented_.begin(), fragmented_.end(), [&](auto& pkg) {
+		if((now - pkg.firstSeen) >= age) {
+			releaseFragments(pkg);
+			return true;
+		}
+
+		return false;
 	});
 
-	auto ret = fragmented_.size() - prev;
-	dlg_debug("Discarding {} fragmented packages", ret);
+	fragmented_.erase(it, fragmented_.end());
+	auto ret = prev - fragmented_.size();
+	if(ret > 0) {
+		dlg_debug("Discarding {} fragmented packages", ret);
+	}
+
 	return ret;
 }
 
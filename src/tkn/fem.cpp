@@ -0,0 +1,569 @@
+#include <tkn/fem.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace tkn {
+namespace {
+
+// Number of vector entries (or matrix rows) per parallelFor range.
+// Reductions sum the ranges in a fixed order, the results therefore
+// don't depend on the number of threads.
+constexpr auto vecGrain = 4 * 1024u;
+
+// Number of elements per parallelFor range in the assembly.
+constexpr auto elemGrain = 512u;
+
+// Sums func(begin, end) over the vector ranges of [0, count).
+template<typename F>
+double reduce(ThreadPool& pool, std::size_t count, F&& func) {
+	std::vector<double> partial((count + vecGrain - 1) / vecGrain);
+	parallelFor(pool, count, vecGrain, [&](auto begin, auto end) {
+		partial[begin / vecGrain] = func(begin, end);
+	});
+
+	auto sum = 0.0;
+	for(auto p : partial) {
+		sum += p;
+	}
+
+	return sum;
+}
+
+// Rows of the 2D linear elasticity matrix (plane strain), relating
+// strain and stress in voigt notation.
+std::array<float, 9> elasticity(float E, float nu) {
+	dlg_assert(nu >= 0.f && nu < 0.5f);
+	auto fac = E / ((1 + nu) * (1 - 2 * nu));
+	auto a = fac * (1 - nu);
+	auto b = fac * nu;
+	auto c = fac * 0.5f * (1 - 2 * nu);
+	return {
+		a, b, 0.f,
+		b, a, 0.f,
+		0.f, 0.f, c,
+	};
+}
+
+} // anon namespace
+
+void multiply(const CsrMatrix& A, nytl::Span<const float> x,
+		nytl::Span<float> y, ThreadPool* pool) {
+	dlg_assert(x.size() >= A.rows && y.size() >= A.rows);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	parallelFor(*pool, A.rows, vecGrain, [&](auto begin, auto end) {
+		for(auto r = begin; r < end; ++r) {
+			auto sum = 0.f;
+			for(auto i = A.rowStart[r]; i < A.rowStart[r + 1]; ++i) {
+				sum += A.values[i] * x[A.cols[i]];
+			}
+			y[r] = sum;
+		}
+	});
+}
+
+PcgResult solvePcg(const CsrMatrix& A, nytl::Span<const float> b,
+		nytl::Span<float> x, unsigned maxIterations, float tolerance,
+		ThreadPool* pool) {
+	auto n = std::size_t(A.rows);
+	dlg_assert(b.size() >= n && x.size() >= n);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	auto bnorm = std::sqrt(reduce(*pool, n, [&](auto begin, auto end) {
+		auto sum = 0.0;
+		for(auto i = begin; i < end; ++i) {
+			sum += double(b[i]) * b[i];
+		}
+		return sum;
+	}));
+
+	if(bnorm == 0.0) {
+		std::fill(x.begin(), x.begin() + n, 0.f);
+		return {0u, 0.f};
+	}
+
+	std::vector<float> r(n), z(n), p(n), q(n), invDiag(n);
+	multiply(A, x, r, pool);
+
+	auto rz = reduce(*pool, n, [&](auto begin, auto end) {
+		auto sum = 0.0;
+		for(auto i = begin; i < end; ++i) {
+			auto row = A.cols.begin() + A.rowStart[i];
+			auto rowEnd = A.cols.begin() + A.rowStart[i + 1];
+			auto it = std::lower_bound(row, rowEnd, u32(i));
+			dlg_assert(it != rowEnd && *it == i);
+			auto diag = A.values[it - A.cols.begin()];
+			dlg_assert(diag > 0.f);
+
+			invDiag[i] = 1.f / diag;
+			r[i] = b[i] - r[i];
+			z[i] = invDiag[i] * r[i];
+			p[i] = z[i];
+			sum += double(r[i]) * z[i];
+		}
+		return sum;
+	});
+
+	PcgResult res;
+	auto rnorm = std::sqrt(reduce(*pool, n, [&](auto begin, auto end) {
+		auto sum = 0.0;
+		for(auto i = begin; i < end; ++i) {
+			sum += double(r[i]) * r[i];
+		}
+		return sum;
+	}));
+
+	while(rnorm > tolerance * bnorm && res.iterations < maxIterations) {
+		// q = A * p, fused with the p * q product
+		auto pq = reduce(*pool, n, [&](auto begin, auto end) {
+			auto sum = 0.0;
+			for(auto row = begin; row < end; ++row) {
+				auto val = 0.f;
+				for(auto i = A.rowStart[row]; i < A.rowStart[row + 1]; ++i) {
+					val += A.values[i] * p[A.cols[i]];
+				}
+				q[row] = val;
+				sum += double(p[row]) * val;
+			}
+			return sum;
+		});
+
+		dlg_assert(pq > 0.0);
+		auto alpha = float(rz / pq);
+
+		// update solution and residual
+		auto rr = 0.0;
+		auto rzNew = 0.0;
+		auto nRanges = (n + vecGrain - 1) / vecGrain;
+		std::vector<std::array<double, 2>> partial(nRanges);
+		parallelFor(*pool, n, vecGrain, [&](auto begin, auto end) {
+			auto srr = 0.0;
+			auto srz = 0.0;
+			for(auto i = begin; i < end; ++i) {
+				x[i] += alpha * p[i];
+				r[i] -= alpha * q[i];
+				z[i] = invDiag[i] * r[i];
+				srr += double(r[i]) * r[i];
+				srz += double(r[i]) * z[i];
+			}
+			partial[begin / vecGrain] = {srr, srz};
+		});
+
+		for(auto& part : partial) {
+			rr += part[0];
+			rzNew += part[1];
+		}
+
+		auto beta = float(rzNew / rz);
+		rz = rzNew;
+		rnorm = std::sqrt(rr);
+		++res.iterations;
+
+		parallelFor(*pool, n, vecGrain, [&](auto begin, auto end) {
+			for(auto i = begin; i < end; ++i) {
+				p[i] = z[i] + beta * p[i];
+			}
+		});
+	}
+
+	res.residual = float(rnorm / bnorm);
+	return res;
+}
+
+nytl::Mat2f polarRotation(const nytl::Mat2f& F) {
+	// The rotation angle maximizes tr(R^T F), i.e. for R = (c, -s; s, c)
+	// it is given by (c, s) ~ (F00 + F11, F10 - F01).
+	auto c = F[0][0] + F[1][1];
+	auto s = F[1][0] - F[0][1];
+	auto len = std::sqrt(c * c + s * s);
+	if(len < 1e-20f) {
+		return nytl::Mat2f{1.f, 0.f, 0.f, 1.f};
+	}
+
+	c /= len;
+	s /= len;
+	return nytl::Mat2f{c, -s, s, c};
+}
+
+// FemBody
+FemBody FemBody::grid(unsigned width, unsigned height, float spacing,
+		const FemParams& params) {
+	dlg_assert(width >= 2 && height >= 2);
+	std::vector<Vec2f> positions;
+	positions.reserve(width * height);
+	for(auto y = 0u; y < height; ++y) {
+		for(auto x = 0u; x < width; ++x) {
+			positions.push_back({spacing * x, spacing * y});
+		}
+	}
+
+	std::vector<Triangle> triangles;
+	triangles.reserve(2 * (width - 1) * (height - 1));
+	for(auto y = 0u; y + 1 < height; ++y) {
+		for(auto x = 0u; x + 1 < width; ++x) {
+			auto id = y * width + x;
+			triangles.push_back({id, id + 1, id + width + 1});
+			triangles.push_back({id, id + width + 1, id + width});
+		}
+	}
+
+	return {std::move(positions), std::move(triangles), params};
+}
+
+FemBody::FemBody(std::vector<Vec2f> rest, std::vector<Triangle> triangles,
+		const FemParams& xparams) : params(xparams), rest_(std::move(rest)),
+			triangles_(std::move(triangles)) {
+	auto n = rest_.size();
+	u_.resize(n);
+	v_.resize(n);
+	fixed_.resize(n);
+
+	elements_.resize(triangles_.size());
+	for(auto i = 0u; i < triangles_.size(); ++i) {
+		for(auto id : triangles_[i]) {
+			dlg_assert(id < n);
+		}
+		elements_[i].nodes = triangles_[i];
+	}
+
+	colorElements();
+	initSystem();
+	updateMaterial();
+}
+
+void FemBody::colorElements() {
+	// greedy: first color not used by any element sharing a node.
+	// The used colors of every node as bitset, grown as needed: a node
+	// can be shared by any number of elements.
+	std::vector<std::vector<u64>> used(rest_.size());
+	std::vector<unsigned> colors(elements_.size());
+	auto count = 0u;
+	for(auto i = 0u; i < elements_.size(); ++i) {
+		auto& nodes = elements_[i].nodes;
+		auto color = 0u;
+		for(auto w = 0u; ; ++w) {
+			auto mask = u64(0);
+			for(auto id : nodes) {
+				mask |= (w < used[id].size()) ? used[id][w] : u64(0);
+			}
+
+			if(mask != ~u64(0)) {
+				color = 64 * w;
+				while(mask & (u64(1) << (color % 64))) {
+					++color;
+				}
+				break;
+			}
+		}
+
+		colors[i] = color;
+		count = std::max(count, color + 1);
+		for(auto id : nodes) {
+			auto& bits = used[id];
+			if(bits.size() <= color / 64) {
+				bits.resize(color / 64 + 1, u64(0));
+			}
+			bits[color / 64] |= u64(1) << (color % 64);
+		}
+	}
+
+	// sort by color
+	colorStart_.assign(count + 1, 0u);
+	for(auto color : colors) {
+		++colorStart_[color + 1];
+	}
+
+	for(auto c = 0u; c < count; ++c) {
+		colorStart_[c + 1] += colorStart_[c];
+	}
+
+	auto offsets = colorStart_;
+	std::vector<Element> sorted(elements_.size());
+	for(auto i = 0u; i < elements_.size(); ++i) {
+		sorted[offsets[colors[i]]++] = elements_[i];
+	}
+
+	elements_ = std::move(sorted);
+}
+
+void FemBody::initSystem() {
+	// sorted neighbors of every node, including itself
+	auto n = rest_.size();
+	std::vector<std::vector<u32>> adj(n);
+	for(auto& elem : elements_) {
+		for(auto a : elem.nodes) {
+			adj[a].insert(adj[a].end(), elem.nodes.begin(), elem.nodes.end());
+		}
+	}
+
+	for(auto a = 0u; a < n; ++a) {
+		adj[a].push_back(a); // for isolated nodes
+		std::sort(adj[a].begin(), adj[a].end());
+		adj[a].erase(std::unique(adj[a].begin(), adj[a].end()), adj[a].end());
+	}
+
+	// both rows of a node have the same columns: the two dimensions of
+	// all its neighbors
+	system_.rows = unsigned(2 * n);
+	system_.rowStart.resize(2 * n + 1);
+	system_.cols.clear();
+	system_.rowStart[0] = 0u;
+	for(auto a = 0u; a < n; ++a) {
+		for(auto r = 0u; r < 2u; ++r) {
+			for(auto b : adj[a]) {
+				system_.cols.push_back(2 * b);
+				system_.cols.push_back(2 * b + 1);
+			}
+			system_.rowStart[2 * a + r + 1] = u32(system_.cols.size());
+		}
+	}
+
+	system_.values.resize(system_.cols.size());
+
+	auto block = [&](u32 a, u32 b) {
+		auto it = std::lower_bound(adj[a].begin(), adj[a].end(), b);
+		dlg_assert(it != adj[a].end() && *it == b);
+		return u32(system_.rowStart[2 * a] + 2 * (it - adj[a].begin()));
+	};
+
+	diag_.resize(n);
+	for(auto a = 0u; a < n; ++a) {
+		diag_[a] = block(a, a);
+	}
+
+	for(auto& elem : elements_) {
+		for(auto i = 0u; i < 3u; ++i) {
+			for(auto j = 0u; j < 3u; ++j) {
+				elem.blocks[i * 3 + j] = block(elem.nodes[i], elem.nodes[j]);
+			}
+		}
+	}
+
+	rhs_.resize(2 * n);
+	dv_.resize(2 * n);
+}
+
+void FemBody::updateMaterial() {
+	auto D = elasticity(params.youngsModulus, params.poissonRatio);
+	mass_.assign(rest_.size(), 0.f);
+
+	for(auto& elem : elements_) {
+		auto& a = rest_[elem.nodes[0]];
+		auto& b = rest_[elem.nodes[1]];
+		auto& c = rest_[elem.nodes[2]];
+
+		auto e1 = b - a;
+		auto e2 = c - a;
+		auto det = e1.x * e2.y - e1.y * e2.x;
+		dlg_assertm(det > 0.f, "Degenerate or clockwise triangle");
+		elem.area = 0.5f * det;
+
+		// inverse of the rest edge matrix (e1, e2)
+		auto invDet = 1.f / det;
+		elem.dmInv = {
+			invDet * e2.y, -invDet * e2.x,
+			-invDet * e1.y, invDet * e1.x,
+		};
+
+		// Derivatives of the linear shape functions (barycentric
+		// coordinates), constant over the triangle.
+		std::array<float, 3> nx = {
+			(b.y - c.y) * invDet, (c.y - a.y) * invDet, (a.y - b.y) * invDet};
+		std::array<float, 3> ny = {
+			(c.x - b.x) * invDet, (a.x - c.x) * invDet, (b.x - a.x) * invDet};
+
+		// strain-displacement matrix, 3x6
+		std::array<float, 18> B {};
+		for(auto i = 0u; i < 3u; ++i) {
+			B[0 * 6 + 2 * i] = nx[i];
+			B[1 * 6 + 2 * i + 1] = ny[i];
+			B[2 * 6 + 2 * i] = ny[i];
+			B[2 * 6 + 2 * i + 1] = nx[i];
+		}
+
+		// K = area * B^T * D * B
+		std::array<float, 18> DB {};
+		for(auto r = 0u; r < 3u; ++r) {
+			for(auto col = 0u; col < 6u; ++col) {
+				for(auto k = 0u; k < 3u; ++k) {
+					DB[r * 6 + col] += D[r * 3 + k] * B[k * 6 + col];
+				}
+			}
+		}
+
+		for(auto r = 0u; r < 6u; ++r) {
+			for(auto col = 0u; col < 6u; ++col) {
+				auto sum = 0.f;
+				for(auto k = 0u; k < 3u; ++k) {
+					sum += B[k * 6 + r] * DB[k * 6 + col];
+				}
+				elem.K[r * 6 + col] = elem.area * sum;
+			}
+		}
+
+		// lumped mass
+		for(auto id : elem.nodes) {
+			mass_[id] += params.density * elem.area / 3.f;
+		}
+	}
+}
+
+void FemBody::fix(u32 node, bool fixed) {
+	dlg_assert(node < rest_.size());
+	fixed_[node] = fixed;
+	if(fixed) {
+		v_[node] = {};
+	}
+}
+
+void FemBody::step(float dt, ThreadPool* pool) {
+	dlg_assert(dt > 0.f);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	auto n = rest_.size();
+	auto& values = system_.values;
+	auto& rowStart = system_.rowStart;
+
+	parallelFor(*pool, values.size(), 16 * vecGrain, [&](auto begin, auto end) {
+		std::fill(values.begin() + begin, values.begin() + end, 0.f);
+	});
+
+	// node terms: mass, damping, gravity
+	parallelFor(*pool, n, vecGrain, [&](auto begin, auto end) {
+		for(auto a = begin; a < end; ++a) {
+			auto m = mass_[a];
+			auto rowLen = rowStart[2 * a + 1] - rowStart[2 * a];
+			auto d = diag_[a];
+			if(fixed_[a]) {
+				values[d] += m;
+				values[d + rowLen + 1] += m;
+				rhs_[2 * a] = rhs_[2 * a + 1] = 0.f;
+				continue;
+			}
+
+			auto diag = m * (1 + dt * params.damping);
+			values[d] += diag;
+			values[d + rowLen + 1] += diag;
+			auto f = m * (params.gravity - params.damping * v_[a]);
+			rhs_[2 * a] = dt * f.x;
+			rhs_[2 * a + 1] = dt * f.y;
+		}
+	});
+
+	// element terms
+	auto dt2 = dt * dt;
+	for(auto c = 0u; c < colorCount(); ++c) {
+		auto first = colorStart_[c];
+		auto count = colorStart_[c + 1] - first;
+		parallelFor(*pool, count, elemGrain, [&](auto begin, auto end) {
+			for(auto e = first + begin; e < first + end; ++e) {
+				auto& elem = elements_[e];
+				std::array<Vec2f, 3> x;
+				for(auto i = 0u; i < 3u; ++i) {
+					x[i] = position(elem.nodes[i]);
+				}
+
+				// deformation gradient F = Ds * Dm^-1
+				auto e1 = x[1] - x[0];
+				auto e2 = x[2] - x[0];
+				auto& dm = elem.dmInv;
+				auto F = nytl::Mat2f{
+					e1.x * dm[0] + e2.x * dm[2], e1.x * dm[1] + e2.x * dm[3],
+					e1.y * dm[0] + e2.y * dm[2], e1.y * dm[1] + e2.y * dm[3],
+				};
+
+				auto R = polarRotation(F);
+				auto rc = R[0][0];
+				auto rs = R[1][0];
+
+				// The element force is f = -R K (R^T x - x0) and its
+				// derivative (ignoring the change of R) -R K R^T.
+				// rhs: dt * (f - dt * R K R^T v) = -dt R K (R^T (x + dt v) - x0)
+				std::array<float, 6> w;
+				for(auto i = 0u; i < 3u; ++i) {
+					auto p = x[i] + dt * v_[elem.nodes[i]];
+					auto& r = rest_[elem.nodes[i]];
+					w[2 * i] = rc * p.x + rs * p.y - r.x;
+					w[2 * i + 1] = -rs * p.x + rc * p.y - r.y;
+				}
+
+				for(auto i = 0u; i < 3u; ++i) {
+					auto a = elem.nodes[i];
+					if(fixed_[a]) {
+						continue;
+					}
+
+					auto gx = 0.f;
+					auto gy = 0.f;
+					for(auto k = 0u; k < 6u; ++k) {
+						gx += elem.K[(2 * i) * 6 + k] * w[k];
+						gy += elem.K[(2 * i + 1) * 6 + k] * w[k];
+					}
+
+					rhs_[2 * a] -= dt * (rc * gx - rs * gy);
+					rhs_[2 * a + 1] -= dt * (rs * gx + rc * gy);
+				}
+
+				// system matrix blocks dt^2 * R K_ij R^T
+				for(auto i = 0u; i < 3u; ++i) {
+					auto a = elem.nodes[i];
+					auto rowLen = rowStart[2 * a + 1] - rowStart[2 * a];
+					for(auto j = 0u; j < 3u; ++j) {
+						if(i != j && (fixed_[a] || fixed_[elem.nodes[j]])) {
+							continue;
+						}
+
+						auto k00 = elem.K[(2 * i) * 6 + 2 * j];
+						auto k01 = elem.K[(2 * i) * 6 + 2 * j + 1];
+						auto k10 = elem.K[(2 * i + 1) * 6 + 2 * j];
+						auto k11 = elem.K[(2 * i + 1) * 6 + 2 * j + 1];
+
+						// M = K_ij R^T
+						auto m00 = k00 * rc - k01 * rs;
+						auto m01 = k00 * rs + k01 * rc;
+						auto m10 = k10 * rc - k11 * rs;
+						auto m11 = k10 * rs + k11 * rc;
+
+						auto idx = elem.blocks[i * 3 + j];
+						values[idx] += dt2 * (rc * m00 - rs * m10);
+						values[idx + 1] += dt2 * (rc * m01 - rs * m11);
+						values[idx + rowLen] += dt2 * (rs * m00 + rc * m10);
+						values[idx + rowLen + 1] += dt2 * (rs * m01 + rc * m11);
+					}
+				}
+			}
+		});
+	}
+
+	// The last change in velocity is a good initial guess
+	for(auto a = 0u; a < n; ++a) {
+		if(fixed_[a]) {
+			dv_[2 * a] = dv_[2 * a + 1] = 0.f;
+		}
+	}
+
+	lastSolve_ = solvePcg(system_, rhs_, dv_, params.maxIterations,
+		params.tolerance, pool);
+
+	parallelFor(*pool, n, vecGrain, [&](auto begin, auto end) {
+		for(auto a = begin; a < end; ++a) {
+			if(fixed_[a]) {
+				v_[a] = {};
+				continue;
+			}
+
+			v_[a] += Vec2f{dv_[2 * a], dv_[2 * a + 1]};
+			u_[a] += dt * v_[a];
+		}
+	});
+}
+
+} // namespace tkn
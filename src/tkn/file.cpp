@@ -0,0 +1,74 @@
+#include <tkn/file.hpp>
+#include <tkn/config.hpp>
+#include <filesystem>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#ifdef TKN_LINUX
+	#include <unistd.h>
+#elif defined(_WIN32)
+	#include <process.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace tkn {
+namespace {
+
+// Identifies this process in the names of temporary files.
+unsigned long long processID() {
+#ifdef TKN_LINUX
+	return getpid();
+#elif defined(_WIN32)
+	return _getpid();
+#else
+	static const auto id = std::chrono::steady_clock::now().time_since_epoch().count();
+	return id;
+#endif
+}
+
+} // anon namespace
+
+bool replaceFile(nytl::StringParam cpath, std::string_view data,
+		std::error_code& ec) {
+	static std::atomic<unsigned> counter {};
+
+	ec = {};
+	auto path = fs::u8path(cpath.c_str());
+	auto tmp = path;
+	tmp += ".tmp.";
+	tmp += std::to_string(processID());
+	tmp += '.';
+	tmp += std::to_string(counter.fetch_add(1u));
+
+	if(path.has_parent_path()) {
+		fs::create_directories(path.parent_path(), ec);
+		if(ec) {
+			return false;
+		}
+	}
+
+	{
+		std::ofstream ofs(tmp, std::ios::binary);
+		ofs.write(data.data(), data.size());
+		if(!ofs) {
+			ec = std::make_error_code(std::errc::io_error);
+		}
+	}
+
+	if(!ec) {
+		fs::rename(tmp, path, ec);
+	}
+
+	if(ec) {
+		std::error_code rec;
+		fs::remove(tmp, rec);
+		return false;
+	}
+
+	return true;
+}
+
+} // namespace tkn
@@ -0,0 +1,77 @@
+#include <tkn/fswatch.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+
+// Platform-independent part of the FileWatcher, see fswatch_inotify.cpp
+// and fswatch_stdfs.cpp for the watcher threads.
+
+namespace tkn {
+
+void FileWatcher::pushBatch(std::vector<std::uint64_t> ids) {
+	if(ids.empty()) {
+		return;
+	}
+
+	auto lock = std::lock_guard(mutex_);
+	pending_.insert(pending_.end(), ids.begin(), ids.end());
+	hasPending_.store(true, std::memory_order_release);
+}
+
+void FileWatcher::update() {
+	if(!hasPending_.load(std::memory_order_acquire)) {
+		return;
+	}
+
+	std::vector<std::uint64_t> batch;
+
+	{
+		auto lock = std::lock_guard(mutex_);
+		batch = std::move(pending_);
+		pending_.clear();
+		hasPending_.store(false, std::memory_order_relaxed);
+	}
+
+	// multiple batches might have been pushed since the last update
+	std::sort(batch.begin(), batch.end());
+	batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+
+	dlg_debug("FileWatcher: {} watches changed", batch.size());
+	changed_.insert(batch.begin(), batch.end());
+	++batchCount_;
+
+	// callbacks might remove themselves
+	auto callbacks = callbacks_;
+	for(auto& [id, callback] : callbacks) {
+		callback(batch);
+	}
+}
+
+bool FileWatcher::check(std::uint64_t id) {
+	auto it = changed_.find(id);
+	if(it == changed_.end()) {
+		return false;
+	}
+
+	changed_.erase(it);
+	return true;
+}
+
+std::uint64_t FileWatcher::onChange(Callback callback) {
+	dlg_assert(callback);
+	auto id = ++lastCallbackID_;
+	callbacks_.emplace_back(id, std::move(callback));
+	return id;
+}
+
+void FileWatcher::removeCallback(std::uint64_t id) {
+	auto it = std::find_if(callbacks_.begin(), callbacks_.end(),
+		[&](auto& cb) { return cb.first == id; });
+	if(it == callbacks_.end()) {
+		dlg_warn("Could not remove FileWatcher callback, invalid id {}", id);
+		return;
+	}
+
+	callbacks_.erase(it);
+}
+
+} // namespace tkn
@@ -1,8 +1,11 @@
 #include <tkn/fswatch.hpp>
 #include <dlg/dlg.hpp>
 #include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <unordered_set>
 #include <unordered_map>
+#include <thread>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
@@ -11,38 +14,218 @@ namespace tkn {
 
 constexpr auto inotifyMask = IN_MODIFY | IN_MOVED_FROM;
 
+// How often we try to re-add watches of removed files.
+constexpr auto lostRetryInterval = std::chrono::milliseconds(100);
+
 struct FileWatcher::Impl {
 	struct Entry {
 		std::string path;
 		std::unordered_set<std::uint64_t> ids;
 	};
 
-	int inotify;
-	std::unordered_set<std::uint64_t> changed;
-	std::unordered_map<unsigned, Entry> entries;
+	int inotify {-1};
+	int wakePipe[2] {-1, -1}; // written to stop the thread
+
+	// Guards entries and lost, accessed by the thread.
+	std::mutex mutex;
+	std::unordered_map<int, Entry> entries;
+	// Entries whose file was removed (e.g. by editors replacing
+	// the file) and could not be re-added yet.
+	std::vector<Entry> lost;
 	std::uint64_t lastID {};
+
+	std::thread thread;
 };
 
-FileWatcher::FileWatcher() {
+namespace {
+
+int addWatch(int inotify, const std::string& path) {
+	return inotify_add_watch(inotify, path.c_str(), inotifyMask);
+}
+
+} // anon namespace
+
+FileWatcher::FileWatcher(std::chrono::milliseconds debounce) :
+		debounce_(debounce) {
 	impl_ = std::make_unique<Impl>();
 	impl_->inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
 	if(impl_->inotify < 0) {
 		dlg_error("Failed to init inotify: {} ({})", std::strerror(errno), errno);
 		return;
 	}
+
+	if(pipe2(impl_->wakePipe, O_CLOEXEC) != 0) {
+		dlg_error("Failed to create pipe: {} ({})", std::strerror(errno), errno);
+		close(impl_->inotify);
+		impl_->inotify = -1;
+		return;
+	}
+
+	impl_->thread = std::thread([this]{
+		using Clock = std::chrono::steady_clock;
+		auto& impl = *impl_;
+
+		std::unordered_set<std::uint64_t> changed;
+		auto lastEvent = Clock::now();
+		auto lastRetry = Clock::now();
+
+		// Tries to re-add all lost watches. Expects impl.mutex to be locked.
+		// Re-added watches are reported as changed (if not already pending)
+		// since the file was (re-)created after the watch was lost.
+		auto retryLost = [&]{
+			lastRetry = Clock::now();
+			for(auto it = impl.lost.begin(); it != impl.lost.end();) {
+				int wd = addWatch(impl.inotify, it->path);
+				if(wd < 0) {
+					dlg_debug("Failed to (re-)add inotify watcher for '{}': {} ({})",
+						it->path, std::strerror(errno), errno);
+					++it;
+					continue;
+				}
+
+				// The file might have been replaced by one we
+				// already watch (e.g. via another path).
+				auto& entry = impl.entries[wd];
+				entry.path = std::move(it->path);
+				for(auto id : it->ids) {
+					entry.ids.insert(id);
+					if(changed.insert(id).second) {
+						lastEvent = Clock::now();
+					}
+				}
+
+				it = impl.lost.erase(it);
+			}
+		};
+
+		while(true) {
+			// Wait indefinitely when nothing is pending, otherwise
+			// until the debounce duration has passed since the last event
+			// or lost watches should be retried.
+			auto timeout = -1;
+			auto waitUntil = [&](Clock::time_point point) {
+				auto left = point - Clock::now();
+				auto ms = std::chrono::ceil<std::chrono::milliseconds>(left);
+				auto t = std::max<int>(ms.count(), 0);
+				timeout = (timeout < 0) ? t : std::min(timeout, t);
+			};
+
+			if(!changed.empty()) {
+				waitUntil(lastEvent + debounce_);
+			}
+
+			bool hasLost;
+			{
+				auto lock = std::lock_guard(impl.mutex);
+				hasLost = !impl.lost.empty();
+			}
+
+			if(hasLost) {
+				waitUntil(lastRetry + lostRetryInterval);
+			}
+
+			pollfd fds[2] {
+				{impl.inotify, POLLIN, 0},
+				{impl.wakePipe[0], POLLIN, 0},
+			};
+
+			auto res = poll(fds, 2, timeout);
+			if(res < 0 && errno != EINTR) {
+				dlg_error("poll: {} ({})", std::strerror(errno), errno);
+				break;
+			}
+
+			if(fds[1].revents) {
+				break;
+			}
+
+			if(fds[0].revents & POLLIN) {
+				alignas(inotify_event) char buffer[4096];
+				ssize_t nr;
+				size_t n;
+
+				auto lock = std::lock_guard(impl.mutex);
+				while((nr = read(impl.inotify, buffer, sizeof(buffer))) > 0) {
+					for(char* p = buffer; p < buffer + nr; p += n) {
+						auto* ev = reinterpret_cast<inotify_event*>(p);
+						n = sizeof(inotify_event) + ev->len;
+
+						auto it = impl.entries.find(ev->wd);
+						if(it == impl.entries.end()) {
+							// This might happen when there were pending events
+							// after it got destroyed. Just ignoring it should not
+							// give any trouble.
+							// When the mask is only IGNORED, it just means that
+							// this watchdog was removed, this is a normal case.
+							if(ev->mask != IN_IGNORED) {
+								dlg_info("Receieved inotify event for unknown watchdog");
+							}
+							continue;
+						}
+
+						auto& entry = it->second;
+						changed.insert(entry.ids.begin(), entry.ids.end());
+						lastEvent = Clock::now();
+						dlg_debug("Detected that file '{}' changed", entry.path);
+
+						// Some editors delete the file instead of just writing it.
+						// In that case our watch got destroyed and we have to
+						// recreate it. The new file might not exist yet, we
+						// try again when the batch is finished and then
+						// periodically until it exists.
+						if(ev->mask & IN_IGNORED) {
+							impl.lost.push_back(std::move(entry));
+							impl.entries.erase(it);
+						}
+					}
+				}
+			}
+
+			// The lost watches are retried before flushing a batch, so that
+			// changes directly after it are not missed, and periodically.
+			auto now = Clock::now();
+			auto flush = !changed.empty() && now - lastEvent >= debounce_;
+			if(flush || now - lastRetry >= lostRetryInterval) {
+				auto lock = std::lock_guard(impl.mutex);
+				if(!impl.lost.empty()) {
+					retryLost();
+				}
+			}
+
+			// no further event during the debounce duration: flush
+			if(changed.empty() || Clock::now() - lastEvent < debounce_) {
+				continue;
+			}
+
+			pushBatch({changed.begin(), changed.end()});
+			changed.clear();
+		}
+	});
 }
 
-// TODO: close fd!
-FileWatcher::~FileWatcher() = default;
+FileWatcher::~FileWatcher() {
+	if(impl_->thread.joinable()) {
+		char c = 0;
+		while(write(impl_->wakePipe[1], &c, 1) < 0 && errno == EINTR);
+		impl_->thread.join();
+	}
+
+	for(auto fd : {impl_->inotify, impl_->wakePipe[0], impl_->wakePipe[1]}) {
+		if(fd >= 0) {
+			close(fd);
+		}
+	}
+}
 
 // TODO: check if already existent, add dummy alias id.
 std::uint64_t FileWatcher::watch(nytl::StringParam path) {
-	if(!impl_ || !impl_->inotify) {
+	if(impl_->inotify < 0) {
 		dlg_warn("inotify not initialized");
 		return 0u;
 	}
 
-	int wd = inotify_add_watch(impl_->inotify, path.c_str(), inotifyMask);
+	auto lock = std::lock_guard(impl_->mutex);
+	int wd = addWatch(impl_->inotify, path.c_str());
 	if(wd < 0) {
 		dlg_error("Failed to add inotify watcher for '{}': {} ({})",
 			path, std::strerror(errno), errno);
@@ -57,19 +240,17 @@ std::uint64_t FileWatcher::watch(nytl::StringParam path) {
 }
 
 void FileWatcher::unregsiter(std::uint64_t id) {
-	if(!impl_ || !impl_->inotify) {
+	if(impl_->inotify < 0) {
 		return;
 	}
 
+	changed_.erase(id);
+
 	// TODO: this is really inefficient
+	auto lock = std::lock_guard(impl_->mutex);
 	for(auto it = impl_->entries.begin(); it != impl_->entries.end(); ++it) {
 		auto& ids = it->second.ids;
 		if(auto idIt = ids.find(id); idIt != ids.end()) {
-			auto changedIt = impl_->changed.find(id);
-			if(changedIt != impl_->changed.end()) {
-				impl_->changed.erase(changedIt);
-			}
-
 			ids.erase(idIt);
 			if(ids.empty()) {
 				inotify_rm_watch(impl_->inotify, it->first);
@@ -80,68 +261,17 @@ void FileWatcher::unregsiter(std::uint64_t id) {
 		}
 	}
 
-	dlg_warn("Could not unregsiter FileSystemWatcher, invalid id {}", id);
-}
-
-void FileWatcher::update() {
-	if(!impl_ || !impl_->inotify) {
-		return;
-	}
-
-	char buffer[1024];
-	ssize_t nr;
-	size_t n;
-	while((nr = read(impl_->inotify, buffer, sizeof(buffer))) > 0) {
-		for(char* p = buffer; p < buffer + nr; p += n) {
-			struct inotify_event* ev = (struct inotify_event*) p;
-			n = sizeof(struct inotify_event) + ev->len;
-
-			auto it = impl_->entries.find(ev->wd);
-			if(it == impl_->entries.end()) {
-				// This might happen when there were pending events
-				// after it got destroyed. Just ignoring it should not
-				// give any trouble.
-				// When the mask is only IGNORED, it just means that
-				// this watchdog was removed, this is a normal case.
-				if(ev->mask != IN_IGNORED) {
-					dlg_info("Receieved inotify event for unknown watchdog");
-				}
-				continue;
+	for(auto it = impl_->lost.begin(); it != impl_->lost.end(); ++it) {
+		if(it->ids.erase(id)) {
+			if(it->ids.empty()) {
+				impl_->lost.erase(it);
 			}
 
-			auto& entry = it->second;
-			impl_->changed.insert(entry.ids.begin(), entry.ids.end());
-			dlg_debug("Detected that file '{}' changed", it->second.path);
-
-			// Some editors delete the file instead of just writing it.
-			// In that case our watch got destroyed and we have to recreate it.
-			// Also make sure to update our internal mapping.
-			if(ev->mask & IN_IGNORED) {
-				int wd = inotify_add_watch(impl_->inotify, entry.path.c_str(), inotifyMask);
-				if(wd < 0) {
-					dlg_error("Failed to (re-)add inotify watcher for '{}': {} ({})",
-						ev->name, std::strerror(errno), errno);
-					continue;
-				}
-
-				if(wd != int(it->first)) {
-					auto mentry = std::move(entry);
-					impl_->entries.erase(it);
-					impl_->entries[wd] = std::move(mentry);
-				}
-			}
+			return;
 		}
 	}
-}
-
-bool FileWatcher::check(std::uint64_t id) {
-	auto it = impl_->changed.find(id);
-	if(it == impl_->changed.end()) {
-		return false;
-	}
 
-	impl_->changed.erase(it);
-	return true;
+	dlg_warn("Could not unregsiter FileSystemWatcher, invalid id {}", id);
 }
 
 } // namespace tkn
@@ -1,33 +1,107 @@
 #include <tkn/fswatch.hpp>
 #include <dlg/dlg.hpp>
+#include <condition_variable>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+// Fallback implementation that simply polls the last write times.
 
 namespace tkn {
 
+namespace fs = std::filesystem;
+constexpr auto pollInterval = std::chrono::milliseconds(100);
+
 struct FileWatcher::Impl {
+	struct Entry {
+		std::string path;
+		fs::file_time_type lastWrite;
+	};
+
+	// Guards all members, accessed by the thread.
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool exit {};
+
+	std::unordered_map<std::uint64_t, Entry> entries;
+	std::uint64_t lastID {};
+
+	std::thread thread;
 };
 
-FileWatcher::FileWatcher() {
-	impl_ = std::make_unique<Impl>();
+namespace {
+
+fs::file_time_type lastWriteTime(const std::string& path) {
+	std::error_code ec;
+	auto ret = fs::last_write_time(path, ec);
+	return ec ? fs::file_time_type::min() : ret;
 }
 
-FileWatcher::~FileWatcher() = default;
+} // anon namespace
 
-std::uint64_t FileWatcher::watch(nytl::StringParam path) {
-    // TODO
-    return 1u;
+FileWatcher::FileWatcher(std::chrono::milliseconds debounce) :
+		debounce_(debounce) {
+	impl_ = std::make_unique<Impl>();
+	impl_->thread = std::thread([this]{
+		using Clock = std::chrono::steady_clock;
+		auto& impl = *impl_;
+
+		std::unordered_set<std::uint64_t> changed;
+		auto lastEvent = Clock::now();
+
+		auto lock = std::unique_lock(impl.mutex);
+		while(!impl.cv.wait_for(lock, pollInterval, [&]{ return impl.exit; })) {
+			for(auto& [id, entry] : impl.entries) {
+				auto time = lastWriteTime(entry.path);
+				if(time != entry.lastWrite) {
+					dlg_debug("Detected that file '{}' changed", entry.path);
+					entry.lastWrite = time;
+					changed.insert(id);
+					lastEvent = Clock::now();
+				}
+			}
+
+			if(!changed.empty() && Clock::now() - lastEvent >= debounce_) {
+				pushBatch({changed.begin(), changed.end()});
+				changed.clear();
+			}
+		}
+	});
 }
 
-void FileWatcher::unregsiter(std::uint64_t id) {
-    // TODO
+FileWatcher::~FileWatcher() {
+	{
+		auto lock = std::lock_guard(impl_->mutex);
+		impl_->exit = true;
+	}
+
+	impl_->cv.notify_one();
+	impl_->thread.join();
 }
 
-void FileWatcher::update() {
-    // TODO
+std::uint64_t FileWatcher::watch(nytl::StringParam path) {
+	std::error_code ec;
+	if(!fs::exists(path.c_str(), ec)) {
+		dlg_error("Failed to add watcher for '{}': file does not exist", path);
+		return 0u;
+	}
+
+	auto lock = std::lock_guard(impl_->mutex);
+	auto newID = ++impl_->lastID;
+	auto& entry = impl_->entries[newID];
+	entry.path = path;
+	entry.lastWrite = lastWriteTime(entry.path);
+	return newID;
 }
 
-bool FileWatcher::check(std::uint64_t id) {
-    // TODO
-    return false;
+void FileWatcher::unregsiter(std::uint64_t id) {
+	changed_.erase(id);
+
+	auto lock = std::lock_guard(impl_->mutex);
+	if(!impl_->entries.erase(id)) {
+		dlg_warn("Could not unregsiter FileSystemWatcher, invalid id {}", id);
+	}
 }
 
-} // namespace tkn
\ No newline at end of file
+} // namespace tkn
@@ -0,0 +1,237 @@
+#include <tkn/gltf.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace tkn {
+namespace {
+
+// gltf buffers don't have to be aligned for the component type (although
+// the spec requires it), memcpy compiles to a simple load anyways.
+template<typename S>
+S load(const std::byte* ptr) {
+	S ret;
+	std::memcpy(&ret, ptr, sizeof(S));
+	return ret;
+}
+
+template<typename D, typename S, bool Norm>
+D convert(S val) {
+	if constexpr(Norm) {
+		// see the gltf spec, animation section for the formulas
+		constexpr auto scale = 1.f / float(std::numeric_limits<S>::max());
+		if constexpr(std::is_signed_v<S>) {
+			return std::max(float(val) * scale, -1.f);
+		} else {
+			return float(val) * scale;
+		}
+	} else {
+		return D(val);
+	}
+}
+
+// Converts n tightly packed values.
+template<typename S, typename D, bool Norm>
+void decodeFlat(const std::byte* src, D* dst, std::size_t n) {
+	if constexpr(std::is_same_v<S, D>) {
+		std::memcpy(dst, src, n * sizeof(D));
+		return;
+	}
+
+	auto i = std::size_t(0u);
+
+#ifdef __SSE2__
+	// The common quantized cases (u8/u16 indices, normalized
+	// u8/u16 texture coordinates or colors) are widened manually,
+	// compilers don't reliably vectorize the generic loop below for
+	// unaligned byte input.
+	constexpr auto u8 = std::is_same_v<S, std::uint8_t>;
+	constexpr auto u16 = std::is_same_v<S, std::uint16_t>;
+	constexpr auto toFloat = std::is_same_v<D, float>;
+	constexpr auto toU32 = std::is_same_v<D, std::uint32_t>;
+	if constexpr((u8 || u16) && (toFloat || toU32)) {
+		const auto zero = _mm_setzero_si128();
+		[[maybe_unused]] const auto scale = _mm_set1_ps(Norm ?
+			1.f / float(std::numeric_limits<S>::max()) : 1.f);
+
+		// stores 4 u32 values, converted if needed
+		auto store = [&](D* to, __m128i v) {
+			if constexpr(toFloat) {
+				auto f = _mm_cvtepi32_ps(v);
+				if constexpr(Norm) {
+					f = _mm_mul_ps(f, scale);
+				}
+				_mm_storeu_ps(to, f);
+			} else {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(to), v);
+			}
+		};
+
+		auto widen16 = [&](D* to, __m128i v) {
+			store(to + 0, _mm_unpacklo_epi16(v, zero));
+			store(to + 4, _mm_unpackhi_epi16(v, zero));
+		};
+
+		if constexpr(u8) {
+			for(; i + 16 <= n; i += 16) {
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				widen16(dst + i + 0, _mm_unpacklo_epi8(v, zero));
+				widen16(dst + i + 8, _mm_unpackhi_epi8(v, zero));
+			}
+		} else {
+			for(; i + 8 <= n; i += 8) {
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+				widen16(dst + i, v);
+			}
+		}
+	}
+#endif // __SSE2__
+
+	for(; i < n; ++i) {
+		dst[i] = convert<D, S, Norm>(load<S>(src + i * sizeof(S)));
+	}
+}
+
+// Generic strided (interleaved) or component-mismatched case.
+// The number of components is small, the compiler unrolls the inner loop
+// for the common cases of the dispatch below.
+template<typename S, typename D, bool Norm, unsigned Comps>
+void decodeStrided(const AccessorData& src, D* dst, unsigned dstComps) {
+	auto comps = std::min(Comps == 0u ? src.components : Comps, dstComps);
+	auto ptr = src.data;
+	for(auto i = 0u; i < src.count; ++i) {
+		auto c = 0u;
+		for(; c < comps; ++c) {
+			dst[c] = convert<D, S, Norm>(load<S>(ptr + c * sizeof(S)));
+		}
+		for(; c < dstComps; ++c) {
+			dst[c] = D(0);
+		}
+
+		ptr += src.stride;
+		dst += dstComps;
+	}
+}
+
+template<typename S, typename D, bool Norm>
+void decodeAs(const AccessorData& src, D* dst, unsigned dstComps) {
+	auto flat = src.components == dstComps &&
+		src.stride == src.components * sizeof(S);
+	if(flat) {
+		decodeFlat<S, D, Norm>(src.data, dst, src.count * dstComps);
+		return;
+	}
+
+	switch(std::min(src.components, dstComps)) {
+		case 1: decodeStrided<S, D, Norm, 1>(src, dst, dstComps); break;
+		case 2: decodeStrided<S, D, Norm, 2>(src, dst, dstComps); break;
+		case 3: decodeStrided<S, D, Norm, 3>(src, dst, dstComps); break;
+		case 4: decodeStrided<S, D, Norm, 4>(src, dst, dstComps); break;
+		default: decodeStrided<S, D, Norm, 0>(src, dst, dstComps); break;
+	}
+}
+
+template<typename S, typename D>
+void decodeFrom(const AccessorData& src, D* dst, unsigned dstComps) {
+	// normalization is only defined for integer accessors and only
+	// relevant when converting to float
+	if constexpr(std::is_integral_v<S> && std::is_floating_point_v<D>) {
+		if(src.normalized) {
+			decodeAs<S, D, true>(src, dst, dstComps);
+			return;
+		}
+	}
+
+	decodeAs<S, D, false>(src, dst, dstComps);
+}
+
+template<typename D>
+void decodeTo(const AccessorData& src, D* dst, unsigned dstComps) {
+	dlg_assert(dstComps > 0);
+	if(src.count == 0u) {
+		return;
+	}
+
+	switch(src.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_BYTE:
+			decodeFrom<std::int8_t>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			decodeFrom<std::uint8_t>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_SHORT:
+			decodeFrom<std::int16_t>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+			decodeFrom<std::uint16_t>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_INT:
+			decodeFrom<std::int32_t>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+			decodeFrom<std::uint32_t>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_FLOAT:
+			decodeFrom<float>(src, dst, dstComps); break;
+		case TINYGLTF_COMPONENT_TYPE_DOUBLE:
+			decodeFrom<double>(src, dst, dstComps); break;
+		default:
+			throw std::runtime_error("Invalid gltf component type");
+	}
+}
+
+} // anon namespace
+
+AccessorData accessorData(const gltf::Model& model,
+		const gltf::Accessor& accessor) {
+	if(accessor.sparse.isSparse) {
+		throw std::runtime_error("Sparse gltf accessors are not supported");
+	}
+
+	if(accessor.bufferView < 0 ||
+			unsigned(accessor.bufferView) >= model.bufferViews.size()) {
+		throw std::runtime_error("Invalid gltf accessor buffer view");
+	}
+
+	auto& bv = model.bufferViews[accessor.bufferView];
+	if(bv.buffer < 0 || unsigned(bv.buffer) >= model.buffers.size()) {
+		throw std::runtime_error("Invalid gltf buffer view buffer");
+	}
+
+	auto buf = bufferData(model.buffers[bv.buffer]);
+	auto compSize = gltf::GetComponentSizeInBytes(accessor.componentType);
+	auto components = gltf::GetTypeSizeInBytes(accessor.type);
+	auto stride = accessor.ByteStride(bv);
+	if(compSize <= 0 || components <= 0 || stride <= 0) {
+		throw std::runtime_error("Invalid gltf accessor type");
+	}
+
+	// check the bounds once for the whole accessor
+	auto offset = bv.byteOffset + accessor.byteOffset;
+	if(accessor.count > 0) {
+		auto end = offset + (accessor.count - 1) * stride + compSize * components;
+		if(end > bv.byteOffset + bv.byteLength || end > buf.size()) {
+			throw std::runtime_error("gltf accessor out of bounds");
+		}
+	}
+
+	AccessorData ret;
+	ret.data = buf.data() + offset;
+	ret.stride = stride;
+	ret.count = accessor.count;
+	ret.components = components;
+	ret.componentType = accessor.componentType;
+	ret.normalized = accessor.normalized;
+	return ret;
+}
+
+void decode(const AccessorData& data, float* dst, unsigned dstComps) {
+	decodeTo(data, dst, dstComps);
+}
+
+void decode(const AccessorData& data, std::uint32_t* dst, unsigned dstComps) {
+	decodeTo(data, dst, dstComps);
+}
+
+} // namespace tkn
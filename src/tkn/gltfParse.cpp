@@ -0,0 +1,1197 @@
+#include <tkn/gltfParse.hpp>
+#include <tkn/stream.hpp>
+#include <tkn/file.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace tkn {
+namespace {
+
+// Minimal pull parser over a json document in memory.
+// There is no document tree: object and array call the given function
+// for each member/element and the caller has to consume the value,
+// either by reading it directly into the destination or by skipping it.
+// All errors are reported by throwing std::runtime_error.
+class JsonReader {
+public:
+	explicit JsonReader(std::string_view src) : src_(src) {}
+
+	[[noreturn]] void error(std::string_view msg) const;
+
+	// Returns the first character of the next value or 0 at the end.
+	char peek();
+	void expect(char c);
+	bool atEnd() { return peek() == '\0'; }
+
+	// The returned view references either the source or the given storage
+	// if the string had to be unescaped.
+	std::string_view string(std::string& storage);
+	std::string string();
+	double number(bool* isInteger = nullptr);
+	int integer();
+	bool boolean();
+
+	// Skips the next value.
+	void skip();
+
+	// Reads the next value, with the same conventions as tinygltf:
+	// null values, empty arrays and empty objects are null values and
+	// nulls are dropped from objects and arrays.
+	gltf::Value value();
+
+	// onMember(std::string_view key) must consume the member value.
+	template<typename F> void object(F&& onMember);
+	// onElement() must consume the element.
+	template<typename F> void array(F&& onElement);
+
+protected:
+	void skipWhitespace();
+	void literal(std::string_view lit);
+	void unescape(std::string& out);
+
+protected:
+	std::string_view src_;
+	std::size_t pos_ {};
+};
+
+void JsonReader::error(std::string_view msg) const {
+	auto line = 1u;
+	auto lineStart = std::size_t(0u);
+	auto end = std::min(pos_, src_.size());
+	for(auto i = 0u; i < end; ++i) {
+		if(src_[i] == '\n') {
+			++line;
+			lineStart = i + 1;
+		}
+	}
+
+	auto col = end - lineStart + 1;
+	throw std::runtime_error(dlg::format("gltf: {} (line {}, column {})",
+		msg, line, col));
+}
+
+void JsonReader::skipWhitespace() {
+	while(pos_ < src_.size()) {
+		auto c = src_[pos_];
+		if(c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+			break;
+		}
+
+		++pos_;
+	}
+}
+
+char JsonReader::peek() {
+	skipWhitespace();
+	return pos_ < src_.size() ? src_[pos_] : '\0';
+}
+
+void JsonReader::expect(char c) {
+	if(peek() != c) {
+		error(dlg::format("Expected '{}'", c));
+	}
+
+	++pos_;
+}
+
+void JsonReader::literal(std::string_view lit) {
+	if(src_.substr(pos_, lit.size()) != lit) {
+		error("Invalid literal");
+	}
+
+	pos_ += lit.size();
+}
+
+std::string_view JsonReader::string(std::string& storage) {
+	expect('"');
+
+	// Fast path, most strings don't contain escapes. Long strings
+	// are usually data uris so we want to use memchr here.
+	auto start = pos_;
+	auto begin = src_.data() + pos_;
+	auto rest = src_.size() - pos_;
+	auto quote = static_cast<const char*>(std::memchr(begin, '"', rest));
+	if(!quote) {
+		pos_ = src_.size();
+		error("Unterminated string");
+	}
+
+	auto length = std::size_t(quote - begin);
+	if(!std::memchr(begin, '\\', length)) {
+		pos_ += length + 1;
+		return src_.substr(start, length);
+	}
+
+	storage.clear();
+	unescape(storage);
+	return storage;
+}
+
+std::string JsonReader::string() {
+	std::string storage;
+	auto view = string(storage);
+	if(view.data() != storage.data()) {
+		storage = view;
+	}
+
+	return storage;
+}
+
+void JsonReader::unescape(std::string& out) {
+	auto hex4 = [&]{
+		if(pos_ + 4 > src_.size()) {
+			error("Invalid unicode escape");
+		}
+
+		auto val = 0u;
+		for(auto i = 0u; i < 4u; ++i) {
+			auto c = src_[pos_++];
+			val <<= 4;
+			if(c >= '0' && c <= '9') val |= unsigned(c - '0');
+			else if(c >= 'a' && c <= 'f') val |= unsigned(c - 'a' + 10);
+			else if(c >= 'A' && c <= 'F') val |= unsigned(c - 'A' + 10);
+			else error("Invalid unicode escape");
+		}
+
+		return val;
+	};
+
+	while(true) {
+		if(pos_ >= src_.size()) {
+			error("Unterminated string");
+		}
+
+		auto c = src_[pos_++];
+		if(c == '"') {
+			return;
+		} else if(c != '\\') {
+			out.push_back(c);
+			continue;
+		}
+
+		if(pos_ >= src_.size()) {
+			error("Unterminated string");
+		}
+
+		switch(auto e = src_[pos_++]; e) {
+			case '"': case '\\': case '/': out.push_back(e); break;
+			case 'b': out.push_back('\b'); break;
+			case 'f': out.push_back('\f'); break;
+			case 'n': out.push_back('\n'); break;
+			case 'r': out.push_back('\r'); break;
+			case 't': out.push_back('\t'); break;
+			case 'u': {
+				auto cp = hex4();
+				if(cp >= 0xD800 && cp < 0xDC00) {
+					// surrogate pair
+					if(src_.substr(pos_, 2) != "\\u") {
+						error("Invalid utf-16 surrogate pair");
+					}
+
+					pos_ += 2;
+					auto low = hex4();
+					if(low < 0xDC00 || low >= 0xE000) {
+						error("Invalid utf-16 surrogate pair");
+					}
+
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				}
+
+				// encode as utf-8
+				if(cp < 0x80) {
+					out.push_back(char(cp));
+				} else if(cp < 0x800) {
+					out.push_back(char(0xC0 | (cp >> 6)));
+					out.push_back(char(0x80 | (cp & 0x3F)));
+				} else if(cp < 0x10000) {
+					out.push_back(char(0xE0 | (cp >> 12)));
+					out.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+					out.push_back(char(0x80 | (cp & 0x3F)));
+				} else {
+					out.push_back(char(0xF0 | (cp >> 18)));
+					out.push_back(char(0x80 | ((cp >> 12) & 0x3F)));
+					out.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+					out.push_back(char(0x80 | (cp & 0x3F)));
+				}
+				break;
+			} default:
+				error("Invalid string escape");
+		}
+	}
+}
+
+double JsonReader::number(bool* isInteger) {
+	// Powers of ten that are exactly representable as double
+	static constexpr double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	skipWhitespace();
+	auto start = pos_;
+	auto isDigit = [&]{
+		return pos_ < src_.size() && src_[pos_] >= '0' && src_[pos_] <= '9';
+	};
+
+	auto neg = false;
+	if(pos_ < src_.size() && src_[pos_] == '-') {
+		neg = true;
+		++pos_;
+	}
+
+	if(!isDigit()) {
+		error("Expected number");
+	}
+
+	// Accumulate up to 19 significant digits. When there are more,
+	// the value is not exact anymore and we fall back to strtod.
+	std::uint64_t mantissa = 0u;
+	auto digits = 0u;
+	auto exp10 = 0;
+	auto exact = true;
+	auto addDigit = [&](unsigned d) {
+		if(digits < 19u) {
+			mantissa = 10u * mantissa + d;
+			digits += (mantissa != 0u);
+			return true;
+		}
+
+		exact = false;
+		return false;
+	};
+
+	while(isDigit()) {
+		if(!addDigit(src_[pos_] - '0')) {
+			++exp10;
+		}
+		++pos_;
+	}
+
+	auto integer = true;
+	if(pos_ < src_.size() && src_[pos_] == '.') {
+		integer = false;
+		++pos_;
+		if(!isDigit()) {
+			error("Invalid number");
+		}
+
+		while(isDigit()) {
+			if(addDigit(src_[pos_] - '0')) {
+				--exp10;
+			}
+			++pos_;
+		}
+	}
+
+	if(pos_ < src_.size() && (src_[pos_] == 'e' || src_[pos_] == 'E')) {
+		integer = false;
+		++pos_;
+		auto negExp = false;
+		if(pos_ < src_.size() && (src_[pos_] == '+' || src_[pos_] == '-')) {
+			negExp = (src_[pos_] == '-');
+			++pos_;
+		}
+
+		if(!isDigit()) {
+			error("Invalid number");
+		}
+
+		auto exp = 0;
+		while(isDigit()) {
+			exp = std::min(10 * exp + (src_[pos_] - '0'), 100000);
+			++pos_;
+		}
+
+		exp10 += negExp ? -exp : exp;
+	}
+
+	if(isInteger) {
+		*isInteger = integer;
+	}
+
+	// Exact in this case: both the mantissa and the power of ten
+	// are representable and the result is correctly rounded.
+	if(exact && mantissa <= (std::uint64_t(1u) << 53) &&
+			exp10 >= -22 && exp10 <= 22) {
+		auto val = double(mantissa);
+		val = exp10 < 0 ? val / pow10[-exp10] : val * pow10[exp10];
+		return neg ? -val : val;
+	}
+
+	auto token = std::string(src_.substr(start, pos_ - start));
+	return std::strtod(token.c_str(), nullptr);
+}
+
+int JsonReader::integer() {
+	auto val = number();
+	if(!(val >= double(std::numeric_limits<int>::min()) &&
+			val <= double(std::numeric_limits<int>::max()))) {
+		error("Expected integer");
+	}
+
+	return int(val);
+}
+
+bool JsonReader::boolean() {
+	auto c = peek();
+	if(c == 't') {
+		literal("true");
+		return true;
+	} else if(c == 'f') {
+		literal("false");
+		return false;
+	}
+
+	error("Expected boolean");
+}
+
+template<typename F>
+void JsonReader::object(F&& onMember) {
+	expect('{');
+	if(peek() == '}') {
+		++pos_;
+		return;
+	}
+
+	std::string storage;
+	while(true) {
+		if(peek() != '"') {
+			error("Expected object key");
+		}
+
+		auto key = string(storage);
+		expect(':');
+		onMember(key);
+
+		auto c = peek();
+		++pos_;
+		if(c == '}') {
+			return;
+		} else if(c != ',') {
+			--pos_;
+			error("Expected ',' or '}'");
+		}
+	}
+}
+
+template<typename F>
+void JsonReader::array(F&& onElement) {
+	expect('[');
+	if(peek() == ']') {
+		++pos_;
+		return;
+	}
+
+	while(true) {
+		onElement();
+
+		auto c = peek();
+		++pos_;
+		if(c == ']') {
+			return;
+		} else if(c != ',') {
+			--pos_;
+			error("Expected ',' or ']'");
+		}
+	}
+}
+
+void JsonReader::skip() {
+	switch(peek()) {
+		case '{': object([&](std::string_view) { skip(); }); break;
+		case '[': array([&]{ skip(); }); break;
+		case '"': { std::string storage; string(storage); break; }
+		case 't': literal("true"); break;
+		case 'f': literal("false"); break;
+		case 'n': literal("null"); break;
+		default: number(); break;
+	}
+}
+
+gltf::Value JsonReader::value() {
+	switch(peek()) {
+		case '{': {
+			auto ret = gltf::Value(gltf::Value::Object{});
+			auto& obj = ret.Get<gltf::Value::Object>();
+			object([&](std::string_view key) {
+				auto val = value();
+				if(val.Type() != gltf::NULL_TYPE) {
+					obj[std::string(key)] = std::move(val);
+				}
+			});
+			return obj.empty() ? gltf::Value{} : std::move(ret);
+		} case '[': {
+			auto ret = gltf::Value(gltf::Value::Array{});
+			auto& arr = ret.Get<gltf::Value::Array>();
+			array([&]{
+				auto val = value();
+				if(val.Type() != gltf::NULL_TYPE) {
+					arr.push_back(std::move(val));
+				}
+			});
+			return arr.empty() ? gltf::Value{} : std::move(ret);
+		} case '"':
+			return gltf::Value(string());
+		case 't': case 'f':
+			return gltf::Value(boolean());
+		case 'n':
+			literal("null");
+			return {};
+		default: {
+			bool integer;
+			auto val = number(&integer);
+			if(integer && std::abs(val) < 9.2e18) {
+				return gltf::Value(int(std::int64_t(val)));
+			}
+
+			return gltf::Value(val);
+		}
+	}
+}
+
+// gltf
+std::vector<double> numbers(JsonReader& r) {
+	std::vector<double> ret;
+	r.array([&]{ ret.push_back(r.number()); });
+	return ret;
+}
+
+std::vector<int> integers(JsonReader& r) {
+	std::vector<int> ret;
+	r.array([&]{ ret.push_back(r.integer()); });
+	return ret;
+}
+
+std::size_t size(JsonReader& r) {
+	auto val = r.number();
+	if(!(val >= 0.0 && val <= double(std::uint64_t(1u) << 53))) {
+		r.error("Expected non-negative integer");
+	}
+
+	return std::size_t(val);
+}
+
+std::map<std::string, int> attributes(JsonReader& r) {
+	std::map<std::string, int> ret;
+	r.object([&](std::string_view key) {
+		ret.emplace(key, r.integer());
+	});
+	return ret;
+}
+
+std::vector<std::map<std::string, int>> targets(JsonReader& r) {
+	std::vector<std::map<std::string, int>> ret;
+	r.array([&]{ ret.push_back(attributes(r)); });
+	return ret;
+}
+
+gltf::ExtensionMap extensions(JsonReader& r) {
+	gltf::ExtensionMap ret;
+	r.object([&](std::string_view key) {
+		if(r.peek() != '{') {
+			r.skip();
+			return;
+		}
+
+		auto val = r.value();
+		if(val.Type() == gltf::NULL_TYPE) {
+			// extensions always have object type
+			val = gltf::Value(gltf::Value::Object{});
+		}
+
+		ret[std::string(key)] = std::move(val);
+	});
+
+	return ret;
+}
+
+// Like tinygltf, material parameters can be strings, numbers,
+// arrays of numbers, objects (of which only the numbers are stored,
+// e.g. texture infos) or booleans. Returns false for other values,
+// they aren't stored.
+bool parameter(JsonReader& r, gltf::Parameter& param) {
+	switch(r.peek()) {
+		case '"':
+			param.string_value = r.string();
+			return true;
+		case '[': {
+			auto valid = true;
+			r.array([&]{
+				auto c = r.peek();
+				if(c == '-' || (c >= '0' && c <= '9')) {
+					param.number_array.push_back(r.number());
+				} else {
+					valid = false;
+					r.skip();
+				}
+			});
+			return valid;
+		} case '{':
+			r.object([&](std::string_view key) {
+				auto c = r.peek();
+				if(c == '-' || (c >= '0' && c <= '9')) {
+					param.json_double_value.emplace(key, r.number());
+				} else {
+					r.skip();
+				}
+			});
+			return true;
+		case 't': case 'f':
+			param.bool_value = r.boolean();
+			return true;
+		case 'n':
+			r.skip();
+			return false;
+		default:
+			param.number_value = r.number();
+			param.has_number_value = true;
+			return true;
+	}
+}
+
+void parse(JsonReader& r, gltf::Asset& asset) {
+	r.object([&](std::string_view key) {
+		if(key == "version") asset.version = r.string();
+		else if(key == "generator") asset.generator = r.string();
+		else if(key == "minVersion") asset.minVersion = r.string();
+		else if(key == "copyright") asset.copyright = r.string();
+		else if(key == "extensions") asset.extensions = extensions(r);
+		else if(key == "extras") asset.extras = r.value();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Buffer& buffer, std::size_t& byteLength) {
+	auto hasLength = false;
+	r.object([&](std::string_view key) {
+		if(key == "byteLength") {
+			byteLength = size(r);
+			hasLength = true;
+		} else if(key == "uri") buffer.uri = r.string();
+		else if(key == "name") buffer.name = r.string();
+		else if(key == "extras") buffer.extras = r.value();
+		else r.skip();
+	});
+
+	if(!hasLength) {
+		r.error("Buffer without byteLength");
+	}
+}
+
+void parse(JsonReader& r, gltf::BufferView& bv) {
+	bv.buffer = -1;
+	bv.byteLength = 0u;
+	bv.target = 0;
+	auto hasLength = false;
+	r.object([&](std::string_view key) {
+		if(key == "buffer") bv.buffer = r.integer();
+		else if(key == "byteOffset") bv.byteOffset = size(r);
+		else if(key == "byteLength") {
+			bv.byteLength = size(r);
+			hasLength = true;
+		} else if(key == "byteStride") bv.byteStride = size(r);
+		else if(key == "target") bv.target = r.integer();
+		else if(key == "name") bv.name = r.string();
+		else if(key == "extras") bv.extras = r.value();
+		else r.skip();
+	});
+
+	if(bv.buffer < 0 || !hasLength) {
+		r.error("BufferView without buffer or byteLength");
+	}
+
+	if(bv.byteStride > 252 || bv.byteStride % 4 != 0) {
+		r.error(dlg::format("Invalid byteStride {}", bv.byteStride));
+	}
+
+	if(bv.target != TINYGLTF_TARGET_ARRAY_BUFFER &&
+			bv.target != TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER) {
+		bv.target = 0;
+	}
+}
+
+int accessorType(JsonReader& r) {
+	std::string storage;
+	auto type = r.string(storage);
+	if(type == "SCALAR") return TINYGLTF_TYPE_SCALAR;
+	if(type == "VEC2") return TINYGLTF_TYPE_VEC2;
+	if(type == "VEC3") return TINYGLTF_TYPE_VEC3;
+	if(type == "VEC4") return TINYGLTF_TYPE_VEC4;
+	if(type == "MAT2") return TINYGLTF_TYPE_MAT2;
+	if(type == "MAT3") return TINYGLTF_TYPE_MAT3;
+	if(type == "MAT4") return TINYGLTF_TYPE_MAT4;
+	r.error(dlg::format("Invalid accessor type '{}'", type));
+}
+
+void parseSparse(JsonReader& r, gltf::Accessor& acc) {
+	auto& sparse = acc.sparse;
+	sparse.isSparse = true;
+	sparse.count = 0;
+	sparse.indices = {};
+	sparse.values = {};
+	r.object([&](std::string_view key) {
+		if(key == "count") sparse.count = r.integer();
+		else if(key == "indices") {
+			r.object([&](std::string_view key) {
+				if(key == "bufferView") sparse.indices.bufferView = r.integer();
+				else if(key == "byteOffset") sparse.indices.byteOffset = r.integer();
+				else if(key == "componentType") sparse.indices.componentType = r.integer();
+				else r.skip();
+			});
+		} else if(key == "values") {
+			r.object([&](std::string_view key) {
+				if(key == "bufferView") sparse.values.bufferView = r.integer();
+				else if(key == "byteOffset") sparse.values.byteOffset = r.integer();
+				else r.skip();
+			});
+		} else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Accessor& acc) {
+	acc.byteOffset = 0u;
+	acc.normalized = false;
+	acc.componentType = -1;
+	acc.count = 0u;
+	acc.type = -1;
+	auto hasCount = false;
+	r.object([&](std::string_view key) {
+		if(key == "bufferView") acc.bufferView = r.integer();
+		else if(key == "byteOffset") acc.byteOffset = size(r);
+		else if(key == "normalized") acc.normalized = r.boolean();
+		else if(key == "componentType") acc.componentType = r.integer();
+		else if(key == "count") {
+			acc.count = size(r);
+			hasCount = true;
+		} else if(key == "type") acc.type = accessorType(r);
+		else if(key == "name") acc.name = r.string();
+		else if(key == "min") acc.minValues = numbers(r);
+		else if(key == "max") acc.maxValues = numbers(r);
+		else if(key == "sparse") parseSparse(r, acc);
+		else if(key == "extras") acc.extras = r.value();
+		else r.skip();
+	});
+
+	if(!hasCount || acc.type < 0) {
+		r.error("Accessor without count or type");
+	}
+
+	if(acc.componentType < TINYGLTF_COMPONENT_TYPE_BYTE ||
+			acc.componentType > TINYGLTF_COMPONENT_TYPE_DOUBLE) {
+		r.error(dlg::format("Invalid accessor componentType {}", acc.componentType));
+	}
+}
+
+void parse(JsonReader& r, gltf::Primitive& prim) {
+	prim.mode = TINYGLTF_MODE_TRIANGLES;
+	auto hasAttributes = false;
+	r.object([&](std::string_view key) {
+		if(key == "attributes") {
+			prim.attributes = attributes(r);
+			hasAttributes = true;
+		} else if(key == "indices") prim.indices = r.integer();
+		else if(key == "material") prim.material = r.integer();
+		else if(key == "mode") prim.mode = r.integer();
+		else if(key == "targets") prim.targets = targets(r);
+		else if(key == "extensions") prim.extensions = extensions(r);
+		else if(key == "extras") prim.extras = r.value();
+		else r.skip();
+	});
+
+	if(!hasAttributes) {
+		r.error("Primitive without attributes");
+	}
+}
+
+void parse(JsonReader& r, gltf::Mesh& mesh) {
+	r.object([&](std::string_view key) {
+		if(key == "primitives") {
+			r.array([&]{ parse(r, mesh.primitives.emplace_back()); });
+		} else if(key == "name") mesh.name = r.string();
+		else if(key == "weights") mesh.weights = numbers(r);
+		else if(key == "targets") mesh.targets = targets(r);
+		else if(key == "extensions") mesh.extensions = extensions(r);
+		else if(key == "extras") mesh.extras = r.value();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Node& node) {
+	r.object([&](std::string_view key) {
+		if(key == "children") node.children = integers(r);
+		else if(key == "mesh") node.mesh = r.integer();
+		else if(key == "camera") node.camera = r.integer();
+		else if(key == "skin") node.skin = r.integer();
+		else if(key == "matrix") node.matrix = numbers(r);
+		else if(key == "translation") node.translation = numbers(r);
+		else if(key == "rotation") node.rotation = numbers(r);
+		else if(key == "scale") node.scale = numbers(r);
+		else if(key == "weights") node.weights = numbers(r);
+		else if(key == "name") node.name = r.string();
+		else if(key == "extensions") node.extensions = extensions(r);
+		else if(key == "extras") node.extras = r.value();
+		else r.skip();
+	});
+
+	// matrix and translation/rotation/scale are exclusive
+	if(!node.matrix.empty()) {
+		node.translation.clear();
+		node.rotation.clear();
+		node.scale.clear();
+	}
+}
+
+void parse(JsonReader& r, gltf::Scene& scene) {
+	r.object([&](std::string_view key) {
+		if(key == "nodes") scene.nodes = integers(r);
+		else if(key == "name") scene.name = r.string();
+		else if(key == "extensions") scene.extensions = extensions(r);
+		else if(key == "extras") scene.extras = r.value();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Material& mat) {
+	r.object([&](std::string_view key) {
+		if(key == "pbrMetallicRoughness") {
+			if(r.peek() != '{') {
+				r.skip();
+				return;
+			}
+
+			r.object([&](std::string_view key) {
+				gltf::Parameter param;
+				if(parameter(r, param)) {
+					mat.values[std::string(key)] = std::move(param);
+				}
+			});
+		} else if(key == "extensions") {
+			mat.extensions = extensions(r);
+		} else if(key == "extras") {
+			mat.extras = r.value();
+		} else {
+			// like tinygltf, all other values (including the name) are
+			// stored as additional values
+			gltf::Parameter param;
+			if(parameter(r, param)) {
+				if(key == "name") {
+					mat.name = param.string_value;
+				}
+				mat.additionalValues[std::string(key)] = std::move(param);
+			}
+		}
+	});
+}
+
+void parse(JsonReader& r, gltf::Image& img) {
+	r.object([&](std::string_view key) {
+		if(key == "uri") img.uri = r.string();
+		else if(key == "bufferView") img.bufferView = r.integer();
+		else if(key == "mimeType") img.mimeType = r.string();
+		else if(key == "width") img.width = r.integer();
+		else if(key == "height") img.height = r.integer();
+		else if(key == "name") img.name = r.string();
+		else if(key == "extensions") img.extensions = extensions(r);
+		else if(key == "extras") img.extras = r.value();
+		else r.skip();
+	});
+
+	if((img.bufferView >= 0) == !img.uri.empty()) {
+		r.error("Image must have exactly one of uri and bufferView");
+	}
+}
+
+void parse(JsonReader& r, gltf::Texture& tex) {
+	r.object([&](std::string_view key) {
+		if(key == "sampler") tex.sampler = r.integer();
+		else if(key == "source") tex.source = r.integer();
+		else if(key == "name") tex.name = r.string();
+		else if(key == "extensions") tex.extensions = extensions(r);
+		else if(key == "extras") tex.extras = r.value();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Sampler& sampler) {
+	// NOTE: tinygltf uses this instead of the default from the constructor
+	sampler.minFilter = TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR;
+	r.object([&](std::string_view key) {
+		if(key == "minFilter") sampler.minFilter = r.integer();
+		else if(key == "magFilter") sampler.magFilter = r.integer();
+		else if(key == "wrapS") sampler.wrapS = r.integer();
+		else if(key == "wrapT") sampler.wrapT = r.integer();
+		else if(key == "name") sampler.name = r.string();
+		else if(key == "extras") sampler.extras = r.value();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Skin& skin) {
+	r.object([&](std::string_view key) {
+		if(key == "joints") skin.joints = integers(r);
+		else if(key == "skeleton") skin.skeleton = r.integer();
+		else if(key == "inverseBindMatrices") skin.inverseBindMatrices = r.integer();
+		else if(key == "name") skin.name = r.string();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Animation& anim) {
+	r.object([&](std::string_view key) {
+		if(key == "channels") {
+			r.array([&]{
+				auto& channel = anim.channels.emplace_back();
+				r.object([&](std::string_view key) {
+					if(key == "sampler") channel.sampler = r.integer();
+					else if(key == "extras") channel.extras = r.value();
+					else if(key == "target") {
+						r.object([&](std::string_view key) {
+							if(key == "node") channel.target_node = r.integer();
+							else if(key == "path") channel.target_path = r.string();
+							else r.skip();
+						});
+					} else r.skip();
+				});
+
+				if(channel.sampler < 0) {
+					r.error("Animation channel without sampler");
+				}
+			});
+		} else if(key == "samplers") {
+			r.array([&]{
+				auto& sampler = anim.samplers.emplace_back();
+				r.object([&](std::string_view key) {
+					if(key == "input") sampler.input = r.integer();
+					else if(key == "output") sampler.output = r.integer();
+					else if(key == "interpolation") sampler.interpolation = r.string();
+					else if(key == "extras") sampler.extras = r.value();
+					else r.skip();
+				});
+
+				if(sampler.input < 0 || sampler.output < 0) {
+					r.error("Animation sampler without input or output");
+				}
+			});
+		} else if(key == "name") anim.name = r.string();
+		else if(key == "extras") anim.extras = r.value();
+		else r.skip();
+	});
+}
+
+template<typename C>
+void parseCameraProjection(JsonReader& r, C& cam) {
+	r.object([&](std::string_view key) {
+		if constexpr(std::is_same_v<C, gltf::PerspectiveCamera>) {
+			if(key == "yfov") { cam.yfov = r.number(); return; }
+			if(key == "aspectRatio") { cam.aspectRatio = r.number(); return; }
+		} else {
+			if(key == "xmag") { cam.xmag = r.number(); return; }
+			if(key == "ymag") { cam.ymag = r.number(); return; }
+		}
+
+		if(key == "znear") cam.znear = r.number();
+		else if(key == "zfar") cam.zfar = r.number();
+		else if(key == "extensions") cam.extensions = extensions(r);
+		else if(key == "extras") cam.extras = r.value();
+		else r.skip();
+	});
+}
+
+void parse(JsonReader& r, gltf::Camera& cam) {
+	auto hasProjection = false;
+	r.object([&](std::string_view key) {
+		if(key == "type") cam.type = r.string();
+		else if(key == "perspective") {
+			parseCameraProjection(r, cam.perspective);
+			hasProjection = true;
+		} else if(key == "orthographic") {
+			parseCameraProjection(r, cam.orthographic);
+			hasProjection = true;
+		} else if(key == "name") cam.name = r.string();
+		else if(key == "extensions") cam.extensions = extensions(r);
+		else if(key == "extras") cam.extras = r.value();
+		else r.skip();
+	});
+
+	if((cam.type != "perspective" && cam.type != "orthographic") ||
+			!hasProjection) {
+		r.error(dlg::format("Invalid camera type '{}'", cam.type));
+	}
+}
+
+template<typename T>
+void parseArray(JsonReader& r, std::vector<T>& dst) {
+	r.array([&]{ parse(r, dst.emplace_back()); });
+}
+
+std::vector<std::string> strings(JsonReader& r) {
+	std::vector<std::string> ret;
+	r.array([&]{ ret.push_back(r.string()); });
+	return ret;
+}
+
+// KHR_lights_cmn, the only extension tinygltf implements explicitly
+void parseLights(gltf::Model& model) {
+	auto it = model.extensions.find("KHR_lights_cmn");
+	if(it == model.extensions.end() || !it->second.Has("lights")) {
+		return;
+	}
+
+	auto& lights = it->second.Get("lights");
+	for(auto i = 0u; i < lights.ArrayLen(); ++i) {
+		auto& src = lights.Get(i);
+		if(!src.IsObject()) {
+			continue;
+		}
+
+		auto& light = model.lights.emplace_back();
+		if(src.Get("name").IsString()) {
+			light.name = src.Get("name").Get<std::string>();
+		}
+		if(src.Get("type").IsString()) {
+			light.type = src.Get("type").Get<std::string>();
+		}
+
+		auto& color = src.Get("color");
+		for(auto c = 0u; c < color.ArrayLen(); ++c) {
+			auto& v = color.Get(c);
+			light.color.push_back(v.IsInt() ? v.Get<int>() : v.Get<double>());
+		}
+	}
+}
+
+struct Source {
+	std::string_view json;
+	bool binary {};
+	nytl::Span<const std::byte> bin; // the binary chunk of a glb
+	std::string_view baseDir;
+};
+
+// External buffer files are mapped and appended to maps.
+gltf::Model parse(const Source& src, std::vector<StreamMemoryMap>& maps) {
+	gltf::Model model;
+	model.defaultScene = -1;
+	std::vector<std::size_t> bufferLengths;
+
+	JsonReader r(src.json);
+	r.object([&](std::string_view key) {
+		if(key == "accessors") parseArray(r, model.accessors);
+		else if(key == "bufferViews") parseArray(r, model.bufferViews);
+		else if(key == "meshes") parseArray(r, model.meshes);
+		else if(key == "nodes") parseArray(r, model.nodes);
+		else if(key == "scenes") parseArray(r, model.scenes);
+		else if(key == "scene") model.defaultScene = r.integer();
+		else if(key == "materials") parseArray(r, model.materials);
+		else if(key == "textures") parseArray(r, model.textures);
+		else if(key == "images") parseArray(r, model.images);
+		else if(key == "samplers") parseArray(r, model.samplers);
+		else if(key == "animations") parseArray(r, model.animations);
+		else if(key == "skins") parseArray(r, model.skins);
+		else if(key == "cameras") parseArray(r, model.cameras);
+		else if(key == "asset") parse(r, model.asset);
+		else if(key == "extensionsUsed") model.extensionsUsed = strings(r);
+		else if(key == "extensionsRequired") model.extensionsRequired = strings(r);
+		else if(key == "extensions") model.extensions = extensions(r);
+		else if(key == "extras") model.extras = r.value();
+		else if(key == "buffers") {
+			r.array([&]{
+				parse(r, model.buffers.emplace_back(), bufferLengths.emplace_back());
+			});
+		} else r.skip();
+	});
+
+	if(!r.atEnd()) {
+		r.error("Unexpected data after the root object");
+	}
+
+	parseLights(model);
+
+	// Same as tinygltf: buffer views that are used as index buffers get
+	// the element target, all others without explicit target the
+	// array target.
+	for(auto& mesh : model.meshes) {
+		for(auto& prim : mesh.primitives) {
+			if(prim.indices < 0 || unsigned(prim.indices) >= model.accessors.size()) {
+				continue;
+			}
+
+			auto bv = model.accessors[prim.indices].bufferView;
+			if(bv >= 0 && unsigned(bv) < model.bufferViews.size()) {
+				model.bufferViews[bv].target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+			}
+		}
+	}
+
+	for(auto& bv : model.bufferViews) {
+		if(bv.target == 0) {
+			bv.target = TINYGLTF_TARGET_ARRAY_BUFFER;
+		}
+	}
+
+	// load buffers
+	auto baseDir = std::string(src.baseDir);
+	for(auto i = 0u; i < model.buffers.size(); ++i) {
+		auto& buf = model.buffers[i];
+		auto length = bufferLengths[i];
+		if(buf.uri.empty()) {
+			if(!src.binary) {
+				throw std::runtime_error(dlg::format(
+					"gltf: buffer {} has no uri", i));
+			}
+
+			if(length > src.bin.size()) {
+				throw std::runtime_error(dlg::format("gltf: buffer {} is larger "
+					"than the binary chunk ({} > {})", i, length, src.bin.size()));
+			}
+
+			buf.mappedData = reinterpret_cast<const unsigned char*>(src.bin.data());
+			buf.mappedSize = length;
+		} else if(gltf::IsDataURI(buf.uri)) {
+			std::string mimeType;
+			if(!gltf::DecodeDataURI(&buf.data, mimeType, buf.uri, length, true)) {
+				throw std::runtime_error(dlg::format(
+					"gltf: failed to decode data uri of buffer {}", i));
+			}
+		} else {
+			auto path = baseDir + buf.uri;
+			auto file = File(path, "rb");
+			std::error_code ec;
+			auto fileSize = fs::file_size(path, ec);
+			if(!file || ec) {
+				throw std::runtime_error(dlg::format(
+					"gltf: can't open buffer file '{}'", path));
+			}
+
+			if(fileSize < length) {
+				throw std::runtime_error(dlg::format("gltf: buffer file '{}' "
+					"too small ({} < {})", path, fileSize, length));
+			}
+
+			if(length > 0) {
+				auto& map = maps.emplace_back(
+					std::make_unique<FileStream>(std::move(file)));
+				buf.mappedData = reinterpret_cast<const unsigned char*>(map.data());
+				buf.mappedSize = length;
+			}
+		}
+	}
+
+	return model;
+}
+
+// Returns the source of a glb file, the chunks reference data.
+Source parseGlb(nytl::Span<const std::byte> data) {
+	auto u32 = [&](std::size_t off) {
+		std::uint32_t val;
+		std::memcpy(&val, data.data() + off, 4u);
+		return val;
+	};
+
+	constexpr auto magic = 0x46546C67u; // "glTF"
+	constexpr auto chunkJson = 0x4E4F534Au; // "JSON"
+	constexpr auto chunkBin = 0x004E4942u; // "BIN\0"
+
+	if(data.size() < 20 || u32(0) != magic) {
+		throw std::runtime_error("glb: invalid header");
+	}
+
+	if(u32(4) != 2u) {
+		throw std::runtime_error(dlg::format("glb: unsupported version {}", u32(4)));
+	}
+
+	auto length = std::min<std::size_t>(u32(8), data.size());
+	auto jsonLength = u32(12);
+	if(u32(16) != chunkJson || 20u + std::size_t(jsonLength) > length) {
+		throw std::runtime_error("glb: invalid json chunk");
+	}
+
+	Source ret;
+	ret.binary = true;
+	ret.json = {reinterpret_cast<const char*>(data.data()) + 20, jsonLength};
+
+	// chunks are 4-byte aligned, the optional binary chunk follows
+	auto off = 20u + ((std::size_t(jsonLength) + 3u) & ~std::size_t(3u));
+	if(off + 8u <= length) {
+		auto binLength = u32(off);
+		if(u32(off + 4) != chunkBin || off + 8u + binLength > length) {
+			throw std::runtime_error("glb: invalid binary chunk");
+		}
+
+		ret.bin = data.subspan(off + 8u, binLength);
+	}
+
+	return ret;
+}
+
+Source parseSource(nytl::Span<const std::byte> data) {
+	if(data.size() >= 4 && std::memcmp(data.data(), "glTF", 4) == 0) {
+		return parseGlb(data);
+	}
+
+	Source ret;
+	ret.json = {reinterpret_cast<const char*>(data.data()), data.size()};
+	return ret;
+}
+
+} // anon namespace
+
+gltf::Model parseGltf(nytl::StringParam path) {
+	auto file = File(path, "rb");
+	std::error_code ec;
+	auto fileSize = fs::file_size(path.c_str(), ec);
+	if(!file || ec || fileSize == 0u) {
+		throw std::runtime_error(dlg::format("gltf: can't read '{}'",
+			path.c_str()));
+	}
+
+	// The mapping of the file itself is needed for the glb binary chunk,
+	// buffer files will be appended.
+	auto maps = std::make_shared<std::vector<StreamMemoryMap>>();
+	auto& map = maps->emplace_back(std::make_unique<FileStream>(std::move(file)));
+
+	auto src = parseSource(map.span());
+
+	auto pathView = std::string_view(path.c_str());
+	auto sep = pathView.find_last_of('/');
+	src.baseDir = (sep == pathView.npos) ? "" : pathView.substr(0, sep + 1);
+
+	auto model = parse(src, *maps);
+
+	// json files don't have to be kept around, only glb binary chunks
+	if(!src.binary) {
+		maps->erase(maps->begin());
+	}
+
+	model.mappedSource = std::move(maps);
+	return model;
+}
+
+gltf::Model parseGltf(nytl::Span<const std::byte> data,
+		std::string_view baseDir, std::shared_ptr<const void> keepAlive) {
+	auto src = parseSource(data);
+	src.baseDir = baseDir;
+
+	auto maps = std::make_shared<std::vector<StreamMemoryMap>>();
+	auto model = parse(src, *maps);
+	if(maps->empty()) {
+		model.mappedSource = std::move(keepAlive);
+	} else {
+		// keep both the given data and the buffer mappings alive
+		using Pair = std::pair<std::shared_ptr<const void>, std::shared_ptr<const void>>;
+		model.mappedSource = std::make_shared<Pair>(std::move(keepAlive),
+			std::move(maps));
+	}
+
+	return model;
+}
+
+} // namespace tkn
@@ -0,0 +1,336 @@
+#include <tkn/hair.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace tkn {
+namespace {
+
+// Batches per parallelFor range.
+constexpr auto batchGrain = 16u;
+
+// Guards against the division by zero for nodes at the same position.
+constexpr auto minLength = 1e-6f;
+
+// One float per strand of a batch. The simulation is written only in
+// terms of these so the SSE and the scalar implementation are the same
+// code, with the same results. With SSE, these are two registers,
+// giving two independent dependency chains for the sqrt and division
+// latencies.
+static_assert(Hair::batchSize == 8u);
+
+#ifdef __SSE2__
+
+struct Lanes {
+	__m128 a, b;
+
+	static Lanes load(const float* src) {
+		return {_mm_loadu_ps(src), _mm_loadu_ps(src + 4)};
+	}
+
+	static Lanes set(float f) { return {_mm_set1_ps(f), _mm_set1_ps(f)}; }
+	void store(float* dst) const {
+		_mm_storeu_ps(dst, a);
+		_mm_storeu_ps(dst + 4, b);
+	}
+};
+
+inline Lanes operator+(Lanes x, Lanes y) { return {_mm_add_ps(x.a, y.a), _mm_add_ps(x.b, y.b)}; }
+inline Lanes operator-(Lanes x, Lanes y) { return {_mm_sub_ps(x.a, y.a), _mm_sub_ps(x.b, y.b)}; }
+inline Lanes operator*(Lanes x, Lanes y) { return {_mm_mul_ps(x.a, y.a), _mm_mul_ps(x.b, y.b)}; }
+inline Lanes operator/(Lanes x, Lanes y) { return {_mm_div_ps(x.a, y.a), _mm_div_ps(x.b, y.b)}; }
+inline Lanes max(Lanes x, Lanes y) { return {_mm_max_ps(x.a, y.a), _mm_max_ps(x.b, y.b)}; }
+inline Lanes sqrt(Lanes x) { return {_mm_sqrt_ps(x.a), _mm_sqrt_ps(x.b)}; }
+
+#else // __SSE2__
+
+struct Lanes {
+	std::array<float, Hair::batchSize> v;
+
+	static Lanes load(const float* src) {
+		Lanes ret;
+		std::copy(src, src + Hair::batchSize, ret.v.begin());
+		return ret;
+	}
+
+	static Lanes set(float f) {
+		Lanes ret;
+		ret.v.fill(f);
+		return ret;
+	}
+
+	void store(float* dst) const { std::copy(v.begin(), v.end(), dst); }
+};
+
+template<typename F>
+Lanes apply(Lanes x, Lanes y, F&& f) {
+	Lanes ret;
+	for(auto i = 0u; i < Hair::batchSize; ++i) {
+		ret.v[i] = f(x.v[i], y.v[i]);
+	}
+	return ret;
+}
+
+inline Lanes operator+(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+inline Lanes operator-(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+inline Lanes operator*(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+inline Lanes operator/(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+inline Lanes max(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return std::max(x, y); }); }
+inline Lanes sqrt(Lanes a) { return apply(a, a, [](float x, float) { return std::sqrt(x); }); }
+
+#endif // __SSE2__
+
+struct Vec3L {
+	Lanes x, y, z;
+};
+
+inline Vec3L operator+(const Vec3L& a, const Vec3L& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3L operator-(const Vec3L& a, const Vec3L& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3L operator*(Lanes f, const Vec3L& a) { return {f * a.x, f * a.y, f * a.z}; }
+inline Lanes dot(const Vec3L& a, const Vec3L& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+Vec3L set(Vec3f v) {
+	return {Lanes::set(v.x), Lanes::set(v.y), Lanes::set(v.z)};
+}
+
+Vec3L load(const std::array<std::vector<float>, 3>& comps, std::size_t i) {
+	return {
+		Lanes::load(comps[0].data() + i),
+		Lanes::load(comps[1].data() + i),
+		Lanes::load(comps[2].data() + i),
+	};
+}
+
+void store(std::array<std::vector<float>, 3>& comps, std::size_t i, const Vec3L& v) {
+	v.x.store(comps[0].data() + i);
+	v.y.store(comps[1].data() + i);
+	v.z.store(comps[2].data() + i);
+}
+
+// Per step constants.
+struct StepConstants {
+	Lanes dt;
+	Lanes invDt;
+	Lanes damping; // velocity factor
+	Vec3L gravity; // velocity change
+	bool collide;
+	Vec3L center;
+	Lanes radius;
+	Lanes one;
+	Lanes minLength;
+};
+
+// Moves p out of the sphere, along the direction from its center.
+Vec3L collide(const StepConstants& c, const Vec3L& p) {
+	if(!c.collide) {
+		return p;
+	}
+
+	auto d = p - c.center;
+	auto len = max(sqrt(dot(d, d)), c.minLength);
+	return c.center + max(c.radius / len, c.one) * d;
+}
+
+// Returns the position that moves a (of the segment from
+// a to b) so that the segment has the given length. In the
+// direction from b to a.
+Vec3L project(const StepConstants& c, const Vec3L& a, const Vec3L& b,
+		Lanes length) {
+	auto d = a - b;
+	auto len = max(sqrt(dot(d, d)), c.minLength);
+	return b + (length / len) * d;
+}
+
+} // anon namespace
+
+Hair::Hair(nytl::Span<const HairStrand> strands, unsigned nodeCount,
+		const HairParams& xparams) : params(xparams),
+			strandCount_(strands.size()), nodeCount_(nodeCount) {
+	dlg_assert(nodeCount >= 2);
+	batchCount_ = (strandCount_ + batchSize - 1) / batchSize;
+
+	// padding lanes simulate a dummy strand
+	auto padded = batchCount_ * batchSize;
+	auto size = std::size_t(batchCount_) * nodeCount_ * batchSize;
+	for(auto c = 0u; c < 3u; ++c) {
+		pos_[c].resize(size);
+		vel_[c].assign(size, 0.f);
+		roots_[c].resize(padded);
+	}
+
+	segLength_.resize(padded);
+	for(auto s = 0u; s < padded; ++s) {
+		auto strand = (s < strandCount_) ? strands[s] :
+			HairStrand{{0.f, 0.f, 0.f}, {0.f, -1.f, 0.f}, 1.f};
+		dlg_assert(strand.length > 0.f);
+
+		auto seg = strand.length / (nodeCount - 1);
+		segLength_[s] = seg;
+		for(auto c = 0u; c < 3u; ++c) {
+			roots_[c][s] = strand.root[c];
+		}
+
+		for(auto i = 0u; i < nodeCount_; ++i) {
+			auto p = strand.root + (i * seg) * strand.direction;
+			auto id = this->id(s / batchSize, i) + s % batchSize;
+			for(auto c = 0u; c < 3u; ++c) {
+				pos_[c][id] = p[c];
+			}
+		}
+	}
+}
+
+void Hair::moveRoots(nytl::Span<const Vec3f> roots) {
+	dlg_assert(roots.size() == strandCount_);
+	for(auto s = 0u; s < strandCount_; ++s) {
+		for(auto c = 0u; c < 3u; ++c) {
+			roots_[c][s] = roots[s][c];
+		}
+	}
+}
+
+void Hair::step(float dt, ThreadPool* pool) {
+	dlg_assert(dt > 0.f);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	parallelFor(*pool, batchCount_, batchGrain, [&](auto begin, auto end) {
+		for(auto b = begin; b < end; ++b) {
+			stepBatch(unsigned(b), dt);
+		}
+	});
+}
+
+void Hair::stepBatch(unsigned b, float dt) {
+	StepConstants c;
+	c.dt = Lanes::set(dt);
+	c.invDt = Lanes::set(1.f / dt);
+	c.damping = Lanes::set(std::max(1.f - params.damping * dt, 0.f));
+	c.gravity = set(dt * params.gravity);
+	c.collide = (params.sphereRadius > 0.f);
+	c.center = set(params.sphereCenter);
+	c.radius = Lanes::set(params.sphereRadius);
+	c.one = Lanes::set(1.f);
+	c.minLength = Lanes::set(minLength);
+
+	auto ftlDamping = Lanes::set(params.ftlDamping);
+	auto half = Lanes::set(0.5f);
+	auto bend = Lanes::set(params.bendStiffness);
+
+	auto strand = b * batchSize;
+	auto seg = Lanes::load(segLength_.data() + strand);
+	auto root = load(roots_, strand);
+
+	// the root is only moved
+	auto r = id(b, 0);
+	store(vel_, r, c.invDt * (root - load(pos_, r)));
+	store(pos_, r, root);
+
+	if(params.solver == HairSolver::followTheLeader) {
+		// The velocity of a node is only known after the next
+		// node was projected, it depends on its correction.
+		auto parent = root;
+		auto lastX = root;
+		auto lastP = root;
+		for(auto i = 1u; i < nodeCount_; ++i) {
+			auto n = id(b, i);
+			auto x = load(pos_, n);
+			auto v = c.damping * load(vel_, n) + c.gravity;
+			auto p = x + c.dt * v;
+			auto q = collide(c, project(c, p, parent, seg));
+
+			if(i > 1) {
+				auto m = id(b, i - 1);
+				auto vm = c.invDt * (lastP - lastX) +
+					(ftlDamping * c.invDt) * (p - q);
+				store(vel_, m, vm);
+				store(pos_, m, lastP);
+			}
+
+			lastX = x;
+			lastP = q;
+			parent = q;
+		}
+
+		auto m = id(b, nodeCount_ - 1);
+		store(vel_, m, c.invDt * (lastP - lastX));
+		store(pos_, m, lastP);
+	} else {
+		// During the iterations, vel_ holds the positions at the
+		// start of the step.
+		for(auto i = 1u; i < nodeCount_; ++i) {
+			auto n = id(b, i);
+			auto x = load(pos_, n);
+			auto v = c.damping * load(vel_, n) + c.gravity;
+			store(vel_, n, x);
+			store(pos_, n, x + c.dt * v);
+		}
+
+		// The root is fixed, the constraints at it only move the
+		// other node.
+		auto twoSeg = seg + seg;
+		for(auto it = 0u; it < params.iterations; ++it) {
+			for(auto i = 1u; i < nodeCount_; ++i) {
+				auto n = id(b, i);
+				auto m = id(b, i - 1);
+				auto p = load(pos_, n);
+				auto a = load(pos_, m);
+				auto corr = project(c, p, a, seg) - p;
+				if(i == 1) {
+					p = p + corr;
+				} else {
+					p = p + half * corr;
+					store(pos_, m, a - half * corr);
+				}
+
+				if(i > 1 && params.bendStiffness > 0.f) {
+					auto l = id(b, i - 2);
+					auto a2 = load(pos_, l);
+					auto corr2 = bend * (project(c, p, a2, twoSeg) - p);
+					if(i == 2) {
+						p = p + corr2;
+					} else {
+						p = p + half * corr2;
+						store(pos_, l, a2 - half * corr2);
+					}
+				}
+
+				store(pos_, n, p);
+			}
+		}
+
+		for(auto i = 1u; i < nodeCount_; ++i) {
+			auto n = id(b, i);
+			auto p = collide(c, load(pos_, n));
+			store(pos_, n, p);
+			store(vel_, n, c.invDt * (p - load(vel_, n)));
+		}
+	}
+}
+
+void Hair::writePositions(nytl::Span<Vec3f> dst) const {
+	dlg_assert(dst.size() == std::size_t(strandCount_) * nodeCount_);
+	for(auto s = 0u; s < strandCount_; ++s) {
+		for(auto i = 0u; i < nodeCount_; ++i) {
+			dst[std::size_t(s) * nodeCount_ + i] = position(s, i);
+		}
+	}
+}
+
+Vec3f Hair::position(unsigned strand, unsigned node) const {
+	auto i = id(strand / batchSize, node) + strand % batchSize;
+	return {pos_[0][i], pos_[1][i], pos_[2][i]};
+}
+
+Vec3f Hair::velocity(unsigned strand, unsigned node) const {
+	auto i = id(strand / batchSize, node) + strand % batchSize;
+	return {vel_[0][i], vel_[1][i], vel_[2][i]};
+}
+
+} // namespace tkn
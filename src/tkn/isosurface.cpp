@@ -0,0 +1,494 @@
+#include <tkn/isosurface.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+#include "isosurfaceTables.hpp"
+
+// The grid is processed in slabs of cell layers along z. Every slab
+// creates the vertices it owns in a fixed order and references
+// vertices it doesn't own (that are created by the next slab) via
+// their local index in the next slab, marked with the 'foreign' bit.
+// After all slabs are done, the vertex counts are summed up (prefix
+// sum) and the indices made global. Since the vertices are always
+// created in the same order, independent of the slabs, the result
+// does not depend on the slab size or the number of threads.
+
+namespace tkn {
+namespace {
+
+constexpr auto slabLayers = 4u; // cell layers per slab
+constexpr auto rowGrain = 64u; // grid rows per parallelFor range in sample
+constexpr u32 noVertex = 0xFFFFFFFFu;
+constexpr u32 foreign = 0x80000000u;
+
+struct Slab {
+	std::vector<Vec3f> positions;
+	std::vector<Vec3f> normals;
+	std::vector<u32> indices; // local, might have the foreign bit set
+};
+
+struct Extractor {
+	const SdfGrid& grid;
+	float iso;
+
+	// Marks the samples of plane z that are outside.
+	void classify(u32 z, std::vector<u8>& outside) const {
+		auto* values = grid.values.data() + grid.id(0, 0, z);
+		for(auto i = 0u; i < outside.size(); ++i) {
+			outside[i] = (values[i] < iso);
+		}
+	}
+
+	// Configuration of the cell at the given id (y * size.x + x) of
+	// the classified planes below and above it. Corner i has the
+	// bit (1 << i) set if it is outside.
+	unsigned config(const u8* below, const u8* above, std::size_t id) const {
+		auto nx = grid.size.x;
+		return below[id] |
+			(below[id + 1] << 1) |
+			(above[id + 1] << 2) |
+			(above[id] << 3) |
+			(below[id + nx] << 4) |
+			(below[id + nx + 1] << 5) |
+			(above[id + nx + 1] << 6) |
+			(above[id + nx] << 7);
+	}
+
+	Vec3f gradient(u32 x, u32 y, u32 z) const {
+		Vec3ui p {x, y, z};
+		Vec3f ret;
+		for(auto a = 0u; a < 3u; ++a) {
+			auto lo = p;
+			auto hi = p;
+			lo[a] = (p[a] > 0) ? p[a] - 1 : p[a];
+			hi[a] = (p[a] + 1 < grid.size[a]) ? p[a] + 1 : p[a];
+			auto d = grid.value(hi.x, hi.y, hi.z) - grid.value(lo.x, lo.y, lo.z);
+			ret[a] = d / ((hi[a] - lo[a]) * grid.spacing[a]);
+		}
+		return ret;
+	}
+
+	// Intersection of the surface with the edge from sample (x, y, z)
+	// to its neighbor along the given axis. Returns position and
+	// (unnormalized) outside-facing gradient.
+	std::pair<Vec3f, Vec3f> intersect(u32 x, u32 y, u32 z, unsigned axis) const {
+		Vec3ui b {x, y, z};
+		++b[axis];
+
+		auto va = grid.value(x, y, z);
+		auto vb = grid.value(b.x, b.y, b.z);
+		auto f = std::clamp((iso - va) / (vb - va), 0.f, 1.f);
+
+		auto pa = grid.position(x, y, z);
+		auto pb = grid.position(b.x, b.y, b.z);
+		auto ga = gradient(x, y, z);
+		auto gb = gradient(b.x, b.y, b.z);
+		return {pa + f * (pb - pa), -1.f * (ga + f * (gb - ga))};
+	}
+};
+
+Vec3f normalized(Vec3f v) {
+	auto l = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+	return (l > 0.f) ? (1 / l) * v : Vec3f{0.f, 0.f, 1.f};
+}
+
+// Divides the cell layers into slabs, calls func(slab, z0, z1) for
+// each in parallel and merges the results.
+template<typename F>
+IsoMesh extract(const SdfGrid& grid, ThreadPool* pool, F&& func) {
+	IsoMesh ret;
+	if(grid.size.x < 2 || grid.size.y < 2 || grid.size.z < 2) {
+		return ret;
+	}
+
+	dlg_assert(grid.values.size() == std::size_t(grid.size.x) *
+		grid.size.y * grid.size.z);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	auto layers = grid.size.z - 1;
+	auto slabCount = (layers + slabLayers - 1) / slabLayers;
+	std::vector<Slab> slabs(slabCount);
+	parallelFor(*pool, slabCount, 1u, [&](auto begin, auto end) {
+		for(auto s = begin; s < end; ++s) {
+			auto z0 = u32(s * slabLayers);
+			auto z1 = std::min(z0 + slabLayers, layers);
+			func(slabs[s], z0, z1);
+		}
+	});
+
+	// prefix sums
+	std::vector<std::size_t> vertexStart(slabCount + 1, 0u);
+	std::vector<std::size_t> indexStart(slabCount + 1, 0u);
+	for(auto s = 0u; s < slabCount; ++s) {
+		vertexStart[s + 1] = vertexStart[s] + slabs[s].positions.size();
+		indexStart[s + 1] = indexStart[s] + slabs[s].indices.size();
+	}
+
+	dlg_assert(vertexStart.back() < foreign);
+	ret.positions.resize(vertexStart.back());
+	ret.normals.resize(vertexStart.back());
+	ret.indices.resize(indexStart.back());
+	parallelFor(*pool, slabCount, 1u, [&](auto begin, auto end) {
+		for(auto s = begin; s < end; ++s) {
+			auto& slab = slabs[s];
+			std::copy(slab.positions.begin(), slab.positions.end(),
+				ret.positions.begin() + vertexStart[s]);
+			std::copy(slab.normals.begin(), slab.normals.end(),
+				ret.normals.begin() + vertexStart[s]);
+
+			auto* out = ret.indices.data() + indexStart[s];
+			for(auto id : slab.indices) {
+				*(out++) = (id & foreign) ?
+					u32(vertexStart[s + 1] + (id & ~foreign)) :
+					u32(vertexStart[s] + id);
+			}
+
+			slab = {};
+		}
+	});
+
+	return ret;
+}
+
+// marching cubes
+// Vertices on the x and y edges of a plane of samples,
+// indexed by y * size.x + x.
+struct Plane {
+	std::vector<u32> x;
+	std::vector<u32> y;
+};
+
+struct McSlab : Extractor {
+	Slab& out;
+	u32 foreignCount {};
+
+	u32 vertex(u32 x, u32 y, u32 z, unsigned axis, bool local) {
+		if(!local) {
+			return foreign | (foreignCount++);
+		}
+
+		auto [pos, grad] = intersect(x, y, z, axis);
+		out.positions.push_back(pos);
+		out.normals.push_back(normalized(grad));
+		return u32(out.positions.size() - 1);
+	}
+
+	// The x and y edges in a plane come first (in sample order),
+	// then the z edges to the next plane.
+	void plane(u32 z, const std::vector<u8>& outside, Plane& plane,
+			bool local) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		for(auto y = 0u; y < ny; ++y) {
+			for(auto x = 0u; x < nx; ++x) {
+				auto id = y * nx + x;
+				plane.x[id] = (x + 1 < nx && outside[id] != outside[id + 1]) ?
+					vertex(x, y, z, 0, local) : noVertex;
+				plane.y[id] = (y + 1 < ny && outside[id] != outside[id + nx]) ?
+					vertex(x, y, z, 1, local) : noVertex;
+			}
+		}
+	}
+
+	void zEdges(u32 z, const std::vector<u8>& below,
+			const std::vector<u8>& above, std::vector<u32>& edges) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		for(auto y = 0u; y < ny; ++y) {
+			for(auto x = 0u; x < nx; ++x) {
+				auto id = y * nx + x;
+				edges[id] = (below[id] != above[id]) ?
+					vertex(x, y, z, 2, true) : noVertex;
+			}
+		}
+	}
+
+	void cells(const std::vector<u8>& below, const std::vector<u8>& above,
+			const Plane& bottom, const Plane& top,
+			const std::vector<u32>& zedges) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		for(auto y = 0u; y + 1 < ny; ++y) {
+			for(auto x = 0u; x + 1 < nx; ++x) {
+				auto id = y * nx + x;
+				auto config = this->config(below.data(), above.data(), id);
+				if(config == 0 || config == 255) {
+					continue;
+				}
+
+				u32 edges[12] = {
+					bottom.x[id],
+					zedges[id + 1],
+					top.x[id],
+					zedges[id],
+					bottom.x[id + nx],
+					zedges[id + nx + 1],
+					top.x[id + nx],
+					zedges[id + nx],
+					bottom.y[id],
+					bottom.y[id + 1],
+					top.y[id + 1],
+					top.y[id],
+				};
+
+				// flip order, table contains them clockwise
+				auto* tris = mc::triTable[config];
+				for(auto i = 0u; tris[i] != -1; i += 3) {
+					out.indices.push_back(edges[tris[i + 0]]);
+					out.indices.push_back(edges[tris[i + 2]]);
+					out.indices.push_back(edges[tris[i + 1]]);
+					dlg_assert(out.indices.back() != noVertex);
+				}
+			}
+		}
+	}
+
+	void run(u32 z0, u32 z1) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		auto nz = grid.size.z;
+		auto count = nx * ny;
+		Plane bottom {std::vector<u32>(count), std::vector<u32>(count)};
+		Plane top {std::vector<u32>(count), std::vector<u32>(count)};
+		std::vector<u32> zedges(count);
+		std::vector<u8> below(count);
+		std::vector<u8> above(count);
+
+		classify(z0, below);
+		plane(z0, below, bottom, true);
+		for(auto z = z0; z < z1; ++z) {
+			classify(z + 1, above);
+			zEdges(z, below, above, zedges);
+
+			// the first plane of the next slab is owned by it
+			auto local = (z + 1 < z1 || z + 1 == nz - 1);
+			plane(z + 1, above, top, local);
+			cells(below, above, bottom, top, zedges);
+			std::swap(bottom, top);
+			std::swap(below, above);
+		}
+	}
+};
+
+// dual marching cubes
+// Dual vertices of a layer of cells, indexed by y * (size.x - 1) + x.
+struct DualLayer {
+	std::vector<u8> config;
+	std::vector<u32> first; // index of the first dual vertex of a cell
+};
+
+struct DmcSlab : Extractor {
+	Slab& out;
+	u32 foreignCount {};
+
+	void layer(u32 z, const std::vector<u8>& below,
+			const std::vector<u8>& above, DualLayer& layer, bool local) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		for(auto y = 0u; y + 1 < ny; ++y) {
+			for(auto x = 0u; x + 1 < nx; ++x) {
+				auto id = y * (nx - 1) + x;
+				auto config = this->config(below.data(), above.data(), y * nx + x);
+				layer.config[id] = u8(config);
+				layer.first[id] = noVertex;
+				if(config == 0 || config == 255) {
+					continue;
+				}
+
+				for(auto& group : mc::dualPointsList[config]) {
+					auto edges = unsigned(group.value());
+					if(edges == 0) {
+						break;
+					}
+
+					u32 vertex;
+					if(local) {
+						vertex = dualVertex(x, y, z, edges);
+					} else {
+						vertex = foreign | (foreignCount++);
+					}
+
+					if(layer.first[id] == noVertex) {
+						layer.first[id] = vertex;
+					}
+				}
+			}
+		}
+	}
+
+	u32 dualVertex(u32 x, u32 y, u32 z, unsigned edges) {
+		auto pos = Vec3f{0.f, 0.f, 0.f};
+		auto grad = Vec3f{0.f, 0.f, 0.f};
+		auto count = 0u;
+		for(auto e = 0u; e < 12u; ++e) {
+			if(!(edges & (1u << e))) {
+				continue;
+			}
+
+			// intersect from the corner with the smaller coordinate
+			auto& start = mc::edgeStarts[e];
+			auto [p, g] = intersect(x + start[0], y + start[1],
+				z + start[2], start[3]);
+			pos += p;
+			grad += g;
+			++count;
+		}
+
+		out.positions.push_back((1.f / count) * pos);
+		out.normals.push_back(normalized(grad));
+		return u32(out.positions.size() - 1);
+	}
+
+	// The dual vertex of the given cell in the layer that is associated
+	// with the given cell edge.
+	u32 vertex(const DualLayer& layer, u32 cx, u32 cy, unsigned edge) const {
+		auto id = cy * (grid.size.x - 1) + cx;
+		auto& groups = mc::dualPointsList[layer.config[id]];
+		for(auto i = 0u; i < 4u; ++i) {
+			if(unsigned(groups[i].value()) & (1u << edge)) {
+				return layer.first[id] + i;
+			}
+		}
+
+		dlg_error("dual vertex for crossed edge not found");
+		return layer.first[id];
+	}
+
+	// The vertices must be ordered counter-clockwise around the
+	// positive axis of the edge. If the edge starts inside, the
+	// surface faces in that direction.
+	void quad(u32 a, u32 b, u32 c, u32 d, bool startInside) {
+		if(!startInside) {
+			std::swap(b, d);
+		}
+
+		out.indices.insert(out.indices.end(), {a, b, c, a, c, d});
+	}
+
+	// Quads of the z edges between the planes z (below) and z + 1 (above).
+	void zQuads(const std::vector<u8>& below, const std::vector<u8>& above,
+			const DualLayer& layer) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		for(auto y = 1u; y + 1 < ny; ++y) {
+			for(auto x = 1u; x + 1 < nx; ++x) {
+				auto id = y * nx + x;
+				if(below[id] == above[id]) {
+					continue;
+				}
+
+				quad(vertex(layer, x - 1, y - 1, 5),
+					vertex(layer, x, y - 1, 7),
+					vertex(layer, x, y, 3),
+					vertex(layer, x - 1, y, 1),
+					!below[id]);
+			}
+		}
+	}
+
+	// Quads of the x and y edges in a plane, between the layers
+	// below and above it.
+	void planeQuads(const std::vector<u8>& outside, const DualLayer& below,
+			const DualLayer& above) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		for(auto y = 0u; y < ny; ++y) {
+			for(auto x = 0u; x < nx; ++x) {
+				auto id = y * nx + x;
+				if(y > 0 && y + 1 < ny && x + 1 < nx &&
+						outside[id] != outside[id + 1]) {
+					quad(vertex(below, x, y - 1, 6),
+						vertex(below, x, y, 2),
+						vertex(above, x, y, 0),
+						vertex(above, x, y - 1, 4),
+						!outside[id]);
+				}
+
+				if(x > 0 && x + 1 < nx && y + 1 < ny &&
+						outside[id] != outside[id + nx]) {
+					quad(vertex(below, x - 1, y, 10),
+						vertex(above, x - 1, y, 9),
+						vertex(above, x, y, 8),
+						vertex(below, x, y, 11),
+						!outside[id]);
+				}
+			}
+		}
+	}
+
+	void run(u32 z0, u32 z1) {
+		auto nx = grid.size.x;
+		auto ny = grid.size.y;
+		auto nz = grid.size.z;
+		auto cellCount = (nx - 1) * (ny - 1);
+		DualLayer prev {std::vector<u8>(cellCount), std::vector<u32>(cellCount)};
+		DualLayer cur {std::vector<u8>(cellCount), std::vector<u32>(cellCount)};
+		std::vector<u8> below(nx * ny);
+		std::vector<u8> above(nx * ny);
+
+		classify(z0, below);
+		for(auto z = z0; z < z1; ++z) {
+			classify(z + 1, above);
+			layer(z, below, above, cur, true);
+			zQuads(below, above, cur);
+			if(z > z0) {
+				planeQuads(below, prev, cur);
+			}
+
+			std::swap(prev, cur);
+			std::swap(below, above);
+		}
+
+		// the first layer of the next slab is owned by it
+		if(z1 < nz - 1) {
+			classify(z1 + 1, above);
+			layer(z1, below, above, cur, false);
+			planeQuads(below, prev, cur);
+		}
+	}
+};
+
+} // anon namespace
+
+void sample(SdfGrid& grid, const SdfRowFunc& func, ThreadPool* pool) {
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	auto nx = grid.size.x;
+	auto ny = grid.size.y;
+	auto nz = grid.size.z;
+	grid.values.resize(std::size_t(nx) * ny * nz);
+	parallelFor(*pool, std::size_t(ny) * nz, rowGrain, [&](auto begin, auto end) {
+		std::vector<float> xs(nx);
+		for(auto x = 0u; x < nx; ++x) {
+			xs[x] = grid.start.x + x * grid.spacing.x;
+		}
+
+		for(auto row = begin; row < end; ++row) {
+			auto y = u32(row % ny);
+			auto z = u32(row / ny);
+			auto py = grid.start.y + y * grid.spacing.y;
+			auto pz = grid.start.z + z * grid.spacing.z;
+			auto values = nytl::Span<float>(grid.values.data() + row * nx, nx);
+			func(xs, py, pz, values);
+		}
+	});
+}
+
+IsoMesh marchingCubes(const SdfGrid& grid, float iso, ThreadPool* pool) {
+	return extract(grid, pool, [&](Slab& slab, u32 z0, u32 z1) {
+		McSlab{{grid, iso}, slab}.run(z0, z1);
+	});
+}
+
+IsoMesh dualMarchingCubes(const SdfGrid& grid, float iso, ThreadPool* pool) {
+	return extract(grid, pool, [&](Slab& slab, u32 z0, u32 z1) {
+		DmcSlab{{grid, iso}, slab}.run(z0, z1);
+	});
+}
+
+} // namespace tkn
@@ -1,5 +1,12 @@
+#pragma once
+
+// Lookup tables for marching cubes and dual marching cubes,
+// used by isosurface.cpp and sparseGrid.cpp.
+
 #include <nytl/flags.hpp>
 
+namespace tkn::mc {
+
 // Indexing of corners
 //
 //      ^ Y
@@ -76,6 +83,19 @@ constexpr struct {
 	{3, 7}, // edge11
 };
 
+// Offsets of the corners, indexed by corner.
+constexpr unsigned cornerOffsets[8][3] = {
+	{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1},
+	{0, 1, 0}, {1, 1, 0}, {1, 1, 1}, {0, 1, 1},
+};
+
+// Start corner offset and axis of the edges, indexed by edge.
+constexpr unsigned edgeStarts[12][4] = {
+	{0, 0, 0, 0}, {1, 0, 0, 2}, {0, 0, 1, 0}, {0, 0, 0, 2},
+	{0, 1, 0, 0}, {1, 1, 0, 2}, {0, 1, 1, 0}, {0, 1, 0, 2},
+	{0, 0, 0, 1}, {1, 0, 0, 1}, {1, 0, 1, 1}, {0, 0, 1, 1},
+};
+
 // indexed by cube bitmask
 // contains the values from Edge as integer bitmask
 constexpr int edgeTable[256] = {
@@ -376,7 +396,7 @@ constexpr int triTable[256][16] = {
 // the second index is for up to four dual points.
 // Each value of a table entry encodes the edges with an associated dual point.
 // A value of 0 indicates a dummy point.
-EdgeFlags dualPointsList[256][4] = {
+constexpr EdgeFlags dualPointsList[256][4] = {
 	{Edge::none, Edge::none, Edge::none, Edge::none}, // Edge::none
 	{Edge::e0|Edge::e3|Edge::e8, Edge::none, Edge::none, Edge::none}, // 1
 	{Edge::e0|Edge::e1|Edge::e9, Edge::none, Edge::none, Edge::none}, // 2
@@ -634,3 +654,5 @@ EdgeFlags dualPointsList[256][4] = {
 	{Edge::e0|Edge::e3|Edge::e8, Edge::none, Edge::none, Edge::none}, // 254
 	{Edge::none, Edge::none, Edge::none, Edge::none} // 255
 };
+
+} // namespace tkn::mc
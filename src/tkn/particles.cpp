@@ -0,0 +1,128 @@
+#include <tkn/particles.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace tkn {
+namespace {
+
+// Number of points per parallelFor range.
+constexpr auto pointGrain = 1024u;
+
+u32 nextPow2(u32 x) {
+	auto ret = 1u;
+	while(ret < x) {
+		ret <<= 1;
+	}
+	return ret;
+}
+
+} // anon namespace
+
+void SpatialHash::build(nytl::Span<const Vec2f> points, float cellSize) {
+	dlg_assert(cellSize > 0.f);
+	cellSize_ = cellSize;
+	invCellSize_ = 1 / cellSize;
+	mask_ = nextPow2(std::max<u32>(points.size(), 1u)) - 1;
+	rowStride_ = nextPow2(u32(std::ceil(std::sqrt(float(mask_ + 1)))));
+
+	// counting sort by bucket
+	auto buckets = mask_ + 1;
+	bucketStart_.assign(buckets + 1, 0u);
+	buckets_.resize(points.size());
+	for(auto i = 0u; i < points.size(); ++i) {
+		auto b = bucket(points[i]);
+		buckets_[i] = b;
+		++bucketStart_[b + 1];
+	}
+
+	for(auto b = 0u; b < buckets; ++b) {
+		bucketStart_[b + 1] += bucketStart_[b];
+	}
+
+	// bucketStart_[b] is used as insertion point for bucket b - 1, ends
+	// up as its end, i.e. the start of bucket b
+	order_.resize(points.size());
+	sorted_.resize(points.size());
+	for(auto i = 0u; i < points.size(); ++i) {
+		auto s = bucketStart_[buckets_[i]]++;
+		order_[s] = i;
+		sorted_[s] = points[i];
+	}
+
+	std::memmove(bucketStart_.data() + 1, bucketStart_.data(),
+		buckets * sizeof(bucketStart_[0]));
+	bucketStart_[0] = 0u;
+}
+
+void applyAttraction(nytl::Span<const Vec2f> positions,
+		nytl::Span<Vec2f> velocities, float dt, const AttractionParams& params,
+		SpatialHash& hash, ThreadPool* pool) {
+	dlg_assert(positions.size() == velocities.size());
+	dlg_assert(params.radius > 0.f);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	hash.build(positions, params.radius);
+
+	// Iterate the points in bucket order, consecutive points then
+	// visit the same (or neighboring) buckets. Only velocities[i] is written for
+	// point i and the neighbors are always summed in the same order.
+	auto order = hash.order();
+	auto sorted = hash.sortedPoints();
+	auto r2 = params.radius * params.radius;
+	auto invRadius = 1 / params.radius;
+	parallelFor(*pool, sorted.size(), pointGrain, [&](auto begin, auto end) {
+		for(auto s = begin; s < end; ++s) {
+			auto pos = sorted[s];
+			auto sum = Vec2f{0.f, 0.f};
+			hash.forEachNear(pos, [&](u32 o) {
+				auto dx = sorted[o].x - pos.x;
+				auto dy = sorted[o].y - pos.y;
+				auto d2 = dx * dx + dy * dy;
+				if(d2 >= r2 || d2 == 0.f) {
+					return;
+				}
+
+				auto fac = 1 / std::sqrt(d2) - invRadius;
+				sum.x += fac * dx;
+				sum.y += fac * dy;
+			});
+
+			auto fac = dt * params.strength;
+			velocities[order[s]].x += fac * sum.x;
+			velocities[order[s]].y += fac * sum.y;
+		}
+	});
+}
+
+// Trails
+Trails::Trails(nytl::Span<const Vec2f> positions, unsigned length) :
+		count_(positions.size()), length_(length) {
+	dlg_assert(length > 0);
+	data_.resize(count_ * (length + 1));
+	for(auto i = 0u; i < count_; ++i) {
+		auto begin = data_.begin() + i * (length + 1);
+		std::fill(begin, begin + length + 1, positions[i]);
+	}
+}
+
+void Trails::push(nytl::Span<const Vec2f> positions) {
+	dlg_assert(positions.size() == count_);
+	head_ = (head_ + length_ - 1) % length_;
+	auto stride = length_ + 1;
+	for(auto i = 0u; i < count_; ++i) {
+		data_[i * stride + head_] = positions[i];
+	}
+
+	if(head_ == 0) {
+		for(auto i = 0u; i < count_; ++i) {
+			data_[i * stride + length_] = positions[i];
+		}
+	}
+}
+
+} // namespace tkn
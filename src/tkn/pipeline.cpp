@@ -10,24 +10,9 @@
 #include <vpp/image.hpp>
 #include <vpp/debug.hpp>
 #include <dlg/dlg.hpp>
-#include <nytl/scope.hpp>
-#include <spirv_reflect.h>
 
 namespace tkn {
 
-vk::DescriptorType toVk(SpvReflectDescriptorType type) {
-	return static_cast<vk::DescriptorType>(type);
-}
-
-void checkThrow(SpvReflectResult res, bool allowNotFound = false) {
-	if(res != SPV_REFLECT_RESULT_SUCCESS &&
-			(!allowNotFound || res != SPV_REFLECT_RESULT_ERROR_ELEMENT_NOT_FOUND)) {
-		// TODO: provide descriptive message
-		auto msg = dlg::format("spir-v reflection failed: {}", (int) res);
-		throw std::runtime_error(msg);
-	}
-}
-
 template<typename V>
 void resizeAtLeast(V& vec, std::size_t size) {
 	if(vec.size() < size) {
@@ -81,35 +66,33 @@ void cmdBindCompute(vk::CommandBuffer cb, const PipeLayoutDescriptors& state) {
 // catch it.
 PipeLayoutDescriptors inferComputeState(const vpp::Device& dev, nytl::Span<const u32> spv,
 		vpp::DescriptorAllocator* dsAlloc, const SamplerProvider* samplers) {
+	return inferComputeState(dev, reflect(spv), dsAlloc, samplers);
+}
+
+PipeLayoutDescriptors inferComputeState(const vpp::Device& dev,
+		const ShaderReflection& refl, vpp::DescriptorAllocator* dsAlloc,
+		const SamplerProvider* samplers) {
 	if(!dsAlloc) {
 		dsAlloc = &dev.descriptorAllocator();
 	}
 
-	SpvReflectShaderModule reflMod;
-	auto res = spvReflectCreateShaderModule(spv.size() * sizeof(u32), spv.data(), &reflMod);
-	checkThrow(res);
-
-	auto modGuard = nytl::ScopeGuard([&]{
-		spvReflectDestroyShaderModule(&reflMod);
-	});
-
 	PipeLayoutDescriptors state;
 
 	// descriptor set layouts
+	// the bindings are sorted by set
 	std::vector<vk::DescriptorSetLayout> dsLayouts;
-	for(auto i = 0u; i < reflMod.descriptor_set_count; ++i) {
-		auto& set = reflMod.descriptor_sets[i];
-		vk::DescriptorSetLayoutCreateInfo ci;
+	for(auto it = refl.bindings.begin(); it != refl.bindings.end();) {
+		auto setID = it->set;
 
 		std::vector<vk::DescriptorSetLayoutBinding> bindings;
-		for(auto i = 0u; i < set.binding_count; ++i) {
-			auto& binding = *set.bindings[i];
+		for(; it != refl.bindings.end() && it->set == setID; ++it) {
+			auto& binding = *it;
 
 			vk::DescriptorSetLayoutBinding info;
 			info.binding = binding.binding;
 			info.descriptorCount = binding.count;
 			info.stageFlags = vk::ShaderStageBits::compute;
-			info.descriptorType = toVk(binding.descriptor_type);
+			info.descriptorType = binding.type;
 			if(samplers && needsSampler(info.descriptorType)) {
 				dlg_assert(info.descriptorCount == 1u);
 				info.pImmutableSamplers = (*samplers)(binding.set, binding.binding);
@@ -118,14 +101,15 @@ PipeLayoutDescriptors inferComputeState(const vpp::Device& dev, nytl::Span<const
 			bindings.push_back(info);
 		}
 
-		ci.bindingCount = set.binding_count;
+		vk::DescriptorSetLayoutCreateInfo ci;
+		ci.bindingCount = bindings.size();
 		ci.pBindings = bindings.data();
 
-		resizeAtLeast(state.descriptors, set.set + 1);
-		resizeAtLeast(dsLayouts, set.set + 1);
-		state.descriptors[set.set].layout.init(dev, ci);
-		state.descriptors[set.set].bindings = std::move(bindings);
-		dsLayouts[set.set] = state.descriptors[set.set].layout;
+		resizeAtLeast(state.descriptors, setID + 1);
+		resizeAtLeast(dsLayouts, setID + 1);
+		state.descriptors[setID].layout.init(dev, ci);
+		state.descriptors[setID].bindings = std::move(bindings);
+		dsLayouts[setID] = state.descriptors[setID].layout;
 	}
 
 	// pipeline layout
@@ -134,13 +118,10 @@ PipeLayoutDescriptors inferComputeState(const vpp::Device& dev, nytl::Span<const
 	plci.setLayoutCount = dsLayouts.size();
 
 	// push constant ranges
-	auto blockVar = spvReflectGetEntryPointPushConstantBlock(&reflMod,
-		shaderEntryPointName, &res);
-	checkThrow(res, true);
-	if(blockVar) {
-		vk::PushConstantRange pcr;
-		pcr.offset = blockVar->offset;
-		pcr.size = blockVar->size;
+	vk::PushConstantRange pcr;
+	if(refl.pushConstantSize) {
+		pcr.offset = refl.pushConstantOffset;
+		pcr.size = refl.pushConstantSize;
 		pcr.stageFlags = vk::ShaderStageBits::compute;
 
 		plci.pushConstantRangeCount = 1u;
@@ -161,41 +142,51 @@ PipeLayoutDescriptors inferComputeState(const vpp::Device& dev, nytl::Span<const
 PipeLayoutDescriptors inferGraphicsState(const vpp::Device& dev, nytl::Span<const u32> vert,
 		nytl::Span<const u32> frag, vpp::DescriptorAllocator* dsAlloc,
 		const SamplerProvider* samplers) {
+	return inferGraphicsState(dev, reflect(vert), reflect(frag), dsAlloc, samplers);
+}
+
+PipeLayoutDescriptors inferGraphicsState(const vpp::Device& dev,
+		const ShaderReflection& vert, const ShaderReflection& frag,
+		vpp::DescriptorAllocator* dsAlloc, const SamplerProvider* samplers) {
 	if(!dsAlloc) {
 		dsAlloc = &dev.descriptorAllocator();
 	}
 
-	SpvReflectShaderModule reflVert {};
-	auto res0 = spvReflectCreateShaderModule(vert.size() * sizeof(u32), vert.data(), &reflVert);
-	SpvReflectShaderModule reflFrag {};
-	auto res1 = spvReflectCreateShaderModule(frag.size() * sizeof(u32), frag.data(), &reflFrag);
-
-	auto modGuard = nytl::ScopeGuard([&]{
-		spvReflectDestroyShaderModule(&reflVert);
-		spvReflectDestroyShaderModule(&reflFrag);
-	});
-
-	checkThrow(res0);
-	checkThrow(res1);
-
 	PipeLayoutDescriptors state;
 
 	// descriptor set layouts
 	std::vector<std::vector<vk::DescriptorSetLayoutBinding>> bindings;
-	for(auto i = 0u; i < reflVert.descriptor_set_count; ++i) {
-		auto& set = reflVert.descriptor_sets[i];
-		resizeAtLeast(bindings, set.set + 1);
-
-		for(auto i = 0u; i < set.binding_count; ++i) {
-			auto& binding = *set.bindings[i];
-
-			resizeAtLeast(bindings[set.set], binding.binding + 1);
-			auto& info = bindings[set.set][binding.binding];
+	for(auto& binding : vert.bindings) {
+		resizeAtLeast(bindings, binding.set + 1);
+		resizeAtLeast(bindings[binding.set], binding.binding + 1);
+		auto& info = bindings[binding.set][binding.binding];
+
+		info.binding = binding.binding;
+		info.descriptorCount = binding.count;
+		info.stageFlags = vk::ShaderStageBits::vertex;
+		info.descriptorType = binding.type;
+		if(samplers && needsSampler(info.descriptorType)) {
+			dlg_assert(info.descriptorCount == 1u);
+			info.pImmutableSamplers = (*samplers)(binding.set, binding.binding);
+		}
+	}
 
+	for(auto& binding : frag.bindings) {
+		resizeAtLeast(bindings, binding.set + 1);
+		resizeAtLeast(bindings[binding.set], binding.binding + 1);
+		auto& info = bindings[binding.set][binding.binding];
+		if(info.stageFlags) { // was already seen before
+			dlg_assert(info.binding == binding.binding);
+			info.descriptorCount = std::max(info.descriptorCount, binding.count);
+			info.stageFlags |= vk::ShaderStageBits::fragment;
+			if(info.descriptorType != binding.type) {
+				throw std::runtime_error("Vertex/fragment shader bindings don't match");
+			}
+		} else {
 			info.binding = binding.binding;
 			info.descriptorCount = binding.count;
-			info.stageFlags = vk::ShaderStageBits::vertex;
-			info.descriptorType = toVk(binding.descriptor_type);
+			info.stageFlags = vk::ShaderStageBits::fragment;
+			info.descriptorType = binding.type;
 			if(samplers && needsSampler(info.descriptorType)) {
 				dlg_assert(info.descriptorCount == 1u);
 				info.pImmutableSamplers = (*samplers)(binding.set, binding.binding);
@@ -203,35 +194,6 @@ PipeLayoutDescriptors inferGraphicsState(const vpp::Device& dev, nytl::Span<cons
 		}
 	}
 
-	for(auto i = 0u; i < reflFrag.descriptor_set_count; ++i) {
-		auto& set = reflFrag.descriptor_sets[i];
-		resizeAtLeast(bindings, set.set + 1);
-
-		for(auto i = 0u; i < set.binding_count; ++i) {
-			auto& binding = *set.bindings[i];
-
-			resizeAtLeast(bindings[set.set], binding.binding + 1);
-			auto& info = bindings[set.set][binding.binding];
-			if(info.stageFlags) { // was already seen before
-				dlg_assert(info.binding == binding.binding);
-				info.descriptorCount = std::max(info.descriptorCount, binding.count);
-				info.stageFlags |= vk::ShaderStageBits::fragment;
-				if(info.descriptorType != toVk(binding.descriptor_type)) {
-					throw std::runtime_error("Vertex/fragment shader bindings don't match");
-				}
-			} else {
-				info.binding = binding.binding;
-				info.descriptorCount = binding.count;
-				info.stageFlags = vk::ShaderStageBits::fragment;
-				info.descriptorType = toVk(binding.descriptor_type);
-				if(samplers && needsSampler(info.descriptorType)) {
-					dlg_assert(info.descriptorCount == 1u);
-					info.pImmutableSamplers = (*samplers)(binding.set, binding.binding);
-				}
-			}
-		}
-	}
-
 	std::vector<vk::DescriptorSetLayout> dsLayouts;
 	dsLayouts.resize(bindings.size());
 	state.descriptors.resize(bindings.size());
@@ -255,26 +217,18 @@ PipeLayoutDescriptors inferGraphicsState(const vpp::Device& dev, nytl::Span<cons
 	plci.setLayoutCount = dsLayouts.size();
 
 	// push constant ranges
-	auto vertBlockVar = spvReflectGetEntryPointPushConstantBlock(&reflVert,
-		shaderEntryPointName, &res0);
-	checkThrow(res0, true);
-
-	auto fragBlockVar = spvReflectGetEntryPointPushConstantBlock(&reflFrag,
-		shaderEntryPointName, &res1);
-	checkThrow(res1, true);
-
 	vk::PushConstantRange pcrs[2];
 	auto pcrCount = 0u;
-	if(vertBlockVar) {
-		pcrs[pcrCount].offset = vertBlockVar->offset;
-		pcrs[pcrCount].size = vertBlockVar->size;
+	if(vert.pushConstantSize) {
+		pcrs[pcrCount].offset = vert.pushConstantOffset;
+		pcrs[pcrCount].size = vert.pushConstantSize;
 		pcrs[pcrCount].stageFlags = vk::ShaderStageBits::vertex;
 		++pcrCount;
 	}
 
-	if(fragBlockVar) {
-		pcrs[pcrCount].offset = fragBlockVar->offset;
-		pcrs[pcrCount].size = fragBlockVar->size;
+	if(frag.pushConstantSize) {
+		pcrs[pcrCount].offset = frag.pushConstantOffset;
+		pcrs[pcrCount].size = frag.pushConstantSize;
 		pcrs[pcrCount].stageFlags = vk::ShaderStageBits::fragment;
 		++pcrCount;
 	}
@@ -385,7 +339,11 @@ void ReloadablePipeline::reload() {
 
 bool ReloadablePipeline::update() {
 	if(!future_.valid()) {
-		if(fileWatcher_) {
+		// All pipelines affected by a batch of file changes start their
+		// reload in the same frame, the jobs run in parallel and
+		// ShaderCache makes sure shared shaders are only compiled once.
+		if(fileWatcher_ && fileWatcher_->batchCount() != checkedBatch_) {
+			checkedBatch_ = fileWatcher_->batchCount();
 			for(auto watch : fileWatches_) {
 				if(fileWatcher_->check(watch.id)) {
 					reload();
@@ -467,14 +425,23 @@ ReloadablePipeline::CreateInfo ReloadablePipeline::recreate(const vpp::Device& d
 
 	dlg_assert(!stages.empty());
 
+	// compile all stages in parallel
 	auto& sc = ShaderCache::instance(dev);
+	std::vector<ShaderCache::LoadRequest> requests;
+	requests.reserve(stages.size());
+	for(auto& stage : stages) {
+		requests.push_back({stage.file, stage.preamble});
+	}
+
+	auto modules = sc.loadMany(requests);
+
 	std::vector<CompiledStage> cstages;
 	cstages.reserve(stages.size());
-
-	for(auto& stage : stages) {
+	for(auto i = 0u; i < stages.size(); ++i) {
+		auto& stage = stages[i];
 		auto& cstage = cstages.emplace_back();
 		cstage.stage = stage;
-		cstage.module = sc.load(stage.file, stage.preamble);
+		cstage.module = modules[i];
 		if(!cstage.module.mod) {
 			return {};
 		}
@@ -584,7 +551,8 @@ vpp::Pipeline ManagedComputePipe::recreate(
 			return provider ? provider->samplers(set, binding) : nullptr;
 		});
 
-		state = inferComputeState(info.dev, stage.module.spv, &dsAlloc, &samplers);
+		auto& refl = ShaderCache::instance(info.dev).reflection(stage.module.spv);
+		state = inferComputeState(info.dev, refl, &dsAlloc, &samplers);
 		nameHandle(state, info.pipeName);
 	}
 
@@ -714,7 +682,9 @@ vpp::Pipeline ManagedGraphicsPipe::recreate(
 			return provider.samplers(set, binding);
 		});
 
-		state = inferGraphicsState(info.dev, vertSpv, fragSpv, &dsAlloc, &samplers);
+		auto& sc = ShaderCache::instance(info.dev);
+		state = inferGraphicsState(info.dev, sc.reflection(vertSpv),
+			sc.reflection(fragSpv), &dsAlloc, &samplers);
 		nameHandle(state, info.pipeName);
 	}
 
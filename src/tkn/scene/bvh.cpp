@@ -0,0 +1,660 @@
+#include <tkn/scene/bvh.hpp>
+#include <tkn/threadPool.hpp>
+#include <nytl/vecOps.hpp>
+#include <nytl/matOps.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace tkn {
+namespace {
+
+constexpr auto inf = std::numeric_limits<float>::infinity();
+
+// Centroid extents up to this are treated as zero. Smaller (denormal)
+// extents would make the bin scale infinite.
+constexpr auto minExtent = Bvh::binCount * std::numeric_limits<float>::min();
+
+Aabb emptyBounds() {
+	return {{inf, inf, inf}, {-inf, -inf, -inf}};
+}
+
+void extend(Aabb& a, const Aabb& b) {
+	a.min = nytl::vec::cw::min(a.min, b.min);
+	a.max = nytl::vec::cw::max(a.max, b.max);
+}
+
+void extend(Aabb& a, Vec3f p) {
+	a.min = nytl::vec::cw::min(a.min, p);
+	a.max = nytl::vec::cw::max(a.max, p);
+}
+
+float area(Vec3f min, Vec3f max) {
+	auto d = max - min;
+	if(d.x < 0.f || d.y < 0.f || d.z < 0.f) {
+		return 0.f; // empty
+	}
+
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+float area(const Aabb& b) {
+	return area(b.min, b.max);
+}
+
+// Range of items in Bvh::items_ that will become a node.
+struct Range {
+	u32 begin;
+	u32 end;
+	Aabb bounds; // of the items
+	Aabb cbounds; // of the item centroids
+
+	u32 size() const { return end - begin; }
+};
+
+struct Bin {
+	Aabb bounds;
+	Aabb cbounds;
+	u32 count;
+};
+
+using Bins = std::array<std::array<Bin, Bvh::binCount>, 3>;
+
+class Builder {
+public:
+	// Ranges with more items are binned in parallel.
+	static constexpr auto parallelThreshold = 16 * 1024u;
+	static constexpr auto parallelGrain = 4 * 1024u;
+
+	nytl::Span<const Aabb> bounds;
+	nytl::Span<u32> items;
+	ThreadPool& pool;
+	std::vector<Vec3f> centroids;
+
+public:
+	Builder(nytl::Span<const Aabb> bounds, nytl::Span<u32> items,
+			ThreadPool& pool) : bounds(bounds), items(items), pool(pool) {
+		centroids.resize(bounds.size());
+		parallelFor(pool, bounds.size(), parallelGrain, [&](auto begin, auto end) {
+			for(auto i = begin; i < end; ++i) {
+				centroids[i] = 0.5f * (bounds[i].min + bounds[i].max);
+			}
+		});
+	}
+
+	Range range(u32 begin, u32 end) const {
+		Range ret {begin, end, emptyBounds(), emptyBounds()};
+		auto add = [&](Range& r, u32 b, u32 e) {
+			for(auto i = b; i < e; ++i) {
+				extend(r.bounds, bounds[items[i]]);
+				extend(r.cbounds, centroids[items[i]]);
+			}
+		};
+
+		if(end - begin < parallelThreshold) {
+			add(ret, begin, end);
+			return ret;
+		}
+
+		std::mutex mutex;
+		parallelFor(pool, end - begin, parallelGrain, [&](auto b, auto e) {
+			Range local {0u, 0u, emptyBounds(), emptyBounds()};
+			add(local, begin + b, begin + e);
+
+			std::lock_guard lock(mutex);
+			extend(ret.bounds, local.bounds);
+			extend(ret.cbounds, local.cbounds);
+		});
+
+		return ret;
+	}
+
+	// Splits the given range, returns false if it should become a leaf.
+	bool split(const Range& range, Range& left, Range& right) {
+		auto n = range.size();
+		if(n <= 1u) {
+			return false;
+		}
+
+		auto& cb = range.cbounds;
+		auto extent = cb.max - cb.min;
+		if(extent.x <= minExtent && extent.y <= minExtent && extent.z <= minExtent) {
+			// all centroids equal, binning can't separate them
+			if(n <= Bvh::maxLeafSize) {
+				return false;
+			}
+
+			auto mid = range.begin + n / 2;
+			left = this->range(range.begin, mid);
+			right = this->range(mid, range.end);
+			return true;
+		}
+
+		// Small nodes use less bins, the fixed cost of evaluating
+		// all bins dominates there otherwise.
+		auto binCount = std::min(n, Bvh::binCount);
+		auto clear = [&](Bins& bins) {
+			for(auto& axis : bins) {
+				for(auto i = 0u; i < binCount; ++i) {
+					axis[i] = {emptyBounds(), emptyBounds(), 0u};
+				}
+			}
+		};
+
+		// scale for bin computation; the centroid at cb.max must
+		// still land in the last bin
+		Vec3f scale;
+		for(auto a = 0u; a < 3; ++a) {
+			scale[a] = extent[a] > minExtent ? 0.9999f * binCount / extent[a] : 0.f;
+		}
+
+		auto binOf = [&](u32 item, unsigned axis) {
+			auto b = (centroids[item][axis] - cb.min[axis]) * scale[axis];
+			return std::min(u32(b), binCount - 1);
+		};
+
+		auto binRange = [&](Bins& bins, u32 begin, u32 end) {
+			for(auto i = begin; i < end; ++i) {
+				auto item = items[i];
+				for(auto a = 0u; a < 3; ++a) {
+					auto& bin = bins[a][binOf(item, a)];
+					++bin.count;
+					extend(bin.bounds, bounds[item]);
+					extend(bin.cbounds, centroids[item]);
+				}
+			}
+		};
+
+		Bins bins;
+		clear(bins);
+		if(n < parallelThreshold) {
+			binRange(bins, range.begin, range.end);
+		} else {
+			std::mutex mutex;
+			parallelFor(pool, n, parallelGrain, [&](auto b, auto e) {
+				Bins local;
+				clear(local);
+				binRange(local, range.begin + b, range.begin + e);
+
+				std::lock_guard lock(mutex);
+				for(auto a = 0u; a < 3; ++a) {
+					for(auto i = 0u; i < binCount; ++i) {
+						auto& dst = bins[a][i];
+						auto& src = local[a][i];
+						dst.count += src.count;
+						extend(dst.bounds, src.bounds);
+						extend(dst.cbounds, src.cbounds);
+					}
+				}
+			});
+		}
+
+		// find the split with the lowest cost
+		// cost(split after bin i) = area(left) * count(left) +
+		//   area(right) * count(right)
+		auto bestCost = inf;
+		auto bestAxis = 0u;
+		auto bestBin = 0u;
+		for(auto a = 0u; a < 3; ++a) {
+			if(extent[a] <= minExtent) {
+				continue;
+			}
+
+			std::array<float, Bvh::binCount> rightCost;
+			auto accum = emptyBounds();
+			auto count = 0u;
+			for(auto i = binCount - 1; i > 0; --i) {
+				extend(accum, bins[a][i].bounds);
+				count += bins[a][i].count;
+				rightCost[i - 1] = count * area(accum);
+			}
+
+			accum = emptyBounds();
+			count = 0u;
+			for(auto i = 0u; i < binCount - 1; ++i) {
+				extend(accum, bins[a][i].bounds);
+				count += bins[a][i].count;
+				if(count == 0u || count == n) {
+					continue;
+				}
+
+				auto cost = count * area(accum) + rightCost[i];
+				if(cost < bestCost) {
+					bestCost = cost;
+					bestAxis = a;
+					bestBin = i;
+				}
+			}
+		}
+
+		// Surface area heuristic, traversal and intersection cost are
+		// assumed to be equal. The leaf cost is n intersections,
+		// a split one traversal plus the expected intersections.
+		auto leafCost = float(n);
+		auto splitCost = 1.f + bestCost / area(range.bounds);
+		if(bestCost == inf || (n <= Bvh::maxLeafSize && leafCost <= splitCost)) {
+			// bestCost can't be inf if n > 1 and there is any extent
+			dlg_assert(n <= Bvh::maxLeafSize);
+			return false;
+		}
+
+		auto first = items.begin() + range.begin;
+		auto last = items.begin() + range.end;
+		auto mid = std::partition(first, last, [&](u32 item) {
+			return binOf(item, bestAxis) <= bestBin;
+		});
+
+		auto midID = u32(mid - items.begin());
+		left = {range.begin, midID, emptyBounds(), emptyBounds()};
+		right = {midID, range.end, emptyBounds(), emptyBounds()};
+		for(auto i = 0u; i < binCount; ++i) {
+			auto& bin = bins[bestAxis][i];
+			auto& dst = (i <= bestBin) ? left : right;
+			extend(dst.bounds, bin.bounds);
+			extend(dst.cbounds, bin.cbounds);
+		}
+
+		dlg_assert(left.size() > 0 && right.size() > 0);
+		return true;
+	}
+
+	// Serially builds the subtree for the given range into 'nodes',
+	// starting with its root at the current end.
+	void build(std::vector<Bvh::Node>& nodes, const Range& root) {
+		std::vector<std::pair<u32, Range>> stack;
+		stack.push_back({u32(nodes.size()), root});
+		nodes.emplace_back();
+
+		while(!stack.empty()) {
+			auto [id, range] = stack.back();
+			stack.pop_back();
+
+			Range left, right;
+			auto node = Bvh::Node {range.bounds.min, range.begin,
+				range.bounds.max, range.size()};
+			if(split(range, left, right)) {
+				node.first = nodes.size();
+				node.count = 0u;
+				nodes.emplace_back();
+				nodes.emplace_back();
+				stack.push_back({node.first, left});
+				stack.push_back({node.first + 1, right});
+			}
+
+			nodes[id] = node;
+		}
+	}
+};
+
+// Frustum planes in SoA layout, padded to 8 planes that
+// are always satisfied.
+struct PackedPlanes {
+	alignas(16) float x[8];
+	alignas(16) float y[8];
+	alignas(16) float z[8];
+	alignas(16) float w[8];
+};
+
+PackedPlanes pack(const FrustumPlanes& planes) {
+	PackedPlanes ret {};
+	for(auto i = 0u; i < 8u; ++i) {
+		auto p = i < planes.size() ? planes[i] : nytl::Vec4f{0.f, 0.f, 0.f, 1.f};
+		ret.x[i] = p[0];
+		ret.y[i] = p[1];
+		ret.z[i] = p[2];
+		ret.w[i] = p[3];
+	}
+
+	return ret;
+}
+
+enum class Containment {
+	outside,
+	intersect,
+	inside,
+};
+
+// Checks the given box against all planes. For each plane, the box is
+// outside when the corner furthest along the normal is outside and
+// completely inside when the nearest corner is inside.
+Containment test(const PackedPlanes& p, Vec3f min, Vec3f max) {
+	auto inside = true;
+
+#ifdef __SSE2__
+	const auto zero = _mm_setzero_ps();
+	const auto minx = _mm_set1_ps(min.x);
+	const auto miny = _mm_set1_ps(min.y);
+	const auto minz = _mm_set1_ps(min.z);
+	const auto maxx = _mm_set1_ps(max.x);
+	const auto maxy = _mm_set1_ps(max.y);
+	const auto maxz = _mm_set1_ps(max.z);
+
+	auto select = [](__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	};
+
+	for(auto i = 0u; i < 8u; i += 4) {
+		auto nx = _mm_load_ps(p.x + i);
+		auto ny = _mm_load_ps(p.y + i);
+		auto nz = _mm_load_ps(p.z + i);
+		auto w = _mm_load_ps(p.w + i);
+
+		auto mx = _mm_cmpge_ps(nx, zero);
+		auto my = _mm_cmpge_ps(ny, zero);
+		auto mz = _mm_cmpge_ps(nz, zero);
+
+		auto outer = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(nx, select(mx, maxx, minx)),
+			_mm_mul_ps(ny, select(my, maxy, miny))), _mm_add_ps(
+			_mm_mul_ps(nz, select(mz, maxz, minz)), w));
+		if(_mm_movemask_ps(_mm_cmplt_ps(outer, zero))) {
+			return Containment::outside;
+		}
+
+		auto inner = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(nx, select(mx, minx, maxx)),
+			_mm_mul_ps(ny, select(my, miny, maxy))), _mm_add_ps(
+			_mm_mul_ps(nz, select(mz, minz, maxz)), w));
+		inside &= !_mm_movemask_ps(_mm_cmplt_ps(inner, zero));
+	}
+#else
+	for(auto i = 0u; i < 8u; ++i) {
+		auto outer =
+			p.x[i] * (p.x[i] >= 0.f ? max.x : min.x) +
+			p.y[i] * (p.y[i] >= 0.f ? max.y : min.y) +
+			p.z[i] * (p.z[i] >= 0.f ? max.z : min.z) + p.w[i];
+		if(outer < 0.f) {
+			return Containment::outside;
+		}
+
+		auto inner =
+			p.x[i] * (p.x[i] >= 0.f ? min.x : max.x) +
+			p.y[i] * (p.y[i] >= 0.f ? min.y : max.y) +
+			p.z[i] * (p.z[i] >= 0.f ? min.z : max.z) + p.w[i];
+		inside &= (inner >= 0.f);
+	}
+#endif // __SSE2__
+
+	return inside ? Containment::inside : Containment::intersect;
+}
+
+// Returns the ray parameter where the ray enters the box or
+// inf if it misses it.
+float intersect(Vec3f origin, Vec3f invDir, Vec3f min, Vec3f max, float maxT) {
+	auto tmin = 0.f;
+	auto tmax = maxT;
+	for(auto a = 0u; a < 3; ++a) {
+		auto t1 = (min[a] - origin[a]) * invDir[a];
+		auto t2 = (max[a] - origin[a]) * invDir[a];
+		// NaN (origin on a slab, parallel ray) is ignored by the
+		// order of arguments, std::max/min return the first one then
+		tmin = std::max(tmin, std::min(t1, t2));
+		tmax = std::min(tmax, std::max(t1, t2));
+	}
+
+	return tmin <= tmax ? tmin : inf;
+}
+
+} // anon namespace
+
+Aabb transform(const Aabb& box, const nytl::Mat4f& mat) {
+	// Transforms the center and the extent separately, see
+	// Arvo, "Transforming Axis-Aligned Bounding Boxes", 1990
+	auto center = 0.5f * (box.min + box.max);
+	auto extent = 0.5f * (box.max - box.min);
+
+	Vec3f c, e;
+	for(auto r = 0u; r < 3; ++r) {
+		c[r] = mat[r][3];
+		e[r] = 0.f;
+		for(auto i = 0u; i < 3; ++i) {
+			c[r] += mat[r][i] * center[i];
+			e[r] += std::abs(mat[r][i]) * extent[i];
+		}
+	}
+
+	return {c - e, c + e};
+}
+
+FrustumPlanes frustumPlanes(const Frustum& f) {
+	// see ndcFrustum for the corner order
+	constexpr unsigned faces[6][3] = {
+		{0, 1, 2}, // near
+		{4, 5, 6}, // far
+		{0, 1, 4}, // top
+		{3, 2, 7}, // bottom
+		{0, 3, 4}, // left
+		{1, 2, 5}, // right
+	};
+
+	auto center = Vec3f{0.f, 0.f, 0.f};
+	for(auto& p : f) {
+		center += p;
+	}
+	center *= 1.f / f.size();
+
+	FrustumPlanes ret;
+	for(auto i = 0u; i < 6u; ++i) {
+		auto& a = f[faces[i][0]];
+		auto& b = f[faces[i][1]];
+		auto& c = f[faces[i][2]];
+		auto n = nytl::normalized(nytl::cross(b - a, c - a));
+
+		// make the normal point inside, independent of winding
+		if(nytl::dot(n, center - a) < 0.f) {
+			n = -n;
+		}
+
+		ret[i] = {n.x, n.y, n.z, -nytl::dot(n, a)};
+	}
+
+	return ret;
+}
+
+FrustumPlanes frustumPlanes(const nytl::Mat4f& viewProj) {
+	auto inv = nytl::Mat4f(nytl::inverse(viewProj));
+	auto frustum = ndcFrustum();
+	for(auto& p : frustum) {
+		p = multPos(inv, p);
+	}
+
+	return frustumPlanes(frustum);
+}
+
+void Bvh::build(nytl::Span<const Aabb> bounds, ThreadPool* pool) {
+	nodes_.clear();
+	items_.resize(bounds.size());
+	bounds_.assign(bounds.begin(), bounds.end());
+	std::iota(items_.begin(), items_.end(), 0u);
+	if(bounds.empty()) {
+		return;
+	}
+
+	auto& tp = pool ? *pool : ThreadPool::instance();
+	Builder builder(bounds_, items_, tp);
+	nodes_.reserve(2 * bounds.size());
+
+	// 1: split the top levels serially (but large nodes are binned in
+	// parallel) until the nodes are small enough to be distributed
+	// as subtrees over the threads.
+	auto threads = tp.numWorkers() + 1;
+	auto subtreeSize = std::max<u32>(1024u, bounds.size() / (8 * threads));
+
+	std::vector<std::pair<u32, Range>> subtrees;
+	std::vector<std::pair<u32, Range>> stack;
+	stack.push_back({0u, builder.range(0u, bounds.size())});
+	nodes_.emplace_back();
+
+	while(!stack.empty()) {
+		auto [id, range] = stack.back();
+		stack.pop_back();
+
+		Range left, right;
+		if(range.size() <= subtreeSize || !builder.split(range, left, right)) {
+			subtrees.push_back({id, range});
+			continue;
+		}
+
+		auto first = u32(nodes_.size());
+		nodes_[id] = {range.bounds.min, first, range.bounds.max, 0u};
+		nodes_.emplace_back();
+		nodes_.emplace_back();
+		stack.push_back({first, left});
+		stack.push_back({first + 1, right});
+	}
+
+	// 2: build the subtrees in parallel
+	std::vector<std::vector<Node>> trees(subtrees.size());
+	parallelFor(tp, subtrees.size(), 1u, [&](auto begin, auto end) {
+		for(auto i = begin; i < end; ++i) {
+			builder.build(trees[i], subtrees[i].second);
+		}
+	});
+
+	// 3: append them, their root replaces the node reserved in step 1
+	for(auto i = 0u; i < subtrees.size(); ++i) {
+		auto& tree = trees[i];
+		auto base = u32(nodes_.size()) - 1; // local 0 is not appended
+		for(auto& node : tree) {
+			if(node.count == 0u) {
+				node.first += base;
+			}
+		}
+
+		nodes_[subtrees[i].first] = tree[0];
+		nodes_.insert(nodes_.end(), tree.begin() + 1, tree.end());
+	}
+}
+
+void Bvh::refit(nytl::Span<const Aabb> bounds) {
+	dlg_assert(bounds.size() == items_.size());
+	bounds_.assign(bounds.begin(), bounds.end());
+
+	// children always come after their parent
+	for(auto i = nodes_.size(); i-- > 0;) {
+		auto& node = nodes_[i];
+		auto box = emptyBounds();
+		if(node.count == 0u) {
+			auto& a = nodes_[node.first];
+			auto& b = nodes_[node.first + 1];
+			box = {nytl::vec::cw::min(a.min, b.min),
+				nytl::vec::cw::max(a.max, b.max)};
+		} else {
+			for(auto j = 0u; j < node.count; ++j) {
+				extend(box, bounds_[items_[node.first + j]]);
+			}
+		}
+
+		node.min = box.min;
+		node.max = box.max;
+	}
+}
+
+void Bvh::cull(const FrustumPlanes& planes, std::vector<u32>& visible) const {
+	if(nodes_.empty()) {
+		return;
+	}
+
+	auto packed = pack(planes);
+
+	// entries: (node, whether it's known to be completely inside)
+	std::vector<std::pair<u32, bool>> stack;
+	stack.reserve(64);
+	stack.push_back({0u, false});
+	while(!stack.empty()) {
+		auto [id, inside] = stack.back();
+		stack.pop_back();
+
+		auto& node = nodes_[id];
+		if(!inside) {
+			auto res = test(packed, node.min, node.max);
+			if(res == Containment::outside) {
+				continue;
+			}
+
+			inside = (res == Containment::inside);
+		}
+
+		if(node.count == 0u) {
+			stack.push_back({node.first, inside});
+			stack.push_back({node.first + 1, inside});
+			continue;
+		}
+
+		for(auto i = 0u; i < node.count; ++i) {
+			auto item = items_[node.first + i];
+			auto& box = bounds_[item];
+			if(inside || test(packed, box.min, box.max) != Containment::outside) {
+				visible.push_back(item);
+			}
+		}
+	}
+}
+
+void Bvh::raycast(Vec3f origin, Vec3f dir, float maxT,
+		std::vector<RayHit>& hits) const {
+	if(nodes_.empty()) {
+		return;
+	}
+
+	auto invDir = Vec3f{1.f / dir.x, 1.f / dir.y, 1.f / dir.z};
+	auto first = hits.size();
+
+	std::vector<u32> stack;
+	stack.reserve(64);
+	stack.push_back(0u);
+	while(!stack.empty()) {
+		auto& node = nodes_[stack.back()];
+		stack.pop_back();
+
+		if(intersect(origin, invDir, node.min, node.max, maxT) == inf) {
+			continue;
+		}
+
+		if(node.count == 0u) {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+			continue;
+		}
+
+		for(auto i = 0u; i < node.count; ++i) {
+			auto item = items_[node.first + i];
+			auto& box = bounds_[item];
+			auto t = intersect(origin, invDir, box.min, box.max, maxT);
+			if(t != inf) {
+				hits.push_back({item, t});
+			}
+		}
+	}
+
+	std::sort(hits.begin() + first, hits.end(),
+		[](auto& a, auto& b) { return a.t < b.t; });
+}
+
+float Bvh::sahCost() const {
+	if(nodes_.empty()) {
+		return 0.f;
+	}
+
+	auto rootArea = area(nodes_[0].min, nodes_[0].max);
+	if(rootArea <= 0.f) {
+		return 1.f + nodes_[0].count;
+	}
+
+	auto cost = 0.f;
+	for(auto& node : nodes_) {
+		auto a = area(node.min, node.max) / rootArea;
+		cost += a * (node.count == 0u ? 1.f : 1.f + node.count);
+	}
+
+	return cost;
+}
+
+} // namespace tkn
@@ -0,0 +1,608 @@
+#include <tkn/scene/cache.hpp>
+#include <tkn/scene/meshOpt.hpp>
+#include <tkn/scene/meshlet.hpp>
+#include <tkn/scene/simplify.hpp>
+#include <tkn/threadPool.hpp>
+#include <tkn/stream.hpp>
+#include <tkn/image.hpp>
+#include <tkn/file.hpp>
+#include <dlg/dlg.hpp>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+
+namespace fs = std::filesystem;
+
+// File layout, all values in native layout:
+// - Header
+// - sources: {u64 size, i64 writeTime, u64 hash, u32 pathLength,
+//   char path[pathLength]}
+// - SamplerInfo[samplerCount]
+// - Material[materialCount]
+// - Scene::Instance[instanceCount]
+// - images: ImageHeader, char path[pathLength]
+// - primitives: PrimitiveHeader
+// - data blobs (16-byte aligned), referenced by offset from the headers.
+//   Primitive blobs contain the indices, positions, normals, texCoords0,
+//   texCoords1, the meshlet, meshlet vertex and meshlet triangle and
+//   the lod level and lod index arrays in that order.
+
+namespace tkn {
+namespace {
+
+constexpr char magic[8] = {'t', 'k', 'n', 's', 'c', 'e', 'n', 'e'};
+
+struct Header {
+	char magic[8];
+	u32 version;
+	u32 layout;
+	u32 sourceCount;
+	u32 samplerCount;
+	u32 materialCount;
+	u32 imageCount;
+	u32 primitiveCount;
+	u32 instanceCount;
+	u64 size; // of the whole file
+};
+
+struct ImageHeader {
+	u32 srgb;
+	u32 needed;
+	u32 format;
+	nytl::Vec3ui size;
+	u32 pathLength;
+	u64 offset;
+	u64 dataSize;
+};
+
+struct PrimitiveHeader {
+	nytl::Vec3f min;
+	nytl::Vec3f max;
+	u64 indexCount;
+	u64 vertexCount;
+	u64 tc0Count;
+	u64 tc1Count;
+	u64 meshletCount;
+	u64 meshletVertexCount;
+	u64 meshletTriangleCount;
+	u64 lodLevelCount;
+	u64 lodIndexCount;
+	u64 offset;
+};
+
+// Changes when the layout of any stored struct changes. Caches from
+// other builds with different struct layouts are simply not used.
+constexpr u32 layout() {
+	return u32(sizeof(Header) ^ (sizeof(ImageHeader) << 6u) ^
+		(sizeof(PrimitiveHeader) << 12u) ^ (sizeof(SamplerInfo) << 18u) ^
+		(sizeof(Material) << 22u) ^ (sizeof(Scene::Instance) << 26u) ^
+		(sizeof(Meshlet) << 3u) ^ (sizeof(LodLevel) << 9u));
+}
+
+// Last modification time of the given file, in ticks of the
+// filesystem clock.
+i64 writeTime(const std::string& path, std::error_code& ec) {
+	auto time = fs::last_write_time(path, ec);
+	return i64(time.time_since_epoch().count());
+}
+
+// Thrown by the reader on invalid data, caught in readSceneCache.
+struct InvalidCache : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+struct Reader {
+	nytl::Span<const std::byte> data;
+	std::size_t at {};
+
+	nytl::Span<const std::byte> bytes(std::size_t off, std::size_t size) const {
+		if(off > data.size() || size > data.size() - off) {
+			throw InvalidCache("out of bounds");
+		}
+
+		return data.subspan(off, size);
+	}
+
+	nytl::Span<const std::byte> next(std::size_t size) {
+		auto ret = bytes(at, size);
+		at += size;
+		return ret;
+	}
+
+	template<typename T>
+	T get() {
+		static_assert(std::is_trivially_copyable_v<T>);
+		T ret;
+		std::memcpy(&ret, next(sizeof(T)).data(), sizeof(T));
+		return ret;
+	}
+
+	template<typename T>
+	void array(std::vector<T>& dst, std::size_t count) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		if(count > data.size() / sizeof(T)) {
+			throw InvalidCache("invalid array size");
+		}
+
+		auto src = next(count * sizeof(T));
+		dst.resize(count);
+		std::memcpy(dst.data(), src.data(), src.size());
+	}
+
+	std::string string(std::size_t length) {
+		auto src = next(length);
+		return {reinterpret_cast<const char*>(src.data()), src.size()};
+	}
+};
+
+struct Writer {
+	std::vector<std::byte> buf;
+
+	void putBytes(nytl::Span<const std::byte> data) {
+		buf.insert(buf.end(), data.begin(), data.end());
+	}
+
+	// Returns the offset at which the value was written
+	template<typename T>
+	std::size_t put(const T& val) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		auto off = buf.size();
+		putBytes(tkn::bytes(val));
+		return off;
+	}
+
+	template<typename T>
+	void array(const std::vector<T>& vals) {
+		putBytes(tkn::bytes(vals));
+	}
+
+	void string(std::string_view str) {
+		auto data = reinterpret_cast<const std::byte*>(str.data());
+		putBytes({data, str.size()});
+	}
+
+	void align(std::size_t alignment) {
+		buf.resize(alignment * ((buf.size() + alignment - 1) / alignment));
+	}
+
+	// Overwrites an already written value at the given offset
+	template<typename T>
+	void set(std::size_t off, const T& val) {
+		dlg_assert(off + sizeof(T) <= buf.size());
+		std::memcpy(buf.data() + off, &val, sizeof(T));
+	}
+};
+
+// Maps the whole file into memory. Returns std::nullopt if it can't be
+// opened or is empty.
+std::optional<StreamMemoryMap> mapFile(nytl::StringParam path) {
+	auto file = File(path, "rb");
+	if(!file) {
+		return std::nullopt;
+	}
+
+	std::error_code ec;
+	if(fs::file_size(path.c_str(), ec) == 0u || ec) {
+		return std::nullopt;
+	}
+
+	return StreamMemoryMap(std::make_unique<FileStream>(std::move(file)));
+}
+
+bool isDataUri(std::string_view uri) {
+	return uri.substr(0, 5) == "data:";
+}
+
+// Optimizes the meshes, generates meshlets from the optimized
+// triangle order and builds the lod chains.
+void bakeMeshes(SceneData& scene) {
+	std::vector<MeshOptStats> stats(scene.primitives.size());
+	parallelFor(ThreadPool::instance(), scene.primitives.size(), 1u,
+			[&](std::size_t begin, std::size_t end) {
+		for(auto i = begin; i < end; ++i) {
+			auto& p = scene.primitives[i];
+			stats[i] = optimizeMesh(p);
+			p.meshlets = buildMeshlets(p.indices, p.positions);
+			p.lods = buildLods(p.indices, p.positions, p.normals,
+				p.texCoords0);
+		}
+	});
+
+	// report the totals, weighted by triangle count
+	auto tris = 0u;
+	auto meshlets = 0u;
+	auto lods = 0u;
+	MeshOptStats total;
+	for(auto i = 0u; i < stats.size(); ++i) {
+		tris += scene.primitives[i].indices.size() / 3;
+		meshlets += scene.primitives[i].meshlets.meshlets.size();
+		lods += scene.primitives[i].lods.levels.size();
+		total.verticesBefore += stats[i].verticesBefore;
+		total.verticesAfter += stats[i].verticesAfter;
+		total.before.misses += stats[i].before.misses;
+		total.after.misses += stats[i].after.misses;
+	}
+
+	if(tris == 0u) {
+		return;
+	}
+
+	dlg_info("Optimized {} primitives: vertices {} -> {}, ACMR {} -> {}, "
+		"ATVR {} -> {}", stats.size(),
+		total.verticesBefore, total.verticesAfter,
+		float(total.before.misses) / tris, float(total.after.misses) / tris,
+		float(total.before.misses) / total.verticesBefore,
+		float(total.after.misses) / total.verticesAfter);
+	dlg_info("Built {} meshlets, {} triangles per meshlet on average",
+		meshlets, float(tris) / meshlets);
+	dlg_info("Built {} levels of detail", lods);
+}
+
+} // anon namespace
+
+u64 contentHash(nytl::Span<const std::byte> data, u64 seed) {
+	// word-wise mixing (from murmur3), finalizer from murmur3's fmix64.
+	constexpr auto c1 = u64(0x87c37b91114253d5ull);
+	constexpr auto c2 = u64(0x4cf5ad432745937full);
+	auto rotl = [](u64 x, unsigned r) { return (x << r) | (x >> (64u - r)); };
+
+	auto h = seed ^ u64(0xcbf29ce484222325ull);
+	auto ptr = data.data();
+	auto left = data.size();
+	for(; left >= 8u; left -= 8u, ptr += 8u) {
+		u64 k;
+		std::memcpy(&k, ptr, 8u);
+		k = rotl(k * c1, 31u) * c2;
+		h = rotl(h ^ k, 27u) * 5u + 0x52dce729u;
+	}
+
+	for(; left > 0u; --left, ++ptr) {
+		h = (h ^ u64(*ptr)) * u64(0x100000001b3ull);
+	}
+
+	h ^= data.size();
+	h ^= h >> 33u;
+	h *= u64(0xff51afd7ed558ccdull);
+	h ^= h >> 33u;
+	h *= u64(0xc4ceb9fe1a85ec53ull);
+	h ^= h >> 33u;
+	return h;
+}
+
+bool writeSceneCache(nytl::StringParam file, const SceneData& scene,
+		nytl::Span<const std::string> sources) {
+	Writer w;
+	w.put(Header{}); // written at the end
+
+	Header header {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = sceneCacheVersion;
+	header.layout = layout();
+	header.sourceCount = sources.size();
+	header.samplerCount = scene.samplers.size();
+	header.materialCount = scene.materials.size();
+	header.imageCount = scene.images.size();
+	header.primitiveCount = scene.primitives.size();
+	header.instanceCount = scene.instances.size();
+
+	for(auto& source : sources) {
+		// query the time first, a later change makes the hash
+		// decide on the next load
+		std::error_code ec;
+		auto time = writeTime(source, ec);
+		auto map = ec ? std::nullopt : mapFile(source);
+		if(!map) {
+			dlg_warn("writeSceneCache: can't read source {}", source);
+			return false;
+		}
+
+		w.put(u64(map->size()));
+		w.put(time);
+		w.put(contentHash(map->span()));
+		w.put(u32(source.size()));
+		w.string(source);
+	}
+
+	w.array(scene.samplers);
+	w.array(scene.materials);
+	w.array(scene.instances);
+
+	// offsets are patched when writing the blobs
+	std::vector<std::size_t> imageHeaders;
+	for(auto& img : scene.images) {
+		dlg_assertm(!img.data.empty(), "writeSceneCache: image not loaded");
+		ImageHeader ih {};
+		ih.srgb = img.srgb;
+		ih.needed = img.needed;
+		ih.format = u32(img.format);
+		ih.size = img.size;
+		ih.pathLength = img.path.size();
+		ih.dataSize = img.data.size();
+		imageHeaders.push_back(w.put(ih));
+		w.string(img.path);
+	}
+
+	std::vector<std::size_t> primHeaders;
+	for(auto& p : scene.primitives) {
+		PrimitiveHeader ph {};
+		ph.min = p.min;
+		ph.max = p.max;
+		ph.indexCount = p.indices.size();
+		ph.vertexCount = p.positions.size();
+		ph.tc0Count = p.texCoords0.size();
+		ph.tc1Count = p.texCoords1.size();
+		ph.meshletCount = p.meshlets.meshlets.size();
+		ph.meshletVertexCount = p.meshlets.vertices.size();
+		ph.meshletTriangleCount = p.meshlets.triangles.size();
+		ph.lodLevelCount = p.lods.levels.size();
+		ph.lodIndexCount = p.lods.indices.size();
+		primHeaders.push_back(w.put(ph));
+	}
+
+	for(auto i = 0u; i < scene.images.size(); ++i) {
+		w.align(16u);
+		w.set(imageHeaders[i] + offsetof(ImageHeader, offset), u64(w.buf.size()));
+		w.putBytes(scene.images[i].data);
+	}
+
+	for(auto i = 0u; i < scene.primitives.size(); ++i) {
+		auto& p = scene.primitives[i];
+		dlg_assert(p.normals.size() == p.positions.size());
+		w.align(16u);
+		w.set(primHeaders[i] + offsetof(PrimitiveHeader, offset), u64(w.buf.size()));
+		w.array(p.indices);
+		w.array(p.positions);
+		w.array(p.normals);
+		w.array(p.texCoords0);
+		w.array(p.texCoords1);
+		w.array(p.meshlets.meshlets);
+		w.array(p.meshlets.vertices);
+		w.array(p.meshlets.triangles);
+		w.array(p.lods.levels);
+		w.array(p.lods.indices);
+	}
+
+	header.size = w.buf.size();
+	w.set(0u, header);
+
+	// other processes never see a partially written cache
+	std::error_code ec;
+	auto data = std::string_view(reinterpret_cast<const char*>(w.buf.data()),
+		w.buf.size());
+	if(!replaceFile(file, data, ec)) {
+		dlg_warn("writeSceneCache: failed to write {}: {}", file, ec.message());
+		return false;
+	}
+
+	return true;
+}
+
+std::optional<SceneData> readSceneCache(nytl::StringParam file) {
+	auto omap = mapFile(file);
+	if(!omap) {
+		return std::nullopt;
+	}
+
+	auto map = std::make_shared<StreamMemoryMap>(std::move(*omap));
+	Reader r{map->span()};
+
+	try {
+		auto header = r.get<Header>();
+		if(std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+				header.version != sceneCacheVersion ||
+				header.layout != layout() ||
+				header.size != map->size()) {
+			dlg_info("Scene cache {}: invalid header or version", file);
+			return std::nullopt;
+		}
+
+		// check that the cache is up-to-date. A source with the same
+		// size and modification time is assumed unchanged, the content
+		// is only hashed when just the time differs.
+		for(auto i = 0u; i < header.sourceCount; ++i) {
+			auto size = r.get<u64>();
+			auto time = r.get<i64>();
+			auto hash = r.get<u64>();
+			auto path = r.string(r.get<u32>());
+
+			std::error_code ec;
+			auto fsize = fs::file_size(path, ec);
+			auto ftime = ec ? 0 : writeTime(path, ec);
+			if(ec || fsize != size) {
+				dlg_info("Scene cache {}: {} changed", file, path);
+				return std::nullopt;
+			}
+
+			if(ftime == time) {
+				continue;
+			}
+
+			auto smap = mapFile(path);
+			if(!smap || contentHash(smap->span()) != hash) {
+				dlg_info("Scene cache {}: {} changed", file, path);
+				return std::nullopt;
+			}
+		}
+
+		SceneData scene;
+		r.array(scene.samplers, header.samplerCount);
+		r.array(scene.materials, header.materialCount);
+		r.array(scene.instances, header.instanceCount);
+
+		scene.images.resize(header.imageCount);
+		for(auto& img : scene.images) {
+			auto ih = r.get<ImageHeader>();
+			img.path = r.string(ih.pathLength);
+			img.srgb = ih.srgb;
+			img.needed = ih.needed;
+			img.format = vk::Format(ih.format);
+			img.size = ih.size;
+			img.data = r.bytes(ih.offset, ih.dataSize);
+		}
+
+		scene.primitives.resize(header.primitiveCount);
+		for(auto& p : scene.primitives) {
+			auto ph = r.get<PrimitiveHeader>();
+			p.min = ph.min;
+			p.max = ph.max;
+
+			Reader blob{r.data, ph.offset};
+			blob.array(p.indices, ph.indexCount);
+			blob.array(p.positions, ph.vertexCount);
+			blob.array(p.normals, ph.vertexCount);
+			blob.array(p.texCoords0, ph.tc0Count);
+			blob.array(p.texCoords1, ph.tc1Count);
+			blob.array(p.meshlets.meshlets, ph.meshletCount);
+			blob.array(p.meshlets.vertices, ph.meshletVertexCount);
+			blob.array(p.meshlets.triangles, ph.meshletTriangleCount);
+			blob.array(p.lods.levels, ph.lodLevelCount);
+			blob.array(p.lods.indices, ph.lodIndexCount);
+
+			for(auto idx : p.indices) {
+				if(idx >= p.positions.size()) {
+					throw InvalidCache("index out of range");
+				}
+			}
+
+			for(auto idx : p.lods.indices) {
+				if(idx >= p.positions.size()) {
+					throw InvalidCache("lod index out of range");
+				}
+			}
+
+			for(auto& lod : p.lods.levels) {
+				if(lod.indexOffset > p.lods.indices.size() ||
+						lod.indexCount > p.lods.indices.size() - lod.indexOffset) {
+					throw InvalidCache("lod level out of range");
+				}
+			}
+
+			auto& md = p.meshlets;
+			for(auto v : md.vertices) {
+				if(v >= p.positions.size()) {
+					throw InvalidCache("meshlet vertex out of range");
+				}
+			}
+
+			for(auto& m : md.meshlets) {
+				if(m.vertexCount > maxMeshletVertices ||
+						m.triangleCount > maxMeshletTriangles ||
+						m.vertexOffset > md.vertices.size() ||
+						m.vertexCount > md.vertices.size() - m.vertexOffset ||
+						m.triangleOffset > md.triangles.size() ||
+						3 * m.triangleCount > md.triangles.size() - m.triangleOffset) {
+					throw InvalidCache("meshlet out of range");
+				}
+
+				auto tris = nytl::span(md.triangles).subspan(m.triangleOffset,
+					3 * m.triangleCount);
+				for(auto t : tris) {
+					if(t >= m.vertexCount) {
+						throw InvalidCache("meshlet triangle out of range");
+					}
+				}
+			}
+		}
+
+		for(auto& ini : scene.instances) {
+			if(ini.primitiveID >= scene.primitives.size() ||
+					ini.materialID >= scene.materials.size()) {
+				throw InvalidCache("invalid instance");
+			}
+		}
+
+		// the images reference the mapping
+		scene.source = std::move(map);
+		return scene;
+	} catch(const InvalidCache& err) {
+		dlg_warn("Scene cache {} is invalid: {}", file, err.what());
+		return std::nullopt;
+	}
+}
+
+std::optional<SceneData> loadSceneCached(nytl::StringParam path,
+		nytl::StringParam cacheDir) {
+	auto resolved = resolveGltf(path);
+	if(!resolved) {
+		return std::nullopt;
+	}
+
+	auto full = resolved->first + resolved->second;
+	std::string cacheFile;
+	if(!cacheDir.empty()) {
+		// The cache is identified by the model path, its content is
+		// validated using the content hashes of all sources.
+		auto key = contentHash({reinterpret_cast<const std::byte*>(full.data()),
+			full.size()});
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.scene",
+			static_cast<unsigned long long>(key));
+
+		cacheFile = cacheDir;
+		if(cacheFile.back() != '/') {
+			cacheFile.push_back('/');
+		}
+		cacheFile += name;
+
+		if(auto scene = readSceneCache(cacheFile); scene) {
+			dlg_info("Loaded scene {} from cache {}", full, cacheFile);
+			return scene;
+		}
+	}
+
+	auto [model, base] = loadGltf(path);
+	if(!model) {
+		return std::nullopt;
+	}
+
+	auto sceneID = model->defaultScene >= 0 ? model->defaultScene : 0;
+	auto scene = loadSceneData(*model, model->scenes[sceneID], base);
+	if(cacheDir.empty()) {
+		return scene;
+	}
+
+	// Only done when baking the cache, not worth it for a single load
+	bakeMeshes(scene);
+
+	std::vector<std::string> sources {full};
+	for(auto& buf : model->buffers) {
+		if(!buf.uri.empty() && !isDataUri(buf.uri)) {
+			sources.push_back(base + buf.uri);
+		}
+	}
+
+	// The images have to be decoded for the cache. We decode them
+	// here, Scene::create will use the decoded data.
+	for(auto& img : scene.images) {
+		if(!img.data.empty()) {
+			continue;
+		}
+
+		auto provider = loadImage(img.path);
+		if(!provider) {
+			dlg_warn("Can't load image {}, not writing scene cache", img.path);
+			return scene;
+		}
+
+		auto data = provider->read(0u, 0u);
+		img.size = provider->size();
+		img.format = provider->format();
+		img.owned = std::make_unique<std::byte[]>(data.size());
+		std::memcpy(img.owned.get(), data.data(), data.size());
+		img.data = {img.owned.get(), data.size()};
+		sources.push_back(img.path);
+	}
+
+	std::error_code ec;
+	fs::create_directories(cacheDir.c_str(), ec);
+	if(ec) {
+		dlg_warn("Can't create scene cache dir {}: {}", cacheDir, ec.message());
+	} else if(writeSceneCache(cacheFile, scene, sources)) {
+		dlg_info("Wrote scene cache {}", cacheFile);
+	}
+
+	return scene;
+}
+
+} // namespace tkn
@@ -30,7 +30,8 @@ constexpr u32 nlastbits(u32 count) {
 }
 
 void initShadowData(ShadowData& data, const vpp::Device& dev, vk::Format depthFormat,
-		vk::DescriptorSetLayout sceneDsLayout, bool multiview, bool depthClamp) {
+		vk::DescriptorSetLayout sceneDsLayout, bool multiview, bool depthClamp,
+		bool compactVertices) {
 	ShadowPipelineInfo spi;
 	spi.dir = {
 		tkn_shadow_s_vert_data,
@@ -42,7 +43,7 @@ void initShadowData(ShadowData& data, const vpp::Device& dev, vk::Format depthFo
 		tkn_shadowPoint_mv_s_vert_data,
 		tkn_shadowPoint_s_frag_data
 	};
-	spi.vertex = Scene::vertexInfo();
+	spi.vertex = Scene::vertexInfo(compactVertices);
 	initShadowData(data, dev, depthFormat, multiview, depthClamp,
 		spi, {{sceneDsLayout}});
 }
@@ -0,0 +1,474 @@
+#include <tkn/scene/meshOpt.hpp>
+#include <nytl/vecOps.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <array>
+
+namespace tkn {
+namespace {
+
+// Parameters from Forsyth's article.
+constexpr auto forsythCacheSize = 32u;
+constexpr auto forsythMaxValence = 32u;
+constexpr auto lastTriScore = 0.75f;
+constexpr auto cacheDecayPower = 1.5f;
+constexpr auto valenceBoostScale = 2.f;
+constexpr auto valenceBoostPower = 0.5f;
+
+struct ScoreTable {
+	std::array<float, forsythCacheSize> cache;
+	std::array<float, forsythMaxValence + 1> valence;
+
+	ScoreTable() {
+		for(auto i = 0u; i < forsythCacheSize; ++i) {
+			if(i < 3) {
+				// the vertices of the last triangle are scored the same,
+				// otherwise the next triangle would be biased
+				cache[i] = lastTriScore;
+			} else {
+				auto s = 1.f - float(i - 3) / (forsythCacheSize - 3);
+				cache[i] = std::pow(s, cacheDecayPower);
+			}
+		}
+
+		valence[0] = 0.f;
+		for(auto i = 1u; i <= forsythMaxValence; ++i) {
+			valence[i] = valenceBoostScale * std::pow(float(i), -valenceBoostPower);
+		}
+	}
+
+	float score(int cachePos, unsigned live) const {
+		if(live == 0u) {
+			return -1.f; // no triangles left, never needed again
+		}
+
+		auto ret = cachePos < 0 ? 0.f : cache[cachePos];
+		ret += live <= forsythMaxValence ? valence[live] :
+			valenceBoostScale * std::pow(float(live), -valenceBoostPower);
+		return ret;
+	}
+};
+
+const ScoreTable& scoreTable() {
+	static const ScoreTable table;
+	return table;
+}
+
+u64 hashVertex(u32 v, nytl::Span<const VertexStream> streams) {
+	// FNV-1a, the vertex data is small
+	auto h = u64(14695981039346656037ull);
+	for(auto& stream : streams) {
+		auto* data = stream.data + v * stream.stride;
+		for(auto i = 0u; i < stream.size; ++i) {
+			h ^= u64(data[i]);
+			h *= u64(1099511628211ull);
+		}
+	}
+
+	return h;
+}
+
+bool equalVertex(u32 a, u32 b, nytl::Span<const VertexStream> streams) {
+	for(auto& stream : streams) {
+		auto* da = stream.data + a * stream.stride;
+		auto* db = stream.data + b * stream.stride;
+		if(std::memcmp(da, db, stream.size) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template<typename Mesh>
+MeshOptStats optimizeMeshImpl(Mesh& mesh, bool overdraw,
+		nytl::Span<const VertexStream> streams) {
+	auto vertexCount = u32(mesh.positions.size());
+
+	MeshOptStats stats;
+	stats.verticesBefore = vertexCount;
+	stats.before = analyzeVertexCache(mesh.indices, vertexCount);
+
+	std::vector<u32> remap(vertexCount);
+	auto unique = generateVertexRemap(remap, mesh.indices, streams);
+	remapIndices(mesh.indices, remap);
+	vertexCount = unique;
+
+	optimizeVertexCache(mesh.indices, mesh.indices, vertexCount);
+
+	// overdraw optimization needs the remapped positions
+	remapVertices(mesh.positions, remap, unique);
+	if(overdraw) {
+		optimizeOverdraw(mesh.indices, mesh.positions);
+	}
+
+	std::vector<u32> fetchRemap(vertexCount);
+	auto used = optimizeVertexFetch(fetchRemap, mesh.indices);
+	dlg_assert(used == unique);
+	remapIndices(mesh.indices, fetchRemap);
+
+	// combine both remaps for the other attributes
+	for(auto& r : remap) {
+		if(r != unusedVertex) {
+			r = fetchRemap[r];
+		}
+	}
+
+	remapVertices(mesh.positions, fetchRemap, used);
+	remapVertices(mesh.normals, remap, used);
+	if constexpr(std::is_same_v<Mesh, Scene::Primitive>) {
+		if(!mesh.texCoords0.empty()) {
+			remapVertices(mesh.texCoords0, remap, used);
+		}
+		if(!mesh.texCoords1.empty()) {
+			remapVertices(mesh.texCoords1, remap, used);
+		}
+	}
+
+	stats.verticesAfter = used;
+	stats.after = analyzeVertexCache(mesh.indices, used);
+	return stats;
+}
+
+} // anon namespace
+
+VertexCacheStats analyzeVertexCache(nytl::Span<const u32> indices,
+		unsigned vertexCount, unsigned cacheSize) {
+	dlg_assert(cacheSize > 0);
+
+	// timestamp of the time the vertex was inserted into the cache.
+	// With a FIFO cache, a vertex is in the cache if it was inserted
+	// during the last 'cacheSize' misses.
+	std::vector<u32> inserted(vertexCount, 0u);
+	auto time = u32(cacheSize + 1);
+
+	VertexCacheStats stats;
+	for(auto idx : indices) {
+		dlg_assert(idx < vertexCount);
+		if(time - inserted[idx] > cacheSize) {
+			inserted[idx] = time++;
+			++stats.misses;
+		}
+	}
+
+	auto tris = indices.size() / 3;
+	stats.acmr = tris ? float(stats.misses) / tris : 0.f;
+	stats.atvr = vertexCount ? float(stats.misses) / vertexCount : 0.f;
+	return stats;
+}
+
+u32 generateVertexRemap(nytl::Span<u32> remap, nytl::Span<const u32> indices,
+		nytl::Span<const VertexStream> streams) {
+	std::fill(remap.begin(), remap.end(), unusedVertex);
+
+	// open addressing hash table of the unique vertices (their original
+	// id), power of two size with load factor <= 0.5
+	auto tableSize = std::size_t(1u);
+	while(tableSize < 2 * remap.size()) {
+		tableSize *= 2;
+	}
+
+	std::vector<u32> table(tableSize, unusedVertex);
+	auto mask = tableSize - 1;
+
+	auto next = u32(0u);
+	for(auto idx : indices) {
+		dlg_assert(idx < remap.size());
+		if(remap[idx] != unusedVertex) {
+			continue;
+		}
+
+		auto bucket = std::size_t(hashVertex(idx, streams)) & mask;
+		while(true) {
+			auto& entry = table[bucket];
+			if(entry == unusedVertex) {
+				entry = idx;
+				remap[idx] = next++;
+				break;
+			}
+
+			if(equalVertex(entry, idx, streams)) {
+				remap[idx] = remap[entry];
+				break;
+			}
+
+			bucket = (bucket + 1) & mask;
+		}
+	}
+
+	return next;
+}
+
+void remapIndices(nytl::Span<u32> indices, nytl::Span<const u32> remap) {
+	for(auto& idx : indices) {
+		dlg_assert(idx < remap.size() && remap[idx] != unusedVertex);
+		idx = remap[idx];
+	}
+}
+
+void optimizeVertexCache(nytl::Span<u32> dst, nytl::Span<const u32> indices,
+		unsigned vertexCount) {
+	dlg_assert(dst.size() == indices.size());
+	dlg_assert(indices.size() % 3 == 0);
+
+	auto triCount = indices.size() / 3;
+	if(triCount == 0) {
+		return;
+	}
+
+	// we write into dst while reading indices
+	std::vector<u32> src(indices.begin(), indices.end());
+	auto& scores = scoreTable();
+
+	// vertex -> triangle adjacency. The first 'live[v]' entries of
+	// the list of a vertex are the triangles not yet emitted.
+	std::vector<u32> live(vertexCount, 0u);
+	for(auto idx : src) {
+		dlg_assert(idx < vertexCount);
+		++live[idx];
+	}
+
+	std::vector<u32> offsets(vertexCount + 1, 0u);
+	for(auto v = 0u; v < vertexCount; ++v) {
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+
+	std::vector<u32> adjacency(src.size());
+	{
+		auto fill = offsets;
+		for(auto t = 0u; t < triCount; ++t) {
+			for(auto j = 0u; j < 3; ++j) {
+				adjacency[fill[src[3 * t + j]]++] = t;
+			}
+		}
+	}
+
+	std::vector<int> cachePos(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for(auto v = 0u; v < vertexCount; ++v) {
+		vertexScore[v] = scores.score(-1, live[v]);
+	}
+
+	std::vector<float> triScore(triCount);
+	std::vector<u8> emitted(triCount, false);
+	auto best = u32(0u);
+	for(auto t = 0u; t < triCount; ++t) {
+		triScore[t] = vertexScore[src[3 * t + 0]] +
+			vertexScore[src[3 * t + 1]] +
+			vertexScore[src[3 * t + 2]];
+		if(triScore[t] > triScore[best]) {
+			best = t;
+		}
+	}
+
+	// the +3 is room for the vertices pushed out when adding a triangle
+	std::vector<u32> cache, newCache;
+	cache.reserve(forsythCacheSize + 3);
+	newCache.reserve(forsythCacheSize + 3);
+
+	auto cursor = u32(0u); // for finding a new start triangle
+	auto out = std::size_t(0u);
+	while(true) {
+		if(best == unusedVertex) {
+			// No triangle in the cache left. Just pick the next one
+			// not yet emitted, scanning for the best one would make
+			// this quadratic for meshes with many small components.
+			while(cursor < triCount && emitted[cursor]) {
+				++cursor;
+			}
+
+			if(cursor == triCount) {
+				break;
+			}
+
+			best = cursor;
+		}
+
+		// emit
+		emitted[best] = true;
+		newCache.clear();
+		for(auto j = 0u; j < 3; ++j) {
+			auto v = src[3 * best + j];
+			dst[out++] = v;
+			newCache.push_back(v);
+
+			// remove the triangle from the live adjacency list
+			auto* list = adjacency.data() + offsets[v];
+			auto it = std::find(list, list + live[v], best);
+			dlg_assert(it != list + live[v]);
+			std::swap(*it, list[live[v] - 1]);
+			--live[v];
+		}
+
+		for(auto v : cache) {
+			if(v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+				newCache.push_back(v);
+			}
+		}
+
+		std::swap(cache, newCache);
+
+		// update the scores of all vertices in (or just pushed out of)
+		// the cache and of their triangles, find the new best one
+		for(auto i = 0u; i < cache.size(); ++i) {
+			auto v = cache[i];
+			cachePos[v] = i < forsythCacheSize ? int(i) : -1;
+			vertexScore[v] = scores.score(cachePos[v], live[v]);
+		}
+
+		best = unusedVertex;
+		auto bestScore = -1.f;
+		for(auto v : cache) {
+			auto* list = adjacency.data() + offsets[v];
+			for(auto k = 0u; k < live[v]; ++k) {
+				auto t = list[k];
+				triScore[t] = vertexScore[src[3 * t + 0]] +
+					vertexScore[src[3 * t + 1]] +
+					vertexScore[src[3 * t + 2]];
+				if(triScore[t] > bestScore) {
+					bestScore = triScore[t];
+					best = t;
+				}
+			}
+		}
+
+		if(cache.size() > forsythCacheSize) {
+			cache.resize(forsythCacheSize);
+		}
+	}
+
+	dlg_assert(out == dst.size());
+}
+
+void optimizeOverdraw(nytl::Span<u32> indices,
+		nytl::Span<const Vec3f> positions, unsigned cacheSize) {
+	dlg_assert(indices.size() % 3 == 0);
+	auto triCount = u32(indices.size() / 3);
+	if(triCount == 0) {
+		return;
+	}
+
+	// find cluster boundaries: triangles where all vertices miss the
+	// (simulated FIFO) cache, i.e. the optimizer had to restart
+	std::vector<u32> inserted(positions.size(), 0u);
+	auto time = u32(cacheSize + 1);
+	std::vector<u32> clusters; // first triangle of each cluster
+	for(auto t = 0u; t < triCount; ++t) {
+		auto misses = 0u;
+		for(auto j = 0u; j < 3; ++j) {
+			auto idx = indices[3 * t + j];
+			dlg_assert(idx < positions.size());
+			if(time - inserted[idx] > cacheSize) {
+				inserted[idx] = time++;
+				++misses;
+			}
+		}
+
+		if(t == 0 || misses == 3) {
+			clusters.push_back(t);
+		}
+	}
+
+	if(clusters.size() == 1) {
+		return;
+	}
+
+	clusters.push_back(triCount);
+
+	// area weighted centroid and normal per cluster
+	struct Cluster {
+		u32 begin;
+		u32 end;
+		float sortKey;
+	};
+
+	auto nc = clusters.size() - 1;
+	std::vector<Cluster> sorted(nc);
+	std::vector<Vec3f> centroids(nc);
+	std::vector<Vec3f> normals(nc);
+	auto meshCentroid = Vec3f{0.f, 0.f, 0.f};
+	auto meshArea = 0.f;
+	for(auto c = 0u; c < nc; ++c) {
+		auto centroid = Vec3f{0.f, 0.f, 0.f};
+		auto normal = Vec3f{0.f, 0.f, 0.f};
+		auto area = 0.f;
+		for(auto t = clusters[c]; t < clusters[c + 1]; ++t) {
+			auto& p0 = positions[indices[3 * t + 0]];
+			auto& p1 = positions[indices[3 * t + 1]];
+			auto& p2 = positions[indices[3 * t + 2]];
+			auto n = nytl::cross(p1 - p0, p2 - p0);
+			auto triArea = nytl::length(n);
+			centroid += triArea * (p0 + p1 + p2) / 3.f;
+			normal += n;
+			area += triArea;
+		}
+
+		meshCentroid += centroid;
+		meshArea += area;
+		centroids[c] = area > 0.f ? centroid / area : centroid;
+		normals[c] = normal;
+		sorted[c] = {clusters[c], clusters[c + 1], 0.f};
+	}
+
+	if(meshArea > 0.f) {
+		meshCentroid /= meshArea;
+	}
+
+	// clusters on the outside (facing away from the center) are
+	// likely to occlude the others
+	for(auto c = 0u; c < nc; ++c) {
+		auto len = nytl::length(normals[c]);
+		auto n = len > 0.f ? normals[c] / len : normals[c];
+		sorted[c].sortKey = nytl::dot(centroids[c] - meshCentroid, n);
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<u32> src(indices.begin(), indices.end());
+	auto out = indices.data();
+	for(auto& cluster : sorted) {
+		auto* begin = src.data() + 3 * cluster.begin;
+		auto* end = src.data() + 3 * cluster.end;
+		out = std::copy(begin, end, out);
+	}
+}
+
+u32 optimizeVertexFetch(nytl::Span<u32> remap, nytl::Span<const u32> indices) {
+	std::fill(remap.begin(), remap.end(), unusedVertex);
+	auto next = u32(0u);
+	for(auto idx : indices) {
+		dlg_assert(idx < remap.size());
+		if(remap[idx] == unusedVertex) {
+			remap[idx] = next++;
+		}
+	}
+
+	return next;
+}
+
+MeshOptStats optimizeMesh(Scene::Primitive& p, bool overdraw) {
+	dlg_assert(p.normals.size() == p.positions.size());
+	std::vector<VertexStream> streams = {p.positions, p.normals};
+	if(!p.texCoords0.empty()) {
+		dlg_assert(p.texCoords0.size() == p.positions.size());
+		streams.push_back(p.texCoords0);
+	}
+	if(!p.texCoords1.empty()) {
+		dlg_assert(p.texCoords1.size() == p.positions.size());
+		streams.push_back(p.texCoords1);
+	}
+
+	return optimizeMeshImpl(p, overdraw, streams);
+}
+
+MeshOptStats optimizeMesh(Shape& shape, bool overdraw) {
+	dlg_assert(shape.normals.size() == shape.positions.size());
+	std::vector<VertexStream> streams = {shape.positions, shape.normals};
+	return optimizeMeshImpl(shape, overdraw, streams);
+}
+
+} // namespace tkn
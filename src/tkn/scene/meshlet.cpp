@@ -0,0 +1,147 @@
+#include <tkn/scene/meshlet.hpp>
+#include <nytl/vecOps.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace tkn {
+
+MeshletData buildMeshlets(nytl::Span<const u32> indices,
+		nytl::Span<const Vec3f> positions) {
+	dlg_assert(indices.size() % 3 == 0);
+
+	MeshletData data;
+	data.meshlets.reserve(indices.size() / (3 * maxMeshletTriangles) + 1);
+	data.vertices.reserve(indices.size() / 3 + 3);
+	data.triangles.reserve(indices.size());
+
+	// local id of each vertex in the current meshlet, 0xFF if it's
+	// not part of it. Reset for the vertices of the finished meshlet.
+	constexpr auto notInMeshlet = u8(0xFFu);
+	std::vector<u8> local(positions.size(), notInMeshlet);
+
+	Meshlet current {};
+	auto finish = [&]{
+		if(current.triangleCount == 0u) {
+			return;
+		}
+
+		computeBounds(current, data, positions);
+		data.meshlets.push_back(current);
+
+		auto verts = nytl::span(data.vertices).subspan(current.vertexOffset);
+		for(auto v : verts) {
+			local[v] = notInMeshlet;
+		}
+
+		current = {};
+		current.vertexOffset = data.vertices.size();
+		current.triangleOffset = data.triangles.size();
+	};
+
+	for(auto i = 0u; i < indices.size(); i += 3) {
+		auto tri = indices.subspan(i, 3);
+		auto newVerts = 0u;
+		for(auto j = 0u; j < 3u; ++j) {
+			dlg_assert(tri[j] < positions.size());
+			// degenerate triangles with duplicate vertices are
+			// counted twice here, that's fine
+			newVerts += (local[tri[j]] == notInMeshlet);
+		}
+
+		if(current.vertexCount + newVerts > maxMeshletVertices ||
+				current.triangleCount + 1 > maxMeshletTriangles) {
+			finish();
+		}
+
+		for(auto j = 0u; j < 3u; ++j) {
+			auto& l = local[tri[j]];
+			if(l == notInMeshlet) {
+				l = current.vertexCount++;
+				data.vertices.push_back(tri[j]);
+			}
+
+			data.triangles.push_back(l);
+		}
+
+		++current.triangleCount;
+	}
+
+	finish();
+	return data;
+}
+
+void computeBounds(Meshlet& meshlet, const MeshletData& data,
+		nytl::Span<const Vec3f> positions) {
+	auto verts = nytl::span(data.vertices).subspan(meshlet.vertexOffset,
+		meshlet.vertexCount);
+	auto tris = nytl::span(data.triangles).subspan(meshlet.triangleOffset,
+		3 * meshlet.triangleCount);
+
+	// Sphere around the center of the bounding box. Not minimal
+	// but meshlets are small and usually compact.
+	auto inf = std::numeric_limits<float>::infinity();
+	auto min = Vec3f{inf, inf, inf};
+	auto max = Vec3f{-inf, -inf, -inf};
+	for(auto v : verts) {
+		min = nytl::vec::cw::min(min, positions[v]);
+		max = nytl::vec::cw::max(max, positions[v]);
+	}
+
+	meshlet.center = 0.5f * (min + max);
+	meshlet.radius = 0.f;
+	for(auto v : verts) {
+		auto dist = nytl::length(positions[v] - meshlet.center);
+		meshlet.radius = std::max(meshlet.radius, dist);
+	}
+
+	// Normal cone, see the meshoptimizer documentation
+	// (meshopt_computeMeshletBounds) for the culling test.
+	std::vector<Vec3f> normals;
+	normals.reserve(meshlet.triangleCount);
+	auto axis = Vec3f{0.f, 0.f, 0.f};
+	for(auto t = 0u; t < meshlet.triangleCount; ++t) {
+		auto& a = positions[verts[tris[3 * t + 0]]];
+		auto& b = positions[verts[tris[3 * t + 1]]];
+		auto& c = positions[verts[tris[3 * t + 2]]];
+		auto n = nytl::cross(b - a, c - a);
+		auto len = nytl::length(n);
+		if(len == 0.f) {
+			continue; // degenerate, never visible
+		}
+
+		n /= len;
+		normals.push_back(n);
+		axis += n;
+	}
+
+	meshlet.coneAxis = Vec3f{0.f, 0.f, 1.f};
+	meshlet.coneCutoff = 1.f;
+
+	auto axisLength = nytl::length(axis);
+	if(normals.empty() || axisLength == 0.f) {
+		return;
+	}
+
+	axis /= axisLength;
+	auto minDot = 1.f;
+	for(auto& n : normals) {
+		minDot = std::min(minDot, nytl::dot(n, axis));
+	}
+
+	meshlet.coneAxis = axis;
+	if(minDot > 0.f) {
+		// sine of the cone spread angle
+		meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+	}
+}
+
+bool backfacing(const Meshlet& meshlet, Vec3f viewPos) {
+	auto dir = meshlet.center - viewPos;
+	auto dist = nytl::length(dir);
+	return nytl::dot(dir, meshlet.coneAxis) >=
+		meshlet.coneCutoff * dist + meshlet.radius;
+}
+
+} // namespace tkn
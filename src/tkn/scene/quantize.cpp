@@ -0,0 +1,335 @@
+#include <tkn/scene/quantize.hpp>
+#include <tkn/f16.hpp>
+#include <nytl/vecOps.hpp>
+#include <nytl/matOps.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+// The scalar and SSE2 paths must produce exactly the same results,
+// both round to nearest (even) via the current rounding mode, i.e.
+// std::lrint and _mm_cvtps_epi32.
+
+namespace tkn {
+namespace {
+
+Vec3f quantizeScale(Vec3f min, Vec3f max) {
+	Vec3f scale;
+	for(auto i = 0u; i < 3; ++i) {
+		auto extent = max[i] - min[i];
+		scale[i] = extent > 0.f ? 65535.f / extent : 0.f;
+	}
+
+	return scale;
+}
+
+CompactPosition quantizePosition(Vec3f pos, Vec3f min, Vec3f scale) {
+	CompactPosition ret {};
+	u16* dst[] = {&ret.x, &ret.y, &ret.z};
+	for(auto i = 0u; i < 3; ++i) {
+		auto v = (pos[i] - min[i]) * scale[i];
+		v = std::min(std::max(v, 0.f), 65535.f);
+		*dst[i] = u16(std::lrint(v));
+	}
+
+	return ret;
+}
+
+float snormToFloat(i16 v) {
+	// as specified by vulkan
+	return std::max(v / 32767.f, -1.f);
+}
+
+#ifdef __SSE2__
+// Packs the low 16 bit of the 4 i32 values (that must be in range
+// [0, 65535] or [-32768, 32767]) into the low 64 bit.
+__m128i pack16(__m128i v) {
+	// sign extend so that packs doesn't saturate
+	v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+	return _mm_packs_epi32(v, v);
+}
+#endif // __SSE2__
+
+} // anon namespace
+
+void quantizePositions(nytl::Span<const Vec3f> src, Vec3f min, Vec3f max,
+		nytl::Span<CompactPosition> dst) {
+	dlg_assert(src.size() == dst.size());
+	auto scale = quantizeScale(min, max);
+	auto i = std::size_t(0u);
+
+#ifdef __SSE2__
+	// One vertex per iteration, loading 4 floats. The fourth value
+	// (belonging to the next vertex) is zeroed by the scale. The last
+	// vertex is done by the scalar path to not read out of bounds.
+	const auto vmin = _mm_setr_ps(min.x, min.y, min.z, 0.f);
+	const auto vscale = _mm_setr_ps(scale.x, scale.y, scale.z, 0.f);
+	const auto zero = _mm_setzero_ps();
+	const auto vmax = _mm_set1_ps(65535.f);
+	for(; i + 1 < src.size(); ++i) {
+		auto v = _mm_loadu_ps(&src[i].x);
+		v = _mm_mul_ps(_mm_sub_ps(v, vmin), vscale);
+		v = _mm_min_ps(_mm_max_ps(v, zero), vmax); // also gets rid of nan
+		auto q = pack16(_mm_cvtps_epi32(v));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(&dst[i]), q);
+	}
+#endif // __SSE2__
+
+	for(; i < src.size(); ++i) {
+		dst[i] = quantizePosition(src[i], min, scale);
+	}
+}
+
+CompactNormal encodeNormal(Vec3f n) {
+	// see encodeNormal in scene.glsl
+	auto l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	l1 = (l1 == 0.f) ? 1.f : l1;
+	auto px = n.x / l1;
+	auto py = n.y / l1;
+	if(n.z <= 0.f) {
+		auto ox = (1.f - std::abs(py)) * (px >= 0.f ? 1.f : -1.f);
+		auto oy = (1.f - std::abs(px)) * (py >= 0.f ? 1.f : -1.f);
+		px = ox;
+		py = oy;
+	}
+
+	auto snorm = [](float v) {
+		v = std::min(std::max(v, -1.f), 1.f);
+		return i16(std::lrint(v * 32767.f));
+	};
+
+	return {snorm(px), snorm(py)};
+}
+
+void encodeNormals(nytl::Span<const Vec3f> src, nytl::Span<CompactNormal> dst) {
+	dlg_assert(src.size() == dst.size());
+	auto i = std::size_t(0u);
+
+#ifdef __SSE2__
+	const auto zero = _mm_setzero_ps();
+	const auto one = _mm_set1_ps(1.f);
+	const auto minusOne = _mm_set1_ps(-1.f);
+	const auto signBit = _mm_set1_ps(-0.f);
+	const auto snormScale = _mm_set1_ps(32767.f);
+
+	auto abs = [&](__m128 v) { return _mm_andnot_ps(signBit, v); };
+	auto select = [](__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	};
+	auto signNotZero = [&](__m128 v) {
+		return select(_mm_cmpge_ps(v, zero), one, minusOne);
+	};
+
+	// 4 normals per iteration, transposed to SoA
+	for(; i + 4 <= src.size(); i += 4) {
+		auto& n0 = src[i + 0];
+		auto& n1 = src[i + 1];
+		auto& n2 = src[i + 2];
+		auto& n3 = src[i + 3];
+		auto x = _mm_setr_ps(n0.x, n1.x, n2.x, n3.x);
+		auto y = _mm_setr_ps(n0.y, n1.y, n2.y, n3.y);
+		auto z = _mm_setr_ps(n0.z, n1.z, n2.z, n3.z);
+
+		auto l1 = _mm_add_ps(_mm_add_ps(abs(x), abs(y)), abs(z));
+		l1 = select(_mm_cmpeq_ps(l1, zero), one, l1);
+		auto px = _mm_div_ps(x, l1);
+		auto py = _mm_div_ps(y, l1);
+
+		auto ox = _mm_mul_ps(_mm_sub_ps(one, abs(py)), signNotZero(px));
+		auto oy = _mm_mul_ps(_mm_sub_ps(one, abs(px)), signNotZero(py));
+		auto lower = _mm_cmple_ps(z, zero);
+		px = select(lower, ox, px);
+		py = select(lower, oy, py);
+
+		px = _mm_min_ps(_mm_max_ps(px, minusOne), one);
+		py = _mm_min_ps(_mm_max_ps(py, minusOne), one);
+		auto ix = _mm_cvtps_epi32(_mm_mul_ps(px, snormScale));
+		auto iy = _mm_cvtps_epi32(_mm_mul_ps(py, snormScale));
+
+		// interleave: x0 y0 x1 y1 x2 y2 x3 y3
+		auto lo = _mm_unpacklo_epi32(ix, iy);
+		auto hi = _mm_unpackhi_epi32(ix, iy);
+		auto packed = _mm_packs_epi32(lo, hi);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[i]), packed);
+	}
+#endif // __SSE2__
+
+	for(; i < src.size(); ++i) {
+		dst[i] = encodeNormal(src[i]);
+	}
+}
+
+u16 quantizeHalf(float v) {
+	// Bit manipulation with rounding to nearest, denormals are
+	// flushed to zero. Compared to the f16 constructor, this rounds.
+	u32 ui;
+	std::memcpy(&ui, &v, sizeof(ui));
+
+	i32 s = (ui >> 16) & 0x8000;
+	i32 em = ui & 0x7fffffff;
+
+	// rebias exponent (127 - 15 = 112) and round
+	i32 h = (em - (112 << 23) + (1 << 12)) >> 13;
+	h = (em < (113 << 23)) ? 0 : h; // underflow, flush to zero
+	h = (em >= (143 << 23)) ? 0x7c00 : h; // overflow, infinity
+	h = (em > (255 << 23)) ? 0x7e00 : h; // nan
+
+	return u16(s | h);
+}
+
+void encodeTexCoords(nytl::Span<const Vec2f> src,
+		nytl::Span<CompactTexCoord> dst) {
+	dlg_assert(src.size() == dst.size());
+	if(src.empty()) {
+		return;
+	}
+
+	// process all components as flat array
+	auto count = 2 * src.size();
+	auto in = &src[0].x;
+	auto out = &dst[0].u;
+	auto i = std::size_t(0u);
+
+#ifdef __SSE2__
+	// The branchless scalar code above, 4 values at a time.
+	const auto absMask = _mm_set1_epi32(0x7fffffff);
+	const auto bias = _mm_set1_epi32((112 << 23) - (1 << 12));
+	const auto minExp = _mm_set1_epi32(113 << 23);
+	const auto maxExp = _mm_set1_epi32((143 << 23) - 1);
+	const auto nanExp = _mm_set1_epi32(255 << 23);
+	const auto inf = _mm_set1_epi32(0x7c00);
+	const auto nan = _mm_set1_epi32(0x7e00);
+
+	auto select = [](__m128i mask, __m128i a, __m128i b) {
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	};
+
+	for(; i + 4 <= count; i += 4) {
+		auto ui = _mm_castps_si128(_mm_loadu_ps(in + i));
+		auto s = _mm_and_si128(_mm_srli_epi32(ui, 16), _mm_set1_epi32(0x8000));
+		auto em = _mm_and_si128(ui, absMask);
+
+		auto h = _mm_srai_epi32(_mm_sub_epi32(em, bias), 13);
+		h = _mm_andnot_si128(_mm_cmplt_epi32(em, minExp), h);
+		h = select(_mm_cmpgt_epi32(em, maxExp), inf, h);
+		h = select(_mm_cmpgt_epi32(em, nanExp), nan, h);
+
+		auto q = pack16(_mm_or_si128(s, h));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), q);
+	}
+#endif // __SSE2__
+
+	for(; i < count; ++i) {
+		out[i] = quantizeHalf(in[i]);
+	}
+}
+
+Vec3f dequantize(CompactPosition pos, Vec3f min, Vec3f max) {
+	auto extent = max - min;
+	return {
+		min.x + (pos.x / 65535.f) * extent.x,
+		min.y + (pos.y / 65535.f) * extent.y,
+		min.z + (pos.z / 65535.f) * extent.z,
+	};
+}
+
+Vec3f decode(CompactNormal n) {
+	// see decodeNormal in scene.glsl
+	auto x = snormToFloat(n.x);
+	auto y = snormToFloat(n.y);
+	auto v = Vec3f{x, y, 1.f - std::abs(x) - std::abs(y)};
+	if(v.z < 0.f) {
+		v.x = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+		v.y = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+	}
+
+	return nytl::normalized(v);
+}
+
+Vec2f decode(CompactTexCoord tc) {
+	f16 u, v;
+	u.bits() = tc.u;
+	v.bits() = tc.v;
+	return {float(u), float(v)};
+}
+
+nytl::Mat4f dequantizeMatrix(Vec3f min, Vec3f max) {
+	auto ret = nytl::identity<4, float>();
+	for(auto i = 0u; i < 3; ++i) {
+		ret[i][i] = max[i] - min[i];
+		ret[i][3] = min[i];
+	}
+
+	return ret;
+}
+
+QuantizationStats& QuantizationStats::operator+=(const QuantizationStats& o) {
+	vertices += o.vertices;
+	floatBytes += o.floatBytes;
+	compactBytes += o.compactBytes;
+	positionError = std::max(positionError, o.positionError);
+	relPositionError = std::max(relPositionError, o.relPositionError);
+	normalError = std::max(normalError, o.normalError);
+	texCoordError = std::max(texCoordError, o.texCoordError);
+	return *this;
+}
+
+QuantizationStats quantizationStats(const Scene::Primitive& p) {
+	QuantizationStats stats;
+	stats.vertices = p.positions.size();
+
+	std::vector<CompactPosition> positions(p.positions.size());
+	quantizePositions(p.positions, p.min, p.max, positions);
+	auto extent = nytl::length(p.max - p.min);
+	for(auto i = 0u; i < positions.size(); ++i) {
+		auto pos = dequantize(positions[i], p.min, p.max);
+		auto err = nytl::length(pos - p.positions[i]);
+		stats.positionError = std::max(stats.positionError, err);
+		if(extent > 0.f) {
+			stats.relPositionError = std::max(stats.relPositionError,
+				err / extent);
+		}
+	}
+
+	std::vector<CompactNormal> normals(p.normals.size());
+	encodeNormals(p.normals, normals);
+	for(auto i = 0u; i < normals.size(); ++i) {
+		auto len = nytl::length(p.normals[i]);
+		if(len == 0.f) {
+			continue;
+		}
+
+		// acos is too imprecise for small angles
+		auto n = p.normals[i] / len;
+		auto d = decode(normals[i]);
+		auto angle = std::atan2(nytl::length(nytl::cross(d, n)), nytl::dot(d, n));
+		stats.normalError = std::max(stats.normalError,
+			float(angle * 180.0 / 3.14159265358979));
+	}
+
+	std::vector<CompactTexCoord> tcs;
+	for(auto* src : {&p.texCoords0, &p.texCoords1}) {
+		tcs.resize(src->size());
+		encodeTexCoords(*src, tcs);
+		for(auto i = 0u; i < tcs.size(); ++i) {
+			auto diff = decode(tcs[i]) - (*src)[i];
+			auto err = std::max(std::abs(diff.x), std::abs(diff.y));
+			stats.texCoordError = std::max(stats.texCoordError, err);
+		}
+	}
+
+	auto tcCount = p.texCoords0.size() + p.texCoords1.size();
+	stats.floatBytes = p.positions.size() * sizeof(Vec3f) +
+		p.normals.size() * sizeof(Vec3f) + tcCount * sizeof(Vec2f);
+	stats.compactBytes = p.positions.size() * sizeof(CompactPosition) +
+		p.normals.size() * sizeof(CompactNormal) +
+		tcCount * sizeof(CompactTexCoord);
+	return stats;
+}
+
+} // namespace tkn
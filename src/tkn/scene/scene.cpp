@@ -1,14 +1,17 @@
 #include <tkn/scene/scene.hpp>
 #include <tkn/scene/shape.hpp>
+#include <tkn/scene/quantize.hpp>
 #include <tkn/quaternion.hpp>
 #include <tkn/types.hpp>
 #include <tkn/image.hpp>
 #include <tkn/gltf.hpp>
+#include <tkn/gltfParse.hpp>
 #include <tkn/bits.hpp>
 #include <tkn/transform.hpp>
 #include <tkn/render.hpp>
 #include <tkn/texture.hpp>
 #include <tkn/util.hpp>
+#include <tkn/threadPool.hpp>
 #include <vpp/vk.hpp>
 #include <vpp/debug.hpp>
 #include <vpp/image.hpp>
@@ -17,6 +20,11 @@
 #include <vpp/commandAllocator.hpp>
 #include <dlg/dlg.hpp>
 #include <numeric>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <mutex>
 
 // NOTE: we can't use instanced rendering since multiple instance might
 // have completely different transform matrices and we therefore couldn't
@@ -72,259 +80,36 @@ public:
 namespace tkn {
 namespace {
 
-TextureInitData loadImageTex(WorkBatcher& wb, const gltf::Image& img,
-		nytl::StringParam path, bool srgb) {
-	auto name = img.name.empty() ?  img.name : "'" + img.name + "'";
-	dlg_info("  Loading image {} (uri {})", name, img.uri);
+TextureInitData loadImageTex(WorkBatcher& wb, SceneData::Image& img) {
 	auto params = TextureCreateParams {};
-	params.srgb = srgb;
-	params.format = srgb ?
+	params.srgb = img.srgb;
+	params.format = img.srgb ?
 		vk::Format::r8g8b8a8Srgb :
 		vk::Format::r8g8b8a8Unorm;
 	// full mipmap chain
 	params.mipLevels = 0;
 	params.fillMipmaps = true;
 
-	// TODO: we currently assume that since we disabled image loading
-	// for tinygltf (ours is better suited for our purposes + less copying)
-	// and we don't support loading from buffer views yet
-	dlg_assert(img.image.empty());
-
-	// TODO: we could support additional formats like r8 or r8g8.
-	// check img.pixel_type. Also support other image parameters
-	// TODO: we currently don't support hdr images. Check the
-	// specified image format
-	if(img.image.empty() && !img.uri.empty()) {
-		auto full = std::string(path);
-		full += img.uri;
-		return createTexture(wb, tkn::loadImage(full), params);
-	}
-
-	// TODO: simplifying assumptions that are usually met
-	dlg_assert(img.component == 4);
-	dlg_assert(!img.as_is);
-
-	// TODO: we only have to copy the image data here in case
-	// the gltf model is destroyed before the image finished initializtion...
-	Image loaded;
-	loaded.size.x = img.width;
-	loaded.size.y = img.height;
-	loaded.size.z = 1u;
-	loaded.format = srgb ? vk::Format::r8g8b8a8Srgb : vk::Format::r8g8b8a8Unorm;
-
-	auto dataSize = img.width * img.height * 4u;
-	loaded.data = std::make_unique<std::byte[]>(dataSize);
-	std::memcpy(loaded.data.get(), img.image.data(), dataSize);
-
-	return createTexture(wb, wrap(std::move(loaded)), params);
+	// already decoded, e.g. embedded or loaded from the scene cache
+	if(img.owned) {
+		Image loaded;
+		loaded.size = img.size;
+		loaded.format = img.format;
+		loaded.data = std::move(img.owned);
+		return createTexture(wb, wrap(std::move(loaded)), params);
+	} else if(!img.data.empty()) {
+		// data is kept alive by InitData::source
+		return createTexture(wb, wrapImage(img.size, img.format, img.data),
+			params);
+	}
+
+	dlg_info("  Loading image {}", img.path);
+	return createTexture(wb, tkn::loadImage(img.path), params);
 }
 
-} // anon namespace
-
-void Scene::create(InitData& data, WorkBatcher& wb, nytl::StringParam path,
-		const tinygltf::Model& model, const tinygltf::Scene& scene,
-		nytl::Mat4f matrix, const SceneRenderInfo& ri, float samplerLodBias) {
-	auto& dev = wb.dev;
-	multiDrawIndirect_ = ri.multiDrawIndirect;
-	dlg_assertm(multiDrawIndirect_, "Emulating multi draw indirect not yet "
-		"implemented, see deferred/gbuf.vert");
-
-	if(model.images.size() > imageCount) {
-		auto msg = dlg::format("Model has {} images, only {} supported",
-			model.images.size(), imageCount);
-		throw std::runtime_error(msg);
-	}
-	if(model.samplers.size() > samplerCount) {
-		auto msg = dlg::format("Model has {} samplers, only {} supported",
-			model.samplers.size(), samplerCount);
-		throw std::runtime_error(msg);
-	}
-
-	// layout
-	auto bindings = std::array {
-		// model ids
-		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
-			vk::ShaderStageBits::vertex),
-		// models
-		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
-			vk::ShaderStageBits::vertex),
-		// materials
-		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
-			vk::ShaderStageBits::fragment),
-		// textures[imageCount]
-		vpp::descriptorBinding(vk::DescriptorType::sampledImage,
-			vk::ShaderStageBits::fragment, nullptr, imageCount),
-		// samplers[samplerCount]
-		vpp::descriptorBinding(vk::DescriptorType::sampler,
-			vk::ShaderStageBits::fragment, nullptr, samplerCount),
-	};
-
-	dsLayout_.init(dev, bindings);
-	vpp::nameHandle(dsLayout_, "Scene:dsLayout");
-	ds_ = {data.initDs, wb.alloc.ds, dsLayout_};
-	blendDs_ = {data.initBlendDs, wb.alloc.ds, dsLayout_};
-
-	// load samplers
-	// TODO: optimization, low prio
-	// check for duplicate samplers. But then also change how materials
-	// access samplers, can't happen simply by id anymore.
-	for(auto& sampler : model.samplers) {
-		samplers_.emplace_back(dev, sampler, ri.samplerAnisotropy,
-			samplerLodBias);
-	}
-
-	// init default sampler as specified in gltf
-	vk::SamplerCreateInfo sci;
-	sci.addressModeU = vk::SamplerAddressMode::repeat;
-	sci.addressModeV = vk::SamplerAddressMode::repeat;
-	sci.addressModeW = vk::SamplerAddressMode::repeat;
-	sci.magFilter = vk::Filter::linear;
-	sci.minFilter = vk::Filter::linear;
-	sci.mipLodBias = samplerLodBias;
-	sci.mipmapMode = vk::SamplerMipmapMode::linear;
-	sci.minLod = 0.0;
-	sci.maxLod = 100.f; // use all mipmap levels
-	sci.anisotropyEnable = ri.samplerAnisotropy != 1.f;
-	sci.maxAnisotropy = ri.samplerAnisotropy;
-	defaultSampler_ = {dev, sci};
-
-	// load materials
-	// we load images later on because we first need to know where
-	// in materials they are used to know whether they contain srgb
-	// or linear data
-	images_.resize(model.images.size());
-
-	dlg_info("Found {} materials", model.materials.size());
-	for(auto& material : model.materials) {
-		auto name = material.name.empty() ?
-			material.name : "'" + material.name + "'";
-		dlg_info("  Loading material {}", name);
-		loadMaterial(data, wb, model, material, ri);
-	}
-
-	// we need at least one material (see primitive creation)
-	// if there is none, add dummy
-	defaultMaterialID_ = materials_.size();
-	materials_.emplace_back(); // default material
-
-	// initialize images
-	data.images.resize(model.images.size());
-	for(auto i = 0u; i < model.images.size(); ++i) {
-		auto& img = images_[i];
-		dlg_assertm(img.needed, "Model has unused image");
-		data.images[i] = loadImageTex(wb, model.images[i], path, img.srgb);
-	}
-
-	auto inf = std::numeric_limits<float>::infinity();
-	min_ = {inf, inf, inf};
-	max_ = {-inf, -inf, -inf};
-
-	// load nodes tree recursively
-	for(auto& nodeid : scene.nodes) {
-		dlg_assert(unsigned(nodeid) < model.nodes.size());
-		auto& node = model.nodes[nodeid];
-		loadNode(data, wb, model, node, ri, matrix);
-	}
-
-	blendCount_ = 0u;
-	opaqueCount_ = 0u;
-	for(auto& ini : instances_) {
-		dlg_assert(ini.materialID < materials_.size());
-		if(materials_[ini.materialID].blend()) {
-			++blendCount_;
-		} else {
-			++opaqueCount_;
-		}
-	}
-
-	auto hostMem = dev.hostMemoryTypes();
-	auto devMem = dev.deviceMemoryTypes();
-	auto stageSize = 0u;
-
-	// models buffer
-	auto pcount = blendCount_ + opaqueCount_;
-	auto size = pcount * sizeof(nytl::Mat4f) * 3;
-	instanceBuf_ = {data.initModels, wb.alloc.bufHost, size,
-		vk::BufferUsageBits::storageBuffer, hostMem};
-
-	// primitive buffers
-	size = indexCount_ * sizeof(Index);
-	stageSize += size;
-	indices_ = {data.initIndices, wb.alloc.bufDevice, size,
-		vk::BufferUsageBits::indexBuffer |
-		vk::BufferUsageBits::transferSrc |
-		vk::BufferUsageBits::transferDst, devMem};
-
-	size = data.tc1Count * sizeof(Vec2f);
-	tc0Offset_ = size;
-	size += data.tc0Count * sizeof(Vec2f);
-	posOffset_ = size;
-	size += vertexCount_ * sizeof(Vec3f);
-	normalOffset_ = size;
-	size += vertexCount_ * sizeof(Vec3f);
-
-	stageSize += size;
-	vertices_ = {data.initVertices, wb.alloc.bufDevice, size,
-		vk::BufferUsageBits::vertexBuffer |
-		vk::BufferUsageBits::transferSrc |
-		vk::BufferUsageBits::transferDst, devMem};
-
-	// materials buffer
-	size = materials_.size() * sizeof(Material);
-	stageSize += size;
-	materialsBuf_ = {data.initMaterials, wb.alloc.bufDevice, size,
-		vk::BufferUsageBits::storageBuffer |
-		vk::BufferUsageBits::transferSrc |
-		vk::BufferUsageBits::transferDst, devMem};
-
-	// cmds buffer
-	// TODO: i guess opaque model ids are pretty static, use devMem for that?
-	// opaque cmds are not so static when we implement culling etc
-	size = std::max<u32>(opaqueCount_ * sizeof(vk::DrawIndexedIndirectCommand), 4u);
-	cmds_ = {data.initCmds, wb.alloc.bufHost, size,
-		vk::BufferUsageBits::indirectBuffer, hostMem};
-	size = std::max<u32>(opaqueCount_ * sizeof(ModelID), 4u);
-	modelIDs_ = {data.initModelIDs, wb.alloc.bufHost, size,
-		vk::BufferUsageBits::storageBuffer, hostMem};
-
-	size = std::max<u32>(blendCount_ * sizeof(vk::DrawIndexedIndirectCommand), 4u);
-	blendCmds_ = {data.initBlendCmds, wb.alloc.bufHost, size,
-		vk::BufferUsageBits::indirectBuffer, hostMem};
-	size = std::max<u32>(blendCount_ * sizeof(ModelID), 4u);
-	blendModelIDs_ = {data.initBlendModelIDs, wb.alloc.bufHost, size,
-		vk::BufferUsageBits::storageBuffer, hostMem};
-
-	// stage
-	data.stage = {data.initStage, wb.alloc.bufHost, stageSize,
-		vk::BufferUsageBits::transferSrc, hostMem};
-
-	auto qf = device().queueSubmitter().queue().family();
-	uploadCb_ = device().commandAllocator().get(qf,
-		vk::CommandPoolCreateBits::resetCommandBuffer);
-	uploadSemaphore_ = {device()};
-}
-
-void Scene::rescale(float s) {
-	auto size = max() - min();
-	auto md = std::max(size.x, std::max(size.y, size.z));
-	s = 2.f * s / md;
-	auto t = -s * (min() + 0.5f * size);
-	auto mat = nytl::Mat4f {
-		s, 0, 0, t.x,
-		0, s, 0, t.y,
-		0, 0, s, t.z,
-		0, 0, 0, 1
-	};
-
-	for(auto& ini : instances()) {
-		ini.matrix = mat * ini.matrix;
-	}
-}
-
-void Scene::loadMaterial(InitData&, WorkBatcher&,
-		const gltf::Model& model, const gltf::Material& material,
-		const SceneRenderInfo&) {
-	auto& m = materials_.emplace_back();
+void loadMaterial(SceneData& scene, const gltf::Model& model,
+		const gltf::Material& material) {
+	auto& m = scene.materials.emplace_back();
 	auto& pbr = material.values;
 	auto& add = material.additionalValues;
 	if(auto color = pbr.find("baseColorFactor"); color != pbr.end()) {
@@ -368,20 +153,21 @@ void Scene::loadMaterial(InitData&, WorkBatcher&,
 		// reserved for the default/dummy values
 		auto samplerID = 0u;
 		if(tex.sampler >= 0) {
-			dlg_assert(unsigned(tex.sampler) < samplers_.size());
+			dlg_assert(unsigned(tex.sampler) < scene.samplers.size());
 			samplerID = tex.sampler + 1;
 		}
 
 		dlg_assert(tex.source >= 0);
 		auto id = unsigned(tex.source);
 
-		dlg_assert(id < images_.size());
-		if(images_[id].needed) {
-			dlg_assert(images_[id].srgb == srgb);
+		dlg_assert(id < scene.images.size());
+		auto& img = scene.images[id];
+		if(img.needed) {
+			dlg_assert(img.srgb == srgb);
 		}
 
-		images_[id].srgb = srgb;
-		images_[id].needed = true;
+		img.srgb = srgb;
+		img.needed = true;
 		return Material::Tex{coord, id + 1, samplerID};
 	};
 
@@ -427,9 +213,120 @@ void Scene::loadMaterial(InitData&, WorkBatcher&,
 	}
 }
 
-void Scene::loadNode(InitData& data, WorkBatcher& wb,
-		const tinygltf::Model& model, const tinygltf::Node& node,
-		const SceneRenderInfo& ri, nytl::Mat4f matrix) {
+// A primitive referenced by a node, in scene traversal order.
+struct PrimitiveRef {
+	const gltf::Primitive* primitive;
+	nytl::Mat4f matrix;
+	u32 materialID;
+};
+
+// Decodes the given primitive and generates missing data (normals).
+// Does not modify any shared state, called from multiple threads
+// in parallel, see loadSceneData.
+Scene::Primitive loadPrimitive(const gltf::Model& model,
+		const gltf::Primitive& primitive, const Material& material) {
+	Scene::Primitive p;
+
+	// supporting other modes requires custom pipelines, means that
+	// we can't render the scene with a single pipe.
+	// theoretically possible but a lot of complexity, really not
+	// worth it for now
+	if(primitive.mode != TINYGLTF_MODE_TRIANGLES) {
+		dlg_error("Unsupported primitive.mode: {}", primitive.mode);
+		throw std::runtime_error("Unsupported primitive.mode");
+	}
+
+	auto ip = primitive.attributes.find("POSITION");
+	auto in = primitive.attributes.find("NORMAL");
+	auto itc0 = primitive.attributes.find("TEXCOORD_0");
+	auto itc1 = primitive.attributes.find("TEXCOORD_1");
+
+	// positions
+	// a model *must* have this property, we can't get that anywhere else/
+	// just guess something
+	if(ip == primitive.attributes.end()) {
+		throw std::runtime_error("primitve doesn't have POSITION");
+	}
+
+	auto& pa = model.accessors[ip->second];
+
+	// PERF: we could use the gltf-supplied min-max values
+	auto inf = std::numeric_limits<float>::infinity();
+	p.min = nytl::Vec3f{inf, inf, inf};
+	p.max = nytl::Vec3f{-inf, -inf, -inf};
+
+	// All attributes are decoded in bulk, resolving the accessor
+	// format once instead of per component (as range<N, T> does).
+	p.positions = tkn::decode<3, float>(model, pa);
+	for(const auto& pos : p.positions) {
+		p.min = nytl::vec::cw::min(p.min, pos);
+		p.max = nytl::vec::cw::max(p.max, pos);
+	}
+
+	// indices
+	if(primitive.indices < 0) {
+		dlg_info("Primitive has no indices, using simple iota indices");
+		p.indices.resize(pa.count);
+		std::iota(p.indices.begin(), p.indices.end(), u32(0u));
+	} else {
+		auto& ia = model.accessors[primitive.indices];
+		p.indices = tkn::decode<1, std::uint32_t>(model, ia);
+
+		// validate in a separate pass, keeps the decoding vectorizable
+		auto maxIndex = u32(0u);
+		for(auto idx : p.indices) {
+			maxIndex = std::max(maxIndex, idx);
+		}
+
+		if(!p.indices.empty() && maxIndex >= p.positions.size()) {
+			throw std::runtime_error("Primitive index out of range");
+		}
+	}
+
+	// normals
+	if(in == primitive.attributes.end()) {
+		dlg_info("Primitive has no normals, generating simple normals");
+		dlg_assertm(p.indices.size() % 3 == 0,
+			"Triangle mode primitive index count not multiple of 3");
+
+		p.normals = areaSmoothNormals(p.positions, p.indices);
+	} else {
+		auto& na = model.accessors[in->second];
+		dlg_assert(na.count == pa.count);
+		p.normals = tkn::decode<3, float>(model, na);
+	}
+
+	auto* tc0a = itc0 == primitive.attributes.end() ?
+		nullptr : &model.accessors[itc0->second];
+	auto* tc1a = itc1 == primitive.attributes.end() ?
+		nullptr : &model.accessors[itc1->second];
+
+	if(tc0a) {
+		dlg_assert(tc0a->count == pa.count);
+		p.texCoords0 = tkn::decode<2, float>(model, *tc0a);
+	}
+
+	if(tc1a) {
+		dlg_assert(tc1a->count == pa.count);
+		p.texCoords1 = tkn::decode<2, float>(model, *tc1a);
+	}
+
+	if(!tc0a && material.needsTexCoord0()) {
+		throw std::runtime_error("material uses texCoords0 but primitive "
+			"doesn't provide them");
+	}
+	if(!tc1a && material.needsTexCoord1()) {
+		throw std::runtime_error("material uses texCoords1 but primitive "
+			"doesn't provide them");
+	}
+
+	return p;
+}
+
+// Only collects the primitives of the node tree, they are loaded
+// afterwards (in parallel).
+void loadNode(std::vector<PrimitiveRef>& prims, const SceneData& scene,
+		const gltf::Model& model, const gltf::Node& node, nytl::Mat4f matrix) {
 	if(!node.matrix.empty()) {
 		nytl::Mat4f mat;
 		for(auto r = 0u; r < 4; ++r) {
@@ -474,7 +371,7 @@ void Scene::loadNode(InitData& data, WorkBatcher& wb,
 
 	for(auto nodeid : node.children) {
 		auto& child = model.nodes[nodeid];
-		loadNode(data, wb, model, child, ri, matrix);
+		loadNode(prims, scene, model, child, matrix);
 	}
 
 	if(node.mesh != -1) {
@@ -482,152 +379,461 @@ void Scene::loadNode(InitData& data, WorkBatcher& wb,
 		auto name = mesh.name.empty() ?  mesh.name : "'" + mesh.name + "'";
 		dlg_info("  Loading mesh {}", name);
 		for(auto& primitive : mesh.primitives) {
-			// TODO
+			auto& ref = prims.emplace_back();
+			ref.primitive = &primitive;
+			ref.matrix = matrix;
+
+			// use default material
+			ref.materialID = primitive.material < 0 ?
+				scene.materials.size() - 1 : primitive.material;
+			dlg_assert(ref.materialID < scene.materials.size());
+		}
+	}
+}
+
+
+} // anon namespace
+
+SceneData loadSceneData(const gltf::Model& model, const gltf::Scene& scene,
+		nytl::StringParam path) {
+	SceneData data;
+	for(auto& sampler : model.samplers) {
+		data.samplers.emplace_back(sampler);
+	}
+
+	// load materials
+	// we load images later on because we first need to know where
+	// in materials they are used to know whether they contain srgb
+	// or linear data
+	data.images.resize(model.images.size());
+
+	dlg_info("Found {} materials", model.materials.size());
+	for(auto& material : model.materials) {
+		auto name = material.name.empty() ?
+			material.name : "'" + material.name + "'";
+		dlg_info("  Loading material {}", name);
+		loadMaterial(data, model, material);
+	}
+
+	// we need at least one material (see primitive creation)
+	// if there is none, add dummy
+	data.materials.emplace_back(); // default material
+
+	for(auto i = 0u; i < model.images.size(); ++i) {
+		auto& src = model.images[i];
+		auto& img = data.images[i];
+		dlg_assertm(img.needed, "Model has unused image");
+
+		// TODO: we currently assume that since we disabled image loading
+		// for tinygltf (ours is better suited for our purposes + less copying)
+		// and we don't support loading from buffer views yet
+		dlg_assert(src.image.empty());
+
+		// TODO: we could support additional formats like r8 or r8g8.
+		// check img.pixel_type. Also support other image parameters
+		// TODO: we currently don't support hdr images. Check the
+		// specified image format
+		if(src.image.empty() && !src.uri.empty()) {
+			img.path = std::string(path);
+			img.path += src.uri;
+			continue;
+		}
+
+		// TODO: simplifying assumptions that are usually met
+		dlg_assert(src.component == 4);
+		dlg_assert(!src.as_is);
+
+		// TODO: we only have to copy the image data here in case
+		// the gltf model is destroyed before the image finished initializtion...
+		auto dataSize = src.width * src.height * 4u;
+		img.size = {unsigned(src.width), unsigned(src.height), 1u};
+		img.format = img.srgb ?
+			vk::Format::r8g8b8a8Srgb :
+			vk::Format::r8g8b8a8Unorm;
+		img.owned = std::make_unique<std::byte[]>(dataSize);
+		std::memcpy(img.owned.get(), src.image.data(), dataSize);
+		img.data = {img.owned.get(), dataSize};
+	}
+
+	// collect primitives from the node tree recursively
+	std::vector<PrimitiveRef> prims;
+	for(auto& nodeid : scene.nodes) {
+		dlg_assert(unsigned(nodeid) < model.nodes.size());
+		auto& node = model.nodes[nodeid];
+		loadNode(prims, data, model, node, nytl::identity<4, float>());
+	}
+
+	// Primitives are independent of each other, so we decode them in
+	// parallel. Every primitive writes only its own slot, the ordering
+	// is therefore the same as with serial loading.
+	// Large primitives are started first, otherwise a single large
+	// primitive picked up last could dominate the load time.
+	auto vertCount = [&](const PrimitiveRef& ref) {
+		auto it = ref.primitive->attributes.find("POSITION");
+		return it == ref.primitive->attributes.end() ?
+			std::size_t(0u) : model.accessors[it->second].count;
+	};
+
+	std::vector<u32> order(prims.size());
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+		return vertCount(prims[a]) > vertCount(prims[b]);
+	});
+
+	std::vector<Scene::Primitive> loaded(prims.size());
+	std::vector<u8> valid(prims.size(), false);
+	parallelFor(ThreadPool::instance(), order.size(), 1u,
+			[&](std::size_t begin, std::size_t end) {
+		for(auto i = begin; i < end; ++i) {
+			auto id = order[i];
+			auto& ref = prims[id];
 			try {
-				loadPrimitive(data, wb, model, primitive, matrix);
+				auto& mat = data.materials[ref.materialID];
+				loaded[id] = loadPrimitive(model, *ref.primitive, mat);
+				valid[id] = true;
 			} catch(const std::exception& err) {
+				// TODO
 				dlg_error("Omitting primitive: {}", err.what());
 			}
 		}
+	});
+
+	for(auto i = 0u; i < prims.size(); ++i) {
+		if(!valid[i]) {
+			continue;
+		}
+
+		Scene::Instance ini;
+		ini.matrix = prims[i].matrix;
+		ini.lastMatrix = prims[i].matrix;
+		ini.materialID = prims[i].materialID;
+		ini.modelID = data.instances.size() + 1;
+		ini.primitiveID = data.primitives.size();
+
+		data.primitives.push_back(std::move(loaded[i]));
+		data.instances.push_back(ini);
 	}
+
+	return data;
 }
 
-void Scene::loadPrimitive(InitData& data, WorkBatcher&,
-		const gltf::Model& model, const gltf::Primitive& primitive,
-		nytl::Mat4f matrix) {
-	auto& p = primitives_.emplace_back();
-	auto mat = primitive.material;
-	if(mat < 0) {
-		// use default material
-		mat = defaultMaterialID_;
+namespace {
+
+// Sizes of a single vertex attribute in the vertex buffer
+struct VertexFormat {
+	std::size_t position;
+	std::size_t normal;
+	std::size_t texCoord;
+};
+
+VertexFormat vertexFormat(bool compact) {
+	if(compact) {
+		return {sizeof(CompactPosition), sizeof(CompactNormal),
+			sizeof(CompactTexCoord)};
 	}
 
-	// supporting other modes requires custom pipelines, means that
-	// we can't render the scene with a single pipe.
-	// theoretically possible but a lot of complexity, really not
-	// worth it for now
-	if(primitive.mode != TINYGLTF_MODE_TRIANGLES) {
-		dlg_error("Unsupported primitive.mode: {}", primitive.mode);
-		throw std::runtime_error("Unsupported primitive.mode");
+	return {sizeof(Vec3f), sizeof(Vec3f), sizeof(Vec2f)};
+}
+
+// Writes the given vertex attribute data into 'dst', starting at
+// vertex 'offset'. When 'compact' is set, encodes the data into elements
+// of type C via 'encode'. Returns the number of written bytes.
+template<typename C, typename T, typename F>
+std::size_t putVertices(nytl::Span<std::byte> dst, std::size_t offset,
+		const std::vector<T>& src, bool compact, F&& encode) {
+	auto elemSize = compact ? sizeof(C) : sizeof(T);
+	auto size = src.size() * elemSize;
+	dlg_assert(dst.size() >= offset * elemSize + size);
+	if(src.empty()) {
+		return 0u;
+	}
+
+	auto data = dst.data() + offset * elemSize;
+	if(compact) {
+		auto cdst = nytl::Span<C>(reinterpret_cast<C*>(data), src.size());
+		encode(nytl::Span<const T>(src), cdst);
+	} else {
+		std::memcpy(data, src.data(), size);
 	}
 
-	auto ip = primitive.attributes.find("POSITION");
-	auto in = primitive.attributes.find("NORMAL");
-	auto itc0 = primitive.attributes.find("TEXCOORD_0");
-	auto itc1 = primitive.attributes.find("TEXCOORD_1");
+	return size;
+}
 
-	// positions
-	// a model *must* have this property, we can't get that anywhere else/
-	// just guess something
-	if(ip == primitive.attributes.end()) {
-		throw std::runtime_error("primitve doesn't have POSITION");
+std::size_t putPositions(nytl::Span<std::byte> dst, std::size_t offset,
+		const Scene::Primitive& p, bool compact) {
+	return putVertices<CompactPosition>(dst, offset, p.positions, compact,
+		[&](auto src, auto cdst) { quantizePositions(src, p.min, p.max, cdst); });
+}
+
+std::size_t putNormals(nytl::Span<std::byte> dst, std::size_t offset,
+		const Scene::Primitive& p, bool compact) {
+	return putVertices<CompactNormal>(dst, offset, p.normals, compact,
+		encodeNormals);
+}
+
+std::size_t putTexCoords(nytl::Span<std::byte> dst, std::size_t offset,
+		const std::vector<Vec2f>& tcs, bool compact) {
+	return putVertices<CompactTexCoord>(dst, offset, tcs, compact,
+		encodeTexCoords);
+}
+
+} // anon namespace
+
+void Scene::create(InitData& data, WorkBatcher& wb, nytl::StringParam path,
+		const tinygltf::Model& model, const tinygltf::Scene& scene,
+		nytl::Mat4f matrix, const SceneRenderInfo& ri, float samplerLodBias) {
+	create(data, wb, loadSceneData(model, scene, path), matrix, ri,
+		samplerLodBias);
+}
+
+void Scene::create(InitData& data, WorkBatcher& wb, SceneData&& scene,
+		nytl::Mat4f matrix, const SceneRenderInfo& ri, float samplerLodBias) {
+	auto& dev = wb.dev;
+	multiDrawIndirect_ = ri.multiDrawIndirect;
+	compact_ = ri.compactVertices;
+	dlg_assertm(multiDrawIndirect_, "Emulating multi draw indirect not yet "
+		"implemented, see deferred/gbuf.vert");
+
+	if(scene.images.size() > imageCount) {
+		auto msg = dlg::format("Model has {} images, only {} supported",
+			scene.images.size(), imageCount);
+		throw std::runtime_error(msg);
+	}
+	if(scene.samplers.size() > samplerCount) {
+		auto msg = dlg::format("Model has {} samplers, only {} supported",
+			scene.samplers.size(), samplerCount);
+		throw std::runtime_error(msg);
 	}
 
-	auto& pa = model.accessors[ip->second];
+	// layout
+	auto bindings = std::array {
+		// model ids
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::vertex),
+		// models
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::vertex),
+		// materials
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::fragment),
+		// textures[imageCount]
+		vpp::descriptorBinding(vk::DescriptorType::sampledImage,
+			vk::ShaderStageBits::fragment, nullptr, imageCount),
+		// samplers[samplerCount]
+		vpp::descriptorBinding(vk::DescriptorType::sampler,
+			vk::ShaderStageBits::fragment, nullptr, samplerCount),
+	};
 
-	// PERF: we could use the gltf-supplied min-max values
-	auto inf = std::numeric_limits<float>::infinity();
-	p.min = nytl::Vec3f{inf, inf, inf};
-	p.max = nytl::Vec3f{-inf, -inf, -inf};
+	dsLayout_.init(dev, bindings);
+	vpp::nameHandle(dsLayout_, "Scene:dsLayout");
+	ds_ = {data.initDs, wb.alloc.ds, dsLayout_};
+	blendDs_ = {data.initBlendDs, wb.alloc.ds, dsLayout_};
 
-	p.positions.reserve(pa.count);
-	for(const auto& pos : range<3, float>(model, pa)) {
-		p.min = nytl::vec::cw::min(p.min, pos);
-		p.max = nytl::vec::cw::max(p.max, pos);
-		p.positions.push_back(pos);
+	// load samplers
+	// TODO: optimization, low prio
+	// check for duplicate samplers. But then also change how materials
+	// access samplers, can't happen simply by id anymore.
+	for(auto& sampler : scene.samplers) {
+		samplers_.emplace_back(dev, sampler, ri.samplerAnisotropy,
+			samplerLodBias);
 	}
 
-	// indices
-	if(primitive.indices < 0) {
-		dlg_info("Primitive has no indices, using simple iota indices");
-		p.indices.resize(pa.count);
-		std::iota(p.indices.begin(), p.indices.end(), u32(0u));
-	} else {
-		auto& ia = model.accessors[primitive.indices];
-		p.indices.resize(ia.count);
+	// init default sampler as specified in gltf
+	vk::SamplerCreateInfo sci;
+	sci.addressModeU = vk::SamplerAddressMode::repeat;
+	sci.addressModeV = vk::SamplerAddressMode::repeat;
+	sci.addressModeW = vk::SamplerAddressMode::repeat;
+	sci.magFilter = vk::Filter::linear;
+	sci.minFilter = vk::Filter::linear;
+	sci.mipLodBias = samplerLodBias;
+	sci.mipmapMode = vk::SamplerMipmapMode::linear;
+	sci.minLod = 0.0;
+	sci.maxLod = 100.f; // use all mipmap levels
+	sci.anisotropyEnable = ri.samplerAnisotropy != 1.f;
+	sci.maxAnisotropy = ri.samplerAnisotropy;
+	defaultSampler_ = {dev, sci};
 
-		auto iit = p.indices.begin();
-		for(auto idx : tkn::range<1, std::uint32_t>(model, ia)) {
-			dlg_assertm(idx < p.positions.size(), "Index out of range");
-			*(iit++) = idx;
+	// the last material is the default one, see loadSceneData
+	dlg_assert(!scene.materials.empty());
+	materials_ = std::move(scene.materials);
+	defaultMaterialID_ = materials_.size() - 1;
+
+	// initialize images
+	data.source = std::move(scene.source);
+	images_.resize(scene.images.size());
+	data.images.resize(scene.images.size());
+	for(auto i = 0u; i < scene.images.size(); ++i) {
+		images_[i].srgb = scene.images[i].srgb;
+		images_[i].needed = scene.images[i].needed;
+		data.images[i] = loadImageTex(wb, scene.images[i]);
+	}
+
+	primitives_ = std::move(scene.primitives);
+	instances_ = std::move(scene.instances);
+	for(auto& p : primitives_) {
+		data.tc0Count += p.texCoords0.size();
+		data.tc1Count += p.texCoords1.size();
+	}
+
+	// Assign the offsets of all primitives in the index and vertex
+	// buffers up front (prefix sums), this way their data can be written
+	// in parallel in init.
+	// The ordering of primitives in the buffer like this allows us to
+	// only allocate tc0 and tc1 buffer space for the models that
+	// really need it. The others will read garbage.
+	// The buffer is always large enough since tc0,tc1,verts are always
+	// allocated on the same buffer and the data in verts is larger
+	// than the (theoretical) need for tc0, tc1.
+	// So first primitives that have both tex coords, then primitives
+	// with only one tex coord and then primitives without any.
+	auto texCoordGroup = [](const Primitive& p) {
+		return !p.texCoords1.empty() ? 0u : !p.texCoords0.empty() ? 1u : 2u;
+	};
+
+	for(auto group = 0u; group < 3u; ++group) {
+		for(auto& p : primitives_) {
+			if(texCoordGroup(p) != group) {
+				continue;
+			}
+
+			p.firstIndex = indexCount_;
+			p.vertexOffset = vertexCount_;
+			indexCount_ += p.indices.size();
+			vertexCount_ += p.positions.size();
 		}
 	}
 
-	// normals
-	if(in == primitive.attributes.end()) {
-		dlg_info("Primitive has no normals, generating simple normals");
-		dlg_assertm(p.indices.size() % 3 == 0,
-			"Triangle mode primitive index count not multiple of 3");
+	auto inf = std::numeric_limits<float>::infinity();
+	min_ = {inf, inf, inf};
+	max_ = {-inf, -inf, -inf};
+	for(auto& ini : instances_) {
+		dlg_assert(ini.primitiveID < primitives_.size());
+		ini.matrix = matrix * ini.matrix;
+		ini.lastMatrix = matrix * ini.lastMatrix;
+		instanceID_ = std::max(instanceID_, ini.modelID);
 
-		p.normals = areaSmoothNormals(p.positions, p.indices);
-	} else {
-		auto& na = model.accessors[in->second];
-		dlg_assert(na.count == pa.count);
+		auto& p = primitives_[ini.primitiveID];
+		min_ = nytl::vec::cw::min(min_, multPos(ini.matrix, p.min));
+		max_ = nytl::vec::cw::max(max_, multPos(ini.matrix, p.max));
+	}
 
-		p.normals.reserve(na.count);
-		for(const auto& normal : range<3, float>(model, na)) {
-			p.normals.push_back(normal);
+	blendCount_ = 0u;
+	opaqueCount_ = 0u;
+	for(auto& ini : instances_) {
+		dlg_assert(ini.materialID < materials_.size());
+		if(materials_[ini.materialID].blend()) {
+			++blendCount_;
+		} else {
+			++opaqueCount_;
 		}
 	}
 
-	auto* tc0a = itc0 == primitive.attributes.end() ?
-		nullptr : &model.accessors[itc0->second];
-	auto* tc1a = itc1 == primitive.attributes.end() ?
-		nullptr : &model.accessors[itc1->second];
+	auto hostMem = dev.hostMemoryTypes();
+	auto devMem = dev.deviceMemoryTypes();
+	auto stageSize = 0u;
 
-	// compute total buffer size
-	auto size = 0u;
-	size += p.indices.size() * sizeof(u32); // indices
-	size += p.positions.size() * sizeof(nytl::Vec3f); // normals
-	size += p.normals.size() * sizeof(nytl::Vec3f); // positions
+	// models buffer
+	auto pcount = blendCount_ + opaqueCount_;
+	auto size = pcount * sizeof(nytl::Mat4f) * 3;
+	instanceBuf_ = {data.initModels, wb.alloc.bufHost, size,
+		vk::BufferUsageBits::storageBuffer, hostMem};
 
-	indexCount_ += p.indices.size();
-	vertexCount_ += p.positions.size();
+	// primitive buffers
+	size = indexCount_ * sizeof(Index);
+	stageSize += size;
+	indices_ = {data.initIndices, wb.alloc.bufDevice, size,
+		vk::BufferUsageBits::indexBuffer |
+		vk::BufferUsageBits::transferSrc |
+		vk::BufferUsageBits::transferDst, devMem};
 
-	if(tc0a) {
-		dlg_assert(tc0a->count == pa.count);
+	auto fmt = vertexFormat(compact_);
+	size = data.tc1Count * fmt.texCoord;
+	tc0Offset_ = size;
+	size += data.tc0Count * fmt.texCoord;
+	posOffset_ = size;
+	size += vertexCount_ * fmt.position;
+	normalOffset_ = size;
+	size += vertexCount_ * fmt.normal;
+
+	if(compact_) {
+		// Computing the stats means encoding everything an additional
+		// time but it's cheap compared to loading.
+		QuantizationStats stats;
+		std::mutex mutex;
+		parallelFor(ThreadPool::instance(), primitives_.size(), 16u,
+				[&](std::size_t begin, std::size_t end) {
+			QuantizationStats local;
+			for(auto i = begin; i < end; ++i) {
+				local += quantizationStats(primitives_[i]);
+			}
 
-		p.texCoords0.resize(tc0a->count);
-		auto tc0it = p.texCoords0.begin();
-		auto uvr = tkn::range<2, float>(model, *tc0a);
-		for(auto uv : uvr) {
-			*(tc0it++) = uv;
-		}
-		data.tc0Count += tc0a->count;
+			std::lock_guard lock(mutex);
+			stats += local;
+		});
+
+		dlg_info("Compact vertices: {} KiB instead of {} KiB ({} vertices)",
+			stats.compactBytes / 1024, stats.floatBytes / 1024, stats.vertices);
+		dlg_info("  max errors: position {} (relative {}), normal {} deg, "
+			"texCoord {}", stats.positionError, stats.relPositionError,
+			stats.normalError, stats.texCoordError);
 	}
 
-	if(tc1a) {
-		dlg_assert(tc1a->count == pa.count);
+	stageSize += size;
+	vertices_ = {data.initVertices, wb.alloc.bufDevice, size,
+		vk::BufferUsageBits::vertexBuffer |
+		vk::BufferUsageBits::transferSrc |
+		vk::BufferUsageBits::transferDst, devMem};
 
-		p.texCoords1.resize(tc1a->count);
-		auto tc1it = p.texCoords1.begin();
-		auto uvr = tkn::range<2, float>(model, *tc1a);
-		for(auto uv : uvr) {
-			*(tc1it++) = uv;
-		}
-		data.tc1Count += tc1a->count;
-	}
+	// materials buffer
+	size = materials_.size() * sizeof(Material);
+	stageSize += size;
+	materialsBuf_ = {data.initMaterials, wb.alloc.bufDevice, size,
+		vk::BufferUsageBits::storageBuffer |
+		vk::BufferUsageBits::transferSrc |
+		vk::BufferUsageBits::transferDst, devMem};
+
+	// cmds buffer
+	// TODO: i guess opaque model ids are pretty static, use devMem for that?
+	// opaque cmds are not so static when we implement culling etc
+	size = std::max<u32>(opaqueCount_ * sizeof(vk::DrawIndexedIndirectCommand), 4u);
+	cmds_ = {data.initCmds, wb.alloc.bufHost, size,
+		vk::BufferUsageBits::indirectBuffer, hostMem};
+	size = std::max<u32>(opaqueCount_ * sizeof(ModelID), 4u);
+	modelIDs_ = {data.initModelIDs, wb.alloc.bufHost, size,
+		vk::BufferUsageBits::storageBuffer, hostMem};
 
-	min_ = nytl::vec::cw::min(min_, multPos(matrix, p.min));
-	max_ = nytl::vec::cw::max(max_, multPos(matrix, p.max));
+	size = std::max<u32>(blendCount_ * sizeof(vk::DrawIndexedIndirectCommand), 4u);
+	blendCmds_ = {data.initBlendCmds, wb.alloc.bufHost, size,
+		vk::BufferUsageBits::indirectBuffer, hostMem};
+	size = std::max<u32>(blendCount_ * sizeof(ModelID), 4u);
+	blendModelIDs_ = {data.initBlendModelIDs, wb.alloc.bufHost, size,
+		vk::BufferUsageBits::storageBuffer, hostMem};
 
-	Instance ini;
-	ini.matrix = matrix;
-	ini.lastMatrix = matrix;
-	ini.materialID = mat;
-	ini.modelID = ++instanceID_;
-	ini.primitiveID = primitives_.size() - 1;
+	// stage
+	data.stage = {data.initStage, wb.alloc.bufHost, stageSize,
+		vk::BufferUsageBits::transferSrc, hostMem};
 
-	if(!tc0a && materials_[ini.materialID].needsTexCoord0()) {
-		throw std::runtime_error("material uses texCoords0 but primitive "
-			"doesn't provide them");
-	}
-	if(!tc1a && materials_[ini.materialID].needsTexCoord1()) {
-		throw std::runtime_error("material uses texCoords1 but primitive "
-			"doesn't provide them");
-	}
+	auto qf = device().queueSubmitter().queue().family();
+	uploadCb_ = device().commandAllocator().get(qf,
+		vk::CommandPoolCreateBits::resetCommandBuffer);
+	uploadSemaphore_ = {device()};
+}
+
+void Scene::rescale(float s) {
+	auto size = max() - min();
+	auto md = std::max(size.x, std::max(size.y, size.z));
+	s = 2.f * s / md;
+	auto t = -s * (min() + 0.5f * size);
+	auto mat = nytl::Mat4f {
+		s, 0, 0, t.x,
+		0, s, 0, t.y,
+		0, 0, s, t.z,
+		0, 0, 0, 1
+	};
 
-	instances_.push_back(ini);
+	for(auto& ini : instances()) {
+		ini.matrix = mat * ini.matrix;
+	}
 }
 
 void Scene::init(InitData& data, WorkBatcher& wb, vk::ImageView dummyView) {
@@ -670,58 +876,40 @@ void Scene::init(InitData& data, WorkBatcher& wb, vk::ImageView dummyView) {
 	auto indexOff = span.data() - stageMap.ptr();
 	auto indexSpan = span;
 
+	auto fmt = vertexFormat(compact_);
 	auto tc1Span = span;
 	skip(tc1Span, sizeof(Index) * indexCount_);
 	auto tc1Off = tc1Span.data() - stageMap.ptr();
 	auto tc0Span = tc1Span;
-	skip(tc0Span, sizeof(nytl::Vec2f) * data.tc1Count);
+	skip(tc0Span, fmt.texCoord * data.tc1Count);
 	auto posSpan = tc0Span;
-	skip(posSpan, sizeof(nytl::Vec2f) * data.tc0Count);
+	skip(posSpan, fmt.texCoord * data.tc0Count);
 	auto normalSpan = posSpan;
-	skip(normalSpan, sizeof(nytl::Vec3f) * vertexCount_);
-
-	auto vertexCount = 0u;
-	auto indexCount = 0u;
-	auto uploadPrimitive = [&](Primitive& primitive) {
-		tkn::write(tc0Span, bytes(primitive.texCoords0));
-		tkn::write(tc1Span, bytes(primitive.texCoords1));
-		tkn::write(posSpan, bytes(primitive.positions));
-		tkn::write(normalSpan, bytes(primitive.normals));
-		tkn::write(indexSpan, bytes(primitive.indices));
-
-		primitive.firstIndex = indexCount;
-		primitive.vertexOffset = vertexCount;
-		indexCount += primitive.indices.size();
-		vertexCount += primitive.positions.size();
+	skip(normalSpan, fmt.position * vertexCount_);
+
+	// offsets were assigned in create, the primitives don't overlap
+	auto put = [](nytl::Span<std::byte> dst, std::size_t elemOffset,
+			auto& src) {
+		using T = typename std::remove_reference_t<decltype(src)>::value_type;
+		auto srcBytes = bytes(src);
+		dlg_assert(dst.size() >= elemOffset * sizeof(T) + srcBytes.size());
+		std::memcpy(dst.data() + elemOffset * sizeof(T), srcBytes.data(),
+			srcBytes.size());
 	};
 
-	// the ordering of primitives in the buffer like this allows us to
-	// only allocate tc0 and tc1 buffer space for the models that
-	// really need it the. The others will read garbage.
-	// the buffer is always large enough since tc0,tc1,verts are always
-	// allocated on the same buffer and the data in verts is large
-	// than the (theoretical) need for tc0, tc1
-
-	// first upload primitives that have both tex coords
-	for(auto& primitive : primitives_) {
-		if(!primitive.texCoords1.empty()) {
-			uploadPrimitive(primitive);
-		}
-	}
-
-	// then primitives with only one tex coord
-	for(auto& primitive : primitives_) {
-		if(primitive.texCoords1.empty() && !primitive.texCoords0.empty()) {
-			uploadPrimitive(primitive);
-		}
-	}
-
-	// then primitives without any texcoord
-	for(auto& primitive : primitives_) {
-		if(primitive.texCoords1.empty() && primitive.texCoords0.empty()) {
-			uploadPrimitive(primitive);
+	// grain: large scenes have thousands of mostly small primitives
+	parallelFor(ThreadPool::instance(), primitives_.size(), 16u,
+			[&](std::size_t begin, std::size_t end) {
+		for(auto i = begin; i < end; ++i) {
+			auto& primitive = primitives_[i];
+			auto off = primitive.vertexOffset;
+			put(indexSpan, primitive.firstIndex, primitive.indices);
+			putTexCoords(tc1Span, off, primitive.texCoords1, compact_);
+			putTexCoords(tc0Span, off, primitive.texCoords0, compact_);
+			putPositions(posSpan, off, primitive, compact_);
+			putNormals(normalSpan, off, primitive, compact_);
 		}
-	}
+	});
 
 	// indices
 	copy.srcOffset = data.stage.offset() + indexOff;
@@ -738,7 +926,6 @@ void Scene::init(InitData& data, WorkBatcher& wb, vk::ImageView dummyView) {
 		vertices_.buffer(), {{copy}});
 
 	// upload matrices for all primitives to modelsBuf
-	span = normalSpan; // last offset
 	stageMap.flush();
 
 	// upload opaque draw commands
@@ -755,12 +942,7 @@ void Scene::init(InitData& data, WorkBatcher& wb, vk::ImageView dummyView) {
 			writeInstance(ini, idspan, cmdspan);
 		}
 
-		write(iniSpan, ini.matrix);
-		auto normalMatrix = nytl::Mat4f(transpose(inverse(ini.matrix)));
-		normalMatrix[3][0] = ini.materialID;
-		normalMatrix[3][1] = ini.modelID;
-		write(iniSpan, normalMatrix);
-		write(iniSpan, ini.lastMatrix);
+		writeModel(iniSpan, ini);
 	}
 
 	idmap.flush();
@@ -803,6 +985,8 @@ void Scene::init(InitData& data, WorkBatcher& wb, vk::ImageView dummyView) {
 	bdsu.storage(materialsBuf_);
 	bdsu.image(images);
 	bdsu.sampler(samplers);
+
+	updateBvh(true);
 }
 
 void Scene::createImage(unsigned id, bool srgb) {
@@ -816,7 +1000,7 @@ void Scene::createImage(unsigned id, bool srgb) {
 }
 
 void Scene::writeInstance(const Instance& ini, nytl::Span<std::byte>& ids,
-		nytl::Span<std::byte>& cmds) {
+		nytl::Span<std::byte>& cmds, bool visible) {
 	// HACK: not sure if logical ids used as rendering indirection
 	// should be connected to picking-releated model ids
 	tkn::write(ids, u32(ini.modelID - 1));
@@ -825,7 +1009,7 @@ void Scene::writeInstance(const Instance& ini, nytl::Span<std::byte>& ids,
 	vk::DrawIndexedIndirectCommand cmd;
 	cmd.indexCount = p.indices.size();
 	cmd.vertexOffset = p.vertexOffset;
-	cmd.instanceCount = 1;
+	cmd.instanceCount = visible ? 1 : 0;
 	cmd.firstInstance = 0;
 	cmd.firstIndex = p.firstIndex;
 	tkn::write(cmds, cmd);
@@ -833,6 +1017,25 @@ void Scene::writeInstance(const Instance& ini, nytl::Span<std::byte>& ids,
 
 // TODO: when updateDs is set to true, a rerecord is needed
 // not necessarily coupled to semaphore...
+void Scene::writeModel(nytl::Span<std::byte>& span, const Instance& ini) const {
+	auto matrix = ini.matrix;
+	auto lastMatrix = ini.lastMatrix;
+	if(compact_) {
+		// the positions are quantized in the bounds of the primitive
+		auto& p = primitives_[ini.primitiveID];
+		auto dequant = dequantizeMatrix(p.min, p.max);
+		matrix = matrix * dequant;
+		lastMatrix = lastMatrix * dequant;
+	}
+
+	write(span, matrix);
+	auto normalMatrix = nytl::Mat4f(transpose(inverse(ini.matrix)));
+	normalMatrix[3][0] = ini.materialID;
+	normalMatrix[3][1] = ini.modelID;
+	write(span, normalMatrix);
+	write(span, lastMatrix);
+}
+
 vk::Semaphore Scene::upload() {
 	auto& dev = device();
 
@@ -903,18 +1106,14 @@ vk::Semaphore Scene::upload() {
 				writeInstance(ini, idspan, cmdspan);
 			}
 
-			write(iniSpan, ini.matrix);
-			auto normalMatrix = nytl::Mat4f(transpose(inverse(ini.matrix)));
-			normalMatrix[3][0] = ini.materialID;
-			normalMatrix[3][1] = ini.modelID;
-			write(iniSpan, normalMatrix);
-			write(iniSpan, ini.lastMatrix);
+			writeModel(iniSpan, ini);
 		}
 
 		idmap.flush();
 		cmdmap.flush();
 		iniMap.flush();
 
+		updateBvh(newInis_ != 0u);
 		newInis_ = {};
 		updateInis_.clear();
 	}
@@ -942,12 +1141,13 @@ vk::Semaphore Scene::upload() {
 		return {a, b};
 	};
 
+	auto fmt = vertexFormat(compact_);
 	auto stageSize = newMats_ * sizeof(Material);
 	for(auto& p : nytl::span(primitives_).last(newPrimitives_)) {
-		stageSize += bytes(p.positions).size();
-		stageSize += bytes(p.normals).size();
-		stageSize += bytes(p.texCoords0).size();
-		stageSize += bytes(p.texCoords1).size();
+		stageSize += p.positions.size() * fmt.position;
+		stageSize += p.normals.size() * fmt.normal;
+		stageSize += p.texCoords0.size() * fmt.texCoord;
+		stageSize += p.texCoords1.size() * fmt.texCoord;
 		stageSize += bytes(p.indices).size();
 	}
 
@@ -991,27 +1191,27 @@ vk::Semaphore Scene::upload() {
 		upload_.vertices = std::move(vertices_);
 		upload_.indices = std::move(indices_);
 
-		auto tc1Size = 0u;
-		for(auto& p : nytl::span(primitives_).last(newPrimitives_)) {
-			tc1Size += write(stageSpan, bytes(p.texCoords1));
-		}
-
-		auto tc0Size = 0u;
-		for(auto& p : nytl::span(primitives_).last(newPrimitives_)) {
-			tc0Size += write(stageSpan, bytes(p.texCoords0));
-		}
-
-		auto posSize = 0u;
-		for(auto& p : nytl::span(primitives_).last(newPrimitives_)) {
-			posSize += write(stageSpan, bytes(p.positions));
-		}
-
-		auto normalsSize = 0u;
-		for(auto& p : nytl::span(primitives_).last(newPrimitives_)) {
-			normalsSize += write(stageSpan, bytes(p.normals));
-		}
-
-		dlg_assert(posSize == normalsSize);
+		auto newPrims = nytl::span(primitives_).last(newPrimitives_);
+		auto putStage = [&](auto&& put) {
+			auto size = std::size_t(0u);
+			for(auto& p : newPrims) {
+				auto n = put(stageSpan, p);
+				skip(stageSpan, n);
+				size += n;
+			}
+			return u32(size);
+		};
+
+		auto tc1Size = putStage([&](auto dst, auto& p) {
+			return putTexCoords(dst, 0u, p.texCoords1, compact_); });
+		auto tc0Size = putStage([&](auto dst, auto& p) {
+			return putTexCoords(dst, 0u, p.texCoords0, compact_); });
+		auto posSize = putStage([&](auto dst, auto& p) {
+			return putPositions(dst, 0u, p, compact_); });
+		auto normalsSize = putStage([&](auto dst, auto& p) {
+			return putNormals(dst, 0u, p, compact_); });
+
+		dlg_assert(posSize / fmt.position == normalsSize / fmt.normal);
 		auto addSize = tc1Size + tc0Size + posSize + normalsSize;
 		auto newVSize = upload_.vertices.size() + addSize;
 		vertices_ = {device().bufferAllocator(), newVSize,
@@ -1023,7 +1223,7 @@ vk::Semaphore Scene::upload() {
 		auto oldtc1 = tc0Offset_ - 0;
 		auto oldtc0 = posOffset_ - tc0Offset_;
 		auto oldpos = normalOffset_ - posOffset_;
-		auto oldnormals = oldpos;
+		auto oldnormals = (oldpos / fmt.position) * fmt.normal;
 		dlg_assert(oldnormals == upload_.vertices.size() - normalOffset_);
 
 		BufferCopier oldVCopies{upload_.vertices, vertices_};
@@ -1107,6 +1307,9 @@ vk::Semaphore Scene::upload() {
 
 vk::Semaphore Scene::updateDevice(nytl::Mat4f proj) {
 	auto ret = upload();
+	if(cull_ || culled_) {
+		cull(proj);
+	}
 
 	// sort blended primitives
 	if(!blendCount_) {
@@ -1140,7 +1343,9 @@ vk::Semaphore Scene::updateDevice(nytl::Mat4f proj) {
 	auto cmdmap = blendCmds_.memoryMap();
 	auto cmdspan = cmdmap.span();
 	for(auto& p : blendPrims) {
-		writeInstance(*p.instance, idspan, cmdspan);
+		auto id = p.instance - instances_.data();
+		auto visible = visible_.empty() || visible_[id];
+		writeInstance(*p.instance, idspan, cmdspan, visible);
 	}
 
 	idmap.flush();
@@ -1187,6 +1392,125 @@ void Scene::render(vk::CommandBuffer cb, vk::PipelineLayout pl, bool blend) cons
 	}
 }
 
+void Scene::updateBvh(bool rebuild) {
+	if(rebuild) {
+		instanceBounds_.resize(instances_.size());
+		for(auto i = 0u; i < instances_.size(); ++i) {
+			instanceBounds_[i] = bounds(instances_[i]);
+		}
+
+		bvh_.build(instanceBounds_);
+		return;
+	}
+
+	if(updateInis_.empty()) {
+		return;
+	}
+
+	for(auto id : updateInis_) {
+		dlg_assert(id < instances_.size());
+		instanceBounds_[id] = bounds(instances_[id]);
+	}
+
+	bvh_.refit(instanceBounds_);
+}
+
+void Scene::cull(const nytl::Mat4f& viewProj) {
+	visible_.assign(instances_.size(), u8(!cull_));
+	if(cull_) {
+		std::vector<u32> ids;
+		bvh_.cull(frustumPlanes(viewProj), ids);
+		for(auto id : ids) {
+			visible_[id] = 1u;
+		}
+	}
+
+	// Rewrite all opaque commands. The number of commands stays the
+	// same, so no re-record is needed. Blend commands are written
+	// in updateDevice anyways.
+	auto idmap = modelIDs_.memoryMap();
+	auto idspan = idmap.span();
+	auto cmdmap = cmds_.memoryMap();
+	auto cmdspan = cmdmap.span();
+	for(auto i = 0u; i < instances_.size(); ++i) {
+		auto& ini = instances_[i];
+		if(!materials_[ini.materialID].blend()) {
+			writeInstance(ini, idspan, cmdspan, visible_[i]);
+		}
+	}
+
+	idmap.flush();
+	cmdmap.flush();
+
+	culled_ = cull_;
+	if(!cull_) {
+		visible_.clear();
+	}
+}
+
+Aabb Scene::bounds(const Instance& ini) const {
+	dlg_assert(ini.primitiveID < primitives_.size());
+	auto& p = primitives_[ini.primitiveID];
+	return transform(Aabb{p.min, p.max}, ini.matrix);
+}
+
+std::optional<std::pair<u32, float>> Scene::pick(nytl::Vec3f origin,
+		nytl::Vec3f dir) const {
+	std::vector<Bvh::RayHit> hits;
+	auto inf = std::numeric_limits<float>::infinity();
+	bvh_.raycast(origin, dir, inf, hits);
+
+	std::optional<std::pair<u32, float>> best;
+	for(auto& hit : hits) {
+		if(best && hit.t > best->second) {
+			break; // sorted, no closer hits possible
+		}
+
+		// Intersect the triangles in model space. The matrix is affine
+		// so the ray parameter stays the same.
+		auto& ini = instances_[hit.item];
+		auto& p = primitives_[ini.primitiveID];
+		auto inv = nytl::Mat4f(nytl::inverse(ini.matrix));
+		auto o = multPos(inv, origin);
+		auto d4 = inv * nytl::Vec4f{dir.x, dir.y, dir.z, 0.f};
+		auto d = nytl::Vec3f{d4[0], d4[1], d4[2]};
+
+		for(auto i = 0u; i + 2 < p.indices.size(); i += 3) {
+			// Moeller-Trumbore, triangles are two-sided
+			auto& a = p.positions[p.indices[i + 0]];
+			auto& b = p.positions[p.indices[i + 1]];
+			auto& c = p.positions[p.indices[i + 2]];
+			auto e1 = b - a;
+			auto e2 = c - a;
+			auto pv = nytl::cross(d, e2);
+			auto det = nytl::dot(e1, pv);
+			if(std::abs(det) < 1e-12f) {
+				continue;
+			}
+
+			auto invDet = 1.f / det;
+			auto tv = o - a;
+			auto u = invDet * nytl::dot(tv, pv);
+			if(u < 0.f || u > 1.f) {
+				continue;
+			}
+
+			auto qv = nytl::cross(tv, e1);
+			auto v = invDet * nytl::dot(d, qv);
+			if(v < 0.f || u + v > 1.f) {
+				continue;
+			}
+
+			auto t = invDet * nytl::dot(e2, qv);
+			if(t >= 0.f && (!best || t < best->second)) {
+				best = {hit.item, t};
+			}
+		}
+	}
+
+	return best;
+}
+
 u32 Scene::addPrimitive(std::vector<nytl::Vec3f> positions,
 		std::vector<nytl::Vec3f> normals,
 		std::vector<u32> indices,
@@ -1208,6 +1532,15 @@ u32 Scene::addPrimitive(std::vector<nytl::Vec3f> positions,
 	p.vertexOffset = vertexCount_;
 	indexCount_ += p.indices.size();
 	vertexCount_ += p.positions.size();
+
+	auto inf = std::numeric_limits<float>::infinity();
+	p.min = nytl::Vec3f{inf, inf, inf};
+	p.max = nytl::Vec3f{-inf, -inf, -inf};
+	for(auto& pos : p.positions) {
+		p.min = nytl::vec::cw::min(p.min, pos);
+		p.max = nytl::vec::cw::max(p.max, pos);
+	}
+
 	return primitives_.size() - 1;
 }
 
@@ -1235,7 +1568,7 @@ u32 Scene::addInstance(const Primitive& prim, nytl::Mat4f matrix, u32 matID) {
 	return addInstance(it - primitives_.begin(), matrix, matID);
 }
 
-const vk::PipelineVertexInputStateCreateInfo& Scene::vertexInfo() {
+const vk::PipelineVertexInputStateCreateInfo& Scene::vertexInfo(bool compact) {
 	// Deinterleave all data (even positions and normals which are
 	// always given) since e.g. for shadow maps normals are not
 	// needed. Texture coordinates might not be given
@@ -1258,28 +1591,38 @@ const vk::PipelineVertexInputStateCreateInfo& Scene::vertexInfo() {
 		4, attributes
 	};
 
-	return ret;
+	// see tkn/scene/quantize.hpp
+	static constexpr vk::VertexInputBindingDescription compactBindings[] = {
+		{0, sizeof(CompactPosition), vk::VertexInputRate::vertex},
+		{1, sizeof(CompactNormal), vk::VertexInputRate::vertex},
+		{2, sizeof(CompactTexCoord), vk::VertexInputRate::vertex},
+		{3, sizeof(CompactTexCoord), vk::VertexInputRate::vertex},
+	};
+
+	static constexpr vk::VertexInputAttributeDescription compactAttributes[] = {
+		{0, 0, vk::Format::r16g16b16a16Unorm, 0}, // pos
+		{1, 1, vk::Format::r16g16Snorm, 0}, // normal, octahedral
+		{2, 2, vk::Format::r16g16Sfloat, 0}, // texCoords0
+		{3, 3, vk::Format::r16g16Sfloat, 0}, // texCoords1
+	};
+
+	static const vk::PipelineVertexInputStateCreateInfo compactRet = {{},
+		4, compactBindings,
+		4, compactAttributes
+	};
+
+	return compact ? compactRet : ret;
 }
 
 // util
-std::tuple<std::optional<gltf::Model>, std::string> loadGltf(nytl::StringParam at) {
-	// Load Model
+std::optional<std::pair<std::string, std::string>> resolveGltf(
+		nytl::StringParam at) {
 	// fallback
 	std::string path = "../assets/gltf/";
 	std::string file = "test3.gltf";
-	bool binary = false;
 	if(!at.empty()) {
-		if(hasSuffixCI(at, ".gltf")) {
-			auto i = at.find_last_of('/');
-			if(i == std::string::npos) {
-				path = {};
-				file = at;
-			} else {
-				path = at.substr(0, i + 1);
-				file = at.substr(i + 1);
-			}
-		} else if(hasSuffixCI(at, ".gltb") || hasSuffixCI(at, ".glb")) {
-			binary = true;
+		if(hasSuffixCI(at, ".gltf") || hasSuffixCI(at, ".gltb") ||
+				hasSuffixCI(at, ".glb")) {
 			auto i = at.find_last_of('/');
 			if(i == std::string::npos) {
 				path = {};
@@ -1296,122 +1639,90 @@ std::tuple<std::optional<gltf::Model>, std::string> loadGltf(nytl::StringParam a
 			if(tinygltf::FileExists(path + "scene.gltf", nullptr)) {
 				file = "scene.gltf";
 			} else if(tinygltf::FileExists(path + "scene.gltb", nullptr)) {
-				binary = true;
 				file = "scene.gltb";
 			} else {
 				dlg_fatal("Given folder doesn't have scene.gltf/gltb");
-				return {};
+				return std::nullopt;
 			}
 		}
 	}
 
+	return std::pair{path, file};
+}
+
+namespace {
+
+// Parses the model with the given function, logs errors and checks
+// that the model can be used for scenes.
+template<typename F>
+std::optional<gltf::Model> tryParseGltf(F&& parse) {
 	dlg_info(">> Parsing gltf model...");
 
-	gltf::TinyGLTF loader;
 	gltf::Model model;
-	std::string err;
-	std::string warn;
-	bool res;
-
-	auto full = std::string(path);
-	full += file;
-	if(binary) {
-		res = loader.LoadBinaryFromFile(&model, &err, &warn, full.c_str());
-	} else {
-		res = loader.LoadASCIIFromFile(&model, &err, &warn, full.c_str());
+	auto start = std::chrono::steady_clock::now();
+	try {
+		model = parse();
+	} catch(const std::exception& err) {
+		dlg_error("  {}", err.what());
+		dlg_fatal(">> Failed to parse model");
+		return std::nullopt;
 	}
 
-	// error, warnings
-	auto pos = 0u;
-	auto end = warn.npos;
-	while((end = warn.find_first_of('\n', pos)) != warn.npos) {
-		auto d = warn.data() + pos;
-		dlg_warn("  {}", std::string_view{d, end - pos});
-		pos = end + 1;
-	}
+	auto dur = std::chrono::steady_clock::now() - start;
+	auto ms = std::chrono::duration<double, std::milli>(dur).count();
+	dlg_info(">> Parsing Succesful ({} ms)...", ms);
 
-	pos = 0u;
-	while((end = err.find_first_of('\n', pos)) != err.npos) {
-		auto d = err.data() + pos;
-		dlg_error("  {}", std::string_view{d, end - pos});
-		pos = end + 1;
-	}
+	// TODO: just implement is using loadImage a memory stream.
+	// Ideally though, we would just store the Provider in the image.
+	for(auto& img : model.images) {
+		if(img.bufferView >= 0) {
+			dlg_fatal(">> Loading images from buffer views not supported atm");
+			return std::nullopt;
+		}
 
-	if(!res) {
-		dlg_fatal(">> Failed to parse model");
-		return {};
+		// would otherwise be used as path relative to the model
+		if(gltf::IsDataURI(img.uri)) {
+			dlg_fatal(">> Loading images from data uris not supported atm");
+			return std::nullopt;
+		}
 	}
 
-	dlg_info(">> Parsing Succesful...");
-
 	// traverse nodes
 	if(model.scenes.empty()) {
 		dlg_fatal(">> Model has no scenes");
-		return {};
+		return std::nullopt;
 	}
 
-	return {model, path};
-}
-
-
-// We use TINYGLTF_NO_EXTERNAL_IMAGE. This is still needed when images
-// are specified as buffer view
-bool tinygltfImageLoader(gltf::Image* img, const int imgID,
-		std::string* err, std::string* warn, int req_width, int req_height,
-		const unsigned char* bytes, int size, void*) {
-	nytl::unused(img, imgID, err, warn, req_width, req_height,
-			bytes, size);
-
-	// TODO: just implement is using loadImage a memory stream.
-	// Ideally though, we would just store the Provider in the image.
-	// Maybe rework tinygtlf so that this function isn't needed
-	// at all anymore and we just load from the buffer view when
-	// we load the image?
-	dlg_assert(err);
-	*err += "tkn: Loading images from buffer views not supported atm";
-	return false;
+	return model;
 }
 
-std::optional<gltf::Model> loadGltf(nytl::Span<const std::byte> buffer) {
-	gltf::TinyGLTF loader;
-	gltf::Model model;
-	std::string err, warn;
-
-	loader.SetImageLoader(&tinygltfImageLoader, nullptr);
-
-	auto bytes = (const unsigned char*) buffer.data();
-	auto res = loader.LoadBinaryFromMemory(&model, &err, &warn, bytes, buffer.size());
-
-	// error, warnings
-	auto pos = 0u;
-	auto end = warn.npos;
-	while((end = warn.find_first_of('\n', pos)) != warn.npos) {
-		auto d = warn.data() + pos;
-		dlg_warn("  {}", std::string_view{d, end - pos});
-		pos = end + 1;
-	}
-
-	pos = 0u;
-	while((end = err.find_first_of('\n', pos)) != err.npos) {
-		auto d = err.data() + pos;
-		dlg_error("  {}", std::string_view{d, end - pos});
-		pos = end + 1;
-	}
+} // anon namespace
 
-	if(!res) {
-		dlg_fatal(">> Failed to parse model");
+std::tuple<std::optional<gltf::Model>, std::string> loadGltf(nytl::StringParam at) {
+	// Load Model
+	auto resolved = resolveGltf(at);
+	if(!resolved) {
 		return {};
 	}
 
-	dlg_info(">> Parsing Succesful...");
+	auto& [path, file] = *resolved;
+	auto full = std::string(path);
+	full += file;
 
-	// traverse nodes
-	if(model.scenes.empty()) {
-		dlg_fatal(">> Model has no scenes");
+	auto model = tryParseGltf([&]{ return parseGltf(full); });
+	if(!model) {
 		return {};
 	}
 
-	return {model};
+	return {std::move(model), path};
+}
+
+std::optional<gltf::Model> loadGltf(nytl::Span<const std::byte> buffer) {
+	// The model references the binary chunk, the caller might not keep
+	// the buffer alive.
+	auto copy = std::make_shared<std::vector<std::byte>>(
+		buffer.begin(), buffer.end());
+	return tryParseGltf([&]{ return parseGltf(*copy, {}, copy); });
 }
 
 // Sampler
@@ -1479,9 +1790,9 @@ bool operator!=(const SamplerInfo& a, const SamplerInfo& b) {
 	return std::memcmp(&a, &b, sizeof(a)) != 0;
 }
 
-Sampler::Sampler(const vpp::Device& dev, const gltf::Sampler& sampler,
+Sampler::Sampler(const vpp::Device& dev, const SamplerInfo& sinfo,
 		float maxAnisotropy, float mipLodBias) {
-	info = {sampler};
+	info = sinfo;
 
 	vk::SamplerCreateInfo sci;
 	sci.addressModeU = info.addressModeU;
@@ -1,6 +1,13 @@
 #include <tkn/scene/shape.hpp>
+#include <tkn/threadPool.hpp>
 #include <nytl/vecOps.hpp>
 #include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
 
 namespace tkn {
 using namespace nytl::vec::cw;
@@ -127,31 +134,261 @@ Shape generateUV(const Sphere& sphere, unsigned stackCount,
 	return shape;
 }
 
-std::vector<Vec3f> areaSmoothNormals(nytl::Span<const Vec3f> positions,
-		nytl::Span<const u32> indices) {
-
-	std::vector<Vec3f> normals;
-	normals.resize(positions.size(), {0.f, 0.f, 0.f});
-	for(auto i = 0u; i < indices.size(); i += 3) {
-		dlg_assert(indices[i + 0] < positions.size());
-		dlg_assert(indices[i + 1] < positions.size());
-		dlg_assert(indices[i + 2] < positions.size());
-		auto e1 = positions[indices[i + 1]] - positions[indices[i + 0]];
-		auto e2 = positions[indices[i + 2]] - positions[indices[i + 0]];
-		auto normal = nytl::cross(e1, e2);
-		normals[indices[i + 0]] += normal;
-		normals[indices[i + 1]] += normal;
-		normals[indices[i + 2]] += normal;
+namespace {
+
+// Number of triangles/vertices per parallel range
+constexpr auto parallelGrain = 4096u;
+
+// Number of triangles per accumulation slice, see accumulateCorners
+constexpr auto sliceSize = 16 * 1024u;
+
+// Computes the per-vertex sums of per triangle corner values, i.e.
+// for each triangle t and corner c, corner(t, c) is added to the
+// vertex indices[3 * t + c].
+// Works in parallel: the triangles are split into slices, each slice
+// accumulates into its own buffer covering only the range of vertices
+// its triangles reference. For meshes with locality (e.g. processed by
+// optimizeMesh, see meshOpt.hpp) these ranges barely overlap. The slice
+// buffers are then summed up per vertex. Otherwise (when the ranges
+// would need too much memory) falls back to a serial scatter.
+// The slices don't depend on the number of threads, the result is
+// deterministic.
+template<typename T, typename F>
+std::vector<T> accumulateCorners(ThreadPool& tp, std::size_t vertexCount,
+		nytl::Span<const u32> indices, F&& corner) {
+	struct Slice {
+		u32 minVertex;
+		u32 maxVertex; // exclusive
+		std::size_t offset; // in the accumulation buffer
+	};
+
+	auto triCount = indices.size() / 3;
+	auto sliceCount = (triCount + sliceSize - 1) / sliceSize;
+	std::vector<Slice> slices(sliceCount);
+	parallelFor(tp, sliceCount, 1u, [&](auto begin, auto end) {
+		for(auto s = begin; s < end; ++s) {
+			auto first = 3 * s * sliceSize;
+			auto last = std::min<std::size_t>(3 * (s + 1) * sliceSize, indices.size());
+			auto [min, max] = std::minmax_element(indices.begin() + first,
+				indices.begin() + last);
+			slices[s] = {*min, *max + 1, 0u};
+		}
+	});
+
+	auto total = std::size_t(0u);
+	for(auto& slice : slices) {
+		dlg_assert(slice.maxVertex <= vertexCount);
+		slice.offset = total;
+		total += slice.maxVertex - slice.minVertex;
 	}
 
-	// normalize all
-	for(auto& n : normals) {
-		normalize(n);
+	if(sliceCount <= 1 || total > 2 * vertexCount) {
+		std::vector<T> ret(vertexCount, T{});
+		for(auto t = 0u; t < triCount; ++t) {
+			for(auto c = 0u; c < 3u; ++c) {
+				ret[indices[3 * t + c]] += corner(t, c);
+			}
+		}
+
+		return ret;
 	}
 
+	std::vector<T> buf(total, T{});
+	parallelFor(tp, sliceCount, 1u, [&](auto begin, auto end) {
+		for(auto s = begin; s < end; ++s) {
+			auto& slice = slices[s];
+			auto* dst = buf.data() + slice.offset - slice.minVertex;
+			auto last = std::min<std::size_t>((s + 1) * sliceSize, triCount);
+			for(auto t = s * sliceSize; t < last; ++t) {
+				for(auto c = 0u; c < 3u; ++c) {
+					dst[indices[3 * t + c]] += corner(t, c);
+				}
+			}
+		}
+	});
+
+	// sum up, always in slice order
+	std::vector<T> ret(vertexCount, T{});
+	parallelFor(tp, vertexCount, parallelGrain, [&](auto begin, auto end) {
+		for(auto& slice : slices) {
+			auto first = std::max<std::size_t>(begin, slice.minVertex);
+			auto last = std::min<std::size_t>(end, slice.maxVertex);
+			auto* src = buf.data() + slice.offset - slice.minVertex;
+			for(auto v = first; v < last; ++v) {
+				ret[v] += src[v];
+			}
+		}
+	});
+
+	return ret;
+}
+
+// Computes the unnormalized normals (length is twice the area) of the
+// triangles [begin, end).
+void faceNormals(nytl::Span<const Vec3f> positions,
+		nytl::Span<const u32> indices, std::size_t begin, std::size_t end,
+		Vec3f* out) {
+	auto t = begin;
+
+#ifdef __SSE2__
+	// 4 triangles at a time, structure of arrays
+	for(; t + 4 <= end; t += 4) {
+		auto* ids = &indices[3 * t];
+		auto load = [&](unsigned corner, unsigned comp) {
+			return _mm_setr_ps(
+				positions[ids[0 + corner]][comp],
+				positions[ids[3 + corner]][comp],
+				positions[ids[6 + corner]][comp],
+				positions[ids[9 + corner]][comp]);
+		};
+
+		auto ax = load(0, 0), ay = load(0, 1), az = load(0, 2);
+		auto e1x = _mm_sub_ps(load(1, 0), ax);
+		auto e1y = _mm_sub_ps(load(1, 1), ay);
+		auto e1z = _mm_sub_ps(load(1, 2), az);
+		auto e2x = _mm_sub_ps(load(2, 0), ax);
+		auto e2y = _mm_sub_ps(load(2, 1), ay);
+		auto e2z = _mm_sub_ps(load(2, 2), az);
+
+		// same operations as nytl::cross
+		alignas(16) float n[3][4];
+		_mm_store_ps(n[0], _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y)));
+		_mm_store_ps(n[1], _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z)));
+		_mm_store_ps(n[2], _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x)));
+		for(auto j = 0u; j < 4u; ++j) {
+			out[t + j] = {n[0][j], n[1][j], n[2][j]};
+		}
+	}
+#endif // __SSE2__
+
+	for(; t < end; ++t) {
+		auto& p0 = positions[indices[3 * t + 0]];
+		auto e1 = positions[indices[3 * t + 1]] - p0;
+		auto e2 = positions[indices[3 * t + 2]] - p0;
+		out[t] = nytl::cross(e1, e2);
+	}
+}
+
+// Returns some normalized vector orthogonal to n (any for n = 0).
+Vec3f orthogonal(Vec3f n) {
+	auto axis = std::abs(n.x) < 0.9f ? Vec3f{1.f, 0.f, 0.f} : Vec3f{0.f, 1.f, 0.f};
+	auto ret = nytl::cross(n, axis);
+	auto len = nytl::length(ret);
+	return len > 0.f ? (1 / len) * ret : axis;
+}
+
+} // anon namespace
+
+std::vector<Vec3f> areaSmoothNormals(nytl::Span<const Vec3f> positions,
+		nytl::Span<const u32> indices, ThreadPool* pool) {
+	dlg_assert(indices.size() % 3 == 0);
+	auto& tp = pool ? *pool : ThreadPool::instance();
+	auto triCount = indices.size() / 3;
+
+	std::vector<Vec3f> faces(triCount);
+	parallelFor(tp, triCount, parallelGrain, [&](auto begin, auto end) {
+		faceNormals(positions, indices, begin, end, faces.data());
+	});
+
+	auto normals = accumulateCorners<Vec3f>(tp, positions.size(), indices,
+		[&](auto t, auto) { return faces[t]; });
+	parallelFor(tp, normals.size(), parallelGrain, [&](auto begin, auto end) {
+		for(auto v = begin; v < end; ++v) {
+			// unreferenced vertices (and degenerate triangles) keep a
+			// zero normal
+			auto len = nytl::length(normals[v]);
+			if(len > 0.f) {
+				normals[v] *= 1 / len;
+			}
+		}
+	});
+
 	return normals;
 }
 
+std::vector<Vec4f> generateTangents(nytl::Span<const Vec3f> positions,
+		nytl::Span<const Vec3f> normals, nytl::Span<const Vec2f> texCoords,
+		nytl::Span<const u32> indices, ThreadPool* pool) {
+	dlg_assert(indices.size() % 3 == 0);
+	dlg_assert(normals.size() == positions.size());
+	dlg_assert(texCoords.size() == positions.size());
+	auto& tp = pool ? *pool : ThreadPool::instance();
+	auto triCount = indices.size() / 3;
+
+	// Per triangle: normalized direction of increasing u and the
+	// orientation of texture space (+1 preserving, -1 mirrored,
+	// 0 for degenerate uvs).
+	struct Face {
+		Vec3f os;
+		float orient;
+	};
+
+	std::vector<Face> faces(triCount);
+	parallelFor(tp, triCount, parallelGrain, [&](auto begin, auto end) {
+		for(auto t = begin; t < end; ++t) {
+			auto i0 = indices[3 * t + 0];
+			auto i1 = indices[3 * t + 1];
+			auto i2 = indices[3 * t + 2];
+
+			auto d1 = positions[i1] - positions[i0];
+			auto d2 = positions[i2] - positions[i0];
+			auto t21 = texCoords[i1] - texCoords[i0];
+			auto t31 = texCoords[i2] - texCoords[i0];
+
+			auto area = t21.x * t31.y - t21.y * t31.x; // signed, times 2
+			auto os = t31.y * d1 - t21.y * d2;
+			auto len = nytl::length(os);
+			if(area == 0.f || len == 0.f) {
+				faces[t] = {{0.f, 0.f, 0.f}, 0.f};
+				continue;
+			}
+
+			auto orient = area > 0.f ? 1.f : -1.f;
+			faces[t] = {(orient / len) * os, orient};
+		}
+	});
+
+	// Per corner: the face direction projected into the tangent plane of
+	// the vertex, weighted by the angle of the triangle at the corner.
+	// The w component accumulates the weighted orientation.
+	auto sums = accumulateCorners<Vec4f>(tp, positions.size(), indices,
+			[&](std::size_t t, unsigned c) {
+		auto& face = faces[t];
+		if(face.orient == 0.f) {
+			return Vec4f{0.f, 0.f, 0.f, 0.f};
+		}
+
+		auto v = indices[3 * t + c];
+		auto& n = normals[v];
+		auto project = [&](Vec3f x) {
+			x -= nytl::dot(n, x) * n;
+			auto len = nytl::length(x);
+			return len > 0.f ? (1 / len) * x : x;
+		};
+
+		auto& p = positions[v];
+		auto e1 = project(positions[indices[3 * t + (c + 1) % 3]] - p);
+		auto e2 = project(positions[indices[3 * t + (c + 2) % 3]] - p);
+		auto angle = std::acos(std::clamp(nytl::dot(e1, e2), -1.f, 1.f));
+		auto os = angle * project(face.os);
+		return Vec4f{os.x, os.y, os.z, angle * face.orient};
+	});
+
+	std::vector<Vec4f> tangents(positions.size());
+	parallelFor(tp, positions.size(), parallelGrain, [&](auto begin, auto end) {
+		for(auto v = begin; v < end; ++v) {
+			auto& sum = sums[v];
+			auto dir = Vec3f{sum.x, sum.y, sum.z};
+			auto len = nytl::length(dir);
+			auto tangent = (len > 0.f) ? (1 / len) * dir : orthogonal(normals[v]);
+			auto w = sum.w < 0.f ? -1.f : 1.f;
+			tangents[v] = {tangent.x, tangent.y, tangent.z, w};
+		}
+	});
+
+	return tangents;
+}
+
 // TODO: fix this for subd, i.e. fix triangle vertex numbering
 // such that hypoth (between vert b and c) of neighbors is the same.
 Shape generateIco(unsigned subdiv) {
@@ -0,0 +1,737 @@
+#include <tkn/scene/simplify.hpp>
+#include <tkn/scene/meshOpt.hpp>
+#include <nytl/vecOps.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <unordered_map>
+#include <queue>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+namespace tkn {
+namespace {
+
+constexpr auto noPartner = u32(0xFFFFFFFFu);
+
+// Symmetric 4x4 matrix (upper triangle) of a sum of weighted plane
+// equations. Evaluating it at a point gives the weighted sum of
+// squared distances to all planes. Doubles since the sums can get
+// large and the differences small.
+struct Quadric {
+	double a2 {}, ab {}, ac {}, ad {};
+	double b2 {}, bc {}, bd {};
+	double c2 {}, cd {};
+	double d2 {};
+	double weight {};
+
+	// plane: dot(n, x) + d = 0, n normalized
+	void addPlane(Vec3f n, float d, float w) {
+		double a = n.x, b = n.y, c = n.z, dd = d;
+		a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * dd;
+		b2 += w * b * b; bc += w * b * c; bd += w * b * dd;
+		c2 += w * c * c; cd += w * c * dd;
+		d2 += w * dd * dd;
+		weight += w;
+	}
+
+	Quadric& operator+=(const Quadric& o) {
+		a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad;
+		b2 += o.b2; bc += o.bc; bd += o.bd;
+		c2 += o.c2; cd += o.cd;
+		d2 += o.d2;
+		weight += o.weight;
+		return *this;
+	}
+
+	double eval(Vec3f p) const {
+		double x = p.x, y = p.y, z = p.z;
+		auto ret = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+			b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+			c2 * z * z + 2 * cd * z +
+			d2;
+		return std::max(ret, 0.0); // rounding
+	}
+};
+
+struct Collapse {
+	double cost;
+	u32 from;
+	u32 to;
+	u32 versionFrom;
+	u32 versionTo;
+
+	bool operator>(const Collapse& o) const {
+		// tie break for determinism
+		if(cost != o.cost) {
+			return cost > o.cost;
+		}
+
+		return from != o.from ? from > o.from : to > o.to;
+	}
+};
+
+// Squared distance from p to the triangle abc, via its closest point
+// (Ericson, "Real-Time Collision Detection", 5.1.5).
+float distanceSq(Vec3f p, Vec3f a, Vec3f b, Vec3f c) {
+	auto ab = b - a;
+	auto ac = c - a;
+	auto ap = p - a;
+	auto d1 = nytl::dot(ab, ap);
+	auto d2 = nytl::dot(ac, ap);
+	auto sqDist = [&](Vec3f q) { auto d = p - q; return nytl::dot(d, d); };
+	if(d1 <= 0.f && d2 <= 0.f) {
+		return sqDist(a);
+	}
+
+	auto bp = p - b;
+	auto d3 = nytl::dot(ab, bp);
+	auto d4 = nytl::dot(ac, bp);
+	if(d3 >= 0.f && d4 <= d3) {
+		return sqDist(b);
+	}
+
+	auto vc = d1 * d4 - d3 * d2;
+	if(vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+		return sqDist(a + (d1 / (d1 - d3)) * ab);
+	}
+
+	auto cp = p - c;
+	auto d5 = nytl::dot(ab, cp);
+	auto d6 = nytl::dot(ac, cp);
+	if(d6 >= 0.f && d5 <= d6) {
+		return sqDist(c);
+	}
+
+	auto vb = d5 * d2 - d1 * d6;
+	if(vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+		return sqDist(a + (d2 / (d2 - d6)) * ac);
+	}
+
+	auto va = d3 * d6 - d5 * d4;
+	if(va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f) {
+		auto w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		return sqDist(b + w * (c - b));
+	}
+
+	auto denom = va + vb + vc;
+	if(denom <= 0.f) { // degenerate
+		return std::min({sqDist(a), sqDist(b), sqDist(c)});
+	}
+
+	auto v = vb / denom;
+	auto w = vc / denom;
+	return sqDist(a + v * ab + w * ac);
+}
+
+// The maximum distance of every removed vertex (remap[v] != v) to the
+// triangles around the vertex it was collapsed into, including the
+// triangles around its neighbors. Since those are only a part of the
+// simplified surface, this is an upper bound for the distance of the
+// original vertices to it. The neighbors are needed since removed
+// vertices drift away when their targets are removed as well.
+float maxDeviation(nytl::Span<const u32> indices,
+		nytl::Span<const Vec3f> positions, nytl::Span<const u32> remap) {
+	// vertex -> triangles, compressed
+	std::vector<u32> offsets(positions.size() + 1, 0u);
+	for(auto i : indices) {
+		++offsets[i + 1];
+	}
+
+	for(auto v = 0u; v < positions.size(); ++v) {
+		offsets[v + 1] += offsets[v];
+	}
+
+	std::vector<u32> tris(indices.size());
+	auto fill = offsets;
+	for(auto i = 0u; i < indices.size(); ++i) {
+		tris[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<u32> ring; // triangles around the target and its neighbors
+	auto ret = 0.f;
+	for(auto v = 0u; v < remap.size(); ++v) {
+		auto r = remap[v];
+		if(r == v) {
+			continue;
+		}
+
+		ring.clear();
+		for(auto j = offsets[r]; j < offsets[r + 1]; ++j) {
+			auto* tri = &indices[3 * tris[j]];
+			for(auto k = 0u; k < 3; ++k) {
+				for(auto l = offsets[tri[k]]; l < offsets[tri[k] + 1]; ++l) {
+					ring.push_back(tris[l]);
+				}
+			}
+		}
+
+		std::sort(ring.begin(), ring.end());
+		ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+
+		// If r has no triangles left, its position is the best we know
+		auto d = positions[v] - positions[r];
+		auto best = nytl::dot(d, d);
+		for(auto t : ring) {
+			auto* tri = &indices[3 * t];
+			best = std::min(best, distanceSq(positions[v],
+				positions[tri[0]], positions[tri[1]], positions[tri[2]]));
+		}
+
+		ret = std::max(ret, best);
+	}
+
+	return std::sqrt(ret);
+}
+
+struct PositionHash {
+	std::size_t operator()(const Vec3f& p) const {
+		u32 bits[3];
+		std::memcpy(bits, &p, sizeof(bits));
+		auto h = std::size_t(bits[0]) * 73856093u;
+		h ^= std::size_t(bits[1]) * 19349663u;
+		h ^= std::size_t(bits[2]) * 83492791u;
+		return h;
+	}
+};
+
+struct PositionEqual {
+	bool operator()(const Vec3f& a, const Vec3f& b) const {
+		// bitwise, positions are only welded if they are exactly equal
+		return std::memcmp(&a, &b, sizeof(a)) == 0;
+	}
+};
+
+class Simplifier {
+public:
+	Simplifier(nytl::Span<const u32> indices, nytl::Span<const Vec3f> positions,
+		nytl::Span<const Vec3f> normals, nytl::Span<const Vec2f> uvs,
+		const SimplifyParams& params);
+
+	SimplifyResult run(u32 targetTriangles);
+
+protected:
+	void classify();
+	void initQuadrics();
+	void pushCandidates(u32 v);
+	double geometricCost(u32 from, u32 to) const;
+	double cost(u32 from, u32 to) const;
+	bool canCollapse(u32 from, u32 to);
+	void collapse(u32 from, u32 to);
+
+	bool hasVertex(u32 tri, u32 v) const {
+		auto* t = &tris_[3 * tri];
+		return t[0] == v || t[1] == v || t[2] == v;
+	}
+
+	Vec3f triNormal(const u32* t) const {
+		auto& a = positions_[t[0]];
+		auto& b = positions_[t[1]];
+		auto& c = positions_[t[2]];
+		return nytl::cross(b - a, c - a);
+	}
+
+	// Collects the vertices adjacent to v via alive triangles.
+	void neighbors(u32 v, std::vector<u32>& out) const;
+
+protected:
+	nytl::Span<const Vec3f> positions_;
+	nytl::Span<const Vec3f> normals_;
+	nytl::Span<const Vec2f> uvs_;
+	SimplifyParams params_;
+	double normalWeight_ {}; // squared, absolute
+	double uvWeight_ {}; // squared, absolute
+	double maxCost_ {}; // squared, absolute
+
+	std::vector<u32> tris_;
+	std::vector<u8> triAlive_;
+	u32 aliveCount_ {};
+
+	std::vector<std::vector<u32>> adj_; // vertex -> triangles (may be dead)
+	std::vector<Quadric> quadrics_;
+	std::vector<u32> version_;
+	std::vector<u8> removed_;
+	std::vector<u8> locked_; // complex vertices
+	std::vector<u8> border_;
+	std::vector<u32> partner_; // other vertex of a seam pair or noPartner
+	std::vector<u32> collapsedTo_; // target of removed vertices, itself otherwise
+
+	std::priority_queue<Collapse, std::vector<Collapse>,
+		std::greater<Collapse>> queue_;
+	std::vector<u32> tmpA_, tmpB_;
+};
+
+Simplifier::Simplifier(nytl::Span<const u32> indices,
+		nytl::Span<const Vec3f> positions, nytl::Span<const Vec3f> normals,
+		nytl::Span<const Vec2f> uvs, const SimplifyParams& params) :
+			positions_(positions), normals_(normals), uvs_(uvs),
+			params_(params) {
+	dlg_assert(indices.size() % 3 == 0);
+	dlg_assert(normals.empty() || normals.size() == positions.size());
+	dlg_assert(uvs.empty() || uvs.size() == positions.size());
+
+	tris_.assign(indices.begin(), indices.end());
+	triAlive_.resize(tris_.size() / 3, true);
+	aliveCount_ = tris_.size() / 3;
+
+	auto n = positions.size();
+	adj_.resize(n);
+	quadrics_.resize(n);
+	version_.resize(n, 0u);
+	removed_.resize(n, false);
+	locked_.resize(n, false);
+	border_.resize(n, false);
+	partner_.resize(n, noPartner);
+	collapsedTo_.resize(n);
+	for(auto v = 0u; v < n; ++v) {
+		collapsedTo_[v] = v;
+	}
+
+	for(auto t = 0u; t < tris_.size() / 3; ++t) {
+		for(auto j = 0u; j < 3; ++j) {
+			dlg_assert(tris_[3 * t + j] < n);
+			adj_[tris_[3 * t + j]].push_back(t);
+		}
+
+		// degenerate triangles (index-wise) would confuse the topology checks
+		auto* tri = &tris_[3 * t];
+		if(tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+			triAlive_[t] = false;
+			--aliveCount_;
+		}
+	}
+
+	auto inf = std::numeric_limits<float>::infinity();
+	auto min = Vec3f{inf, inf, inf};
+	auto max = Vec3f{-inf, -inf, -inf};
+	for(auto idx : indices) {
+		min = nytl::vec::cw::min(min, positions[idx]);
+		max = nytl::vec::cw::max(max, positions[idx]);
+	}
+
+	auto extent = indices.empty() ? 0.0 : double(nytl::length(max - min));
+	auto sq = [](double x) { return x * x; };
+	normalWeight_ = sq(params.normalWeight * extent);
+	uvWeight_ = sq(params.uvWeight * extent);
+	maxCost_ = sq(params.maxError * extent);
+
+	classify();
+	initQuadrics();
+}
+
+void Simplifier::classify() {
+	// Vertices with the same position but different attributes. Two
+	// of them form a seam pair, more are locked.
+	std::unordered_map<Vec3f, u32, PositionHash, PositionEqual> first;
+	first.reserve(positions_.size());
+	for(auto v = 0u; v < positions_.size(); ++v) {
+		if(adj_[v].empty()) {
+			continue; // not referenced
+		}
+
+		auto [it, inserted] = first.emplace(positions_[v], v);
+		if(inserted) {
+			continue;
+		}
+
+		auto f = it->second;
+		if(!locked_[f] && partner_[f] == noPartner) {
+			partner_[f] = v;
+			partner_[v] = f;
+			continue;
+		}
+
+		locked_[v] = true;
+		locked_[f] = true;
+		if(partner_[f] != noPartner) {
+			locked_[partner_[f]] = true;
+			partner_[partner_[f]] = noPartner;
+			partner_[f] = noPartner;
+		}
+	}
+
+	// Border vertices have an edge that is only used by one triangle.
+	// Seam edges are detected as borders as well (the other side uses
+	// other vertices), seam vertices therefore only move along the seam.
+	for(auto v = 0u; v < positions_.size(); ++v) {
+		if(locked_[v]) {
+			continue;
+		}
+
+		neighbors(v, tmpA_);
+		for(auto w : tmpA_) {
+			auto count = 0u;
+			for(auto t : adj_[v]) {
+				count += triAlive_[t] && hasVertex(t, w);
+			}
+
+			if(count == 1u) {
+				border_[v] = true;
+				break;
+			}
+		}
+	}
+}
+
+void Simplifier::initQuadrics() {
+	for(auto t = 0u; t < tris_.size() / 3; ++t) {
+		if(!triAlive_[t]) {
+			continue;
+		}
+
+		auto* tri = &tris_[3 * t];
+		auto n = triNormal(tri);
+		auto len = nytl::length(n);
+		if(len == 0.f) {
+			continue;
+		}
+
+		auto area = 0.5f * len;
+		n /= len;
+		auto d = -nytl::dot(n, positions_[tri[0]]);
+		for(auto j = 0u; j < 3; ++j) {
+			quadrics_[tri[j]].addPlane(n, d, area);
+		}
+
+		// Border edges get an additional plane perpendicular to the
+		// triangle, keeps borders in place.
+		for(auto j = 0u; j < 3; ++j) {
+			auto a = tri[j];
+			auto b = tri[(j + 1) % 3];
+			if(!border_[a] && !border_[b]) {
+				continue;
+			}
+
+			auto count = 0u;
+			for(auto ot : adj_[a]) {
+				count += triAlive_[ot] && hasVertex(ot, b);
+			}
+
+			if(count != 1u) {
+				continue;
+			}
+
+			auto edge = positions_[b] - positions_[a];
+			auto en = nytl::cross(edge, n);
+			auto elen = nytl::length(en);
+			if(elen == 0.f) {
+				continue;
+			}
+
+			en /= elen;
+			auto ed = -nytl::dot(en, positions_[a]);
+			auto w = nytl::dot(edge, edge);
+			quadrics_[a].addPlane(en, ed, w);
+			quadrics_[b].addPlane(en, ed, w);
+		}
+	}
+}
+
+void Simplifier::neighbors(u32 v, std::vector<u32>& out) const {
+	out.clear();
+	for(auto t : adj_[v]) {
+		if(!triAlive_[t]) {
+			continue;
+		}
+
+		for(auto j = 0u; j < 3; ++j) {
+			auto w = tris_[3 * t + j];
+			if(w != v) {
+				out.push_back(w);
+			}
+		}
+	}
+
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+double Simplifier::geometricCost(u32 from, u32 to) const {
+	auto q = quadrics_[from];
+	q += quadrics_[to];
+	return q.weight > 0.0 ? q.eval(positions_[to]) / q.weight : 0.0;
+}
+
+double Simplifier::cost(u32 from, u32 to) const {
+	auto ret = geometricCost(from, to);
+
+	if(!normals_.empty()) {
+		auto d = normals_[from] - normals_[to];
+		ret += normalWeight_ * nytl::dot(d, d);
+	}
+
+	if(!uvs_.empty()) {
+		auto d = uvs_[from] - uvs_[to];
+		ret += uvWeight_ * nytl::dot(d, d);
+	}
+
+	return ret;
+}
+
+void Simplifier::pushCandidates(u32 v) {
+	neighbors(v, tmpB_);
+	for(auto w : tmpB_) {
+		if(!locked_[v]) {
+			queue_.push({cost(v, w), v, w, version_[v], version_[w]});
+		}
+		if(!locked_[w]) {
+			queue_.push({cost(w, v), w, v, version_[w], version_[v]});
+		}
+	}
+}
+
+bool Simplifier::canCollapse(u32 from, u32 to) {
+	if(locked_[from] || removed_[from] || removed_[to]) {
+		return false;
+	}
+
+	// number of triangles sharing the edge
+	auto shared = 0u;
+	for(auto t : adj_[from]) {
+		shared += triAlive_[t] && hasVertex(t, to);
+	}
+
+	if(shared == 0u) {
+		return false; // not an edge (anymore)
+	}
+
+	// border vertices may only move along the border
+	if(border_[from] && shared != 1u) {
+		return false;
+	}
+
+	// Link condition: the vertices connected to both must be exactly
+	// the ones of the shared triangles, otherwise the collapse would
+	// create non-manifold geometry.
+	neighbors(from, tmpA_);
+	neighbors(to, tmpB_);
+	auto common = 0u;
+	for(auto i = 0u, j = 0u; i < tmpA_.size() && j < tmpB_.size();) {
+		if(tmpA_[i] < tmpB_[j]) {
+			++i;
+		} else if(tmpB_[j] < tmpA_[i]) {
+			++j;
+		} else {
+			++common;
+			++i;
+			++j;
+		}
+	}
+
+	if(common != shared) {
+		return false;
+	}
+
+	// the remaining triangles around 'from' must not flip
+	for(auto t : adj_[from]) {
+		if(!triAlive_[t] || hasVertex(t, to)) {
+			continue;
+		}
+
+		u32 moved[3];
+		std::memcpy(moved, &tris_[3 * t], sizeof(moved));
+		auto before = triNormal(moved);
+		for(auto& v : moved) {
+			v = (v == from) ? to : v;
+		}
+
+		auto after = triNormal(moved);
+		auto d = nytl::dot(before, after);
+		if(d <= 0.f || nytl::dot(after, after) == 0.f) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Simplifier::collapse(u32 from, u32 to) {
+	auto& toAdj = adj_[to];
+	toAdj.erase(std::remove_if(toAdj.begin(), toAdj.end(),
+		[&](auto t) { return !triAlive_[t]; }), toAdj.end());
+
+	for(auto t : adj_[from]) {
+		if(!triAlive_[t]) {
+			continue;
+		}
+
+		if(hasVertex(t, to)) {
+			triAlive_[t] = false;
+			--aliveCount_;
+			continue;
+		}
+
+		for(auto j = 0u; j < 3; ++j) {
+			auto& v = tris_[3 * t + j];
+			v = (v == from) ? to : v;
+		}
+
+		toAdj.push_back(t);
+	}
+
+	adj_[from].clear();
+	removed_[from] = true;
+	collapsedTo_[from] = to;
+	quadrics_[to] += quadrics_[from];
+
+	// invalidates all queued collapses from and to 'to'
+	++version_[to];
+	pushCandidates(to);
+}
+
+SimplifyResult Simplifier::run(u32 targetTriangles) {
+	for(auto v = 0u; v < positions_.size(); ++v) {
+		if(locked_[v]) {
+			continue;
+		}
+
+		neighbors(v, tmpB_);
+		for(auto w : tmpB_) {
+			queue_.push({cost(v, w), v, w, version_[v], version_[w]});
+		}
+	}
+
+	while(aliveCount_ > targetTriangles && !queue_.empty()) {
+		auto c = queue_.top();
+		queue_.pop();
+
+		if(c.versionFrom != version_[c.from] || c.versionTo != version_[c.to]) {
+			continue; // outdated
+		}
+
+		// the attribute error only influences the order
+		auto geoCost = geometricCost(c.from, c.to);
+		if(geoCost > maxCost_ || !canCollapse(c.from, c.to)) {
+			continue;
+		}
+
+		// The other side of a seam must be collapsed along the
+		// same edge, otherwise the seam would open.
+		auto pfrom = partner_[c.from];
+		if(pfrom != noPartner) {
+			auto pto = partner_[c.to];
+			if(pto == noPartner || pto == c.from) {
+				continue;
+			}
+
+			auto pCost = geometricCost(pfrom, pto);
+			if(pCost > maxCost_ || !canCollapse(pfrom, pto)) {
+				continue;
+			}
+
+			collapse(pfrom, pto);
+		}
+
+		collapse(c.from, c.to);
+	}
+
+	SimplifyResult res;
+	res.lockedVertices = u32(std::count(locked_.begin(), locked_.end(), true));
+	res.indices.reserve(3 * aliveCount_);
+	for(auto t = 0u; t < tris_.size() / 3; ++t) {
+		if(triAlive_[t]) {
+			res.indices.insert(res.indices.end(),
+				tris_.begin() + 3 * t, tris_.begin() + 3 * t + 3);
+		}
+	}
+
+	// Targets might have been removed later on, resolve the chains.
+	// A target is always alive when collapsed into, so there are no cycles.
+	for(auto v = 0u; v < collapsedTo_.size(); ++v) {
+		auto r = v;
+		while(collapsedTo_[r] != r) {
+			r = collapsedTo_[r];
+		}
+
+		// path compression, keeps this linear
+		for(auto w = v; w != r;) {
+			auto next = collapsedTo_[w];
+			collapsedTo_[w] = r;
+			w = next;
+		}
+	}
+
+	res.remap = std::move(collapsedTo_);
+
+	res.error = maxDeviation(res.indices, positions_, res.remap);
+	return res;
+}
+
+} // anon namespace
+
+SimplifyResult simplify(nytl::Span<const u32> indices,
+		nytl::Span<const Vec3f> positions, nytl::Span<const Vec3f> normals,
+		nytl::Span<const Vec2f> uvs, u32 targetTriangles,
+		const SimplifyParams& params) {
+	Simplifier simplifier(indices, positions, normals, uvs, params);
+	return simplifier.run(targetTriangles);
+}
+
+LodData buildLods(nytl::Span<const u32> indices,
+		nytl::Span<const Vec3f> positions, nytl::Span<const Vec3f> normals,
+		nytl::Span<const Vec2f> uvs, const LodParams& params) {
+	LodData lods;
+	std::vector<u32> current(indices.begin(), indices.end());
+
+	// The vertex every original vertex was collapsed into so far
+	std::vector<u32> remap(positions.size());
+	for(auto v = 0u; v < remap.size(); ++v) {
+		remap[v] = v;
+	}
+
+	while(lods.levels.size() < params.maxLevels) {
+		auto tris = u32(current.size() / 3);
+		auto target = u32(tris * params.ratio);
+		if(target < params.minTriangles) {
+			break;
+		}
+
+		auto res = simplify(current, positions, normals, uvs, target,
+			params.simplify);
+
+		// stop when simplification stalls (e.g. error limit reached)
+		auto newTris = u32(res.indices.size() / 3);
+		if(newTris < params.minTriangles || newTris > 0.9f * tris) {
+			break;
+		}
+
+		optimizeVertexCache(res.indices, res.indices, positions.size());
+
+		// The error is measured against the original mesh instead of
+		// summing up the errors of the levels, that overestimates a lot.
+		for(auto& r : remap) {
+			r = res.remap[r];
+		}
+
+		auto error = maxDeviation(res.indices, positions, remap);
+		auto prevError = lods.levels.empty() ? 0.f : lods.levels.back().error;
+
+		auto& level = lods.levels.emplace_back();
+		level.indexOffset = lods.indices.size();
+		level.indexCount = res.indices.size();
+		level.error = std::max(error, prevError);
+		lods.indices.insert(lods.indices.end(),
+			res.indices.begin(), res.indices.end());
+		current = std::move(res.indices);
+	}
+
+	return lods;
+}
+
+unsigned selectLod(const LodData& lods, float distance, float projScale,
+		float pixelError, float scale) {
+	// model space error that is allowed at this distance
+	auto allowed = pixelError * std::max(distance, 0.f) / (projScale * scale);
+	auto ret = 0u;
+	for(auto i = 0u; i < lods.levels.size(); ++i) {
+		if(lods.levels[i].error > allowed) {
+			break;
+		}
+
+		ret = i + 1;
+	}
+
+	return ret;
+}
+
+} // namespace tkn
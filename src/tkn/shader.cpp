@@ -2,25 +2,41 @@
 #define DLG_DEFAULT_TAGS "tkn", "tkn/shader"
 
 #include <tkn/shader.hpp>
+#include <tkn/config.hpp>
 #include <tkn/util.hpp>
 #include <tkn/bits.hpp>
+#include <tkn/threadPool.hpp>
+#include <tkn/stream.hpp>
+#include <tkn/file.hpp>
 #include <dlg/dlg.hpp>
 #include <vpp/shader.hpp>
 #include <vpp/pipeline.hpp>
-#include <vpp/util/file.hpp>
 #include <vkpp/enums.hpp>
 #include <vkpp/functions.hpp>
 #include <nytl/scope.hpp>
 #include <filesystem>
 #include <fstream>
 #include <atomic>
+#include <cerrno>
 #include <unordered_set>
+#include <algorithm>
 #include <sha1.hpp>
+#include <spirv_reflect.h>
 
 #include <glslang/Public/ShaderLang.h>
 #include <SPIRV/GlslangToSpv.h>
 #include <SPIRV/Logger.h>
 
+#ifdef TKN_WITH_SPIRV_TOOLS
+	#include <spirv-tools/optimizer.hpp>
+#endif
+
+#ifdef TKN_LINUX
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/file.h>
+#endif
+
 namespace tkn {
 
 inline std::string readFilePath(const fs::path& path) {
@@ -336,7 +352,8 @@ std::vector<u32> compileShader(
 		EShLanguage shlang,
 		nytl::StringParam sourcePath,
 		nytl::StringParam cpreamble,
-		nytl::Span<const char*> includeDirs) {
+		nytl::Span<const char*> includeDirs,
+		const SpirvOptions& spvOptions) {
 	static bool glslangInit = initGlslang();
 	if(!glslangInit) {
 		return {};
@@ -382,9 +399,13 @@ std::vector<u32> compileShader(
 	dlg_assert(intermed);
 
     auto logger = spv::SpvBuildLogger{};
+	// Whether glslang optimizes and strips depends on how it was built.
+	// We do both ourselves, so the result only depends on what is part
+	// of the module hash, see ShaderCache::buildModuleHash.
 	auto options = SpvOptions{};
-	options.generateDebugInfo = true;
-	// options.disableOptimizer = false;
+	options.generateDebugInfo = !spvOptions.stripDebugInfo;
+	options.stripDebugInfo = false;
+	options.disableOptimizer = true;
 
 	TProgram program;
 	program.addShader(&shader);
@@ -419,12 +440,56 @@ std::vector<u32> compileShader(
 		dlg_info("SPV logger: {}", spvLog);
 	}
 
+	std::vector<u32> ret;
 	if constexpr(std::is_same_v<u32, unsigned>) {
-		return spirv;
+		ret = std::move(spirv);
 	} else {
 		dlg_warn("Need to copy spirv since glslang assumes u32 == unsigned");
-		return {std::vector<u32>(spirv.begin(), spirv.end())};
+		ret.assign(spirv.begin(), spirv.end());
+	}
+
+	if(!spvOptions.specConstants.empty() &&
+			!freezeSpecConstants(ret, spvOptions.specConstants)) {
+		dlg_error("Shader '{}': freezing specialization constants failed",
+			sourcePath);
+		return {};
+	}
+
+#ifdef TKN_WITH_SPIRV_TOOLS
+	if(spvOptions.optimize) {
+		spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_0);
+		optimizer.SetMessageConsumer([&](spv_message_level_t,
+				const char*, const spv_position_t&, const char* msg) {
+			dlg_info("Shader '{}', optimizer: {}", sourcePath, msg);
+		});
+
+		if(spvOptions.optimizeSize) {
+			optimizer.RegisterSizePasses();
+		} else {
+			optimizer.RegisterPerformancePasses();
+		}
+
+		// On failure, we simply use the unoptimized module
+		std::vector<u32> optimized;
+		if(optimizer.Run(ret.data(), ret.size(), &optimized)) {
+			ret = std::move(optimized);
+		} else {
+			dlg_warn("Shader '{}': optimizing failed", sourcePath);
+		}
+	}
+#else // TKN_WITH_SPIRV_TOOLS
+	static std::atomic<bool> warned {};
+	if(spvOptions.optimize && !warned.exchange(true)) {
+		dlg_info("SPIR-V optimization needs tkn built with SPIRV-Tools, ignoring it");
+	}
+#endif // TKN_WITH_SPIRV_TOOLS
+
+	if(spvOptions.stripDebugInfo && !stripSpirvDebugInfo(ret)) {
+		dlg_error("Shader '{}': stripping debug info failed", sourcePath);
+		return {};
 	}
+
+	return ret;
 }
 
 bool deduceShaderStage(nytl::StringParam glslPath, EShLanguage& outStage) {
@@ -447,7 +512,8 @@ bool deduceShaderStage(nytl::StringParam glslPath, EShLanguage& outStage) {
 
 std::vector<u32> compileShader(const fs::path& glslPath,
 		nytl::StringParam preamble,
-		nytl::Span<const char*> includeDirs) {
+		nytl::Span<const char*> includeDirs,
+		const SpirvOptions& options) {
 	EShLanguage lang;
 	if(!deduceShaderStage(glslPath.u8string(), lang)) {
 		dlg_warn("Can't deduce shader type of {}", glslPath);
@@ -455,9 +521,230 @@ std::vector<u32> compileShader(const fs::path& glslPath,
 	}
 
 	std::string source = readFilePath(glslPath);
-	return compileShader(source, lang, glslPath.u8string(), preamble, includeDirs);
+	return compileShader(source, lang, glslPath.u8string(), preamble,
+		includeDirs, options);
 }
 
+bool freezeSpecConstants(std::vector<u32>& spv,
+		nytl::Span<const SpecConstantValue> values) {
+	// See the SPIR-V specification, 2.3 (physical layout) and 3.32
+	constexpr auto headerSize = 5u;
+	constexpr auto magic = 0x07230203u;
+	constexpr auto opDecorate = 71u;
+	constexpr auto decorationSpecId = 1u;
+	constexpr auto opConstantTrue = 41u;
+	constexpr auto opConstantFalse = 42u;
+	constexpr auto opConstant = 43u;
+	constexpr auto opSpecConstantTrue = 48u;
+	constexpr auto opSpecConstantFalse = 49u;
+	constexpr auto opSpecConstant = 50u;
+
+	if(spv.size() < headerSize || spv[0] != magic) {
+		return false;
+	}
+
+	auto isSpecId = [](const u32* inst, u32 count) {
+		return (inst[0] & 0xFFFFu) == opDecorate && count == 4u &&
+			inst[2] == decorationSpecId;
+	};
+
+	// Maps the result ids of the constants to freeze to their values.
+	// Also validates the instruction sizes, the second pass relies on it.
+	std::unordered_map<u32, u64> frozen;
+	for(auto i = headerSize; i < spv.size();) {
+		auto count = spv[i] >> 16u;
+		if(count == 0u || count > spv.size() - i) {
+			return false;
+		}
+
+		if(isSpecId(&spv[i], count)) {
+			for(auto& value : values) {
+				if(value.id == spv[i + 3]) {
+					frozen[spv[i + 1]] = value.value;
+				}
+			}
+		}
+
+		i += count;
+	}
+
+	if(frozen.empty()) {
+		return true;
+	}
+
+	std::vector<u32> ret;
+	ret.reserve(spv.size());
+	ret.insert(ret.end(), spv.begin(), spv.begin() + headerSize);
+	for(auto i = headerSize; i < spv.size();) {
+		auto* inst = &spv[i];
+		auto count = spv[i] >> 16u;
+		auto opcode = spv[i] & 0xFFFFu;
+		i += count;
+
+		if(isSpecId(inst, count) && frozen.count(inst[1])) {
+			continue;
+		}
+
+		auto start = ret.size();
+		ret.insert(ret.end(), inst, inst + count);
+
+		auto spec = opcode == opSpecConstantTrue ||
+			opcode == opSpecConstantFalse || opcode == opSpecConstant;
+		if(!spec || count < 3u) {
+			continue;
+		}
+
+		auto it = frozen.find(inst[2]);
+		if(it == frozen.end()) {
+			continue;
+		}
+
+		auto value = it->second;
+		if(opcode == opSpecConstant) {
+			ret[start] = (count << 16u) | opConstant;
+			ret[start + 3] = u32(value);
+			if(count > 4u) {
+				ret[start + 4] = u32(value >> 32u);
+			}
+		} else {
+			ret[start] = (count << 16u) | (value ? opConstantTrue : opConstantFalse);
+		}
+	}
+
+	spv = std::move(ret);
+	return true;
+}
+
+bool stripSpirvDebugInfo(std::vector<u32>& spv) {
+	// See the SPIR-V specification, 3.32.2 (debug instructions)
+	constexpr auto headerSize = 5u;
+	constexpr auto magic = 0x07230203u;
+	constexpr auto opSourceContinued = 2u;
+	constexpr auto opSource = 3u;
+	constexpr auto opSourceExtension = 4u;
+	constexpr auto opName = 5u;
+	constexpr auto opMemberName = 6u;
+	constexpr auto opString = 7u;
+	constexpr auto opLine = 8u;
+	constexpr auto opExtInstImport = 11u;
+	constexpr auto opNoLine = 317u;
+	constexpr auto opModuleProcessed = 330u;
+
+	if(spv.size() < headerSize || spv[0] != magic) {
+		return false;
+	}
+
+	// Non-semantic instructions (e.g. debugPrintfEXT) reference strings,
+	// keep them if there are any.
+	auto keepStrings = false;
+	for(auto i = headerSize; i < spv.size();) {
+		auto count = spv[i] >> 16u;
+		if(count == 0u || count > spv.size() - i) {
+			return false;
+		}
+
+		if((spv[i] & 0xFFFFu) == opExtInstImport && count > 2u) {
+			auto* name = reinterpret_cast<const char*>(&spv[i + 2]);
+			auto* end = std::find(name, name + 4u * (count - 2u), '\0');
+			auto str = std::string_view(name, end - name);
+			keepStrings |= (str.substr(0, 12) == "NonSemantic.");
+		}
+
+		i += count;
+	}
+
+	std::vector<u32> ret;
+	ret.reserve(spv.size());
+	ret.insert(ret.end(), spv.begin(), spv.begin() + headerSize);
+	for(auto i = headerSize; i < spv.size();) {
+		auto count = spv[i] >> 16u;
+		auto opcode = spv[i] & 0xFFFFu;
+		auto strip = opcode == opSourceContinued || opcode == opSource ||
+			opcode == opSourceExtension || opcode == opName ||
+			opcode == opMemberName || opcode == opLine ||
+			opcode == opNoLine || opcode == opModuleProcessed ||
+			(opcode == opString && !keepStrings);
+		if(!strip) {
+			ret.insert(ret.end(), spv.begin() + i, spv.begin() + i + count);
+		}
+
+		i += count;
+	}
+
+	spv = std::move(ret);
+	return true;
+}
+
+namespace {
+
+// Identifies the optimizer used for runtime compiled modules, part of
+// the module hash. Empty without SPIRV-Tools, optimization is ignored then.
+std::string_view optimizerVersion() {
+#ifdef TKN_WITH_SPIRV_TOOLS
+	return spvSoftwareVersionString();
+#else // TKN_WITH_SPIRV_TOOLS
+	return {};
+#endif // TKN_WITH_SPIRV_TOOLS
+}
+
+// Exclusive advisory lock on the given file (created if needed), held
+// until destruction. Synchronizes processes using the same cache dir,
+// it does not exclude other threads of this process, use a mutex for that.
+// On platforms without file lock support, this does nothing (and
+// reports being locked).
+class FileLock {
+public:
+	explicit FileLock(const fs::path& path) {
+#ifdef TKN_LINUX
+		std::error_code ec;
+		fs::create_directories(path.parent_path(), ec);
+		fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if(fd_ < 0) {
+			dlg_warn("Can't open lock file {}: {}", path, std::strerror(errno));
+			return;
+		}
+
+		while(::flock(fd_, LOCK_EX) != 0) {
+			if(errno != EINTR) {
+				dlg_warn("Can't lock {}: {}", path, std::strerror(errno));
+				::close(fd_);
+				fd_ = -1;
+				return;
+			}
+		}
+#else // TKN_LINUX
+		(void) path;
+#endif // TKN_LINUX
+	}
+
+	~FileLock() {
+#ifdef TKN_LINUX
+		if(fd_ >= 0) {
+			::flock(fd_, LOCK_UN);
+			::close(fd_);
+		}
+#endif // TKN_LINUX
+	}
+
+	FileLock(const FileLock&) = delete;
+	FileLock& operator=(const FileLock&) = delete;
+
+	bool locked() const {
+#ifdef TKN_LINUX
+		return fd_ >= 0;
+#else // TKN_LINUX
+		return true;
+#endif // TKN_LINUX
+	}
+
+private:
+#ifdef TKN_LINUX
+	int fd_ {-1};
+#endif // TKN_LINUX
+};
+
+} // anon namespace
+
 // ShaderCache
 ShaderCache& ShaderCache::instance(const vpp::Device& dev) {
 	static ShaderCache shaderCache(dev);
@@ -465,6 +752,16 @@ ShaderCache& ShaderCache::instance(const vpp::Device& dev) {
 	return shaderCache;
 }
 
+ShaderCache::ShaderCache(const vpp::Device& dev) : dev_(dev) {
+	loadIndex();
+	loadReflections();
+	openArchive();
+}
+
+ShaderCache::~ShaderCache() {
+	save();
+}
+
 bool ShaderCache::reparse(std::string_view source,
 		std::vector<std::string>& outIncluded, Hash& outHash) {
 	Sha1 sha;
@@ -513,14 +810,18 @@ bool ShaderCache::buildCurrentHash(fs::path shaderPath, Hash& outHash) {
 		auto item = worklist.back();
 		auto itemString = item.string();
 		worklist.pop_back();
-		done.insert(item.string());
+		if(!done.insert(itemString).second) {
+			continue;
+		}
+
+		auto sourceLastWritten = fs::last_write_time(item);
+		auto timeBeforeParsed = FsClock::now();
 
 		{
 			auto sharedLock = std::shared_lock(mutex_);
 			auto knownIt = known_.find(itemString);
 			if(knownIt != known_.end()) {
 				auto& known = knownIt->second;
-				auto sourceLastWritten = fs::last_write_time(item);
 				if(sourceLastWritten < known.lastParsed) {
 					auto& hash = known.hash;
 					sha.add(hash.data(), hash.size());
@@ -531,30 +832,50 @@ bool ShaderCache::buildCurrentHash(fs::path shaderPath, Hash& outHash) {
 			}
 		}
 
-		// parsed file is out-of-date or not known at all.
-		// reparse it
-		std::vector<std::string> included;
+		// Not known in memory or out-of-date. Check whether the file
+		// changed since it was indexed, otherwise we don't have to
+		// read it.
+		auto sourceSize = fs::file_size(item);
+		std::vector<fs::path> includedPaths;
 		Hash hash;
-		auto timeBeforeParsed = FsClock::now();
-		auto source = readFilePath(itemString);
-		dlg_debug("reparsing {}", item);
-		if(!reparse(source, included, hash)) {
-			// parsing failed for some reason
-			return false;
+		bool indexed = false;
+
+		{
+			auto sharedLock = std::shared_lock(mutex_);
+			auto indexIt = index_.find(itemString);
+			if(indexIt != index_.end()) {
+				auto& entry = indexIt->second;
+				if(entry.lastWritten == sourceLastWritten &&
+						entry.size == sourceSize) {
+					hash = entry.hash;
+					includedPaths = entry.includes;
+					indexed = true;
+				}
+			}
 		}
 
-		std::vector<fs::path> includedPaths;
-		includedPaths.reserve(included.size());
-		for(auto& incStr : included) {
-			auto path = resolve(incStr, item.parent_path());
-			if(path.empty()) {
-				// could not resolve shader include
-				dlg_warn("Could not resolve shader {}", incStr);
+		if(!indexed) {
+			// reparse it
+			std::vector<std::string> included;
+			auto source = readFilePath(itemString);
+			dlg_debug("reparsing {}", item);
+			if(!reparse(source, included, hash)) {
+				// parsing failed for some reason
 				return false;
 			}
 
-			dlg_debug(" {} -> {}", item, path);
-			includedPaths.push_back(path);
+			includedPaths.reserve(included.size());
+			for(auto& incStr : included) {
+				auto path = resolve(incStr, item.parent_path());
+				if(path.empty()) {
+					// could not resolve shader include
+					dlg_warn("Could not resolve shader {}", incStr);
+					return false;
+				}
+
+				dlg_debug(" {} -> {}", item, path);
+				includedPaths.push_back(path);
+			}
 		}
 
 		worklist.insert(worklist.end(), includedPaths.begin(),
@@ -563,6 +884,18 @@ bool ShaderCache::buildCurrentHash(fs::path shaderPath, Hash& outHash) {
 
 		{
 			auto lock = std::lock_guard(mutex_);
+			if(!indexed) {
+				// We use the last write time from *before* reading the
+				// file. If it changed in the meantime, it will simply
+				// be parsed again the next time.
+				auto& entry = index_[itemString];
+				entry.lastWritten = sourceLastWritten;
+				entry.size = sourceSize;
+				entry.hash = hash;
+				entry.includes = includedPaths;
+				indexChanged_ = true;
+			}
+
 			auto& known = known_[itemString];
 			known.includes = std::move(includedPaths);
 			known.hash = hash;
@@ -575,38 +908,38 @@ bool ShaderCache::buildCurrentHash(fs::path shaderPath, Hash& outHash) {
 	return true;
 }
 
+ShaderCache::CompiledShaderView ShaderCache::findLoaded(
+		const std::string& fullPathStr, const Hash& hash) {
+	auto sharedLock = std::shared_lock(mutex_);
+	auto knownIt = known_.find(fullPathStr);
+	if(knownIt != known_.end()) {
+		auto& known = knownIt->second;
+		auto shaderIt = known.modules.find(hash);
+		if(shaderIt != known.modules.end()) {
+			return shaderIt->second.view();
+		}
+	}
+
+	return {};
+}
+
 ShaderCache::CompiledShaderView ShaderCache::find(
 		const std::string& fullPathStr, const Hash& hash) {
+	auto loaded = findLoaded(fullPathStr, hash);
+	if(loaded.mod) {
+		return loaded;
+	}
 
+	// check if it exists in the archive
+	nytl::Span<const u32> spv;
 	{
 		auto sharedLock = std::shared_lock(mutex_);
-		auto knownIt = known_.find(fullPathStr);
-		dlg_assertm(knownIt != known_.end(),
-			"There must be an entry for this shader, we generated a hash!");
-
-		if(knownIt != known_.end()) {
-			auto& known = knownIt->second;
-			auto shaderIt = known.modules.find(hash);
-			if(shaderIt != known.modules.end()) {
-				return {shaderIt->second.mod, shaderIt->second.spv};
-			}
+		auto archiveIt = archive_.find(hash);
+		if(archiveIt == archive_.end()) {
+			return {};
 		}
-	}
-
-	// check if it exists on disk
-	auto spvPath = cachePathForShader(hash);
-	if(!fs::exists(spvPath)) {
-		// potential disk cache does not exist
-		return {};
-	}
 
-	std::vector<u32> spv;
-	try {
-		spv = readFilePath32(spvPath);
-	} catch(const std::exception& err) {
-		dlg_warn("Error reading shader cache file from disk at {}: {}",
-			spvPath, err.what());
-		return {};
+		spv = archiveIt->second.spv;
 	}
 
 	auto newMod = vpp::ShaderModule{device(), spv};
@@ -616,7 +949,9 @@ ShaderCache::CompiledShaderView ShaderCache::find(
 	dlg_assertm(knownIt != known_.end(),
 		"There must be an entry for this shader, we generated a hash!");
 
-	auto compiled = CompiledShader{std::move(newMod), std::move(spv)};
+	archive_.find(hash)->second.used = true;
+
+	auto compiled = CompiledShader{std::move(newMod), {}, spv};
 	auto [it, emplaced] = knownIt->second.modules.try_emplace(hash, std::move(compiled));
 
 	// NOTE: this can realistically happen, for instance if two pipelines
@@ -628,11 +963,104 @@ ShaderCache::CompiledShaderView ShaderCache::find(
 		"already existed. Either this is a sha1 collision or another thread "
 		"compiled and inserted it at the same time as this one");
 
-	return {it->second.mod, it->second.spv};
+	return it->second.view();
+}
+
+ShaderCache::CompiledShaderView ShaderCache::loadSpv(const fs::path& fullPath) {
+	dlg_debug("Interpreting shader {} as spirv", fullPath);
+
+	auto fullPathStr = fullPath.string();
+	auto lastWritten = fs::last_write_time(fullPath);
+
+	{
+		auto lock = std::shared_lock(mutex_);
+		auto knownIt = known_.find(fullPathStr);
+		if(knownIt != known_.end()) {
+			auto& known = knownIt->second;
+			if(known.lastParsed > lastWritten) {
+				auto modIt = known.modules.find(known.hash);
+				if(modIt != known.modules.end()) {
+					return modIt->second.view();
+				}
+			}
+		}
+	}
+
+	// not found/not up to date. We have to reload it.
+	auto timeBeforeRead = FsClock::now();
+	auto spv = readFilePath32(fullPath);
+
+	Sha1 sha;
+	sha.add(spv.data(), spv.size() * sizeof(spv[0]));
+	sha.finalize();
+
+	auto lock = std::lock_guard(mutex_);
+	auto& known = known_[fullPathStr];
+	known.includes.clear();
+	known.lastParsed = timeBeforeRead;
+	sha.print_hex(known.hash.data());
+
+	// another thread might have loaded the same version in the meantime
+	auto modIt = known.modules.find(known.hash);
+	if(modIt != known.modules.end()) {
+		return modIt->second.view();
+	}
+
+	auto newMod = vpp::ShaderModule(device(), spv);
+	auto compiled = CompiledShader{std::move(newMod), std::move(spv)};
+	auto it = known.modules.emplace(known.hash, std::move(compiled)).first;
+	return it->second.view();
+}
+
+bool ShaderCache::buildModuleHash(const fs::path& fullPath,
+		std::string_view preamble,
+		nytl::Span<const SpecConstantValue> specConstants, Hash& outHash) {
+	Hash sourceHash;
+	if(!buildCurrentHash(fullPath, sourceHash)) {
+		// Some error during parsing the files
+		return false;
+	}
+
+	Sha1 sha;
+	sha.add(sourceHash.data(), sourceHash.size());
+	sha.add(preamble.data(), preamble.size());
+
+	// Only hash non-default options so that the hashes of modules
+	// compiled without post-processing don't change. What the optimizer
+	// does depends on its version, optimization is ignored without it.
+	auto& opts = spirvOptions;
+	auto optimizer = optimizerVersion();
+	auto optimize = opts.optimize && !optimizer.empty();
+	if(optimize || opts.stripDebugInfo) {
+		char optString[] = {'#', 's', 'p', 'v', '2',
+			optimize ? (opts.optimizeSize ? 's' : 'p') : '-',
+			opts.stripDebugInfo ? 's' : '-'};
+		sha.add(optString, sizeof(optString));
+		if(optimize) {
+			sha.add(optimizer.data(), optimizer.size());
+		}
+	}
+
+	// The frozen specialization constants in the order they are applied
+	auto addSpec = [&](const SpecConstantValue& spec) {
+		sha.add(&spec.id, sizeof(spec.id));
+		sha.add(&spec.value, sizeof(spec.value));
+	};
+
+	if(!opts.specConstants.empty() || !specConstants.empty()) {
+		sha.add("#spec", 5u);
+		std::for_each(opts.specConstants.begin(), opts.specConstants.end(), addSpec);
+		std::for_each(specConstants.begin(), specConstants.end(), addSpec);
+	}
+
+	sha.finalize();
+	sha.print_hex(outHash.data(), true);
+	return true;
 }
 
 ShaderCache::CompiledShaderView ShaderCache::load(
-		std::string_view shaderPath, nytl::StringParam preamble) {
+		std::string_view shaderPath, nytl::StringParam preamble,
+		nytl::Span<const SpecConstantValue> specConstants) {
 
 	// rough idea of shader loading
 	// - retrieve hash of requested shader
@@ -641,7 +1069,8 @@ ShaderCache::CompiledShaderView ShaderCache::load(
 	//   while doing so, build up hash. Make sure to include the preamble in the hash
 	// - check if compiled version of hash is present
 	//   if so: return it
-	//   otherwise: compile shader from scratch
+	//   otherwise: compile shader from scratch (or wait for the thread
+	//   already compiling it)
 
 	auto fullPath = resolve(shaderPath);
 	if(fullPath.empty()) {
@@ -649,119 +1078,1109 @@ ShaderCache::CompiledShaderView ShaderCache::load(
 		return {};
 	}
 
-	auto fullPathStr = fullPath.string();
-
 	// check if it's a plain spirv shader
 	if(!fullPath.has_extension() || fullPath.extension() == ".spv") {
-		dlg_debug("Interpreting shader {} as spirv", fullPath);
-		dlg_assertm(preamble.empty(), "Can't use preamble for precompiled shaders");
+		dlg_assertm(preamble.empty() && specConstants.empty(),
+			"Can't use preamble or frozen constants for precompiled shaders");
+		return loadSpv(fullPath);
+	}
+
+	Hash hash;
+	if(!buildModuleHash(fullPath, preamble, specConstants, hash)) {
+		return {};
+	}
 
-		auto lastWritten = fs::last_write_time(fullPath);
+	return loadHashed(fullPath, preamble, specConstants, hash);
+}
 
-		{
-			auto lock = std::shared_lock(mutex_);
-			auto knownIt = known_.find(fullPathStr);
-			if(knownIt != known_.end()) {
-				auto& known = knownIt->second;
-				if(known.lastParsed > lastWritten) {
-					auto modIt = known.modules.find(known.hash);
-					if(modIt != known.modules.end()) {
-						return {modIt->second.mod, modIt->second.spv};
-					}
-				}
-			}
+std::vector<ShaderCache::CompiledShaderView> ShaderCache::loadMany(
+		nytl::Span<const LoadRequest> requests, ThreadPool* pool) {
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	struct Job {
+		fs::path fullPath;
+		std::string_view preamble;
+		nytl::Span<const SpecConstantValue> specConstants;
+		Hash hash;
+		bool spv {};
+		bool valid {};
+		CompiledShaderView result {};
+	};
+
+	// Deduplicate identical requests before doing anything.
+	std::vector<Job> jobs;
+	std::vector<std::size_t> jobIDs(requests.size());
+	std::unordered_map<std::string, std::size_t> seen;
+	for(auto i = 0u; i < requests.size(); ++i) {
+		auto& req = requests[i];
+		auto key = std::string(req.path);
+		key += '\0';
+		key += req.preamble;
+		for(auto& spec : req.specConstants) {
+			key += '\0';
+			key += std::to_string(spec.id);
+			key += '=';
+			key += std::to_string(spec.value);
 		}
 
-		// not found/not up to date. We have to reload it.
-		auto timeBeforeRead = FsClock::now();
-		auto spv = readFilePath32(fullPath);
+		auto [it, emplaced] = seen.try_emplace(std::move(key), jobs.size());
+		if(emplaced) {
+			auto& job = jobs.emplace_back();
+			job.preamble = req.preamble;
+			job.specConstants = req.specConstants;
+		}
 
-		Sha1 sha;
-		sha.add(spv.data(), spv.size() * sizeof(spv[0]));
-		sha.finalize();
+		jobIDs[i] = it->second;
+	}
 
-		auto lock = std::lock_guard(mutex_);
-		auto& known = known_[fullPathStr];
-		known.includes.clear();
-		known.lastParsed = timeBeforeRead;
-		sha.print_hex(known.hash.data());
+	// Resolve and hash all shaders. This has to read all sources
+	// (at least when not known yet), so do it in parallel as well.
+	std::vector<std::string_view> paths(jobs.size());
+	for(auto i = 0u; i < requests.size(); ++i) {
+		paths[jobIDs[i]] = requests[i].path;
+	}
 
-		auto newMod = vpp::ShaderModule(device(), spv);
-		auto compiled = CompiledShader{std::move(newMod), std::move(spv)};
-		auto [it, emplaced] = known.modules.try_emplace(known.hash, std::move(compiled));
-		dlg_assertm(emplaced, "Could not insert compiled shader module since it "
-			"already existed. Either this is a sha1 collision or another thread "
-			"compiled and inserted it at the same time as this one");
+	parallelFor(*pool, jobs.size(), 1u, [&](std::size_t begin, std::size_t end) {
+		for(auto i = begin; i < end; ++i) {
+			auto& job = jobs[i];
+			job.fullPath = resolve(paths[i]);
+			if(job.fullPath.empty()) {
+				dlg_error("Can't load {}, could not resolve path", paths[i]);
+				continue;
+			}
 
-		return {it->second.mod, it->second.spv};
-	}
+			auto ext = job.fullPath.extension();
+			job.spv = !job.fullPath.has_extension() || ext == ".spv";
+			if(job.spv) {
+				dlg_assertm(job.preamble.empty() && job.specConstants.empty(),
+					"Can't use preamble or frozen constants for precompiled shaders");
+				job.valid = true;
+			} else {
+				job.valid = buildModuleHash(job.fullPath, job.preamble,
+					job.specConstants, job.hash);
+			}
+		}
+	});
+
+	// Different paths or preambles might still result in the same module.
+	// Only load/compile one job for every distinct module.
+	std::vector<std::size_t> work;
+	std::vector<std::size_t> sameAs(jobs.size());
+	std::unordered_map<Hash, std::size_t, HashHasher> hashes;
+	for(auto i = 0u; i < jobs.size(); ++i) {
+		sameAs[i] = i;
+		if(!jobs[i].valid) {
+			continue;
+		}
 
-	// check if shader is already known
-	Hash sourceHash;
-	if(!buildCurrentHash(fullPath, sourceHash)) {
-		// Some error during parsing the files
-		return {};
+		if(!jobs[i].spv) {
+			auto [it, emplaced] = hashes.try_emplace(jobs[i].hash, i);
+			if(!emplaced) {
+				sameAs[i] = it->second;
+				continue;
+			}
+		}
+
+		work.push_back(i);
 	}
 
-	Sha1 sha;
-	sha.add(sourceHash.data(), sourceHash.size());
-	sha.add(preamble.data(), preamble.size());
-	sha.finalize();
+	dlg_debug("loadMany: {} requests, {} distinct modules",
+		requests.size(), work.size());
 
-	Hash hash;
-	sha.print_hex(hash.data(), true);
+	parallelFor(*pool, work.size(), 1u, [&](std::size_t begin, std::size_t end) {
+		for(auto i = begin; i < end; ++i) {
+			auto& job = jobs[work[i]];
+			job.result = job.spv ?
+				loadSpv(job.fullPath) :
+				loadHashed(job.fullPath, job.preamble, job.specConstants, job.hash);
+		}
+	});
+
+	std::vector<CompiledShaderView> ret(requests.size());
+	for(auto i = 0u; i < requests.size(); ++i) {
+		ret[i] = jobs[sameAs[jobIDs[i]]].result;
+	}
+
+	return ret;
+}
 
+ShaderCache::CompiledShaderView ShaderCache::loadHashed(
+		const fs::path& fullPath, std::string_view preamble,
+		nytl::Span<const SpecConstantValue> specConstants, const Hash& hash) {
+	auto fullPathStr = fullPath.string();
 	auto mod = find(fullPathStr, hash);
 	if(mod.mod) {
 		dlg_debug("Loading {} (hash: '{}') from cache", fullPath, hash.data());
 		return mod;
 	}
 
+	// Check whether another thread is already compiling the module.
+	// Otherwise register our own compilation. We have to check the
+	// loaded modules again while holding the lock, the other thread
+	// might have finished (and removed its in-flight entry) since 'find'.
+	std::promise<CompiledShaderView> promise;
+	{
+		auto lock = std::unique_lock(inFlightMutex_);
+		auto it = inFlight_.find(hash);
+		if(it != inFlight_.end()) {
+			auto future = it->second;
+			lock.unlock();
+
+			dlg_debug("Waiting for {} (hash: '{}') compiled by another thread",
+				fullPath, hash.data());
+			return future.get();
+		}
+
+		mod = findLoaded(fullPathStr, hash);
+		if(mod.mod) {
+			return mod;
+		}
+
+		inFlight_.emplace(hash, promise.get_future().share());
+	}
+
+	auto inFlightGuard = nytl::ScopeGuard([&]{
+		auto lock = std::lock_guard(inFlightMutex_);
+		inFlight_.erase(hash);
+	});
+
+	try {
+		mod = compile(fullPath, preamble, specConstants, hash);
+	} catch(...) {
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+
+	promise.set_value(mod);
+	return mod;
+}
+
+ShaderCache::CompiledShaderView ShaderCache::compile(const fs::path& fullPath,
+		std::string_view preamble,
+		nytl::Span<const SpecConstantValue> specConstants, const Hash& hash) {
+	auto fullPathStr = fullPath.string();
 	dlg_debug("recompiling {}", fullPath);
 
-	// Make sure to store (in memory and on disk) the time *before* compilation
-	// as last write time. This way, if the shader is modified during
-	// compilation, the cache will be immediately out of date (even though
-	// we return a version without the new change here). This guarantees
-	// that we (later on) will never return a module that doesn't match
-	// the current code.
-	auto preCompileTime = FsClock::now();
-	auto spv = tkn::compileShader(fullPathStr, preamble, includePaths);
+	auto options = spirvOptions;
+	options.specConstants.insert(options.specConstants.end(),
+		specConstants.begin(), specConstants.end());
+	auto spv = tkn::compileShader(fullPathStr, std::string(preamble),
+		includePaths, options);
 	if(spv.empty()) {
 		return {};
 	}
 
-	auto spvPath = cachePathForShader(hash);
-	auto spvPathParent = spvPath.parent_path();
-	if(!fs::exists(spvPathParent)) {
-		fs::create_directories(spvPathParent);
-	}
+	appendArchive(hash, spv);
 
-	vpp::writeFile(spvPath.u8string(), tkn::bytes(spv), true);
-	fs::last_write_time(spvPath, preCompileTime);
+	auto newMod = vpp::ShaderModule(device(), spv);
 
 	auto lockGuard = std::lock_guard(mutex_);
 	auto& known = known_[fullPathStr];
 
-	auto newMod = vpp::ShaderModule(device(), spv);
 	auto compiled = CompiledShader{std::move(newMod), std::move(spv)};
 	auto [it, emplaced] = known.modules.try_emplace(hash, std::move(compiled));
 	dlg_assertm(emplaced, "Could not insert compiled shader module since it "
 		"already existed. Either this is a sha1 collision or another thread "
 		"compiled and inserted it at the same time as this one");
 
-	return {it->second.mod, it->second.spv};
+	return it->second.view();
 }
 
 void ShaderCache::clear() {
+	save();
+
 	auto lockGuard = std::lock_guard(mutex_);
 	known_.clear();
 }
 
-fs::path ShaderCache::cachePathForShader(const Hash& hash) {
-	auto spvName = std::string(hash.data(), hash.size() - 1);
-	spvName += ".spv";
-	return cacheDir / fs::path(spvName);
+bool ShaderCache::save() {
+	// Snapshots are taken and written under this lock, so an older
+	// snapshot can never replace a newer one.
+	auto lock = std::lock_guard(saveMutex_);
+	auto res = saveIndex();
+	res &= saveReflections();
+	res &= saveArchiveUsage();
+	return res;
+}
+
+// Archive file format:
+// - ArchiveHeader
+// - ArchiveRecord[entryCount], sorted by hash
+// - the SPIR-V of those records
+// - from header.packedSize on: modules appended since the last
+//   compaction, each as ArchiveRecord directly followed by its SPIR-V.
+namespace {
+
+constexpr char archiveMagic[8] = {'t', 'k', 'n', 's', 'p', 'i', 'r', 'v'};
+constexpr u32 archiveVersion = 1u;
+
+// Appended data is only compacted automatically when there is at
+// least this much of it.
+constexpr auto minCompactSize = 256 * 1024u;
+
+struct ArchiveHeader {
+	char magic[8];
+	u32 version;
+	u32 entryCount;
+	u64 packedSize; // end of the records and SPIR-V packed at the front
+};
+
+struct ArchiveRecord {
+	char hash[40];
+	i64 lastUsed; // seconds since the system_clock epoch
+	u64 offset; // of the SPIR-V in the file, in bytes
+	u32 size; // of the SPIR-V, in words
+	u32 pad;
+};
+
+static_assert(sizeof(ArchiveHeader) == 24u);
+static_assert(sizeof(ArchiveRecord) == 64u);
+
+i64 secondsNow() {
+	using namespace std::chrono;
+	auto now = system_clock::now().time_since_epoch();
+	return duration_cast<seconds>(now).count();
+}
+
+struct ArchiveContent {
+	ArchiveHeader header;
+	// All valid records with the offset of the record itself.
+	std::vector<std::pair<u64, ArchiveRecord>> records;
+	// Size of the valid data, a crash while appending might leave
+	// an incomplete record at the end.
+	u64 validSize;
+};
+
+// Returns false if the data is not a valid archive.
+bool parseArchive(nytl::Span<const std::byte> data, ArchiveContent& out) {
+	auto read = [&](u64 offset, auto& dst) {
+		dlg_assert(offset + sizeof(dst) <= data.size());
+		std::memcpy(&dst, data.data() + offset, sizeof(dst));
+	};
+
+	if(data.size() < sizeof(ArchiveHeader)) {
+		return false;
+	}
+
+	auto& header = out.header;
+	read(0u, header);
+	if(std::memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) != 0 ||
+			header.version != archiveVersion ||
+			header.packedSize > data.size() ||
+			header.packedSize < sizeof(header) +
+				u64(header.entryCount) * sizeof(ArchiveRecord)) {
+		return false;
+	}
+
+	out.records.clear();
+	for(auto i = 0u; i < header.entryCount; ++i) {
+		auto off = sizeof(header) + u64(i) * sizeof(ArchiveRecord);
+		auto& [recOff, rec] = out.records.emplace_back();
+		recOff = off;
+		read(off, rec);
+		if(rec.offset % 4u != 0u ||
+				rec.offset + 4u * u64(rec.size) > header.packedSize) {
+			return false;
+		}
+	}
+
+	auto off = header.packedSize;
+	while(off + sizeof(ArchiveRecord) <= data.size()) {
+		ArchiveRecord rec;
+		read(off, rec);
+		auto end = rec.offset + 4u * u64(rec.size);
+		if(rec.offset != off + sizeof(rec) || end > data.size()) {
+			break;
+		}
+
+		out.records.push_back({off, rec});
+		off = end;
+	}
+
+	out.validSize = off;
+	return true;
+}
+
+std::unique_ptr<StreamMemoryMap> mapArchive(const fs::path& path) {
+	std::error_code ec;
+	if(fs::file_size(path, ec) == 0u || ec) {
+		return {};
+	}
+
+	auto file = File(path.u8string(), "rb");
+	if(!file) {
+		return {};
+	}
+
+	return std::make_unique<StreamMemoryMap>(
+		std::make_unique<FileStream>(std::move(file)));
+}
+
+} // anon namespace
+
+fs::path ShaderCache::archivePath() {
+	return cacheDir / fs::path("archive");
+}
+
+// The archive is shared by all processes using the cache dir. Appending,
+// cutting off incomplete records, updating usage times and compacting
+// happen while holding this lock. It's a separate file since compacting
+// replaces the archive file.
+fs::path ShaderCache::archiveLockPath() {
+	return cacheDir / fs::path("archive.lock");
+}
+
+void ShaderCache::openArchive() {
+	auto path = archivePath();
+
+	// Check whether the archive should be compacted first. We can
+	// do it now since we haven't mapped it yet.
+	{
+		ArchiveHeader header;
+		std::error_code ec;
+		auto size = fs::file_size(path, ec);
+		auto file = File(path.u8string(), "rb");
+		if(!ec && file && std::fread(&header, sizeof(header), 1, file) == 1 &&
+				header.packedSize <= size) {
+			auto appended = size - header.packedSize;
+			if(appended > minCompactSize && appended > header.packedSize) {
+				file = {};
+				compactArchive();
+			}
+		}
+	}
+
+	// Another process might be appending right now, its record would look
+	// incomplete. Hold the lock until we know what is valid.
+	FileLock fileLock(archiveLockPath());
+	auto map = mapArchive(path);
+	if(!map) {
+		return;
+	}
+
+	ArchiveContent content;
+	if(!parseArchive(map->span(), content)) {
+		map = {};
+		if(fileLock.locked()) {
+			dlg_info("Shader archive {}: invalid header or version, removing it", path);
+			std::error_code ec;
+			fs::remove(path, ec);
+		}
+		return;
+	}
+
+	// Without the lock, we can't know whether the incomplete record is
+	// still being written. Only use the valid part then.
+	if(content.validSize < map->size() && fileLock.locked()) {
+		// Probably crashed while appending, cut off the incomplete
+		// record. Otherwise we would append after it.
+		dlg_info("Shader archive {}: incomplete record at {}", path,
+			content.validSize);
+		map = {};
+
+		std::error_code ec;
+		fs::resize_file(path, content.validSize, ec);
+		map = mapArchive(path);
+		if(ec || !map) {
+			dlg_warn("Shader archive {}: resizing failed", path);
+			map = {};
+			fs::remove(path, ec);
+			return;
+		}
+	}
+
+	auto lock = std::lock_guard(mutex_);
+	for(auto& [recOff, rec] : content.records) {
+		Hash hash {};
+		std::memcpy(hash.data(), rec.hash, sizeof(rec.hash));
+
+		auto& entry = archive_[hash];
+		auto ptr = reinterpret_cast<const u32*>(map->data() + rec.offset);
+		entry.spv = {ptr, rec.size};
+		entry.entryOffset = recOff;
+	}
+
+	dlg_debug("Mapped shader archive with {} modules", archive_.size());
+	archiveMap_ = std::move(map);
+}
+
+void ShaderCache::appendArchive(const Hash& hash, nytl::Span<const u32> spv) {
+	auto lock = std::lock_guard(archiveWriteMutex_);
+	FileLock fileLock(archiveLockPath());
+	if(!fileLock.locked()) {
+		return;
+	}
+
+	auto path = archivePath();
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+
+	// The offset must be queried while holding the lock, other
+	// processes might have appended since we last looked.
+	auto file = File(path.u8string(), "ab");
+	if(!file || std::fseek(file, 0, SEEK_END) != 0) {
+		dlg_warn("Can't open shader archive {}", path);
+		return;
+	}
+
+	auto end = std::ftell(file);
+	if(end < 0) {
+		dlg_warn("Can't query size of shader archive {}", path);
+		return;
+	}
+
+	auto size = u64(end);
+	auto ok = true;
+	if(size == 0u) {
+		ArchiveHeader header {};
+		std::memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+		header.version = archiveVersion;
+		header.packedSize = sizeof(header);
+		ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+		size = sizeof(header);
+	}
+
+	ArchiveRecord rec {};
+	std::memcpy(rec.hash, hash.data(), sizeof(rec.hash));
+	rec.lastUsed = secondsNow();
+	rec.offset = size + sizeof(rec);
+	rec.size = spv.size();
+
+	ok = ok && std::fwrite(&rec, sizeof(rec), 1, file) == 1;
+	ok = ok && std::fwrite(spv.data(), sizeof(u32), spv.size(), file) == spv.size();
+	if(!ok) {
+		dlg_warn("Failed to write to shader archive {}", path);
+	}
+}
+
+bool ShaderCache::saveArchiveUsage() {
+	std::vector<std::pair<u64, Hash>> used;
+
+	{
+		auto lock = std::lock_guard(mutex_);
+		for(auto& [hash, entry] : archive_) {
+			if(entry.used) {
+				used.push_back({entry.entryOffset, hash});
+				entry.used = false;
+			}
+		}
+	}
+
+	if(used.empty()) {
+		return true;
+	}
+
+	auto lock = std::lock_guard(archiveWriteMutex_);
+	FileLock fileLock(archiveLockPath());
+	if(!fileLock.locked()) {
+		return false;
+	}
+
+	auto file = File(archivePath().u8string(), "r+b");
+	if(!file) {
+		dlg_warn("Can't open shader archive {}", archivePath());
+		return false;
+	}
+
+	auto now = secondsNow();
+	for(auto& [offset, hash] : used) {
+		// Make sure the archive is still the one we mapped,
+		// it might have been compacted by another process.
+		char fileHash[sizeof(ArchiveRecord::hash)];
+		if(std::fseek(file, offset, SEEK_SET) != 0 ||
+				std::fread(fileHash, sizeof(fileHash), 1, file) != 1 ||
+				std::memcmp(fileHash, hash.data(), sizeof(fileHash)) != 0) {
+			dlg_debug("Shader archive changed, can't update usage");
+			return false;
+		}
+
+		auto off = offset + offsetof(ArchiveRecord, lastUsed);
+		if(std::fseek(file, off, SEEK_SET) != 0 ||
+				std::fwrite(&now, sizeof(now), 1, file) != 1) {
+			dlg_warn("Failed to write to shader archive {}", archivePath());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ShaderCache::compactArchive(std::chrono::seconds maxUnused,
+		std::uint64_t maxSize) {
+	auto path = archivePath();
+
+	// remove the files of the old disk cache (one .spv per module)
+	std::error_code ec;
+	for(auto& entry : fs::directory_iterator(cacheDir, ec)) {
+		if(entry.path().extension() == ".spv") {
+			fs::remove(entry.path(), ec);
+		}
+	}
+
+	// Held until the compacted archive replaced the old one, records
+	// appended in the meantime would be lost otherwise.
+	FileLock fileLock(archiveLockPath());
+	if(!fileLock.locked()) {
+		return false;
+	}
+
+	if(!fs::exists(path, ec)) {
+		return true;
+	}
+
+	std::string data;
+	try {
+		std::ifstream ifs(path, std::ios::binary);
+		ifs.exceptions(std::ostream::failbit | std::ostream::badbit);
+		data = std::string(std::istreambuf_iterator<char>(ifs), {});
+	} catch(const std::exception& err) {
+		dlg_warn("Error reading shader archive {}: {}", path, err.what());
+		return false;
+	}
+
+	auto bytes = nytl::Span<const std::byte>(
+		reinterpret_cast<const std::byte*>(data.data()), data.size());
+	ArchiveContent content;
+	if(!parseArchive(bytes, content)) {
+		dlg_info("Shader archive {}: invalid header or version, removing it", path);
+		fs::remove(path, ec);
+		return true;
+	}
+
+	// only keep the most recently used record per hash
+	std::vector<ArchiveRecord> records;
+	std::unordered_map<std::string_view, std::size_t> ids;
+	for(auto& [off, rec] : content.records) {
+		auto hash = std::string_view(rec.hash, sizeof(rec.hash));
+		auto [it, emplaced] = ids.try_emplace(hash, records.size());
+		if(emplaced) {
+			records.push_back(rec);
+		} else if(records[it->second].lastUsed < rec.lastUsed) {
+			records[it->second] = rec;
+		}
+	}
+
+	auto total = records.size();
+	auto minUsed = secondsNow() - i64(maxUnused.count());
+	auto dropped = std::remove_if(records.begin(), records.end(),
+		[&](auto& rec) { return rec.lastUsed < minUsed; });
+	records.erase(dropped, records.end());
+
+	if(maxSize) {
+		std::sort(records.begin(), records.end(), [](auto& a, auto& b) {
+			return a.lastUsed > b.lastUsed;
+		});
+
+		auto size = u64(0u);
+		auto it = records.begin();
+		for(; it != records.end(); ++it) {
+			size += 4u * u64(it->size);
+			if(size > maxSize) {
+				break;
+			}
+		}
+
+		records.erase(it, records.end());
+	}
+
+	std::sort(records.begin(), records.end(), [](auto& a, auto& b) {
+		return std::memcmp(a.hash, b.hash, sizeof(a.hash)) < 0;
+	});
+
+	// write the packed archive
+	ArchiveHeader header {};
+	std::memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+	header.version = archiveVersion;
+	header.entryCount = records.size();
+
+	auto off = sizeof(header) + records.size() * sizeof(ArchiveRecord);
+	std::vector<u64> srcOffsets;
+	for(auto& rec : records) {
+		srcOffsets.push_back(rec.offset);
+		rec.offset = off;
+		off += 4u * u64(rec.size);
+	}
+
+	header.packedSize = off;
+
+	std::string out;
+	out.reserve(off);
+	out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.append(reinterpret_cast<const char*>(records.data()),
+		records.size() * sizeof(ArchiveRecord));
+	for(auto i = 0u; i < records.size(); ++i) {
+		out.append(data.data() + srcOffsets[i], 4u * records[i].size);
+	}
+
+	if(!replaceFile(path.u8string(), out, ec)) {
+		dlg_warn("Failed to write shader archive {}: {}", path, ec.message());
+		return false;
+	}
+
+	dlg_info("Compacted shader archive: kept {} of {} modules, {} -> {} KiB",
+		records.size(), total, data.size() / 1024, out.size() / 1024);
+	return true;
+}
+
+// Index file format:
+// - char magic[8], u32 version, u32 entryCount
+// - for every entry:
+//   i64 lastWritten (ticks since FsClock epoch), u64 size,
+//   char hash[41], u32 pathLength, char path[pathLength], u32 includeCount
+//   and for every include: u32 pathLength, char path[pathLength]
+namespace {
+
+constexpr char indexMagic[8] = {'t', 'k', 'n', 's', 'h', 'i', 'd', 'x'};
+constexpr u32 indexVersion = 1u;
+
+struct IndexReader {
+	std::string_view data;
+
+	template<typename T>
+	T get() {
+		T ret;
+		read(&ret, sizeof(ret));
+		return ret;
+	}
+
+	void read(void* dst, std::size_t size) {
+		if(data.size() < size) {
+			throw std::runtime_error("Unexpected end of file");
+		}
+
+		std::memcpy(dst, data.data(), size);
+		data.remove_prefix(size);
+	}
+
+	std::string string() {
+		auto size = get<u32>();
+		std::string ret(size, '\0');
+		read(ret.data(), size);
+		return ret;
+	}
+};
+
+template<typename T>
+void put(std::string& dst, const T& val) {
+	dst.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+void putString(std::string& dst, std::string_view str) {
+	put(dst, u32(str.size()));
+	dst.append(str);
+}
+
+} // anon namespace
+
+fs::path ShaderCache::indexPath() {
+	return cacheDir / fs::path("index");
+}
+
+void ShaderCache::loadIndex() {
+	auto path = indexPath();
+	if(!fs::exists(path)) {
+		return;
+	}
+
+	std::unordered_map<std::string, IndexEntry> index;
+	try {
+		std::ifstream ifs(path, std::ios::binary);
+		ifs.exceptions(std::ostream::failbit | std::ostream::badbit);
+		auto data = std::string(std::istreambuf_iterator<char>(ifs), {});
+
+		IndexReader r{data};
+		char magic[sizeof(indexMagic)];
+		r.read(magic, sizeof(magic));
+		if(std::memcmp(magic, indexMagic, sizeof(magic)) != 0 ||
+				r.get<u32>() != indexVersion) {
+			dlg_info("Shader cache index {}: invalid header or version", path);
+			return;
+		}
+
+		auto count = r.get<u32>();
+		for(auto i = 0u; i < count; ++i) {
+			IndexEntry entry;
+			entry.lastWritten = FsTimePoint(FsDuration(r.get<i64>()));
+			entry.size = r.get<u64>();
+			r.read(entry.hash.data(), entry.hash.size());
+			auto file = r.string();
+
+			auto includeCount = r.get<u32>();
+			entry.includes.reserve(includeCount);
+			for(auto j = 0u; j < includeCount; ++j) {
+				entry.includes.push_back(r.string());
+			}
+
+			index.emplace(std::move(file), std::move(entry));
+		}
+	} catch(const std::exception& err) {
+		dlg_warn("Error reading shader cache index {}: {}", path, err.what());
+		return;
+	}
+
+	dlg_debug("Loaded shader cache index with {} entries", index.size());
+	auto lock = std::lock_guard(mutex_);
+	index_ = std::move(index);
+}
+
+bool ShaderCache::saveIndex() {
+	std::string data;
+
+	{
+		auto lock = std::lock_guard(mutex_);
+		if(!indexChanged_) {
+			return true;
+		}
+
+		data.append(indexMagic, sizeof(indexMagic));
+		put(data, indexVersion);
+		put(data, u32(index_.size()));
+		for(auto& [file, entry] : index_) {
+			put(data, i64(entry.lastWritten.time_since_epoch().count()));
+			put(data, u64(entry.size));
+			data.append(entry.hash.data(), entry.hash.size());
+			putString(data, file);
+			put(data, u32(entry.includes.size()));
+			for(auto& inc : entry.includes) {
+				putString(data, inc.string());
+			}
+		}
+
+		indexChanged_ = false;
+	}
+
+	// a concurrently running instance never sees a partial index
+	auto path = indexPath();
+	std::error_code ec;
+	if(!replaceFile(path.u8string(), data, ec)) {
+		dlg_warn("Failed to write shader cache index {}: {}", path, ec.message());
+		auto lock = std::lock_guard(mutex_);
+		indexChanged_ = true; // try again next time
+		return false;
+	}
+
+	return true;
+}
+
+// Reflection file format:
+// - char magic[8], u32 version, u32 entryCount
+// - for every entry:
+//   char spvHash[40] (hex sha1),
+//   i64 lastUsed (seconds since the system_clock epoch),
+//   u32 bindingCount, {u32 set, binding, count, type}[bindingCount],
+//   u32 pushConstantOffset, u32 pushConstantSize,
+//   u32 specConstantCount, {u32 id, u32 size, u64 value}[specConstantCount]
+namespace {
+
+constexpr char reflectionMagic[8] = {'t', 'k', 'n', 's', 'h', 'r', 'f', 'l'};
+constexpr u32 reflectionVersion = 2u;
+
+// Reflections not used for this long are dropped on load.
+constexpr auto reflectionMaxUnused = i64(30 * 24 * 60 * 60);
+// The last usage time is only updated (and the file rewritten) when
+// it is older than this.
+constexpr auto reflectionUsedGranularity = i64(24 * 60 * 60);
+
+// SHA-1 of the SPIR-V. A collision would hand a pipeline the wrong
+// layout, so we use the same strong hash as for the modules (and
+// assume it never collides, see ShaderCache::find).
+ShaderCache::Hash hashSpv(nytl::Span<const u32> spv) {
+	Sha1 sha;
+	sha.add(spv.data(), spv.size() * sizeof(spv[0]));
+	sha.finalize();
+
+	ShaderCache::Hash ret;
+	sha.print_hex(ret.data(), true);
+	return ret;
+}
+
+void checkReflect(SpvReflectResult res, bool allowNotFound = false) {
+	if(res != SPV_REFLECT_RESULT_SUCCESS &&
+			(!allowNotFound || res != SPV_REFLECT_RESULT_ERROR_ELEMENT_NOT_FOUND)) {
+		auto msg = dlg::format("spir-v reflection failed: {}", (int) res);
+		throw std::runtime_error(msg);
+	}
+}
+
+// spirv_reflect does not support specialization constants, we
+// parse them ourselves.
+std::vector<ShaderReflection::SpecConstant> reflectSpecConstants(
+		nytl::Span<const u32> spv) {
+	constexpr auto opDecorate = 71u;
+	constexpr auto opTypeBool = 20u;
+	constexpr auto opTypeInt = 21u;
+	constexpr auto opTypeFloat = 22u;
+	constexpr auto opSpecConstantTrue = 48u;
+	constexpr auto opSpecConstantFalse = 49u;
+	constexpr auto opSpecConstant = 50u;
+	constexpr auto decorationSpecId = 1u;
+
+	std::unordered_map<u32, u32> specIDs; // result id -> constant_id
+	std::unordered_map<u32, u32> typeSizes; // type id -> size
+	struct Constant {
+		u32 type;
+		u32 id;
+		u64 value;
+	};
+	std::vector<Constant> constants;
+
+	// skip the header
+	auto i = 5u;
+	while(i < spv.size()) {
+		auto op = spv[i] & 0xFFFFu;
+		auto count = spv[i] >> 16u;
+		if(count == 0u || i + count > spv.size()) {
+			throw std::runtime_error("spir-v reflection failed: invalid instruction");
+		}
+
+		auto args = spv.subspan(i + 1, count - 1);
+		auto checkArgs = [&](std::size_t min) {
+			if(args.size() < min) {
+				throw std::runtime_error("spir-v reflection failed: invalid instruction");
+			}
+		};
+
+		switch(op) {
+			case opDecorate:
+				checkArgs(2);
+				if(args[1] == decorationSpecId) {
+					checkArgs(3);
+					specIDs[args[0]] = args[2];
+				}
+				break;
+			case opTypeBool:
+				checkArgs(1);
+				typeSizes[args[0]] = 4u; // VkBool32
+				break;
+			case opTypeInt:
+			case opTypeFloat:
+				checkArgs(2);
+				typeSizes[args[0]] = args[1] / 8u;
+				break;
+			case opSpecConstantTrue:
+			case opSpecConstantFalse:
+				checkArgs(2);
+				constants.push_back({args[0], args[1], op == opSpecConstantTrue});
+				break;
+			case opSpecConstant: {
+				checkArgs(3);
+				auto value = u64(args[2]);
+				if(args.size() >= 4) {
+					value |= u64(args[3]) << 32u;
+				}
+				constants.push_back({args[0], args[1], value});
+				break;
+			} default:
+				break;
+		}
+
+		i += count;
+	}
+
+	std::vector<ShaderReflection::SpecConstant> ret;
+	for(auto& constant : constants) {
+		auto it = specIDs.find(constant.id);
+		if(it == specIDs.end()) { // e.g. OpSpecConstantOp results
+			continue;
+		}
+
+		ret.push_back({it->second, typeSizes[constant.type], constant.value});
+	}
+
+	std::sort(ret.begin(), ret.end(), [](auto& a, auto& b) {
+		return a.id < b.id;
+	});
+	return ret;
+}
+
+} // anon namespace
+
+ShaderReflection reflect(nytl::Span<const u32> spv) {
+	SpvReflectShaderModule mod;
+	auto res = spvReflectCreateShaderModule(spv.size() * sizeof(u32),
+		spv.data(), &mod);
+	checkReflect(res);
+
+	auto modGuard = nytl::ScopeGuard([&]{
+		spvReflectDestroyShaderModule(&mod);
+	});
+
+	ShaderReflection ret;
+	for(auto i = 0u; i < mod.descriptor_set_count; ++i) {
+		auto& set = mod.descriptor_sets[i];
+		for(auto j = 0u; j < set.binding_count; ++j) {
+			auto& binding = *set.bindings[j];
+			ret.bindings.push_back({binding.set, binding.binding, binding.count,
+				static_cast<vk::DescriptorType>(binding.descriptor_type)});
+		}
+	}
+
+	std::sort(ret.bindings.begin(), ret.bindings.end(), [](auto& a, auto& b) {
+		return std::tie(a.set, a.binding) < std::tie(b.set, b.binding);
+	});
+
+	// entry point name, see tkn/pipeline.hpp
+	auto block = spvReflectGetEntryPointPushConstantBlock(&mod, "main", &res);
+	checkReflect(res, true);
+	if(block) {
+		ret.pushConstantOffset = block->offset;
+		ret.pushConstantSize = block->size;
+	}
+
+	ret.specConstants = reflectSpecConstants(spv);
+	return ret;
+}
+
+const ShaderReflection& ShaderCache::reflection(nytl::Span<const u32> spv) {
+	auto hash = hashSpv(spv);
+	auto now = secondsNow();
+
+	{
+		auto lock = std::shared_lock(reflectionMutex_);
+		auto it = reflections_.find(hash);
+		if(it != reflections_.end() &&
+				now - it->second.lastUsed < reflectionUsedGranularity) {
+			return it->second.reflection;
+		}
+	}
+
+	auto lock = std::lock_guard(reflectionMutex_);
+	auto it = reflections_.find(hash);
+	if(it != reflections_.end()) {
+		it->second.lastUsed = now;
+		reflectionsChanged_ = true;
+		return it->second.reflection;
+	}
+
+	// NOTE: we reflect while holding the lock. Shouldn't matter much,
+	// reflection is cheap compared to compilation and usually every
+	// module is only reflected once.
+	auto [nit, emplaced] = reflections_.emplace(hash,
+		ReflectionEntry{reflect(spv), now});
+	dlg_assert(emplaced);
+	reflectionsChanged_ = true;
+	return nit->second.reflection;
+}
+
+fs::path ShaderCache::reflectionPath() {
+	return cacheDir / fs::path("reflection");
+}
+
+void ShaderCache::loadReflections() {
+	auto path = reflectionPath();
+	if(!fs::exists(path)) {
+		return;
+	}
+
+	std::unordered_map<Hash, ReflectionEntry, HashHasher> reflections;
+	auto dropped = 0u;
+	try {
+		std::ifstream ifs(path, std::ios::binary);
+		ifs.exceptions(std::ostream::failbit | std::ostream::badbit);
+		auto data = std::string(std::istreambuf_iterator<char>(ifs), {});
+
+		IndexReader r{data};
+		char magic[sizeof(reflectionMagic)];
+		r.read(magic, sizeof(magic));
+		if(std::memcmp(magic, reflectionMagic, sizeof(magic)) != 0 ||
+				r.get<u32>() != reflectionVersion) {
+			dlg_info("Shader reflection cache {}: invalid header or version", path);
+			return;
+		}
+
+		auto minUsed = secondsNow() - reflectionMaxUnused;
+		auto count = r.get<u32>();
+		for(auto i = 0u; i < count; ++i) {
+			Hash hash {};
+			r.read(hash.data(), hash.size() - 1);
+			ReflectionEntry entry;
+			entry.lastUsed = r.get<i64>();
+
+			auto& refl = entry.reflection;
+			refl.bindings.resize(r.get<u32>());
+			for(auto& binding : refl.bindings) {
+				binding.set = r.get<u32>();
+				binding.binding = r.get<u32>();
+				binding.count = r.get<u32>();
+				binding.type = static_cast<vk::DescriptorType>(r.get<u32>());
+			}
+
+			refl.pushConstantOffset = r.get<u32>();
+			refl.pushConstantSize = r.get<u32>();
+			refl.specConstants.resize(r.get<u32>());
+			for(auto& constant : refl.specConstants) {
+				constant.id = r.get<u32>();
+				constant.size = r.get<u32>();
+				constant.defaultValue = r.get<u64>();
+			}
+
+			if(entry.lastUsed < minUsed) {
+				++dropped;
+				continue;
+			}
+
+			reflections.emplace(hash, std::move(entry));
+		}
+	} catch(const std::exception& err) {
+		dlg_warn("Error reading shader reflection cache {}: {}", path, err.what());
+		return;
+	}
+
+	dlg_debug("Loaded {} cached shader reflections", reflections.size());
+	auto lock = std::lock_guard(reflectionMutex_);
+	reflections_ = std::move(reflections);
+	reflectionsChanged_ = (dropped > 0);
+}
+
+bool ShaderCache::saveReflections() {
+	std::string data;
+
+	{
+		auto lock = std::lock_guard(reflectionMutex_);
+		if(!reflectionsChanged_) {
+			return true;
+		}
+
+		data.append(reflectionMagic, sizeof(reflectionMagic));
+		put(data, reflectionVersion);
+		put(data, u32(reflections_.size()));
+		for(auto& [hash, entry] : reflections_) {
+			auto& refl = entry.reflection;
+			data.append(hash.data(), hash.size() - 1);
+			put(data, entry.lastUsed);
+			put(data, u32(refl.bindings.size()));
+			for(auto& binding : refl.bindings) {
+				put(data, binding.set);
+				put(data, binding.binding);
+				put(data, binding.count);
+				put(data, u32(binding.type));
+			}
+
+			put(data, refl.pushConstantOffset);
+			put(data, refl.pushConstantSize);
+			put(data, u32(refl.specConstants.size()));
+			for(auto& constant : refl.specConstants) {
+				put(data, constant.id);
+				put(data, constant.size);
+				put(data, constant.defaultValue);
+			}
+		}
+
+		reflectionsChanged_ = false;
+	}
+
+	auto path = reflectionPath();
+	std::error_code ec;
+	if(!replaceFile(path.u8string(), data, ec)) {
+		dlg_warn("Failed to write shader reflection cache {}: {}", path, ec.message());
+		auto lock = std::lock_guard(reflectionMutex_);
+		reflectionsChanged_ = true; // try again next time
+		return false;
+	}
+
+	return true;
 }
 
 fs::path ShaderCache::resolve(std::string_view shader,
@@ -0,0 +1,631 @@
+#include <tkn/sparseGrid.hpp>
+#include <tkn/threadPool.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include "isosurfaceTables.hpp"
+
+namespace tkn {
+namespace {
+
+using Grid = SparseSdfGrid;
+constexpr auto brickSize = Grid::brickSize;
+constexpr auto nodeSize = Grid::nodeSize;
+constexpr auto nodeSamples = brickSize * nodeSize; // per dimension
+constexpr auto nodeBricks = nodeSize * nodeSize * nodeSize;
+constexpr auto brickGrain = 16u; // bricks per parallelFor range
+
+u32 ceilDiv(u32 a, u32 b) {
+	return (a + b - 1) / b;
+}
+
+float length(Vec3f v) {
+	return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+Vec3f normalized(Vec3f v) {
+	auto l = length(v);
+	return (l > 0.f) ? (1 / l) * v : Vec3f{0.f, 0.f, 1.f};
+}
+
+} // anon namespace
+
+SparseSdfGrid::SparseSdfGrid(Vec3ui size, Vec3f start, Vec3f spacing) :
+	size_(size), start_(start), spacing_(spacing) {
+}
+
+void SparseSdfGrid::sample(const SdfRowFunc& func, float band,
+		float lipschitz, ThreadPool* pool) {
+	dlg_assert(band > 0.f && lipschitz > 0.f);
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	auto diag = length(spacing_);
+	background_ = std::max(band, lipschitz * diag);
+	rootSize_ = {
+		ceilDiv(size_.x, nodeSamples),
+		ceilDiv(size_.y, nodeSamples),
+		ceilDiv(size_.z, nodeSamples),
+	};
+
+	auto rootCount = std::size_t(rootSize_.x) * rootSize_.y * rootSize_.z;
+	root_.assign(rootCount, noNode);
+	rootTiles_.assign(rootCount, background_);
+	nodes_.clear();
+	bricks_.clear();
+
+	// Evaluates the function at the centers of count boxes of
+	// extent^3 samples, the first one starting at sample first.
+	// The values are written in x, y, z order.
+	auto centers = [&](Vec3ui first, Vec3ui count, u32 extent,
+			nytl::Span<float> out) {
+		std::vector<float> xs(count.x);
+		for(auto x = 0u; x < count.x; ++x) {
+			xs[x] = start_.x + (first.x + x * extent + 0.5f * (extent - 1)) *
+				spacing_.x;
+		}
+
+		for(auto z = 0u; z < count.z; ++z) {
+			for(auto y = 0u; y < count.y; ++y) {
+				auto py = start_.y + (first.y + y * extent + 0.5f * (extent - 1)) *
+					spacing_.y;
+				auto pz = start_.z + (first.z + z * extent + 0.5f * (extent - 1)) *
+					spacing_.z;
+				auto off = (z * count.y + y) * count.x;
+				func(xs, py, pz, out.subspan(off, count.x));
+			}
+		}
+	};
+
+	// A box may contain a value within the band if the value at its
+	// center is within band + the (bounded) change to its corners.
+	auto inBand = [&](float center, u32 extent) {
+		return std::abs(center) <= background_ +
+			lipschitz * 0.5f * (extent - 1) * diag;
+	};
+
+	auto tile = [&](float center) {
+		return (center < 0.f) ? -background_ : background_;
+	};
+
+	// root
+	std::vector<float> values(rootCount);
+	centers({0, 0, 0}, rootSize_, nodeSamples, values);
+
+	std::vector<Vec3ui> nodeOrigins;
+	for(auto z = 0u; z < rootSize_.z; ++z) {
+		for(auto y = 0u; y < rootSize_.y; ++y) {
+			for(auto x = 0u; x < rootSize_.x; ++x) {
+				auto id = (z * rootSize_.y + y) * rootSize_.x + x;
+				if(inBand(values[id], nodeSamples)) {
+					root_[id] = u32(nodeOrigins.size());
+					nodeOrigins.push_back(nodeSamples * Vec3ui{x, y, z});
+				} else {
+					rootTiles_[id] = tile(values[id]);
+				}
+			}
+		}
+	}
+
+	// nodes
+	auto brickCount = Vec3ui{
+		ceilDiv(size_.x, brickSize),
+		ceilDiv(size_.y, brickSize),
+		ceilDiv(size_.z, brickSize),
+	};
+
+	nodes_.resize(nodeOrigins.size());
+	std::vector<u32> brickStart(nodes_.size() + 1, 0u);
+	parallelFor(*pool, nodes_.size(), 1u, [&](auto begin, auto end) {
+		std::vector<float> values(nodeBricks);
+		for(auto n = begin; n < end; ++n) {
+			auto& node = nodes_[n];
+			auto origin = nodeOrigins[n];
+			centers(origin, {nodeSize, nodeSize, nodeSize}, brickSize, values);
+
+			auto count = 0u;
+			for(auto i = 0u; i < nodeBricks; ++i) {
+				auto bx = origin.x / brickSize + i % nodeSize;
+				auto by = origin.y / brickSize + (i / nodeSize) % nodeSize;
+				auto bz = origin.z / brickSize + i / (nodeSize * nodeSize);
+				auto inside = bx < brickCount.x && by < brickCount.y &&
+					bz < brickCount.z;
+				if(inside && inBand(values[i], brickSize)) {
+					node.bricks[i] = count++;
+					node.tiles[i] = background_;
+				} else {
+					node.bricks[i] = noBrick;
+					node.tiles[i] = tile(values[i]);
+				}
+			}
+
+			brickStart[n + 1] = count;
+		}
+	});
+
+	for(auto n = 0u; n < nodes_.size(); ++n) {
+		brickStart[n + 1] += brickStart[n];
+	}
+
+	// bricks
+	bricks_.resize(brickStart.back());
+	parallelFor(*pool, nodes_.size(), 1u, [&](auto begin, auto end) {
+		for(auto n = begin; n < end; ++n) {
+			auto& node = nodes_[n];
+			for(auto i = 0u; i < nodeBricks; ++i) {
+				if(node.bricks[i] == noBrick) {
+					continue;
+				}
+
+				node.bricks[i] += brickStart[n];
+				bricks_[node.bricks[i]].origin = nodeOrigins[n] + brickSize * Vec3ui{
+					i % nodeSize,
+					(i / nodeSize) % nodeSize,
+					i / (nodeSize * nodeSize)};
+			}
+		}
+	});
+
+	parallelFor(*pool, bricks_.size(), brickGrain, [&](auto begin, auto end) {
+		std::vector<float> xs(brickSize);
+		for(auto b = begin; b < end; ++b) {
+			auto& brick = bricks_[b];
+			for(auto x = 0u; x < brickSize; ++x) {
+				xs[x] = start_.x + (brick.origin.x + x) * spacing_.x;
+			}
+
+			for(auto z = 0u; z < brickSize; ++z) {
+				for(auto y = 0u; y < brickSize; ++y) {
+					auto py = start_.y + (brick.origin.y + y) * spacing_.y;
+					auto pz = start_.z + (brick.origin.z + z) * spacing_.z;
+					auto off = (z * brickSize + y) * brickSize;
+					func(xs, py, pz, nytl::Span<float>(brick.values.data() + off,
+						brickSize));
+				}
+			}
+		}
+	});
+}
+
+u32 SparseSdfGrid::brickID(u32 bx, u32 by, u32 bz) const {
+	auto rx = bx / nodeSize;
+	auto ry = by / nodeSize;
+	auto rz = bz / nodeSize;
+	if(rx >= rootSize_.x || ry >= rootSize_.y || rz >= rootSize_.z) {
+		return noBrick;
+	}
+
+	auto node = root_[(rz * rootSize_.y + ry) * rootSize_.x + rx];
+	if(node == noNode) {
+		return noBrick;
+	}
+
+	auto lx = bx % nodeSize;
+	auto ly = by % nodeSize;
+	auto lz = bz % nodeSize;
+	return nodes_[node].bricks[(lz * nodeSize + ly) * nodeSize + lx];
+}
+
+float SparseSdfGrid::tile(u32 bx, u32 by, u32 bz) const {
+	auto rx = bx / nodeSize;
+	auto ry = by / nodeSize;
+	auto rz = bz / nodeSize;
+	if(rx >= rootSize_.x || ry >= rootSize_.y || rz >= rootSize_.z) {
+		return background_;
+	}
+
+	auto rid = (rz * rootSize_.y + ry) * rootSize_.x + rx;
+	if(root_[rid] == noNode) {
+		return rootTiles_[rid];
+	}
+
+	auto lx = bx % nodeSize;
+	auto ly = by % nodeSize;
+	auto lz = bz % nodeSize;
+	return nodes_[root_[rid]].tiles[(lz * nodeSize + ly) * nodeSize + lx];
+}
+
+float SparseSdfGrid::value(u32 x, u32 y, u32 z) const {
+	auto bx = x / brickSize;
+	auto by = y / brickSize;
+	auto bz = z / brickSize;
+	auto id = brickID(bx, by, bz);
+	if(id == noBrick) {
+		return tile(bx, by, bz);
+	}
+
+	return bricks_[id].value(x % brickSize, y % brickSize, z % brickSize);
+}
+
+std::size_t SparseSdfGrid::memoryUsage() const {
+	return bricks_.size() * sizeof(Brick) +
+		nodes_.size() * sizeof(Node) +
+		root_.size() * (sizeof(root_[0]) + sizeof(rootTiles_[0]));
+}
+
+float SparseSdfGrid::Accessor::value(u32 x, u32 y, u32 z) {
+	auto b = Vec3ui{x / brickSize, y / brickSize, z / brickSize};
+	if(b != cached_) {
+		cached_ = b;
+		auto id = grid_->brickID(b.x, b.y, b.z);
+		brick_ = (id == noBrick) ? nullptr : &grid_->bricks()[id];
+		tile_ = brick_ ? 0.f : grid_->tile(b.x, b.y, b.z);
+	}
+
+	return brick_ ?
+		brick_->value(x % brickSize, y % brickSize, z % brickSize) :
+		tile_;
+}
+
+// marching cubes
+// Every brick owns the vertices on the edges starting at its samples.
+// A first pass finds the crossed edges and the number of triangles of
+// every brick, after a prefix sum over the counts the second pass writes
+// the vertices and indices directly to the mesh. The vertex of an edge
+// owned by another brick is found via the rank of the edge in the
+// crossed edges of that brick.
+namespace {
+
+// The samples of a brick and around it, needed for the cells
+// (up to local coordinate 8) and the gradients (from -1 to 9).
+constexpr auto windowSize = brickSize + 3;
+constexpr auto edgeBits = brickSize * brickSize * brickSize * 3;
+constexpr auto edgeWords = edgeBits / 64;
+
+// Number of indices in mc::triTable for every configuration.
+constexpr std::array<u8, 256> triIndexCounts() {
+	std::array<u8, 256> ret {};
+	for(auto c = 0u; c < 256u; ++c) {
+		while(mc::triTable[c][ret[c]] != -1) {
+			++ret[c];
+		}
+	}
+	return ret;
+}
+
+constexpr auto triIndexCount = triIndexCounts();
+
+struct BrickEdges {
+	// Bit ((z * 8 + y) * 8 + x) * 3 + axis is set if the edge is crossed.
+	std::array<u64, edgeWords> crossed;
+	std::array<u16, edgeWords> prefix; // set bits in the previous words
+	u32 vertexCount;
+	u32 indexCount;
+
+	u32 rank(u32 bit) const {
+		auto word = bit / 64;
+		auto below = crossed[word] & ((u64(1) << (bit % 64)) - 1);
+		return prefix[word] + u32(std::bitset<64>(below).count());
+	}
+};
+
+struct BrickMesher {
+	const SparseSdfGrid& grid;
+	float iso;
+
+	Vec3ui origin {};
+	std::array<float, windowSize * windowSize * windowSize> values {};
+	std::array<u8, windowSize * windowSize * windowSize> outside {};
+	Vec3ui samples {}; // owned samples within the grid
+	Vec3ui cells {}; // cells within the grid
+
+	// Bricks owning the edges at local coordinates (0 or 8).
+	u32 owners[2][2][2] {};
+
+	static u32 wid(int x, int y, int z) {
+		return ((z + 1) * windowSize + (y + 1)) * windowSize + (x + 1);
+	}
+
+	// Fills the window from the brick and its neighbors, row by row.
+	void gather(Vec3ui brickOrigin) {
+		origin = brickOrigin;
+		auto size = grid.size();
+		for(auto a = 0u; a < 3u; ++a) {
+			samples[a] = std::min(brickSize, size[a] - origin[a]);
+			cells[a] = std::min(brickSize, size[a] - 1 - origin[a]);
+		}
+
+		auto bx = origin.x / brickSize;
+		auto by = origin.y / brickSize;
+		auto bz = origin.z / brickSize;
+		for(auto i = 0u; i < 8u; ++i) {
+			auto ox = i & 1u;
+			auto oy = (i >> 1) & 1u;
+			auto oz = i >> 2;
+			owners[oz][oy][ox] = grid.brickID(bx + ox, by + oy, bz + oz);
+		}
+
+		auto bricks = grid.bricks();
+		auto copy = [&](u32 nx, u32 ny, u32 nz, u32 lx, u32 ly, u32 lz,
+				u32 count, float* dst) {
+			auto id = grid.brickID(nx, ny, nz);
+			if(id == SparseSdfGrid::noBrick) {
+				std::fill(dst, dst + count, grid.tile(nx, ny, nz));
+			} else {
+				auto* src = &bricks[id].values[(lz * brickSize + ly) * brickSize + lx];
+				std::copy(src, src + count, dst);
+			}
+		};
+
+		for(auto z = -1; z <= int(brickSize + 1); ++z) {
+			for(auto y = -1; y <= int(brickSize + 1); ++y) {
+				// brick offset (-1, 0, 1) and local coordinate
+				auto oy = (y < 0) ? -1 : (y >= int(brickSize)) ? 1 : 0;
+				auto oz = (z < 0) ? -1 : (z >= int(brickSize)) ? 1 : 0;
+				auto ny = by + oy;
+				auto nz = bz + oz;
+				auto ly = u32(y - oy * int(brickSize));
+				auto lz = u32(z - oz * int(brickSize));
+
+				auto* row = &values[wid(-1, y, z)];
+				copy(bx - 1, ny, nz, brickSize - 1, ly, lz, 1, row);
+				copy(bx, ny, nz, 0, ly, lz, brickSize, row + 1);
+				copy(bx + 1, ny, nz, 0, ly, lz, 2, row + 1 + brickSize);
+			}
+		}
+
+		for(auto i = 0u; i < values.size(); ++i) {
+			outside[i] = (values[i] < iso);
+		}
+	}
+
+	unsigned config(u32 x, u32 y, u32 z) const {
+		auto ret = 0u;
+		for(auto i = 0u; i < 8u; ++i) {
+			auto& o = mc::cornerOffsets[i];
+			ret |= outside[wid(x + o[0], y + o[1], z + o[2])] << i;
+		}
+		return ret;
+	}
+
+	// Whether all crossed edges of the cell belong to allocated bricks.
+	// Bricks with crossed edges are always allocated for iso values
+	// up to background - lipschitz * diagonal, see sample. For values
+	// closer to the background an edge in a tile may be crossed (with
+	// the tile value as one end), there is no vertex for it: the cell
+	// is handled as if it had no crossing in both passes.
+	bool owned(u32 x, u32 y, u32 z, unsigned config) const {
+		if(x + 1 < brickSize && y + 1 < brickSize && z + 1 < brickSize) {
+			return true;
+		}
+
+		auto used = unsigned(mc::edgeTable[config]);
+		for(auto e = 0u; e < 12u; ++e) {
+			auto& ce = mc::edgeStarts[e];
+			auto owner = owners[(z + ce[2]) / brickSize][(y + ce[1]) / brickSize]
+				[(x + ce[0]) / brickSize];
+			if((used & (1u << e)) && owner == SparseSdfGrid::noBrick) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Whether the corners of the cells are not all on the same side.
+	bool mixed() const {
+		auto first = outside[wid(0, 0, 0)];
+		for(auto z = 0u; z <= cells.z; ++z) {
+			for(auto y = 0u; y <= cells.y; ++y) {
+				auto* row = &outside[wid(0, y, z)];
+				for(auto x = 0u; x <= cells.x; ++x) {
+					if(row[x] != first) {
+						return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+
+	void findEdges(BrickEdges& edges) const {
+		edges.crossed.fill(0u);
+		edges.vertexCount = 0u;
+		edges.indexCount = 0u;
+
+		// an edge can only be crossed if it ends within the grid,
+		// i.e. if there is a cell along it
+		constexpr u32 strides[3] = {1u, windowSize, windowSize * windowSize};
+		for(auto z = 0u; z < samples.z; ++z) {
+			for(auto y = 0u; y < samples.y; ++y) {
+				auto* row = &outside[wid(0, y, z)];
+				u32 limits[3] = {
+					cells.x,
+					(y < cells.y) ? samples.x : 0u,
+					(z < cells.z) ? samples.x : 0u,
+				};
+
+				for(auto x = 0u; x < samples.x; ++x) {
+					for(auto a = 0u; a < 3u; ++a) {
+						if(x < limits[a] && row[x] != row[x + strides[a]]) {
+							auto bit = ((z * brickSize + y) * brickSize + x) * 3 + a;
+							edges.crossed[bit / 64] |= u64(1) << (bit % 64);
+							++edges.vertexCount;
+						}
+					}
+				}
+			}
+		}
+
+		auto count = 0u;
+		for(auto w = 0u; w < edgeWords; ++w) {
+			edges.prefix[w] = u16(count);
+			count += u32(std::bitset<64>(edges.crossed[w]).count());
+		}
+
+		// Cells can still have crossed edges owned by the neighbors.
+		// But if all their corners are on the same side, there
+		// is nothing to do.
+		if(edges.vertexCount == 0u && !mixed()) {
+			return;
+		}
+
+		for(auto z = 0u; z < cells.z; ++z) {
+			for(auto y = 0u; y < cells.y; ++y) {
+				for(auto x = 0u; x < cells.x; ++x) {
+					auto c = config(x, y, z);
+					if(owned(x, y, z, c)) {
+						edges.indexCount += triIndexCount[c];
+					}
+				}
+			}
+		}
+	}
+
+	// Same as for SdfGrid: central differences, one-sided at the
+	// boundary of the grid.
+	Vec3f gradient(u32 x, u32 y, u32 z) const {
+		auto spacing = grid.spacing();
+		Vec3ui p {x, y, z};
+		Vec3f ret;
+		for(auto a = 0u; a < 3u; ++a) {
+			Vec3i lo {int(x), int(y), int(z)};
+			auto hi = lo;
+			lo[a] -= (origin[a] + p[a] > 0) ? 1 : 0;
+			hi[a] += (origin[a] + p[a] + 1 < grid.size()[a]) ? 1 : 0;
+			auto d = values[wid(hi.x, hi.y, hi.z)] - values[wid(lo.x, lo.y, lo.z)];
+			ret[a] = d / ((hi[a] - lo[a]) * spacing[a]);
+		}
+		return ret;
+	}
+
+	void vertex(u32 x, u32 y, u32 z, unsigned axis, Vec3f& pos, Vec3f& normal) const {
+		Vec3ui b {x, y, z};
+		++b[axis];
+
+		auto va = values[wid(x, y, z)];
+		auto vb = values[wid(b.x, b.y, b.z)];
+		auto f = std::clamp((iso - va) / (vb - va), 0.f, 1.f);
+
+		auto pa = grid.position(origin.x + x, origin.y + y, origin.z + z);
+		auto pb = grid.position(origin.x + b.x, origin.y + b.y, origin.z + b.z);
+		auto ga = gradient(x, y, z);
+		auto gb = gradient(b.x, b.y, b.z);
+		pos = pa + f * (pb - pa);
+		normal = normalized(-1.f * (ga + f * (gb - ga)));
+	}
+};
+
+} // anon namespace
+
+IsoMesh marchingCubes(const SparseSdfGrid& grid, float iso, ThreadPool* pool) {
+	IsoMesh ret;
+	auto bricks = grid.bricks();
+	if(bricks.empty()) {
+		return ret;
+	}
+
+	dlg_assert(std::abs(iso) < grid.background());
+	if(!pool) {
+		pool = &ThreadPool::instance();
+	}
+
+	std::vector<BrickEdges> edges(bricks.size());
+	parallelFor(*pool, bricks.size(), brickGrain, [&](auto begin, auto end) {
+		BrickMesher mesher {grid, iso};
+		for(auto b = begin; b < end; ++b) {
+			mesher.gather(bricks[b].origin);
+			mesher.findEdges(edges[b]);
+		}
+	});
+
+	// prefix sums
+	std::vector<std::size_t> vertexStart(bricks.size() + 1, 0u);
+	std::vector<std::size_t> indexStart(bricks.size() + 1, 0u);
+	for(auto b = 0u; b < bricks.size(); ++b) {
+		vertexStart[b + 1] = vertexStart[b] + edges[b].vertexCount;
+		indexStart[b + 1] = indexStart[b] + edges[b].indexCount;
+	}
+
+	dlg_assert(vertexStart.back() < 0xFFFFFFFFu);
+	ret.positions.resize(vertexStart.back());
+	ret.normals.resize(vertexStart.back());
+	ret.indices.resize(indexStart.back());
+
+	parallelFor(*pool, bricks.size(), brickGrain, [&](auto begin, auto end) {
+		BrickMesher mesher {grid, iso};
+		for(auto b = begin; b < end; ++b) {
+			if(edges[b].vertexCount == 0u && edges[b].indexCount == 0u) {
+				continue;
+			}
+
+			auto origin = bricks[b].origin;
+			mesher.gather(origin);
+
+			// the vertices are ordered like the bits
+			auto vid = vertexStart[b];
+			auto& own = edges[b];
+			for(auto w = 0u; w < edgeWords; ++w) {
+				for(auto bits = own.crossed[w], i = u64(0); bits; bits >>= 1, ++i) {
+					if(!(bits & 1u)) {
+						continue;
+					}
+
+					auto bit = u32(w * 64 + i);
+					auto axis = bit % 3;
+					auto s = bit / 3;
+					mesher.vertex(s % brickSize, (s / brickSize) % brickSize,
+						s / (brickSize * brickSize), axis,
+						ret.positions[vid], ret.normals[vid]);
+					++vid;
+				}
+			}
+
+			// only called for owned cells, see BrickMesher::owned
+			auto edgeVertex = [&](u32 x, u32 y, u32 z, u32 axis) {
+				auto ox = x / brickSize;
+				auto oy = y / brickSize;
+				auto oz = z / brickSize;
+				auto owner = mesher.owners[oz][oy][ox];
+
+				x %= brickSize;
+				y %= brickSize;
+				z %= brickSize;
+				auto bit = ((z * brickSize + y) * brickSize + x) * 3 + axis;
+				dlg_assert(edges[owner].crossed[bit / 64] & (u64(1) << (bit % 64)));
+				return u32(vertexStart[owner] + edges[owner].rank(bit));
+			};
+
+			auto* out = ret.indices.data() + indexStart[b];
+			auto cells = mesher.cells;
+			for(auto z = 0u; z < cells.z; ++z) {
+				for(auto y = 0u; y < cells.y; ++y) {
+					for(auto x = 0u; x < cells.x; ++x) {
+						auto config = mesher.config(x, y, z);
+						if(config == 0 || config == 255 ||
+								!mesher.owned(x, y, z, config)) {
+							continue;
+						}
+
+						u32 verts[12];
+						auto used = unsigned(mc::edgeTable[config]);
+						for(auto e = 0u; e < 12u; ++e) {
+							if(used & (1u << e)) {
+								auto& ce = mc::edgeStarts[e];
+								verts[e] = edgeVertex(x + ce[0], y + ce[1],
+									z + ce[2], ce[3]);
+							}
+						}
+
+						// flip order, table contains them clockwise
+						auto* tris = mc::triTable[config];
+						for(auto i = 0u; tris[i] != -1; i += 3) {
+							*(out++) = verts[tris[i + 0]];
+							*(out++) = verts[tris[i + 2]];
+							*(out++) = verts[tris[i + 1]];
+						}
+					}
+				}
+			}
+
+			dlg_assert(out == ret.indices.data() + indexStart[b + 1]);
+		}
+	});
+
+	return ret;
+}
+
+} // namespace tkn
@@ -1,6 +1,8 @@
 #include <tkn/threadPool.hpp>
 #include <dlg/dlg.hpp>
 #include <iostream>
+#include <algorithm>
+#include <exception>
 
 namespace tkn {
 namespace {
@@ -145,4 +147,67 @@ void ThreadPool::destroy() {
 	}
 }
 
+namespace detail {
+
+void parallelFor(ThreadPool& pool, std::size_t count, std::size_t grain,
+		void* func, void (*call)(void*, std::size_t, std::size_t)) {
+	if(count == 0u) {
+		return;
+	}
+
+	grain = std::max<std::size_t>(grain, 1u);
+	auto nRanges = (count + grain - 1) / grain;
+
+	// Shared with the helper tasks since they might only get executed
+	// after we returned (when the calling thread already processed
+	// all ranges). They only access 'func' while they own a range.
+	struct State {
+		std::atomic<std::size_t> next {0u};
+		std::atomic<std::size_t> done {0u};
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::exception_ptr error;
+	};
+
+	auto state = std::make_shared<State>();
+	auto work = [=](State& s) {
+		while(true) {
+			auto range = s.next.fetch_add(1u);
+			if(range >= nRanges) {
+				return;
+			}
+
+			auto begin = range * grain;
+			auto end = std::min(begin + grain, count);
+			try {
+				call(func, begin, end);
+			} catch(...) {
+				auto lock = std::lock_guard(s.mutex);
+				if(!s.error) {
+					s.error = std::current_exception();
+				}
+			}
+
+			if(s.done.fetch_add(1u) + 1 == nRanges) {
+				auto lock = std::lock_guard(s.mutex);
+				s.cv.notify_all();
+			}
+		}
+	};
+
+	auto nHelpers = std::min<std::size_t>(pool.numWorkers(), nRanges - 1);
+	for(auto i = 0u; i < nHelpers; ++i) {
+		pool.add([state, work]{ work(*state); });
+	}
+
+	work(*state);
+
+	auto lock = std::unique_lock(state->mutex);
+	state->cv.wait(lock, [&]{ return state->done.load() == nRanges; });
+	if(state->error) {
+		std::rethrow_exception(state->error);
+	}
+}
+
+} // namespace detail
 } // namespace tkn
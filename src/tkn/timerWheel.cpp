@@ -0,0 +1,211 @@
+#include <tkn/timerWheel.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+
+namespace tkn {
+
+TimerWheel::TimerWheel(Clock::duration tick, Clock::time_point start) :
+		start_(start), tick_(tick) {
+	dlg_assert(tick.count() > 0);
+	slots_.fill(invalid);
+}
+
+TimerWheel::TimerID TimerWheel::add(Clock::time_point expiry, Function<void()> func) {
+	dlg_assert(func);
+
+	std::uint32_t id;
+	if(!free_.empty()) {
+		id = free_.back();
+		free_.pop_back();
+	} else {
+		id = timers_.size();
+		timers_.emplace_back();
+	}
+
+	// round up, timers must never fire early.
+	// Timers that are already expired fire on the next tick, we already
+	// handled the current one.
+	auto ticks = std::uint64_t(0u);
+	if(expiry > start_) {
+		ticks = (expiry - start_ + tick_ - Clock::duration(1)) / tick_;
+	}
+
+	auto& timer = timers_[id];
+	timer.expiry = std::max(ticks, now_ + 1);
+	timer.func = std::move(func);
+	insert(id);
+	++count_;
+
+	return (std::uint64_t(timer.generation) << 32u) | id;
+}
+
+bool TimerWheel::cancel(TimerID tid) {
+	auto id = std::uint32_t(tid & 0xFFFFFFFFu);
+	auto generation = std::uint32_t(tid >> 32u);
+	if(id >= timers_.size()) {
+		return false;
+	}
+
+	auto& timer = timers_[id];
+	if(timer.generation != generation || timer.slot == invalid) {
+		return false;
+	}
+
+	unlink(id);
+	timer.func = {};
+	++timer.generation;
+	free_.push_back(id);
+	--count_;
+	return true;
+}
+
+void TimerWheel::insert(std::uint32_t id) {
+	auto& timer = timers_[id];
+	dlg_assert(timer.expiry >= now_);
+
+	// Find the first level that covers the remaining time. Timers
+	// beyond the range of the highest level are put into its last
+	// slot and simply cascaded again later on.
+	auto delta = timer.expiry - now_;
+	auto level = 0u;
+	while(level + 1 < levelCount && delta >= (std::uint64_t(1u) << (slotBits * (level + 1)))) {
+		++level;
+	}
+
+	auto shift = slotBits * level;
+	auto slotTick = timer.expiry >> shift;
+	auto maxTick = (now_ >> shift) + slotCount;
+	slotTick = std::min(slotTick, maxTick);
+
+	auto slot = level * slotCount + (slotTick & (slotCount - 1));
+	auto& head = slots_[slot];
+	timer.slot = slot;
+	timer.prev = invalid;
+	timer.next = head;
+	if(head != invalid) {
+		timers_[head].prev = id;
+	}
+
+	head = id;
+}
+
+void TimerWheel::unlink(std::uint32_t id) {
+	auto& timer = timers_[id];
+	dlg_assert(timer.slot != invalid);
+
+	if(timer.prev != invalid) {
+		timers_[timer.prev].next = timer.next;
+	} else {
+		slots_[timer.slot] = timer.next;
+	}
+
+	if(timer.next != invalid) {
+		timers_[timer.next].prev = timer.prev;
+	}
+
+	timer.prev = timer.next = timer.slot = invalid;
+}
+
+void TimerWheel::cascade(unsigned level) {
+	auto shift = slotBits * level;
+	auto slot = level * slotCount + ((now_ >> shift) & (slotCount - 1));
+
+	// Re-insert all timers of the slot. They will end up in a lower
+	// level (or the same level in a later slot for the timers
+	// that were clamped into the last slot of the highest level).
+	auto id = slots_[slot];
+	slots_[slot] = invalid;
+	while(id != invalid) {
+		auto next = timers_[id].next;
+		timers_[id].slot = invalid;
+		insert(id);
+		id = next;
+	}
+}
+
+unsigned TimerWheel::advance(Clock::time_point now) {
+	if(now < start_) {
+		return 0u;
+	}
+
+	auto target = std::uint64_t((now - start_) / tick_);
+	auto fired = 0u;
+	while(now_ < target) {
+		// skip all ticks in which nothing happens
+		auto next = nextTick();
+		if(next > target) {
+			now_ = target;
+			break;
+		}
+
+		now_ = next;
+
+		// cascade higher levels down when the lower level wrapped
+		for(auto l = 1u; l < levelCount; ++l) {
+			auto mask = (std::uint64_t(1u) << (slotBits * l)) - 1;
+			if((now_ & mask) != 0u) {
+				break;
+			}
+
+			cascade(l);
+		}
+
+		// fire all timers in the current level 0 slot.
+		// Pop them one-by-one since the callbacks might cancel
+		// other timers in the same slot.
+		auto& head = slots_[now_ & (slotCount - 1)];
+		while(head != invalid) {
+			auto id = head;
+			auto& timer = timers_[id];
+			dlg_assert(timer.expiry == now_);
+			unlink(id);
+
+			auto func = std::move(timer.func);
+			timer.func = {};
+			++timer.generation;
+			free_.push_back(id);
+			--count_;
+			++fired;
+
+			// might add timers, invalidating the timer reference
+			func();
+		}
+	}
+
+	return fired;
+}
+
+std::uint64_t TimerWheel::nextTick() const {
+	if(count_ == 0u) {
+		return std::uint64_t(-1);
+	}
+
+	// For every level, find the first non-empty slot in the future.
+	// For level 0 this is the exact expiration tick, for the higher
+	// levels the tick at which the slot will be cascaded.
+	auto next = std::uint64_t(-1);
+	for(auto l = 0u; l < levelCount; ++l) {
+		auto shift = slotBits * l;
+		auto base = now_ >> shift;
+		for(auto i = 1u; i <= slotCount; ++i) {
+			auto slotTick = base + i;
+			if(slots_[l * slotCount + (slotTick & (slotCount - 1))] != invalid) {
+				next = std::min(next, slotTick << shift);
+				break;
+			}
+		}
+	}
+
+	dlg_assert(next != std::uint64_t(-1));
+	return next;
+}
+
+std::optional<TimerWheel::Clock::time_point> TimerWheel::nextExpiry() const {
+	if(count_ == 0u) {
+		return std::nullopt;
+	}
+
+	return start_ + tick_ * nextTick();
+}
+
+} // namespace tkn
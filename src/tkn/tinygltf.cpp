@@ -224,8 +224,18 @@ bool Asset::operator==(const Asset &other) const {
          this->minVersion == other.minVersion && this->version == other.version;
 }
 bool Buffer::operator==(const Buffer &other) const {
-  return this->data == other.data && this->extras == other.extras &&
-         this->name == other.name && this->uri == other.uri;
+  // for tkn: compare the effective contents, mapped or owned
+  auto bytes = [](const Buffer &buf) {
+    return buf.mappedData ? std::make_pair(buf.mappedData, buf.mappedSize)
+                          : std::make_pair(buf.data.data(), buf.data.size());
+  };
+  auto a = bytes(*this);
+  auto b = bytes(other);
+  return a.second == b.second &&
+         (a.first == b.first || a.second == 0 ||
+          memcmp(a.first, b.first, a.second) == 0) &&
+         this->extras == other.extras && this->name == other.name &&
+         this->uri == other.uri;
 }
 bool BufferView::operator==(const BufferView &other) const {
   return this->buffer == other.buffer && this->byteLength == other.byteLength &&